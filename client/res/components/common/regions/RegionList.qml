@@ -41,7 +41,7 @@ Item {
   //: describe the scroll bar for the region list.)
   property string regionListLabel: uiTranslate("RegionListView", "Region list")
 
-  property alias regionFilter: regionListView.regionFilter
+  property alias serviceFilter: regionListView.serviceFilter
   property alias serviceLocations: regionListView.serviceLocations
   property alias portForwardEnabled: regionListView.portForwardEnabled
   property alias canFavorite: regionListView.canFavorite
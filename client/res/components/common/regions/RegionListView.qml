@@ -27,6 +27,8 @@ import "../../settings/stores"
 import "qrc:/javascript/keyutil.js" as KeyUtil
 import "qrc:/javascript/util.js" as Util
 import PIA.NativeAcc 1.0 as NativeAcc
+import PIA.NativeDaemon 1.0
+import PIA.RegionListModel 1.0
 
 // RegionListView is used to select a region from the list of available regions.
 // It's used to select the VPN region, as well as the Shadowsocks region.
@@ -47,9 +49,9 @@ Rectangle {
 
   // Customization properties
 
-  // Specify a function used to filter regions.  The functor is passed a
-  // ServerLocation and returns true/false to include or exclude a region.
-  property var regionFilter
+  // Only display regions offering a particular service - see
+  // RegionListModel.serviceFilter.  Empty displays all regions.
+  property string serviceFilter
 
   // The service locations for this list view - includes best/chosen locations
   property var serviceLocations
@@ -74,6 +76,24 @@ Rectangle {
 
   color: Theme.dashboard.backgroundColor
 
+  // The country groups and single regions, maintained natively so latency
+  // updates only update the affected rows rather than rebuilding the list.
+  RegionListModel {
+    id: regionListModel
+    daemonState: NativeDaemon.state
+    daemonData: NativeDaemon.data
+    language: Client.settings.language
+    serviceFilter: regionListView.serviceFilter
+  }
+
+  RegionFilterModel {
+    id: regionFilterModel
+    regions: regionListModel
+    searchTerm: regionListView.searchTerm
+    sortKey: regionListView.sortKey.currentValue
+    locale: Client.state.activeLanguage.locale
+  }
+
   // Keyboard navigation in the regions list acts like a table.  The user can
   // focus the whole list, then use the arrow keys to navigate the regions.
   //
@@ -228,11 +248,11 @@ Rectangle {
           }
           Repeater {
             id: regionsRepeater
-            model: displayRegionsArray
+            model: regionFilterModel
             delegate: RegionDelegate {
-              region: modelData.region
-              regionCountry: modelData.regionCountry
-              regionChildren: modelData.regionChildren
+              region: model.region
+              regionCountry: model.regionCountry
+              regionChildren: model.regionChildren
               portForwardEnabled: regionListView.portForwardEnabled
               serviceLocations: regionListView.serviceLocations
               canFavorite: regionListView.canFavorite
@@ -439,14 +459,17 @@ Rectangle {
   function filterDedicatedIps() {
     var dedicatedIps = Daemon.state.dedicatedIpLocations
 
-    if(!searchTerm && !regionFilter)
+    if(!searchTerm && !serviceFilter)
       return dedicatedIps
 
     var filteredDedicatedIps = dedicatedIps
 
-    // Filter with the region filter if there is one
-    if(regionFilter)
-      filteredDedicatedIps = filteredDedicatedIps.filter(regionFilter)
+    // Filter by service if needed
+    if(serviceFilter) {
+      filteredDedicatedIps = filteredDedicatedIps.filter(function(dip) {
+        return regionListModel.locationMatchesServiceFilter(dip.id)
+      })
+    }
 
     // Filter by the search term if present
     if(searchTerm) {
@@ -458,67 +481,10 @@ Rectangle {
     return filteredDedicatedIps
   }
 
-  // Filter the 'countries' object from DaemonState.groupedLocations,
-  // which is an array of CountryLocations (which has a 'locations' property,
-  // which is an array of locations).
-  //
-  // - Single regions or regions in a group are included if the region name
-  //   contains the search string
-  // - An entire group is included if the group name contains the search string
-  function filterCountryLocations() {
-    var countries = Daemon.state.groupedLocations
-    if(!searchTerm && !regionFilter)
-      return countries
-
-    var filteredCountries = []
-    for(var i=0; i<countries.length; ++i) {
-      // Filter the locations in this country using the region filter.  This
-      // could cause a country group to become a single location (which affects
-      // the search term matching below)
-      var filteredLocations = countries[i].locations
-      if(regionFilter)
-        filteredLocations = filteredLocations.filter(regionFilter)
-
-      if(filteredLocations.length <= 0)
-        continue  // Nothing to display in this country
-
-      // If the country contains exactly one region, just include it if the
-      // region's name matches.  Don't look at the country name, because we
-      // don't display it for single regions.
-      if(filteredLocations.length === 1) {
-        if(matchesSearchTerm(Daemon.getLocationName(filteredLocations[0])))
-          filteredCountries.push({locations: filteredLocations})
-      }
-      // The country contains more than one region.  If the country name
-      // matches, include everything.
-      else if(matchesSearchTerm(Daemon.getCountryName(filteredLocations[0].country)))
-        filteredCountries.push({locations: filteredLocations})
-      // The country has more than one region, and the country name doesn't
-      // match.  Filter the individual regions.
-      else {
-        var filteredRegions = filteredLocations.filter(function(loc) {
-          return matchesSearchTerm(Daemon.getLocationName(loc))
-        })
-        // If at least one region matched, include the country with the filtered
-        // regions
-        if(filteredRegions.length > 0)
-          filteredCountries.push({locations: filteredRegions})
-      }
-    }
-
-    return filteredCountries
-  }
-
   function localeCompareRegions(first, second) {
     return first.localeCompare(second, Client.state.activeLanguage.locale)
   }
 
-  function countrySortName(country) {
-    if(country.locations.length === 1)
-      return Daemon.getLocationName(country.locations[0]).toLowerCase()
-    return Daemon.getCountryName(country.locations[0].country).toLowerCase()
-  }
-
   function sortLocations(locations) {
     var sortedLocations = locations.slice()
     sortedLocations.sort(function(first, second) {
@@ -538,60 +504,6 @@ Rectangle {
     return sortedLocations
   }
 
-  // Sort the (possibly filtered) country locations by name.
-  function sortCountriesByName(countries) {
-    // Sort the country groups by either the country name or single-region name.
-    // Sort a copy of the array because this could be the actual array from
-    // DaemonState.
-    countries = countries.slice()
-    countries.sort(function(first, second) {
-      return localeCompareRegions(countrySortName(first), countrySortName(second))
-    })
-
-    // Sort each country's regions
-    for(var i=0; i<countries.length; ++i) {
-      // Create new country objects, because these could still be the actual
-      // objects from DaemonState.  sortLocations() creates a new array with the
-      // sorted locations.
-      countries[i] = {locations: sortLocations(countries[i].locations)}
-    }
-
-    return countries
-  }
-
-  // Build an array of regions from the country map.
-  function buildRegionArray(countries) {
-    var result = []
-    for(var i=0; i<countries.length; ++i) {
-      var rlist = countries[i].locations
-      var countryId = rlist[0].country.toLowerCase()
-      // Single location
-      if (rlist.length === 1) {
-        result.push({
-                      region: rlist[0],
-                      regionCountry: countryId,
-                      regionChildren: []
-                    })
-      }
-      // Group of locations in a country
-      else {
-        var subregions = rlist.map(function(rgn) {
-          return {
-            subregion: rgn
-          }});
-
-        // Country groups have a null region (they don't represent a single
-        // location).
-        result.push({
-                      region: null,
-                      regionCountry: countryId,
-                      regionChildren: subregions
-                    })
-      }
-    }
-    return result
-  }
-
   property var displayDedicatedIpsArray: {
     // Get the filtered dedicated IP locations
     var dedicatedIps = filterDedicatedIps()
@@ -603,27 +515,6 @@ Rectangle {
     return dedicatedIps
   }
 
-  // The array of country groups and single regions used as the model for the
-  // regions repeater.
-  //
-  // This consists of objects with the following properties:
-  // - region: null for a country group, or a Location object for a single region
-  // - regionCountry: country code for the group or location
-  // - regionChildren: array of {subregion: <Location>} objects for a country
-  //   group, or empty array for a single region
-  property var displayRegionsArray: {
-    // Get the filtered country locations
-    var countries = filterCountryLocations()
-
-    // If sorting by name, re-sort the countries and their locations.
-    // (If sorting by latency, Daemon has already sorted them.)
-    if(sortKey.currentValue === "name")
-      countries = sortCountriesByName(countries)
-
-    // Build the actual model into a list with children
-    return buildRegionArray(countries)
-  }
-
   // Build a flat tabular representation of the contents that we use for
   // accessibility.  Keyboard navigation uses this, and screen reader
   // representation probably will too.  (The heirarchical representation is
@@ -664,14 +555,12 @@ Rectangle {
                 regionItem: regionAuto})
 
     // The accessibility table is built from the actual items that represent the
-    // regions, not the displayRegionsArray, so it can include references to the
-    // row items.  These are used to build the accessibility elements in
+    // regions, not the region model, so it can include references to the row
+    // items.  These are used to build the accessibility elements in
     // NativeAcc.Table.rows.
     //
-    // This also gives it a good way to access regionItem.expanded (which stores
-    // the 'expanded' state, although this should probably move out of the items
-    // themselves eventually, since this causes it to reset whenever the array
-    // is rebuilt.
+    // This also gives it a good way to access regionItem.expanded (which is
+    // determined by the collapsed countries setting).
 
     var i;
     for(i=0; i<dedicatedIpsRepeater.count; ++i) {
@@ -360,16 +360,8 @@ Page {
       id: shadowsocksRegionList
       width: parent.width
       implicitHeight: 450
-      regionFilter: function (serverLocation) {
-        // Show regions that have at least one shadowsocks server
-        for (var i = 0; i < serverLocation.servers.length; ++i) {
-          if (serverLocation.servers[i].shadowsocksPorts.length > 0
-              && serverLocation.servers[i].shadowsocksKey
-              && serverLocation.servers[i].shadowsocksCipher)
-            return true
-        }
-        return false
-      }
+      // Show regions that have at least one shadowsocks server
+      serviceFilter: "shadowsocks"
       // Don't use shadowsocksLocations directly since the chosen location
       // isn't applied until the user clicks OK
       property var chosenLocation
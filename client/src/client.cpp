@@ -33,6 +33,7 @@
 #include "windowmaxsize.h"
 #include "clipboard.h"
 #include "flexvalidator.h"
+#include "regionlistmodel.h"
 #include "path_interface.h"
 #include "semversion.h"
 #include "version.h"
@@ -579,6 +580,8 @@ Client::Client(bool hasExistingSettingsFile, const QJsonObject &initialSettings,
     qmlRegisterType<FocusCue>("PIA.FocusCue", 1, 0, "FocusCue");
     qmlRegisterType<DragHandle>("PIA.DragHandle", 1, 0, "DragHandle");
     qmlRegisterType<FlexValidator>("PIA.FlexValidator", 1, 0, "FlexValidator");
+    qmlRegisterType<RegionListModel>("PIA.RegionListModel", 1, 0, "RegionListModel");
+    qmlRegisterType<RegionFilterModel>("PIA.RegionListModel", 1, 0, "RegionFilterModel");
 
     qmlRegisterSingletonType<DaemonInterface>("PIA.NativeDaemon", 1, 0, "NativeDaemon",
         [](auto, auto) -> QObject* {return &Client::instance()->_daemonInterface;});
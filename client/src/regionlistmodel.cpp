@@ -0,0 +1,550 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("regionlistmodel.cpp")
+
+#include "regionlistmodel.h"
+#include <QJsonObject>
+#include <algorithm>
+#include <unordered_set>
+
+namespace
+{
+    // Compare locations by value - the daemon sends new objects with each
+    // update, so the pointers always differ.
+    bool sameLocations(const std::vector<QSharedPointer<Location>> &first,
+                       const std::vector<QSharedPointer<Location>> &second)
+    {
+        return std::equal(first.begin(), first.end(), second.begin(), second.end(),
+                          &compareLocationsValue);
+    }
+
+    QVariantList buildLocationValues(const std::vector<QSharedPointer<Location>> &locations)
+    {
+        QVariantList values;
+        values.reserve(static_cast<int>(locations.size()));
+        for(const auto &pLocation : locations)
+            values.push_back(RegionListModel::locationValue(pLocation));
+        return values;
+    }
+}
+
+RegionListModel::RegionListModel(QObject *pParent)
+    : QAbstractListModel{pParent}
+{
+}
+
+bool RegionListModel::matchesServiceFilter(const Location &location) const
+{
+    if(_serviceFilter.isEmpty())
+        return true;
+    if(_serviceFilter == QStringLiteral("shadowsocks"))
+    {
+        // A server is only usable for Shadowsocks if it has the key and cipher
+        // too
+        return std::any_of(location.servers().begin(), location.servers().end(),
+            [](const Server &server)
+            {
+                return server.hasService(Service::Shadowsocks) &&
+                    !server.shadowsocksKey().isEmpty() &&
+                    !server.shadowsocksCipher().isEmpty();
+            });
+    }
+    qWarning() << "Unknown service filter:" << _serviceFilter;
+    return true;
+}
+
+QString RegionListModel::translateName(const QString &name) const
+{
+    if(!_pDaemonData)
+        return name;
+    const auto &translations = _pDaemonData->modernRegionMeta()
+        .value(QStringLiteral("translations")).toObject();
+    const auto &translated = translations.value(name).toObject()
+        .value(_language).toString();
+    return translated.isEmpty() ? name : translated;
+}
+
+void RegionListModel::translateRow(Row &row) const
+{
+    // Like Daemon.getCountryName(), fall back to the capitalized country code
+    // if the country name isn't known
+    QString countryName;
+    if(_pDaemonData)
+    {
+        countryName = _pDaemonData->modernRegionMeta()
+            .value(QStringLiteral("country_groups")).toObject()
+            .value(row.country).toString();
+    }
+    row.countryName = countryName.isEmpty() ? row.country.toUpper() : translateName(countryName);
+
+    row.locationNames.clear();
+    row.locationNames.reserve(static_cast<int>(row.locations.size()));
+    for(const auto &pLocation : row.locations)
+        row.locationNames.push_back(translateName(pLocation->name()));
+}
+
+void RegionListModel::updateRows()
+{
+    std::vector<Row> newRows;
+    if(_pDaemonState)
+    {
+        const auto &countries = _pDaemonState->groupedLocations();
+        newRows.reserve(countries.size());
+        for(const auto &country : countries)
+        {
+            Row row;
+            for(const auto &pLocation : country.locations())
+            {
+                if(pLocation && matchesServiceFilter(*pLocation))
+                    row.locations.push_back(pLocation);
+            }
+            if(row.locations.empty())
+                continue;   // Nothing to display in this country
+            row.country = row.locations.front()->country().toLower();
+            translateRow(row);
+            newRows.push_back(std::move(row));
+        }
+    }
+
+    applyRows(std::move(newRows));
+}
+
+void RegionListModel::applyRows(std::vector<Row> newRows)
+{
+    // Remove rows for countries that no longer exist
+    std::unordered_set<QString> newCountries;
+    for(const auto &newRow : newRows)
+        newCountries.insert(newRow.country);
+    for(int i = static_cast<int>(_rows.size()) - 1; i >= 0; --i)
+    {
+        if(newCountries.count(row(i).country) == 0)
+        {
+            beginRemoveRows({}, i, i);
+            _rows.erase(_rows.begin() + i);
+            endRemoveRows();
+        }
+    }
+
+    // Rows before i are now in their final positions.  Each remaining row is
+    // either moved up to position i, or inserted if it's new.
+    for(std::size_t i = 0; i < newRows.size(); ++i)
+    {
+        Row &newRow = newRows[i];
+        int idx = static_cast<int>(i);
+        auto itExisting = std::find_if(_rows.begin() + idx, _rows.end(),
+            [&](const Row &existing){return existing.country == newRow.country;});
+
+        if(itExisting == _rows.end())
+        {
+            newRow.locationValues = buildLocationValues(newRow.locations);
+            beginInsertRows({}, idx, idx);
+            _rows.insert(_rows.begin() + idx, std::move(newRow));
+            endInsertRows();
+            continue;
+        }
+
+        int existingIdx = static_cast<int>(itExisting - _rows.begin());
+        if(existingIdx != idx)
+        {
+            // Moving up, so the destination (the row it's moved before) is
+            // just idx
+            beginMoveRows({}, existingIdx, existingIdx, {}, idx);
+            std::rotate(_rows.begin() + idx, itExisting, itExisting + 1);
+            endMoveRows();
+        }
+
+        Row &existing = _rows[i];
+        bool locationsChanged = !sameLocations(existing.locations, newRow.locations);
+        bool changed = locationsChanged ||
+            existing.countryName != newRow.countryName ||
+            existing.locationNames != newRow.locationNames;
+        // The values only depend on the locations, keep them if those are the
+        // same
+        if(locationsChanged)
+            newRow.locationValues = buildLocationValues(newRow.locations);
+        else
+            newRow.locationValues = std::move(existing.locationValues);
+        // Take the new row even if it's unchanged to keep the current objects
+        existing = std::move(newRow);
+        if(changed)
+            emit dataChanged(index(idx), index(idx));
+    }
+
+    Q_ASSERT(_rows.size() == newRows.size());
+}
+
+void RegionListModel::updateNames()
+{
+    if(_rows.empty())
+        return;
+    for(auto &existing : _rows)
+        translateRow(existing);
+    emit dataChanged(index(0), index(static_cast<int>(_rows.size()) - 1));
+}
+
+void RegionListModel::setDaemonState(QObject *pDaemonState)
+{
+    if(pDaemonState == _pDaemonState)
+        return;
+
+    if(_pDaemonState)
+        disconnect(_pDaemonState, nullptr, this, nullptr);
+    _pDaemonState = dynamic_cast<DaemonState*>(pDaemonState);
+    if(pDaemonState && !_pDaemonState)
+        qWarning() << "Object given for daemonState is not a DaemonState:" << pDaemonState;
+    if(_pDaemonState)
+    {
+        connect(_pDaemonState, &DaemonState::groupedLocationsChanged, this,
+                &RegionListModel::updateRows);
+    }
+    updateRows();
+    emit daemonStateChanged();
+}
+
+void RegionListModel::setDaemonData(QObject *pDaemonData)
+{
+    if(pDaemonData == _pDaemonData)
+        return;
+
+    if(_pDaemonData)
+        disconnect(_pDaemonData, nullptr, this, nullptr);
+    _pDaemonData = dynamic_cast<DaemonData*>(pDaemonData);
+    if(pDaemonData && !_pDaemonData)
+        qWarning() << "Object given for daemonData is not a DaemonData:" << pDaemonData;
+    if(_pDaemonData)
+    {
+        connect(_pDaemonData, &DaemonData::modernRegionMetaChanged, this,
+                &RegionListModel::updateNames);
+    }
+    updateNames();
+    emit daemonDataChanged();
+}
+
+void RegionListModel::setLanguage(const QString &language)
+{
+    if(language == _language)
+        return;
+    _language = language;
+    updateNames();
+    emit languageChanged();
+}
+
+void RegionListModel::setServiceFilter(const QString &serviceFilter)
+{
+    if(serviceFilter == _serviceFilter)
+        return;
+    _serviceFilter = serviceFilter;
+    updateRows();
+    emit serviceFilterChanged();
+}
+
+bool RegionListModel::locationMatchesServiceFilter(const QString &locationId) const
+{
+    if(!_pDaemonState)
+        return false;
+    const auto &locations = _pDaemonState->availableLocations();
+    auto itLocation = locations.find(locationId);
+    if(itLocation == locations.end() || !itLocation->second)
+        return false;
+    return matchesServiceFilter(*itLocation->second);
+}
+
+QVariant RegionListModel::locationValue(const QSharedPointer<Location> &pLocation)
+{
+    if(!pLocation)
+        return QVariant::fromValue(nullptr);
+    return pLocation->toJsonObject();
+}
+
+int RegionListModel::rowCount(const QModelIndex &parent) const
+{
+    // This is a list, only the root has children
+    if(parent.isValid())
+        return 0;
+    return static_cast<int>(_rows.size());
+}
+
+QVariant RegionListModel::data(const QModelIndex &index, int role) const
+{
+    if(!index.isValid() || index.row() < 0 || index.row() >= rowCount())
+        return {};
+
+    const Row &modelRow = row(index.row());
+    switch(role)
+    {
+        case RegionRole:
+            if(modelRow.locations.size() == 1)
+                return modelRow.locationValues.front();
+            return QVariant::fromValue(nullptr);
+        case RegionCountryRole:
+            return modelRow.country;
+        case RegionChildrenRole:
+        {
+            QVariantList children;
+            if(modelRow.locations.size() > 1)
+            {
+                children.reserve(modelRow.locationValues.size());
+                for(const auto &value : modelRow.locationValues)
+                    children.push_back(QVariantMap{{QStringLiteral("subregion"), value}});
+            }
+            return children;
+        }
+        default:
+            return {};
+    }
+}
+
+QHash<int, QByteArray> RegionListModel::roleNames() const
+{
+    return {
+        {RegionRole, QByteArrayLiteral("region")},
+        {RegionCountryRole, QByteArrayLiteral("regionCountry")},
+        {RegionChildrenRole, QByteArrayLiteral("regionChildren")}
+    };
+}
+
+RegionFilterModel::RegionFilterModel(QObject *pParent)
+    : QSortFilterProxyModel{pParent}, _sortKey{QStringLiteral("latency")}
+{
+    // The filter and sort depend on the whole row, not a particular role or
+    // column.  Source data changes (latency updates) refilter and resort only
+    // the affected rows.
+    setDynamicSortFilter(true);
+    _collator.setCaseSensitivity(Qt::CaseInsensitive);
+}
+
+bool RegionFilterModel::matchesSearchTerm(const QString &name) const
+{
+    return name.contains(_searchTerm, Qt::CaseInsensitive);
+}
+
+auto RegionFilterModel::buildVisibleRow(int sourceRow) const -> VisibleRow
+{
+    VisibleRow visibleRow;
+    if(!_pRegions || sourceRow < 0 || sourceRow >= _pRegions->rowCount())
+        return visibleRow;
+
+    const auto &modelRow = _pRegions->row(sourceRow);
+    const auto &names = modelRow.locationNames;
+    auto &visible = visibleRow.locations;
+    // Single regions only match their own name, since the country name isn't
+    // displayed.  Groups match entirely if the country name matches.
+    bool allMatch = _searchTerm.isEmpty() ||
+        (modelRow.locations.size() > 1 && matchesSearchTerm(modelRow.countryName));
+    for(std::size_t i = 0; i < modelRow.locations.size(); ++i)
+    {
+        if(allMatch || matchesSearchTerm(names.value(static_cast<int>(i))))
+            visible.push_back(i);
+    }
+
+    if(sortByName())
+    {
+        std::stable_sort(visible.begin(), visible.end(),
+            [&](std::size_t first, std::size_t second)
+            {
+                return _collator.compare(names.value(static_cast<int>(first)),
+                                         names.value(static_cast<int>(second))) < 0;
+            });
+    }
+
+    if(visible.size() == 1)
+        visibleRow.sortName = names.value(static_cast<int>(visible.front()));
+    else
+        visibleRow.sortName = modelRow.countryName;
+    return visibleRow;
+}
+
+auto RegionFilterModel::visibleRow(int sourceRow) const -> const VisibleRow &
+{
+    static const VisibleRow empty{};
+    if(sourceRow < 0 || static_cast<std::size_t>(sourceRow) >= _visibleRows.size())
+        return empty;
+    return _visibleRows[static_cast<std::size_t>(sourceRow)];
+}
+
+void RegionFilterModel::updateVisibleRows(int first, int last)
+{
+    for(int i = first; i <= last; ++i)
+    {
+        if(i >= 0 && static_cast<std::size_t>(i) < _visibleRows.size())
+            _visibleRows[static_cast<std::size_t>(i)] = buildVisibleRow(i);
+    }
+}
+
+void RegionFilterModel::rebuildVisibleRows()
+{
+    _visibleRows.clear();
+    if(_pRegions)
+    {
+        _visibleRows.resize(static_cast<std::size_t>(_pRegions->rowCount()));
+        updateVisibleRows(0, _pRegions->rowCount() - 1);
+    }
+}
+
+void RegionFilterModel::onSourceDataChanged(const QModelIndex &topLeft,
+                                            const QModelIndex &bottomRight)
+{
+    updateVisibleRows(topLeft.row(), bottomRight.row());
+}
+
+void RegionFilterModel::onSourceRowsInserted(const QModelIndex &, int first, int last)
+{
+    _visibleRows.insert(_visibleRows.begin() + first,
+                        static_cast<std::size_t>(last - first + 1), VisibleRow{});
+    updateVisibleRows(first, last);
+}
+
+void RegionFilterModel::onSourceRowsRemoved(const QModelIndex &, int first, int last)
+{
+    _visibleRows.erase(_visibleRows.begin() + first, _visibleRows.begin() + last + 1);
+}
+
+void RegionFilterModel::onSourceRowsMoved(const QModelIndex &, int start, int end,
+                                          const QModelIndex &, int row)
+{
+    // 'row' is the row the moved rows are placed before (in the original
+    // positions)
+    auto itBegin = _visibleRows.begin();
+    if(row < start)
+        std::rotate(itBegin + row, itBegin + start, itBegin + end + 1);
+    else
+        std::rotate(itBegin + start, itBegin + end + 1, itBegin + row);
+}
+
+void RegionFilterModel::refresh()
+{
+    rebuildVisibleRows();
+    invalidate();
+    // Sort by name, or keep the source order when sorting by latency
+    sort(sortByName() ? 0 : -1);
+    // The region/children data depend on the filter and sort too
+    if(rowCount() > 0)
+    {
+        emit dataChanged(index(0, 0), index(rowCount() - 1, 0),
+                         {RegionListModel::RegionRole, RegionListModel::RegionChildrenRole});
+    }
+}
+
+void RegionFilterModel::setRegions(RegionListModel *pRegions)
+{
+    if(pRegions == _pRegions)
+        return;
+
+    // This also disconnects QSortFilterProxyModel from the old model, which is
+    // fine since setSourceModel() is about to replace it
+    if(_pRegions)
+        disconnect(_pRegions, nullptr, this, nullptr);
+    _pRegions = pRegions;
+    // Connect before setSourceModel() so these are called before
+    // QSortFilterProxyModel's handlers for the same signals
+    if(_pRegions)
+    {
+        connect(_pRegions, &QAbstractItemModel::dataChanged, this,
+                &RegionFilterModel::onSourceDataChanged);
+        connect(_pRegions, &QAbstractItemModel::rowsInserted, this,
+                &RegionFilterModel::onSourceRowsInserted);
+        connect(_pRegions, &QAbstractItemModel::rowsRemoved, this,
+                &RegionFilterModel::onSourceRowsRemoved);
+        connect(_pRegions, &QAbstractItemModel::rowsMoved, this,
+                &RegionFilterModel::onSourceRowsMoved);
+        connect(_pRegions, &QAbstractItemModel::modelReset, this,
+                &RegionFilterModel::rebuildVisibleRows);
+    }
+    rebuildVisibleRows();
+    setSourceModel(pRegions);
+    refresh();
+    emit regionsChanged();
+}
+
+void RegionFilterModel::setSearchTerm(const QString &searchTerm)
+{
+    if(searchTerm == _searchTerm)
+        return;
+    _searchTerm = searchTerm;
+    refresh();
+    emit searchTermChanged();
+}
+
+void RegionFilterModel::setSortKey(const QString &sortKey)
+{
+    if(sortKey == _sortKey)
+        return;
+    _sortKey = sortKey;
+    refresh();
+    emit sortKeyChanged();
+}
+
+void RegionFilterModel::setLocale(const QString &locale)
+{
+    QLocale newLocale{locale};
+    if(newLocale == _collator.locale())
+        return;
+    _collator.setLocale(newLocale);
+    if(sortByName())
+        refresh();
+    emit localeChanged();
+}
+
+QVariant RegionFilterModel::data(const QModelIndex &index, int role) const
+{
+    if(!_pRegions || !index.isValid() ||
+       (role != RegionListModel::RegionRole && role != RegionListModel::RegionChildrenRole))
+    {
+        return QSortFilterProxyModel::data(index, role);
+    }
+
+    int sourceRow = mapToSource(index).row();
+    const auto &visible = visibleRow(sourceRow).locations;
+    const auto &modelRow = _pRegions->row(sourceRow);
+
+    // A group filtered down to one region is displayed as a single region
+    if(role == RegionListModel::RegionRole)
+    {
+        if(visible.size() == 1)
+            return modelRow.locationValues[static_cast<int>(visible.front())];
+        return QVariant::fromValue(nullptr);
+    }
+
+    QVariantList children;
+    if(visible.size() > 1)
+    {
+        children.reserve(static_cast<int>(visible.size()));
+        for(auto locationIdx : visible)
+        {
+            children.push_back(QVariantMap{{QStringLiteral("subregion"),
+                modelRow.locationValues[static_cast<int>(locationIdx)]}});
+        }
+    }
+    return children;
+}
+
+bool RegionFilterModel::filterAcceptsRow(int sourceRow, const QModelIndex &) const
+{
+    return !visibleRow(sourceRow).locations.empty();
+}
+
+bool RegionFilterModel::lessThan(const QModelIndex &left, const QModelIndex &right) const
+{
+    // Only used when sorting by name; ties keep the source (latency) order
+    int nameComp = _collator.compare(visibleRow(left.row()).sortName,
+                                     visibleRow(right.row()).sortName);
+    if(nameComp != 0)
+        return nameComp < 0;
+    return left.row() < right.row();
+}
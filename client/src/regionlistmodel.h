@@ -0,0 +1,242 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("regionlistmodel.h")
+
+#ifndef REGIONLISTMODEL_H
+#define REGIONLISTMODEL_H
+
+#include "settings/daemondata.h"
+#include "settings/daemonstate.h"
+#include <QAbstractListModel>
+#include <QCollator>
+#include <QPointer>
+#include <QSortFilterProxyModel>
+
+// RegionListModel provides the country groups and single regions from
+// DaemonState::groupedLocations as a list model for the regions list.  Each
+// row is one country, in the daemon's order (sorted by latency).
+//
+// When groupedLocations changes, the new rows are matched to the existing rows
+// by country.  Rows that changed (usually just latencies) emit dataChanged(),
+// and rows that changed position are moved with rowsMoved(), so the view keeps
+// its delegates (and their state, like expanded groups) instead of rebuilding
+// the whole list on every latency update.
+//
+// The translated country and region names are also computed here (from the
+// region metadata in DaemonData) so RegionFilterModel can search and sort by
+// them without doing that for each comparison.
+class RegionListModel : public QAbstractListModel
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("regionlistmodel")
+
+public:
+    enum Role : int
+    {
+        // The Location for a single region, or null for a country group
+        RegionRole = Qt::UserRole,
+        // The (lowercase) country code of the group or single region
+        RegionCountryRole,
+        // For a country group, an array of objects with a 'subregion' property
+        // containing each Location.  Empty for a single region.
+        RegionChildrenRole,
+    };
+
+    // One row in the model - the locations in a given country that pass the
+    // service filter (never empty).  If there is exactly one, the row is
+    // displayed as a single region, otherwise it's a country group.
+    struct Row
+    {
+        QString country;
+        std::vector<QSharedPointer<Location>> locations;
+        // Translated country name, and translated names of each location (same
+        // order as 'locations')
+        QString countryName;
+        QStringList locationNames;
+        // The value provided to QML for each location (same order as
+        // 'locations', see locationValue()).  Built when the row's locations
+        // change, not on each data() call.
+        QVariantList locationValues;
+    };
+
+public:
+    // The DaemonState providing groupedLocations (NativeDaemon.state)
+    Q_PROPERTY(QObject *daemonState READ daemonState WRITE setDaemonState NOTIFY daemonStateChanged)
+    // The DaemonData providing region translations (NativeDaemon.data)
+    Q_PROPERTY(QObject *daemonData READ daemonData WRITE setDaemonData NOTIFY daemonDataChanged)
+    // The current UI language, used to translate region names
+    Q_PROPERTY(QString language READ language WRITE setLanguage NOTIFY languageChanged)
+    // Only include regions offering this service.  Empty includes all regions;
+    // "shadowsocks" includes regions with at least one usable Shadowsocks
+    // server.
+    Q_PROPERTY(QString serviceFilter READ serviceFilter WRITE setServiceFilter NOTIFY serviceFilterChanged)
+
+public:
+    RegionListModel(QObject *pParent = nullptr);
+
+private:
+    bool matchesServiceFilter(const Location &location) const;
+    QString translateName(const QString &name) const;
+    void translateRow(Row &row) const;
+    // Rebuild the rows from groupedLocations and apply the differences
+    void updateRows();
+    // Apply new rows by removing, moving, inserting, and updating existing
+    // rows as needed
+    void applyRows(std::vector<Row> newRows);
+    // Retranslate all existing rows (the language or metadata changed)
+    void updateNames();
+
+public:
+    QObject *daemonState() const {return _pDaemonState;}
+    void setDaemonState(QObject *pDaemonState);
+    QObject *daemonData() const {return _pDaemonData;}
+    void setDaemonData(QObject *pDaemonData);
+    const QString &language() const {return _language;}
+    void setLanguage(const QString &language);
+    const QString &serviceFilter() const {return _serviceFilter;}
+    void setServiceFilter(const QString &serviceFilter);
+
+    // Check whether a location (by ID) satisfies the service filter.  Used
+    // by the regions list for dedicated IP regions, which aren't part of this
+    // model.
+    Q_INVOKABLE bool locationMatchesServiceFilter(const QString &locationId) const;
+
+    const Row &row(int index) const {return _rows[static_cast<std::size_t>(index)];}
+
+    // Convert a location to the JSON value provided to QML
+    static QVariant locationValue(const QSharedPointer<Location> &pLocation);
+
+    // QAbstractListModel overrides
+    virtual int rowCount(const QModelIndex &parent = {}) const override;
+    virtual QVariant data(const QModelIndex &index, int role) const override;
+    virtual QHash<int, QByteArray> roleNames() const override;
+
+signals:
+    void daemonStateChanged();
+    void daemonDataChanged();
+    void languageChanged();
+    void serviceFilterChanged();
+
+private:
+    QPointer<DaemonState> _pDaemonState;
+    QPointer<DaemonData> _pDaemonData;
+    QString _language;
+    QString _serviceFilter;
+    std::vector<Row> _rows;
+};
+
+// RegionFilterModel filters and sorts a RegionListModel for display, based on
+// the search term and the region sort key ("latency" or "name").
+//
+// - Single regions are included if the region name contains the search term
+// - A country group is included entirely if the country name contains the
+//   search term; otherwise only the regions with matching names are included.
+//   A group with only one matching region is displayed as a single region.
+//
+// When sorting by latency, the source model's order is kept (the daemon sorts
+// groupedLocations by latency), so no sorting is done here.  When sorting by
+// name, countries and the regions within them are sorted by their translated
+// names using the current locale.
+class RegionFilterModel : public QSortFilterProxyModel
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("regionlistmodel")
+
+public:
+    // The RegionListModel being filtered
+    Q_PROPERTY(RegionListModel *regions READ regions WRITE setRegions NOTIFY regionsChanged)
+    // The search term; empty includes all regions
+    Q_PROPERTY(QString searchTerm READ searchTerm WRITE setSearchTerm NOTIFY searchTermChanged)
+    // The region sort key from ClientSettings ("latency" or "name")
+    Q_PROPERTY(QString sortKey READ sortKey WRITE setSortKey NOTIFY sortKeyChanged)
+    // The locale used to sort by name (BCP 47 name, like "en-US")
+    Q_PROPERTY(QString locale READ locale WRITE setLocale NOTIFY localeChanged)
+
+public:
+    RegionFilterModel(QObject *pParent = nullptr);
+
+private:
+    // The displayed part of a source row.  filterAcceptsRow(), lessThan(),
+    // and data() are called many times for each row, so this is computed once
+    // for each source row when the filter or sort changes, or when the source
+    // row changes.
+    struct VisibleRow
+    {
+        // The indices of the locations that are displayed, in display order.
+        // Empty if the row is filtered out entirely.
+        std::vector<std::size_t> locations;
+        // The name used to sort the row - the country name for a group, or the
+        // region name for a single region (or a group filtered to one region)
+        QString sortName;
+    };
+
+private:
+    bool matchesSearchTerm(const QString &name) const;
+    bool sortByName() const {return _sortKey == QStringLiteral("name");}
+    VisibleRow buildVisibleRow(int sourceRow) const;
+    const VisibleRow &visibleRow(int sourceRow) const;
+    // Recompute the visible rows for source rows first-last
+    void updateVisibleRows(int first, int last);
+    // Recompute the visible rows for all source rows
+    void rebuildVisibleRows();
+    // Keep _visibleRows in sync with the source model.  These are connected
+    // before QSortFilterProxyModel's own connections, so the visible rows are
+    // up to date when it refilters and resorts the affected rows.
+    void onSourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+    void onSourceRowsInserted(const QModelIndex &parent, int first, int last);
+    void onSourceRowsRemoved(const QModelIndex &parent, int first, int last);
+    void onSourceRowsMoved(const QModelIndex &parent, int start, int end,
+                           const QModelIndex &destination, int row);
+    // Refilter and resort all rows after a change in the filter or sort key.
+    // Also updates the region/children data of all rows, which depends on
+    // both.
+    void refresh();
+
+public:
+    RegionListModel *regions() const {return _pRegions;}
+    void setRegions(RegionListModel *pRegions);
+    const QString &searchTerm() const {return _searchTerm;}
+    void setSearchTerm(const QString &searchTerm);
+    const QString &sortKey() const {return _sortKey;}
+    void setSortKey(const QString &sortKey);
+    QString locale() const {return _collator.locale().bcp47Name();}
+    void setLocale(const QString &locale);
+
+    // QSortFilterProxyModel overrides
+    virtual QVariant data(const QModelIndex &index, int role) const override;
+protected:
+    virtual bool filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const override;
+    virtual bool lessThan(const QModelIndex &left, const QModelIndex &right) const override;
+
+signals:
+    void regionsChanged();
+    void searchTermChanged();
+    void sortKeyChanged();
+    void localeChanged();
+
+private:
+    QPointer<RegionListModel> _pRegions;
+    QString _searchTerm;
+    QString _sortKey;
+    QCollator _collator;
+    // The visible part of each source row, indexed by source row
+    std::vector<VisibleRow> _visibleRows;
+};
+
+#endif
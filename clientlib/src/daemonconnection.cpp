@@ -20,6 +20,7 @@
 #line SOURCE_FILE("daemonconnection.cpp")
 
 #include "daemonconnection.h"
+#include "statepatch.h"
 
 DaemonConnection::DaemonConnection(QObject* parent)
     : QObject(parent)
@@ -114,9 +115,24 @@ void DaemonConnection::RPC_data(const QJsonObject &data)
     AssignObject(data);
     AssignObject(account);
     AssignObject(settings);
-    AssignObject(state);
 #undef AssignObject
 
+    // The large location properties are sent as patches; apply them in the
+    // same atomic change as the rest of the state (see StatePatch)
+    const auto &stateValue = data.value(QStringLiteral("state"));
+    const auto &statePatchValue = data.value(QStringLiteral("statePatch"));
+    if(statePatchValue.isObject())
+    {
+        const auto &statePatch = statePatchValue.toObject();
+        state.assign(stateValue.toObject(), [this, &statePatch]()
+        {
+            if(!StatePatch::applyStatePatch(state, statePatch))
+                qWarning() << "Received invalid state patch";
+        });
+    }
+    else if(stateValue.isObject())
+        state.assign(stateValue.toObject());
+
     if (!_connected && _ipc->isConnected())
     {
         _connectionTimer.stop();
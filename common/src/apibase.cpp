@@ -17,12 +17,39 @@
 // <https://www.gnu.org/licenses/>.
 
 #include "apibase.h"
+#include <algorithm>
+
+namespace
+{
+    // Number of recent successful latencies kept for each base
+    const std::size_t latencyHistorySize{8};
+
+    // Hedge delay used for a base with no latency history, and the limits
+    // applied to the delay computed from the history.  The minimum avoids
+    // doubling requests for a base that is usually very fast.
+    // (NetworkTaskWithRetry also limits this to half of the attempt timeout.)
+    const std::chrono::milliseconds defaultHedgeDelay{1500};
+    const std::chrono::milliseconds minHedgeDelay{250};
+    const std::chrono::milliseconds maxHedgeDelay{3000};
+
+    // Get a percentile (0-100) from a set of latencies
+    std::chrono::milliseconds latencyPercentile(std::deque<std::chrono::milliseconds> latencies,
+                                                unsigned percentile)
+    {
+        Q_ASSERT(!latencies.empty());   // Guaranteed by caller
+        std::sort(latencies.begin(), latencies.end());
+        // Nearest-rank percentile
+        std::size_t rank = (latencies.size() * percentile + 99) / 100;
+        return latencies[rank ? rank-1 : 0];
+    }
+}
 ApiBaseData::ApiBaseData(const std::vector<QString> &baseUris)
     : _baseUris{}, _nextStartIndex{0}
 {
     _baseUris.reserve(baseUris.size());
     for(auto &uri : baseUris)
         addBaseUri(uri, {}, {});
+    _latencies.resize(_baseUris.size());
 }
 
 ApiBaseData::ApiBaseData(const std::initializer_list<QString> &baseUris)
@@ -31,6 +58,7 @@ ApiBaseData::ApiBaseData(const std::initializer_list<QString> &baseUris)
     _baseUris.reserve(baseUris.size());
     for(auto &uri : baseUris)
         addBaseUri(uri, {}, {});
+    _latencies.resize(_baseUris.size());
 }
 
 ApiBaseData::ApiBaseData(const QString &uri, std::shared_ptr<PrivateCA> pCA,
@@ -38,6 +66,7 @@ ApiBaseData::ApiBaseData(const QString &uri, std::shared_ptr<PrivateCA> pCA,
     : _baseUris{}, _nextStartIndex{0}
 {
     addBaseUri(uri, std::move(pCA), peerVerifyName);
+    _latencies.resize(_baseUris.size());
 }
 
 ApiBaseData::ApiBaseData(std::vector<BaseUri> baseUris)
@@ -49,6 +78,7 @@ ApiBaseData::ApiBaseData(std::vector<BaseUri> baseUris)
         if(!base.uri.endsWith('/'))
             base.uri += '/';
     }
+    _latencies.resize(_baseUris.size());
 }
 
 void ApiBaseData::addBaseUri(const QString &uri, std::shared_ptr<PrivateCA> pCA,
@@ -66,10 +96,63 @@ BaseUri ApiBaseData::getUri(unsigned index)
     return _baseUris[index];
 }
 
-void ApiBaseData::attemptSucceeded(unsigned successIndex)
+void ApiBaseData::attemptSucceeded(unsigned successIndex,
+                                   std::chrono::milliseconds latency)
 {
     Q_ASSERT(successIndex < _baseUris.size());  // Guaranteed by caller
-    _nextStartIndex = successIndex;
+    auto &history = _latencies[successIndex];
+    history.push_back(latency);
+    if(history.size() > latencyHistorySize)
+        history.pop_front();
+
+    // The base that just succeeded wins ties, and is always chosen if no other
+    // base has a history (which is the prior behavior - start with the last
+    // successful base).
+    updateNextStartIndex(successIndex);
+}
+
+void ApiBaseData::attemptFailed(unsigned failedIndex)
+{
+    Q_ASSERT(failedIndex < _baseUris.size());   // Guaranteed by caller
+    _latencies[failedIndex].clear();
+
+    // Don't keep starting with a base that just failed.  If no base has a
+    // history, move on to the next base.
+    unsigned defaultIndex = _nextStartIndex;
+    if(defaultIndex == failedIndex)
+        defaultIndex = (failedIndex + 1) % _baseUris.size();
+    updateNextStartIndex(defaultIndex);
+}
+
+void ApiBaseData::updateNextStartIndex(unsigned defaultIndex)
+{
+    // Start with the base that has been fastest recently.  defaultIndex wins
+    // ties, and is chosen if no base has a history.
+    _nextStartIndex = defaultIndex;
+    std::chrono::milliseconds bestMedian{std::chrono::milliseconds::max()};
+    if(!_latencies[defaultIndex].empty())
+        bestMedian = latencyPercentile(_latencies[defaultIndex], 50);
+    for(unsigned i=0; i<_latencies.size(); ++i)
+    {
+        if(_latencies[i].empty())
+            continue;
+        std::chrono::milliseconds median{latencyPercentile(_latencies[i], 50)};
+        if(median < bestMedian)
+        {
+            bestMedian = median;
+            _nextStartIndex = i;
+        }
+    }
+}
+
+std::chrono::milliseconds ApiBaseData::getHedgeDelay(unsigned index) const
+{
+    Q_ASSERT(index < _baseUris.size());     // Guaranteed by caller
+    const auto &history = _latencies[index];
+    if(history.empty())
+        return defaultHedgeDelay;
+    return std::max(minHedgeDelay,
+                    std::min(maxHedgeDelay, latencyPercentile(history, 90)));
 }
 
 ApiBaseSequence FixedApiBase::beginAttempt()
@@ -102,8 +185,27 @@ BaseUri ApiBaseSequence::getNextUri()
     return _pData->getUri(_currentBaseUri);
 }
 
-void ApiBaseSequence::attemptSucceeded()
+unsigned ApiBaseSequence::getUriCount() const
+{
+    Q_ASSERT(_pData);   // Class invariant
+    return _pData->getUriCount();
+}
+
+void ApiBaseSequence::attemptSucceeded(unsigned index,
+                                       std::chrono::milliseconds latency)
+{
+    Q_ASSERT(_pData);   // Class invariant
+    _pData->attemptSucceeded(index, latency);
+}
+
+void ApiBaseSequence::attemptFailed(unsigned index)
+{
+    Q_ASSERT(_pData);   // Class invariant
+    _pData->attemptFailed(index);
+}
+
+std::chrono::milliseconds ApiBaseSequence::getHedgeDelay(unsigned index) const
 {
     Q_ASSERT(_pData);   // Class invariant
-    _pData->attemptSucceeded(_currentBaseUri);
+    return _pData->getHedgeDelay(index);
 }
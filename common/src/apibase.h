@@ -25,6 +25,8 @@
 #include "openssl.h"
 #include <QSharedPointer>
 #include <vector>
+#include <deque>
+#include <chrono>
 #include <initializer_list>
 
 // ApiBase is used to describe the different endpoints where various APIs can be
@@ -61,8 +63,9 @@ struct COMMON_EXPORT BaseUri
     QString peerVerifyName;
 };
 
-// Data used by both ApiBase and ApiBaseSequence - the actual base URIs and the
-// last successful one.
+// Data used by both ApiBase and ApiBaseSequence - the actual base URIs, the
+// latencies of recent successful requests to each base, and the base to start
+// with for the next request.
 // Note that this is not currently thread-safe; all API requests of any kind are
 // handled on the main thread.
 class COMMON_EXPORT ApiBaseData
@@ -89,24 +92,51 @@ public:
     // if the API base is updated.  This contains QStrings and a shared_ptr, so
     // copies aren't too expensive.
     BaseUri getUri(unsigned index);
-    void attemptSucceeded(unsigned successIndex);
+    // An attempt succeeded with the given latency.  Later requests start with
+    // whichever base has the lowest median latency recently.
+    void attemptSucceeded(unsigned successIndex, std::chrono::milliseconds latency);
+    // An attempt failed.  The base's latency history is discarded, so it's no
+    // longer preferred over bases that are still responding, and later
+    // requests no longer start with it.
+    void attemptFailed(unsigned failedIndex);
+    // Get the delay before hedging an attempt to this base with an attempt to
+    // another base - the 90th percentile of the base's recent latencies (with
+    // a default if there is no history), within reasonable limits.
+    std::chrono::milliseconds getHedgeDelay(unsigned index) const;
+
+private:
+    // Choose the base with the lowest median latency to start the next
+    // request, or defaultIndex if it's tied or no base has a history.
+    void updateNextStartIndex(unsigned defaultIndex);
 
 private:
     std::vector<BaseUri> _baseUris;
+    // Latencies of the most recent successful attempts to each base (indices
+    // correspond to _baseUris).
+    std::vector<std::deque<std::chrono::milliseconds>> _latencies;
     unsigned _nextStartIndex;
 };
 
 // ApiBaseSequence keeps track of the base URIs being used for a particular
-// request.  If an attempt is successful, it updates the last successful URI in
-// the ApiBaseData to speed up later requests using the same API base.
+// request.  Attempt results are reported back to the ApiBaseData to speed up
+// later requests using the same API base.
+//
+// More than one attempt can be in flight (NetworkTaskWithRetry can hedge a slow
+// attempt), so results are reported with the index of the attempt's base.
 class COMMON_EXPORT ApiBaseSequence
 {
 public:
     ApiBaseSequence(QSharedPointer<ApiBaseData> pData);
 
 public:
+    // Advance to the next base URI and return it; its index is then given by
+    // getCurrentIndex().
     BaseUri getNextUri();
-    void attemptSucceeded();
+    unsigned getCurrentIndex() const {return _currentBaseUri;}
+    unsigned getUriCount() const;
+    void attemptSucceeded(unsigned index, std::chrono::milliseconds latency);
+    void attemptFailed(unsigned index);
+    std::chrono::milliseconds getHedgeDelay(unsigned index) const;
 
 private:
     const QSharedPointer<ApiBaseData> _pData;
@@ -63,32 +63,38 @@ void ApiResource::trace(QDebug &dbg) const
 }
 
 // Counted retry strategy.  Just retries immediately up to a maximum number of
-// attempts.
+// attempts.  If hedging is enabled, attempts can also begin concurrently up to
+// the same limit.
 class COMMON_EXPORT CountedApiRetry : public ApiRetry
 {
 public:
-    CountedApiRetry(unsigned maxAttempts);
+    CountedApiRetry(unsigned maxAttempts, bool hedge);
 
 public:
     virtual std::chrono::milliseconds beginAttempt(const ApiResource &resource) override;
     virtual nullable_t<std::chrono::milliseconds> attemptFailed(const ApiResource &resource) override;
+    virtual bool canBeginConcurrentAttempt() const override;
 
 private:
     unsigned _maxAttempts;
+    bool _hedge;
+    // Count of attempts begun (incremented by beginAttempt()).
+    unsigned _beginCount;
     // Count of failed attempts (incremented by attemptFailed()).
     unsigned _failureCount;
 };
 
-CountedApiRetry::CountedApiRetry(unsigned maxAttempts)
-    : _maxAttempts{maxAttempts}, _failureCount{0}
+CountedApiRetry::CountedApiRetry(unsigned maxAttempts, bool hedge)
+    : _maxAttempts{maxAttempts}, _hedge{hedge}, _beginCount{0}, _failureCount{0}
 {
 }
 
 auto CountedApiRetry::beginAttempt(const ApiResource &resource)
     -> std::chrono::milliseconds
 {
+    ++_beginCount;
     // Counted attempts always use a fixed retry interval
-    qInfo() << "Begin attempt" << (_failureCount+1) << "for resource" << resource;
+    qInfo() << "Begin attempt" << _beginCount << "for resource" << resource;
     return countedRequestTimeout;
 }
 
@@ -110,6 +116,11 @@ auto CountedApiRetry::attemptFailed(const ApiResource &resource)
     return std::chrono::milliseconds{0};
 }
 
+bool CountedApiRetry::canBeginConcurrentAttempt() const
+{
+    return _hedge && _beginCount < _maxAttempts;
+}
+
 // Timed retry strategy; used for the VPN IP and port forward requests.
 //
 // Uses a backing-off interval between requests (with an upper bound) and an
@@ -131,6 +142,7 @@ public:
 public:
     virtual std::chrono::milliseconds beginAttempt(const ApiResource &resource) override;
     virtual nullable_t<std::chrono::milliseconds> attemptFailed(const ApiResource &resource) override;
+    virtual bool canBeginConcurrentAttempt() const override;
 
 private:
     // Time since the first attempt began; used for the overall timeout
@@ -258,9 +270,21 @@ auto TimedApiRetry::attemptFailed(const ApiResource &resource)
     return thisRequestDelay;
 }
 
+bool TimedApiRetry::canBeginConcurrentAttempt() const
+{
+    // Timed retries already pace their attempts with a backing-off interval;
+    // they aren't hedged.
+    return false;
+}
+
 std::unique_ptr<ApiRetry> ApiRetries::counted(unsigned maxAttempts)
 {
-    return std::make_unique<CountedApiRetry>(maxAttempts);
+    return std::make_unique<CountedApiRetry>(maxAttempts, false);
+}
+
+std::unique_ptr<ApiRetry> ApiRetries::hedged(unsigned maxAttempts)
+{
+    return std::make_unique<CountedApiRetry>(maxAttempts, true);
 }
 
 std::unique_ptr<ApiRetry> ApiRetries::timed(std::chrono::seconds fastRequestTime,
@@ -89,6 +89,15 @@ public:
     // The resource path is provided just for tracing, it shouldn't affect the
     // attempt behavior.
     virtual nullable_t<std::chrono::milliseconds> attemptFailed(const ApiResource &resource) = 0;
+
+    // Check whether another attempt could begin now, while an earlier attempt
+    // is still in flight.  NetworkTaskWithRetry uses this to hedge a slow
+    // attempt; if this returns true, it may call beginAttempt() without an
+    // intervening attemptFailed().  Each attempt still fails individually
+    // with attemptFailed().
+    //
+    // This is only permitted by strategies created with hedging enabled.
+    virtual bool canBeginConcurrentAttempt() const = 0;
 };
 
 namespace ApiRetries
@@ -97,6 +106,12 @@ namespace ApiRetries
     // is no delay between each attempt.
     std::unique_ptr<ApiRetry> COMMON_EXPORT counted(unsigned maxAttempts);
 
+    // Create a counted retry strategy that also permits hedged attempts (see
+    // NetworkTaskWithRetry).  Hedged attempts still count toward maxAttempts.
+    // Only use this for idempotent requests, since the request may be sent to
+    // two API bases.
+    std::unique_ptr<ApiRetry> COMMON_EXPORT hedged(unsigned maxAttempts);
+
     // Create a timed retry strategy with timing factors tuned for the VPN IP
     // address request.
     std::unique_ptr<ApiRetry> COMMON_EXPORT timed(std::chrono::seconds fastRequestTime,
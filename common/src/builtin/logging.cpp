@@ -21,6 +21,8 @@
 
 #include "logging.h"
 #include "error.h"
+#include "mpscring.h"
+#include "redactor.h"
 #include "path.h"
 #include "util.h"
 #include "exec.h"
@@ -36,7 +38,12 @@
 #include <QTextStream>
 #include <QThread>
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstdlib>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <cstring>
 
@@ -50,27 +57,21 @@ namespace
     QMutex g_logMutex(QMutex::Recursive);
     bool g_logToStdErr = false;
     // Log redactions - maps redact strings to replacements (which now include
-    // the angle brackets).  All redactions are applied sequentially when
-    // redacting text, but they're stored in a map so that adding the same
+    // the angle brackets).  They're stored in a map so that adding the same
     // redaction again doesn't accumulate.
     std::unordered_map<QString, QString> g_redactions;
+    // The redactions compiled for a single scan of each text; rebuilt when
+    // g_redactions changes
+    Redactor g_redactor;
 
-    QString redactTextNoLock(QString text)
+    QString redactTextNoLock(const QString &text)
     {
-        for(const auto &redaction : g_redactions)
-        {
-            text.replace(redaction.first, redaction.second);
-        }
-        return text;
+        return g_redactor.redact(text);
     }
 
-    QByteArray redactTextNoLock(QByteArray text)
+    QByteArray redactTextNoLock(const QByteArray &text)
     {
-        for(const auto &redaction : g_redactions)
-        {
-            text.replace(redaction.first.toLocal8Bit(), redaction.second.toLocal8Bit());
-        }
-        return text;
+        return g_redactor.redact(text);
     }
 
     // Automatically strip the repo path from file paths in CodeLocation.  This
@@ -198,6 +199,11 @@ class LoggerPrivate
 
     // Wipe log file and backup log file if exists
     void wipeLogFile();
+
+public:
+    // Redact log lines and write them to all outputs.  'd' is nullptr if
+    // there's no Logger (lines only go to stderr/debugger).  Takes g_logMutex.
+    static void writeLogLines(LoggerPrivate *d, QString logLinesUnredacted);
 };
 
 // This is the default "base" filterset applied when logging to disk is enabled.
@@ -221,6 +227,174 @@ const QString LoggerPrivate::disabledFilters {
 #endif
 };
 
+namespace
+{
+    // Writes log records on a dedicated thread in asynchronous mode.
+    //
+    // Producers push formatted (unredacted) records into a bounded lock-free
+    // ring and return immediately.  The writer thread takes everything that's
+    // queued, joins it into one chunk, and redacts and writes it with
+    // writeLogLines(), so the disk I/O (and g_logMutex) are off of the
+    // producers' threads.
+    class AsyncLogWriter
+    {
+    public:
+        // Number of records that can be queued
+        static const std::size_t queueCapacity = 4096;
+        // Largest chunk written at once (in characters)
+        static const int maxChunkSize = 256 * 1024;
+        // Longest time the writer sleeps without checking the queue - bounds
+        // the delay if a wakeup races with the writer going to sleep
+        static const std::chrono::milliseconds idleWait;
+        // Longest time drain() waits for the writer to finish its current chunk
+        static const std::chrono::milliseconds drainWait;
+
+    public:
+        AsyncLogWriter() : _ring{queueCapacity}, _pLogger{nullptr}, _running{false}, _writerWaiting{false} {}
+        ~AsyncLogWriter() {stop();}
+
+    public:
+        // Start the writer thread, writing to pLogger's log file
+        void start(LoggerPrivate *pLogger);
+        // Stop the writer thread; everything queued is written first
+        void stop();
+
+        // Queue a record if the writer is running.  Returns false if the
+        // record must be written synchronously instead - the writer isn't
+        // running, or this is the writer thread.  'record' is moved only if
+        // it was queued.
+        bool queue(QString &record);
+
+        // Write everything queued on the calling thread (used before writing
+        // a fatal message, since the process aborts right after that).
+        void drain();
+
+    private:
+        // Write the queued records.  The caller must hold _consumerMutex.
+        void writeQueued();
+        void run();
+
+    private:
+        MpscRing<QString> _ring;
+        LoggerPrivate *_pLogger;
+        std::atomic<bool> _running;
+        // Set while the writer is about to wait for a wakeup; producers only
+        // take _wakeMutex to wake it in that case
+        std::atomic<bool> _writerWaiting;
+        std::mutex _wakeMutex;
+        std::condition_variable _wake;
+        // Held while consuming the ring, so drain() and the writer thread
+        // don't consume at the same time
+        std::timed_mutex _consumerMutex;
+        std::thread _thread;
+        std::atomic<std::thread::id> _writerThreadId;
+    };
+
+    const std::chrono::milliseconds AsyncLogWriter::idleWait{250};
+    const std::chrono::milliseconds AsyncLogWriter::drainWait{2000};
+
+    void AsyncLogWriter::start(LoggerPrivate *pLogger)
+    {
+        if(_running)
+            return;
+        _pLogger = pLogger;
+        _running = true;
+        _thread = std::thread{[this]{run();}};
+    }
+
+    void AsyncLogWriter::stop()
+    {
+        if(!_running.exchange(false))
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock{_wakeMutex};
+            _wake.notify_one();
+        }
+        _thread.join();
+        _writerThreadId = std::thread::id{};
+        // Pick up anything that was queued while the writer was stopping
+        drain();
+        _pLogger = nullptr;
+    }
+
+    bool AsyncLogWriter::queue(QString &record)
+    {
+        if(!_running || std::this_thread::get_id() == _writerThreadId.load())
+            return false;
+
+        // If the queue is full, wait for the writer to make room rather than
+        // dropping lines
+        while(!_ring.tryPush(record))
+        {
+            {
+                std::lock_guard<std::mutex> lock{_wakeMutex};
+                _wake.notify_one();
+            }
+            std::this_thread::yield();
+            if(!_running)
+                return false;
+        }
+
+        // Pairs with the fence in run() - either we see that the writer is
+        // going to wait, or it sees this record
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(_writerWaiting.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> lock{_wakeMutex};
+            _wake.notify_one();
+        }
+        return true;
+    }
+
+    void AsyncLogWriter::drain()
+    {
+        // If the writer thread is stuck in a write, give up on the queued
+        // lines rather than hanging here
+        std::unique_lock<std::timed_mutex> lock{_consumerMutex, drainWait};
+        if(lock.owns_lock())
+            writeQueued();
+    }
+
+    void AsyncLogWriter::writeQueued()
+    {
+        QString chunk;
+        QString record;
+        while(_ring.tryPop(record))
+        {
+            chunk += record;
+            if(chunk.size() >= maxChunkSize)
+            {
+                LoggerPrivate::writeLogLines(_pLogger, std::move(chunk));
+                chunk.clear();
+            }
+        }
+        if(!chunk.isEmpty())
+            LoggerPrivate::writeLogLines(_pLogger, std::move(chunk));
+    }
+
+    void AsyncLogWriter::run()
+    {
+        _writerThreadId = std::this_thread::get_id();
+        while(_running)
+        {
+            {
+                std::lock_guard<std::timed_mutex> lock{_consumerMutex};
+                writeQueued();
+            }
+
+            std::unique_lock<std::mutex> lock{_wakeMutex};
+            _writerWaiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(_running && _ring.empty())
+                _wake.wait_for(lock, idleWait);
+            _writerWaiting.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    AsyncLogWriter g_asyncWriter;
+}
+
 // See Singleton - CRTP template with static member in dynamic lib
 template class COMMON_EXPORT Singleton<Logger>;
 
@@ -243,7 +417,12 @@ void Logger::enableStdErr(bool logToStdErr)
 void Logger::addRedaction(const QString &redact, const QString &replace)
 {
     QMutexLocker lock{&g_logMutex};
-    g_redactions[redact] = QStringLiteral("<<%1>>").arg(replace);
+    QString replacement = QStringLiteral("<<%1>>").arg(replace);
+    auto itRedaction = g_redactions.find(redact);
+    if(itRedaction != g_redactions.end() && itRedaction->second == replacement)
+        return; // Already present, nothing to rebuild
+    g_redactions[redact] = std::move(replacement);
+    g_redactor = Redactor{g_redactions};
 }
 
 QString Logger::redactText(QString text)
@@ -258,7 +437,7 @@ QByteArray Logger::redactText(QByteArray text)
     return redactTextNoLock(std::move(text));
 }
 
-Logger::Logger(const Path &logFilePath)
+Logger::Logger(const Path &logFilePath, WriteMode writeMode)
     : d_ptr(nullptr)
 {
     // We have to null out d_ptr (above), then initialize it with a new
@@ -275,10 +454,15 @@ Logger::Logger(const Path &logFilePath)
         qCritical() << "Instantiated Logging singleton before QCoreApplication";
 
     d->readDebugFile();
+
+    if (writeMode == WriteMode::Asynchronous)
+        g_asyncWriter.start(d);
 }
 
 Logger::~Logger()
 {
+    // Write everything queued before the log file goes away
+    g_asyncWriter.stop();
     delete d_ptr;
 }
 
@@ -595,6 +779,29 @@ static QString buildLogFilePrefix(QDateTime now, QtMsgType type,
     return prefix;
 }
 
+void LoggerPrivate::writeLogLines(LoggerPrivate *d, QString logLinesUnredacted)
+{
+    QMutexLocker lock{&g_logMutex};
+
+    QString logLines = redactTextNoLock(std::move(logLinesUnredacted));
+
+#if defined(QT_DEBUG) && defined(Q_OS_WIN)
+    if (isDebuggerPresent())
+    {
+        ::OutputDebugStringW(qUtf16Printable(logLines));
+    }
+    else
+#endif
+    {
+        if(g_logToStdErr)
+            QTextStream(stderr, QIODevice::WriteOnly) << logLines;
+    }
+    if (d)
+    {
+        d->writeToLogFile(logLines);
+    }
+}
+
 void Logger::loggingHandler(QtMsgType type, const QMessageLogContext &context, const QString &msg)
 {
 #if defined(Q_OS_WIN)
@@ -627,27 +834,18 @@ void Logger::loggingHandler(QtMsgType type, const QMessageLogContext &context, c
     Logger* self = Logger::instance();
     LoggerPrivate* const d = self ? self->d_func() : nullptr;
 
-    g_logMutex.lock();
-
-    QString logLines = redactTextNoLock(std::move(logLinesUnredacted));
-
-#if defined(QT_DEBUG) && defined(Q_OS_WIN)
-    if (isDebuggerPresent())
+    // In asynchronous mode, the writer thread writes the lines.  Fatal
+    // messages are always written synchronously after draining the queue, so
+    // everything is written before we abort.
+    if (type == QtFatalMsg)
     {
-        ::OutputDebugStringW(qUtf16Printable(logLines));
+        g_asyncWriter.drain();
+        LoggerPrivate::writeLogLines(d, std::move(logLinesUnredacted));
     }
-    else
-#endif
+    else if (!g_asyncWriter.queue(logLinesUnredacted))
     {
-        if(g_logToStdErr)
-            QTextStream(stderr, QIODevice::WriteOnly) << logLines;
+        LoggerPrivate::writeLogLines(d, std::move(logLinesUnredacted));
     }
-    if (d)
-    {
-        d->writeToLogFile(logLines);
-    }
-
-    g_logMutex.unlock();
 
     // Failure to queue arguments is a programming error (and hard to debug),
     // assert to provide a way to debug it.
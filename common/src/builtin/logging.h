@@ -251,6 +251,10 @@ public:
     // Adding the same redaction again updates the replacement text (the
     // duplicate redactions do not accumulate).
     //
+    // All redactions are applied in one scan of the text (see Redactor).  If
+    // redact texts overlap in a line, the leftmost one is replaced, and the
+    // longest one if several start at the same position.
+    //
     // Replacement texts should generally have some semantic meaning, so (for
     // example) different values can be differentiated, and so issues/warnings
     // could still be detected (for example, dedicated IP addresses and tokens
@@ -268,8 +272,19 @@ public:
     // Redact a piece of text in the default 8-bit encoding.
     static QByteArray redactText(QByteArray text);
 
+    enum class WriteMode
+    {
+        // Log lines are written on the thread that traces them
+        Synchronous,
+        // Log lines are queued and written by a dedicated writer thread, in
+        // chunks.  This keeps disk I/O off of the tracing threads.  Fatal
+        // messages are still written synchronously (after writing anything
+        // queued), since the process aborts immediately after.
+        Asynchronous,
+    };
+
     // Instantiate the singleton in the main thread after QCoreApplication has been created.
-    explicit Logger(const Path &logFilePath);
+    explicit Logger(const Path &logFilePath, WriteMode writeMode = WriteMode::Synchronous);
 
     // Destroy the singleton in the same thread it was created.
     ~Logger();
@@ -0,0 +1,140 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("builtin/mpscring.h")
+
+#ifndef BUILTIN_MPSCRING_H
+#define BUILTIN_MPSCRING_H
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Bounded multiple-producer, single-consumer queue.  Producers never block or
+// take a lock; a push just claims a slot with a CAS and publishes it.  If the
+// queue is full, tryPush() fails and the producer decides what to do.
+//
+// Any number of threads can call tryPush() concurrently.  Only one thread at a
+// time can call tryPop() (the consumer can change, but the caller must ensure
+// the pops don't overlap).
+//
+// The capacity is rounded up to a power of 2.
+template<class T>
+class MpscRing
+{
+private:
+    struct Slot
+    {
+        // The position that can use this slot next.  A producer can fill the
+        // slot when it equals the enqueue position; the consumer can take it
+        // when it equals the dequeue position + 1.
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    static std::size_t roundCapacity(std::size_t capacity)
+    {
+        std::size_t rounded{2};
+        while(rounded < capacity)
+            rounded <<= 1;
+        return rounded;
+    }
+
+public:
+    explicit MpscRing(std::size_t capacity)
+        : _capacity{roundCapacity(capacity)}, _slots{new Slot[_capacity]},
+          _enqueuePos{0}, _dequeuePos{0}
+    {
+        for(std::size_t i=0; i<_capacity; ++i)
+            _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+private:
+    MpscRing(const MpscRing &) = delete;
+    MpscRing &operator=(const MpscRing &) = delete;
+
+public:
+    std::size_t capacity() const {return _capacity;}
+
+    // Push a value.  The value is moved into the queue only if this succeeds;
+    // returns false (and leaves 'value' intact) if the queue is full.
+    bool tryPush(T &value)
+    {
+        std::size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+        Slot *pSlot;
+        while(true)
+        {
+            pSlot = &_slots[pos & (_capacity-1)];
+            std::size_t seq = pSlot->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+            if(diff == 0)
+            {
+                // The slot is free, try to claim it
+                if(_enqueuePos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed))
+                    break;
+                // Otherwise, another producer claimed it; pos was reloaded
+            }
+            else if(diff < 0)
+                return false;   // Full - the consumer hasn't taken this slot yet
+            else
+                pos = _enqueuePos.load(std::memory_order_relaxed);
+        }
+
+        pSlot->value = std::move(value);
+        pSlot->sequence.store(pos+1, std::memory_order_release);
+        return true;
+    }
+
+    // Pop the oldest value.  Returns false if the queue is empty (or if the
+    // oldest slot has been claimed by a producer that hasn't finished
+    // publishing it yet).
+    bool tryPop(T &value)
+    {
+        std::size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+        Slot &slot = _slots[pos & (_capacity-1)];
+        if(slot.sequence.load(std::memory_order_acquire) != pos+1)
+            return false;
+
+        value = std::move(slot.value);
+        slot.value = T{};
+        // Free the slot for the producer that is one lap ahead
+        slot.sequence.store(pos + _capacity, std::memory_order_release);
+        _dequeuePos.store(pos+1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Check if the queue appears empty.  This can be called from any thread,
+    // but the result is just a snapshot.
+    bool empty() const
+    {
+        std::size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+        return _slots[pos & (_capacity-1)].sequence.load(std::memory_order_acquire) != pos+1;
+    }
+
+private:
+    const std::size_t _capacity;
+    std::unique_ptr<Slot[]> _slots;
+    // Producers and the consumer update these independently, keep them on
+    // separate cache lines
+    alignas(64) std::atomic<std::size_t> _enqueuePos;
+    alignas(64) std::atomic<std::size_t> _dequeuePos;
+};
+
+#endif
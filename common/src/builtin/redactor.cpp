@@ -0,0 +1,203 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("builtin/redactor.cpp")
+
+#include "redactor.h"
+#include <algorithm>
+#include <deque>
+#include <map>
+
+template<class String>
+RedactionAutomaton<String>::RedactionAutomaton(const std::vector<std::pair<String, String>> &redactions)
+{
+    // Build the trie with temporary maps for the edges
+    std::vector<std::map<Char, int>> children{1};
+    _nodes.push_back({0, 0, 0, 0, -1, -1});
+    for(const auto &redaction : redactions)
+    {
+        const String &pattern = redaction.first;
+        if(pattern.isEmpty())
+            continue;
+
+        int node = 0;
+        for(const Char &ch : pattern)
+        {
+            auto itChild = children[node].find(ch);
+            if(itChild != children[node].end())
+            {
+                node = itChild->second;
+                continue;
+            }
+            int child = static_cast<int>(_nodes.size());
+            _nodes.push_back({0, 0, 0, _nodes[node].depth + 1, -1, -1});
+            children.emplace_back();
+            children[node].emplace(ch, child);
+            node = child;
+        }
+
+        // If the same pattern occurs twice, the last replacement wins
+        if(_nodes[node].pattern < 0)
+        {
+            _nodes[node].pattern = static_cast<int>(_replacements.size());
+            _replacements.push_back(redaction.second);
+        }
+        else
+            _replacements[_nodes[node].pattern] = redaction.second;
+    }
+
+    // Compute failure links and outputs breadth-first, so each node's
+    // failure target (which is shallower) is complete before the node
+    std::deque<int> queue;
+    for(const auto &child : children[0])
+    {
+        _nodes[child.second].fail = 0;
+        queue.push_back(child.second);
+    }
+    while(!queue.empty())
+    {
+        int node = queue.front();
+        queue.pop_front();
+        Node &nodeData = _nodes[node];
+        nodeData.output = nodeData.pattern >= 0 ? node : _nodes[nodeData.fail].output;
+
+        for(const auto &child : children[node])
+        {
+            // Follow the failure links from this node until one can advance
+            // with this character
+            int fail = nodeData.fail;
+            while(fail && !children[fail].count(child.first))
+                fail = _nodes[fail].fail;
+            auto itFailChild = children[fail].find(child.first);
+            _nodes[child.second].fail = (itFailChild != children[fail].end()) ?
+                itFailChild->second : 0;
+            queue.push_back(child.second);
+        }
+    }
+
+    // Flatten the edges, the maps are already sorted
+    for(std::size_t node = 0; node < _nodes.size(); ++node)
+    {
+        _nodes[node].firstEdge = static_cast<int>(_edges.size());
+        _nodes[node].edgeCount = static_cast<int>(children[node].size());
+        for(const auto &child : children[node])
+            _edges.push_back({child.first, child.second});
+    }
+}
+
+template<class String>
+int RedactionAutomaton<String>::next(int state, Char ch) const
+{
+    while(true)
+    {
+        const Node &node = _nodes[state];
+        auto itEdgesBegin = _edges.begin() + node.firstEdge;
+        auto itEdgesEnd = itEdgesBegin + node.edgeCount;
+        auto itEdge = std::lower_bound(itEdgesBegin, itEdgesEnd, ch,
+            [](const Edge &edge, Char value){return edge.ch < value;});
+        if(itEdge != itEdgesEnd && itEdge->ch == ch)
+            return itEdge->target;
+        if(state == 0)
+            return 0;
+        state = node.fail;
+    }
+}
+
+template<class String>
+String RedactionAutomaton<String>::redact(const String &text) const
+{
+    if(empty())
+        return text;
+
+    struct Match
+    {
+        int start;
+        int length;
+        int pattern;
+    };
+    // All matches found, usually none
+    std::vector<Match> matches;
+
+    int state{0};
+    const int size = text.size();
+    for(int i=0; i<size; ++i)
+    {
+        state = next(state, text[i]);
+        for(int match = _nodes[state].output; match >= 0;
+            match = _nodes[_nodes[match].fail].output)
+        {
+            matches.push_back({i + 1 - _nodes[match].depth, _nodes[match].depth,
+                               _nodes[match].pattern});
+        }
+    }
+
+    if(matches.empty())
+        return text;
+
+    // Replace the leftmost match first, preferring the longest match at a
+    // given position, then skip any matches that overlap it
+    std::sort(matches.begin(), matches.end(),
+        [](const Match &first, const Match &second)
+        {
+            if(first.start != second.start)
+                return first.start < second.start;
+            return first.length > second.length;
+        });
+
+    String result;
+    int copied{0};
+    for(const auto &match : matches)
+    {
+        if(match.start < copied)
+            continue;
+        result.append(text.constData() + copied, match.start - copied);
+        result.append(_replacements[match.pattern]);
+        copied = match.start + match.length;
+    }
+    result.append(text.constData() + copied, size - copied);
+    return result;
+}
+
+template class RedactionAutomaton<QString>;
+template class RedactionAutomaton<QByteArray>;
+
+Redactor::Redactor(const std::unordered_map<QString, QString> &redactions)
+{
+    std::vector<std::pair<QString, QString>> unicode;
+    std::vector<std::pair<QByteArray, QByteArray>> local8Bit;
+    unicode.reserve(redactions.size());
+    local8Bit.reserve(redactions.size());
+    for(const auto &redaction : redactions)
+    {
+        unicode.push_back(redaction);
+        local8Bit.push_back({redaction.first.toLocal8Bit(), redaction.second.toLocal8Bit()});
+    }
+    _unicode = RedactionAutomaton<QString>{unicode};
+    _local8Bit = RedactionAutomaton<QByteArray>{local8Bit};
+}
+
+QString Redactor::redact(const QString &text) const
+{
+    return _unicode.redact(text);
+}
+
+QByteArray Redactor::redact(const QByteArray &text) const
+{
+    return _local8Bit.redact(text);
+}
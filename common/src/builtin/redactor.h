@@ -0,0 +1,109 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("builtin/redactor.h")
+
+#ifndef BUILTIN_REDACTOR_H
+#define BUILTIN_REDACTOR_H
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <unordered_map>
+#include <vector>
+
+// Automaton used by Redactor to find all redaction strings in one pass
+// (Aho-Corasick).  String is QString or QByteArray.
+template<class String>
+class RedactionAutomaton
+{
+private:
+    using Char = typename String::value_type;
+
+    struct Node
+    {
+        // Outgoing edges - [firstEdge, firstEdge+edgeCount) in _edges, sorted
+        // by character
+        int firstEdge;
+        int edgeCount;
+        // Failure link - node for the longest proper suffix of this node's
+        // text that is also in the trie
+        int fail;
+        // Length of this node's text
+        int depth;
+        // Pattern that ends at this node, or -1
+        int pattern;
+        // Nearest node in the failure chain (including this node) that ends a
+        // pattern, or -1 - the longest match ending here
+        int output;
+    };
+
+    struct Edge
+    {
+        Char ch;
+        int target;
+    };
+
+public:
+    RedactionAutomaton() = default;
+    // Build the automaton for the given patterns and their replacements.
+    // Empty patterns are ignored.
+    RedactionAutomaton(const std::vector<std::pair<String, String>> &redactions);
+
+public:
+    bool empty() const {return _replacements.empty();}
+
+    // Replace all patterns in 'text'.  Matches are found leftmost-first; if
+    // several patterns match at the same position, the longest one is used.
+    // Replacement text is not scanned again.
+    String redact(const String &text) const;
+
+private:
+    int next(int state, Char ch) const;
+
+private:
+    std::vector<Node> _nodes;
+    std::vector<Edge> _edges;
+    std::vector<String> _replacements;
+};
+
+// Redactor replaces any number of redaction strings in text with a single scan
+// of the text (for Logger's log redactions).  The redactions are compiled
+// once; create a new Redactor when they change.
+class COMMON_EXPORT Redactor
+{
+public:
+    Redactor() = default;
+    // Compile redactions (mapping redacted strings to their replacements).
+    // QByteArray text is redacted using the strings in the local 8-bit
+    // encoding.
+    explicit Redactor(const std::unordered_map<QString, QString> &redactions);
+
+public:
+    bool empty() const {return _unicode.empty();}
+
+    QString redact(const QString &text) const;
+    QByteArray redact(const QByteArray &text) const;
+
+private:
+    RedactionAutomaton<QString> _unicode;
+    RedactionAutomaton<QByteArray> _local8Bit;
+};
+
+#endif
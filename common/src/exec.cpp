@@ -89,8 +89,8 @@ QDebug &operator<<(QDebug &dbg, const CmdTrace &trace)
 
 int Executor::cmdImpl(const QString &program, const QStringList &args,
                       void(*traceFunc)(QDebug &, const QString&, const QStringList&),
-                      const QProcessEnvironment &env, QString *pOut,
-                      bool ignoreErrors)
+                      const QProcessEnvironment &env, const QByteArray *pIn,
+                      QString *pOut, bool ignoreErrors)
 {
     Q_ASSERT(traceFunc);    // Ensured by caller
 
@@ -98,7 +98,9 @@ int Executor::cmdImpl(const QString &program, const QStringList &args,
 
     // Set the process environment (if provided)
     if(!env.isEmpty()) p.setProcessEnvironment(env);
-    p.start(program, args, QProcess::ReadOnly);
+    p.start(program, args, pIn ? QProcess::ReadWrite : QProcess::ReadOnly);
+    if(pIn)
+        p.write(*pIn);
     p.closeWriteChannel();
     int exitCode = waitForExitCode(p);
     auto out = p.readAllStandardOutput().trimmed();
@@ -144,7 +146,7 @@ void Executor::cmdDetached(const QString &program, const QStringList &args)
 int Executor::bash(const QString &command, bool ignoreErrors)
 {
     return cmdImpl(QStringLiteral("/bin/bash"), {QStringLiteral("-c"), command},
-                   traceShellCmd, {}, nullptr, ignoreErrors);
+                   traceShellCmd, {}, nullptr, nullptr, ignoreErrors);
 }
 
 void Executor::bashDetached(const QString &command)
@@ -156,7 +158,7 @@ QString Executor::bashWithOutput(const QString &command, bool ignoreErrors)
 {
     QString output;
     cmdImpl(QStringLiteral("/bin/bash"), {QStringLiteral("-c"), command},
-            traceShellCmd, {}, &output, ignoreErrors);
+            traceShellCmd, {}, nullptr, &output, ignoreErrors);
 
     return output;
 }
@@ -171,7 +173,13 @@ int Executor::cmd(const QString &program, const QStringList &args, bool ignoreEr
 // Execute a specific program with arguments and an environment
 int Executor::cmdWithEnv(const QString &program, const QStringList &args, const QProcessEnvironment &env, bool ignoreErrors)
 {
-    return cmdImpl(program, args, traceCmd, env, nullptr, ignoreErrors);
+    return cmdImpl(program, args, traceCmd, env, nullptr, nullptr, ignoreErrors);
+}
+
+int Executor::cmdWithInput(const QString &program, const QStringList &args,
+                           const QByteArray &input, bool ignoreErrors)
+{
+    return cmdImpl(program, args, traceCmd, {}, &input, nullptr, ignoreErrors);
 }
 
 #if defined(Q_OS_UNIX)
@@ -179,7 +187,7 @@ QString Executor::cmdWithOutput(const QString &program, const QStringList &args)
 {
     QString output;
     // Nonzero return values are traced by cmdImpl, output is empty in that case
-    cmdImpl(program, args, traceCmd, {}, &output, false);
+    cmdImpl(program, args, traceCmd, {}, nullptr, &output, false);
     return output;
 }
 
@@ -53,10 +53,11 @@ private:
     // command, exit code, and stdout/stderr if anything unexpected is returned.
     // traceFunc is called to trace the command if tracing occurs; tracing is
     // different for bash() vs. cmd().
+    // If pIn is given, it's written to the process's stdin.
     int cmdImpl(const QString &program, const QStringList &args,
                 void(*traceFunc)(QDebug &, const QString&, const QStringList&),
-                const QProcessEnvironment &env, QString *pOut,
-                bool ignoreErrors);
+                const QProcessEnvironment &env, const QByteArray *pIn,
+                QString *pOut, bool ignoreErrors);
 
     void cmdDetached(const QString &program, const QStringList &args);
 
@@ -80,6 +81,10 @@ public:
     int cmdWithEnv(const QString &program, const QStringList &args,
                   const QProcessEnvironment &env, bool ignoreErrors = false);
 
+    // Execute a command and write 'input' to its stdin.
+    int cmdWithInput(const QString &program, const QStringList &args,
+                     const QByteArray &input, bool ignoreErrors = false);
+
 #if defined(Q_OS_UNIX)
     // Execute a command and return the output if successful.  (The output and
     // exit code are still traced.)  If the command fails, an empty string is
@@ -20,9 +20,11 @@
 #line SOURCE_FILE("filewatcher.cpp")
 
 #include "filewatcher.h"
+#include <QFileInfo>
 
-FileWatcher::FileWatcher(Path target)
-    : _target{std::move(target)}
+FileWatcher::FileWatcher(Path target, bool watchParent,
+                         std::chrono::milliseconds settleDelay)
+    : _target{std::move(target)}, _watchParent{watchParent}
 {
     // Like RecursiveDirWatcher, this builds on Windows but does not currently
     // work due to a bug in Path::parent().  It isn't currently needed on
@@ -35,19 +37,40 @@ FileWatcher::FileWatcher(Path target)
             &FileWatcher::pathChanged);
     connect(&_fsWatcher, &QFileSystemWatcher::fileChanged, this,
             &FileWatcher::pathChanged);
+    _settleTimer.setSingleShot(true);
+    _settleTimer.setInterval(msec32(settleDelay));
+    connect(&_settleTimer, &QTimer::timeout, this, &FileWatcher::changed);
     addWatch();
 }
 
+bool FileWatcher::watching() const
+{
+    // If the target exists, it must be watched itself; a directory watch on an
+    // ancestor doesn't detect changes to the file's content
+    if(QFileInfo::exists(_target))
+        return _currentWatch == _target && (!_watchParent || !_parentWatch.str().isEmpty());
+    return !_currentWatch.str().isEmpty();
+}
+
 void FileWatcher::pathChanged(const QString &)
 {
     addWatch();
-    emit changed();
+    if(_settleTimer.interval() <= 0)
+        emit changed();
+    // Don't restart the timer if it's already running
+    else if(!_settleTimer.isActive())
+        _settleTimer.start();
 }
 
 void FileWatcher::addWatch()
 {
     if(!_currentWatch.str().isEmpty())
         _fsWatcher.removePath(_currentWatch);
+    if(!_parentWatch.str().isEmpty())
+    {
+        _fsWatcher.removePath(_parentWatch);
+        _parentWatch = Path{};
+    }
 
     _currentWatch = _target;
     // Keep trying to watch the next parent until we find something that exists
@@ -72,6 +95,14 @@ void FileWatcher::addWatch()
     }
     else if(_currentWatch == _target)
     {
+        if(_watchParent)
+        {
+            Path parent = _target.parent();
+            if(parent != _target && _fsWatcher.addPath(parent))
+                _parentWatch = std::move(parent);
+            else
+                qWarning() << "Could not watch parent of" << _target;
+        }
         qInfo() << "Watching" << _target << "for changes";
     }
     else
@@ -23,6 +23,8 @@
 #define FILEWATCHER_H
 
 #include <QFileSystemWatcher>
+#include <QTimer>
+#include <chrono>
 #include "path.h"
 
 // FileWatcher watches for a file to be modified, created, or deleted.
@@ -30,12 +32,33 @@
 // watch a path that actually exists.  If the file specified doesn't exist,
 // FileWatcher will walk up the directory heirarchy to the first directory that
 // does exist, and watch that to detect when the file might be created.
+//
+// If watchParent is set, the target's parent directory is also watched while
+// the file exists.  This catches a file being replaced by a rename from another
+// name in the same directory, which some tools (like NetworkManager) use to
+// rewrite files atomically.  Changes to other files in that directory are also
+// signaled, so this is best used for files that are cheap to re-check.
+//
+// If settleDelay is nonzero, changed() is emitted that long after a change is
+// detected, so a burst of changes causes one signal.  Further changes do not
+// postpone the signal, so a steady stream of changes can't delay it
+// indefinitely.
 class COMMON_EXPORT FileWatcher : public QObject
 {
     Q_OBJECT
 
 public:
-    FileWatcher(Path target);
+    FileWatcher(Path target, bool watchParent = false,
+                std::chrono::milliseconds settleDelay = {});
+
+public:
+    // Whether changes to the target can currently be detected - the target is
+    // watched itself if it exists (along with its parent if watchParent was
+    // set), or an ancestor is watched if it doesn't.  This is false if a watch
+    // couldn't be added, such as when the inotify watch limit has been
+    // reached.  Callers that must not miss changes can poll when this is
+    // false.
+    bool watching() const;
 
 private:
     // Add a watch to _fsWatcher for _target if it exists, or the first ancestor
@@ -56,7 +79,12 @@ signals:
 private:
     Path _target;
     Path _currentWatch;
+    bool _watchParent;
+    // Parent directory watched when _watchParent is set and the target exists
+    Path _parentWatch;
     QFileSystemWatcher _fsWatcher;
+    // Delays changed() when a settle delay is given
+    QTimer _settleTimer;
 };
 
 #endif
@@ -29,6 +29,15 @@
 #include <QUuid>
 #include <QFile>
 #include <QLocalServer>
+#include <algorithm>
+#include <vector>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
 
 // The IPC layer provides basic message framing for UTF-8-encoded payloads.
 // (The JSON-RPC implementation is connected to this IPC layer to transport its
@@ -85,6 +94,10 @@ namespace
     {
         // Threshold where IPC starts emitting the remoteLagging() signal
         DefaultLagThreshold = 10,
+        // Queued frames are normally written at the end of the event loop
+        // iteration that queued them; once this many bytes are queued, they're
+        // written immediately.
+        FrameCoalesceThreshold = 64 * 1024,
     };
 }
 
@@ -202,10 +215,11 @@ LocalSocketIPCConnection::LocalSocketIPCConnection(QLocalSocket *socket, QObject
       _payloadSequence{0},
       _lastSendSequence{0xFFF0},    // Start from a high value so wraparound is easily verified
       _acknowledgedSequence{_lastSendSequence},
-      _error{false}
+      _error{false}, _pendingBytes{0}, _flushQueued{false}
 {
     connect(socket, QOverload<QLocalSocket::LocalSocketError>::of(&QLocalSocket::error), this, [this](QLocalSocket::LocalSocketError e) {
         _error = true;
+        discardFrames();
         _socket->disconnect(this);
         emit error(_socket->errorString());
         _socket->close();
@@ -213,6 +227,9 @@ LocalSocketIPCConnection::LocalSocketIPCConnection(QLocalSocket *socket, QObject
         _socket = nullptr;
     });
     connect(socket, &QLocalSocket::disconnected, this, [this]() {
+        // Write anything still queued if the socket can take it; flushFrames()
+        // discards the frames if it can't.
+        flushFrames();
         _socket->disconnect(this);
         emit disconnected();
         _socket->deleteLater();
@@ -227,6 +244,14 @@ LocalSocketIPCConnection::LocalSocketIPCConnection(QObject *parent)
     _socket->setParent(this);
 }
 
+LocalSocketIPCConnection::~LocalSocketIPCConnection()
+{
+    // The queued flushFrames() call is dropped when this object is destroyed;
+    // send the frames that were queued before that
+    if(_socket)
+        flushFrames();
+}
+
 void LocalSocketIPCConnection::connectToServer()
 {
     connect(_socket, &QLocalSocket::connected, this, [this]()
@@ -266,9 +291,9 @@ void LocalSocketIPCConnection::setLagThreshold(int threshold)
     _lagThreshold = threshold;
 }
 
-void LocalSocketIPCConnection::writeFrame(quint16 sequence,
-                                          const QByteArray &data,
-                                          QDataStream& stream)
+void LocalSocketIPCConnection::writeFrameHeader(quint16 sequence,
+                                                const QByteArray &data,
+                                                QDataStream &stream)
 {
     auto byteOrder = stream.byteOrder();
     stream.setByteOrder(QDataStream::BigEndian);
@@ -280,16 +305,28 @@ void LocalSocketIPCConnection::writeFrame(quint16 sequence,
     quint16 sequenceHighShifted = (sequence & 0xFF00) >> 4;
     stream << sequenceLowShifted;
     stream << sequenceHighShifted;
-    // This writes a 32-bit length and the payload data
-    stream << data;
+    // The 32-bit length, as QDataStream would write it for a QByteArray (a
+    // null QByteArray is written as 0xFFFFFFFF)
+    stream << (data.isNull() ? quint32{0xFFFFFFFF} : static_cast<quint32>(data.size()));
     stream.setByteOrder(byteOrder);
 }
 
+void LocalSocketIPCConnection::writeFrame(quint16 sequence,
+                                          const QByteArray &data,
+                                          QDataStream& stream)
+{
+    writeFrameHeader(sequence, data, stream);
+    if(!data.isEmpty())
+        stream.writeRawData(data.constData(), data.size());
+}
+
 #ifdef UNIT_TEST
 void LocalSocketIPCConnection::sendRawMessage(const QByteArray& msg)
 {
     if (!isConnected())
         return;
+    // Write anything already queued first to keep the stream in order
+    flushFrames();
     auto written = _socket->write(msg);
     if (written != msg.size())
     {
@@ -313,11 +350,138 @@ void LocalSocketIPCConnection::sendFrame(quint16 sequence, const QByteArray &pay
 {
     Q_ASSERT(isConnected());     // Checked by caller
 
+    PendingFrame frame;
     {
-        QDataStream stream{_socket};
-        writeFrame(sequence, payload, stream);
+        QDataStream stream{&frame.header, QIODevice::WriteOnly};
+        writeFrameHeader(sequence, payload, stream);
     }
-    _socket->flush();
+    frame.payload = payload;
+    _pendingBytes += frame.header.size() + frame.payload.size();
+    _pendingFrames.push_back(std::move(frame));
+
+    // A burst of messages (such as a batch of data notifications followed by
+    // RPC responses) is written with one write at the end of this event loop
+    // iteration, unless it's getting large.
+    if(_pendingBytes >= FrameCoalesceThreshold)
+        flushFrames();
+    else if(!_flushQueued)
+    {
+        _flushQueued = true;
+        QMetaObject::invokeMethod(this, [this]()
+            {
+                _flushQueued = false;
+                flushFrames();
+            }, Qt::QueuedConnection);
+    }
+}
+
+#ifdef Q_OS_LINUX
+qint64 LocalSocketIPCConnection::sendFramesGathered()
+{
+    // If QLocalSocket has data buffered, it has to be written first.  (This
+    // normally only happens if the remote end isn't keeping up.)
+    if(_socket->bytesToWrite() > 0)
+        return 0;
+    int fd = static_cast<int>(_socket->socketDescriptor());
+    if(fd < 0)
+        return 0;
+
+    std::vector<iovec> iovs;
+    iovs.reserve(static_cast<std::size_t>(_pendingFrames.size()) * 2);
+    for(const auto &frame : _pendingFrames)
+    {
+        for(const QByteArray *pPart : {&frame.header, &frame.payload})
+        {
+            if(pPart->isEmpty())
+                continue;
+            iovec part{};
+            part.iov_base = const_cast<char*>(pPart->constData());
+            part.iov_len = static_cast<std::size_t>(pPart->size());
+            iovs.push_back(part);
+        }
+    }
+
+    qint64 sent = 0;
+    std::size_t next = 0;
+    while(next < iovs.size())
+    {
+        msghdr msg{};
+        msg.msg_iov = iovs.data() + next;
+        msg.msg_iovlen = std::min(iovs.size() - next, std::size_t{IOV_MAX});
+        ssize_t result = ::sendmsg(fd, &msg, MSG_NOSIGNAL|MSG_DONTWAIT);
+        if(result < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            // EAGAIN, or an error that QLocalSocket will report when it tries
+            // to write the remaining data
+            break;
+        }
+
+        sent += result;
+        // Skip the parts that were sent completely; stop if this was a short
+        // write, the socket buffer is full.
+        std::size_t remaining = static_cast<std::size_t>(result);
+        std::size_t batchEnd = next + msg.msg_iovlen;
+        while(next < batchEnd && remaining >= iovs[next].iov_len)
+        {
+            remaining -= iovs[next].iov_len;
+            ++next;
+        }
+        if(next < batchEnd)
+            break;
+    }
+    return sent;
+}
+#endif
+
+void LocalSocketIPCConnection::flushFrames()
+{
+    if(_pendingFrames.isEmpty())
+        return;
+    // Frames can still be written while the socket is closing
+    if(!_socket || !_socket->isOpen())
+    {
+        discardFrames();
+        return;
+    }
+
+    qint64 sent = 0;
+#ifdef Q_OS_LINUX
+    sent = sendFramesGathered();
+#endif
+
+    // Anything that couldn't be sent directly goes to QLocalSocket as one
+    // contiguous write.
+    if(sent < _pendingBytes)
+    {
+        QByteArray unsent;
+        unsent.reserve(static_cast<int>(_pendingBytes - sent));
+        for(const auto &frame : _pendingFrames)
+        {
+            for(const QByteArray *pPart : {&frame.header, &frame.payload})
+            {
+                if(sent >= pPart->size())
+                {
+                    sent -= pPart->size();
+                    continue;
+                }
+                unsent.append(pPart->constData() + sent,
+                              pPart->size() - static_cast<int>(sent));
+                sent = 0;
+            }
+        }
+        _socket->write(unsent);
+        _socket->flush();
+    }
+
+    discardFrames();
+}
+
+void LocalSocketIPCConnection::discardFrames()
+{
+    _pendingFrames.clear();
+    _pendingBytes = 0;
 }
 
 void LocalSocketIPCConnection::sendMessage(const QByteArray &data)
@@ -493,7 +657,10 @@ void LocalSocketIPCConnection::onReadReady()
 void LocalSocketIPCConnection::close()
 {
     if(_socket)
+    {
+        flushFrames();
         _socket->disconnectFromServer();
+    }
 }
 
 namespace
@@ -27,6 +27,7 @@
 #include <QByteArray>
 #include <QSet>
 #include <QString>
+#include <QVector>
 
 class COMMON_EXPORT IPCConnection;
 
@@ -133,11 +134,18 @@ public:
                            QDataStream &stream);
 
 private:
+    // Serialize just the header of a frame for a given payload - everything
+    // writeFrame() writes ahead of the payload bytes.
+    static void writeFrameHeader(quint16 sequence, const QByteArray &data,
+                                 QDataStream &stream);
+
     // Wrap around an existing socket
     LocalSocketIPCConnection(class QLocalSocket* socket, QObject *parent = nullptr);
 public:
     // Create a connection wrapper around an unconnected socket
     LocalSocketIPCConnection(QObject *parent = nullptr);
+    // Sends any frames that are still queued
+    virtual ~LocalSocketIPCConnection() override;
 
     // Connect to the server
     virtual void connectToServer() override;
@@ -156,7 +164,21 @@ protected slots:
 
 private:
     int getUnackedCount() const;
+    // Queue a frame to be sent.  Frames are written to the socket at the end
+    // of the current event loop iteration (see flushFrames()), or immediately
+    // if the queued frames exceed the coalescing threshold.
     void sendFrame(quint16 sequence, const QByteArray &payload);
+    // Write all queued frames to the socket with as few writes as possible.
+    void flushFrames();
+#ifdef Q_OS_LINUX
+    // Try to write the queued frames directly to the socket with one gathered
+    // send.  Returns the number of bytes sent, which may be 0 if the socket
+    // could not accept any data (or if QLocalSocket still has buffered data
+    // that must be written first).
+    qint64 sendFramesGathered();
+#endif
+    // Discard queued frames (when the socket fails with an error)
+    void discardFrames();
 
 public slots:
     virtual void sendMessage(const QByteArray &msg) override;
@@ -178,6 +200,19 @@ private:
     // The last sequence that was acknowledged from the remote side
     quint16 _acknowledgedSequence;
     bool _error;
+    // Frames queued by sendFrame() that haven't been written to the socket
+    // yet.  Each frame is stored as its serialized header and its payload; the
+    // payload is shared with the caller's QByteArray, not copied.
+    struct PendingFrame
+    {
+        QByteArray header;
+        QByteArray payload;
+    };
+    QVector<PendingFrame> _pendingFrames;
+    // Total size of _pendingFrames (headers and payloads)
+    qint64 _pendingBytes;
+    // Whether a flushFrames() call has been queued to the event loop
+    bool _flushQueued;
 
     friend class LocalSocketIPCServer;
 };
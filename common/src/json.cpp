@@ -25,6 +25,7 @@
 
 #include <QJsonDocument>
 #include <QFile>
+#include <QSaveFile>
 
 
 bool json_cast(const QJsonValue &from, bool &to) { return from.isBool() && ((to = from.toBool()), true); }
@@ -178,6 +179,12 @@ bool NativeJsonObject::isKnownProperty(const QString &name) const
 }
 
 bool NativeJsonObject::assign(const QJsonObject &properties)
+{
+    return assign(properties, {});
+}
+
+bool NativeJsonObject::assign(const QJsonObject &properties,
+                              const std::function<void()> &nativeAssign)
 {
     // Defer change signals during assign() so the entire change is observed
     // atomically
@@ -197,6 +204,11 @@ bool NativeJsonObject::assign(const QJsonObject &properties)
         setInternal(qUtf8Printable(key), key, value);
         if (!error && _error) error = std::move(_error);
     }
+    if (nativeAssign)
+    {
+        nativeAssign();
+        if (!error && _error) error = std::move(_error);
+    }
 
     if(_pDeferredChanges == &changes)
         _pDeferredChanges = nullptr;
@@ -377,3 +389,32 @@ void writeProperties(const QJsonObject& object, const Path &settingsDir,
     else
         qCritical() << "Unable to write" << filename;
 }
+
+bool writeJsonFileAtomic(const QJsonObject &object, const QString &path)
+{
+    SCOPE_LOGGING_CATEGORY("json.settings");
+
+    // QSaveFile writes to a temporary file in the same directory, flushes it
+    // to disk, and then renames it over the target in commit().  If anything
+    // fails (including a crash), the existing file is left intact.
+    QSaveFile file{path};
+    if(!file.open(QFile::WriteOnly | QFile::Text))
+    {
+        qCritical() << "Unable to open" << path << "-" << file.errorString();
+        return false;
+    }
+    const QByteArray content = QJsonDocument(object).toJson(QJsonDocument::Compact);
+    if(file.write(content) != content.size())
+    {
+        qCritical() << "Unable to write" << path << "-" << file.errorString();
+        file.cancelWriting();
+        return false;
+    }
+    if(!file.commit())
+    {
+        qCritical() << "Unable to commit" << path << "-" << file.errorString();
+        return false;
+    }
+    qDebug() << "Successfully wrote" << path;
+    return true;
+}
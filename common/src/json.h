@@ -25,6 +25,7 @@
 
 #include <cmath>
 #include <exception>
+#include <functional>
 #include <limits>
 #include <vector>
 #include <deque>
@@ -395,6 +396,10 @@ public:
     // Assign a set of name/value pairs from a QJsonObject; returns true
     // if all properties were assigned successfully.
     bool assign(const QJsonObject& properties);
+    // Assign a set of name/value pairs, and also apply native changes made by
+    // 'nativeAssign' in the same atomic change (used to apply changes that
+    // can't be expressed as plain property values).
+    bool assign(const QJsonObject& properties, const std::function<void()>& nativeAssign);
 
     // Reset all properties to their default values.
     void reset();
@@ -650,5 +655,12 @@ COMMON_EXPORT bool readProperties(NativeJsonObject &object, const Path &settings
                                   const char *filename);
 COMMON_EXPORT void writeProperties(const QJsonObject &object, const Path &settingsDir,
                                    const char *filename);
+// Write a JSON object to a file atomically - the content is written to a
+// temporary file, flushed to disk, and renamed over the target, so the target
+// always has either the old or the new content, even if the process dies or
+// the system loses power during the write.  This is thread-safe (it's used
+// from PersistenceWriter's worker thread).  Returns true if the file was
+// written.
+COMMON_EXPORT bool writeJsonFileAtomic(const QJsonObject &object, const QString &path);
 
 #endif // JSON_H
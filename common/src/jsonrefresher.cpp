@@ -26,13 +26,14 @@
 #include <QDir>
 #include <QJsonArray>
 #include <QJsonObject>
+#include <QCryptographicHash>
 
 JsonRefresher::JsonRefresher(QString name, QString resource,
                              std::chrono::milliseconds initialInterval,
                              std::chrono::milliseconds refreshInterval)
     : _name{std::move(name)}, _resource{std::move(resource)},
       _initialInterval{std::move(initialInterval)},
-      _refreshInterval{std::move(refreshInterval)}
+      _refreshInterval{std::move(refreshInterval)}, _contentAccepted{false}
 {
     connect(&_refreshTimer, &QTimer::timeout, this,
             &JsonRefresher::refreshTimerElapsed);
@@ -57,19 +58,23 @@ void JsonRefresher::refreshTimerElapsed()
         return;
     }
 
-    // Fetch the resource.  Try each possible base URI one time.
+    // Fetch the resource.  Try each possible base URI one time.  If the
+    // current content was accepted, only fetch it if it has changed.
+    auto pValidators = std::make_shared<HttpValidators>();
+    if(_contentAccepted)
+        *pValidators = _validators;
     Async<QByteArray> pBodyTask = Async<QByteArray>{new NetworkTaskWithRetry{
                                         QNetworkAccessManager::GetOperation,
                                         *_pApiBaseUris, _resource,
                                         ApiRetries::counted(_pApiBaseUris->getAttemptCount(1)),
-                                        {}, {}}};
+                                        {}, {}, pValidators}};
     // Use next() instead of notify() so we can abandon the task (if the
     // JsonRefresher is stopped) by dropping our reference to the outermost
     // task.
     // Note that the stored task refers to the void result of our callback, not
     // to the QByteArray result of the body task.
     _pFetchTask = pBodyTask->next(this,
-            [this](const Error& error, const QByteArray& body)
+            [this, pValidators](const Error& error, const QByteArray& body)
             {
                 // We shouldn't get this signal if we're not running; we abandon
                 // tasks when stopped.
@@ -87,12 +92,12 @@ void JsonRefresher::refreshTimerElapsed()
                 }
                 else
                 {
-                    emitReply(body);
+                    handleReply(body, *pValidators);
                 }
             });
 }
 
-QJsonDocument JsonRefresher::readReply(QByteArray responsePayload) const
+bool JsonRefresher::verifyReply(QByteArray &responsePayload) const
 {
     // The response can optionally contain a GPG signature appended to the
     // end after a double newline. If one exists, verify that it matches
@@ -120,7 +125,7 @@ QJsonDocument JsonRefresher::readReply(QByteArray responsePayload) const
         if (signature.isEmpty())
         {
             qError() << "Missing signature in response for" << _name;
-            return {};
+            return false;
         }
         if (!verifySignature(_signatureKey, signature, responsePayload))
         {
@@ -129,7 +134,7 @@ QJsonDocument JsonRefresher::readReply(QByteArray responsePayload) const
             if (!verifySignature(_signatureKey, signature, QByteArray(responsePayload).replace(".piaproxy.net", ".privateinternetaccess.com")))
             {
                 qError() << "Invalid signature in response for" << _name;
-                return {};
+                return false;
             }
         }
         qInfo() << "Verified signature in response for" << _name;
@@ -139,15 +144,19 @@ QJsonDocument JsonRefresher::readReply(QByteArray responsePayload) const
         qWarning() << "Unexpected signature found in response for" << _name;
     }
 
+    return true;
+}
+
+QJsonDocument JsonRefresher::parseReply(const QByteArray &jsonContent) const
+{
     // Parse the JSON response
     QJsonParseError parseError;
-    const auto &jsonDoc = QJsonDocument::fromJson(responsePayload,
-                                                         &parseError);
+    const auto &jsonDoc = QJsonDocument::fromJson(jsonContent, &parseError);
     if(jsonDoc.isNull())
     {
         qWarning() << "Could not parse" << _name << "due to error:"
             << parseError.error << "at position" << parseError.offset;
-        qWarning() << "Retrieved JSON:" << responsePayload;
+        qWarning() << "Retrieved JSON:" << jsonContent;
         return {};
     }
 
@@ -157,11 +166,60 @@ QJsonDocument JsonRefresher::readReply(QByteArray responsePayload) const
 
 void JsonRefresher::emitReply(QByteArray responsePayload)
 {
-    QJsonDocument doc{readReply(std::move(responsePayload))};
+    if(!verifyReply(responsePayload))
+        return;
+    QJsonDocument doc{parseReply(responsePayload)};
     if(!doc.isNull())
         emit contentLoaded(doc);
 }
 
+void JsonRefresher::handleReply(QByteArray responsePayload,
+                                const HttpValidators &validators)
+{
+    // We only send validators once the content has been accepted, so a 304
+    // means the accepted content is still current.
+    if(validators.notModified && _contentAccepted)
+    {
+        qInfo() << _name << "has not been modified";
+        loadSucceeded();
+        return;
+    }
+
+    if(!verifyReply(responsePayload))
+        return;
+
+    // Check the digest after verifying the signature, so an identical payload
+    // with a bad signature is still rejected.
+    QByteArray digest{QCryptographicHash::hash(responsePayload, QCryptographicHash::Algorithm::Sha256)};
+    if(_contentAccepted && digest == _contentDigest)
+    {
+        qInfo() << _name << "is unchanged";
+        _validators = validators;
+        loadSucceeded();
+        return;
+    }
+
+    QJsonDocument doc{parseReply(responsePayload)};
+    if(doc.isNull())
+        return;
+
+    // Store the validators and digest, but don't use them until the content is
+    // accepted.  If the consumer rejects this content, the next result will be
+    // fetched and emitted unconditionally.
+    _validators = validators;
+    _validators.notModified = false;
+    _contentDigest = std::move(digest);
+    _contentAccepted = false;
+    emit contentLoaded(doc);
+}
+
+void JsonRefresher::resetContentState()
+{
+    _validators = {};
+    _contentDigest.clear();
+    _contentAccepted = false;
+}
+
 bool JsonRefresher::processOverrideFile(const QString &overridePath)
 {
     QFile overrideRegionFile{overridePath};
@@ -211,6 +269,9 @@ void JsonRefresher::start(std::shared_ptr<ApiBase> pApiBaseUris)
     Q_ASSERT(!isRunning()); // Postcondition of stop()
 
     _pApiBaseUris = std::move(pApiBaseUris);
+    // Always emit the first result after starting; the consumer may have
+    // discarded the content while we were stopped.
+    resetContentState();
     // Issue a request for the resource right now.
     refreshTimerElapsed();
     // Start refreshing periodically.
@@ -287,6 +348,11 @@ bool JsonRefresher::isRunning() const
     return _refreshTimer.isActive();
 }
 
+void JsonRefresher::invalidate()
+{
+    resetContentState();
+}
+
 void JsonRefresher::refresh()
 {
     // If the timer is running, restart it with the new interval.
@@ -294,6 +360,9 @@ void JsonRefresher::refresh()
     // change the timer interval.  Here, we specifically want to issue a request
     // now and then wait the full _initialInterval - calling start() this way
     // is documented as restarting the timer if it was running before.
+    // The caller wants the content again, even if it's unchanged.
+    resetContentState();
+
     if(isRunning())
     {
         // Issue a new request now
@@ -317,4 +386,5 @@ void JsonRefresher::loadSucceeded()
     {
         _refreshTimer.setInterval(static_cast<int>(_refreshInterval.count()));
     }
+    _contentAccepted = true;
 }
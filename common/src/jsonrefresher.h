@@ -24,6 +24,7 @@
 #include "async.h"
 #include "testshim.h"
 #include "filewatcher.h"
+#include "networktaskwithretry.h"
 #include <QObject>
 #include <QJsonDocument>
 #include <QByteArray>
@@ -41,6 +42,11 @@
 // that URI will be the first one tried for subsequent attempts.
 //
 // The JSON payload is expected to have a GPG signature if signatureKey is set.
+//
+// Once a result has been accepted (see loadSucceeded()), periodic refreshes use
+// a conditional GET, and a payload identical to the accepted one isn't emitted
+// again.  Starting the refresher, or calling refresh() or invalidate(), always
+// emits the next result.
 class COMMON_EXPORT JsonRefresher : public QObject
 {
     Q_OBJECT
@@ -54,12 +60,23 @@ public:
 
 private:
     void refreshTimerElapsed();
-    // Read a reply payload into a QJsonDocument, including validating the
-    // signature if a key is configured on this JsonRefresher.  If the response
-    // can't be read for any reason, returns a null QJsonDocument.
-    QJsonDocument readReply(QByteArray responsePayload) const;
+    // Validate the signature on a reply payload if a key is configured on this
+    // JsonRefresher, and strip the signature from the payload.  If the
+    // signature can't be verified, returns false.
+    bool verifyReply(QByteArray &responsePayload) const;
+    // Parse verified JSON content.  If it can't be parsed, returns a null
+    // QJsonDocument.
+    QJsonDocument parseReply(const QByteArray &jsonContent) const;
     // Read a reply, and emit it to contentLoaded() if successful.
     void emitReply(QByteArray responsePayload);
+    // Handle a reply fetched from the endpoint.  If the server indicated that
+    // the content is unchanged, or the verified content is identical to the
+    // last content accepted, it's not parsed or emitted again.  Otherwise, it's
+    // emitted like emitReply().
+    void handleReply(QByteArray responsePayload, const HttpValidators &validators);
+    // Forget the validators and digest of the last content, so the next fetch
+    // is unconditional and its result is emitted.
+    void resetContentState();
 
     bool processOverrideFile(const QString &overridePath);
 
@@ -113,12 +130,21 @@ public:
     // interval again the next time it is started.)
     void refresh();
 
+    // Indicate that the consumer has discarded the content that was last
+    // accepted.  The next result is emitted even if it's unchanged, but no
+    // request is issued now.  (start() does this too, but it has no effect if
+    // the refresher is already running.)
+    void invalidate();
+
     // Call loadSucceeded() to indicate that data were successfully loaded from
     // a result emitted by contentLoaded().  This switches to the long interval
     // if we were using the short interval.
     //
     // This isn't implicitly done when contentLoaded is emitted, because there
     // may be resource-specific validation done on the JSON body.
+    //
+    // This also marks the last emitted content as accepted; unchanged content
+    // is not emitted again until it is replaced or the refresher is restarted.
     void loadSucceeded();
 
 signals:
@@ -144,6 +170,12 @@ public:
     Async<void> _pFetchTask;
     QByteArray _signatureKey;
     nullable_t<FileWatcher> _pOverrideFileWatcher;
+    // Validators and SHA-256 digest of the last content emitted from the
+    // endpoint.  These are only used once that content has been accepted by
+    // loadSucceeded(); otherwise the next result is always emitted.
+    HttpValidators _validators;
+    QByteArray _contentDigest;
+    bool _contentAccepted;
 };
 
 #endif
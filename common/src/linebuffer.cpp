@@ -20,30 +20,56 @@
 #line SOURCE_FILE("linebuffer.cpp")
 
 #include "linebuffer.h"
+#include <cstring>
 
 void LineBuffer::append(const QByteArray &data)
 {
-    _buffer += data;
+    const char *pData = data.constData();
+    const char *pEnd = pData + data.size();
 
-    int lineStartPos = 0;
-    int lineEndPos = _buffer.indexOf('\n', lineStartPos);
-    while(lineEndPos >= 0)
+    if(!_buffer.isEmpty())
     {
-        int lineTrimmedEnd = lineEndPos;
-        if(lineEndPos > lineStartPos && _buffer[lineEndPos-1] == '\r')
-            --lineTrimmedEnd;
+        // The buffered partial line has already been scanned, just look for the
+        // end of it in the new data
+        auto pBreak = static_cast<const char*>(std::memchr(pData, '\n', static_cast<std::size_t>(data.size())));
+        if(!pBreak)
+        {
+            _buffer += data;
+            return;
+        }
 
-        QByteArray line = _buffer.mid(lineStartPos, lineTrimmedEnd - lineStartPos);
-        emit lineComplete(line);
+        // Take the partial line out of _buffer before emitting it, in case a
+        // slot calls reset() or append()
+        QByteArray line = std::exchange(_buffer, QByteArray{});
+        line.append(pData, static_cast<int>(pBreak - pData));
+        emitLine(line.constData(), line.constData() + line.size());
+        pData = pBreak + 1;
+    }
 
-        lineStartPos = lineEndPos + 1;
-        lineEndPos = _buffer.indexOf('\n', lineStartPos);
+    // Emit lines directly from the new data
+    while(pData < pEnd)
+    {
+        auto pBreak = static_cast<const char*>(std::memchr(pData, '\n', static_cast<std::size_t>(pEnd - pData)));
+        if(!pBreak)
+            break;
+        emitLine(pData, pBreak);
+        pData = pBreak + 1;
     }
 
-    // lineStartPos is now the beginning of the last partial line in the buffer.
-    // If the buffer content ended with '\n', it's the length of the buffer, so
-    // this empties the buffer.
-    _buffer = _buffer.mid(lineStartPos);
+    // Keep the remaining partial line, if there is one.  If none of the data
+    // was consumed, this shares it instead of copying it (unless it's raw
+    // data, which QByteArray copies).
+    if(pData == data.constData())
+        _buffer += data;
+    else if(pData < pEnd)
+        _buffer.append(pData, static_cast<int>(pEnd - pData));
+}
+
+void LineBuffer::emitLine(const char *pBegin, const char *pEnd)
+{
+    if(pEnd > pBegin && *(pEnd-1) == '\r')
+        --pEnd;
+    emit lineComplete(QByteArray::fromRawData(pBegin, static_cast<int>(pEnd - pBegin)));
 }
 
 QByteArray LineBuffer::reset()
@@ -27,6 +27,11 @@
 // Any partial line that remains on destruction (a partial line that wasn't
 // terminated with a line break) is ignored.  If the process is restarted,
 // reset() can be used to reset the buffer.
+//
+// Lines are not copied out of the data given to append().  Only a trailing
+// partial line is kept, and data appended to it is only scanned once, so long
+// lines arriving in many small chunks are not rescanned or reallocated for
+// each chunk.
 class COMMON_EXPORT LineBuffer : public QObject
 {
     Q_OBJECT
@@ -39,11 +44,22 @@ public:
     // was one)
     QByteArray reset();
 
+private:
+    void emitLine(const char *pBegin, const char *pEnd);
+
 signals:
-    // A completed line was read
+    // A completed line was read (without the line break).
+    //
+    // The line does not own its data (see QByteArray::fromRawData()), it
+    // refers to the data passed to append() or the partial line buffer, and it
+    // is only valid during the signal.  It must be handled with a direct
+    // connection, and a slot that keeps the line must copy it explicitly with
+    // QByteArray{line.constData(), line.size()} - assigning or copying the
+    // QByteArray does not copy the data.
     void lineComplete(const QByteArray &line);
 
 private:
+    // The partial line following the last line break (never contains '\n')
     QByteArray _buffer;
 };
 
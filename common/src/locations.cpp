@@ -433,16 +433,14 @@ void applyLatency(Location &location, const LatencyMap &latencies)
     }
 }
 
-LocationsById buildModernLocations(const LatencyMap &latencies,
-                                   const QJsonObject &regionsObj,
-                                   const QJsonArray &shadowsocksObj,
-                                   const std::vector<AccountDedicatedIp> &dedicatedIps,
-                                   const ManualServer &manualServer)
+ModernRegions buildModernRegions(const QJsonObject &regionsObj,
+                                 const QJsonArray &shadowsocksObj)
 {
+    ModernRegions regions;
+
     // Build template Server objects for each "group" given in the regions list.
     // These will be used later to construct the actual servers by filling in
     // an ID and common name.
-    std::unordered_map<QString, Server> groupTemplates;
     const auto &groupsObj = regionsObj["groups"].toObject();
 
     // Group names are in keys, use Qt iterators
@@ -458,7 +456,7 @@ LocationsById buildModernLocations(const LatencyMap &latencies,
         // Keep groups even if they have no known services.  This prevents
         // spurious "unknown group" warnings, the servers in this group will be
         // ignored.
-        groupTemplates[itGroup.key()] = std::move(groupTemplate);
+        regions.groupTemplates[itGroup.key()] = std::move(groupTemplate);
         ++itGroup;
     }
 
@@ -484,26 +482,47 @@ LocationsById buildModernLocations(const LatencyMap &latencies,
     }
 
     // Now read the locations and use the group templates to build servers
-    LocationsById newLocations;
     const auto &regionsArray = regionsObj["regions"].toArray();
     for(const auto &regionValue : regionsArray)
     {
         const auto &regionObj = regionValue.toObject();
 
-        auto pLocation = readModernLocation(regionObj, groupTemplates, shadowsocksRegions);
+        auto pLocation = readModernLocation(regionObj, regions.groupTemplates,
+                                            shadowsocksRegions);
 
         if(pLocation)
-        {
-            applyLatency(*pLocation, latencies);
-            newLocations[pLocation->id()] = std::move(pLocation);
-        }
+            regions.locations[pLocation->id()] = std::move(pLocation);
         // Failure to load the location is traced by readModernLocation()
     }
 
+    return regions;
+}
+
+LocationsById buildModernLocations(const LatencyMap &latencies,
+                                   const QJsonObject &regionsObj,
+                                   const QJsonArray &shadowsocksObj,
+                                   const std::vector<AccountDedicatedIp> &dedicatedIps,
+                                   const ManualServer &manualServer)
+{
+    return buildModernLocations(latencies,
+                                buildModernRegions(regionsObj, shadowsocksObj),
+                                dedicatedIps, manualServer);
+}
+
+LocationsById buildModernLocations(const LatencyMap &latencies,
+                                   const ModernRegions &regions,
+                                   const std::vector<AccountDedicatedIp> &dedicatedIps,
+                                   const ManualServer &manualServer)
+{
+    // The regions are shared; updateLocationLatencies() replaces any location
+    // that gets a latency with an updated copy.
+    LocationsById newLocations{regions.locations};
+    updateLocationLatencies(newLocations, latencies);
+
     // Build dedicated IP regions
     for(const auto &dip : dedicatedIps)
     {
-        auto pLocation = buildDedicatedIpLocation(newLocations, groupTemplates, dip);
+        auto pLocation = buildDedicatedIpLocation(newLocations, regions.groupTemplates, dip);
         if(pLocation)
         {
             applyLatency(*pLocation, latencies);
@@ -512,7 +531,7 @@ LocationsById buildModernLocations(const LatencyMap &latencies,
     }
 
     // Build the manual location if one is specified
-    auto pManualLocation = buildManualLocation(newLocations, groupTemplates,
+    auto pManualLocation = buildManualLocation(newLocations, regions.groupTemplates,
                                                manualServer);
     if(pManualLocation)
     {
@@ -553,6 +572,58 @@ bool compareEntries(const Location &first, const Location &second)
     return first.id().compare(second.id(), Qt::CaseSensitivity::CaseInsensitive) < 0;
 }
 
+namespace
+{
+    // Sort locations by latency, then country, then id
+    bool compareLocationPtrs(const QSharedPointer<Location> &pFirst,
+                             const QSharedPointer<Location> &pSecond)
+    {
+        Q_ASSERT(pFirst);
+        Q_ASSERT(pSecond);
+
+        return compareEntries(*pFirst, *pSecond);
+    }
+
+    // Sort the countries by their lowest latency
+    void sortCountryGroups(std::vector<CountryLocations> &groupedLocations)
+    {
+        std::sort(groupedLocations.begin(), groupedLocations.end(),
+            [](const auto &first, const auto &second)
+            {
+                // Country groups are always created with at least 1 location
+                Q_ASSERT(!first.locations().empty());
+                Q_ASSERT(!second.locations().empty());
+                // Sort by the lowest latency for each country, then country
+                // code if the latencies are the same
+                return compareLocationPtrs(first.locations().front(),
+                                           second.locations().front());
+            });
+    }
+
+    // Replace any changed locations in a sorted list with the updated objects
+    // from 'locations'.  Returns true if any were replaced, in which case the
+    // list needs to be re-sorted.
+    bool replaceChangedLocations(const LocationsById &locations,
+                                 const std::unordered_set<QString> &changedIds,
+                                 std::vector<QSharedPointer<Location>> &sortedLocations)
+    {
+        bool replaced = false;
+        for(auto &pLocation : sortedLocations)
+        {
+            Q_ASSERT(pLocation);
+            if(changedIds.count(pLocation->id()) == 0)
+                continue;
+            auto itUpdated = locations.find(pLocation->id());
+            if(itUpdated != locations.end() && itUpdated->second)
+            {
+                pLocation = itUpdated->second;
+                replaced = true;
+            }
+        }
+        return replaced;
+    }
+}
+
 void buildGroupedLocations(const LocationsById &locations,
                            std::vector<CountryLocations> &groupedLocations,
                            std::vector<QSharedPointer<Location>> &dedicatedIpLocations)
@@ -574,22 +645,14 @@ void buildGroupedLocations(const LocationsById &locations,
     }
 
     // Sort each countries' locations by latency, then id
-    auto sortLocations = [](const QSharedPointer<Location> &pFirst,
-                            const QSharedPointer<Location> &pSecond)
-    {
-        Q_ASSERT(pFirst);
-        Q_ASSERT(pSecond);
-
-        return compareEntries(*pFirst, *pSecond);
-    };
-
     for(auto &group : countryGroups)
     {
-        std::sort(group.second.begin(), group.second.end(), sortLocations);
+        std::sort(group.second.begin(), group.second.end(), compareLocationPtrs);
     }
 
     // Sort dedicated IP locations in the same way
-    std::sort(dedicatedIpLocations.begin(), dedicatedIpLocations.end(), sortLocations);
+    std::sort(dedicatedIpLocations.begin(), dedicatedIpLocations.end(),
+              compareLocationPtrs);
 
     // Create country groups from the sorted lists
     groupedLocations.clear();
@@ -600,22 +663,59 @@ void buildGroupedLocations(const LocationsById &locations,
         groupedLocations.back().locations(group.second);
     }
 
-    // Sort the countries by their lowest latency
-    std::sort(groupedLocations.begin(), groupedLocations.end(),
-        [](const auto &first, const auto &second)
+    sortCountryGroups(groupedLocations);
+}
+
+std::unordered_set<QString> updateLocationLatencies(LocationsById &locations,
+                                                    const LatencyMap &latencies)
+{
+    std::unordered_set<QString> changedIds;
+    for(auto &locationEntry : locations)
+    {
+        Q_ASSERT(locationEntry.second);
+        auto itLatency = latencies.find(locationEntry.first);
+        // Like applyLatency(), a missing measurement leaves the current
+        // latency as-is
+        if(itLatency == latencies.end())
+            continue;
+        const Optional<double> &currentLatency = locationEntry.second->latency();
+        if(currentLatency && currentLatency.get() == itLatency->second)
+            continue;
+
+        QSharedPointer<Location> pUpdated{new Location{*locationEntry.second}};
+        pUpdated->latency(itLatency->second);
+        locationEntry.second = std::move(pUpdated);
+        changedIds.insert(locationEntry.first);
+    }
+    return changedIds;
+}
+
+void updateGroupedLocations(const LocationsById &locations,
+                            const std::unordered_set<QString> &changedIds,
+                            std::vector<CountryLocations> &groupedLocations,
+                            std::vector<QSharedPointer<Location>> &dedicatedIpLocations)
+{
+    if(changedIds.empty())
+        return;
+
+    for(auto &country : groupedLocations)
+    {
+        auto countryLocations = country.locations();
+        if(replaceChangedLocations(locations, changedIds, countryLocations))
         {
-            // Consequence of above; groupedLocations created with at least 1 location
-            Q_ASSERT(!first.locations().empty());
-            Q_ASSERT(!second.locations().empty());
-            // Sort by the lowest latency for each country, then country code if
-            // the latencies are the same
-            const auto &pFirstNearest = first.locations().front();
-            const auto &pSecondNearest = second.locations().front();
-
-            Q_ASSERT(pFirstNearest);
-            Q_ASSERT(pSecondNearest);
-            return compareEntries(*pFirstNearest, *pSecondNearest);
-        });
+            std::sort(countryLocations.begin(), countryLocations.end(),
+                      compareLocationPtrs);
+            country.locations(std::move(countryLocations));
+        }
+    }
+
+    if(replaceChangedLocations(locations, changedIds, dedicatedIpLocations))
+    {
+        std::sort(dedicatedIpLocations.begin(), dedicatedIpLocations.end(),
+                  compareLocationPtrs);
+    }
+
+    sortCountryGroups(groupedLocations);
 }
 
 NearestLocations::NearestLocations(const LocationsById &allLocations)
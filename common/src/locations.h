@@ -25,8 +25,27 @@
 #include "settings/connection.h"
 #include "settings/locations.h"
 #include "settings/dedicatedip.h"
+#include <unordered_set>
 
 
+// The regions built from the modern regions list and Shadowsocks regions list,
+// before latencies, dedicated IPs, and the manual server are applied.  This
+// only depends on the regions lists, so it can be cached (see RegionDatabase).
+//
+// The Location objects are never modified once built; buildModernLocations()
+// copies any location that needs a latency applied.
+struct ModernRegions
+{
+    LocationsById locations;
+    // Template servers for each server group in the regions list - used to
+    // build servers for dedicated IP and manual regions.
+    std::unordered_map<QString, Server> groupTemplates;
+};
+
+// Build the regions from the modern regions list and Shadowsocks regions list.
+COMMON_EXPORT ModernRegions buildModernRegions(const QJsonObject &regionsObj,
+                                               const QJsonArray &shadowsocksObj);
+
 // Build Location and Server objects for the modern region infrastructure from
 // the latencies, modern regions list, and Shadowsocks regions list.
 // Dedicated IPs and the dev manual server are added as additional regions.
@@ -35,12 +54,42 @@ COMMON_EXPORT LocationsById buildModernLocations(const LatencyMap &latencies,
                                                  const QJsonArray &shadowsocksObj,
                                                  const std::vector<AccountDedicatedIp> &dedicatedIps,
                                                  const ManualServer &manualServer);
+// Build locations from regions that were already built with
+// buildModernRegions() (or materialized from a RegionDatabase).  The result is the
+// same as building from the regions lists.
+COMMON_EXPORT LocationsById buildModernLocations(const LatencyMap &latencies,
+                                                 const ModernRegions &regions,
+                                                 const std::vector<AccountDedicatedIp> &dedicatedIps,
+                                                 const ManualServer &manualServer);
 
 // Build the grouped and sorted locations from the flat locations.
 COMMON_EXPORT void buildGroupedLocations(const LocationsById &locations,
                                          std::vector<CountryLocations> &groupedLocations,
                                          std::vector<QSharedPointer<Location>> &dedicatedIpLocations);
 
+// Apply new latency measurements to locations that have already been built,
+// without rebuilding them from the regions list.
+//
+// Location objects are shared with DaemonState and ConnectionInfo, so they are
+// never modified in place - each location whose latency changed is replaced
+// with an updated copy in 'locations'.  Returns the IDs of the replaced
+// locations (empty if no latencies changed).
+COMMON_EXPORT std::unordered_set<QString> updateLocationLatencies(LocationsById &locations,
+                                                                  const LatencyMap &latencies);
+
+// Update grouped locations previously built by buildGroupedLocations() after
+// updateLocationLatencies() replaced the locations in 'changedIds'.  Only the
+// countries containing a changed location are re-sorted internally; the
+// country order is then re-sorted since each country's nearest location may
+// have changed.
+//
+// This produces the same result as buildGroupedLocations() as long as the set
+// of locations has not changed.
+COMMON_EXPORT void updateGroupedLocations(const LocationsById &locations,
+                                          const std::unordered_set<QString> &changedIds,
+                                          std::vector<CountryLocations> &groupedLocations,
+                                          std::vector<QSharedPointer<Location>> &dedicatedIpLocations);
+
 class COMMON_EXPORT NearestLocations
 {
 public:
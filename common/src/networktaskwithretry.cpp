@@ -26,6 +26,7 @@
 #include <QTimer>
 #include <QNetworkRequest>
 #include <QNetworkReply>
+#include <algorithm>
 
 namespace
 {
@@ -43,11 +44,13 @@ NetworkTaskWithRetry::NetworkTaskWithRetry(QNetworkAccessManager::Operation verb
                                            QString resource,
                                            std::unique_ptr<ApiRetry> pRetryStrategy,
                                            const QJsonDocument &data,
-                                           QByteArray authHeaderVal)
+                                           QByteArray authHeaderVal,
+                                           std::shared_ptr<HttpValidators> pValidators)
     : _verb{std::move(verb)}, _baseUriSequence{apiBaseUris.beginAttempt()},
       _pRetryStrategy{std::move(pRetryStrategy)}, _resource{std::move(resource)},
       _data{(data.isNull() ? QByteArray() : data.toJson())},
       _authHeaderVal{std::move(authHeaderVal)},
+      _pValidators{std::move(pValidators)}, _nextAttemptId{0},
       _worstRetriableError{Error::Code::ApiNetworkError}
 {
     Q_ASSERT(_pRetryStrategy);
@@ -56,6 +59,10 @@ NetworkTaskWithRetry::NetworkTaskWithRetry(QNetworkAccessManager::Operation verb
              _verb == QNetworkAccessManager::Operation::PostOperation ||
              _verb == QNetworkAccessManager::Operation::HeadOperation);
 
+    _hedgeTimer.setSingleShot(true);
+    connect(&_hedgeTimer, &QTimer::timeout, this,
+            &NetworkTaskWithRetry::hedgeTimerElapsed);
+
     scheduleNextAttempt(std::chrono::milliseconds{0});
 }
 
@@ -73,56 +80,129 @@ void NetworkTaskWithRetry::scheduleNextAttempt(std::chrono::milliseconds nextDel
 
 void NetworkTaskWithRetry::executeNextAttempt()
 {
-    // Handle the request
-    sendRequest()
-            ->notify(this, [this](const Error& error, const QByteArray& body) {
-
-                // Release this task; it's no longer needed
-                _pNetworkReply.reset();
-
-                // Check for errors
-                if (error)
-                {
-                    // Auth and "payment required" (expired account) errors can't be retried.
-                    if (error.code() == Error::ApiUnauthorizedError || error.code() == Error::ApiPaymentRequiredError)
-                    {
-                        reject(error);
-                        return;
-                    }
-
-                    // A rate limiting error is worse than a network error - set the worst
-                    // retriable error, but keep trying in case another API endpoint gives us
-                    // 200 or 401.
-                    // (Otherwise, leave the worst error alone, it might already be set to a
-                    // rate limiting error by a prior attempt.)
-                    if (error.code() == Error::ApiRateLimitedError)
-                        _worstRetriableError = Error::Code::ApiRateLimitedError;
-
-                    qWarning() << "Attempt for" << _resource
-                        << "failed with error" << error;
-
-                    // Retry if we still have attempts left.
-                    Q_ASSERT(_pRetryStrategy);  // Class invariant
-                    auto nextDelay = _pRetryStrategy->attemptFailed(_resource);
-                    if(!nextDelay)
-                    {
-                        qWarning() << "Request for resource" << _resource
-                            << "failed, returning error" << _worstRetriableError;
-                        reject({HERE, _worstRetriableError});
-                        return;
-                    }
-                    else
-                        scheduleNextAttempt(*nextDelay);
-                }
-                else
-                {
-                    _baseUriSequence.attemptSucceeded();
-                    resolve(body);
-                }
-            });
+    _attempts.push_back({});
+    Attempt &attempt = _attempts.back();
+    attempt.id = _nextAttemptId++;
+    attempt.elapsed.start();
+    attempt.pTask = sendRequest(attempt);
+
+    quint64 attemptId = attempt.id;
+    // Hedge this attempt if permitted and there's another base to try.  Hedge
+    // no later than halfway through the attempt's timeout, or there'd be
+    // little benefit.
+    Q_ASSERT(_pRetryStrategy);  // Class invariant
+    if(_pRetryStrategy->canBeginConcurrentAttempt() &&
+       _baseUriSequence.getUriCount() > 1)
+    {
+        _hedgeTimer.start(msec(std::min(_baseUriSequence.getHedgeDelay(attempt.baseIndex),
+                                        attempt.timeout / 2)));
+    }
+
+    attempt.pTask->notify(this, [this, attemptId](const Error &error, const QByteArray &body)
+        {
+            attemptFinished(attemptId, error, body);
+        });
+}
+
+void NetworkTaskWithRetry::hedgeTimerElapsed()
+{
+    // Only hedge if exactly one attempt is in flight.  (If there are none,
+    // we're waiting to retry; if there are two, we've already hedged.)
+    if(_attempts.size() != 1)
+        return;
+
+    Q_ASSERT(_pRetryStrategy);  // Class invariant
+    if(!_pRetryStrategy->canBeginConcurrentAttempt())
+        return;
+
+    qInfo() << "Attempt for" << _resource << "has not completed after"
+        << traceMsec(_attempts.front().elapsed.elapsed())
+        << "- hedging with next base";
+    executeNextAttempt();
+}
+
+void NetworkTaskWithRetry::attemptFinished(quint64 attemptId, const Error &error,
+                                           const QByteArray &body)
+{
+    auto itAttempt = std::find_if(_attempts.begin(), _attempts.end(),
+        [attemptId](const Attempt &attempt){return attempt.id == attemptId;});
+    // If the attempt isn't in flight any more, it was aborted; ignore it.
+    if(itAttempt == _attempts.end())
+        return;
+
+    unsigned baseIndex = itAttempt->baseIndex;
+    std::chrono::milliseconds latency{itAttempt->elapsed.elapsed()};
+    _attempts.erase(itAttempt);
+
+    // Check for errors
+    if (error)
+    {
+        _baseUriSequence.attemptFailed(baseIndex);
+
+        // Auth and "payment required" (expired account) errors can't be retried.
+        if (error.code() == Error::ApiUnauthorizedError || error.code() == Error::ApiPaymentRequiredError)
+        {
+            abortAttempts();
+            reject(error);
+            return;
+        }
+
+        // A rate limiting error is worse than a network error - set the worst
+        // retriable error, but keep trying in case another API endpoint gives us
+        // 200 or 401.
+        // (Otherwise, leave the worst error alone, it might already be set to a
+        // rate limiting error by a prior attempt.)
+        if (error.code() == Error::ApiRateLimitedError)
+            _worstRetriableError = Error::Code::ApiRateLimitedError;
+
+        qWarning() << "Attempt for" << _resource
+            << "failed with error" << error;
+
+        Q_ASSERT(_pRetryStrategy);  // Class invariant
+        auto nextDelay = _pRetryStrategy->attemptFailed(_resource);
+
+        // If a hedged attempt is still in flight, it takes the place of the
+        // retry; wait for it.
+        if(!_attempts.empty())
+            return;
+
+        _hedgeTimer.stop();
+        // Retry if we still have attempts left.
+        if(!nextDelay)
+        {
+            qWarning() << "Request for resource" << _resource
+                << "failed, returning error" << _worstRetriableError;
+            reject({HERE, _worstRetriableError});
+            return;
+        }
+        else
+            scheduleNextAttempt(*nextDelay);
+    }
+    else
+    {
+        abortAttempts();
+        _baseUriSequence.attemptSucceeded(baseIndex, latency);
+        resolve(body);
+    }
 }
 
-Async<QByteArray> NetworkTaskWithRetry::sendRequest()
+void NetworkTaskWithRetry::abortAttempts()
+{
+    _hedgeTimer.stop();
+    // Remove the attempts before aborting them, so attemptFinished() ignores
+    // their results.
+    std::vector<Attempt> abortedAttempts;
+    abortedAttempts.swap(_attempts);
+    for(const auto &attempt : abortedAttempts)
+    {
+        qInfo() << "Aborting attempt for" << _resource << "to base"
+            << attempt.baseIndex;
+        if(attempt.pReply)
+            attempt.pReply->abort();
+    }
+}
+
+Async<QByteArray> NetworkTaskWithRetry::sendRequest(Attempt &attempt)
 {
     // Use ApiNetwork's QNetworkAccessManager, this binds us to the VPN
     // interface when connected (important when we do not route the default
@@ -131,12 +211,24 @@ Async<QByteArray> NetworkTaskWithRetry::sendRequest()
 
 
     const BaseUri &nextBase = _baseUriSequence.getNextUri();
+    attempt.baseIndex = _baseUriSequence.getCurrentIndex();
     ApiResource requestResource{nextBase.uri + _resource};
     QUrl requestUri{requestResource};
     QNetworkRequest request(requestUri);
     if (!_authHeaderVal.isEmpty())
         setAuth(request, _authHeaderVal);
 
+    // Make the request conditional if we have validators from a prior reply.
+    // (Accept-Encoding isn't set here; QNetworkAccessManager requests gzip and
+    // decompresses the reply itself as long as we don't set that header.)
+    if(_pValidators)
+    {
+        if(!_pValidators->etag.isEmpty())
+            request.setRawHeader(QByteArrayLiteral("If-None-Match"), _pValidators->etag);
+        if(!_pValidators->lastModified.isEmpty())
+            request.setRawHeader(QByteArrayLiteral("If-Modified-Since"), _pValidators->lastModified);
+    }
+
     // The URL for each request is logged to indicate if there is trouble with
     // specific API URLs, etc.  Query parameters are redacted by ApiResource.
     if(nextBase.pCA && !nextBase.peerVerifyName.isEmpty())
@@ -196,10 +288,12 @@ Async<QByteArray> NetworkTaskWithRetry::sendRequest()
     // in (e.g. abort->finished->delete is not currently safe). This way
     // we don't have to delay the entire finished signal to stay safe.
     QSharedPointer<QNetworkReply> reply(replyPtr, &QObject::deleteLater);
+    attempt.pReply = reply;
 
     // Abort the request if it doesn't complete within a certain interval
     Q_ASSERT(_pRetryStrategy);  // Class invariant
-    QTimer::singleShot(msec(_pRetryStrategy->beginAttempt(_resource)), reply.get(), &QNetworkReply::abort);
+    attempt.timeout = _pRetryStrategy->beginAttempt(_resource);
+    QTimer::singleShot(msec(attempt.timeout), reply.get(), &QNetworkReply::abort);
 
     // Handle redirects by permitting same-origin HTTPS redirects only
     connect(reply.get(), &QNetworkReply::redirected, this,
@@ -244,7 +338,7 @@ Async<QByteArray> NetworkTaskWithRetry::sendRequest()
     // Create a network task that resolves to the result of the request
     auto networkTask = Async<QByteArray>::create();
     ApiResource resource = _resource;
-    connect(reply.get(), &QNetworkReply::finished, networkTask.get(), [networkTask = networkTask.get(), reply, resource]
+    connect(reply.get(), &QNetworkReply::finished, networkTask.get(), [networkTask = networkTask.get(), reply, resource, pValidators = _pValidators]
     {
         auto keepAlive = networkTask->sharedFromThis();
 
@@ -296,6 +390,21 @@ Async<QByteArray> NetworkTaskWithRetry::sendRequest()
             return;
         }
 
+        if(pValidators)
+        {
+            // A 304 means the content hasn't changed since the validators were
+            // obtained; keep them.  Otherwise, store the new validators (which
+            // may be empty if the server didn't provide them).
+            if(statusCode.toInt() == 304)
+                pValidators->notModified = true;
+            else
+            {
+                pValidators->notModified = false;
+                pValidators->etag = reply->rawHeader(QByteArrayLiteral("ETag"));
+                pValidators->lastModified = reply->rawHeader(QByteArrayLiteral("Last-Modified"));
+            }
+        }
+
         networkTask->resolve(reply->readAll());
     });
 
@@ -27,11 +27,34 @@
 #include "apiretry.h"
 #include <QJsonDocument>
 #include <QNetworkAccessManager>
+#include <QElapsedTimer>
+#include <QSharedPointer>
+#include <QTimer>
 #include <memory>
+#include <vector>
+
+// HTTP cache validators for a conditional GET.  If these are set when the
+// request is sent, they're sent as If-None-Match and If-Modified-Since.  When
+// a reply is received, they're updated with the response's ETag and
+// Last-Modified headers, and notModified indicates whether the server replied
+// with 304 Not Modified (in which case the body is empty).
+struct COMMON_EXPORT HttpValidators
+{
+    QByteArray etag;
+    QByteArray lastModified;
+    bool notModified = false;
+};
 
 // NetworkTaskWithRetry executes an API request until either it succeeds or
 // the maximum attempt count is reached.  It uses a NetworkReplyHandler for each
 // attempt.
+//
+// If the retry strategy permits it (see ApiRetries::hedged()) and there is more
+// than one base URI, attempts are hedged.  If an attempt hasn't completed after
+// the hedge delay for its base (see ApiBaseData::getHedgeDelay()), another
+// attempt begins with the next base, and whichever succeeds first is used.  The
+// other attempt is aborted.  Hedged attempts count toward the retry strategy's
+// limits like any other attempt.
 class COMMON_EXPORT NetworkTaskWithRetry : public Task<QByteArray>
 {
     CLASS_LOGGING_CATEGORY("apiclient")
@@ -54,21 +77,52 @@ public:
     //
     // If authHeaderVal is not empty, it is applied as an authorization header
     // to each request.
+    //
+    // If pValidators is set, the request is made conditional using those
+    // validators, and the validators are updated from the successful reply
+    // before the task resolves.
     NetworkTaskWithRetry(QNetworkAccessManager::Operation verb,
                          ApiBase &apiBaseUris, QString resource,
                          std::unique_ptr<ApiRetry> pRetryStrategy,
-                         const QJsonDocument &data, QByteArray authHeaderVal);
+                         const QJsonDocument &data, QByteArray authHeaderVal,
+                         std::shared_ptr<HttpValidators> pValidators = {});
     ~NetworkTaskWithRetry();
 
 private:
     // Schedule an attempt, or reject if all attempts have been used.
     void scheduleNextAttempt(std::chrono::milliseconds nextDelay);
 
-    // Execute an attempt (used by scheduleNextAttempt())
+    // Execute an attempt (used by scheduleNextAttempt() and to hedge)
     void executeNextAttempt();
 
-    // Create task to issue a single request and return its body.
-    Async<QByteArray> sendRequest();
+    // The hedge delay elapsed for the current attempt; begin another attempt
+    // if it's still in flight.
+    void hedgeTimerElapsed();
+
+    // An attempt completed (successfully or not)
+    void attemptFinished(quint64 attemptId, const Error &error,
+                         const QByteArray &body);
+
+    // Abort any attempts still in flight (after another attempt succeeded, or
+    // a non-retriable error occurred).
+    void abortAttempts();
+
+    // An attempt in flight.  Up to two attempts can be in flight when hedging.
+    struct Attempt
+    {
+        quint64 id;
+        // Index of the base URI in _baseUriSequence
+        unsigned baseIndex;
+        // Timeout for the attempt from the retry strategy
+        std::chrono::milliseconds timeout;
+        QElapsedTimer elapsed;
+        QSharedPointer<QNetworkReply> pReply;
+        Async<QByteArray> pTask;
+    };
+
+    // Create task to issue a single request and return its body.  Selects the
+    // next base URI and fills in the attempt's base index and reply.
+    Async<QByteArray> sendRequest(Attempt &attempt);
 
     // Trace a leaf certificate; used by checkSslErrorPeerName().
     void traceLeafCert(const QSslCertificate &leafCert) const;
@@ -85,7 +139,12 @@ private:
     ApiResource _resource;
     QByteArray _data;
     QByteArray _authHeaderVal;
-    Async<QByteArray> _pNetworkReply;
+    std::shared_ptr<HttpValidators> _pValidators;
+    // Attempts currently in flight, and the ID for the next attempt.
+    std::vector<Attempt> _attempts;
+    quint64 _nextAttemptId;
+    // Timer used to hedge the current attempt
+    QTimer _hedgeTimer;
     // ApiRateLimitedError is retriable but causes us to return that instead of
     // the generic error if we don't encounter an auth error.
     // This field keeps track of the worst retriable error we have seen, if we
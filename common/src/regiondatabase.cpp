@@ -0,0 +1,348 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("regiondatabase.cpp")
+
+#include "regiondatabase.h"
+#include <map>
+
+const std::array<Service, RegionDatabase::ServicePortListCount> RegionDatabase::portListServices
+{{
+    Service::OpenVpnTcp,
+    Service::OpenVpnUdp,
+    Service::WireGuard,
+    Service::Shadowsocks,
+    Service::Meta
+}};
+
+namespace
+{
+    // Builds the database tables, interning strings and port lists
+    class RegionDatabaseBuilder
+    {
+    public:
+        quint32 intern(const QString &value);
+        RegionDatabase::PortList internPorts(const std::vector<quint16> &ports);
+        quint32 addServer(const Server &server);
+        void addLocation(const Location &location);
+        void addGroup(const QString &name, const Server &server);
+        RegionDatabase build();
+
+    private:
+        std::unordered_map<QString, quint32> _stringIndices;
+        std::map<std::vector<quint16>, RegionDatabase::PortList> _portLists;
+        std::vector<quint32> _stringOffsets{0};
+        std::vector<quint16> _stringData;
+        std::vector<quint16> _ports;
+        std::vector<RegionDatabase::ServerRecord> _servers;
+        std::vector<RegionDatabase::LocationRecord> _locations;
+        std::vector<RegionDatabase::GroupRecord> _groups;
+    };
+
+    quint32 RegionDatabaseBuilder::intern(const QString &value)
+    {
+        auto itIndex = _stringIndices.find(value);
+        if(itIndex != _stringIndices.end())
+            return itIndex->second;
+        quint32 index = static_cast<quint32>(_stringOffsets.size() - 1);
+        for(QChar c : value)
+            _stringData.push_back(c.unicode());
+        _stringOffsets.push_back(static_cast<quint32>(_stringData.size()));
+        _stringIndices.emplace(value, index);
+        return index;
+    }
+
+    RegionDatabase::PortList RegionDatabaseBuilder::internPorts(const std::vector<quint16> &ports)
+    {
+        auto itPortList = _portLists.find(ports);
+        if(itPortList != _portLists.end())
+            return itPortList->second;
+        RegionDatabase::PortList portList{static_cast<quint32>(_ports.size()),
+                                          static_cast<quint32>(ports.size())};
+        _ports.insert(_ports.end(), ports.begin(), ports.end());
+        _portLists.emplace(ports, portList);
+        return portList;
+    }
+
+    quint32 RegionDatabaseBuilder::addServer(const Server &server)
+    {
+        RegionDatabase::ServerRecord record{};
+        record.ip = intern(server.ip());
+        record.commonName = intern(server.commonName());
+        record.shadowsocksKey = intern(server.shadowsocksKey());
+        record.shadowsocksCipher = intern(server.shadowsocksCipher());
+        for(std::size_t i=0; i<RegionDatabase::ServicePortListCount; ++i)
+            record.portLists[i] = internPorts(server.servicePorts(RegionDatabase::portListServices[i]));
+        record.openvpnNcpSupport = server.openvpnNcpSupport();
+        _servers.push_back(record);
+        return static_cast<quint32>(_servers.size() - 1);
+    }
+
+    void RegionDatabaseBuilder::addLocation(const Location &location)
+    {
+        RegionDatabase::LocationRecord record{};
+        // Servers are added first so they're contiguous
+        record.firstServer = static_cast<quint32>(_servers.size());
+        for(const auto &server : location.servers())
+            addServer(server);
+        record.serverCount = static_cast<quint32>(location.servers().size());
+        record.id = intern(location.id());
+        record.name = intern(location.name());
+        record.country = intern(location.country());
+        record.dedicatedIp = intern(location.dedicatedIp());
+        record.dedicatedIpCorrespondingRegion = intern(location.dedicatedIpCorrespondingRegion());
+        record.dedicatedIpExpire = location.dedicatedIpExpire();
+        record.portForward = location.portForward();
+        record.geoOnly = location.geoOnly();
+        record.autoSafe = location.autoSafe();
+        record.offline = location.offline();
+        _locations.push_back(record);
+    }
+
+    void RegionDatabaseBuilder::addGroup(const QString &name, const Server &server)
+    {
+        quint32 serverIndex = addServer(server);
+        _groups.push_back({intern(name), serverIndex});
+    }
+
+    RegionDatabase RegionDatabaseBuilder::build()
+    {
+        _stringOffsets.shrink_to_fit();
+        _stringData.shrink_to_fit();
+        _ports.shrink_to_fit();
+        _servers.shrink_to_fit();
+        _locations.shrink_to_fit();
+        _groups.shrink_to_fit();
+        return RegionDatabase::fromTables(std::move(_stringOffsets),
+                                          std::move(_stringData), std::move(_ports),
+                                          std::move(_servers), std::move(_locations),
+                                          std::move(_groups));
+    }
+
+    void checkIndex(quint32 index, std::size_t count, const char *table)
+    {
+        if(index >= count)
+        {
+            qWarning() << "Region database" << table << "index" << index
+                << "is out of range, count is" << count;
+            throw Error{HERE, Error::Code::Unknown};
+        }
+    }
+
+    void checkRange(quint32 first, quint32 count, std::size_t tableSize,
+                    const char *table)
+    {
+        if(quint64{first} + count > tableSize)
+        {
+            qWarning() << "Region database" << table << "range" << first << "+"
+                << count << "is out of range, size is" << tableSize;
+            throw Error{HERE, Error::Code::Unknown};
+        }
+    }
+
+    // Creates Location and Server objects from a database.  Strings are
+    // decoded on first use, and every object using a string shares the
+    // decoded QString.
+    class RegionMaterializer
+    {
+    public:
+        RegionMaterializer(const RegionDatabase &database)
+            : _database{database}, _strings(database.stringCount()),
+              _decoded(database.stringCount())
+        {}
+
+        const QString &string(quint32 index);
+        Server server(const RegionDatabase::ServerRecord &record);
+        QSharedPointer<Location> location(const RegionDatabase::LocationRecord &record,
+                                          const LatencyMap &latencies);
+
+    private:
+        const RegionDatabase &_database;
+        std::vector<QString> _strings;
+        std::vector<bool> _decoded;
+    };
+
+    const QString &RegionMaterializer::string(quint32 index)
+    {
+        if(!_decoded[index])
+        {
+            _strings[index] = _database.string(index);
+            _decoded[index] = true;
+        }
+        return _strings[index];
+    }
+
+    Server RegionMaterializer::server(const RegionDatabase::ServerRecord &record)
+    {
+        Server server;
+        server.ip(string(record.ip));
+        server.commonName(string(record.commonName));
+        server.shadowsocksKey(string(record.shadowsocksKey));
+        server.shadowsocksCipher(string(record.shadowsocksCipher));
+        for(std::size_t i=0; i<RegionDatabase::ServicePortListCount; ++i)
+        {
+            const auto &portList = record.portLists[i];
+            if(portList.count)
+            {
+                auto itBegin = _database.ports().begin() + portList.offset;
+                server.servicePorts(RegionDatabase::portListServices[i],
+                                    std::vector<quint16>(itBegin, itBegin + portList.count));
+            }
+        }
+        server.openvpnNcpSupport(record.openvpnNcpSupport);
+        return server;
+    }
+
+    QSharedPointer<Location> RegionMaterializer::location(const RegionDatabase::LocationRecord &record,
+                                                          const LatencyMap &latencies)
+    {
+        QSharedPointer<Location> pLocation{new Location{}};
+        pLocation->id(string(record.id));
+        pLocation->name(string(record.name));
+        pLocation->country(string(record.country));
+        pLocation->dedicatedIp(string(record.dedicatedIp));
+        pLocation->dedicatedIpCorrespondingRegion(string(record.dedicatedIpCorrespondingRegion));
+        pLocation->dedicatedIpExpire(record.dedicatedIpExpire);
+        pLocation->portForward(record.portForward);
+        pLocation->geoOnly(record.geoOnly);
+        pLocation->autoSafe(record.autoSafe);
+        pLocation->offline(record.offline);
+
+        auto itLatency = latencies.find(pLocation->id());
+        if(itLatency != latencies.end())
+            pLocation->latency(itLatency->second);
+
+        std::vector<Server> servers;
+        servers.reserve(record.serverCount);
+        for(quint32 i=0; i<record.serverCount; ++i)
+            servers.push_back(server(_database.servers()[record.firstServer + i]));
+        pLocation->servers(std::move(servers));
+        return pLocation;
+    }
+}
+
+RegionDatabase RegionDatabase::build(const ModernRegions &regions)
+{
+    RegionDatabaseBuilder builder;
+    for(const auto &locationEntry : regions.locations)
+    {
+        Q_ASSERT(locationEntry.second);   // Guaranteed by buildModernRegions()
+        builder.addLocation(*locationEntry.second);
+    }
+    for(const auto &groupEntry : regions.groupTemplates)
+        builder.addGroup(groupEntry.first, groupEntry.second);
+    return builder.build();
+}
+
+RegionDatabase RegionDatabase::fromTables(std::vector<quint32> stringOffsets,
+                                          std::vector<quint16> stringData,
+                                          std::vector<quint16> ports,
+                                          std::vector<ServerRecord> servers,
+                                          std::vector<LocationRecord> locations,
+                                          std::vector<GroupRecord> groups)
+{
+    if(stringOffsets.empty() || stringOffsets.front() != 0 ||
+       stringOffsets.back() != stringData.size())
+    {
+        qWarning() << "Region database string offsets do not match string data of"
+            << stringData.size() << "characters";
+        throw Error{HERE, Error::Code::Unknown};
+    }
+    for(std::size_t i=1; i<stringOffsets.size(); ++i)
+    {
+        if(stringOffsets[i] < stringOffsets[i-1])
+        {
+            qWarning() << "Region database string" << (i-1) << "has invalid range"
+                << stringOffsets[i-1] << "-" << stringOffsets[i];
+            throw Error{HERE, Error::Code::Unknown};
+        }
+    }
+    const std::size_t stringCount = stringOffsets.size() - 1;
+
+    for(const auto &server : servers)
+    {
+        checkIndex(server.ip, stringCount, "string");
+        checkIndex(server.commonName, stringCount, "string");
+        checkIndex(server.shadowsocksKey, stringCount, "string");
+        checkIndex(server.shadowsocksCipher, stringCount, "string");
+        for(const auto &portList : server.portLists)
+            checkRange(portList.offset, portList.count, ports.size(), "port");
+    }
+    for(const auto &location : locations)
+    {
+        checkIndex(location.id, stringCount, "string");
+        checkIndex(location.name, stringCount, "string");
+        checkIndex(location.country, stringCount, "string");
+        checkIndex(location.dedicatedIp, stringCount, "string");
+        checkIndex(location.dedicatedIpCorrespondingRegion, stringCount, "string");
+        checkRange(location.firstServer, location.serverCount, servers.size(), "server");
+    }
+    for(const auto &group : groups)
+    {
+        checkIndex(group.name, stringCount, "string");
+        checkIndex(group.server, servers.size(), "server");
+    }
+
+    RegionDatabase database;
+    database._stringOffsets = std::move(stringOffsets);
+    database._stringData = std::move(stringData);
+    database._ports = std::move(ports);
+    database._servers = std::move(servers);
+    database._locations = std::move(locations);
+    database._groups = std::move(groups);
+    return database;
+}
+
+QString RegionDatabase::string(quint32 index) const
+{
+    Q_ASSERT(index < stringCount());    // Guaranteed by caller
+    quint32 begin = _stringOffsets[index];
+    quint32 end = _stringOffsets[index + 1];
+    return QString{reinterpret_cast<const QChar*>(_stringData.data() + begin),
+                   static_cast<int>(end - begin)};
+}
+
+ModernRegions RegionDatabase::materialize(const LatencyMap &latencies) const
+{
+    RegionMaterializer materializer{*this};
+    ModernRegions regions;
+    regions.locations.reserve(_locations.size());
+    for(const auto &record : _locations)
+    {
+        auto pLocation = materializer.location(record, latencies);
+        regions.locations[pLocation->id()] = std::move(pLocation);
+    }
+    regions.groupTemplates.reserve(_groups.size());
+    for(const auto &group : _groups)
+    {
+        regions.groupTemplates.emplace(materializer.string(group.name),
+                                       materializer.server(_servers[group.server]));
+    }
+    return regions;
+}
+
+std::size_t RegionDatabase::memoryUsage() const
+{
+    std::size_t usage = _stringOffsets.capacity() * sizeof(quint32);
+    usage += _stringData.capacity() * sizeof(quint16);
+    usage += _ports.capacity() * sizeof(quint16);
+    usage += _servers.capacity() * sizeof(ServerRecord);
+    usage += _locations.capacity() * sizeof(LocationRecord);
+    usage += _groups.capacity() * sizeof(GroupRecord);
+    return usage;
+}
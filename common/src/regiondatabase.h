@@ -0,0 +1,137 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("regiondatabase.h")
+
+#ifndef REGIONDATABASE_H
+#define REGIONDATABASE_H
+
+#include "locations.h"
+#include <array>
+#include <vector>
+
+// RegionDatabase is a compact, flat representation of the regions built from
+// the modern regions lists (ModernRegions).
+//
+// Location and Server are NativeJsonObjects - each one is a QObject with its
+// own QStrings and port vectors.  The regions list has thousands of servers
+// that mostly repeat the same few port lists and strings, so the daemon keeps
+// the cached regions in this form instead:
+// - strings are interned; each distinct string is stored once, as UTF-16 in
+//   one flat table (not as QStrings - those are only created when needed)
+// - port lists are stored once each in a shared port table; servers refer to
+//   them by index
+// - servers are stored in one contiguous array, and each location refers to a
+//   range of that array
+//
+// Location/Server objects are only produced from the database when the
+// daemon's locations are rebuilt - see materialize().  The daemon keeps only
+// the database and the resulting locations in DaemonState; it does not keep
+// another set of Location objects for the cached regions.
+//
+// RegionDatabase is immutable once built, so it can be shared between threads
+// (PersistenceWriter writes it to a RegionSnapshot on its worker thread).
+class COMMON_EXPORT RegionDatabase
+{
+public:
+    // Port lists in the order they're stored in ServerRecord::portLists
+    enum : std::size_t { ServicePortListCount = 5 };
+    static const std::array<Service, ServicePortListCount> portListServices;
+
+    // A range in the port table
+    struct PortList
+    {
+        quint32 offset;
+        quint32 count;
+    };
+
+    struct ServerRecord
+    {
+        // String indices
+        quint32 ip, commonName, shadowsocksKey, shadowsocksCipher;
+        // Port lists for each service in portListServices
+        std::array<PortList, ServicePortListCount> portLists;
+        bool openvpnNcpSupport;
+    };
+
+    struct LocationRecord
+    {
+        // String indices
+        quint32 id, name, country, dedicatedIp, dedicatedIpCorrespondingRegion;
+        quint64 dedicatedIpExpire;
+        bool portForward, geoOnly, autoSafe, offline;
+        // Range of servers in the server table
+        quint32 firstServer, serverCount;
+    };
+
+    struct GroupRecord
+    {
+        quint32 name;   // String index
+        quint32 server; // Template server index in the server table
+    };
+
+public:
+    // Build a database from built regions.
+    static RegionDatabase build(const ModernRegions &regions);
+
+    // Build a database from existing tables (used by RegionSnapshot).  The
+    // string table is given as the UTF-16 string data and the offset of each
+    // string in that data (plus a final offset for the end of the data).  All
+    // offsets and indices are validated; throws Error if any are out of range.
+    static RegionDatabase fromTables(std::vector<quint32> stringOffsets,
+                                     std::vector<quint16> stringData,
+                                     std::vector<quint16> ports,
+                                     std::vector<ServerRecord> servers,
+                                     std::vector<LocationRecord> locations,
+                                     std::vector<GroupRecord> groups);
+
+public:
+    const std::vector<quint32> &stringOffsets() const {return _stringOffsets;}
+    const std::vector<quint16> &stringData() const {return _stringData;}
+    std::size_t stringCount() const {return _stringOffsets.empty() ? 0 : _stringOffsets.size() - 1;}
+    // Decode a string from the string table
+    QString string(quint32 index) const;
+
+    const std::vector<quint16> &ports() const {return _ports;}
+    const std::vector<ServerRecord> &servers() const {return _servers;}
+    const std::vector<LocationRecord> &locations() const {return _locations;}
+    const std::vector<GroupRecord> &groups() const {return _groups;}
+
+    bool empty() const {return _locations.empty();}
+
+    // Create Location and Server objects for all regions, applying latencies
+    // to the locations as they're created.  Each string is decoded once, all
+    // of the created objects that use it share the same QString.
+    //
+    // Applying the latencies here means that buildModernLocations() does not
+    // have to copy each location again to apply them.
+    ModernRegions materialize(const LatencyMap &latencies = {}) const;
+
+    // Approximate heap memory used by the database, in bytes
+    std::size_t memoryUsage() const;
+
+private:
+    std::vector<quint32> _stringOffsets{0};
+    std::vector<quint16> _stringData;
+    std::vector<quint16> _ports;
+    std::vector<ServerRecord> _servers;
+    std::vector<LocationRecord> _locations;
+    std::vector<GroupRecord> _groups;
+};
+
+#endif
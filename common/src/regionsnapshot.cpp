@@ -0,0 +1,479 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("regionsnapshot.cpp")
+
+#include "regionsnapshot.h"
+#include <QCryptographicHash>
+#include <QSaveFile>
+#include <QtEndian>
+#include <cstring>
+
+namespace
+{
+    const char snapshotMagic[8]{'P', 'I', 'A', 'R', 'G', 'S', 'N', 'P'};
+
+    enum : quint32
+    {
+        // Increment when the format changes; older snapshots are then ignored
+        FormatVersion = 1,
+    };
+
+    enum : int
+    {
+        HeaderSize = 64,
+        ChecksumSize = 16,  // MD5
+        // Header field offsets
+        MagicOffset = 0,
+        VersionOffset = 8,
+        PayloadSizeOffset = 12,
+        ChecksumOffset = 16,
+        StringCountOffset = 32,
+        PortCountOffset = 36,
+        ServerCountOffset = 40,
+        LocationCountOffset = 44,
+        GroupCountOffset = 48,
+        SourceIdOffset = 52,
+        // 56-63 reserved
+
+        // Server record: ip, commonName, shadowsocksKey, shadowsocksCipher,
+        // flags, then (offset, count) for each port list
+        ServerRecordSize = 5 * 4 + RegionDatabase::ServicePortListCount * 8,
+        // Location record: id, name, country, dedicatedIp,
+        // dedicatedIpCorrespondingRegion, dedicatedIpExpire (u64), flags,
+        // first server, server count
+        LocationRecordSize = 5 * 4 + 8 + 3 * 4,
+        // Group record: name, server
+        GroupRecordSize = 2 * 4,
+    };
+
+    enum : quint32
+    {
+        ServerOpenvpnNcpSupport = 0x01,
+
+        LocationPortForward = 0x01,
+        LocationGeoOnly = 0x02,
+        LocationAutoSafe = 0x04,
+        LocationOffline = 0x08,
+    };
+
+    void appendU16(QByteArray &buffer, quint16 value)
+    {
+        uchar bytes[sizeof(value)];
+        qToLittleEndian(value, bytes);
+        buffer.append(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+    }
+    void appendU32(QByteArray &buffer, quint32 value)
+    {
+        uchar bytes[sizeof(value)];
+        qToLittleEndian(value, bytes);
+        buffer.append(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+    }
+    void appendU64(QByteArray &buffer, quint64 value)
+    {
+        uchar bytes[sizeof(value)];
+        qToLittleEndian(value, bytes);
+        buffer.append(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+    }
+    void padToU32(QByteArray &buffer)
+    {
+        while(buffer.size() % 4)
+            buffer.append('\0');
+    }
+
+    quint32 readU32(const uchar *pData) {return qFromLittleEndian<quint32>(pData);}
+    quint64 readU64(const uchar *pData) {return qFromLittleEndian<quint64>(pData);}
+
+    // Reads the tables from a mapped snapshot.  The constructor locates the
+    // tables and checks that they fit in the payload; indices in the records
+    // are checked by RegionDatabase::fromTables().
+    class SnapshotReader
+    {
+        CLASS_LOGGING_CATEGORY("regionsnapshot");
+
+    public:
+        // The header must have been validated (magic, version, size,
+        // checksum) already.
+        SnapshotReader(const uchar *pData, qint64 size);
+
+        QString sourceId() const;
+        RegionDatabase database() const;
+
+    private:
+        // Get a pointer to a table, advancing 'offset' past it, and check that
+        // it fits in the snapshot
+        const uchar *takeTable(qint64 &offset, qint64 tableSize);
+        QString string(quint32 index) const;
+
+    private:
+        const uchar *_pData;
+        qint64 _size;
+        quint32 _stringCount, _portCount, _serverCount, _locationCount,
+            _groupCount, _sourceIdIndex;
+        const uchar *_pStringOffsets, *_pStringData, *_pPorts, *_pServers,
+            *_pLocations, *_pGroups;
+        quint32 _stringDataSize;
+    };
+
+    SnapshotReader::SnapshotReader(const uchar *pData, qint64 size)
+        : _pData{pData}, _size{size}
+    {
+        Q_ASSERT(_size >= HeaderSize);  // Checked by caller
+        _stringCount = readU32(_pData + StringCountOffset);
+        _portCount = readU32(_pData + PortCountOffset);
+        _serverCount = readU32(_pData + ServerCountOffset);
+        _locationCount = readU32(_pData + LocationCountOffset);
+        _groupCount = readU32(_pData + GroupCountOffset);
+        _sourceIdIndex = readU32(_pData + SourceIdOffset);
+
+        qint64 offset{HeaderSize};
+        _pStringOffsets = takeTable(offset, (qint64{_stringCount} + 1) * 4);
+        _stringDataSize = readU32(_pStringOffsets + qint64{_stringCount} * 4);
+        _pStringData = takeTable(offset, qint64{_stringDataSize} * 2);
+        offset = (offset + 3) & ~qint64{3};
+        _pPorts = takeTable(offset, qint64{_portCount} * 2);
+        offset = (offset + 3) & ~qint64{3};
+        _pServers = takeTable(offset, qint64{_serverCount} * ServerRecordSize);
+        _pLocations = takeTable(offset, qint64{_locationCount} * LocationRecordSize);
+        _pGroups = takeTable(offset, qint64{_groupCount} * GroupRecordSize);
+        if(offset != _size)
+        {
+            qWarning() << "Region snapshot has" << (_size - offset)
+                << "unexpected trailing bytes";
+            throw Error{HERE, Error::Code::Unknown};
+        }
+        if(_sourceIdIndex >= _stringCount)
+        {
+            qWarning() << "Region snapshot source ID index" << _sourceIdIndex
+                << "is out of range, count is" << _stringCount;
+            throw Error{HERE, Error::Code::Unknown};
+        }
+    }
+
+    const uchar *SnapshotReader::takeTable(qint64 &offset, qint64 tableSize)
+    {
+        if(offset + tableSize > _size)
+        {
+            qWarning() << "Region snapshot table at" << offset << "with size"
+                << tableSize << "exceeds snapshot size" << _size;
+            throw Error{HERE, Error::Code::Unknown};
+        }
+        const uchar *pTable = _pData + offset;
+        offset += tableSize;
+        return pTable;
+    }
+
+    QString SnapshotReader::string(quint32 index) const
+    {
+        Q_ASSERT(index < _stringCount); // Guaranteed by caller
+        quint32 begin = readU32(_pStringOffsets + qint64{index} * 4);
+        quint32 end = readU32(_pStringOffsets + (qint64{index} + 1) * 4);
+        if(begin > end || end > _stringDataSize)
+        {
+            qWarning() << "Region snapshot string" << index
+                << "has invalid range" << begin << "-" << end;
+            throw Error{HERE, Error::Code::Unknown};
+        }
+        const uchar *pChars = _pStringData + qint64{begin} * 2;
+        int length = static_cast<int>(end - begin);
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        // The string data are 2-byte aligned (the tables are 4-byte aligned,
+        // and the mapping is page-aligned), so they can be copied directly.
+        return QString{reinterpret_cast<const QChar*>(pChars), length};
+#else
+        QString value;
+        value.resize(length);
+        for(int i=0; i<length; ++i)
+            value[i] = QChar{qFromLittleEndian<quint16>(pChars + i * 2)};
+        return value;
+#endif
+    }
+
+    QString SnapshotReader::sourceId() const
+    {
+        return string(_sourceIdIndex);
+    }
+
+    RegionDatabase SnapshotReader::database() const
+    {
+        // The source ID is stored after the database's strings (see
+        // RegionSnapshot::serialize()); leave it out of the database
+        quint32 databaseStringCount = _stringCount;
+        if(_sourceIdIndex == _stringCount - 1)
+            --databaseStringCount;
+        // The string table is copied as-is; strings are only decoded when
+        // Location objects are materialized from the database
+        std::vector<quint32> stringOffsets;
+        stringOffsets.reserve(std::size_t{databaseStringCount} + 1);
+        for(quint32 i=0; i<=databaseStringCount; ++i)
+            stringOffsets.push_back(readU32(_pStringOffsets + qint64{i} * 4));
+        if(stringOffsets.back() > _stringDataSize)
+        {
+            qWarning() << "Region snapshot string data size" << stringOffsets.back()
+                << "exceeds table size" << _stringDataSize;
+            throw Error{HERE, Error::Code::Unknown};
+        }
+        std::vector<quint16> stringData(stringOffsets.back());
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        // The string data are 2-byte aligned (the tables are 4-byte aligned,
+        // and the mapping is page-aligned), so they can be copied directly.
+        if(!stringData.empty())
+            std::memcpy(stringData.data(), _pStringData, stringData.size() * 2);
+#else
+        for(std::size_t i=0; i<stringData.size(); ++i)
+            stringData[i] = qFromLittleEndian<quint16>(_pStringData + i * 2);
+#endif
+
+        std::vector<quint16> ports;
+        ports.reserve(_portCount);
+        for(quint32 i=0; i<_portCount; ++i)
+            ports.push_back(qFromLittleEndian<quint16>(_pPorts + qint64{i} * 2));
+
+        std::vector<RegionDatabase::ServerRecord> servers;
+        servers.reserve(_serverCount);
+        for(quint32 i=0; i<_serverCount; ++i)
+        {
+            const uchar *pRecord = _pServers + qint64{i} * ServerRecordSize;
+            RegionDatabase::ServerRecord server{};
+            server.ip = readU32(pRecord);
+            server.commonName = readU32(pRecord + 4);
+            server.shadowsocksKey = readU32(pRecord + 8);
+            server.shadowsocksCipher = readU32(pRecord + 12);
+            server.openvpnNcpSupport = readU32(pRecord + 16) & ServerOpenvpnNcpSupport;
+            const uchar *pPortList = pRecord + 20;
+            for(auto &portList : server.portLists)
+            {
+                portList.offset = readU32(pPortList);
+                portList.count = readU32(pPortList + 4);
+                pPortList += 8;
+            }
+            servers.push_back(server);
+        }
+
+        std::vector<RegionDatabase::LocationRecord> locations;
+        locations.reserve(_locationCount);
+        for(quint32 i=0; i<_locationCount; ++i)
+        {
+            const uchar *pRecord = _pLocations + qint64{i} * LocationRecordSize;
+            RegionDatabase::LocationRecord location{};
+            location.id = readU32(pRecord);
+            location.name = readU32(pRecord + 4);
+            location.country = readU32(pRecord + 8);
+            location.dedicatedIp = readU32(pRecord + 12);
+            location.dedicatedIpCorrespondingRegion = readU32(pRecord + 16);
+            location.dedicatedIpExpire = readU64(pRecord + 20);
+            quint32 flags = readU32(pRecord + 28);
+            location.portForward = flags & LocationPortForward;
+            location.geoOnly = flags & LocationGeoOnly;
+            location.autoSafe = flags & LocationAutoSafe;
+            location.offline = flags & LocationOffline;
+            location.firstServer = readU32(pRecord + 32);
+            location.serverCount = readU32(pRecord + 36);
+            locations.push_back(location);
+        }
+
+        std::vector<RegionDatabase::GroupRecord> groups;
+        groups.reserve(_groupCount);
+        for(quint32 i=0; i<_groupCount; ++i)
+        {
+            const uchar *pRecord = _pGroups + qint64{i} * GroupRecordSize;
+            groups.push_back({readU32(pRecord), readU32(pRecord + 4)});
+        }
+
+        return RegionDatabase::fromTables(std::move(stringOffsets),
+                                          std::move(stringData), std::move(ports),
+                                          std::move(servers), std::move(locations),
+                                          std::move(groups));
+    }
+}
+
+QByteArray RegionSnapshot::serialize(const RegionDatabase &database,
+                                     const QString &sourceId)
+{
+    // The source ID is stored as an extra string after the database's strings
+    const quint32 stringCount = static_cast<quint32>(database.stringCount() + 1);
+
+    QByteArray payload;
+    for(quint32 offset : database.stringOffsets())
+        appendU32(payload, offset);
+    appendU32(payload, static_cast<quint32>(database.stringData().size() + sourceId.size()));
+    for(quint16 c : database.stringData())
+        appendU16(payload, c);
+    for(QChar c : sourceId)
+        appendU16(payload, c.unicode());
+    padToU32(payload);
+    for(quint16 port : database.ports())
+        appendU16(payload, port);
+    padToU32(payload);
+    for(const auto &server : database.servers())
+    {
+        appendU32(payload, server.ip);
+        appendU32(payload, server.commonName);
+        appendU32(payload, server.shadowsocksKey);
+        appendU32(payload, server.shadowsocksCipher);
+        appendU32(payload, server.openvpnNcpSupport ? ServerOpenvpnNcpSupport : 0);
+        for(const auto &portList : server.portLists)
+        {
+            appendU32(payload, portList.offset);
+            appendU32(payload, portList.count);
+        }
+    }
+    for(const auto &location : database.locations())
+    {
+        quint32 flags{0};
+        if(location.portForward)
+            flags |= LocationPortForward;
+        if(location.geoOnly)
+            flags |= LocationGeoOnly;
+        if(location.autoSafe)
+            flags |= LocationAutoSafe;
+        if(location.offline)
+            flags |= LocationOffline;
+
+        appendU32(payload, location.id);
+        appendU32(payload, location.name);
+        appendU32(payload, location.country);
+        appendU32(payload, location.dedicatedIp);
+        appendU32(payload, location.dedicatedIpCorrespondingRegion);
+        appendU64(payload, location.dedicatedIpExpire);
+        appendU32(payload, flags);
+        appendU32(payload, location.firstServer);
+        appendU32(payload, location.serverCount);
+    }
+    for(const auto &group : database.groups())
+    {
+        appendU32(payload, group.name);
+        appendU32(payload, group.server);
+    }
+
+    QByteArray snapshot;
+    snapshot.reserve(HeaderSize + payload.size());
+    snapshot.append(snapshotMagic, sizeof(snapshotMagic));
+    appendU32(snapshot, FormatVersion);
+    appendU32(snapshot, static_cast<quint32>(payload.size()));
+    snapshot.append(QCryptographicHash::hash(payload, QCryptographicHash::Md5));
+    appendU32(snapshot, stringCount);
+    appendU32(snapshot, static_cast<quint32>(database.ports().size()));
+    appendU32(snapshot, static_cast<quint32>(database.servers().size()));
+    appendU32(snapshot, static_cast<quint32>(database.locations().size()));
+    appendU32(snapshot, static_cast<quint32>(database.groups().size()));
+    appendU32(snapshot, stringCount - 1);
+    snapshot.append(HeaderSize - snapshot.size(), '\0');
+    Q_ASSERT(snapshot.size() == HeaderSize);
+    snapshot.append(payload);
+    return snapshot;
+}
+
+bool RegionSnapshot::write(const QString &path, const RegionDatabase &database,
+                           const QString &sourceId)
+{
+    const QByteArray snapshot = serialize(database, sourceId);
+
+    QSaveFile file{path};
+    if(!file.open(QFile::WriteOnly) ||
+       file.write(snapshot) != snapshot.size() || !file.commit())
+    {
+        qWarning() << "Unable to write region snapshot" << path << "-"
+            << file.errorString();
+        return false;
+    }
+    qDebug() << "Wrote region snapshot" << path << "-" << snapshot.size()
+        << "bytes," << database.locations().size() << "regions";
+    return true;
+}
+
+bool RegionSnapshot::open(const QString &path)
+{
+    _file.close();
+    _pData = nullptr;
+    _size = 0;
+    _sourceId.clear();
+
+    _file.setFileName(path);
+    if(!_file.open(QFile::ReadOnly))
+    {
+        qInfo() << "No region snapshot at" << path << "-" << _file.errorString();
+        return false;
+    }
+
+    qint64 size = _file.size();
+    if(size < HeaderSize)
+    {
+        qWarning() << "Region snapshot is too small:" << size << "bytes";
+        _file.close();
+        return false;
+    }
+    const uchar *pData = _file.map(0, size);
+    if(!pData)
+    {
+        qWarning() << "Unable to map region snapshot -" << _file.errorString();
+        _file.close();
+        return false;
+    }
+
+    const char *pChars = reinterpret_cast<const char*>(pData);
+    quint32 version = readU32(pData + VersionOffset);
+    quint32 payloadSize = readU32(pData + PayloadSizeOffset);
+    if(std::memcmp(pData + MagicOffset, snapshotMagic, sizeof(snapshotMagic)) != 0 ||
+       version != FormatVersion || qint64{payloadSize} != size - HeaderSize)
+    {
+        qInfo() << "Region snapshot has unsupported format - version"
+            << version << "- payload size" << payloadSize << "- file size" << size;
+        _file.close();
+        return false;
+    }
+    QByteArray checksum = QCryptographicHash::hash(QByteArray::fromRawData(pChars + HeaderSize, payloadSize),
+                                                   QCryptographicHash::Md5);
+    if(checksum != QByteArray::fromRawData(pChars + ChecksumOffset, ChecksumSize))
+    {
+        qWarning() << "Region snapshot checksum does not match";
+        _file.close();
+        return false;
+    }
+
+    try
+    {
+        _sourceId = SnapshotReader{pData, size}.sourceId();
+    }
+    catch(const Error &ex)
+    {
+        qWarning() << "Region snapshot is malformed:" << ex;
+        _file.close();
+        return false;
+    }
+
+    _pData = pData;
+    _size = size;
+    return true;
+}
+
+RegionDatabase RegionSnapshot::database() const
+{
+    if(!_pData)
+        return {};
+
+    try
+    {
+        return SnapshotReader{_pData, _size}.database();
+    }
+    catch(const Error &ex)
+    {
+        qWarning() << "Region snapshot is malformed:" << ex;
+        return {};
+    }
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("regionsnapshot.h")
+
+#ifndef REGIONSNAPSHOT_H
+#define REGIONSNAPSHOT_H
+
+#include "regiondatabase.h"
+#include <QFile>
+
+// RegionSnapshot is a binary file containing a RegionDatabase - the regions
+// built from the modern regions lists.
+//
+// Building the regions means walking the whole regions list JSON and
+// constructing every Location and Server, which is a significant part of the
+// daemon's startup time.  The daemon writes a snapshot whenever the regions
+// lists change, and at startup it maps the snapshot and loads the database's
+// tables from it directly.
+//
+// The snapshot is identified by a "source ID" that is stored along with the
+// regions lists in DaemonData.  If the ID in the snapshot doesn't match (the
+// snapshot wasn't written after the last change, it's from another version,
+// or it's damaged), the daemon builds from the JSON as before.
+//
+// Format (all integers are little-endian):
+// - Header (64 bytes): magic, format version, payload size, MD5 of the payload,
+//   table counts, and the string index of the source ID
+// - String table: offsets (u32, in UTF-16 code units) followed by the UTF-16
+//   string data.  This is the database's string table, plus the source ID.
+// - Port table (u16)
+// - Server records: string indices, flags, and ranges in the port table
+// - Location records: string indices, flags, and a range of server records
+// - Group records: group name string index and a server record index for the
+//   group's template server
+class COMMON_EXPORT RegionSnapshot
+{
+    CLASS_LOGGING_CATEGORY("regionsnapshot");
+
+public:
+    // Serialize a region database to the snapshot format.
+    static QByteArray serialize(const RegionDatabase &database, const QString &sourceId);
+    // Serialize a region database and write a snapshot file atomically (like
+    // writeJsonFileAtomic()).  Returns true if the file was written.
+    static bool write(const QString &path, const RegionDatabase &database,
+                      const QString &sourceId);
+
+public:
+    // Map a snapshot file and validate its header and checksum.  Returns
+    // false (and traces why) if the file doesn't exist or isn't valid.  If it
+    // succeeds, sourceId() and database() can be used.
+    bool open(const QString &path);
+
+    // The source ID given when the snapshot was written.  Empty if the
+    // snapshot hasn't been opened.
+    const QString &sourceId() const {return _sourceId;}
+
+    // Load the region database from the snapshot.  If the snapshot is
+    // malformed, this traces the problem and returns an empty database.
+    RegionDatabase database() const;
+
+private:
+    QFile _file;
+    // The mapped snapshot, valid after a successful open()
+    const uchar *_pData{nullptr};
+    qint64 _size{0};
+    QString _sourceId;
+};
+
+#endif
@@ -109,6 +109,10 @@ public:
     // changed.
     JsonField(QJsonArray, cachedModernShadowsocksList, {})
     JsonField(QJsonObject, cachedModernRegionsList, {})
+    // Identifies the current content of the cached regions lists above.  This
+    // changes whenever either list changes; the daemon's region snapshot
+    // (RegionSnapshot) is only used if it was built with the same ID.
+    JsonField(QString, cachedModernRegionsId, {})
 
     JsonField(QJsonObject, modernRegionMeta, {})
 
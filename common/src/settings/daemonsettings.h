@@ -174,6 +174,13 @@ public:
     // available.
     JsonField(bool, wireguardUseKernel, true)
 
+    // Firewall backend used for the filter rules on Linux.  "nftables" applies
+    // them with netlink transactions instead of iptables; if nftables can't
+    // be used, the daemon falls back to iptables.  With nftables, traffic
+    // that the rules allow can still be blocked by the host's own firewall
+    // rules (see NftablesFirewall).
+    JsonField(QString, linuxFirewallBackend, QStringLiteral("iptables"), {"iptables", "nftables"})
+
     // If no data is received for (wireguardPingTimeout/2) seconds, fire off a ping.
     // If no data is recieved for another (wireguardPingTimeout/2) seconds, assume that the connection
     // is lost
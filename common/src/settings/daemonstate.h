@@ -118,6 +118,45 @@ public:
     JsonField(bool, portForward, false)
 };
 
+// The daemon's latency probe schedule - latencies are measured on an adaptive
+// schedule rather than all at once.  This is only provided for observability.
+// The per-location schedule changes after every batch, and DaemonState is sent
+// to all clients, so the daemon publishes it at most once per 30 seconds.
+class COMMON_EXPORT LatencyProbeSchedule : public NativeJsonObject
+{
+    Q_OBJECT
+
+public:
+    LatencyProbeSchedule() {}
+    LatencyProbeSchedule(const LatencyProbeSchedule &other) {*this = other;}
+    LatencyProbeSchedule &operator=(const LatencyProbeSchedule &other)
+    {
+        probeBudget(other.probeBudget());
+        probesPerHour(other.probesPerHour());
+        nextProbes(other.nextProbes());
+        return *this;
+    }
+    bool operator==(const LatencyProbeSchedule &other) const
+    {
+        return probeBudget() == other.probeBudget() &&
+            probesPerHour() == other.probesPerHour() &&
+            nextProbes() == other.nextProbes();
+    }
+    bool operator!=(const LatencyProbeSchedule &other) const
+    {
+        return !(*this == other);
+    }
+
+public:
+    // Maximum number of locations probed in one batch
+    JsonField(int, probeBudget, 0)
+    // Projected number of probes per hour with the current schedule
+    JsonField(double, probesPerHour, 0)
+    // Time of the next probe for each location ID (milliseconds since the
+    // epoch)
+    JsonField(std::unordered_map<QString, qint64>, nextProbes, {})
+};
+
 // Class encapsulating 'state' properties of the daemon; these describe
 // the current state of the daemon and the VPN connection, and are not
 // saved to disk. These are combined with the 'data' object when passed
@@ -268,6 +307,9 @@ public:
     // to regions.
     JsonField(LocationsById, availableLocations, {})
 
+    // The latency probe schedule for availableLocations
+    JsonField(LatencyProbeSchedule, latencyProbeSchedule, {})
+
     // Locations grouped by country and sorted by latency.  The locations are
     // chosen from the active infrastructure specified by the "infrastructure"
     // setting.
@@ -0,0 +1,167 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("statepatch.cpp")
+
+#include "statepatch.h"
+
+namespace
+{
+    const QString patchSetKey{QStringLiteral("set")};
+    const QString patchRemoveKey{QStringLiteral("remove")};
+    const QString availableLocationsKey{QStringLiteral("availableLocations")};
+    const QString groupedLocationsKey{QStringLiteral("groupedLocations")};
+}
+
+namespace StatePatch
+{
+
+QJsonObject buildLocationsPatch(const LocationsById &base,
+                                const LocationsById &current)
+{
+    QJsonObject setLocations;
+    QJsonArray removeIds;
+
+    for(const auto &locationEntry : current)
+    {
+        auto itBase = base.find(locationEntry.first);
+        // Locations that weren't replaced are usually the same object, but
+        // a full rebuild creates new objects that are mostly identical
+        if(itBase != base.end() &&
+            (itBase->second == locationEntry.second ||
+             compareLocationsValue(itBase->second, locationEntry.second)))
+        {
+            continue;
+        }
+
+        QJsonValue locationJson;
+        json_cast(locationEntry.second, locationJson);
+        setLocations.insert(locationEntry.first, locationJson);
+    }
+
+    for(const auto &locationEntry : base)
+    {
+        if(current.count(locationEntry.first) == 0)
+            removeIds.push_back(locationEntry.first);
+    }
+
+    return QJsonObject{{patchSetKey, setLocations},
+                       {patchRemoveKey, removeIds}};
+}
+
+QJsonArray buildGroupedLayout(const std::vector<CountryLocations> &groupedLocations)
+{
+    QJsonArray layout;
+    for(const auto &country : groupedLocations)
+    {
+        QJsonArray countryIds;
+        for(const auto &pLocation : country.locations())
+        {
+            Q_ASSERT(pLocation);
+            countryIds.push_back(pLocation->id());
+        }
+        layout.push_back(countryIds);
+    }
+    return layout;
+}
+
+bool applyLocationsPatch(LocationsById &locations, const QJsonObject &patch)
+{
+    bool valid = true;
+
+    const auto &setLocations = patch.value(patchSetKey).toObject();
+    for(auto itSet = setLocations.begin(); itSet != setLocations.end(); ++itSet)
+    {
+        QSharedPointer<Location> pLocation;
+        if(!json_cast(itSet.value(), pLocation) || !pLocation)
+        {
+            qWarning() << "Invalid location" << itSet.key() << "in state patch";
+            valid = false;
+            continue;
+        }
+        locations[itSet.key()] = std::move(pLocation);
+    }
+
+    for(const auto &removeId : patch.value(patchRemoveKey).toArray())
+        locations.erase(removeId.toString());
+
+    return valid;
+}
+
+bool applyGroupedLayout(const LocationsById &locations, const QJsonArray &layout,
+                        std::vector<CountryLocations> &groupedLocations)
+{
+    bool valid = true;
+
+    groupedLocations.clear();
+    groupedLocations.reserve(layout.size());
+    for(const auto &countryValue : layout)
+    {
+        std::vector<QSharedPointer<Location>> countryLocations;
+        for(const auto &idValue : countryValue.toArray())
+        {
+            auto itLocation = locations.find(idValue.toString());
+            if(itLocation == locations.end() || !itLocation->second)
+            {
+                qWarning() << "Unknown location" << idValue.toString()
+                    << "in grouped locations patch";
+                valid = false;
+                continue;
+            }
+            countryLocations.push_back(itLocation->second);
+        }
+        // Country groups are never empty
+        if(!countryLocations.empty())
+        {
+            groupedLocations.push_back({});
+            groupedLocations.back().locations(std::move(countryLocations));
+        }
+    }
+
+    return valid;
+}
+
+bool applyStatePatch(DaemonState &state, const QJsonObject &patch)
+{
+    bool valid = true;
+
+    auto itLocations = patch.find(availableLocationsKey);
+    if(itLocations != patch.end())
+    {
+        LocationsById locations{state.availableLocations()};
+        valid &= applyLocationsPatch(locations, itLocations.value().toObject());
+        state.availableLocations(locations);
+    }
+
+    // Apply the grouped layout after availableLocations, it refers to the new
+    // locations
+    auto itGrouped = patch.find(groupedLocationsKey);
+    if(itGrouped != patch.end())
+    {
+        std::vector<CountryLocations> groupedLocations;
+        valid &= applyGroupedLayout(state.availableLocations(),
+                                    itGrouped.value().toArray(),
+                                    groupedLocations);
+        state.groupedLocations(groupedLocations);
+    }
+
+    return valid;
+}
+
+}
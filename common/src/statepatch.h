@@ -0,0 +1,68 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("statepatch.h")
+
+#ifndef STATEPATCH_H
+#define STATEPATCH_H
+
+#include "settings/daemonstate.h"
+
+// The largest DaemonState properties - availableLocations and groupedLocations
+// - change on every latency update, but usually only a few fields actually
+// change.  Rather than sending the full values to clients, the daemon sends
+// patches in a separate "statePatch" object:
+//
+// - availableLocations is sent as {"set": {<id>: <location>, ...},
+//   "remove": [<id>, ...]}, containing only locations that differ from the
+//   last value sent
+// - groupedLocations is sent as a layout of location IDs
+//   ([[<id>, ...], ...]); the client resolves the IDs using its
+//   availableLocations (groupedLocations always refers to locations from
+//   availableLocations)
+//
+// Patches always contain the complete values of changed locations, so they can
+// be applied to any value between the last one sent and the current one (for
+// example, a client that received the full state upon connecting).
+namespace StatePatch
+{
+    // Build a patch for availableLocations that transforms 'base' into
+    // 'current'.  Locations are compared by pointer first, then by value.
+    COMMON_EXPORT QJsonObject buildLocationsPatch(const LocationsById &base,
+                                                  const LocationsById &current);
+
+    // Build the ID layout for groupedLocations.
+    COMMON_EXPORT QJsonArray buildGroupedLayout(const std::vector<CountryLocations> &groupedLocations);
+
+    // Apply an availableLocations patch to a map of locations.
+    COMMON_EXPORT bool applyLocationsPatch(LocationsById &locations,
+                                           const QJsonObject &patch);
+
+    // Build groupedLocations from an ID layout, using the given locations.
+    COMMON_EXPORT bool applyGroupedLayout(const LocationsById &locations,
+                                          const QJsonArray &layout,
+                                          std::vector<CountryLocations> &groupedLocations);
+
+    // Apply a "statePatch" object from the daemon to DaemonState.  Locations
+    // that aren't changed by the patch keep their existing objects.  Returns
+    // false if the patch was invalid (any valid parts are still applied).
+    COMMON_EXPORT bool applyStatePatch(DaemonState &state, const QJsonObject &patch);
+}
+
+#endif
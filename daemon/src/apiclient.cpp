@@ -85,10 +85,11 @@ Async<QByteArray> ApiClient::requestRetry(QNetworkAccessManager::Operation verb,
 Async<QJsonDocument> ApiClient::getRetry(ApiBase &apiBaseUris, QString resource,
                                          QByteArray auth)
 {
+    // GETs are idempotent, so hedge them across API bases
     return requestRetry(QNetworkAccessManager::Operation::GetOperation,
                         apiBaseUris, std::move(resource),
-                        apiBaseUris.getAttemptCount(apiAttemptsPerBase), {},
-                        std::move(auth))
+                        ApiRetries::hedged(apiBaseUris.getAttemptCount(apiAttemptsPerBase)),
+                        {}, std::move(auth))
             ->then(parseJsonBody);
 }
 
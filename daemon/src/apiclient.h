@@ -72,6 +72,9 @@ public:
     // credentials for forward compatibility, but this means a valid response
     // does not necessarily mean that the credentials were valid for all
     // requests.
+    //
+    // Slow attempts are hedged with the next API base (see
+    // NetworkTaskWithRetry).
     Async<QJsonDocument> getRetry(ApiBase &apiBaseUris, QString resource,
                                   QByteArray auth = {});
 
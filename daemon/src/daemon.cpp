@@ -26,6 +26,8 @@
 #include "ipc.h"
 #include "jsonrpc.h"
 #include "locations.h"
+#include "regionsnapshot.h"
+#include "statepatch.h"
 #include "path.h"
 #include "version.h"
 #include "brand.h"
@@ -52,6 +54,7 @@
 #include <QRandomGenerator>
 #include <QRegExp>
 #include <QStringView>
+#include <QUuid>
 
 #if defined(Q_OS_WIN)
 #include <Windows.h>
@@ -106,6 +109,31 @@ namespace
                                         QStringLiteral("qt*.debug=false"),
                                         QStringLiteral("latency.*=false"),
                                         QStringLiteral("qt.scenegraph.general*=true")};
+
+    // Bits in Daemon::_pendingSerializations - the files that need to be
+    // written
+    enum : unsigned
+    {
+        SerializeData = 0x01,
+        SerializeAccount = 0x02,
+        SerializeSettings = 0x04,
+        SerializeRegionsCache = 0x08,
+    };
+
+    // The cached regions lists are large and change much less often than the
+    // rest of DaemonData (latencies, service quality events, etc.), so they're
+    // stored in their own file.  data.json has the other DaemonData properties.
+    //
+    // Older versions stored these in data.json; they're still read from there
+    // if regionscache.json doesn't exist yet.
+    const char *regionsCacheFile = "regionscache.json";
+    const QStringList regionsCacheProperties{QStringLiteral("cachedModernRegionsList"),
+                                             QStringLiteral("cachedModernShadowsocksList"),
+                                             QStringLiteral("cachedModernRegionsId"),
+                                             QStringLiteral("modernRegionMeta")};
+    // Binary snapshot of the regions built from the cached regions lists (see
+    // RegionSnapshot); written along with regionscache.json.
+    const char *regionSnapshotFile = "regions.snapshot";
 }
 
 void restrictAccountJson()
@@ -412,6 +440,11 @@ Daemon::Daemon(QObject* parent)
 
     // Load settings if they exist
     readProperties(_data, Path::DaemonSettingsDir, "data.json");
+    // Load the regions cache.  If it hasn't been split out of data.json yet,
+    // write it out the next time data are serialized (the regions were read
+    // from data.json above).
+    if(!readProperties(_data, Path::DaemonSettingsDir, regionsCacheFile))
+        _pendingSerializations |= SerializeRegionsCache;
     // Load account.json.  If it doesn't exist, write it out now so we can set
     // its permissions.
     if(!readProperties(_account, Path::DaemonSettingsDir, "account.json"))
@@ -595,6 +628,11 @@ Daemon::Daemon(QObject* parent)
 
     connect(&_modernLatencyTracker, &LatencyTracker::newMeasurements, this,
             &Daemon::newLatencyMeasurements);
+    connect(&_modernLatencyTracker, &LatencyTracker::probeScheduleChanged, this,
+            [this]()
+            {
+                _state.latencyProbeSchedule(_modernLatencyTracker.probeSchedule());
+            });
     // No locations are loaded yet - they're loaded when the daemon activates
 
     connect(&_portForwarder, &PortForwarder::portForwardUpdated, this,
@@ -685,7 +723,13 @@ Daemon::Daemon(QObject* parent)
         queueNotification(&Daemon::reapplyFirewallRules);
         updatePublicIpRefresher(_connection->state());
         _state.externalIp({});
+        // The refresher is probably still running, make sure it emits the
+        // public IP again even if it hasn't changed
+        _publicIpRefresher.invalidate();
     });
+    connect(&_settings, &DaemonSettings::favoriteLocationsChanged, this, &Daemon::updateLatencyCandidates);
+    connect(&_settings, &DaemonSettings::recentLocationsChanged, this, &Daemon::updateLatencyCandidates);
+
     connect(&_settings, &DaemonSettings::killswitchChanged, this, &Daemon::queueApplyFirewallRules);
     connect(&_settings, &DaemonSettings::allowLANChanged, this, &Daemon::queueApplyFirewallRules);
     connect(&_settings, &DaemonSettings::overrideDNSChanged, this, &Daemon::queueApplyFirewallRules);
@@ -1746,7 +1790,18 @@ void Daemon::clientConnected(IPCConnection* connection)
         accountJsonObj.remove(sensitiveProp);
     all.insert(QStringLiteral("account"), std::move(accountJsonObj));
     all.insert(QStringLiteral("settings"), _settings.toJsonObject());
-    all.insert(QStringLiteral("state"), _state.toJsonObject());
+    QJsonObject stateJsonObj = _state.toJsonObject();
+    // Location patches are built relative to the last locations sent.  If the
+    // locations have changed since then, give this client that last-sent value
+    // too, so the pending patch brings it up to date along with the other
+    // clients.  (Don't flush the pending changes here, that would broadcast
+    // them to all clients just because one connected.)
+    if(_stateChanges.contains(QStringLiteral("availableLocations")))
+    {
+        stateJsonObj.insert(QStringLiteral("availableLocations"),
+                            json_cast<QJsonValue>(_sentAvailableLocations, HERE));
+    }
+    all.insert(QStringLiteral("state"), std::move(stateJsonObj));
     client->post(QStringLiteral("data"), all);
 }
 
@@ -1766,8 +1821,15 @@ void Daemon::notifyChanges()
     QJsonObject all;
     if (!_dataChanges.empty())
     {
+        // Only write the files containing the properties that changed
+        for(const auto &property : _dataChanges)
+        {
+            if(regionsCacheProperties.contains(property))
+                _pendingSerializations |= SerializeRegionsCache;
+            else
+                _pendingSerializations |= SerializeData;
+        }
         all.insert(QStringLiteral("data"), getProperties(_data, std::exchange(_dataChanges, {})));
-        _pendingSerializations |= 1;
     }
     if (!_accountChanges.empty())
     {
@@ -1778,16 +1840,34 @@ void Daemon::notifyChanges()
         for(const auto &sensitiveProp : DaemonAccount::sensitiveProperties())
             newAccountChanges.remove(sensitiveProp);
         all.insert(QStringLiteral("account"), getProperties(_account, newAccountChanges));
-        _pendingSerializations |= 2;
+        _pendingSerializations |= SerializeAccount;
     }
     if (!_settingsChanges.empty())
     {
         all.insert(QStringLiteral("settings"), getProperties(_settings, std::exchange(_settingsChanges, {})));
-        _pendingSerializations |= 4;
+        _pendingSerializations |= SerializeSettings;
     }
     if (!_stateChanges.empty())
     {
-        all.insert(QStringLiteral("state"), getProperties(_state, std::exchange(_stateChanges, {})));
+        QSet<QString> stateChanges;
+        _stateChanges.swap(stateChanges);
+        // The large location properties are sent as patches (see StatePatch)
+        QJsonObject statePatch;
+        if(stateChanges.remove(QStringLiteral("availableLocations")))
+        {
+            statePatch.insert(QStringLiteral("availableLocations"),
+                              StatePatch::buildLocationsPatch(_sentAvailableLocations,
+                                                              _state.availableLocations()));
+            _sentAvailableLocations = _state.availableLocations();
+        }
+        if(stateChanges.remove(QStringLiteral("groupedLocations")))
+        {
+            statePatch.insert(QStringLiteral("groupedLocations"),
+                              StatePatch::buildGroupedLayout(_state.groupedLocations()));
+        }
+        all.insert(QStringLiteral("state"), getProperties(_state, stateChanges));
+        if(!statePatch.isEmpty())
+            all.insert(QStringLiteral("statePatch"), statePatch);
     }
     serialize();
     _rpc->post(QStringLiteral("data"), all);
@@ -1799,15 +1879,52 @@ void Daemon::serialize()
     {
         if (!_serializationTimer.isActive())
         {
-            if (_pendingSerializations & 1)
-                writeProperties(_data.toJsonObject(), Path::DaemonSettingsDir, "data.json");
-            if (_pendingSerializations & 2)
+            // data.json and settings.json are converted to text and written
+            // on the PersistenceWriter thread.  Only the property values are
+            // captured here.
+            const Path &settingsDir = Path::DaemonSettingsDir.mkpath();
+            // Write the regions cache before data.json - if data.json was
+            // written first and then the daemon was killed, an upgrade from
+            // a version that stored the regions in data.json would lose them.
+            if (_pendingSerializations & SerializeRegionsCache)
+            {
+                QJsonObject regionsCache;
+                for(const auto &property : regionsCacheProperties)
+                    regionsCache.insert(property, _data.get(property));
+                _persistenceWriter.queueWrite(settingsDir / regionsCacheFile,
+                                              std::move(regionsCache));
+                // If the regions have been built, update the snapshot too.
+                // It's only used if its source ID matches regionscache.json,
+                // so it doesn't matter which is written first.
+                if (_pRegionDatabase && !_data.cachedModernRegionsId().isEmpty())
+                {
+                    _persistenceWriter.queueWrite(settingsDir / regionSnapshotFile,
+                        [pDatabase = _pRegionDatabase, sourceId = _data.cachedModernRegionsId()]
+                        (const QString &path)
+                        {
+                            RegionSnapshot::write(path, *pDatabase, sourceId);
+                        });
+                }
+            }
+            if (_pendingSerializations & SerializeData)
+            {
+                QJsonObject data = _data.toJsonObject();
+                for(const auto &property : regionsCacheProperties)
+                    data.remove(property);
+                _persistenceWriter.queueWrite(settingsDir / "data.json",
+                                              std::move(data));
+            }
+            // account.json is small, and it's written in place synchronously
+            // to preserve the restricted permissions applied by
+            // restrictAccountJson().
+            if (_pendingSerializations & SerializeAccount)
                 writeProperties(_account.toJsonObject(), Path::DaemonSettingsDir, "account.json");
-            if (_pendingSerializations & 4)
+            if (_pendingSerializations & SerializeSettings)
             {
                 QJsonObject settings = _settings.toJsonObject();
                 settings.remove(QStringLiteral("debugLogging"));
-                writeProperties(settings, Path::DaemonSettingsDir, "settings.json");
+                _persistenceWriter.queueWrite(settingsDir / "settings.json",
+                                              std::move(settings));
             }
             _pendingSerializations = 0;
             _serializationTimer.start(5000);
@@ -2085,7 +2202,7 @@ void Daemon::vpnStateChanged(VPNConnection::State state,
                 // This proxy does not support hostname lookup, UDP, or
                 // listening
                 localProxy.setCapabilities(QNetworkProxy::TunnelingCapability);
-                localProxy.setUser(QString::fromLatin1(SocksConnection::username));
+                localProxy.setUser(QString::fromLatin1(SocksNegotiation::username));
                 localProxy.setPassword(QString::fromLatin1(_socksServer.password()));
                 ApiNetwork::instance()->setProxy(localProxy);
             }
@@ -2237,7 +2354,9 @@ void Daemon::newLatencyMeasurements(const LatencyTracker::Latencies &measurement
 
     for(const auto &measurement : measurements)
     {
-        newLatencies[measurement.first] = static_cast<double>(msec(measurement.second));
+        // Measurements have microsecond resolution; latencies are stored in
+        // fractional milliseconds.
+        newLatencies[measurement.first] = static_cast<double>(measurement.second.count()) / 1000.0;
         if(_state.availableLocations().find(measurement.first) != _state.availableLocations().end())
         {
             locationsAffected = true;
@@ -2248,9 +2367,10 @@ void Daemon::newLatencyMeasurements(const LatencyTracker::Latencies &measurement
 
     if(locationsAffected)
     {
-        // Rebuild the locations, including the grouped locations and location
-        // choices, since the latencies changed
-        rebuildActiveLocations();
+        // Update the locations, including the grouped locations and location
+        // choices, since the latencies changed.  The regions list itself
+        // hasn't changed, so there's no need to rebuild everything.
+        applyLatencyUpdates();
     }
 }
 
@@ -2311,6 +2431,49 @@ void Daemon::applyBuiltLocations(const LocationsById &newLocations)
     _state.groupedLocations(std::move(groupedLocations));
     _state.dedicatedIpLocations(std::move(dedicatedIpLocations));
 
+    updateDedicatedIpExpiration();
+
+    // Calculate new location preferences
+    calculateLocationPreferences();
+
+    // Update the available ports
+    DescendingPortSet udpPorts, tcpPorts;
+    for(const auto &locationEntry : _state.availableLocations())
+    {
+        locationEntry.second->allPortsForService(Service::OpenVpnUdp, udpPorts);
+        locationEntry.second->allPortsForService(Service::OpenVpnTcp, tcpPorts);
+    }
+    _state.openvpnUdpPortChoices(udpPorts);
+    _state.openvpnTcpPortChoices(tcpPorts);
+}
+
+void Daemon::applyLatencyUpdates()
+{
+    LocationsById locations{_state.availableLocations()};
+    auto changedIds = updateLocationLatencies(locations, _data.modernLatencies());
+    if(changedIds.empty())
+        return;
+
+    _state.availableLocations(locations);
+
+    std::vector<CountryLocations> groupedLocations{_state.groupedLocations()};
+    std::vector<QSharedPointer<Location>> dedicatedIpLocations{_state.dedicatedIpLocations()};
+    updateGroupedLocations(_state.availableLocations(), changedIds,
+                           groupedLocations, dedicatedIpLocations);
+    _state.groupedLocations(std::move(groupedLocations));
+    _state.dedicatedIpLocations(std::move(dedicatedIpLocations));
+
+    // The dedicated IP expiration display depends on the current time, keep
+    // refreshing it like a full rebuild would.
+    updateDedicatedIpExpiration();
+
+    // The available ports don't depend on latency, but the location
+    // preferences do
+    calculateLocationPreferences();
+}
+
+void Daemon::updateDedicatedIpExpiration()
+{
     // Find the closest expiration time for any dedicated IP, and find the most
     // recent dedicated IP change
     const auto &accountDips = _account.dedicatedIps();
@@ -2366,27 +2529,12 @@ void Daemon::applyBuiltLocations(const LocationsById &newLocations)
 
         _state.dedicatedIpChanged(lastDipChange);
     }
-
-    // Calculate new location preferences
-    calculateLocationPreferences();
-
-    // Update the available ports
-    DescendingPortSet udpPorts, tcpPorts;
-    for(const auto &locationEntry : _state.availableLocations())
-    {
-        locationEntry.second->allPortsForService(Service::OpenVpnUdp, udpPorts);
-        locationEntry.second->allPortsForService(Service::OpenVpnTcp, tcpPorts);
-    }
-    _state.openvpnUdpPortChoices(udpPorts);
-    _state.openvpnTcpPortChoices(tcpPorts);
 }
 
-bool Daemon::rebuildModernLocations(const QJsonObject &regionsObj,
-                                    const QJsonArray &shadowsocksObj)
+bool Daemon::rebuildModernLocations(const ModernRegions &regions)
 {
     LocationsById newLocations = buildModernLocations(_data.modernLatencies(),
-                                                      regionsObj,
-                                                      shadowsocksObj,
+                                                      regions,
                                                       _account.dedicatedIps(),
                                                       _settings.manualServer());
 
@@ -2403,10 +2551,59 @@ bool Daemon::rebuildModernLocations(const QJsonObject &regionsObj,
     return true;
 }
 
+const RegionDatabase &Daemon::cachedRegionDatabase()
+{
+    if(!_pRegionDatabase)
+    {
+        const QString &sourceId = _data.cachedModernRegionsId();
+        RegionSnapshot snapshot;
+        if(!sourceId.isEmpty() &&
+           snapshot.open(Path::DaemonSettingsDir / regionSnapshotFile))
+        {
+            if(snapshot.sourceId() == sourceId)
+            {
+                RegionDatabase database{snapshot.database()};
+                if(!database.empty())
+                {
+                    qInfo() << "Loaded" << database.locations().size()
+                        << "regions from snapshot";
+                    _pRegionDatabase = std::make_shared<const RegionDatabase>(std::move(database));
+                }
+            }
+            else
+            {
+                qInfo() << "Region snapshot is stale - built from"
+                    << snapshot.sourceId() << "but regions list is" << sourceId;
+            }
+        }
+
+        if(!_pRegionDatabase)
+        {
+            ModernRegions regions{buildModernRegions(_data.cachedModernRegionsList(),
+                                                     _data.cachedModernShadowsocksList())};
+            // The snapshot couldn't be used, write a new one if there's
+            // anything in it
+            storeRegionDatabase(regions, !regions.locations.empty());
+        }
+    }
+
+    return *_pRegionDatabase;
+}
+
+void Daemon::storeRegionDatabase(const ModernRegions &regions, bool listsChanged)
+{
+    _pRegionDatabase = std::make_shared<const RegionDatabase>(RegionDatabase::build(regions));
+    // Assigning a new ID causes regionscache.json and the snapshot to be
+    // written (see serialize())
+    if(listsChanged)
+        _data.cachedModernRegionsId(QUuid::createUuid().toString(QUuid::StringFormat::WithoutBraces));
+}
+
 void Daemon::rebuildActiveLocations()
 {
-    rebuildModernLocations(_data.cachedModernRegionsList(),
-                            _data.cachedModernShadowsocksList());
+    // Latencies are applied while materializing, so each location is created
+    // once and becomes the location held by DaemonState.
+    rebuildModernLocations(cachedRegionDatabase().materialize(_data.modernLatencies()));
 }
 
 void Daemon::shadowsocksRegionsLoaded(const QJsonDocument &shadowsocksRegionsJsonDoc)
@@ -2415,7 +2612,9 @@ void Daemon::shadowsocksRegionsLoaded(const QJsonDocument &shadowsocksRegionsJso
 
     // It's unlikely that the Shadowsocks regions list could totally hose us,
     // but the same resiliency is here for robustness.
-    if(!rebuildModernLocations(_data.cachedModernRegionsList(), shadowsocksRegionsObj))
+    ModernRegions regions{buildModernRegions(_data.cachedModernRegionsList(),
+                                             shadowsocksRegionsObj)};
+    if(!rebuildModernLocations(regions))
     {
         qWarning() << "Shadowsocks location data could not be loaded.  Received"
             << shadowsocksRegionsJsonDoc.toJson();
@@ -2425,7 +2624,9 @@ void Daemon::shadowsocksRegionsLoaded(const QJsonDocument &shadowsocksRegionsJso
         return;
     }
 
+    bool listChanged = shadowsocksRegionsObj != _data.cachedModernShadowsocksList();
     _data.cachedModernShadowsocksList(shadowsocksRegionsObj);
+    storeRegionDatabase(regions, listChanged);
     _shadowsocksRefresher.loadSucceeded();
 }
 
@@ -2437,7 +2638,9 @@ void Daemon::modernRegionsLoaded(const QJsonDocument &modernRegionsJsonDoc)
     // would totally hose the client and more likely indicates a problem in the
     // servers list - keep whatever content we had before even though it's
     // older.
-    if(!rebuildModernLocations(modernRegionsObj, _data.cachedModernShadowsocksList()))
+    ModernRegions regions{buildModernRegions(modernRegionsObj,
+                                             _data.cachedModernShadowsocksList())};
+    if(!rebuildModernLocations(regions))
     {
         qWarning() << "Modern location data could not be loaded.  Received"
             << modernRegionsJsonDoc.toJson();
@@ -2446,7 +2649,9 @@ void Daemon::modernRegionsLoaded(const QJsonDocument &modernRegionsJsonDoc)
         return;
     }
 
+    bool listChanged = modernRegionsObj != _data.cachedModernRegionsList();
     _data.cachedModernRegionsList(modernRegionsObj);
+    storeRegionDatabase(regions, listChanged);
     _modernRegionRefresher.loadSucceeded();
 }
 
@@ -3383,6 +3588,29 @@ void Daemon::calculateLocationPreferences()
         _state.shadowsocksLocations().nextLocation(_state.shadowsocksLocations().chosenLocation());
     else
         _state.shadowsocksLocations().nextLocation(_state.shadowsocksLocations().bestLocation());
+
+    updateLatencyCandidates();
+}
+
+void Daemon::updateLatencyCandidates()
+{
+    // Probe the preferred locations more often, so the auto-selection stays
+    // accurate even when far-away locations are probed less frequently
+    std::unordered_set<QString> candidateIds;
+    for(const auto &pLocation : {_state.vpnLocations().bestLocation(),
+                                 _state.vpnLocations().chosenLocation(),
+                                 _state.shadowsocksLocations().bestLocation(),
+                                 _state.shadowsocksLocations().chosenLocation()})
+    {
+        if(pLocation)
+            candidateIds.insert(pLocation->id());
+    }
+    // The user's favorite and recent locations are likely to be chosen too
+    for(const auto &id : _settings.favoriteLocations())
+        candidateIds.insert(id);
+    for(const auto &id : _settings.recentLocations())
+        candidateIds.insert(id);
+    _modernLatencyTracker.updateCandidateLocations(std::move(candidateIds));
 }
 
 void Daemon::onUpdateRefreshed(const Update &availableUpdate,
@@ -28,7 +28,9 @@
 #include "environment.h"
 #include "jsonrpc.h"
 #include "latencytracker.h"
+#include "regiondatabase.h"
 #include "networkmonitor.h"
+#include "persistencewriter.h"
 #include "portforwarder.h"
 #include "socksserverthread.h"
 #include "updatedownloader.h"
@@ -486,19 +488,37 @@ private:
     // dependent properties - used by rebuild*Location().
     void applyBuiltLocations(const LocationsById &newLocations);
 
-    // Build the locations list from the modern regions list.  Returns true if
-    // the new locations list is not empty, meaning the new data can be cached.
-    // The new locations are also applied.
+    // Apply updated latencies from DaemonData to the current locations without
+    // rebuilding them from the regions list - used when only latencies have
+    // changed.  Only the affected locations and countries are updated.
+    void applyLatencyUpdates();
+
+    // Update the dedicated IP expiration/change state from the account's
+    // dedicated IPs - used by applyBuiltLocations() and applyLatencyUpdates().
+    void updateDedicatedIpExpiration();
+
+    // Build the locations list from regions built from the modern regions
+    // list.  Returns true if the new locations list is not empty, meaning the
+    // new data can be cached.  The new locations are also applied.
     //
-    // regionsObj can be the cached object from DaemonData or new data retrieved
-    // (which should then be cached if successful).  Latencies from DaemonData
-    // are used.
-    bool rebuildModernLocations(const QJsonObject &regionsObj,
-                                const QJsonArray &shadowsocksObj);
-
-    // Rebuild either the legacy or modern locations from the cached data,
-    // depending on the infrastructure setting.  Used when latencies are updated
-    // or when initially building the regions list.
+    // regions can be the cached regions (cachedRegionDatabase()) or regions
+    // built from new data retrieved (which should then be cached if
+    // successful).  Latencies from DaemonData are used.
+    bool rebuildModernLocations(const ModernRegions &regions);
+
+    // Get the region database for the cached regions lists.  This is built on
+    // first use - loaded from the region snapshot if it matches the cached
+    // regions lists, or built from the regions lists' JSON otherwise.
+    const RegionDatabase &cachedRegionDatabase();
+
+    // Store regions built from new regions lists after the lists have been
+    // cached in DaemonData.  If the lists changed, this assigns a new source ID
+    // so a new region snapshot is written.
+    void storeRegionDatabase(const ModernRegions &regions, bool listsChanged);
+
+    // Rebuild the modern locations from the cached data.  Used when initially
+    // building the regions list or when settings/account data used to build
+    // the locations change.  (Latency updates use applyLatencyUpdates().)
     void rebuildActiveLocations();
 
     // Handle region list results from JsonRefresher
@@ -521,13 +541,17 @@ private:
 
 private:
     // Rebuild location preferences from the grouped locations.  Used when
-    // settings are changed that affect the location preferences.  (Latency and
-    // region list changes result in rebuilding the entire region list.)
+    // settings are changed that affect the location preferences, and after
+    // the regions list or latencies are updated.
     void calculateLocationPreferences();
     // Rebuild the chosen/best/next location selections (without rebuilding the
     // entire list).  Used when data changes that affect the location
     // selections.
     void updateChosenLocations();
+    // Pass the preferred locations to the latency tracker - the chosen/best
+    // locations, and the favorite and recent locations from settings.  Used
+    // when the location selections or those settings change.
+    void updateLatencyCandidates();
     void onUpdateRefreshed(const Update &availableUpdate,
                            bool osFailedRequirement,
                            const Update &gaUpdate, const Update &betaUpdate,
@@ -618,9 +642,20 @@ protected:
     QSet<QString> _accountChanges;
     QSet<QString> _settingsChanges;
     QSet<QString> _stateChanges;
+    // The last availableLocations value sent to clients - used as the base for
+    // the availableLocations patch (see StatePatch)
+    LocationsById _sentAvailableLocations;
 
     unsigned int _pendingSerializations;
     QTimer _serializationTimer;
+    // Writes data.json, settings.json, and the regions cache in the background
+    PersistenceWriter _persistenceWriter;
+    // Regions built from the cached regions lists (see cachedRegionDatabase()).
+    // This is the only copy of the cached regions kept - Location objects are
+    // materialized from it when rebuilding and then only held by DaemonState.
+    // Shared with PersistenceWriter when writing the region snapshot; never
+    // modified once built.
+    std::shared_ptr<const RegionDatabase> _pRegionDatabase;
 
     QTimer _accountRefreshTimer;
     QTimer _dedicatedIpRefreshTimer;
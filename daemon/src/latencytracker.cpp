@@ -21,6 +21,8 @@
 
 #include "latencytracker.h"
 #include <algorithm>
+#include <cmath>
+#include <QDateTime>
 #include <QRandomGenerator>
 
 #if defined(Q_OS_WIN)
@@ -31,14 +33,32 @@
 
 namespace
 {
-    const std::chrono::minutes latencyRefreshInterval{1};
+    // A location's latency is "near" the best latency if it's within this
+    // fraction of the best latency, or within nearBestMinMargin.  These are
+    // probed as often as the best location, so auto-selection notices quickly
+    // if one becomes better.
+    const int nearBestDivisor{5};   // 20%
+    const std::chrono::milliseconds nearBestMinMargin{5};
+    // A location's measurements are considered stable if their standard
+    // deviation is within 1/stableDivisor of the mean.
+    const int stableDivisor{10};
+    // Minimum time between measurement batches - if more locations are due
+    // than the probe budget allows, the rest are probed after this delay.
+    const std::chrono::seconds minBatchSpacing{1};
     const std::chrono::seconds latencyEchoTimeout{10};
     const std::chrono::milliseconds latencyBatchInterval{100};
-
-    //The number of measurements that LatencyHistory stores
-    const int measurementHistoryCount{5};
-
-    RegisterMetaType<std::chrono::milliseconds> rxChronoMilliseconds;
+    // The probe schedule changes after every batch, and it's published to
+    // all clients in DaemonState, so probeScheduleChanged() is emitted at most
+    // this often.
+    const std::chrono::seconds probeSchedulePublishInterval{30};
+
+    // Echoes in a batch are sent in bursts of this many echoes, spaced by this
+    // interval.  This avoids queuing a whole batch in the local network at
+    // once, which would inflate the latency of the servers pinged last.
+    const std::size_t latencyBurstSize{16};
+    const std::chrono::milliseconds latencyBurstInterval{2};
+
+    RegisterMetaType<std::chrono::microseconds> rxChronoMicroseconds;
     RegisterMetaType<LatencyTracker::Latencies> rxLatencies;
 
     // Select a ping address for a location when using ICMP pings.  A server is
@@ -67,36 +87,27 @@ namespace
         CLASS_LOGGING_CATEGORY("latency");
 
     public:
-        // Create WinIcmpBatchPinger with the locations to be pinged.
-        // WinIcmpBatchPinger will insert all locations that were successfully
-        // pinged into pendingReplies (values are the location IDs).  Ports are
-        // always 0 for WinIcmpBatchPinger since it uses ICMP.
-        WinIcmpBatchPinger(const std::vector<QSharedPointer<Location>> &locations,
-                           PendingRepliesMap &pendingReplies,
-                           std::chrono::milliseconds timeout);
+        WinIcmpBatchPinger(std::chrono::milliseconds timeout) : _timeout{timeout} {}
+
+    protected:
+        virtual bool sendEcho(quint32 address) override;
+
+    private:
+        std::chrono::milliseconds _timeout;
     };
 
-    WinIcmpBatchPinger::WinIcmpBatchPinger(const std::vector<QSharedPointer<Location>> &locations,
-                                           PendingRepliesMap &pendingReplies,
-                                           std::chrono::milliseconds timeout)
+    bool WinIcmpBatchPinger::sendEcho(quint32 address)
     {
-        //Ping each location.
-        for(const auto &pLocation : locations)
-        {
-            quint32 echoAddr = selectIcmpPingAddress(pLocation);
-            QPointer<WinIcmpEcho> pEcho;
-            if(echoAddr && (pEcho = WinIcmpEcho::send(echoAddr, timeout)))
-            {
-                // Pinged this location, put it in the pending replies.
-                pendingReplies[HostPortKey{QHostAddress{echoAddr}, 0}] = pLocation->id();
-
-                connect(pEcho.data(), &WinIcmpEcho::receivedReply, this,
-                        [this](quint32 address)
-                        {
-                            emit receivedResponse(QHostAddress{address}, 0);
-                        });
-            }
-        }
+        QPointer<WinIcmpEcho> pEcho = WinIcmpEcho::send(address, _timeout);
+        if(!pEcho)
+            return false;
+
+        connect(pEcho.data(), &WinIcmpEcho::receivedReply, this,
+                [this](quint32 replyAddress, std::chrono::microseconds roundTrip)
+                {
+                    emit receivedResponse(QHostAddress{replyAddress}, 0, roundTrip);
+                });
+        return true;
     }
 
 #else
@@ -107,83 +118,269 @@ namespace
         CLASS_LOGGING_CATEGORY("latency");
 
     public:
-        // Create PosixIcmpBatchPinger with the locations to be pinged.
-        // PosixIcmpBatchPinger will insert all locations that were successfully
-        // pinged into pendingReplies (values are the location IDs).  Ports are
-        // always 0 for PosixIcmpBatchPinger since it uses ICMP.
-        PosixIcmpBatchPinger(const std::vector<QSharedPointer<Location>> &locations,
-                             PendingRepliesMap &pendingReplies);
+        PosixIcmpBatchPinger();
+
+    protected:
+        virtual bool sendEcho(quint32 address) override;
 
     private:
         PosixPing _ping;
     };
 
-    PosixIcmpBatchPinger::PosixIcmpBatchPinger(const std::vector<QSharedPointer<Location>> &locations,
-                                               PendingRepliesMap &pendingReplies)
+    PosixIcmpBatchPinger::PosixIcmpBatchPinger()
     {
-        //Ping each location.
-        for(const auto &pLocation : locations)
-        {
-            quint32 echoAddr = selectIcmpPingAddress(pLocation);
-            if(echoAddr && _ping.sendEchoRequest(echoAddr))
-            {
-                // Pinged this location, put it in the pending replies.
-                pendingReplies[HostPortKey{QHostAddress{echoAddr}, 0}] = pLocation->id();
-            }
-        }
-
         connect(&_ping, &PosixPing::receivedReply, this,
-                [this](quint32 addr)
+                [this](quint32 addr, std::chrono::microseconds roundTrip)
                 {
-                    receivedResponse(QHostAddress{addr}, 0);
+                    emit receivedResponse(QHostAddress{addr}, 0, roundTrip);
                 });
     }
 
+    bool PosixIcmpBatchPinger::sendEcho(quint32 address)
+    {
+        return _ping.sendEchoRequest(address);
+    }
+
 #endif
 }
 
-std::chrono::milliseconds LatencyHistory::updateLatency(std::chrono::milliseconds newMeasurement)
+std::size_t LatencyStore::add()
 {
-    //If we already have the maximum number of entries, discard the oldest one.
-    if(_lastMeasurements.size() >= measurementHistoryCount)
-    {
-        _lastMeasurements.pop_front();
-    }
+    _samples.resize(_samples.size() + HistoryCount, std::chrono::microseconds{0});
+    _sums.push_back(std::chrono::microseconds{0});
+    _heads.push_back(0);
+    _counts.push_back(0);
+    return _counts.size() - 1;
+}
+
+std::size_t LatencyStore::add(const LatencyStore &other, std::size_t otherIndex)
+{
+    Q_ASSERT(otherIndex < other.size());   // Guaranteed by caller
+    auto itOtherSamples = other._samples.begin() + otherIndex * HistoryCount;
+    _samples.insert(_samples.end(), itOtherSamples, itOtherSamples + HistoryCount);
+    _sums.push_back(other._sums[otherIndex]);
+    _heads.push_back(other._heads[otherIndex]);
+    _counts.push_back(other._counts[otherIndex]);
+    return _counts.size() - 1;
+}
 
-    //Store the new one.
-    _lastMeasurements.push_back(newMeasurement);
+void LatencyStore::clear()
+{
+    _samples.clear();
+    _sums.clear();
+    _heads.clear();
+    _counts.clear();
+}
+
+void LatencyStore::reserve(std::size_t count)
+{
+    _samples.reserve(count * HistoryCount);
+    _sums.reserve(count);
+    _heads.reserve(count);
+    _counts.reserve(count);
+}
+
+std::chrono::microseconds LatencyStore::updateLatency(std::size_t index,
+                                                      std::chrono::microseconds newMeasurement)
+{
+    Q_ASSERT(index < size());   // Guaranteed by caller
+
+    //Replace the oldest sample (or an unused slot if the buffer isn't full
+    //yet - unused slots are 0, so the sum is unaffected by replacing them).
+    auto &slot = _samples[index * HistoryCount + _heads[index]];
+    _sums[index] += newMeasurement - slot;
+    slot = newMeasurement;
+    _heads[index] = static_cast<quint8>((_heads[index] + 1) % HistoryCount);
+    if(_counts[index] < HistoryCount)
+        ++_counts[index];
 
     //Compute the average latency over these measurements.
     //An average is probably the best way to aggregate these (as opposed to min/
     //max/etc.), because it'll reduce the effect of anomalous measurements at
     //either end of the spectrum.
-    std::chrono::milliseconds sum = std::accumulate(_lastMeasurements.begin(),
-                                                    _lastMeasurements.end(),
-                                                    std::chrono::milliseconds{0});
+    return _sums[index] / _counts[index];
+}
+
+std::chrono::microseconds LatencyStore::latency(std::size_t index) const
+{
+    Q_ASSERT(index < size());   // Guaranteed by caller
+    if(_counts[index] == 0)
+        return std::chrono::microseconds{0};
+    return _sums[index] / _counts[index];
+}
+
+void LatencyStore::computeLatencies(std::vector<std::chrono::microseconds> &result) const
+{
+    result.resize(size());
+    for(std::size_t i=0; i<_counts.size(); ++i)
+    {
+        // Avoid dividing by 0 for locations without measurements; the sum is
+        // 0 for those anyway.
+        result[i] = _sums[i] / std::max<int>(_counts[i], 1);
+    }
+}
+
+std::chrono::microseconds LatencyStore::deviation(std::size_t index) const
+{
+    Q_ASSERT(index < size());   // Guaranteed by caller
+    if(_counts[index] < 2)
+        return std::chrono::microseconds{0};
+
+    //Unused slots are 0, so they don't affect the sum of squares.
+    double mean = static_cast<double>(_sums[index].count()) / _counts[index];
+    double sumSquares{0};
+    auto itSamples = _samples.begin() + index * HistoryCount;
+    for(std::size_t i=0; i<HistoryCount; ++i)
+    {
+        double sample = static_cast<double>(itSamples[i].count());
+        sumSquares += sample * sample;
+    }
+    double variance = sumSquares / _counts[index] - mean * mean;
+    return std::chrono::microseconds{static_cast<qint64>(std::sqrt(std::max(variance, 0.0)))};
+}
+
+constexpr std::chrono::seconds LatencyProbeScheduler::CandidateInterval;
+constexpr std::chrono::seconds LatencyProbeScheduler::BaseInterval;
+constexpr std::chrono::seconds LatencyProbeScheduler::MaxInterval;
+constexpr std::chrono::seconds LatencyProbeScheduler::CoalesceWindow;
+
+std::size_t LatencyProbeScheduler::add(Clock::time_point now)
+{
+    _nextProbes.push_back(now);
+    _intervals.push_back(BaseInterval);
+    _candidates.push_back(false);
+    return _nextProbes.size() - 1;
+}
+
+std::size_t LatencyProbeScheduler::add(const LatencyProbeScheduler &other,
+                                       std::size_t otherIndex)
+{
+    Q_ASSERT(otherIndex < other.size());   // Guaranteed by caller
+    _nextProbes.push_back(other._nextProbes[otherIndex]);
+    _intervals.push_back(other._intervals[otherIndex]);
+    _candidates.push_back(other._candidates[otherIndex]);
+    return _nextProbes.size() - 1;
+}
+
+void LatencyProbeScheduler::clear()
+{
+    _nextProbes.clear();
+    _intervals.clear();
+    _candidates.clear();
+}
+
+void LatencyProbeScheduler::reserve(std::size_t count)
+{
+    _nextProbes.reserve(count);
+    _intervals.reserve(count);
+    _candidates.reserve(count);
+}
+
+void LatencyProbeScheduler::setCandidate(std::size_t index, bool candidate,
+                                         Clock::time_point now)
+{
+    Q_ASSERT(index < size());   // Guaranteed by caller
+    _candidates[index] = candidate;
+    if(candidate)
+    {
+        _intervals[index] = CandidateInterval;
+        _nextProbes[index] = std::min(_nextProbes[index], now + CandidateInterval);
+    }
+    //A location that's no longer a candidate starts backing off the next time
+    //it's probed.
+}
+
+void LatencyProbeScheduler::measured(std::size_t index, bool stable,
+                                     Clock::time_point now)
+{
+    Q_ASSERT(index < size());   // Guaranteed by caller
+    //Candidates are always probed at CandidateInterval; stable locations keep
+    //backing off.
+    if(_candidates[index] || stable)
+        return;
+
+    _intervals[index] = BaseInterval;
+    _nextProbes[index] = std::min(_nextProbes[index], now + BaseInterval);
+}
+
+void LatencyProbeScheduler::takeDue(Clock::time_point now,
+                                    std::vector<std::size_t> &due)
+{
+    due.clear();
+    auto horizon = now + CoalesceWindow;
+    for(std::size_t i=0; i<_nextProbes.size(); ++i)
+    {
+        if(_nextProbes[i] <= horizon)
+            due.push_back(i);
+    }
+
+    if(due.size() > ProbeBudget)
+    {
+        //Probe candidates first, then the locations that are most overdue.
+        std::partial_sort(due.begin(), due.begin() + ProbeBudget, due.end(),
+            [this](std::size_t first, std::size_t second)
+            {
+                if(_candidates[first] != _candidates[second])
+                    return _candidates[first] > _candidates[second];
+                return _nextProbes[first] < _nextProbes[second];
+            });
+        due.resize(ProbeBudget);
+    }
+
+    for(auto index : due)
+    {
+        _nextProbes[index] = now + _intervals[index];
+        if(!_candidates[index])
+            _intervals[index] = std::min(std::max(_intervals[index] * 2, BaseInterval), MaxInterval);
+    }
+}
 
-    return sum / _lastMeasurements.size();
+auto LatencyProbeScheduler::nextDue() const -> Clock::time_point
+{
+    if(_nextProbes.empty())
+        return Clock::time_point::max();
+    return *std::min_element(_nextProbes.begin(), _nextProbes.end());
+}
+
+double LatencyProbeScheduler::probesPerHour() const
+{
+    double probes{0};
+    for(const auto &interval : _intervals)
+        probes += std::chrono::duration<double>{std::chrono::hours{1}} / interval;
+    return probes;
 }
 
 LatencyTracker::LatencyTracker()
+    : _measurementsEnabled{false}, _scheduleChangePending{false}
 {
-    _measureTrigger.setInterval(std::chrono::milliseconds(latencyRefreshInterval).count());
+    _measureTrigger.setSingleShot(true);
     connect(&_measureTrigger, &QTimer::timeout, this,
             &LatencyTracker::onMeasureTrigger);
+    _schedulePublishTimer.setSingleShot(true);
+    _schedulePublishTimer.setInterval(std::chrono::milliseconds(probeSchedulePublishInterval).count());
+    connect(&_schedulePublishTimer, &QTimer::timeout, this, [this]()
+        {
+            if(_scheduleChangePending)
+                queueProbeScheduleChanged();
+        });
 }
 
-void LatencyTracker::onMeasureTrigger()
+void LatencyTracker::queueProbeScheduleChanged()
 {
-    //Measure all known addresses (if there are any)
-    //This vector of PingLocations could in principle be built with _locations
-    //and stored, but it shouldn't be a significant cost to just build it here.
-    std::vector<QSharedPointer<Location>> measureLocations;
-    measureLocations.reserve(_locations.size());
-    for(auto itLocation = _locations.begin(); itLocation != _locations.end();
-        ++itLocation)
+    if(_schedulePublishTimer.isActive())
     {
-        measureLocations.push_back(itLocation->second.pLocation);
+        _scheduleChangePending = true;
+        return;
     }
-    beginMeasurement(measureLocations);
+
+    _scheduleChangePending = false;
+    _schedulePublishTimer.start();
+    emit probeScheduleChanged();
+}
+
+void LatencyTracker::onMeasureTrigger()
+{
+    measureDueLocations();
 }
 
 void LatencyTracker::onNewMeasurements(const Latencies &measurements)
@@ -193,42 +390,102 @@ void LatencyTracker::onNewMeasurements(const Latencies &measurements)
     for(const auto &measurement : measurements)
     {
         // Find this location
-        auto itLocation = _locations.find(measurement.first);
+        auto itIndex = _locationIndices.find(measurement.first);
         // If it was found, store it and get the new aggregated value.  If it's
         // no longer present, there's nothing to do.
-        if(itLocation != _locations.end())
+        if(itIndex != _locationIndices.end())
         {
             // Store the new latency measurement, and get the current aggregate
             // value.
-            auto aggregateLatency = itLocation->second.latency.updateLatency(measurement.second);
+            auto aggregateLatency = _latencies.updateLatency(itIndex->second,
+                                                             measurement.second);
             aggregatedMeasurements.push_back({measurement.first, aggregateLatency});
         }
     }
 
     if(!aggregatedMeasurements.empty())
+    {
+        //The best latency may have changed, which affects the candidates.
+        //Then reschedule the measured locations based on how stable they are.
+        updateCandidates();
+        auto now = LatencyProbeScheduler::Clock::now();
+        for(const auto &measurement : aggregatedMeasurements)
+        {
+            auto index = _locationIndices.at(measurement.first);
+            bool stable = _latencies.sampleCount(index) >= 2 &&
+                _latencies.deviation(index) * stableDivisor <= measurement.second;
+            _scheduler.measured(index, stable, now);
+        }
+        scheduleMeasurement();
+        queueProbeScheduleChanged();
+
         emit newMeasurements(aggregatedMeasurements);
+    }
 }
 
-void LatencyTracker::measureNewLocations()
+void LatencyTracker::updateCandidates()
 {
-    std::vector<QSharedPointer<Location>> newLocations;
+    std::vector<std::chrono::microseconds> latencies;
+    _latencies.computeLatencies(latencies);
 
-    for(auto &locationEntry : _locations)
+    //Find the best latency (0 means no measurements)
+    std::chrono::microseconds bestLatency{std::chrono::microseconds::max()};
+    for(const auto &latency : latencies)
     {
-        //If this location hasn't been attempted yet, ping it now.
-        if(!locationEntry.second.pingAttempted)
-        {
-            locationEntry.second.pingAttempted = true;
-            newLocations.push_back(locationEntry.second.pLocation);
-        }
+        if(latency.count() > 0)
+            bestLatency = std::min(bestLatency, latency);
+    }
+    std::chrono::microseconds nearBestLimit{0};
+    if(bestLatency != std::chrono::microseconds::max())
+    {
+        nearBestLimit = bestLatency + std::max<std::chrono::microseconds>(bestLatency / nearBestDivisor,
+                                                                          nearBestMinMargin);
     }
 
-    if(!newLocations.empty())
+    auto now = LatencyProbeScheduler::Clock::now();
+    for(std::size_t i=0; i<_locations.size(); ++i)
     {
-        beginMeasurement(newLocations);
+        bool candidate = (latencies[i].count() > 0 && latencies[i] <= nearBestLimit) ||
+            _candidateLocations.count(_locations[i].pLocation->id());
+        if(candidate != _scheduler.isCandidate(i))
+            _scheduler.setCandidate(i, candidate, now);
     }
 }
 
+void LatencyTracker::measureDueLocations()
+{
+    std::vector<std::size_t> dueIndices;
+    _scheduler.takeDue(LatencyProbeScheduler::Clock::now(), dueIndices);
+
+    if(!dueIndices.empty())
+    {
+        std::vector<QSharedPointer<Location>> dueLocations;
+        dueLocations.reserve(dueIndices.size());
+        for(auto index : dueIndices)
+            dueLocations.push_back(_locations[index].pLocation);
+        beginMeasurement(dueLocations);
+        queueProbeScheduleChanged();
+    }
+
+    scheduleMeasurement();
+}
+
+void LatencyTracker::scheduleMeasurement()
+{
+    auto nextDue = _scheduler.nextDue();
+    if(!_measurementsEnabled || nextDue == LatencyProbeScheduler::Clock::time_point::max())
+    {
+        _measureTrigger.stop();
+        return;
+    }
+
+    //Don't start batches back-to-back if more locations were due than the
+    //budget allowed.
+    auto delay = std::max<LatencyProbeScheduler::Clock::duration>(nextDue - LatencyProbeScheduler::Clock::now(),
+                                                                  minBatchSpacing);
+    _measureTrigger.start(static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(delay).count()));
+}
+
 void LatencyTracker::beginMeasurement(const std::vector<QSharedPointer<Location>> &locations)
 {
     //If there's at least one address to measure, start a measurement.
@@ -240,9 +497,11 @@ void LatencyTracker::beginMeasurement(const std::vector<QSharedPointer<Location>
         //
         // This is a blocking call over to the worker thread, but we don't do
         // any long-running operations on the worker thread, so this is fine.
-        // Latency batches also time out before another batch would be
-        // scheduled, so there shouldn't be any activity at all on the worker
-        // thread when this is called.
+        // Batches can overlap (they're started at least minBatchSpacing apart,
+        // but each one waits up to latencyEchoTimeout for replies), so the
+        // worker thread may be handling replies for earlier batches.  That
+        // only delays this call briefly; the new batch doesn't send anything
+        // until it has been created, so its measurements aren't affected.
         _measurementThread.invokeOnThread([&]()
         {
             //Create a LatencyBatch; parent it to this object so it is cleaned up if
@@ -259,51 +518,150 @@ void LatencyTracker::beginMeasurement(const std::vector<QSharedPointer<Location>
 void LatencyTracker::updateLocations(const LocationsById &serverLocations)
 {
     // Pull out the existing locations, then put back the ones that are still
-    // present.
-    std::unordered_map<QString, LocationData> oldLocations;
+    // present.  The locations are rebuilt densely, so indices from the old
+    // location list are not valid afterward.
+    std::vector<LocationData> oldLocations;
+    LatencyStore oldLatencies;
+    LatencyProbeScheduler oldScheduler;
+    std::unordered_map<QString, std::size_t> oldIndices;
     oldLocations.swap(_locations);
+    std::swap(oldLatencies, _latencies);
+    std::swap(oldScheduler, _scheduler);
+    oldIndices.swap(_locationIndices);
 
     //Process the current locations
+    auto now = LatencyProbeScheduler::Clock::now();
     _locations.reserve(serverLocations.size());
+    _latencies.reserve(serverLocations.size());
+    _scheduler.reserve(serverLocations.size());
+    _locationIndices.reserve(serverLocations.size());
     for(const auto &location : serverLocations)
     {
-        // Create the location.  No pings have been attempted yet if we don't
-        // find this location in oldLocations
-        auto &newLocation = _locations[location.first];
-        newLocation = {location.second, {}, false};
-
         // Did we have this location before?
-        auto itOldLocation = oldLocations.find(location.first);
-        if(itOldLocation != oldLocations.end())
+        auto itOldIndex = oldIndices.find(location.first);
+        std::size_t index;
+        if(itOldIndex != oldIndices.end())
+        {
+            //It existed, so preserve its latency measurements and schedule
+            index = _latencies.add(oldLatencies, itOldIndex->second);
+            _scheduler.add(oldScheduler, itOldIndex->second);
+        }
+        else
         {
-            //It existed, so preserve its latency measurements
-            newLocation.latency = std::move(itOldLocation->second.latency);
-            //Preserve pingAttempted
-            newLocation.pingAttempted = itOldLocation->second.pingAttempted;
+            // New locations are due to be measured right away
+            index = _latencies.add();
+            _scheduler.add(now);
         }
+        _locations.push_back({location.second});
+        Q_ASSERT(index == _locations.size() - 1);
+        _locationIndices.emplace(location.first, index);
     }
+    updateCandidates();
+
+    //If measurements are enabled, measure the new locations now.  Otherwise,
+    //they'll be measured when measurements are enabled.
+    if(_measurementsEnabled)
+        measureDueLocations();
+    queueProbeScheduleChanged();
+}
+
+void LatencyTracker::updateCandidateLocations(std::unordered_set<QString> locationIds)
+{
+    if(locationIds == _candidateLocations)
+        return;
 
-    //If measurements are enabled, trigger a new measurement for the new
-    //locations.  Otherwise, leave them in _locations to be attempted later.
-    if(_measureTrigger.isActive())
-        measureNewLocations();
+    _candidateLocations = std::move(locationIds);
+    updateCandidates();
+    //New candidates might be due sooner now
+    scheduleMeasurement();
+    queueProbeScheduleChanged();
+}
+
+LatencyProbeSchedule LatencyTracker::probeSchedule() const
+{
+    auto now = LatencyProbeScheduler::Clock::now();
+    auto nowMsec = QDateTime::currentMSecsSinceEpoch();
+
+    std::unordered_map<QString, qint64> nextProbes;
+    nextProbes.reserve(_locations.size());
+    for(std::size_t i=0; i<_locations.size(); ++i)
+    {
+        auto untilProbe = std::chrono::duration_cast<std::chrono::milliseconds>(_scheduler.nextProbe(i) - now);
+        nextProbes.emplace(_locations[i].pLocation->id(), nowMsec + untilProbe.count());
+    }
+
+    LatencyProbeSchedule schedule;
+    schedule.probeBudget(LatencyProbeScheduler::ProbeBudget);
+    schedule.probesPerHour(_scheduler.probesPerHour());
+    schedule.nextProbes(std::move(nextProbes));
+    return schedule;
 }
 
 void LatencyTracker::start()
 {
-    if(!_measureTrigger.isActive())
+    if(!_measurementsEnabled)
     {
-        _measureTrigger.start();
-        //Trigger measurements for anything that hasn't been measured yet
-        measureNewLocations();
+        _measurementsEnabled = true;
+        //Trigger measurements for anything that's due, including new
+        //locations that haven't been measured yet
+        measureDueLocations();
     }
 }
 
 void LatencyTracker::stop()
 {
+    _measurementsEnabled = false;
     _measureTrigger.stop();
 }
 
+BatchPinger::BatchPinger()
+    : _pPendingReplies{nullptr}
+{
+    _burstTimer.setInterval(std::chrono::milliseconds(latencyBurstInterval).count());
+    connect(&_burstTimer, &QTimer::timeout, this, &BatchPinger::sendBurst);
+}
+
+void BatchPinger::start(const std::vector<QSharedPointer<Location>> &locations,
+                        PendingRepliesMap &pendingReplies)
+{
+    _pPendingReplies = &pendingReplies;
+
+    for(const auto &pLocation : locations)
+    {
+        quint32 echoAddr = selectIcmpPingAddress(pLocation);
+        if(echoAddr)
+        {
+            // Put this location in the pending replies now - it'll be removed
+            // if the echo can't be sent.
+            pendingReplies[HostPortKey{QHostAddress{echoAddr}, 0}] = pLocation->id();
+            _unsentAddresses.push_back(echoAddr);
+        }
+    }
+
+    // Send the first burst now; the rest are sent by the timer
+    sendBurst();
+    if(!_unsentAddresses.empty())
+        _burstTimer.start();
+}
+
+void BatchPinger::sendBurst()
+{
+    Q_ASSERT(_pPendingReplies);    // Timer isn't started until start() is called
+
+    std::size_t sent{0};
+    while(!_unsentAddresses.empty() && sent < latencyBurstSize)
+    {
+        quint32 address = _unsentAddresses.front();
+        _unsentAddresses.pop_front();
+        if(!sendEcho(address))
+            _pPendingReplies->erase(HostPortKey{QHostAddress{address}, 0});
+        ++sent;
+    }
+
+    if(_unsentAddresses.empty())
+        _burstTimer.stop();
+}
+
 LatencyBatch::LatencyBatch(const std::vector<QSharedPointer<Location>> &locations,
                            QObject *pParent)
     : QObject{pParent}
@@ -313,17 +671,15 @@ LatencyBatch::LatencyBatch(const std::vector<QSharedPointer<Location>> &location
     connect(&_batchTimer, &QTimer::timeout, this,
             &LatencyBatch::onBatchElapsed);
 
-    //Start the timer before sending the ping packets
-    _timeSincePing.start();
-
 #if defined(Q_OS_WIN)
-    _pPinger.reset(new WinIcmpBatchPinger{locations, _pendingReplies, latencyEchoTimeout});
+    _pPinger.reset(new WinIcmpBatchPinger{latencyEchoTimeout});
 #else
-    _pPinger.reset(new PosixIcmpBatchPinger{locations, _pendingReplies});
+    _pPinger.reset(new PosixIcmpBatchPinger{});
 #endif
 
     connect(_pPinger.get(), &BatchPinger::receivedResponse, this,
             &LatencyBatch::onReceivedResponse);
+    _pPinger->start(locations, _pendingReplies);
 
     if(_pendingReplies.size() >= 1)
     {
@@ -350,11 +706,9 @@ void LatencyBatch::emitBatchedMeasurements()
     }
 }
 
-void LatencyBatch::onReceivedResponse(const QHostAddress &address, quint16 port)
+void LatencyBatch::onReceivedResponse(const QHostAddress &address, quint16 port,
+                                      std::chrono::microseconds latency)
 {
-    // Get the roundtrip latency measurement.
-    std::chrono::milliseconds roundtripLatency{_timeSincePing.elapsed()};
-
     //Look up this host in the pending replies.  Look for any possible
     //equivalent address - for example, an IPv4 address could now be represented
     //as an IPv4-mapped IPv6 address.
@@ -375,8 +729,7 @@ void LatencyBatch::onReceivedResponse(const QHostAddress &address, quint16 port)
         return;
 
     // Store a measurement for this host
-    _batchedMeasurements.push_back({itHostPendingReply->second,
-                                    roundtripLatency});
+    _batchedMeasurements.push_back({itHostPendingReply->second, latency});
 
     //This host has been measured, so remove it from _pendingReplies
     _pendingReplies.erase(itHostPendingReply);
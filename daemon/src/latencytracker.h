@@ -23,14 +23,18 @@
 #define LATENCYTRACKER_H
 
 #include "thread.h"
+#include "settings/daemonstate.h"
 #include "settings/locations.h"
 #include "vpn.h"
 #include <QObject>
-#include <QElapsedTimer>
 #include <QHostAddress>
 #include <QTimer>
 #include <QUdpSocket>
 #include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace std
 {
@@ -58,25 +62,131 @@ struct HashPair
 // values are the associated location IDs.
 using PendingRepliesMap = std::unordered_map<HostPortKey, QString, HashPair>;
 
-//LatencyHistory queues up latency measurements for a particular remote host.
-//As measurements are taken, they're queued up in LatencyHistory, which
-//computes a latency value based on those measurements.
-class LatencyHistory
+//LatencyStore holds the recent latency measurements for a set of locations.
+//Locations are identified by a dense index assigned by add(); LatencyTracker
+//maps location IDs to these indices.
+//
+//The store is laid out as parallel arrays rather than one object per location.
+//Each location has a fixed-size circular buffer of samples in _samples, and the
+//sum/count of its samples are maintained incrementally as measurements are
+//added, so adding a measurement and reading the aggregate are both O(1), and
+//aggregating every location is a single pass over two contiguous arrays.
+class LatencyStore
 {
     CLASS_LOGGING_CATEGORY("latency");
 
 public:
-    //Add a new measurement and calculate the current latency based on all
-    //recent measurements.
-    std::chrono::milliseconds updateLatency(std::chrono::milliseconds newMeasurement);
+    //The number of measurements stored per location
+    enum : std::size_t { HistoryCount = 5 };
+
+public:
+    //Add a location with no measurements, returns its index.
+    std::size_t add();
+    //Add a location with the measurements from a location in another store
+    //(used to carry over measurements when the location list is rebuilt).
+    std::size_t add(const LatencyStore &other, std::size_t otherIndex);
+
+    std::size_t size() const {return _counts.size();}
+    void clear();
+    void reserve(std::size_t count);
+
+    //Add a new measurement for a location and return the current latency
+    //based on all of its recent measurements.
+    std::chrono::microseconds updateLatency(std::size_t index,
+                                            std::chrono::microseconds newMeasurement);
+
+    //Get the current latency of a location, or 0 if it has no measurements.
+    std::chrono::microseconds latency(std::size_t index) const;
+
+    //Compute the current latency of all locations.  result is resized to
+    //size(); locations with no measurements are 0.
+    void computeLatencies(std::vector<std::chrono::microseconds> &result) const;
+
+    //Get the number of measurements stored for a location.
+    std::size_t sampleCount(std::size_t index) const {return _counts[index];}
+
+    //Get the standard deviation of a location's recent measurements, or 0 if
+    //it has fewer than 2 measurements.
+    std::chrono::microseconds deviation(std::size_t index) const;
+
+private:
+    //Samples for all locations - HistoryCount slots per location.  Slots that
+    //haven't been filled yet are 0.
+    std::vector<std::chrono::microseconds> _samples;
+    //Running sum of the stored samples for each location
+    std::vector<std::chrono::microseconds> _sums;
+    //Slot that will receive each location's next sample
+    std::vector<quint8> _heads;
+    //Number of valid samples for each location (up to HistoryCount)
+    std::vector<quint8> _counts;
+};
+
+//LatencyProbeScheduler decides when each location should be probed next.
+//Like LatencyStore, locations are identified by LatencyTracker's dense index,
+//and the schedule is stored as parallel arrays.
+//
+//Rather than re-probing every location on a fixed interval, each location has
+//its own probe interval:
+// - Candidates for the best location (the current best and chosen locations,
+//   and any location whose latency is near the best) are probed every
+//   CandidateInterval.
+// - Other locations back off exponentially each time they're probed, from
+//   BaseInterval up to MaxInterval.  This covers both locations with stable
+//   measurements and locations that don't respond at all.
+// - If a location's measurements vary, it goes back to BaseInterval.
+//
+//Locations that are due at nearly the same time are coalesced into one batch to
+//reduce wakeups, and at most ProbeBudget locations are probed in one batch.
+class LatencyProbeScheduler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::seconds CandidateInterval{30};
+    static constexpr std::chrono::seconds BaseInterval{60};
+    static constexpr std::chrono::seconds MaxInterval{960};
+    //Locations due within this window are probed with the current batch
+    static constexpr std::chrono::seconds CoalesceWindow{10};
+    //Maximum number of locations probed in one batch
+    enum : std::size_t { ProbeBudget = 64 };
+
+public:
+    //Add a location that is due to be probed now; returns its index.
+    std::size_t add(Clock::time_point now);
+    //Add a location with the schedule from a location in another scheduler.
+    std::size_t add(const LatencyProbeScheduler &other, std::size_t otherIndex);
+
+    std::size_t size() const {return _nextProbes.size();}
+    void clear();
+    void reserve(std::size_t count);
+
+    //Set whether a location is a candidate for the best location.  A new
+    //candidate is rescheduled to CandidateInterval if it was due later.
+    void setCandidate(std::size_t index, bool candidate, Clock::time_point now);
+    bool isCandidate(std::size_t index) const {return _candidates[index];}
+
+    //A location has been measured; if its measurements aren't stable, it's
+    //rescheduled at BaseInterval.
+    void measured(std::size_t index, bool stable, Clock::time_point now);
+
+    //Find the locations that are due to be probed at 'now', up to ProbeBudget
+    //(candidates first, then the most overdue), and schedule their next
+    //probes.  The indices are stored in 'due'.
+    void takeDue(Clock::time_point now, std::vector<std::size_t> &due);
+
+    //Get the time the next location is due, or Clock::time_point::max() if
+    //there are no locations.
+    Clock::time_point nextDue() const;
+    Clock::time_point nextProbe(std::size_t index) const {return _nextProbes[index];}
+
+    //Get the projected number of probes per hour at the current intervals.
+    double probesPerHour() const;
 
 private:
-    //The last few measurements are stored here.  Qt doesn't have a deque,
-    //which would probably be ideal, but a QList should be OK.  It'll still have
-    //to copy the entire array when we run out of space in the back of its
-    //buffer, but it'll probably do better than a vector since it won't have to
-    //do it every time we delete something from the front.
-    QList<std::chrono::milliseconds> _lastMeasurements;
+    std::vector<Clock::time_point> _nextProbes;
+    //Interval that will be used to schedule each location's next probe
+    std::vector<std::chrono::seconds> _intervals;
+    std::vector<quint8> _candidates;
 };
 
 //LatencyTracker takes measurements of the latency to each location's "ping"
@@ -87,6 +197,11 @@ private:
 //each location periodically and emits the "newMeasurements" signal when new
 //measurements are taken.
 //
+//Locations are probed on an adaptive schedule (see LatencyProbeScheduler).
+//Daemon provides the locations that are currently preferred with
+//updateCandidateLocations(); those and any location with a latency near the
+//best are probed most often.
+//
 //LatencyTracker identifies locations by their ID, not by their ping address.
 //This means that if a location's ping address changes (which usually happens
 //when we refresh the server list), the measurements from the old address carry
@@ -100,15 +215,11 @@ private:
     struct LocationData
     {
         QSharedPointer<Location> pLocation;
-        LatencyHistory latency;
-        //Locations can sit in _locations without having been attempted if
-        //measurements are not enabled.
-        bool pingAttempted;
     };
 
 public:
     // Group of latency measurements - location IDs and latency values.
-    using Latencies = std::vector<QPair<QString, std::chrono::milliseconds>>;
+    using Latencies = std::vector<QPair<QString, std::chrono::microseconds>>;
 
 public:
     // LatencyTracker begins with measurements stopped - call start() to enable
@@ -121,6 +232,11 @@ signals:
     // (Note that moc requires redundant qualifications of nested types)
     void newMeasurements(const LatencyTracker::Latencies &measurements);
 
+    // The probe schedule has changed; see probeSchedule().  This is
+    // throttled - it's emitted at most once per publish interval, after the
+    // last change in that interval.
+    void probeScheduleChanged();
+
 private slots:
     //Trigger a new latency measurement
     void onMeasureTrigger();
@@ -128,13 +244,25 @@ private slots:
     void onNewMeasurements(const Latencies &measurements);
 
 private:
-    //Begin a measurement for all locations in _locations that haven't been
-    //attempted yet
-    void measureNewLocations();
+    //Begin a measurement for all locations that are due now, then schedule the
+    //next measurement
+    void measureDueLocations();
+
+    //Start _measureTrigger for the next location that's due (if measurements
+    //are enabled)
+    void scheduleMeasurement();
+
+    //Update the scheduler's candidates from the candidate locations and the
+    //current latencies
+    void updateCandidates();
 
     //Begin a new measurement for a group of locations
     void beginMeasurement(const std::vector<QSharedPointer<Location>> &locations);
 
+    //Emit probeScheduleChanged() now, or when the publish interval elapses if
+    //it was emitted recently
+    void queueProbeScheduleChanged();
+
 public:
     //Daemon passes the current set of locations to this method.
     //
@@ -143,11 +271,19 @@ public:
     //measured whenever measurements are re-enabled.
     void updateLocations(const LocationsById &serverLocations);
 
+    //Daemon passes the locations that are currently preferred - the best and
+    //chosen locations for each service.  These are probed more often, along
+    //with any other location whose latency is near the best.
+    void updateCandidateLocations(std::unordered_set<QString> locationIds);
+
+    //Get the current probe schedule (for observability in DaemonState).
+    LatencyProbeSchedule probeSchedule() const;
+
     //Enable latency measurements.
     //
     //If they were already enabled, this has no effect.  If they weren't
-    //enabled, and new locations have been added since they were last enabled,
-    //a measurement is started immediately for those locations.
+    //enabled, a measurement is started immediately for any locations that are
+    //due, including new locations added since they were last enabled.
     void start();
 
     //Stop latency measurements.  If they were already stopped, this has no
@@ -160,22 +296,29 @@ public:
 private:
     // Measurement batches are executed on this thread.
     RunningWorkerThread _measurementThread;
-    //This QTimer triggers when we need to refresh the measurements for all
-    //servers.  This timer is running if and only if measurements have been
-    //started.
+    //This single-shot QTimer triggers when the next location is due to be
+    //probed.  It only runs when measurements have been started.
     QTimer _measureTrigger;
+    bool _measurementsEnabled;
     //All locations received from the last call to updateLocations() are
     //held here.  The rest of the location list isn't stored; we only keep track
     //of the distinct addresses that are pinged.
     //
-    //Keys in this map are location IDs.
-    //
-    //Values are LocationData objects, which contain the location's ping address
-    //and its LatencyHistory.
-    std::unordered_map<QString, LocationData> _locations;
+    //_locations, _latencies, and _scheduler are indexed by the same dense
+    //location index; _locationIndices maps location IDs to that index.
+    std::vector<LocationData> _locations;
+    LatencyStore _latencies;
+    LatencyProbeScheduler _scheduler;
+    std::unordered_map<QString, std::size_t> _locationIndices;
+    //Candidate locations from Daemon
+    std::unordered_set<QString> _candidateLocations;
+    //Throttles probeScheduleChanged(); _scheduleChangePending is set if the
+    //schedule changed while the timer was running
+    QTimer _schedulePublishTimer;
+    bool _scheduleChangePending;
 };
 
-Q_DECLARE_METATYPE(std::chrono::milliseconds);
+Q_DECLARE_METATYPE(std::chrono::microseconds);
 Q_DECLARE_METATYPE(LatencyTracker::Latencies);
 
 // BatchPinger is an interface to measure latency to a batch of servers using
@@ -191,23 +334,52 @@ class BatchPinger : public QObject
     CLASS_LOGGING_CATEGORY("latency");
 
 public:
+    BatchPinger();
     virtual ~BatchPinger() = default;
 
+public:
+    // Ping each location.  All locations with a ping address are inserted into
+    // pendingReplies before start() returns (values are the location IDs;
+    // ports are always 0 for ICMP).  If an echo can't be sent, that location
+    // is removed from pendingReplies again.
+    //
+    // The echoes are paced - they're sent in small bursts rather than all at
+    // once, so a large batch doesn't queue up behind itself and penalize the
+    // servers pinged last.  pendingReplies must outlive the BatchPinger.
+    void start(const std::vector<QSharedPointer<Location>> &locations,
+               PendingRepliesMap &pendingReplies);
+
+protected:
+    // Send one echo to an address.  Returns false if it couldn't be sent.
+    virtual bool sendEcho(quint32 address) = 0;
+
+private:
+    void sendBurst();
+
 signals:
-    // A server has responded.
+    // A server has responded.  latency is the round trip time of the echo to
+    // that server, measured individually for each echo.
     // It's possible that the BatchPinger could receive spurious replies from
     // hosts that weren't pinged in this batch; the receiver of this signal
     // should ignore these.
-    void receivedResponse(const QHostAddress &address, quint16 port);
+    void receivedResponse(const QHostAddress &address, quint16 port,
+                          std::chrono::microseconds latency);
+
+private:
+    PendingRepliesMap *_pPendingReplies;
+    // Addresses that haven't been pinged yet
+    std::deque<quint32> _unsentAddresses;
+    // Sends the next burst of echoes
+    QTimer _burstTimer;
 };
 
 // LatencyBatch represents one batch of latency measurements.
 // LatencyTracker creates a batch each time it needs to measure latency to one or
 // more servers.
 //
-// LatencyBatch sends UDP packets to each configured address, then waits for
-// echos until the timeout time elapses.  When a reply is received, it
-// calculates the measured latency.  Groups of measurements are emitted in the
+// LatencyBatch sends ICMP echoes to each configured address, then waits for
+// replies until the timeout time elapses.  Each reply carries the round trip
+// time measured by the BatchPinger for that echo.  Groups of measurements are emitted in the
 // newMeasurements signal, which LatencyTracker forwards on.
 //
 // Once all measurements are received, or if the timeout time elapses,
@@ -239,15 +411,13 @@ private:
     void emitBatchedMeasurements();
 
 private:
-    void onReceivedResponse(const QHostAddress &address, quint16 port);
+    void onReceivedResponse(const QHostAddress &address, quint16 port,
+                            std::chrono::microseconds latency);
     void onTimeoutElapsed();
     // The batch timer has elapsed, process the batched measurements
     void onBatchElapsed();
 
 private:
-    //This timer measures the elapsed time since the pings were sent, which is
-    //used to calculate latency when the echoes are received.
-    QElapsedTimer _timeSincePing;
     //This map holds the addresses that we haven't heard echoes from yet.
     //Values are the location IDs that we received in the constructor.
     PendingRepliesMap _pendingReplies;
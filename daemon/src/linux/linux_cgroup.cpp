@@ -28,11 +28,135 @@
 #include "brand.h"
 
 #include <QDir>
+#include <mutex>
+#include <unordered_map>
+#include <sys/statfs.h>
+#include <linux/magic.h>
+#include <unistd.h>
 
+namespace
+{
+    // Mount point of the unified hierarchy (when it's the only hierarchy)
+    const QString unifiedRoot{QStringLiteral("/sys/fs/cgroup")};
+    // Names of the split tunnel groups in the unified hierarchy (at the root
+    // level, so they're matched with level 1 paths)
+    const QString unifiedBypassGroup{QStringLiteral(BRAND_CODE "vpnexclusions")};
+    const QString unifiedVpnOnlyGroup{QStringLiteral(BRAND_CODE "vpnonly")};
+
+    const Path unifiedExclusionsFile{unifiedRoot + '/' + unifiedBypassGroup + QStringLiteral("/cgroup.procs")};
+    const Path unifiedVpnOnlyFile{unifiedRoot + '/' + unifiedVpnOnlyGroup + QStringLiteral("/cgroup.procs")};
+    const Path unifiedParentFile{unifiedRoot + QStringLiteral("/cgroup.procs")};
+
+    // The cgroups that processes were in before they were added to a split
+    // tunnel group in the unified hierarchy (paths relative to unifiedRoot).
+    // Processes are added on the launch resolver's thread, so this is guarded
+    // by a mutex.
+    std::mutex originalGroupsMutex;
+    std::unordered_map<pid_t, QString> originalGroups;
+
+    bool isSplitTunnelGroup(const QString &group)
+    {
+        return group == '/' + unifiedBypassGroup || group == '/' + unifiedVpnOnlyGroup;
+    }
+
+    // Get the unified hierarchy cgroup of a process from /proc/<pid>/cgroup
+    // (the "0::<path>" line).  Returns an empty string if it can't be read.
+    QString unifiedGroupOf(pid_t pid)
+    {
+        QFile cgroupFile{QStringLiteral("/proc/%1/cgroup").arg(pid)};
+        if(!cgroupFile.open(QIODevice::ReadOnly | QIODevice::Text))
+            return {};
+        while(!cgroupFile.atEnd())
+        {
+            const QByteArray &line = cgroupFile.readLine().trimmed();
+            if(line.startsWith("0::"))
+                return QString::fromUtf8(line.mid(3));
+        }
+        return {};
+    }
+}
 
 const QString CGroup::bypassId{hexNumberStr(BRAND_LINUX_CGROUP_BASE)};
 const QString CGroup::vpnOnlyId{hexNumberStr(BRAND_LINUX_CGROUP_BASE+1)};
 
+auto CGroup::detectHierarchy() -> Hierarchy
+{
+    struct statfs rootFs{};
+    if(::statfs(qPrintable(unifiedRoot), &rootFs) != 0)
+    {
+        qWarning() << "Unable to check cgroup hierarchy at" << unifiedRoot
+            << "-" << ErrnoTracer{};
+        return Hierarchy::NetCls;
+    }
+    if(rootFs.f_type != CGROUP2_SUPER_MAGIC)
+    {
+        qInfo() << "Using net_cls cgroups for split tunnel";
+        return Hierarchy::NetCls;
+    }
+
+    // If we can't create the groups, fall back to net_cls; the rules are
+    // valid (though they won't match anything) if net_cls isn't available.
+    if(::access(qPrintable(unifiedRoot), W_OK) != 0)
+    {
+        qWarning() << "Can't create cgroups in" << unifiedRoot << "-"
+            << ErrnoTracer{} << "- using net_cls cgroups for split tunnel";
+        return Hierarchy::NetCls;
+    }
+
+    qInfo() << "Using unified cgroup hierarchy for split tunnel";
+    return Hierarchy::Unified;
+}
+
+auto CGroup::hierarchy() -> Hierarchy
+{
+    static const Hierarchy _hierarchy{detectHierarchy()};
+    return _hierarchy;
+}
+
+bool CGroup::createUnifiedGroups()
+{
+    if(hierarchy() != Hierarchy::Unified)
+        return true;
+
+    QDir root{unifiedRoot};
+    bool success{true};
+    for(const auto &group : {unifiedBypassGroup, unifiedVpnOnlyGroup})
+    {
+        if(!root.exists(group) && !root.mkdir(group))
+        {
+            qWarning() << "Unable to create cgroup" << root.filePath(group);
+            success = false;
+        }
+    }
+    return success;
+}
+
+QString CGroup::iptablesMatch(const QString &cGroupId)
+{
+    if(hierarchy() == Hierarchy::Unified)
+    {
+        Q_ASSERT(cGroupId == bypassId || cGroupId == vpnOnlyId);
+        return QStringLiteral("--path %1")
+            .arg(cGroupId == bypassId ? unifiedBypassGroup : unifiedVpnOnlyGroup);
+    }
+    return QStringLiteral("--cgroup %1").arg(cGroupId);
+}
+
+const Path &CGroup::exclusionsFile()
+{
+    return hierarchy() == Hierarchy::Unified ? unifiedExclusionsFile : Path::VpnExclusionsFile;
+}
+
+const Path &CGroup::vpnOnlyFile()
+{
+    return hierarchy() == Hierarchy::Unified ? unifiedVpnOnlyFile : Path::VpnOnlyFile;
+}
+
+const Path &CGroup::parentFile()
+{
+    return hierarchy() == Hierarchy::Unified ? unifiedParentFile : Path::ParentVpnExclusionsFile;
+}
+
 bool CGroup::createNetCls()
 {
     Path netClsDir{Path::ParentVpnExclusionsFile.parent()};
@@ -57,8 +181,8 @@ bool CGroup::createNetCls()
 
 void CGroup::setupNetCls()
 {
-    const QString bypassDir{Path::VpnExclusionsFile.parent()};
-    const QString vpnOnlyDir{Path::VpnOnlyFile.parent()};
+    const QString bypassDir{exclusionsFile().parent()};
+    const QString vpnOnlyDir{vpnOnlyFile().parent()};
 
     // Split tunnel (exclusions) - we want the bypass rule to have lower priority than the vpnOnly rule (see Routing::Priorities)
     // so that an app set to vpnOnly has all its packets sent over the VPN even if a bypass rule (such as a subnet bypass) would otherwise
@@ -78,9 +202,15 @@ void CGroup::setupCgroup(const Path &cGroupDir, const QString &cGroupId, const Q
 {
     qInfo() << "Should be setting up cgroups in" << cGroupDir << "for traffic splitting";
 
-    // Create the net_cls group
-    execute(QStringLiteral("if [ ! -d %1 ] ; then mkdir %1 ; sleep 0.1 ; echo %2 > %1/net_cls.classid ; fi")
-        .arg(cGroupDir).arg(cGroupId));
+    // Create the net_cls group.  Unified groups are matched by path, not a
+    // class ID, so they just need to exist.
+    if(hierarchy() == Hierarchy::NetCls)
+    {
+        execute(QStringLiteral("if [ ! -d %1 ] ; then mkdir %1 ; sleep 0.1 ; echo %2 > %1/net_cls.classid ; fi")
+            .arg(cGroupDir).arg(cGroupId));
+    }
+    else
+        createUnifiedGroups();
     execute(QStringLiteral("if ! ip rule list | grep -q %1 ; then ip rule add from all fwmark %1 lookup %2 pri %3 ; fi")
         .arg(packetTag, routingTableName).arg(priority));
 }
@@ -110,22 +240,39 @@ int CGroup::execute(const QString &command, bool ignoreErrors)
     return iptablesExecutor.bash(command, ignoreErrors);
 }
 
-void CGroup::writePidToCGroup(pid_t pid, const QString &cGroupPath)
+bool CGroup::writePidToCGroup(pid_t pid, const QString &cGroupPath)
 {
     QFile cGroupFile{cGroupPath};
 
     if(!cGroupFile.open(QFile::WriteOnly))
     {
         qWarning() << "Cannot open" << cGroupPath << "for writing!" << cGroupFile.errorString();
-        return;
+        return false;
     }
 
     if(cGroupFile.write(QByteArray::number(pid)) < 0)
+    {
         qWarning() << "Could not write to" << cGroupPath << cGroupFile.errorString();
+        return false;
+    }
+    return true;
 }
 
 void CGroup::addPidToCgroup(pid_t pid, const Path &cGroupPath)
 {
+    // Record where the process came from so it can be put back.  If it's
+    // moving between the split tunnel groups, keep the group it was in before
+    // either of them.
+    if(hierarchy() == Hierarchy::Unified)
+    {
+        QString group = unifiedGroupOf(pid);
+        if(!group.isEmpty() && !isSplitTunnelGroup(group))
+        {
+            std::lock_guard<std::mutex> lock{originalGroupsMutex};
+            originalGroups[pid] = std::move(group);
+        }
+    }
+
     writePidToCGroup(pid, cGroupPath);
     // Add child processes (NOTE: we also recurse through child processes of child processes)
     addChildPidsToCgroup(pid, cGroupPath);
@@ -140,19 +287,68 @@ void CGroup::addChildPidsToCgroup(pid_t parentPid, const Path &cGroupPath)
     }
 }
 
-void CGroup::removeChildPidsFromCgroup(pid_t parentPid, const Path &cGroupPath)
+void CGroup::releasePid(pid_t pid)
 {
-    for(pid_t pid : ProcFs::childPidsOf(parentPid))
+    if(hierarchy() == Hierarchy::Unified)
+        releaseUnifiedPid(pid);
+    else
+    {
+        // We remove a PID from a net_cls cgroup by adding it to its parent
+        // cgroup
+        writePidToCGroup(pid, Path::ParentVpnExclusionsFile);
+    }
+
+    // Remove child processes (NOTE: we also recurse through child processes of
+    // child processes).  This happens after the parent is released, so
+    // children that were started in the split tunnel group follow it.
+    for(pid_t childPid : ProcFs::childPidsOf(pid))
     {
-        qInfo() << "Removing child pid" << pid << cGroupPath;
-        removePidFromCgroup(pid, cGroupPath);
+        qInfo() << "Removing child pid" << childPid;
+        releasePid(childPid);
     }
 }
 
-void CGroup::removePidFromCgroup(pid_t pid, const Path &cGroupPath)
+void CGroup::releaseUnifiedPid(pid_t pid)
 {
-    // We remove a PID from a cgroup by adding it to its parent cgroup
-    writePidToCGroup(pid, cGroupPath);
-    // Remove child processes (NOTE: we also recurse through child processes of child processes)
-    removeChildPidsFromCgroup(pid, cGroupPath);
+    QString group;
+    {
+        std::lock_guard<std::mutex> lock{originalGroupsMutex};
+        auto itGroup = originalGroups.find(pid);
+        if(itGroup != originalGroups.end())
+        {
+            group = std::move(itGroup->second);
+            originalGroups.erase(itGroup);
+        }
+    }
+
+    // If we don't know where this process came from (it was started in the
+    // split tunnel group, or the daemon restarted), use the cgroup of the
+    // nearest ancestor that isn't in split tunnel.
+    for(pid_t ancestor = ProcFs::parentPidOf(pid); group.isEmpty() && ancestor > 0;
+        ancestor = ProcFs::parentPidOf(ancestor))
+    {
+        QString ancestorGroup = unifiedGroupOf(ancestor);
+        if(!ancestorGroup.isEmpty() && !isSplitTunnelGroup(ancestorGroup))
+            group = std::move(ancestorGroup);
+    }
+
+    // The original cgroup may have been removed (systemd removes a scope when
+    // its last process leaves), so try its ancestors.  The root always
+    // accepts processes.
+    QString groupDir = QDir::cleanPath(unifiedRoot + '/' + group);
+    while(!writePidToCGroup(pid, groupDir + QStringLiteral("/cgroup.procs")))
+    {
+        if(!groupDir.startsWith(unifiedRoot + '/'))
+            return;
+        groupDir.truncate(groupDir.lastIndexOf('/'));
+    }
+    qInfo() << "Moved pid" << pid << "back to cgroup" << groupDir;
+}
+
+void CGroup::forgetPid(pid_t pid)
+{
+    if(hierarchy() != Hierarchy::Unified)
+        return;
+    std::lock_guard<std::mutex> lock{originalGroupsMutex};
+    originalGroups.erase(pid);
 }
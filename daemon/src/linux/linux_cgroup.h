@@ -22,14 +22,63 @@
 #ifndef LINUX_CGROUP_H
 #define LINUX_CGROUP_H
 
+#include "path.h"
+
+// Split tunnel places the processes of bypass and VPN-only apps in cgroups,
+// which are matched by firewall rules to mark their packets for routing.
+//
+// Hosts that have the legacy net_cls controller use net_cls cgroups, which are
+// matched by class ID.  On hosts with only the unified (v2) hierarchy, net_cls
+// isn't available; cgroup v2 groups are created in the root of the hierarchy
+// instead and matched by path.  Since children inherit their parent's cgroup,
+// processes started by a split tunnel app are classified by the kernel either
+// way.  The hierarchy is detected at runtime the first time it's needed.
+//
+// In the unified hierarchy, a process belongs to exactly one cgroup, so moving
+// it to a split tunnel group takes it out of its systemd scope or slice.  The
+// original cgroup of each process is recorded, and the process is moved back
+// there when it's released from split tunnel.
 class CGroup
 {
    CLASS_LOGGING_CATEGORY("linux_cgroup")
 public:
-    // CGroup identifiers (net_cls.classid)
+    enum class Hierarchy
+    {
+        NetCls,
+        Unified,
+    };
+
+    // CGroup identifiers (net_cls.classid).  Use iptablesMatch() to match
+    // them in firewall rules.
     const static QString bypassId;
     const static QString vpnOnlyId;
 
+    // Get the hierarchy used for split tunnel.  The unified hierarchy is used
+    // if /sys/fs/cgroup is a cgroup2 mount that we can create groups in.  This
+    // only inspects the system; the groups are created by
+    // createUnifiedGroups().
+    static Hierarchy hierarchy();
+
+    // Create the split tunnel groups in the unified hierarchy if they don't
+    // exist yet.  They must exist before any firewall rule refers to them,
+    // since path matches are resolved when the rule is created.  Does nothing
+    // (and returns true) when using net_cls.
+    static bool createUnifiedGroups();
+
+    // Get the arguments to the iptables cgroup match for bypassId or
+    // vpnOnlyId - "--cgroup <classid>" for net_cls, or "--path <path>" for
+    // the unified hierarchy.
+    static QString iptablesMatch(const QString &cGroupId);
+
+    // The cgroup.procs files for the bypass and VPN-only cgroups, and their
+    // parent cgroup.  When using net_cls, these are Path::VpnExclusionsFile,
+    // Path::VpnOnlyFile, and Path::ParentVpnExclusionsFile.  (Use releasePid()
+    // to remove a process from split tunnel, in the unified hierarchy it
+    // doesn't go back to the parent.)
+    static const Path &exclusionsFile();
+    static const Path &vpnOnlyFile();
+    static const Path &parentFile();
+
     // Setup the bypass and vpnOnly cgroups + routing rules
     static void setupNetCls();
 
@@ -42,13 +91,22 @@ public:
     static bool createNetCls();
 
 public:
+    // Add a process and its descendants to a split tunnel cgroup
     static void addPidToCgroup(pid_t pid, const Path &cGroupPath);
-    static void removePidFromCgroup(pid_t pid, const Path &cGroupPath);
+    // Remove a process and its descendants from split tunnel.  With net_cls,
+    // they're moved to the parent cgroup.  In the unified hierarchy, they're
+    // moved back to the cgroup they were in before they were added (or the
+    // cgroup of their nearest ancestor outside of split tunnel if that wasn't
+    // recorded).
+    static void releasePid(pid_t pid);
+    // Forget the original cgroup recorded for a process that has exited
+    static void forgetPid(pid_t pid);
 
 private:
-    static void writePidToCGroup(pid_t pid, const QString &cGroupPath);
-    static void removeChildPidsFromCgroup(pid_t parentPid, const Path &cGroupPath);
+    static bool writePidToCGroup(pid_t pid, const QString &cGroupPath);
     static void addChildPidsToCgroup(pid_t parentPid, const Path &cGroupPath);
+    static void releaseUnifiedPid(pid_t pid);
+    static Hierarchy detectHierarchy();
     static void setupCgroup(const Path &cGroupDir, const QString &cGroupId, const QString &packetTag,
                             const QString &routingTableName, int priority);
     static void teardownCgroup(const QString &packetTag, const QString &routingTableName);
@@ -23,10 +23,14 @@
 #include <linux/netlink.h>
 #include <linux/cn_proc.h>
 #include <linux/connector.h>
+#include <linux/filter.h>
+#include <arpa/inet.h>
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <array>
+#include <vector>
 
 namespace
 {
@@ -53,10 +57,31 @@ namespace
             proc_event event;
         };
     } NetlinkResponse;
+
+    // Maximum number of messages received by one recvmmsg() call
+    const std::size_t ReceiveBatchSize{64};
+    // Maximum number of batches read per socket notification.  If there are
+    // more messages, the notifier is activated again after other events are
+    // handled, so a flood of events can't stall the thread.
+    const int MaxBatchesPerRead{16};
+    // Socket receive buffer size requested - large enough to absorb bursts of
+    // events between reads (the default is usually ~200 KiB)
+    const int ReceiveBufferSize{4 * 1024 * 1024};
+
+    // Build classic BPF instructions
+    sock_filter bpfStmt(std::uint16_t code, std::uint32_t k)
+    {
+        return {code, 0, 0, k};
+    }
+    sock_filter bpfJump(std::uint16_t code, std::uint32_t k, std::uint8_t jt,
+                        std::uint8_t jf)
+    {
+        return {code, jt, jf, k};
+    }
 }
 
 CnProc::CnProc()
-    : _cnSock{}, _pReadNotifier{}
+    : _cnSock{}, _pReadNotifier{}, _overflowCount{0}
 {
     qInfo() << "Connecting to Netlink";
 
@@ -84,6 +109,22 @@ CnProc::CnProc()
         return;
     }
 
+    // Enlarge the receive buffer to absorb bursts.  SO_RCVBUFFORCE can exceed
+    // rmem_max but requires CAP_NET_ADMIN (which we need for cn_proc anyway);
+    // fall back to SO_RCVBUF.
+    if(::setsockopt(_cnSock.get(), SOL_SOCKET, SO_RCVBUFFORCE,
+                    &ReceiveBufferSize, sizeof(ReceiveBufferSize)) < 0 &&
+       ::setsockopt(_cnSock.get(), SOL_SOCKET, SO_RCVBUF, &ReceiveBufferSize,
+                    sizeof(ReceiveBufferSize)) < 0)
+    {
+        qWarning() << "Failed to set Netlink connector receive buffer size -"
+            << ErrnoTracer{};
+    }
+
+    // The filter isn't required, we still ignore other events if it can't
+    // be attached
+    attachEventFilter();
+
     if(!subscribeToProcEvents(true))
     {
         qWarning() << "Could not subscribe to proc events";
@@ -105,25 +146,112 @@ CnProc::~CnProc()
     }
 }
 
-void CnProc::readFromSocket()
+bool CnProc::attachEventFilter()
 {
-    NetlinkResponse message = {};
+    // Drop everything that isn't a cn_proc event from the kernel, and any
+    // events we don't use
+    const std::vector<std::uint32_t> acceptEvents{proc_event::PROC_EVENT_NONE,
+                                                  proc_event::PROC_EVENT_EXEC,
+                                                  proc_event::PROC_EVENT_EXIT};
 
-    int received = ::recv(_cnSock.get(), &message, sizeof(message), 0);
+    // The header checks jump to the 'drop' instruction, which follows the
+    // event checks.  BPF_ABS loads convert from network byte order, so the
+    // (host order) constants are converted to match.
+    const std::uint8_t eventChecks = static_cast<std::uint8_t>(acceptEvents.size());
+    std::vector<sock_filter> filter
+    {
+        // Message is from the kernel
+        bpfStmt(BPF_LD|BPF_W|BPF_ABS, offsetof(nlmsghdr, nlmsg_pid)),
+        bpfJump(BPF_JMP|BPF_JEQ|BPF_K, 0, 0, static_cast<std::uint8_t>(eventChecks + 7)),
+        // A single message (not multipart)
+        bpfStmt(BPF_LD|BPF_H|BPF_ABS, offsetof(nlmsghdr, nlmsg_type)),
+        bpfJump(BPF_JMP|BPF_JEQ|BPF_K, htons(NLMSG_DONE), 0, static_cast<std::uint8_t>(eventChecks + 5)),
+        // A proc connector message
+        bpfStmt(BPF_LD|BPF_W|BPF_ABS, offsetof(NetlinkResponse, body) + offsetof(cn_msg, id) + offsetof(cb_id, idx)),
+        bpfJump(BPF_JMP|BPF_JEQ|BPF_K, htonl(CN_IDX_PROC), 0, static_cast<std::uint8_t>(eventChecks + 3)),
+        bpfStmt(BPF_LD|BPF_W|BPF_ABS, offsetof(NetlinkResponse, body) + offsetof(cn_msg, id) + offsetof(cb_id, val)),
+        bpfJump(BPF_JMP|BPF_JEQ|BPF_K, htonl(CN_VAL_PROC), 0, static_cast<std::uint8_t>(eventChecks + 1)),
+        // Load the event type
+        bpfStmt(BPF_LD|BPF_W|BPF_ABS, offsetof(NetlinkResponse, event) + offsetof(proc_event, what)),
+    };
+    // Each accepted event jumps over the remaining checks and 'drop' to
+    // 'accept'
+    for(std::uint8_t i = 0; i < eventChecks; ++i)
+    {
+        filter.push_back(bpfJump(BPF_JMP|BPF_JEQ|BPF_K, htonl(acceptEvents[i]),
+                                 static_cast<std::uint8_t>(eventChecks - i), 0));
+    }
+    filter.push_back(bpfStmt(BPF_RET|BPF_K, 0));   // drop
+    filter.push_back(bpfStmt(BPF_RET|BPF_K, 0xFFFFFFFF));  // accept
 
-    if(received < 0)
+    sock_fprog program{};
+    program.len = static_cast<unsigned short>(filter.size());
+    program.filter = filter.data();
+    if(::setsockopt(_cnSock.get(), SOL_SOCKET, SO_ATTACH_FILTER, &program,
+                    sizeof(program)) < 0)
     {
-        qWarning() << "Failed receiving from socket -" << ErrnoTracer{};
-        return;
+        qWarning() << "Failed to attach Netlink connector socket filter -"
+            << ErrnoTracer{};
+        return false;
     }
+    return true;
+}
 
-    if(received != sizeof(message))
+void CnProc::readFromSocket()
+{
+    std::array<NetlinkResponse, ReceiveBatchSize> messages;
+    std::array<iovec, ReceiveBatchSize> iovecs;
+    std::array<mmsghdr, ReceiveBatchSize> headers;
+
+    for(int batch = 0; batch < MaxBatchesPerRead; ++batch)
     {
-        qWarning() << "Received" << received
-            << "bytes for Netlink message, expected" << sizeof(message);
+        for(std::size_t i = 0; i < ReceiveBatchSize; ++i)
+        {
+            iovecs[i].iov_base = &messages[i];
+            iovecs[i].iov_len = sizeof(messages[i]);
+            headers[i] = {};
+            headers[i].msg_hdr.msg_iov = &iovecs[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int received = ::recvmmsg(_cnSock.get(), headers.data(),
+                                  static_cast<unsigned>(headers.size()),
+                                  MSG_DONTWAIT, nullptr);
+        if(received < 0)
+        {
+            if(errno == ENOBUFS)
+            {
+                // The socket overflowed and the kernel dropped events.  The
+                // error is reported once per overflow; keep reading.
+                ++_overflowCount;
+                emit overflowed();
+                continue;
+            }
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                qWarning() << "Failed receiving from socket -" << ErrnoTracer{};
+            return;
+        }
+
+        for(int i = 0; i < received; ++i)
+            processMessage(&messages[i], headers[i].msg_len);
+
+        // A short batch means the socket has been drained
+        if(static_cast<std::size_t>(received) < ReceiveBatchSize)
+            return;
+    }
+}
+
+void CnProc::processMessage(const void *pMessage, std::size_t size)
+{
+    if(size != sizeof(NetlinkResponse))
+    {
+        qWarning() << "Received" << size
+            << "bytes for Netlink message, expected" << sizeof(NetlinkResponse);
         return;
     }
 
+    const NetlinkResponse &message = *reinterpret_cast<const NetlinkResponse*>(pMessage);
+
     // shortcut
     const auto &eventData = message.event.event_data;
 
@@ -140,7 +268,8 @@ void CnProc::readFromSocket()
         emit exit(eventData.exit.process_pid);
         break;
     default:
-        // We're not interested in any other events
+        // We're not interested in any other events (if the filter couldn't be
+        // attached)
         break;
     }
 }
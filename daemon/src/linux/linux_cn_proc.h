@@ -24,6 +24,7 @@
 
 #include <QSocketNotifier>
 #include "posix/posix_objects.h"
+#include <cstdint>
 
 // CnProc connects a NETLINK_CONNECTOR socket and subscribes to Proc events
 // (exec, exit, etc.).  This is used by split tunnel to monitor process
@@ -33,16 +34,31 @@
 // Linux kernel, most x86_64 kernels seem to include cn_proc, but many ARM
 // kernels seem to omit it.  (These kernels often include NETLINK_CONNECTOR as a
 // module, so the socket will connect but we won't actually receive any events.)
+//
+// Hosts that start many processes (build servers, CI runners) can generate a
+// lot of events.  A socket filter drops events we don't use in the kernel,
+// and the socket is drained in batches with recvmmsg().  If the socket
+// overflows anyway, the kernel drops events; this is counted by
+// overflowCount().
 class CnProc : public QObject
 {
     Q_OBJECT
+    CLASS_LOGGING_CATEGORY("cn_proc")
 
 public:
     CnProc();
     ~CnProc();
 
+public:
+    // Number of times the socket overflowed (the kernel dropped events since
+    // they couldn't be read quickly enough).  Each overflow may drop any
+    // number of events.
+    std::uint64_t overflowCount() const {return _overflowCount;}
+
 private:
+    bool attachEventFilter();
     void readFromSocket();
+    void processMessage(const void *pMessage, std::size_t size);
     bool subscribeToProcEvents(bool enable);
 
 signals:
@@ -61,9 +77,13 @@ signals:
     // A process exit has occurred
     void exit(pid_t pid);
 
+    // The socket overflowed and events were lost
+    void overflowed();
+
 private:
     PosixFd _cnSock;
     nullable_t<QSocketNotifier> _pReadNotifier;
+    std::uint64_t _overflowCount;
 };
 
 #endif
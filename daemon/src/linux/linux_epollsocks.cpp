@@ -0,0 +1,998 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("linux/linux_epollsocks.cpp")
+
+#include "linux_epollsocks.h"
+#include "linux_splicerelay.h"
+#include "socksnegotiation.h"
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <cstring>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    enum : std::size_t
+    {
+        // Size of each direction's relay buffer in a connection slot.  The
+        // buffers hold SOCKS responses, and relayed data if splice() can't be
+        // used.
+        RelayBufferSize = 16 * 1024,
+        // Number of slots in the timer wheel.  The wheel must span longer than
+        // the longest timeout, timeouts are clamped to fit.
+        WheelSlots = 256,
+        // Maximum events handled per epoll_wait()
+        MaxEvents = 256,
+    };
+
+    // Resolution of the timer wheel
+    const std::chrono::milliseconds wheelTick{50};
+
+    enum : quint32
+    {
+        InvalidIndex = 0xFFFFFFFF,
+    };
+
+    // epoll event sets used for connection sockets
+    enum : quint32
+    {
+        NoEvents = 0,
+        ReadEvents = EPOLLIN,
+        WriteEvents = EPOLLOUT,
+    };
+
+    // epoll_event tags.  Connection sockets are tagged with the slot's
+    // generation (high 32 bits), slot index, and a bit indicating the target
+    // socket, so events for a slot that was released and reused in the same
+    // epoll_wait() batch are ignored.
+    enum : quint64
+    {
+        ListenTag = ~quint64{0},
+        KillTag = ~quint64{0} - 1,
+    };
+
+    bool isTransientError(int error)
+    {
+        return error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+    }
+
+    // Reply code sent when the target connection fails with an errno value
+    SocksNegotiation::Reply connectErrorReply(int error)
+    {
+        switch(error)
+        {
+            default:
+                return SocksNegotiation::Reply::GeneralFailure;
+            case ENETUNREACH:
+                return SocksNegotiation::Reply::NetUnreachable;
+            case EHOSTUNREACH:
+                return SocksNegotiation::Reply::HostUnreachable;
+            case ECONNREFUSED:
+                return SocksNegotiation::Reply::ConnectionRefused;
+        }
+    }
+}
+
+class EpollSocksProxy::Worker
+{
+public:
+    // Lifecycle of a connection slot - these correspond to the states of
+    // SocksConnection.  Once connected, a half-close is tracked per direction
+    // instead of with "disconnecting" states: when one side reaches EOF, the
+    // data from that side have already been sent (the source isn't read until
+    // its pipe or buffer is empty), so the EOF is passed on to the other side,
+    // which then has the disconnect timeout to send its remaining data and
+    // close, like SocksConnection.
+    enum class State : quint8
+    {
+        // Receiving negotiation messages - see SocksNegotiation
+        Negotiating,
+        // Connecting the target socket
+        Connecting,
+        // Relaying data both ways
+        Connected,
+        // Sending a failure response to the SOCKS client, then closing
+        SocksDisconnecting,
+        // Slot isn't in use
+        Free,
+    };
+
+    enum Direction : int
+    {
+        // SOCKS client to target
+        Outbound,
+        // Target to SOCKS client (including SOCKS responses)
+        Inbound,
+        DirectionCount,
+    };
+
+    struct RelayState
+    {
+        // Data received that haven't been sent.  The channel's pipe is opened
+        // once connected; during negotiation, or if splice() can't be used for
+        // this connection, data are queued in the slot's buffer instead.
+        SpliceChannel channel;
+        // Set once the source has reached EOF
+        bool sourceEof;
+    };
+
+    // Connection slot.  Slots are stored contiguously and referred to by
+    // index; the relay buffers are in _buffers at the same index.
+    struct Slot
+    {
+        State state;
+        // Incremented when the slot is released
+        quint32 generation;
+        int clientFd;
+        int targetFd;
+        // Events currently registered with epoll for each socket
+        quint32 clientEvents;
+        quint32 targetEvents;
+        RelayState relay[DirectionCount];
+        // Negotiation message being received
+        SocksNegotiation negotiation;
+        quint16 received;
+        unsigned char message[SocksNegotiation::MaxMessageSize];
+        // Timer wheel links.  timerWheelSlot is InvalidIndex when the timer
+        // isn't armed.  When free, timerNext links the free list.
+        quint32 timerWheelSlot;
+        quint32 timerPrev;
+        quint32 timerNext;
+    };
+
+public:
+    Worker(const EpollSocksProxy &proxy, QByteArray passwordHash,
+           std::chrono::milliseconds negotiationTimeout);
+
+public:
+    quint16 port() const {return _port;}
+    // Run the event loop until the kill socket becomes readable
+    void run(PosixFd killSocket);
+
+private:
+    static quint64 socketTag(quint32 index, quint32 generation, bool target);
+
+    char *buffer(quint32 index, Direction dir);
+
+    quint32 allocateSlot();
+    // Close the slot's sockets and return it to the free list
+    void release(quint32 index);
+    void abortConnection(quint32 index, const char *reason);
+
+    // Timer wheel
+    void armTimer(quint32 index);
+    void disarmTimer(quint32 index);
+    void advanceTimers();
+    int msecUntilNextTick() const;
+
+    void acceptConnections();
+    // Register the sockets' events needed for the current state
+    void updateEvents(quint32 index);
+    void applyEvents(quint32 index, bool target, quint32 events);
+
+    void onClientEvent(quint32 index, quint32 events);
+    void onTargetEvent(quint32 index, quint32 events);
+
+    // Receive and process negotiation messages.  Returns false if the
+    // connection was released.
+    bool receiveNegotiation(quint32 index);
+    bool processMessage(quint32 index);
+    // Queue a response to the SOCKS client, and send it if possible.  Returns
+    // false if the connection was released.
+    bool respond(quint32 index, const unsigned char *pData, std::size_t size);
+    // Send a failure response, then close.  Returns false if the connection
+    // was released.
+    bool rejectConnection(quint32 index, const unsigned char *pData,
+                          std::size_t size);
+    bool rejectConnect(quint32 index, SocksNegotiation::Reply reply);
+    bool startConnect(quint32 index, quint32 address, quint16 port);
+    bool onTargetConnected(quint32 index);
+
+    // Create the pipes used to splice() data in each direction.  If a pipe
+    // can't be created, that direction uses its buffer.
+    void openPipes(quint32 index);
+    // Relay data in one direction until the source or destination would
+    // block.  Returns false if the connection was released.
+    bool pump(quint32 index, Direction dir);
+
+private:
+    const EpollSocksProxy &_proxy;
+    QByteArray _passwordHash;
+    std::chrono::milliseconds _negotiationTimeout;
+    PosixFd _epoll;
+    PosixFd _listenSocket;
+    quint16 _port;
+
+    std::vector<Slot> _slots;
+    std::vector<char> _buffers;
+    quint32 _freeHead;
+    quint32 _activeCount;
+
+    // Timer wheel - each wheel slot is the head of a list of connection slots
+    // that expire on that tick
+    std::array<quint32, WheelSlots> _wheel;
+    quint64 _currentTick;
+    std::chrono::steady_clock::time_point _nextTickTime;
+    quint32 _armedCount;
+};
+
+quint64 EpollSocksProxy::Worker::socketTag(quint32 index, quint32 generation,
+                                           bool target)
+{
+    return (quint64{generation} << 32) | (quint64{index} << 1) | (target ? 1 : 0);
+}
+
+EpollSocksProxy::Worker::Worker(const EpollSocksProxy &proxy,
+                                QByteArray passwordHash,
+                                std::chrono::milliseconds negotiationTimeout)
+    : _proxy{proxy}, _passwordHash{std::move(passwordHash)},
+      _negotiationTimeout{negotiationTimeout}, _port{0},
+      _freeHead{InvalidIndex}, _activeCount{0}, _currentTick{0},
+      _armedCount{0}
+{
+    _wheel.fill(InvalidIndex);
+
+    _epoll = PosixFd{::epoll_create1(EPOLL_CLOEXEC)};
+    if(!_epoll)
+    {
+        qWarning() << "Unable to create epoll instance for API proxy -" << ErrnoTracer{};
+        return;
+    }
+
+    _listenSocket = PosixFd{::socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)};
+    if(!_listenSocket)
+    {
+        qWarning() << "Unable to create API proxy socket -" << ErrnoTracer{};
+        return;
+    }
+
+    sockaddr_in listenAddr{};
+    listenAddr.sin_family = AF_INET;
+    listenAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listenAddr.sin_port = 0;
+    if(::bind(_listenSocket.get(), reinterpret_cast<sockaddr*>(&listenAddr), sizeof(listenAddr)) ||
+       ::listen(_listenSocket.get(), SOMAXCONN))
+    {
+        qWarning() << "Unable to listen for API proxy -" << ErrnoTracer{};
+        return;
+    }
+
+    socklen_t addrLen = sizeof(listenAddr);
+    if(::getsockname(_listenSocket.get(), reinterpret_cast<sockaddr*>(&listenAddr), &addrLen))
+    {
+        qWarning() << "Unable to get API proxy port -" << ErrnoTracer{};
+        return;
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = ListenTag;
+    if(::epoll_ctl(_epoll.get(), EPOLL_CTL_ADD, _listenSocket.get(), &event))
+    {
+        qWarning() << "Unable to watch API proxy socket -" << ErrnoTracer{};
+        return;
+    }
+
+    _port = ntohs(listenAddr.sin_port);
+}
+
+char *EpollSocksProxy::Worker::buffer(quint32 index, Direction dir)
+{
+    return _buffers.data() + (std::size_t{index} * DirectionCount + dir) * RelayBufferSize;
+}
+
+quint32 EpollSocksProxy::Worker::allocateSlot()
+{
+    quint32 index = _freeHead;
+    if(index != InvalidIndex)
+        _freeHead = _slots[index].timerNext;
+    else
+    {
+        index = static_cast<quint32>(_slots.size());
+        _slots.push_back({});
+        _slots[index].generation = 0;
+        _buffers.resize(_slots.size() * DirectionCount * RelayBufferSize);
+    }
+
+    Slot &slot = _slots[index];
+    slot.state = State::Negotiating;
+    slot.clientFd = PosixFd::Invalid;
+    slot.targetFd = PosixFd::Invalid;
+    slot.clientEvents = 0;
+    slot.targetEvents = 0;
+    for(auto &relay : slot.relay)
+    {
+        relay.channel.reset();
+        relay.sourceEof = false;
+    }
+    slot.negotiation = {};
+    slot.received = 0;
+    slot.timerWheelSlot = InvalidIndex;
+    slot.timerPrev = InvalidIndex;
+    slot.timerNext = InvalidIndex;
+    ++_activeCount;
+    return index;
+}
+
+void EpollSocksProxy::Worker::release(quint32 index)
+{
+    Slot &slot = _slots[index];
+    Q_ASSERT(slot.state != State::Free);
+
+    disarmTimer(index);
+    // Closing the sockets also removes them from the epoll set
+    if(slot.clientFd != PosixFd::Invalid)
+        ::close(slot.clientFd);
+    if(slot.targetFd != PosixFd::Invalid)
+        ::close(slot.targetFd);
+    slot.clientFd = PosixFd::Invalid;
+    slot.targetFd = PosixFd::Invalid;
+    for(auto &relay : slot.relay)
+        relay.channel.reset();
+    slot.state = State::Free;
+    ++slot.generation;
+    slot.timerNext = _freeHead;
+    _freeHead = index;
+    --_activeCount;
+}
+
+void EpollSocksProxy::Worker::abortConnection(quint32 index, const char *reason)
+{
+    qWarning() << "API proxy: connection" << index << "aborted in state"
+        << static_cast<int>(_slots[index].state) << "-" << reason;
+    release(index);
+}
+
+void EpollSocksProxy::Worker::armTimer(quint32 index)
+{
+    disarmTimer(index);
+
+    if(_armedCount == 0)
+        _nextTickTime = std::chrono::steady_clock::now() + wheelTick;
+
+    // Round up so the timeout never fires early, and clamp so it fits in the
+    // wheel.
+    auto ticks = (_negotiationTimeout.count() + wheelTick.count() - 1) / wheelTick.count();
+    ticks = std::max<decltype(ticks)>(1, std::min<decltype(ticks)>(ticks, WheelSlots - 1));
+    quint32 wheelSlot = static_cast<quint32>((_currentTick + ticks) % WheelSlots);
+
+    Slot &slot = _slots[index];
+    slot.timerWheelSlot = wheelSlot;
+    slot.timerPrev = InvalidIndex;
+    slot.timerNext = _wheel[wheelSlot];
+    if(slot.timerNext != InvalidIndex)
+        _slots[slot.timerNext].timerPrev = index;
+    _wheel[wheelSlot] = index;
+    ++_armedCount;
+}
+
+void EpollSocksProxy::Worker::disarmTimer(quint32 index)
+{
+    Slot &slot = _slots[index];
+    if(slot.timerWheelSlot == InvalidIndex)
+        return;
+
+    if(slot.timerPrev != InvalidIndex)
+        _slots[slot.timerPrev].timerNext = slot.timerNext;
+    else
+        _wheel[slot.timerWheelSlot] = slot.timerNext;
+    if(slot.timerNext != InvalidIndex)
+        _slots[slot.timerNext].timerPrev = slot.timerPrev;
+
+    slot.timerWheelSlot = InvalidIndex;
+    slot.timerPrev = InvalidIndex;
+    slot.timerNext = InvalidIndex;
+    --_armedCount;
+}
+
+void EpollSocksProxy::Worker::advanceTimers()
+{
+    auto now = std::chrono::steady_clock::now();
+    while(_armedCount > 0 && now >= _nextTickTime)
+    {
+        ++_currentTick;
+        _nextTickTime += wheelTick;
+
+        // Everything in this wheel slot has expired, since the wheel spans
+        // longer than any timeout.
+        quint32 &head = _wheel[_currentTick % WheelSlots];
+        while(head != InvalidIndex)
+            abortConnection(head, "timed out"); // Removes it from the list
+    }
+}
+
+int EpollSocksProxy::Worker::msecUntilNextTick() const
+{
+    if(_armedCount == 0)
+        return -1;
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        _nextTickTime - std::chrono::steady_clock::now());
+    return static_cast<int>(std::max<std::chrono::milliseconds::rep>(0, remaining.count() + 1));
+}
+
+void EpollSocksProxy::Worker::run(PosixFd killSocket)
+{
+    epoll_event killEvent{};
+    killEvent.events = EPOLLIN;
+    killEvent.data.u64 = KillTag;
+    if(::epoll_ctl(_epoll.get(), EPOLL_CTL_ADD, killSocket.get(), &killEvent))
+    {
+        qWarning() << "Unable to watch API proxy kill socket -" << ErrnoTracer{};
+        return;
+    }
+
+    std::array<epoll_event, MaxEvents> events;
+    while(true)
+    {
+        int count = ::epoll_wait(_epoll.get(), events.data(),
+                                 static_cast<int>(events.size()),
+                                 msecUntilNextTick());
+        if(count < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            qWarning() << "API proxy thread terminating due to epoll error -"
+                << ErrnoTracer{};
+            break;
+        }
+
+        for(int i=0; i<count; ++i)
+        {
+            quint64 tag = events[i].data.u64;
+            if(tag == KillTag)
+            {
+                qInfo() << "API proxy thread terminating with" << _activeCount
+                    << "connections";
+                count = -1;
+                break;
+            }
+            if(tag == ListenTag)
+            {
+                acceptConnections();
+                continue;
+            }
+
+            quint32 index = static_cast<quint32>(tag >> 1) & 0x7FFFFFFF;
+            quint32 generation = static_cast<quint32>(tag >> 32);
+            // Ignore events for slots released earlier in this batch
+            if(index >= _slots.size() || _slots[index].generation != generation ||
+               _slots[index].state == State::Free)
+            {
+                continue;
+            }
+
+            if(tag & 1)
+                onTargetEvent(index, events[i].events);
+            else
+                onClientEvent(index, events[i].events);
+        }
+        if(count < 0)
+            break;
+
+        advanceTimers();
+    }
+
+    // Close all remaining connections
+    for(quint32 i=0; i<_slots.size(); ++i)
+    {
+        if(_slots[i].state != State::Free)
+            release(i);
+    }
+}
+
+void EpollSocksProxy::Worker::acceptConnections()
+{
+    while(true)
+    {
+        int clientFd = ::accept4(_listenSocket.get(), nullptr, nullptr,
+                                 SOCK_NONBLOCK|SOCK_CLOEXEC);
+        if(clientFd < 0)
+        {
+            int error = errno;
+            // ECONNABORTED just means this connection was lost, keep going
+            if(error == ECONNABORTED)
+                continue;
+            if(!isTransientError(error))
+                qWarning() << "API proxy: accept failed -" << ErrnoTracer{error};
+            return;
+        }
+
+        quint32 index = allocateSlot();
+        Slot &slot = _slots[index];
+        slot.clientFd = clientFd;
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = socketTag(index, slot.generation, false);
+        if(::epoll_ctl(_epoll.get(), EPOLL_CTL_ADD, clientFd, &event))
+        {
+            qWarning() << "API proxy: unable to watch connection -" << ErrnoTracer{};
+            release(index);
+            continue;
+        }
+        slot.clientEvents = EPOLLIN;
+
+        // Time out if initial negotiation isn't completed
+        armTimer(index);
+    }
+}
+
+void EpollSocksProxy::Worker::applyEvents(quint32 index, bool target,
+                                          quint32 events)
+{
+    Slot &slot = _slots[index];
+    quint32 &registered = target ? slot.targetEvents : slot.clientEvents;
+    int fd = target ? slot.targetFd : slot.clientFd;
+    if(fd == PosixFd::Invalid || registered == events)
+        return;
+
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = socketTag(index, slot.generation, target);
+    if(::epoll_ctl(_epoll.get(), EPOLL_CTL_MOD, fd, &event))
+        qWarning() << "API proxy: unable to update events -" << ErrnoTracer{};
+    else
+        registered = events;
+}
+
+void EpollSocksProxy::Worker::updateEvents(quint32 index)
+{
+    const Slot &slot = _slots[index];
+    bool outboundPending = slot.relay[Outbound].channel.pending() > 0;
+    bool inboundPending = slot.relay[Inbound].channel.pending() > 0;
+    // Sources aren't read after EOF
+    bool clientReadable = !outboundPending && !slot.relay[Outbound].sourceEof;
+    bool targetReadable = !inboundPending && !slot.relay[Inbound].sourceEof;
+    quint32 clientEvents{0}, targetEvents{0};
+
+    switch(slot.state)
+    {
+        default:
+            // Negotiating - read messages and send responses
+            clientEvents = ReadEvents | (inboundPending ? WriteEvents : NoEvents);
+            break;
+        case State::Connecting:
+            // Any data sent by the client now are relayed once connected;
+            // leave them in the socket.  (Errors and hangups are always
+            // reported.)
+            targetEvents = WriteEvents;
+            break;
+        case State::Connected:
+            // Each source is read only when its pipe or buffer has been
+            // sent, so a slow receiver applies backpressure to the sender.
+            clientEvents = (clientReadable ? ReadEvents : NoEvents) | (inboundPending ? WriteEvents : NoEvents);
+            targetEvents = (targetReadable ? ReadEvents : NoEvents) | (outboundPending ? WriteEvents : NoEvents);
+            break;
+        case State::SocksDisconnecting:
+            clientEvents = inboundPending ? WriteEvents : NoEvents;
+            break;
+        case State::Free:
+            return;
+    }
+
+    applyEvents(index, false, clientEvents);
+    applyEvents(index, true, targetEvents);
+}
+
+void EpollSocksProxy::Worker::onClientEvent(quint32 index, quint32 events)
+{
+    Slot &slot = _slots[index];
+
+    if(slot.state == State::Negotiating)
+    {
+        if((events & EPOLLOUT) && !pump(index, Inbound))
+            return;
+        if((events & (EPOLLIN|EPOLLHUP|EPOLLERR)) && !receiveNegotiation(index))
+            return;
+    }
+    else if(slot.state == State::Connecting)
+    {
+        if(events & (EPOLLHUP|EPOLLERR))
+        {
+            abortConnection(index, "unexpected SOCKS disconnect");
+            return;
+        }
+    }
+    else
+    {
+        if((events & (EPOLLIN|EPOLLHUP|EPOLLERR)) && slot.state == State::Connected &&
+           !pump(index, Outbound))
+        {
+            return;
+        }
+        if((events & (EPOLLOUT|EPOLLHUP|EPOLLERR)) && !pump(index, Inbound))
+            return;
+    }
+
+    updateEvents(index);
+}
+
+void EpollSocksProxy::Worker::onTargetEvent(quint32 index, quint32 events)
+{
+    Slot &slot = _slots[index];
+
+    if(slot.state == State::Connecting)
+    {
+        int error{0};
+        socklen_t errorLen = sizeof(error);
+        if(::getsockopt(slot.targetFd, SOL_SOCKET, SO_ERROR, &error, &errorLen))
+            error = errno;
+        if(error)
+        {
+            qInfo() << "API proxy: connection" << index << "failed to connect -"
+                << ErrnoTracer{error};
+            rejectConnect(index, connectErrorReply(error));
+            return;
+        }
+        if(!onTargetConnected(index))
+            return;
+    }
+    else if(slot.state == State::Connected)
+    {
+        if((events & (EPOLLIN|EPOLLHUP|EPOLLERR)) && !pump(index, Inbound))
+            return;
+        if((events & (EPOLLOUT|EPOLLHUP|EPOLLERR)) && !pump(index, Outbound))
+            return;
+    }
+
+    updateEvents(index);
+}
+
+bool EpollSocksProxy::Worker::receiveNegotiation(quint32 index)
+{
+    Slot &slot = _slots[index];
+    while(slot.state == State::Negotiating)
+    {
+        quint16 needed = slot.negotiation.nextMessageBytes();
+        if(slot.received < needed)
+        {
+            // Read only the current message; anything after it stays in the
+            // socket until the state that handles it (possibly data to relay
+            // once connected)
+            ssize_t result = ::recv(slot.clientFd, slot.message + slot.received,
+                                    needed - slot.received, 0);
+            if(result == 0)
+            {
+                abortConnection(index, "unexpected SOCKS disconnect");
+                return false;
+            }
+            if(result < 0)
+            {
+                if(isTransientError(errno))
+                    return true;
+                abortConnection(index, "SOCKS connection error");
+                return false;
+            }
+            slot.received += static_cast<quint16>(result);
+            if(slot.received < needed)
+                continue;
+        }
+
+        if(!processMessage(index))
+            return false;
+    }
+    return true;
+}
+
+bool EpollSocksProxy::Worker::processMessage(quint32 index)
+{
+    Slot &slot = _slots[index];
+    auto result = slot.negotiation.processMessage(slot.message, slot.received,
+                                                  _passwordHash);
+    slot.received = 0;
+
+    switch(result.action)
+    {
+        default:
+        case SocksNegotiation::Action::Continue:
+            return true;
+        case SocksNegotiation::Action::Respond:
+            return respond(index, result.response.data(), result.responseSize);
+        case SocksNegotiation::Action::Reject:
+            qInfo() << "API proxy: rejecting connection" << index << "-"
+                << result.pReason;
+            return rejectConnection(index, result.response.data(),
+                                    result.responseSize);
+        case SocksNegotiation::Action::Abort:
+            abortConnection(index, result.pReason);
+            return false;
+        case SocksNegotiation::Action::Connect:
+            return startConnect(index, result.address, result.port);
+    }
+}
+
+bool EpollSocksProxy::Worker::respond(quint32 index, const unsigned char *pData,
+                                      std::size_t size)
+{
+    SpliceChannel &inbound = _slots[index].relay[Inbound].channel;
+    // Responses are only sent during negotiation, which never fills the buffer
+    Q_ASSERT(inbound.bufferEnd() + size <= RelayBufferSize);
+    std::memcpy(buffer(index, Inbound) + inbound.bufferEnd(), pData, size);
+    inbound.queueBuffered(size);
+    return pump(index, Inbound);
+}
+
+bool EpollSocksProxy::Worker::rejectConnection(quint32 index,
+                                               const unsigned char *pData,
+                                               std::size_t size)
+{
+    Slot &slot = _slots[index];
+    slot.state = State::SocksDisconnecting;
+    // Abort if the response can't be sent soon
+    armTimer(index);
+    if(slot.targetFd != PosixFd::Invalid)
+    {
+        ::close(slot.targetFd);
+        slot.targetFd = PosixFd::Invalid;
+        slot.targetEvents = 0;
+    }
+    return respond(index, pData, size);
+}
+
+bool EpollSocksProxy::Worker::rejectConnect(quint32 index,
+                                            SocksNegotiation::Reply reply)
+{
+    auto response = SocksNegotiation::connectResponse(reply);
+    return rejectConnection(index, response.data(), response.size());
+}
+
+bool EpollSocksProxy::Worker::startConnect(quint32 index, quint32 address,
+                                           quint16 port)
+{
+    Slot &slot = _slots[index];
+    QHostAddress destHost{address};
+    qInfo() << "API proxy: connection" << index << "connecting to" << destHost
+        << "port" << port;
+
+    // Negotiation completed, stop the abort timeout while connecting
+    slot.state = State::Connecting;
+    disarmTimer(index);
+
+    slot.targetFd = ::socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+    if(slot.targetFd == PosixFd::Invalid)
+    {
+        qWarning() << "API proxy: unable to create target socket -" << ErrnoTracer{};
+        return rejectConnect(index, SocksNegotiation::Reply::GeneralFailure);
+    }
+
+    // Bind to the VPN interface if the target isn't loopback - see
+    // SocksConnection.
+    if(!destHost.isLoopback())
+    {
+        QHostAddress bindAddress;
+        QString bindInterface;
+        _proxy.getBindAddress(bindAddress, bindInterface);
+
+        sockaddr_in bindAddr{};
+        bindAddr.sin_family = AF_INET;
+        bindAddr.sin_addr.s_addr = htonl(bindAddress.toIPv4Address());
+        if(::bind(slot.targetFd, reinterpret_cast<sockaddr*>(&bindAddr), sizeof(bindAddr)))
+        {
+            qWarning() << "API proxy: bind failed on connection" << index
+                << "->" << bindAddress << "-" << ErrnoTracer{};
+        }
+        QByteArray interfaceName = bindInterface.toUtf8();
+        if(::setsockopt(slot.targetFd, SOL_SOCKET, SO_BINDTODEVICE,
+                        interfaceName.constData(), interfaceName.size()))
+        {
+            qWarning() << "API proxy: unable to bind connection" << index
+                << "to" << bindInterface << "-" << ErrnoTracer{};
+        }
+    }
+
+    sockaddr_in destAddr{};
+    destAddr.sin_family = AF_INET;
+    destAddr.sin_addr.s_addr = htonl(address);
+    destAddr.sin_port = htons(port);
+    int connectResult = ::connect(slot.targetFd,
+                                  reinterpret_cast<sockaddr*>(&destAddr),
+                                  sizeof(destAddr));
+    if(connectResult && errno != EINPROGRESS)
+    {
+        int error = errno;
+        qInfo() << "API proxy: connection" << index << "failed to connect -"
+            << ErrnoTracer{error};
+        return rejectConnect(index, connectErrorReply(error));
+    }
+
+    epoll_event event{};
+    event.events = EPOLLOUT;
+    event.data.u64 = socketTag(index, slot.generation, true);
+    if(::epoll_ctl(_epoll.get(), EPOLL_CTL_ADD, slot.targetFd, &event))
+    {
+        qWarning() << "API proxy: unable to watch target socket -" << ErrnoTracer{};
+        return rejectConnect(index, SocksNegotiation::Reply::GeneralFailure);
+    }
+    slot.targetEvents = EPOLLOUT;
+    // Stop watching the client while connecting
+    applyEvents(index, false, 0);
+
+    // Connection completes asynchronously, even if connect() succeeded
+    // immediately EPOLLOUT will be signaled.
+    return true;
+}
+
+bool EpollSocksProxy::Worker::onTargetConnected(quint32 index)
+{
+    Slot &slot = _slots[index];
+
+    sockaddr_in localAddr{};
+    socklen_t addrLen = sizeof(localAddr);
+    ::getsockname(slot.targetFd, reinterpret_cast<sockaddr*>(&localAddr), &addrLen);
+
+    auto response = SocksNegotiation::connectResponse(SocksNegotiation::Reply::Succeeded,
+                                                      ntohl(localAddr.sin_addr.s_addr),
+                                                      ntohs(localAddr.sin_port));
+
+    qInfo() << "API proxy: connection" << index << "connected from port"
+        << ntohs(localAddr.sin_port);
+    slot.state = State::Connected;
+    openPipes(index);
+    return respond(index, response.data(), response.size());
+}
+
+void EpollSocksProxy::Worker::openPipes(quint32 index)
+{
+    for(auto &relay : _slots[index].relay)
+    {
+        if(!relay.channel.openPipe())
+        {
+            qInfo() << "API proxy: unable to create relay pipe for connection"
+                << index << "- using buffer instead -" << ErrnoTracer{};
+        }
+    }
+}
+
+bool EpollSocksProxy::Worker::pump(quint32 index, Direction dir)
+{
+    Slot &slot = _slots[index];
+    RelayState &relay = slot.relay[dir];
+    int sourceFd = dir == Outbound ? slot.clientFd : slot.targetFd;
+    int destFd = dir == Outbound ? slot.targetFd : slot.clientFd;
+
+    while(true)
+    {
+        if(relay.channel.pending() == 0)
+        {
+            // Sources are only read once connected; in other states, this
+            // direction just sends what was queued.
+            if(slot.state != State::Connected)
+            {
+                // A rejection response has been sent; done.
+                if(slot.state == State::SocksDisconnecting)
+                {
+                    release(index);
+                    return false;
+                }
+                return true;
+            }
+            if(relay.sourceEof)
+                return true;
+
+            ssize_t received = relay.channel.fill(sourceFd, buffer(index, dir),
+                                                  RelayBufferSize);
+            if(received == 0)
+            {
+                // EOF - all data from this side have been sent.  If the other
+                // side already closed, we're done.
+                qInfo() << "API proxy: connection" << index
+                    << (dir == Outbound ? "closed by SOCKS client" : "closed by target");
+                relay.sourceEof = true;
+                if(slot.relay[dir == Outbound ? Inbound : Outbound].sourceEof)
+                {
+                    release(index);
+                    return false;
+                }
+                // Otherwise, pass on the EOF, and give the other side time to
+                // send any remaining data and close.
+                ::shutdown(destFd, SHUT_WR);
+                armTimer(index);
+                return true;
+            }
+            if(received < 0)
+            {
+                if(isTransientError(errno))
+                    return true;
+                abortConnection(index, dir == Outbound ? "SOCKS connection error" : "target connection error");
+                return false;
+            }
+        }
+
+        ssize_t sent = relay.channel.drain(destFd, buffer(index, dir));
+        if(sent < 0)
+        {
+            if(isTransientError(errno))
+                return true;
+            abortConnection(index, dir == Outbound ? "target connection error" : "SOCKS connection error");
+            return false;
+        }
+        if(sent == 0)
+            return true;
+    }
+}
+
+EpollSocksProxy::EpollSocksProxy(QHostAddress bindAddress,
+                                 QString bindInterface,
+                                 std::chrono::milliseconds negotiationTimeout)
+    : _bindAddress{std::move(bindAddress)},
+      _bindInterface{std::move(bindInterface)}, _port{0}
+{
+    Q_ASSERT(_bindAddress.protocol() == QAbstractSocket::NetworkLayerProtocol::IPv4Protocol);
+
+    _password = SocksNegotiation::generatePassword();
+    _pWorker.reset(new Worker{*this, SocksNegotiation::hashPassword(_password),
+                              negotiationTimeout});
+    if(!_pWorker->port())
+    {
+        qWarning() << "Failed to start API proxy";
+        _pWorker.reset();
+        return;
+    }
+
+    auto killSockets = createSocketPair();
+    if(!killSockets.first || !killSockets.second)
+    {
+        qWarning() << "Failed to create API proxy kill socket";
+        _pWorker.reset();
+        return;
+    }
+    _killSocket = std::move(killSockets.first);
+
+    _port = _pWorker->port();
+    _workerThread = std::thread{[pWorker = _pWorker.get(),
+                                 workerKill = std::move(killSockets.second)]() mutable
+    {
+        pWorker->run(std::move(workerKill));
+    }};
+    qInfo() << "Started API proxy on port" << _port;
+}
+
+EpollSocksProxy::~EpollSocksProxy()
+{
+    if(_workerThread.joinable())
+    {
+        unsigned char term = 0;
+        ::write(_killSocket.get(), &term, sizeof(term));
+        _workerThread.join();
+    }
+}
+
+void EpollSocksProxy::updateBindAddress(QHostAddress bindAddress,
+                                        QString bindInterface)
+{
+    // Checked by caller
+    Q_ASSERT(bindAddress.protocol() == QAbstractSocket::NetworkLayerProtocol::IPv4Protocol);
+    std::lock_guard<std::mutex> lock{_bindMutex};
+    _bindAddress = std::move(bindAddress);
+    _bindInterface = std::move(bindInterface);
+}
+
+void EpollSocksProxy::getBindAddress(QHostAddress &bindAddress,
+                                     QString &bindInterface) const
+{
+    std::lock_guard<std::mutex> lock{_bindMutex};
+    bindAddress = _bindAddress;
+    bindInterface = _bindInterface;
+}
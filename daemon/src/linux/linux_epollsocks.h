@@ -0,0 +1,95 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("linux/linux_epollsocks.h")
+
+#ifndef LINUX_EPOLLSOCKS_H
+#define LINUX_EPOLLSOCKS_H
+
+#include "posix/posix_objects.h"
+#include <QHostAddress>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// EpollSocksProxy is the Linux implementation of the API proxy - a minimal
+// SOCKS5 server that forwards connections through the VPN interface.  It
+// speaks the same protocol as SocksServer (see SocksNegotiation), but
+// instead of a QTcpSocket pair and a QTimer per connection, it runs all
+// connections on one epoll thread:
+//
+// - Connection state lives in a pooled array of fixed-size slots; slots are
+//   reused through a free list, and the relay buffers for all slots are one
+//   contiguous allocation.
+// - Negotiation and disconnect timeouts use a single timer wheel instead of a
+//   timer per connection.
+// - Once connected, data are moved with splice() through a pipe for each
+//   direction, so they don't enter user space (see SpliceChannel, shared with
+//   SocksConnection's SpliceRelay).  If a pipe can't be created or the sockets
+//   don't support splice(), the slot's relay buffers are used.
+//
+// This lets the proxy handle thousands of concurrent connections without any
+// per-connection QObjects.
+//
+// The proxy starts listening and starts its thread when constructed; check
+// port() to see if it started.  Destroying it stops the thread and closes all
+// connections.
+class EpollSocksProxy
+{
+private:
+    class Worker;
+
+public:
+    // Create the proxy with the VPN IP address that outgoing connections will
+    // bind to (a valid IPv4 address) and the VPN interface.
+    //
+    // Clients must complete negotiation within negotiationTimeout, and this
+    // is also the time allowed to send a rejection response.
+    EpollSocksProxy(QHostAddress bindAddress, QString bindInterface,
+                    std::chrono::milliseconds negotiationTimeout = std::chrono::seconds{5});
+    ~EpollSocksProxy();
+
+public:
+    // Get the port that the proxy is listening on.  If this returns 0, the
+    // proxy failed to start.
+    quint16 port() const {return _port;}
+    // Get the password to the proxy - see SocksServer::password().  The user
+    // name is SocksNegotiation::username.
+    QByteArray password() const {return _password;}
+
+    // Update the bind address - the new address must be a valid IPv4 address.
+    // Affects connections made after this call.
+    void updateBindAddress(QHostAddress bindAddress, QString bindInterface);
+
+    // Get the current bind address and interface (used by the worker thread)
+    void getBindAddress(QHostAddress &bindAddress, QString &bindInterface) const;
+
+private:
+    mutable std::mutex _bindMutex;
+    QHostAddress _bindAddress;
+    QString _bindInterface;
+    quint16 _port;
+    QByteArray _password;
+    std::unique_ptr<Worker> _pWorker;
+    std::thread _workerThread;
+    // Written to stop the worker thread
+    PosixFd _killSocket;
+};
+
+#endif
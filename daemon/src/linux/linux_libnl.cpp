@@ -99,6 +99,7 @@ namespace libnl
         loadLibnl(nl_object_get_msgtype);
         loadLibnl(nl_recvmsgs_default);
         loadLibnl(nl_send_auto);
+        loadLibnl(nl_sendto);
         loadLibnl(nl_socket_add_membership);
         loadLibnl(nl_socket_alloc);
         loadLibnl(nl_socket_disable_seq_check);
@@ -108,6 +109,7 @@ namespace libnl
         loadLibnl(nl_socket_get_local_port);
         loadLibnl(nl_socket_modify_cb);
         loadLibnl(nl_socket_set_nonblocking);
+        loadLibnl(nl_wait_for_ack);
         loadLibnl(nla_data);
         loadLibnl(nla_get_u16);
         loadLibnl(nla_get_u32);
@@ -171,6 +173,7 @@ namespace libnl
     LIBNL_FUNC(nl_object_get_msgtype);
     LIBNL_FUNC(nl_recvmsgs_default);
     LIBNL_FUNC(nl_send_auto);
+    LIBNL_FUNC(nl_sendto);
     LIBNL_FUNC(nl_socket_add_membership);
     LIBNL_FUNC(nl_socket_alloc);
     LIBNL_FUNC(nl_socket_disable_seq_check);
@@ -180,6 +183,7 @@ namespace libnl
     LIBNL_FUNC(nl_socket_get_local_port);
     LIBNL_FUNC(nl_socket_modify_cb);
     LIBNL_FUNC(nl_socket_set_nonblocking);
+    LIBNL_FUNC(nl_wait_for_ack);
     LIBNL_FUNC(nla_data);
     LIBNL_FUNC(nla_get_u16);
     LIBNL_FUNC(nla_get_u32);
@@ -149,6 +149,7 @@ namespace libnl
     LIBNL_FUNC(nl_object_get_msgtype);
     LIBNL_FUNC(nl_recvmsgs_default);
     LIBNL_FUNC(nl_send_auto);
+    LIBNL_FUNC(nl_sendto);
     LIBNL_FUNC(nl_socket_add_membership);
     LIBNL_FUNC(nl_socket_alloc);
     LIBNL_FUNC(nl_socket_disable_seq_check);
@@ -158,6 +159,7 @@ namespace libnl
     LIBNL_FUNC(nl_socket_get_local_port);
     LIBNL_FUNC(nl_socket_modify_cb);
     LIBNL_FUNC(nl_socket_set_nonblocking);
+    LIBNL_FUNC(nl_wait_for_ack);
     LIBNL_FUNC(nla_data);
     LIBNL_FUNC(nla_get_u16);
     LIBNL_FUNC(nla_get_u32);
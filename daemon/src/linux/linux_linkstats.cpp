@@ -0,0 +1,152 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("linux_linkstats.cpp")
+
+#include "linux_linkstats.h"
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+namespace
+{
+    // The kernel replies synchronously, so this just guards against a hang
+    const timeval receiveTimeout{1, 0};
+
+    // Receive buffer for the RTM_NEWLINK reply.  Replies are typically a few
+    // KiB with all the link attributes.
+    const std::size_t replyBufferSize{32768};
+}
+
+LinkStatsReader::LinkStatsReader()
+    : _nextSeq{1}
+{
+    _socket = PosixFd{::socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_ROUTE)};
+    if(!_socket)
+    {
+        qWarning() << "Failed to open rtnetlink socket -" << ErrnoTracer{};
+        return;
+    }
+
+    if(::setsockopt(_socket.get(), SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout,
+                    sizeof(receiveTimeout)) < 0)
+    {
+        qWarning() << "Failed to set rtnetlink receive timeout -" << ErrnoTracer{};
+    }
+}
+
+bool LinkStatsReader::read(const QString &interfaceName, Counters &counters)
+{
+    if(!_socket)
+        return false;
+
+    const QByteArray name = interfaceName.toLocal8Bit();
+    if(name.isEmpty() || name.size() >= IFNAMSIZ)
+    {
+        qWarning() << "Interface name" << interfaceName << "is not valid";
+        return false;
+    }
+
+    // Request the link by name
+    struct
+    {
+        nlmsghdr header;
+        ifinfomsg info;
+        char attrs[RTA_SPACE(IFNAMSIZ)];
+    } request{};
+    const std::uint32_t seq = _nextSeq++;
+    rtattr *pNameAttr = reinterpret_cast<rtattr*>(request.attrs);
+    pNameAttr->rta_type = IFLA_IFNAME;
+    pNameAttr->rta_len = static_cast<unsigned short>(RTA_LENGTH(name.size() + 1));
+    std::memcpy(RTA_DATA(pNameAttr), name.constData(), static_cast<std::size_t>(name.size()));
+    request.header.nlmsg_len = static_cast<std::uint32_t>(NLMSG_LENGTH(sizeof(ifinfomsg)) + RTA_ALIGN(pNameAttr->rta_len));
+    request.header.nlmsg_type = RTM_GETLINK;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.header.nlmsg_seq = seq;
+    request.info.ifi_family = AF_UNSPEC;
+
+    if(::send(_socket.get(), &request, request.header.nlmsg_len, 0) < 0)
+    {
+        qWarning() << "Failed to request link stats for" << interfaceName
+            << "-" << ErrnoTracer{};
+        return false;
+    }
+
+    std::array<char, replyBufferSize> reply;
+    // Skip any stale replies (from a request that timed out)
+    while(true)
+    {
+        auto received = ::recv(_socket.get(), reply.data(), reply.size(), 0);
+        if(received < 0)
+        {
+            qWarning() << "Failed to receive link stats for" << interfaceName
+                << "-" << ErrnoTracer{};
+            return false;
+        }
+
+        auto remaining = static_cast<unsigned>(received);
+        for(auto pMsg = reinterpret_cast<const nlmsghdr*>(reply.data());
+            NLMSG_OK(pMsg, remaining); pMsg = NLMSG_NEXT(pMsg, remaining))
+        {
+            if(pMsg->nlmsg_seq != seq)
+                continue;
+
+            if(pMsg->nlmsg_type == NLMSG_ERROR)
+            {
+                const nlmsgerr *pErr = reinterpret_cast<const nlmsgerr*>(NLMSG_DATA(pMsg));
+                qWarning() << "Can't get link stats for" << interfaceName << "-"
+                    << ErrnoTracer{-pErr->error};
+                return false;
+            }
+            if(pMsg->nlmsg_type != RTM_NEWLINK)
+                continue;
+
+            const ifinfomsg *pInfo = reinterpret_cast<const ifinfomsg*>(NLMSG_DATA(pMsg));
+            auto attrsLen = static_cast<unsigned>(IFLA_PAYLOAD(pMsg));
+            for(auto pAttr = IFLA_RTA(pInfo); RTA_OK(pAttr, attrsLen);
+                pAttr = RTA_NEXT(pAttr, attrsLen))
+            {
+                // The kernel's struct may be smaller or larger than ours,
+                // depending on versions; only the byte counts are needed
+                const std::size_t payload = RTA_PAYLOAD(pAttr);
+                if(pAttr->rta_type != IFLA_STATS64 ||
+                   payload < offsetof(rtnl_link_stats64, tx_bytes) + sizeof(std::uint64_t))
+                {
+                    continue;
+                }
+                // The attribute is only 4-byte aligned
+                rtnl_link_stats64 stats{};
+                std::memcpy(&stats, RTA_DATA(pAttr), std::min(payload, sizeof(stats)));
+                counters.rxBytes = stats.rx_bytes;
+                counters.txBytes = stats.tx_bytes;
+                return true;
+            }
+
+            qWarning() << "No IFLA_STATS64 in link info for" << interfaceName;
+            return false;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("linux_linkstats.h")
+
+#ifndef LINUX_LINKSTATS_H
+#define LINUX_LINKSTATS_H
+
+#include "posix/posix_objects.h"
+#include <QString>
+#include <cstdint>
+
+// LinkStatsReader reads a network interface's traffic counters (IFLA_STATS64)
+// with an RTM_GETLINK request for that interface.
+//
+// This is much lighter than a full WireGuard device dump (which includes every
+// peer and allowed IP) when only the byte counts are needed.  The netlink
+// socket is kept open, so each read is just one request and one reply.
+class LinkStatsReader
+{
+    CLASS_LOGGING_CATEGORY("linkstats")
+
+public:
+    struct Counters
+    {
+        std::uint64_t rxBytes;
+        std::uint64_t txBytes;
+    };
+
+public:
+    LinkStatsReader();
+
+public:
+    // Read the counters for an interface.  Returns false if the interface
+    // doesn't exist or the counters can't be read (traced).
+    bool read(const QString &interfaceName, Counters &counters);
+
+private:
+    PosixFd _socket;
+    std::uint32_t _nextSeq;
+};
+
+#endif
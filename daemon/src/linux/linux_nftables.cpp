@@ -0,0 +1,1177 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("linux_nftables.cpp")
+
+#include "linux_nftables.h"
+#include "linux_libnl.h"
+#include "linux_nlcache.h"
+#include <QFile>
+#include <QHostAddress>
+#include <QVersionNumber>
+#include <QtEndian>
+#include <linux/netfilter/nf_tables.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netlink.h>
+#include <net/if.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <netinet/icmp6.h>
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <grp.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <set>
+
+namespace
+{
+    // Data types used for set keys by the nft utility; only used to display
+    // the sets, the kernel just uses the key length
+    enum : std::uint32_t
+    {
+        NftTypeIpv4Addr = 7,
+        NftTypeIpv6Addr = 8,
+    };
+
+    // Socket expression attributes and keys for cgroup v2 matches (Linux
+    // 5.13); defined here since older headers lack them
+    enum : std::uint16_t
+    {
+        NftaSocketKey = 1,
+        NftaSocketDreg = 2,
+        NftaSocketLevel = 3,
+    };
+    enum : std::uint32_t
+    {
+        NftSocketCgroupV2 = 3,
+    };
+
+    // Mount point of the cgroup v2 hierarchy; '--path' matches are relative
+    // to it
+    const QString cgroupV2Root{QStringLiteral("/sys/fs/cgroup")};
+
+    const char *familyTrace(Nftables::Family family)
+    {
+        return family == Nftables::Family::IPv6 ? "(IPv6)" : "(IPv4)";
+    }
+
+    int addressLength(Nftables::Family family)
+    {
+        return family == Nftables::Family::IPv6 ? 16 : 4;
+    }
+
+    // Offsets of the source and destination addresses in the network header
+    std::uint32_t sourceAddressOffset(Nftables::Family family)
+    {
+        return family == Nftables::Family::IPv6 ? 8 : 12;
+    }
+    std::uint32_t destAddressOffset(Nftables::Family family)
+    {
+        return family == Nftables::Family::IPv6 ? 24 : 16;
+    }
+
+    // Compare addresses of the same length in network byte order
+    bool addressLess(const QByteArray &first, const QByteArray &second)
+    {
+        Q_ASSERT(first.size() == second.size());
+        return std::memcmp(first.constData(), second.constData(),
+                           static_cast<std::size_t>(first.size())) < 0;
+    }
+
+    QByteArray prefixMask(int length, int prefix)
+    {
+        QByteArray mask{length, '\0'};
+        for(int i=0; i<length && prefix > 0; ++i, prefix -= 8)
+        {
+            mask[i] = prefix >= 8 ? static_cast<char>(0xFF) :
+                static_cast<char>(0xFF << (8 - prefix));
+        }
+        return mask;
+    }
+
+    // Parse an address or subnet, providing the masked address and the mask
+    void parseSubnet(Nftables::Family family, const QString &subnet,
+                     QByteArray &address, QByteArray &mask)
+    {
+        int slash = subnet.indexOf('/');
+        QHostAddress hostAddress{slash >= 0 ? subnet.left(slash) : subnet};
+        const int length = addressLength(family);
+
+        if(family == Nftables::Family::IPv4 &&
+           hostAddress.protocol() == QAbstractSocket::NetworkLayerProtocol::IPv4Protocol)
+        {
+            quint32 ipv4 = qToBigEndian(hostAddress.toIPv4Address());
+            address = QByteArray{reinterpret_cast<const char*>(&ipv4), sizeof(ipv4)};
+        }
+        else if(family == Nftables::Family::IPv6 &&
+                hostAddress.protocol() == QAbstractSocket::NetworkLayerProtocol::IPv6Protocol)
+        {
+            Q_IPV6ADDR ipv6 = hostAddress.toIPv6Address();
+            address = QByteArray{reinterpret_cast<const char*>(ipv6.c), sizeof(ipv6.c)};
+        }
+        else
+        {
+            qWarning() << "Address" << subnet << "is not valid for" << familyTrace(family);
+            throw Error{HERE, Error::Code::FirewallRuleFailed};
+        }
+
+        int prefix = length * 8;
+        if(slash >= 0)
+        {
+            bool prefixOk{false};
+            prefix = subnet.mid(slash+1).toInt(&prefixOk);
+            if(!prefixOk || prefix < 0 || prefix > length * 8)
+            {
+                qWarning() << "Prefix of subnet" << subnet << "is not valid for"
+                    << familyTrace(family);
+                throw Error{HERE, Error::Code::FirewallRuleFailed};
+            }
+        }
+
+        mask = prefixMask(length, prefix);
+        for(int i=0; i<length; ++i)
+            address[i] = static_cast<char>(address[i] & mask[i]);
+    }
+
+    QByteArray hostU32(std::uint32_t value)
+    {
+        return QByteArray{reinterpret_cast<const char*>(&value), sizeof(value)};
+    }
+
+    QByteArray hostU64(std::uint64_t value)
+    {
+        return QByteArray{reinterpret_cast<const char*>(&value), sizeof(value)};
+    }
+
+    QByteArray networkU16(std::uint16_t value)
+    {
+        value = qToBigEndian(value);
+        return QByteArray{reinterpret_cast<const char*>(&value), sizeof(value)};
+    }
+
+    Nftables::Match metaMatch(std::uint32_t key, QByteArray value, bool negate)
+    {
+        return {Nftables::Match::Source::Meta, key, 0, 0, {}, std::move(value), negate};
+    }
+
+    Nftables::Match portMatch(bool dest, std::uint16_t port, bool negate)
+    {
+        // Source and destination ports are at the same offsets in TCP and UDP
+        return {Nftables::Match::Source::Payload, NFT_PAYLOAD_TRANSPORT_HEADER,
+                dest ? 2u : 0u, 2, {}, networkU16(port), negate};
+    }
+
+    // Match a cgroup v2 path, like the iptables cgroup match's '--path'.  The
+    // socket's ancestor at the path's level is compared with the cgroup's ID
+    // (its inode number), so the cgroup must exist.
+    Nftables::Match cgroupPathMatch(const QString &path, bool negate)
+    {
+        const QStringList components = path.split('/', QString::SkipEmptyParts);
+        if(components.isEmpty())
+        {
+            qWarning() << "Cgroup path" << path << "is not valid";
+            throw Error{HERE, Error::Code::FirewallRuleFailed};
+        }
+
+        struct stat cgroupStat{};
+        const QString cgroupDir = cgroupV2Root + '/' + components.join('/');
+        if(::stat(QFile::encodeName(cgroupDir).constData(), &cgroupStat) != 0 ||
+           !S_ISDIR(cgroupStat.st_mode))
+        {
+            qWarning() << "Cgroup" << cgroupDir << "does not exist -" << ErrnoTracer{};
+            throw Error{HERE, Error::Code::FirewallRuleFailed};
+        }
+
+        return {Nftables::Match::Source::SocketCgroupV2,
+                static_cast<std::uint32_t>(components.size()), 0, 0, {},
+                hostU64(static_cast<std::uint64_t>(cgroupStat.st_ino)), negate};
+    }
+
+    Nftables::Match addressMatch(Nftables::Family family, bool dest,
+                                 const QString &subnet, bool negate)
+    {
+        QByteArray address, mask;
+        parseSubnet(family, subnet, address, mask);
+        // No need to mask if the whole address is compared
+        if(mask == QByteArray{mask.size(), static_cast<char>(0xFF)})
+            mask.clear();
+        return {Nftables::Match::Source::Payload, NFT_PAYLOAD_NETWORK_HEADER,
+                dest ? destAddressOffset(family) : sourceAddressOffset(family),
+                static_cast<std::uint32_t>(addressLength(family)),
+                std::move(mask), std::move(address), negate};
+    }
+
+    // Interface names are compared including the null padding, unless they
+    // end with '+' - a wildcard for any interface with that prefix
+    QByteArray interfaceName(const QString &name)
+    {
+        if(name.endsWith('+') && name.size() > 1)
+            return name.left(name.size()-1).toLocal8Bit();
+        QByteArray padded = name.toLocal8Bit();
+        if(padded.isEmpty() || padded.size() >= IFNAMSIZ)
+        {
+            qWarning() << "Interface name" << name << "is not valid";
+            throw Error{HERE, Error::Code::FirewallRuleFailed};
+        }
+        padded.append(QByteArray{IFNAMSIZ - padded.size(), '\0'});
+        return padded;
+    }
+
+    // Translate one iptables rule.  Several rules result if the rule uses
+    // multiport.  Each rule's key is the normalized rule text, with any
+    // destination address replaced by "@set".
+    std::vector<Nftables::Rule> parseRule(Nftables::Family family,
+                                          const QString &ruleText)
+    {
+        auto fail = [&](const char *pReason)
+        {
+            qWarning() << "Can't translate rule" << ruleText << "-" << pReason;
+            return Error{HERE, Error::Code::FirewallRuleFailed};
+        };
+        auto parseNumber = [&](const QString &value, std::uint32_t max)
+        {
+            bool numberOk{false};
+            // Base 0 permits the hex values used for marks and cgroup IDs
+            uint number = value.toUInt(&numberOk, 0);
+            if(!numberOk || number > max)
+                throw fail("invalid number");
+            return static_cast<std::uint32_t>(number);
+        };
+
+        const QStringList tokens = ruleText.split(' ', QString::SkipEmptyParts);
+        Nftables::Rule rule{};
+        rule.matchDestSet = false;
+        bool hasVerdict{false};
+        bool hasProtocol{false};
+        bool negate{false};
+        std::vector<std::uint16_t> multiportDests;
+        QStringList keyTokens;
+
+        for(int i=0; i<tokens.size(); ++i)
+        {
+            const QString &option = tokens[i];
+            keyTokens.push_back(option);
+            if(option == QLatin1String("!"))
+            {
+                if(negate)
+                    throw fail("repeated '!'");
+                negate = true;
+                continue;
+            }
+
+            // All other options have an argument
+            if(i+1 >= tokens.size())
+                throw fail("missing argument");
+            const QString &arg = tokens[++i];
+            const bool negateOption = negate;
+            negate = false;
+
+            if(option == QLatin1String("-m") || option == QLatin1String("--match"))
+            {
+                // The match options are handled below regardless of module,
+                // just make sure it's a module we understand
+                static const QStringList modules{QStringLiteral("udp"),
+                    QStringLiteral("tcp"), QStringLiteral("multiport"),
+                    QStringLiteral("owner"), QStringLiteral("mark"),
+                    QStringLiteral("cgroup")};
+                if(negateOption || !modules.contains(arg))
+                    throw fail("unsupported module");
+                keyTokens.push_back(arg);
+            }
+            else if(option == QLatin1String("-o") || option == QLatin1String("-i"))
+            {
+                rule.matches.push_back(metaMatch(option == QLatin1String("-o") ? NFT_META_OIFNAME : NFT_META_IIFNAME,
+                                                 interfaceName(arg), negateOption));
+                keyTokens.push_back(arg);
+            }
+            else if(option == QLatin1String("-p"))
+            {
+                std::uint8_t protocol{};
+                if(arg == QLatin1String("udp"))
+                    protocol = IPPROTO_UDP;
+                else if(arg == QLatin1String("tcp"))
+                    protocol = IPPROTO_TCP;
+                else
+                    throw fail("unsupported protocol");
+                rule.matches.push_back(metaMatch(NFT_META_L4PROTO,
+                                                 QByteArray(1, static_cast<char>(protocol)),
+                                                 negateOption));
+                hasProtocol = !negateOption;
+                keyTokens.push_back(arg);
+            }
+            else if(option == QLatin1String("--dport") || option == QLatin1String("--sport"))
+            {
+                if(!hasProtocol)
+                    throw fail("port requires a protocol");
+                rule.matches.push_back(portMatch(option == QLatin1String("--dport"),
+                                                 static_cast<std::uint16_t>(parseNumber(arg, 0xFFFF)),
+                                                 negateOption));
+                keyTokens.push_back(arg);
+            }
+            else if(option == QLatin1String("--dports"))
+            {
+                if(!hasProtocol || negateOption)
+                    throw fail("unsupported multiport match");
+                // The ports are added to the key for each expanded rule
+                for(const auto &port : arg.split(','))
+                    multiportDests.push_back(static_cast<std::uint16_t>(parseNumber(port, 0xFFFF)));
+                keyTokens.pop_back();
+            }
+            else if(option == QLatin1String("-d") && !negateOption)
+            {
+                rule.matchDestSet = true;
+                rule.destRanges.push_back(Nftables::subnetRange(family, arg));
+                keyTokens.push_back(QStringLiteral("@set"));
+            }
+            else if(option == QLatin1String("-d") || option == QLatin1String("-s"))
+            {
+                rule.matches.push_back(addressMatch(family, option == QLatin1String("-d"),
+                                                    arg, negateOption));
+                keyTokens.push_back(arg);
+            }
+            else if(option == QLatin1String("--gid-owner"))
+            {
+                const QByteArray groupName = arg.toLocal8Bit();
+                const group *pGroup = ::getgrnam(groupName.constData());
+                if(!pGroup)
+                    throw fail("unknown group");
+                rule.matches.push_back(metaMatch(NFT_META_SKGID, hostU32(pGroup->gr_gid),
+                                                 negateOption));
+                keyTokens.push_back(arg);
+            }
+            else if(option == QLatin1String("--mark"))
+            {
+                rule.matches.push_back(metaMatch(NFT_META_MARK,
+                                                 hostU32(parseNumber(arg, 0xFFFFFFFF)),
+                                                 negateOption));
+                keyTokens.push_back(arg);
+            }
+            else if(option == QLatin1String("--cgroup"))
+            {
+                // This is the net_cls class ID, like the iptables cgroup match
+                rule.matches.push_back(metaMatch(NFT_META_CGROUP,
+                                                 hostU32(parseNumber(arg, 0xFFFFFFFF)),
+                                                 negateOption));
+                keyTokens.push_back(arg);
+            }
+            else if(option == QLatin1String("--path"))
+            {
+                // A cgroup v2 path (used when split tunnel uses the unified
+                // hierarchy)
+                rule.matches.push_back(cgroupPathMatch(arg, negateOption));
+                // Include the cgroup ID, the rule has to be recreated if the
+                // cgroup is
+                keyTokens.push_back(arg + ':' + rule.matches.back().value.toHex());
+            }
+            else if(option == QLatin1String("-j") && !negateOption && !hasVerdict)
+            {
+                if(arg == QLatin1String("ACCEPT"))
+                    rule.verdict = Nftables::Verdict::Accept;
+                else if(arg == QLatin1String("DROP"))
+                    rule.verdict = Nftables::Verdict::Drop;
+                else if(arg == QLatin1String("REJECT"))
+                    rule.verdict = Nftables::Verdict::Reject;
+                else if(arg == QLatin1String("RETURN"))
+                    rule.verdict = Nftables::Verdict::Return;
+                else
+                    throw fail("unsupported target");
+                hasVerdict = true;
+                keyTokens.push_back(arg);
+            }
+            else
+                throw fail("unsupported option");
+        }
+
+        if(negate)
+            throw fail("'!' without an option");
+        if(!hasVerdict)
+            throw fail("no target");
+
+        const QString key = keyTokens.join(' ');
+        if(multiportDests.empty())
+        {
+            rule.key = key;
+            return {std::move(rule)};
+        }
+
+        std::vector<Nftables::Rule> expanded;
+        expanded.reserve(multiportDests.size());
+        for(auto port : multiportDests)
+        {
+            expanded.push_back(rule);
+            expanded.back().matches.push_back(portMatch(true, port, false));
+            expanded.back().key = QStringLiteral("%1 --dport %2").arg(key).arg(port);
+        }
+        return expanded;
+    }
+
+    // Builds netlink messages and attributes in a buffer
+    class NlBuffer
+    {
+    public:
+        QByteArray &data() {return _data;}
+
+        // Begin an attribute; returns the offset to pass to endAttr()
+        int beginAttr(std::uint16_t type)
+        {
+            int offset = _data.size();
+            nlattr header{};
+            header.nla_type = type;
+            append(&header, sizeof(header));
+            return offset;
+        }
+        int beginNested(std::uint16_t type) {return beginAttr(type | NLA_F_NESTED);}
+        // Fill in the length of an attribute after writing its content
+        void endAttr(int offset)
+        {
+            auto length = static_cast<std::uint16_t>(_data.size() - offset);
+            std::memcpy(_data.data() + offset + offsetof(nlattr, nla_len),
+                        &length, sizeof(length));
+            pad();
+        }
+
+        void putBinary(std::uint16_t type, const void *pValue, std::size_t size)
+        {
+            int attr = beginAttr(type);
+            append(pValue, size);
+            endAttr(attr);
+        }
+        void putBinary(std::uint16_t type, const QByteArray &value)
+        {
+            putBinary(type, value.constData(), static_cast<std::size_t>(value.size()));
+        }
+        // Strings include the null terminator
+        void putString(std::uint16_t type, const QString &value)
+        {
+            const QByteArray utf8 = value.toUtf8();
+            putBinary(type, utf8.constData(), static_cast<std::size_t>(utf8.size()) + 1);
+        }
+        void putString(std::uint16_t type, const char *pValue)
+        {
+            putBinary(type, pValue, std::strlen(pValue) + 1);
+        }
+        void putU8(std::uint16_t type, std::uint8_t value)
+        {
+            putBinary(type, &value, sizeof(value));
+        }
+        // Integer attributes are in network byte order
+        void putU32(std::uint16_t type, std::uint32_t value)
+        {
+            value = qToBigEndian(value);
+            putBinary(type, &value, sizeof(value));
+        }
+        // Put a data attribute containing a value (NFTA_DATA_VALUE)
+        void putDataValue(std::uint16_t type, const QByteArray &value)
+        {
+            int data = beginNested(type);
+            putBinary(NFTA_DATA_VALUE, value);
+            endAttr(data);
+        }
+
+        // Begin an nfnetlink message; returns the offset to pass to endMsg()
+        int beginMsg(std::uint16_t type, std::uint16_t flags, std::uint8_t family,
+                     std::uint32_t seq, std::uint16_t resId)
+        {
+            int offset = _data.size();
+            nlmsghdr header{};
+            header.nlmsg_type = type;
+            header.nlmsg_flags = static_cast<std::uint16_t>(NLM_F_REQUEST | flags);
+            header.nlmsg_seq = seq;
+            append(&header, sizeof(header));
+            nfgenmsg genHeader{};
+            genHeader.nfgen_family = family;
+            genHeader.version = NFNETLINK_V0;
+            genHeader.res_id = qToBigEndian(resId);
+            append(&genHeader, sizeof(genHeader));
+            return offset;
+        }
+        void endMsg(int offset)
+        {
+            auto length = static_cast<std::uint32_t>(_data.size() - offset);
+            std::memcpy(_data.data() + offset + offsetof(nlmsghdr, nlmsg_len),
+                        &length, sizeof(length));
+            pad();
+        }
+        void addMsgFlags(int offset, std::uint16_t flags)
+        {
+            char *pFlags = _data.data() + offset + offsetof(nlmsghdr, nlmsg_flags);
+            std::uint16_t msgFlags;
+            std::memcpy(&msgFlags, pFlags, sizeof(msgFlags));
+            msgFlags |= flags;
+            std::memcpy(pFlags, &msgFlags, sizeof(msgFlags));
+        }
+
+    private:
+        void append(const void *pData, std::size_t size)
+        {
+            _data.append(reinterpret_cast<const char*>(pData), static_cast<int>(size));
+        }
+        // NLMSG_ALIGNTO is the same as NLA_ALIGNTO
+        void pad()
+        {
+            while(_data.size() % NLA_ALIGNTO)
+                _data.append('\0');
+        }
+
+    private:
+        QByteArray _data;
+    };
+
+    // Write an expression to a rule's expression list.  writeData() writes
+    // the expression's attributes.
+    template<class WriteDataFunc>
+    void putExpr(NlBuffer &buf, const char *pName, WriteDataFunc writeData)
+    {
+        int elem = buf.beginNested(NFTA_LIST_ELEM);
+        buf.putString(NFTA_EXPR_NAME, pName);
+        int data = buf.beginNested(NFTA_EXPR_DATA);
+        writeData();
+        buf.endAttr(data);
+        buf.endAttr(elem);
+    }
+
+    void putPayloadLoad(NlBuffer &buf, std::uint32_t base, std::uint32_t offset,
+                        std::uint32_t length)
+    {
+        putExpr(buf, "payload", [&]
+        {
+            buf.putU32(NFTA_PAYLOAD_DREG, NFT_REG_1);
+            buf.putU32(NFTA_PAYLOAD_BASE, base);
+            buf.putU32(NFTA_PAYLOAD_OFFSET, offset);
+            buf.putU32(NFTA_PAYLOAD_LEN, length);
+        });
+    }
+
+    void putMatch(NlBuffer &buf, const Nftables::Match &match)
+    {
+        if(match.source == Nftables::Match::Source::Meta)
+        {
+            putExpr(buf, "meta", [&]
+            {
+                buf.putU32(NFTA_META_DREG, NFT_REG_1);
+                buf.putU32(NFTA_META_KEY, match.key);
+            });
+        }
+        else if(match.source == Nftables::Match::Source::SocketCgroupV2)
+        {
+            putExpr(buf, "socket", [&]
+            {
+                buf.putU32(NftaSocketKey, NftSocketCgroupV2);
+                buf.putU32(NftaSocketDreg, NFT_REG_1);
+                buf.putU32(NftaSocketLevel, match.key);
+            });
+        }
+        else
+            putPayloadLoad(buf, match.key, match.offset, match.length);
+
+        if(!match.mask.isEmpty())
+        {
+            putExpr(buf, "bitwise", [&]
+            {
+                buf.putU32(NFTA_BITWISE_SREG, NFT_REG_1);
+                buf.putU32(NFTA_BITWISE_DREG, NFT_REG_1);
+                buf.putU32(NFTA_BITWISE_LEN, static_cast<std::uint32_t>(match.mask.size()));
+                buf.putDataValue(NFTA_BITWISE_MASK, match.mask);
+                buf.putDataValue(NFTA_BITWISE_XOR, QByteArray{match.mask.size(), '\0'});
+            });
+        }
+
+        putExpr(buf, "cmp", [&]
+        {
+            buf.putU32(NFTA_CMP_SREG, NFT_REG_1);
+            buf.putU32(NFTA_CMP_OP, match.negate ? NFT_CMP_NEQ : NFT_CMP_EQ);
+            buf.putDataValue(NFTA_CMP_DATA, match.value);
+        });
+    }
+
+    void putImmediateVerdict(NlBuffer &buf, int code, const QString &chain)
+    {
+        putExpr(buf, "immediate", [&]
+        {
+            buf.putU32(NFTA_IMMEDIATE_DREG, NFT_REG_VERDICT);
+            int data = buf.beginNested(NFTA_IMMEDIATE_DATA);
+            int verdict = buf.beginNested(NFTA_DATA_VERDICT);
+            buf.putU32(NFTA_VERDICT_CODE, static_cast<std::uint32_t>(code));
+            if(!chain.isEmpty())
+                buf.putString(NFTA_VERDICT_CHAIN, chain);
+            buf.endAttr(verdict);
+            buf.endAttr(data);
+        });
+    }
+
+    void putJump(NlBuffer &buf, const QString &chain)
+    {
+        putImmediateVerdict(buf, NFT_JUMP, chain);
+    }
+
+    void putVerdict(NlBuffer &buf, Nftables::Family family, Nftables::Verdict verdict)
+    {
+        switch(verdict)
+        {
+            case Nftables::Verdict::Accept:
+                putImmediateVerdict(buf, NF_ACCEPT, {});
+                break;
+            case Nftables::Verdict::Drop:
+                putImmediateVerdict(buf, NF_DROP, {});
+                break;
+            case Nftables::Verdict::Return:
+                putImmediateVerdict(buf, NFT_RETURN, {});
+                break;
+            case Nftables::Verdict::Reject:
+                // Same as the default for the iptables REJECT target
+                putExpr(buf, "reject", [&]
+                {
+                    buf.putU32(NFTA_REJECT_TYPE, NFT_REJECT_ICMP_UNREACH);
+                    buf.putU8(NFTA_REJECT_ICMP_CODE, family == Nftables::Family::IPv6 ?
+                        ICMP6_DST_UNREACH_NOPORT : ICMP_PORT_UNREACH);
+                });
+                break;
+        }
+    }
+
+    // Write a translated rule; 'setName' and 'setId' identify the rule's
+    // destination set if it has one
+    void putRule(NlBuffer &buf, Nftables::Family family, const Nftables::Rule &rule,
+                 const QString &setName, std::uint32_t setId)
+    {
+        for(const auto &match : rule.matches)
+            putMatch(buf, match);
+        if(rule.matchDestSet)
+        {
+            putPayloadLoad(buf, NFT_PAYLOAD_NETWORK_HEADER, destAddressOffset(family),
+                           static_cast<std::uint32_t>(addressLength(family)));
+            putExpr(buf, "lookup", [&]
+            {
+                buf.putString(NFTA_LOOKUP_SET, setName);
+                buf.putU32(NFTA_LOOKUP_SREG, NFT_REG_1);
+                buf.putU32(NFTA_LOOKUP_SET_ID, setId);
+            });
+        }
+        putVerdict(buf, family, rule.verdict);
+    }
+
+    std::uint32_t hookNumber(const QString &hook)
+    {
+        if(hook == QLatin1String("INPUT"))
+            return NF_INET_LOCAL_IN;
+        if(hook == QLatin1String("FORWARD"))
+            return NF_INET_FORWARD;
+        Q_ASSERT(hook == QLatin1String("OUTPUT"));
+        return NF_INET_LOCAL_OUT;
+    }
+
+    QString anchorChain(const QString &anchor)
+    {
+        return QStringLiteral("a.") + anchor;
+    }
+
+    QString setName(const QString &anchor, std::uint32_t setId)
+    {
+        return QStringLiteral("%1.%2").arg(anchor).arg(setId);
+    }
+}
+
+namespace Nftables
+{
+    std::vector<Rule> translateRules(Family family, const QStringList &rules)
+    {
+        std::vector<Rule> result;
+        // The rule in 'result' that each key has been combined into, among the
+        // current run of rules with the same verdict
+        std::map<QString, std::size_t> runRules;
+
+        for(const auto &ruleText : rules)
+        {
+            for(auto &rule : parseRule(family, ruleText))
+            {
+                // Rules can't be reordered across a change in verdict
+                if(!result.empty() && result.back().verdict != rule.verdict)
+                    runRules.clear();
+
+                if(rule.matchDestSet)
+                {
+                    auto itRunRule = runRules.find(rule.key);
+                    if(itRunRule != runRules.end())
+                    {
+                        auto &destRanges = result[itRunRule->second].destRanges;
+                        destRanges.insert(destRanges.end(), rule.destRanges.begin(),
+                                          rule.destRanges.end());
+                        continue;
+                    }
+                    runRules.emplace(rule.key, result.size());
+                }
+                result.push_back(std::move(rule));
+            }
+        }
+
+        for(auto &rule : result)
+        {
+            if(rule.matchDestSet)
+                rule.destRanges = mergeRanges(std::move(rule.destRanges));
+        }
+        return result;
+    }
+
+    std::vector<AddressRange> mergeRanges(std::vector<AddressRange> ranges)
+    {
+        std::sort(ranges.begin(), ranges.end(),
+            [](const AddressRange &first, const AddressRange &second)
+            {
+                return addressLess(first.start, second.start);
+            });
+
+        std::vector<AddressRange> merged;
+        for(auto &range : ranges)
+        {
+            if(!merged.empty())
+            {
+                AddressRange &last = merged.back();
+                // Combine if the last range extends to the end of the address
+                // space, or if this range begins in it or right after it
+                if(last.end.isEmpty() || !addressLess(last.end, range.start))
+                {
+                    if(!last.end.isEmpty() &&
+                       (range.end.isEmpty() || addressLess(last.end, range.end)))
+                    {
+                        last.end = range.end;
+                    }
+                    continue;
+                }
+            }
+            merged.push_back(std::move(range));
+        }
+        return merged;
+    }
+
+    AddressRange subnetRange(Family family, const QString &subnet)
+    {
+        QByteArray address, mask;
+        parseSubnet(family, subnet, address, mask);
+
+        // Find the first address after the subnet - set all the host bits and
+        // add 1
+        QByteArray end = address;
+        for(int i=0; i<end.size(); ++i)
+            end[i] = static_cast<char>(end[i] | ~mask[i]);
+        int carry = end.size()-1;
+        for(; carry >= 0; --carry)
+        {
+            auto byte = static_cast<unsigned char>(end[carry]);
+            if(byte != 0xFF)
+            {
+                end[carry] = static_cast<char>(byte + 1);
+                break;
+            }
+            end[carry] = '\0';
+        }
+        // If the carry went past the first byte, the subnet extends to the end
+        // of the address space
+        if(carry < 0)
+            end.clear();
+
+        return {std::move(address), std::move(end)};
+    }
+
+    bool socketCgroupV2Supported()
+    {
+        static const bool supported = []
+        {
+            utsname kernelName{};
+            if(::uname(&kernelName) != 0)
+                return false;
+            // fromString() ignores suffixes like "-generic"
+            const auto &kernelVersion = QVersionNumber::fromString(QString::fromLatin1(kernelName.release));
+            return kernelVersion >= QVersionNumber{5, 13};
+        }();
+        return supported;
+    }
+}
+
+// A transaction containing nftables commands.  The commands are applied
+// atomically when the batch is committed.
+class NftablesFirewall::Batch
+{
+public:
+    Batch()
+        : _seq{static_cast<std::uint32_t>(std::time(nullptr))}, _lastCmd{-1}
+    {
+        int begin = _buf.beginMsg(NFNL_MSG_BATCH_BEGIN, 0, AF_UNSPEC, _seq++,
+                                  NFNL_SUBSYS_NFTABLES);
+        _buf.endMsg(begin);
+    }
+
+private:
+    int beginCmd(std::uint16_t type, std::uint16_t flags, Nftables::Family family)
+    {
+        _lastCmd = _buf.beginMsg(static_cast<std::uint16_t>((NFNL_SUBSYS_NFTABLES << 8) | type),
+                                 flags, static_cast<std::uint8_t>(family), _seq++, 0);
+        return _lastCmd;
+    }
+
+public:
+    void newTable(Nftables::Family family, const QString &table)
+    {
+        int msg = beginCmd(NFT_MSG_NEWTABLE, NLM_F_CREATE, family);
+        _buf.putString(NFTA_TABLE_NAME, table);
+        _buf.endMsg(msg);
+    }
+
+    void delTable(Nftables::Family family, const QString &table)
+    {
+        int msg = beginCmd(NFT_MSG_DELTABLE, 0, family);
+        _buf.putString(NFTA_TABLE_NAME, table);
+        _buf.endMsg(msg);
+    }
+
+    // Create a base chain attached to a hook.  It runs just before the
+    // iptables filter table (see Nftables::BaseChainPriority) and accepts by
+    // default.
+    void newBaseChain(Nftables::Family family, const QString &table,
+                      const QString &chain, std::uint32_t hookNum)
+    {
+        int msg = beginCmd(NFT_MSG_NEWCHAIN, NLM_F_CREATE, family);
+        _buf.putString(NFTA_CHAIN_TABLE, table);
+        _buf.putString(NFTA_CHAIN_NAME, chain);
+        int hook = _buf.beginNested(NFTA_CHAIN_HOOK);
+        _buf.putU32(NFTA_HOOK_HOOKNUM, hookNum);
+        _buf.putU32(NFTA_HOOK_PRIORITY,
+                    static_cast<std::uint32_t>(Nftables::BaseChainPriority));
+        _buf.endAttr(hook);
+        _buf.putU32(NFTA_CHAIN_POLICY, NF_ACCEPT);
+        _buf.putString(NFTA_CHAIN_TYPE, "filter");
+        _buf.endMsg(msg);
+    }
+
+    void newChain(Nftables::Family family, const QString &table, const QString &chain)
+    {
+        int msg = beginCmd(NFT_MSG_NEWCHAIN, NLM_F_CREATE, family);
+        _buf.putString(NFTA_CHAIN_TABLE, table);
+        _buf.putString(NFTA_CHAIN_NAME, chain);
+        _buf.endMsg(msg);
+    }
+
+    // Delete all rules in a chain
+    void flushChain(Nftables::Family family, const QString &table, const QString &chain)
+    {
+        int msg = beginCmd(NFT_MSG_DELRULE, 0, family);
+        _buf.putString(NFTA_RULE_TABLE, table);
+        _buf.putString(NFTA_RULE_CHAIN, chain);
+        _buf.endMsg(msg);
+    }
+
+    // Append a rule to a chain; writeExprs() writes the rule's expressions
+    template<class WriteExprsFunc>
+    void newRule(Nftables::Family family, const QString &table,
+                 const QString &chain, WriteExprsFunc writeExprs)
+    {
+        int msg = beginCmd(NFT_MSG_NEWRULE, NLM_F_CREATE | NLM_F_APPEND, family);
+        _buf.putString(NFTA_RULE_TABLE, table);
+        _buf.putString(NFTA_RULE_CHAIN, chain);
+        int exprs = _buf.beginNested(NFTA_RULE_EXPRESSIONS);
+        writeExprs(_buf);
+        _buf.endAttr(exprs);
+        _buf.endMsg(msg);
+    }
+
+    // Create an interval set of addresses
+    void newSet(Nftables::Family family, const QString &table, const QString &set,
+                std::uint32_t setId)
+    {
+        int msg = beginCmd(NFT_MSG_NEWSET, NLM_F_CREATE, family);
+        _buf.putString(NFTA_SET_TABLE, table);
+        _buf.putString(NFTA_SET_NAME, set);
+        _buf.putU32(NFTA_SET_FLAGS, NFT_SET_INTERVAL);
+        _buf.putU32(NFTA_SET_KEY_TYPE, family == Nftables::Family::IPv6 ?
+            NftTypeIpv6Addr : NftTypeIpv4Addr);
+        _buf.putU32(NFTA_SET_KEY_LEN, static_cast<std::uint32_t>(addressLength(family)));
+        _buf.putU32(NFTA_SET_ID, setId);
+        _buf.endMsg(msg);
+    }
+
+    void delSet(Nftables::Family family, const QString &table, const QString &set)
+    {
+        int msg = beginCmd(NFT_MSG_DELSET, 0, family);
+        _buf.putString(NFTA_SET_TABLE, table);
+        _buf.putString(NFTA_SET_NAME, set);
+        _buf.endMsg(msg);
+    }
+
+    // Add or delete set elements (NFT_MSG_NEWSETELEM or NFT_MSG_DELSETELEM).
+    // Each range is an element for its start, and an interval end element
+    // unless it extends to the end of the address space.
+    void setElements(std::uint16_t type, Nftables::Family family, const QString &table,
+                     const QString &set, std::uint32_t setId,
+                     const std::vector<Nftables::AddressRange> &ranges)
+    {
+        if(ranges.empty())
+            return;
+
+        int msg = beginCmd(type, type == NFT_MSG_NEWSETELEM ? NLM_F_CREATE : 0, family);
+        _buf.putString(NFTA_SET_ELEM_LIST_TABLE, table);
+        _buf.putString(NFTA_SET_ELEM_LIST_SET, set);
+        _buf.putU32(NFTA_SET_ELEM_LIST_SET_ID, setId);
+        int elems = _buf.beginNested(NFTA_SET_ELEM_LIST_ELEMENTS);
+        auto putElement = [this](const QByteArray &key, std::uint32_t flags)
+        {
+            int elem = _buf.beginNested(NFTA_LIST_ELEM);
+            _buf.putDataValue(NFTA_SET_ELEM_KEY, key);
+            if(flags)
+                _buf.putU32(NFTA_SET_ELEM_FLAGS, flags);
+            _buf.endAttr(elem);
+        };
+        for(const auto &range : ranges)
+        {
+            putElement(range.start, 0);
+            if(!range.end.isEmpty())
+                putElement(range.end, NFT_SET_ELEM_INTERVAL_END);
+        }
+        _buf.endAttr(elems);
+        _buf.endMsg(msg);
+    }
+
+    // Send the batch and wait for the result.  Throws if the transaction
+    // fails; in that case none of the commands were applied.
+    void commit()
+    {
+        if(_lastCmd < 0)
+            return; // Nothing to do
+
+        // Errors are always reported.  Request an ack for the last command so
+        // we know when the whole batch has succeeded.
+        _buf.addMsgFlags(_lastCmd, NLM_F_ACK);
+        int end = _buf.beginMsg(NFNL_MSG_BATCH_END, 0, AF_UNSPEC, _seq++,
+                                NFNL_SUBSYS_NFTABLES);
+        _buf.endMsg(end);
+
+        LinuxNlReqSock reqSock{NETLINK_NETFILTER};
+        // Sequence numbers were already assigned to each message
+        libnl::nl_socket_disable_seq_check(reqSock.get());
+        int result = libnl::nl_sendto(reqSock.get(), _buf.data().data(),
+                                      static_cast<std::size_t>(_buf.data().size()));
+        LibnlError::checkRet(result, HERE, "Unable to send nftables transaction");
+        // Returns the first error reported for the batch, if any
+        result = libnl::nl_wait_for_ack(reqSock.get());
+        LibnlError::checkRet(result, HERE, "nftables transaction failed");
+    }
+
+private:
+    NlBuffer _buf;
+    std::uint32_t _seq;
+    // Offset of the last command message, -1 if there are no commands
+    int _lastCmd;
+};
+
+std::vector<Nftables::Rule> NftablesFirewall::translateAnchorRules(Nftables::Family family,
+                                                                  const QString &anchor,
+                                                                  const QStringList &rules)
+{
+    try
+    {
+        return Nftables::translateRules(family, rules);
+    }
+    catch(const Error &)
+    {
+        qCritical() << "Rules for anchor" << anchor << familyTrace(family)
+            << "can't be translated to nftables";
+        throw;
+    }
+}
+
+NftablesFirewall::NftablesFirewall(QString tableName)
+    : _tableName{std::move(tableName)}, _nextSetId{1}
+{
+}
+
+void NftablesFirewall::install(const std::vector<AnchorDef> &anchors)
+{
+    Batch batch;
+    for(auto family : {Nftables::Family::IPv4, Nftables::Family::IPv6})
+    {
+        // Adding the table first ensures that deleting it succeeds if it
+        // doesn't exist, then it's recreated empty
+        batch.newTable(family, _tableName);
+        batch.delTable(family, _tableName);
+        batch.newTable(family, _tableName);
+    }
+
+    std::map<AnchorKey, AnchorRules> installed;
+    std::set<std::pair<Nftables::Family, QString>> baseChains;
+    for(const auto &def : anchors)
+    {
+        if(baseChains.insert({def.family, def.hook}).second)
+        {
+            batch.newBaseChain(def.family, _tableName, def.hook,
+                               hookNumber(def.hook));
+        }
+        batch.newChain(def.family, _tableName, anchorChain(def.anchor));
+        batch.newChain(def.family, _tableName, def.anchor);
+        installed[{def.family, def.anchor}] = addRules(batch, def.family, def.anchor,
+            translateAnchorRules(def.family, def.anchor, def.rules));
+        batch.newRule(def.family, _tableName, def.hook, [&](NlBuffer &buf)
+        {
+            putJump(buf, anchorChain(def.anchor));
+        });
+    }
+
+    batch.commit();
+    _anchors = std::move(installed);
+    qInfo() << "Installed" << anchors.size() << "anchors in table" << _tableName;
+}
+
+void NftablesFirewall::uninstall()
+{
+    Batch batch;
+    for(auto family : {Nftables::Family::IPv4, Nftables::Family::IPv6})
+    {
+        batch.newTable(family, _tableName);
+        batch.delTable(family, _tableName);
+    }
+
+    try
+    {
+        batch.commit();
+    }
+    catch(const std::exception &ex)
+    {
+        qWarning() << "Unable to delete table" << _tableName << "-" << ex.what();
+    }
+    _anchors.clear();
+}
+
+void NftablesFirewall::commit(const std::vector<AnchorChange> &changes)
+{
+    Batch batch;
+    // Rules applied to anchors; stored only if the transaction succeeds
+    std::map<AnchorKey, AnchorRules> replaced;
+
+    for(const auto &change : changes)
+    {
+        AnchorKey key{change.family, change.anchor};
+        auto itAnchor = _anchors.find(key);
+        if(itAnchor == _anchors.end())
+        {
+            qWarning() << "Anchor" << change.anchor << familyTrace(change.family)
+                << "is not installed";
+            throw Error{HERE, Error::Code::FirewallRuleFailed};
+        }
+
+        if(change.rules)
+        {
+            replaced[key] = replaceRules(batch, change.family, change.anchor,
+                itAnchor->second,
+                translateAnchorRules(change.family, change.anchor, change.rules.get()));
+        }
+        if(change.enabled)
+        {
+            batch.flushChain(change.family, _tableName, anchorChain(change.anchor));
+            if(change.enabled.get())
+            {
+                batch.newRule(change.family, _tableName, anchorChain(change.anchor),
+                    [&](NlBuffer &buf){putJump(buf, change.anchor);});
+            }
+        }
+    }
+
+    batch.commit();
+    for(auto &anchorRules : replaced)
+        _anchors[anchorRules.first] = std::move(anchorRules.second);
+}
+
+auto NftablesFirewall::addRules(Batch &batch, Nftables::Family family,
+                                const QString &anchor,
+                                std::vector<Nftables::Rule> rules)
+    -> AnchorRules
+{
+    AnchorRules added;
+    added.setIds.reserve(rules.size());
+    for(const auto &rule : rules)
+    {
+        std::uint32_t setId{0};
+        if(rule.matchDestSet)
+        {
+            setId = _nextSetId++;
+            batch.newSet(family, _tableName, setName(anchor, setId), setId);
+            batch.setElements(NFT_MSG_NEWSETELEM, family, _tableName,
+                              setName(anchor, setId), setId, rule.destRanges);
+        }
+        batch.newRule(family, _tableName, anchor, [&](NlBuffer &buf)
+        {
+            putRule(buf, family, rule, setName(anchor, setId), setId);
+        });
+        added.setIds.push_back(setId);
+    }
+    added.rules = std::move(rules);
+    return added;
+}
+
+auto NftablesFirewall::replaceRules(Batch &batch, Nftables::Family family,
+                                    const QString &anchor,
+                                    const AnchorRules &oldRules,
+                                    std::vector<Nftables::Rule> rules)
+    -> AnchorRules
+{
+    bool sameKeys = rules.size() == oldRules.rules.size() &&
+        std::equal(rules.begin(), rules.end(), oldRules.rules.begin(),
+            [](const Nftables::Rule &first, const Nftables::Rule &second)
+            {
+                return first.key == second.key;
+            });
+
+    if(!sameKeys)
+    {
+        // Replace the whole chain and its sets
+        batch.flushChain(family, _tableName, anchor);
+        for(auto setId : oldRules.setIds)
+        {
+            if(setId)
+                batch.delSet(family, _tableName, setName(anchor, setId));
+        }
+        return addRules(batch, family, anchor, std::move(rules));
+    }
+
+    // The rules are the same apart from their sets, so just update the set
+    // elements
+    auto missingFrom = [](const std::vector<Nftables::AddressRange> &ranges,
+                          const std::vector<Nftables::AddressRange> &other)
+    {
+        std::vector<Nftables::AddressRange> missing;
+        for(const auto &range : ranges)
+        {
+            if(std::find(other.begin(), other.end(), range) == other.end())
+                missing.push_back(range);
+        }
+        return missing;
+    };
+    for(std::size_t i=0; i<rules.size(); ++i)
+    {
+        std::uint32_t setId = oldRules.setIds[i];
+        if(!setId)
+            continue;
+        const auto &oldRanges = oldRules.rules[i].destRanges;
+        const auto &newRanges = rules[i].destRanges;
+        batch.setElements(NFT_MSG_DELSETELEM, family, _tableName, setName(anchor, setId),
+                          setId, missingFrom(oldRanges, newRanges));
+        batch.setElements(NFT_MSG_NEWSETELEM, family, _tableName, setName(anchor, setId),
+                          setId, missingFrom(newRanges, oldRanges));
+    }
+    return {std::move(rules), oldRules.setIds};
+}
@@ -0,0 +1,244 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("linux_nftables.h")
+
+#ifndef LINUX_NFTABLES_H
+#define LINUX_NFTABLES_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <linux/netfilter.h>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// nftables backend for the Linux filter anchors.
+//
+// IpTablesFirewall can apply its filter table anchors with nftables instead of
+// iptables.  The anchor model is the same - each anchor's rules are in a chain
+// that is linked from a fixed anchor chain to enable it - but all changes are
+// applied in one netlink transaction, without starting any processes.
+//
+// Anchor rules are still written in the iptables syntax used by
+// IpTablesFirewall; the subset of that syntax used by the filter anchors is
+// translated to nftables expressions.  Rules that differ only by destination
+// address (bypass subnets, LAN ranges, DNS servers) are combined into one rule
+// that matches a set, so changing those addresses just updates set elements.
+namespace Nftables
+{
+    // Netfilter family of a table.  One table is created for each family, like
+    // iptables and ip6tables.
+    enum class Family : std::uint8_t
+    {
+        IPv4 = NFPROTO_IPV4,
+        IPv6 = NFPROTO_IPV6,
+    };
+
+    // A range of addresses in a set - the first address in the range and the
+    // first address after it (in network byte order).  'end' is empty if the
+    // range extends to the end of the address space.
+    struct AddressRange
+    {
+        QByteArray start;
+        QByteArray end;
+
+        bool operator==(const AddressRange &other) const
+        {
+            return start == other.start && end == other.end;
+        }
+        bool operator!=(const AddressRange &other) const {return !(*this == other);}
+    };
+
+    // A match translated from an iptables rule - load a value into a register,
+    // optionally mask it, and compare it.
+    struct Match
+    {
+        enum class Source
+        {
+            Meta,       // 'key' is an nft_meta_keys value
+            Payload,    // 'key' is an nft_payload_bases value
+            // The socket's cgroup v2 ancestor at level 'key', compared by ID
+            SocketCgroupV2,
+        };
+
+        Source source;
+        std::uint32_t key;
+        // Payload offset and length (unused for Meta and SocketCgroupV2)
+        std::uint32_t offset;
+        std::uint32_t length;
+        // Mask applied before comparing, empty if the whole value is compared
+        QByteArray mask;
+        // Value compared - may be shorter than the loaded value to compare a
+        // prefix (used for interface wildcards)
+        QByteArray value;
+        bool negate;
+    };
+
+    // Priority of the base chains.  This is just ahead of the iptables filter
+    // tables (NF_IP_PRI_FILTER and NF_IP6_PRI_FILTER are 0), so the anchors see
+    // packets before any host filter rules, like the iptables anchors that are
+    // inserted first in the built-in chains.  It's still after NAT, so the
+    // anchors see translated addresses as the filter table does.
+    const std::int32_t BaseChainPriority = -1;
+
+    enum class Verdict
+    {
+        Accept,
+        Drop,
+        Reject,
+        Return,
+    };
+
+    // A rule translated from one or more iptables rules.
+    struct Rule
+    {
+        // Identifies the rule's matches and verdict, apart from the contents of
+        // its destination set.  Rules with the same key can be updated by just
+        // changing the set elements.
+        QString key;
+        std::vector<Match> matches;
+        // Whether the rule matches the destination address in a set, and the
+        // ranges in that set
+        bool matchDestSet;
+        std::vector<AddressRange> destRanges;
+        Verdict verdict;
+    };
+
+    // Translate the rules of an anchor from iptables syntax.  Consecutive rules
+    // with the same verdict can be applied in any order, so among those, rules
+    // that differ only by a destination address are combined into one rule
+    // with a destination set.  Rules using multiport are expanded.
+    //
+    // Throws if any rule can't be translated.
+    std::vector<Rule> translateRules(Family family, const QStringList &rules);
+
+    // Sort and merge address ranges (ranges that overlap or are adjacent are
+    // combined, as required by interval sets).
+    std::vector<AddressRange> mergeRanges(std::vector<AddressRange> ranges);
+
+    // Get the range of addresses covered by a subnet ("addr" or "addr/prefix").
+    // Throws if the subnet is not valid for the family.
+    AddressRange subnetRange(Family family, const QString &subnet);
+
+    // Whether the kernel can match a socket's cgroup v2 ancestor, which is
+    // needed for '--path' rules.  The socket expression's cgroupv2 key was
+    // added in Linux 5.13.
+    bool socketCgroupV2Supported();
+}
+
+// Applies filter anchors using nftables.  This creates one table for each
+// family with a base chain for each hook used by the anchors.  Each anchor
+// has an anchor chain ("a.<anchor>") jumped to from the base chain, and a rule
+// chain ("<anchor>") that the anchor chain jumps to if it's enabled.
+//
+// The base chains accept by default; like the iptables anchors, a packet is
+// blocked only if some enabled anchor rejects it.
+//
+// There is one difference from the iptables anchors that can't be reproduced:
+// an ACCEPT in an nftables base chain only ends that chain.  The packet still
+// goes through every other base chain on the hook, including the host's own
+// iptables filter rules, and a DROP there still applies.  With iptables, an
+// ACCEPT in the anchors ends the filter table, so host rules after the
+// anchors are skipped.  So with nftables, traffic allowed by the anchors (LAN,
+// VPN, bypass apps, etc.) can still be blocked by a host firewall.  Traffic
+// blocked by the anchors is blocked either way, since BaseChainPriority runs
+// the anchors first and a DROP or REJECT is final.
+class NftablesFirewall
+{
+    CLASS_LOGGING_CATEGORY("nftables")
+
+public:
+    // An anchor to install - the built-in chain the anchor is linked into
+    // ("OUTPUT", "INPUT", or "FORWARD") and the rules it initially contains.
+    // Anchors are linked in the order given.
+    struct AnchorDef
+    {
+        Nftables::Family family;
+        QString hook;
+        QString anchor;
+        QStringList rules;
+    };
+
+    // Changes to apply to an anchor; either part can be unspecified.
+    struct AnchorChange
+    {
+        Nftables::Family family;
+        QString anchor;
+        Optional<bool> enabled;
+        Optional<QStringList> rules;
+    };
+
+public:
+    explicit NftablesFirewall(QString tableName);
+
+public:
+    // Create the tables with the given anchors, all disabled.  Any existing
+    // tables with the same name are replaced.  Throws if the tables can't be
+    // created.
+    void install(const std::vector<AnchorDef> &anchors);
+
+    // Delete the tables.  Failures are traced; there's nothing else we could
+    // do about them.
+    void uninstall();
+
+    // Apply changes to anchors in one transaction.  Throws if the changes
+    // can't be applied; nothing is changed in that case.
+    void commit(const std::vector<AnchorChange> &changes);
+
+private:
+    using AnchorKey = std::pair<Nftables::Family, QString>;
+
+    // The rules applied to an anchor and the ID of the set used by each rule
+    // (0 for rules without a set)
+    struct AnchorRules
+    {
+        std::vector<Nftables::Rule> rules;
+        std::vector<std::uint32_t> setIds;
+    };
+
+    class Batch;
+
+    // Translate an anchor's rules.  The anchor rules come from
+    // IpTablesFirewall, so a rule that can't be translated is a bug (each
+    // rule is checked by tst_nftables); this is traced as critical before
+    // rethrowing, the caller then reverts to iptables.
+    static std::vector<Nftables::Rule> translateAnchorRules(Nftables::Family family,
+                                                            const QString &anchor,
+                                                            const QStringList &rules);
+    // Add an anchor's rules (and their sets) to the rule chain
+    AnchorRules addRules(Batch &batch, Nftables::Family family,
+                         const QString &anchor,
+                         std::vector<Nftables::Rule> rules);
+    // Replace an anchor's rules.  If the rules have the same keys as the
+    // existing rules, only set elements are updated.
+    AnchorRules replaceRules(Batch &batch, Nftables::Family family,
+                             const QString &anchor, const AnchorRules &oldRules,
+                             std::vector<Nftables::Rule> rules);
+
+private:
+    QString _tableName;
+    std::map<AnchorKey, AnchorRules> _anchors;
+    // Sets are given unique names and IDs so a new set never conflicts with a
+    // set deleted in the same transaction
+    std::uint32_t _nextSetId;
+};
+
+#endif
@@ -17,11 +17,76 @@
 // <https://www.gnu.org/licenses/>.
 
 #include "linux_proc_fs.h"
+#include <QFile>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    // Read the exe link of a process.  'pidDir' is relative to dirFd.  Returns
+    // an empty string if the link can't be read (the process has exited, it's
+    // a kernel thread, etc.)
+    QString readExeLink(int dirFd, const char *pidDir)
+    {
+        char linkPath[64];
+        if(std::snprintf(linkPath, sizeof(linkPath), "%s/exe", pidDir) >= static_cast<int>(sizeof(linkPath)))
+            return {};
+
+        char target[PATH_MAX];
+        auto len = ::readlinkat(dirFd, linkPath, target, sizeof(target));
+        if(len <= 0 || static_cast<std::size_t>(len) >= sizeof(target))
+            return {};
+        return QString::fromLocal8Bit(target, static_cast<int>(len));
+    }
+
+    bool isPidName(const char *name)
+    {
+        // PIDs are nonzero and have no leading zeros
+        if(*name < '1' || *name > '9')
+            return false;
+        for(++name; *name; ++name)
+        {
+            if(*name < '0' || *name > '9')
+                return false;
+        }
+        return true;
+    }
+}
+
 QSet<pid_t> ProcFs::pidsForPath(const QString &path)
 {
     return filterPids([&](pid_t pid) { return pathForPid(pid) == path; });
 }
 
+auto ProcFs::indexPidsByPath(const QString &procDir) -> ExePidIndex
+{
+    ExePidIndex index;
+
+    DIR *pDir = ::opendir(QFile::encodeName(procDir).constData());
+    if(!pDir)
+    {
+        qWarning() << "Unable to open" << procDir << "- error" << errno;
+        return index;
+    }
+
+    int dirFd = ::dirfd(pDir);
+    while(const dirent *pEntry = ::readdir(pDir))
+    {
+        if(!isPidName(pEntry->d_name))
+            continue;
+        QString exePath = readExeLink(dirFd, pEntry->d_name);
+        if(!exePath.isEmpty())
+            index[exePath].push_back(static_cast<pid_t>(std::atoi(pEntry->d_name)));
+    }
+
+    ::closedir(pDir);
+    return index;
+}
+
 QSet<pid_t> ProcFs::childPidsOf(pid_t parentPid)
 {
     return filterPids([&](pid_t pid) { return isChildOf(parentPid, pid); });
@@ -29,24 +94,29 @@ QSet<pid_t> ProcFs::childPidsOf(pid_t parentPid)
 
 QString ProcFs::pathForPid(pid_t pid)
 {
-    QString link = QStringLiteral("%1/%2/exe").arg(kProcDirName).arg(pid);
-    return QFile::symLinkTarget(link);
+    // Read the link the same way as indexPidsByPath(), so paths from either
+    // one can be compared
+    QByteArray pidDir = QFile::encodeName(kProcDirName) + '/' + QByteArray::number(pid);
+    return readExeLink(AT_FDCWD, pidDir.constData());
 }
 
 bool ProcFs::isChildOf(pid_t parentPid, pid_t pid)
+{
+    pid_t foundParentPid = parentPidOf(pid);
+    return foundParentPid != 0 && foundParentPid == parentPid;
+}
+
+pid_t ProcFs::parentPidOf(pid_t pid)
 {
     static const QRegularExpression parentPidRegex{QStringLiteral("PPid:\\s+([0-9]+)")};
 
     QFile statusFile{QStringLiteral("%1/%2/status").arg(kProcDirName).arg(pid)};
     if(!statusFile.open(QIODevice::ReadOnly | QIODevice::Text))
-        return false;
+        return 0;
 
     auto match = parentPidRegex.match(statusFile.readAll());
     if(match.hasMatch())
-    {
-        auto foundParentPid = match.captured(1).toInt();
-        return foundParentPid == parentPid;
-    }
+        return match.captured(1).toInt();
 
-    return false;
+    return 0;
 }
@@ -20,6 +20,8 @@
 #include "common.h"
 #include <QSet>
 #include <QDir>
+#include <unordered_map>
+#include <vector>
 
 #ifndef PROC_FS_H
 #define PROC_FS_H
@@ -28,9 +30,19 @@ namespace ProcFs
 {
     const QString kProcDirName{"/proc"};
 
+    // Map of executable paths to the PIDs running them
+    using ExePidIndex = std::unordered_map<QString, std::vector<pid_t>>;
+
     // Return all pids for the given executable path
     QSet<pid_t> pidsForPath(const QString &path);
 
+    // Index all processes by executable path with a single pass over /proc.
+    // Each process's exe link is read once, so this is O(processes) no matter
+    // how many paths are looked up in the result (pidsForPath() is
+    // O(processes) for each path).  The /proc directory can be given for
+    // tests.
+    ExePidIndex indexPidsByPath(const QString &procDir = kProcDirName);
+
     // Return all (immediate) children pids of parentPid
     QSet<pid_t> childPidsOf(pid_t parentPid);
 
@@ -43,6 +55,9 @@ namespace ProcFs
     // Is pid a child of parentPid ?
     bool isChildOf(pid_t parentPid, pid_t pid);
 
+    // Get the parent of pid; 0 if it can't be read (the process has exited)
+    pid_t parentPidOf(pid_t pid);
+
     template <typename Func_T>
     QSet<pid_t> filterPids(Func_T filterFunc)
     {
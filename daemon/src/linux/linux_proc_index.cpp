@@ -0,0 +1,109 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("linux/linux_proc_index.cpp")
+
+#include "linux_proc_index.h"
+
+void ProcAppIndex::addApp(const QString &app, Group group)
+{
+    _apps.emplace(app, AppData{group, {}});
+}
+
+std::vector<pid_t> ProcAppIndex::removeApp(const QString &app)
+{
+    auto itApp = _apps.find(app);
+    if(itApp == _apps.end())
+        return {};
+
+    std::vector<pid_t> pids{itApp->second.pids.begin(), itApp->second.pids.end()};
+    for(pid_t pid : pids)
+        _pidApps.erase(pid);
+    _apps.erase(itApp);
+    return pids;
+}
+
+void ProcAppIndex::clear()
+{
+    _apps.clear();
+    _pidApps.clear();
+}
+
+auto ProcAppIndex::appGroup(const QString &app) const -> const Group *
+{
+    auto itApp = _apps.find(app);
+    if(itApp == _apps.end())
+        return nullptr;
+    return &itApp->second.group;
+}
+
+std::vector<QString> ProcAppIndex::appsInGroup(Group group) const
+{
+    std::vector<QString> apps;
+    for(const auto &app : _apps)
+    {
+        if(app.second.group == group)
+            apps.push_back(app.first);
+    }
+    return apps;
+}
+
+bool ProcAppIndex::addPid(pid_t pid, const QString &app)
+{
+    auto itApp = _apps.find(app);
+    if(itApp == _apps.end())
+        return false;
+
+    auto itPidApp = _pidApps.find(pid);
+    if(itPidApp != _pidApps.end())
+    {
+        if(itPidApp->second == app)
+            return true;    // Already tracked for this app
+        // Tracked for another app - move it
+        auto itOldApp = _apps.find(itPidApp->second);
+        if(itOldApp != _apps.end())
+            itOldApp->second.pids.erase(pid);
+        itPidApp->second = app;
+    }
+    else
+        _pidApps.emplace(pid, app);
+
+    itApp->second.pids.insert(pid);
+    return true;
+}
+
+void ProcAppIndex::removePid(pid_t pid)
+{
+    auto itPidApp = _pidApps.find(pid);
+    if(itPidApp == _pidApps.end())
+        return;
+
+    auto itApp = _apps.find(itPidApp->second);
+    if(itApp != _apps.end())
+        itApp->second.pids.erase(pid);
+    _pidApps.erase(itPidApp);
+}
+
+QString ProcAppIndex::appForPid(pid_t pid) const
+{
+    auto itPidApp = _pidApps.find(pid);
+    if(itPidApp == _pidApps.end())
+        return {};
+    return itPidApp->second;
+}
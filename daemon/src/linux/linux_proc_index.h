@@ -0,0 +1,85 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("linux/linux_proc_index.h")
+
+#ifndef LINUX_PROC_INDEX_H
+#define LINUX_PROC_INDEX_H
+
+#include <QString>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <sys/types.h>
+
+// ProcAppIndex tracks the running PIDs of the apps configured for split
+// tunnel.  Each app belongs to one group (the cgroup its processes are placed
+// in).
+//
+// PIDs are added when apps are configured (from a single-pass index of /proc -
+// ProcFs::indexPidsByPath()) and as processes are launched, and removed as
+// processes exit.  A reverse PID->app map makes each process event O(1),
+// rather than searching every app's PIDs.
+class ProcAppIndex
+{
+public:
+    enum class Group
+    {
+        Exclusions,
+        VpnOnly,
+    };
+
+private:
+    struct AppData
+    {
+        Group group;
+        std::unordered_set<pid_t> pids;
+    };
+
+public:
+    // Add an app to a group.  If the app is already tracked, this has no
+    // effect.
+    void addApp(const QString &app, Group group);
+    // Remove an app, returns the PIDs that were tracked for it.
+    std::vector<pid_t> removeApp(const QString &app);
+    void clear();
+
+    // Get the group of an app, or nullptr if the app isn't tracked.
+    const Group *appGroup(const QString &app) const;
+    bool empty() const {return _apps.empty();}
+    // Get all apps in a group.
+    std::vector<QString> appsInGroup(Group group) const;
+
+    // Add a PID for an app; returns false if the app isn't tracked.  If the
+    // PID was tracked for another app (the process exec'd another
+    // executable), it's moved to this app.
+    bool addPid(pid_t pid, const QString &app);
+    // Remove a PID that has exited.  Has no effect if the PID isn't tracked.
+    void removePid(pid_t pid);
+
+    // Get the app tracking a PID, or an empty string if it isn't tracked.
+    QString appForPid(pid_t pid) const;
+    std::size_t pidCount() const {return _pidApps.size();}
+
+private:
+    std::unordered_map<QString, AppData> _apps;
+    std::unordered_map<pid_t, QString> _pidApps;
+};
+
+#endif
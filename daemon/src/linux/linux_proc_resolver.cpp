@@ -0,0 +1,118 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("linux/linux_proc_resolver.cpp")
+
+#include "linux_proc_resolver.h"
+#include "linux_cgroup.h"
+#include "linux_proc_fs.h"
+#include "path.h"
+
+namespace
+{
+    RegisterMetaType<pid_t> qPidT{"pid_t"};
+}
+
+const std::size_t ProcLaunchResolver::DefaultMaxPending{8192};
+
+ProcLaunchResolver::ProcLaunchResolver(std::size_t maxPending)
+    : _maxPending{maxPending}, _resolveQueued{false}, _droppedCount{0}
+{
+}
+
+void ProcLaunchResolver::setApps(AppCGroups apps)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    _apps = std::move(apps);
+}
+
+bool ProcLaunchResolver::queueExec(pid_t pid)
+{
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        // Nothing to match, don't bother resolving the PID
+        if(_apps.empty())
+            return true;
+        if(_pending.size() >= _maxPending)
+        {
+            ++_droppedCount;
+            return false;
+        }
+        _pending.push_back(pid);
+        if(_resolveQueued)
+            return true;
+        _resolveQueued = true;
+    }
+
+    _resolverThread.queueOnThread([this](){resolvePending();});
+    return true;
+}
+
+void ProcLaunchResolver::clear()
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    _apps.clear();
+    _pending.clear();
+}
+
+void ProcLaunchResolver::flush()
+{
+    // resolvePending() calls are queued in order, so once this runs, all PIDs
+    // queued before it have been resolved
+    _resolverThread.invokeOnThread([](){});
+}
+
+std::uint64_t ProcLaunchResolver::droppedCount() const
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _droppedCount;
+}
+
+void ProcLaunchResolver::resolvePending()
+{
+    std::deque<pid_t> pids;
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        pids.swap(_pending);
+        _resolveQueued = false;
+    }
+
+    for(pid_t pid : pids)
+    {
+        // May be empty if the process was so short-lived it exited before we
+        // had a chance to read its name - just ignore it
+        QString appName = ProcFs::pathForPid(pid);
+        if(appName.isEmpty())
+            continue;
+
+        QString cGroupPath;
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            auto itApp = _apps.find(appName);
+            if(itApp == _apps.end())
+                continue;
+            cGroupPath = itApp->second;
+        }
+
+        // Add the PID to the cgroup so its network traffic is routed for this
+        // app
+        CGroup::addPidToCgroup(pid, cGroupPath);
+        emit resolved(pid, appName, cGroupPath);
+    }
+}
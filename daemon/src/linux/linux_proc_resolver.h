@@ -0,0 +1,104 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("linux/linux_proc_resolver.h")
+
+#ifndef LINUX_PROC_RESOLVER_H
+#define LINUX_PROC_RESOLVER_H
+
+#include "thread.h"
+#include <QObject>
+#include <QString>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <sys/types.h>
+
+// ProcLaunchResolver handles exec events for split tunnel on a worker thread.
+//
+// Each exec requires reading the process's exe link, and if it's a configured
+// app, writing it (and its children) to a cgroup, which scans /proc for child
+// processes.  When many processes are launched, doing this on the thread
+// receiving events would delay other work, and the events would back up in
+// the cn_proc socket until the kernel drops them.
+//
+// queueExec() queues a PID and returns immediately.  The worker resolves each
+// PID's executable; if it's one of the apps given to setApps(), it adds the
+// PID to that app's cgroup and emits resolved().
+//
+// The queue is bounded; if it is full, the event is dropped and counted by
+// droppedCount().
+class ProcLaunchResolver : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Map of app executable paths to the cgroup file their processes are
+    // written to
+    using AppCGroups = std::unordered_map<QString, QString>;
+
+    // Default limit on the number of exec events waiting to be resolved
+    static const std::size_t DefaultMaxPending;
+
+public:
+    ProcLaunchResolver(std::size_t maxPending = DefaultMaxPending);
+
+public:
+    // Set the apps that are matched.  Apps are matched using the most recent
+    // set of apps when each PID is resolved.
+    void setApps(AppCGroups apps);
+
+    // Queue a launched PID to be resolved.  Returns false if the queue was
+    // full and the PID was dropped.
+    bool queueExec(pid_t pid);
+
+    // Discard all queued PIDs and apps.
+    void clear();
+
+    // Wait for all PIDs queued so far to be resolved.
+    void flush();
+
+    std::uint64_t droppedCount() const;
+
+signals:
+    // A PID was resolved to a configured app and added to cGroupPath.  This is
+    // emitted on the worker thread.
+    void resolved(pid_t pid, const QString &app, const QString &cGroupPath);
+
+private:
+    // Resolve all queued PIDs (on the worker thread)
+    void resolvePending();
+
+private:
+    const std::size_t _maxPending;
+    mutable std::mutex _mutex;
+    AppCGroups _apps;
+    std::deque<pid_t> _pending;
+    // Set while a resolvePending() call is queued on the worker thread and
+    // hasn't taken the pending PIDs yet, so PIDs queued in a burst only queue
+    // one call.
+    bool _resolveQueued;
+    std::uint64_t _droppedCount;
+    // Destroyed first, which completes any queued work while the state above
+    // is still valid.
+    RunningWorkerThread _resolverThread;
+};
+
+#endif
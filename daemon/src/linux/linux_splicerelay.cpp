@@ -0,0 +1,238 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#include "common.h"
+#line SOURCE_FILE("linux/linux_splicerelay.cpp")
+
+#include "linux_splicerelay.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    enum : std::size_t
+    {
+        // Size of SpliceRelay's buffer for each direction, used only if
+        // splice() can't be used
+        RelayBufferSize = 16 * 1024,
+    };
+
+    bool isTransientError(int error)
+    {
+        return error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+    }
+}
+
+bool SpliceChannel::openPipe()
+{
+    int pipeFds[2]{PosixFd::Invalid, PosixFd::Invalid};
+    if(::pipe2(pipeFds, O_CLOEXEC|O_NONBLOCK))
+        return false;
+    _pipeRead = PosixFd{pipeFds[0]};
+    _pipeWrite = PosixFd{pipeFds[1]};
+    return true;
+}
+
+void SpliceChannel::reset()
+{
+    _pipeRead = {};
+    _pipeWrite = {};
+    _pending = 0;
+    _offset = 0;
+    _relayedBytes = 0;
+    _piped = false;
+}
+
+void SpliceChannel::queueBuffered(std::size_t size)
+{
+    Q_ASSERT(!_piped || _pending == 0);  // Can't mix with data in the pipe
+    _piped = false;
+    _pending += static_cast<quint32>(size);
+}
+
+ssize_t SpliceChannel::fill(int sourceFd, char *pBuffer, std::size_t bufferSize)
+{
+    Q_ASSERT(_pending == 0);    // Checked by caller
+
+    ssize_t result{};
+    if(_pipeWrite)
+    {
+        result = ::splice(sourceFd, nullptr, _pipeWrite.get(), nullptr,
+                          SpliceChunkSize, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        if(result < 0 && (errno == EINVAL || errno == ENOSYS))
+        {
+            qInfo() << "splice() not supported for relay, using buffer instead -"
+                << ErrnoTracer{};
+            _pipeRead = {};
+            _pipeWrite = {};
+        }
+        else
+            _piped = true;
+    }
+    if(!_pipeWrite)
+    {
+        _piped = false;
+        result = ::recv(sourceFd, pBuffer, bufferSize, 0);
+    }
+
+    _offset = 0;
+    if(result > 0)
+        _pending = static_cast<quint32>(result);
+    return result;
+}
+
+ssize_t SpliceChannel::drain(int destFd, const char *pBuffer)
+{
+    Q_ASSERT(_pending > 0);     // Checked by caller
+
+    ssize_t result{};
+    if(_piped)
+    {
+        result = ::splice(_pipeRead.get(), nullptr, destFd, nullptr, _pending,
+                          SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    }
+    else
+        result = ::send(destFd, pBuffer + _offset, _pending, MSG_NOSIGNAL);
+
+    if(result > 0)
+    {
+        _pending -= static_cast<quint32>(result);
+        _offset = _pending ? _offset + static_cast<quint32>(result) : 0;
+        _relayedBytes += static_cast<quint64>(result);
+    }
+    return result;
+}
+
+SpliceRelay::SpliceRelay(PosixFd first, PosixFd second)
+    : _first{std::move(first)}, _second{std::move(second)}, _closing{false},
+      _done{false}
+{
+    initDirection(_firstToSecond, Endpoint::First, _first.get(), _second.get());
+    initDirection(_secondToFirst, Endpoint::Second, _second.get(), _first.get());
+    // The read notifiers are level-triggered, so any data that were already
+    // waiting in either socket are picked up once the event loop runs.
+}
+
+void SpliceRelay::initDirection(Direction &dir, Endpoint source, int sourceFd,
+                                int destFd)
+{
+    dir.source = source;
+    dir.sourceFd = sourceFd;
+    dir.destFd = destFd;
+    dir.buffer.resize(RelayBufferSize);
+    dir.sourceEof = false;
+
+    if(!dir.channel.openPipe())
+    {
+        qWarning() << "Unable to create relay pipe, using buffer instead -"
+            << ErrnoTracer{};
+    }
+
+    dir.pSourceNotifier.emplace(sourceFd, QSocketNotifier::Read);
+    connect(dir.pSourceNotifier.ptr(), &QSocketNotifier::activated, this,
+            [this, &dir](){pump(dir);});
+    dir.pDestNotifier.emplace(destFd, QSocketNotifier::Write);
+    connect(dir.pDestNotifier.ptr(), &QSocketNotifier::activated, this,
+            [this, &dir](){pump(dir);});
+    updateNotifiers(dir);
+}
+
+void SpliceRelay::pump(Direction &dir)
+{
+    if(_done)
+        return;
+
+    while(true)
+    {
+        if(dir.channel.pending() == 0)
+        {
+            // Once either endpoint has closed, the sources aren't read any
+            // more.
+            if(_closing)
+                break;
+
+            ssize_t received = dir.channel.fill(dir.sourceFd, dir.buffer.data(),
+                                                dir.buffer.size());
+            if(received < 0)
+            {
+                if(isTransientError(errno))
+                    break;
+                fail("receive", errno);
+                return;
+            }
+            if(received == 0)
+            {
+                qInfo() << "Relay endpoint" << traceEnum(dir.source)
+                    << "closed after" << dir.channel.relayedBytes() << "bytes";
+                dir.sourceEof = true;
+                _closing = true;
+                // Stop reading the other direction; anything buffered for it
+                // is discarded.
+                updateNotifiers(&dir == &_firstToSecond ? _secondToFirst : _firstToSecond);
+                emit endpointClosed(dir.source);
+                break;
+            }
+        }
+
+        ssize_t sent = dir.channel.drain(dir.destFd, dir.buffer.data());
+        // A 0-byte result shouldn't happen with data pending, treat it like
+        // EAGAIN so we wait for the destination to become writable.
+        if(sent == 0 || (sent < 0 && isTransientError(errno)))
+            break;
+        if(sent < 0)
+        {
+            fail("send", errno);
+            return;
+        }
+    }
+
+    if(dir.sourceEof && dir.channel.pending() == 0)
+    {
+        _done = true;
+        updateNotifiers(_firstToSecond);
+        updateNotifiers(_secondToFirst);
+        emit finished();
+        return;
+    }
+
+    updateNotifiers(dir);
+}
+
+void SpliceRelay::updateNotifiers(Direction &dir)
+{
+    // Read the source only when nothing is pending in this direction - this
+    // applies backpressure to the source if the destination is slow.
+    dir.pSourceNotifier->setEnabled(!_done && !_closing && dir.channel.pending() == 0);
+    // Wait for the destination only when data are pending.  Once the relay is
+    // closing, only the direction from the closed endpoint is still sent.
+    dir.pDestNotifier->setEnabled(!_done && dir.channel.pending() > 0 &&
+                                  (!_closing || dir.sourceEof));
+}
+
+void SpliceRelay::fail(const char *operation, int error)
+{
+    qWarning() << "Relay failed to" << operation << "data -"
+        << ErrnoTracer{error};
+    _done = true;
+    updateNotifiers(_firstToSecond);
+    updateNotifiers(_secondToFirst);
+    emit failed();
+}
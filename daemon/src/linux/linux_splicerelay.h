@@ -0,0 +1,166 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#include "common.h"
+#line HEADER_FILE("linux/linux_splicerelay.h")
+
+#ifndef LINUX_SPLICERELAY_H
+#define LINUX_SPLICERELAY_H
+
+#include <QSocketNotifier>
+#include "posix/posix_objects.h"
+#include <sys/types.h>
+#include <vector>
+
+// SpliceChannel moves data in one direction between two stream sockets.  Data
+// are moved with splice() through a pipe, so they never enter user space.  If
+// the pipe can't be created, or the sockets don't support splice(), it falls
+// back to recv()/send() through a buffer provided by the owner.
+//
+// A channel holds one chunk at a time - fill() is only called once everything
+// received has been sent, so a slow destination applies backpressure to the
+// source.
+//
+// SpliceChannel only moves data; the owner decides when to fill and drain it.
+// SpliceRelay drives a pair of channels with QSocketNotifiers, and
+// EpollSocksProxy drives them from its epoll loop.
+class SpliceChannel
+{
+public:
+    // Maximum bytes moved into the pipe by one fill().  This is the default
+    // pipe capacity on Linux.
+    static const std::size_t SpliceChunkSize = 64 * 1024;
+
+public:
+    SpliceChannel() : _pending{0}, _offset{0}, _relayedBytes{0}, _piped{false} {}
+
+public:
+    // Create the pipe.  If this fails (errno is set), the channel uses the
+    // buffer.
+    bool openPipe();
+    // Close the pipe and discard anything pending, so the channel can be
+    // reused
+    void reset();
+
+    // Number of bytes received that haven't been sent yet - in the pipe or
+    // buffer
+    std::size_t pending() const {return _pending;}
+    // Total bytes sent to the destination
+    quint64 relayedBytes() const {return _relayedBytes;}
+
+    // Offset in the buffer where more data can be queued with queueBuffered()
+    std::size_t bufferEnd() const {return _offset + _pending;}
+    // Queue data that the owner wrote to the buffer at bufferEnd() (such as a
+    // protocol response).  Can't be used while data are in the pipe.
+    void queueBuffered(std::size_t size);
+
+    // Receive data from sourceFd; pending() must be 0.  Returns the result of
+    // splice() or recv() - the number of bytes received, 0 at EOF, or -1 with
+    // errno set.
+    ssize_t fill(int sourceFd, char *pBuffer, std::size_t bufferSize);
+    // Send pending data to destFd; pending() must be nonzero.  Returns the
+    // result of splice() or send().
+    ssize_t drain(int destFd, const char *pBuffer);
+
+private:
+    PosixFd _pipeRead, _pipeWrite;
+    quint32 _pending;
+    // Offset of the pending data in the buffer (when not piped)
+    quint32 _offset;
+    quint64 _relayedBytes;
+    // Whether the pending data are in the pipe or the buffer
+    bool _piped;
+};
+
+// SpliceRelay relays data in both directions between two connected stream
+// sockets, using a SpliceChannel and a fixed buffer for each direction.
+//
+// SpliceRelay takes ownership of both sockets, which must be nonblocking.
+//
+// When either endpoint reaches EOF, the relay stops reading from the other
+// endpoint (data from it are discarded), sends any remaining data toward the
+// other endpoint, then emits finished().  This is the same as what
+// SocksConnection does with QTcpSockets when one side disconnects.
+class SpliceRelay : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class Endpoint
+    {
+        First,
+        Second,
+    };
+    Q_ENUM(Endpoint);
+
+private:
+    // State for one direction of the relay
+    struct Direction
+    {
+        Endpoint source;
+        int sourceFd;
+        int destFd;
+        SpliceChannel channel;
+        // Buffer used by the channel when splice() isn't available
+        std::vector<char> buffer;
+        // Whether the source has reached EOF
+        bool sourceEof;
+        nullable_t<QSocketNotifier> pSourceNotifier;
+        nullable_t<QSocketNotifier> pDestNotifier;
+    };
+
+public:
+    SpliceRelay(PosixFd first, PosixFd second);
+
+private:
+    void initDirection(Direction &dir, Endpoint source, int sourceFd,
+                       int destFd);
+    // Move as much data as possible in one direction, then update the
+    // notifiers for that direction
+    void pump(Direction &dir);
+    void updateNotifiers(Direction &dir);
+    // Stop relaying due to an error (errno value) and emit failed()
+    void fail(const char *operation, int error);
+
+public:
+    // Total bytes relayed in each direction (first-to-second and
+    // second-to-first)
+    quint64 firstToSecondBytes() const {return _firstToSecond.channel.relayedBytes();}
+    quint64 secondToFirstBytes() const {return _secondToFirst.channel.relayedBytes();}
+
+signals:
+    // An endpoint reached EOF.  The relay is sending any remaining data to the
+    // other endpoint, then it will emit finished().
+    void endpointClosed(Endpoint endpoint);
+    // All data from the closed endpoint have been sent.  The relay can be
+    // destroyed, which closes both sockets.
+    void finished();
+    // A socket error occurred; the relay can't continue.
+    void failed();
+
+private:
+    PosixFd _first, _second;
+    Direction _firstToSecond, _secondToFirst;
+    // Set when either endpoint reaches EOF (or fails)
+    bool _closing;
+    // Set once finished() or failed() has been emitted
+    bool _done;
+};
+
+#endif
@@ -45,10 +45,23 @@ namespace
     RegisterMetaType<QVector<QString>> qStringVector;
     RegisterMetaType<OriginalNetworkScan> qNetScan;
     RegisterMetaType<FirewallParams> qFirewallParams;
+
+    const Path &groupCGroupFile(ProcAppIndex::Group group)
+    {
+        return group == ProcAppIndex::Group::Exclusions ? CGroup::exclusionsFile() : CGroup::vpnOnlyFile();
+    }
 }
 
 Executor ProcTracker::_executor{CURRENT_CATEGORY};
 
+ProcTracker::ProcTracker(QObject *pParent)
+    : QObject{pParent}, _socketOverflows{0}, _droppedExecs{0}
+{
+    // Emitted on the resolver's worker thread, so this is queued
+    connect(&_launchResolver, &ProcLaunchResolver::resolved, this,
+            &ProcTracker::onLaunchResolved);
+}
+
 void ProcTracker::updateMasquerade(QString interfaceName, QString tunnelDeviceName)
 {
     if(interfaceName.isEmpty())
@@ -159,6 +172,10 @@ void ProcTracker::initiateConnection(const FirewallParams &params,
             &ProcTracker::addLaunchedApp);
     connect(_pCnProc.ptr(), &CnProc::exit, this,
             &ProcTracker::removeTerminatedApp);
+    connect(_pCnProc.ptr(), &CnProc::overflowed, this, [this]()
+    {
+        countLostEvents(_socketOverflows, "Netlink socket overflowed");
+    });
 
     // setup cgroups + configure routing rules
     CGroup::setupNetCls();
@@ -216,51 +233,76 @@ void ProcTracker::updateApps(QVector<QString> excludedApps, QVector<QString> vpn
     // If we're not tracking excluded apps, remove everything
     if(!_previousNetScan.ipv4Valid())
         excludedApps = {};
-    // Update excluded apps
-    removeApps(excludedApps, _exclusionsMap);
-    addApps(excludedApps, _exclusionsMap, Path::VpnExclusionsFile);
+    // Remove apps first, so an app moving between groups is re-added to its
+    // new group
+    removeApps(excludedApps, Group::Exclusions);
+    removeApps(vpnOnlyApps, Group::VpnOnly);
+
+    // Scan /proc once for all apps, rather than once per app
+    ProcFs::ExePidIndex exePids;
+    if(!excludedApps.isEmpty() || !vpnOnlyApps.isEmpty())
+        exePids = ProcFs::indexPidsByPath();
 
-    // Update vpnOnly
-    removeApps(vpnOnlyApps, _vpnOnlyMap);
-    addApps(vpnOnlyApps, _vpnOnlyMap, Path::VpnOnlyFile);
+    addApps(excludedApps, Group::Exclusions, exePids, CGroup::exclusionsFile());
+    addApps(vpnOnlyApps, Group::VpnOnly, exePids, CGroup::vpnOnlyFile());
+
+    updateLaunchResolver();
 }
 
 void ProcTracker::removeAllApps()
 {
     qInfo() << "Removing all apps from cgroups";
-    removeApps({}, _exclusionsMap);
-    removeApps({}, _vpnOnlyMap);
+    removeApps({}, Group::Exclusions);
+    removeApps({}, Group::VpnOnly);
 
-    _exclusionsMap.clear();
-    _vpnOnlyMap.clear();
+    _appIndex.clear();
+    _launchResolver.clear();
+    _resolvingPids.clear();
 }
 
-void ProcTracker::addApps(const QVector<QString> &apps, AppMap &appMap, QString cGroupPath)
+void ProcTracker::updateLaunchResolver()
+{
+    ProcLaunchResolver::AppCGroups appCGroups;
+    // Excluded apps are only tracked while we have a network scan
+    if(_previousNetScan.ipv4Valid())
+    {
+        for(const auto &app : _appIndex.appsInGroup(Group::Exclusions))
+            appCGroups.emplace(app, CGroup::exclusionsFile());
+    }
+    for(const auto &app : _appIndex.appsInGroup(Group::VpnOnly))
+        appCGroups.emplace(app, CGroup::vpnOnlyFile());
+    _launchResolver.setApps(std::move(appCGroups));
+}
+
+void ProcTracker::addApps(const QVector<QString> &apps, Group group,
+                          const ProcFs::ExePidIndex &exePids,
+                          const QString &cGroupPath)
 {
     for(auto &app : apps)
     {
-        appMap.insert(app, {});
-        for(pid_t pid : ProcFs::pidsForPath(app))
+        _appIndex.addApp(app, group);
+        auto itPids = exePids.find(app);
+        if(itPids == exePids.end())
+            continue;
+        for(pid_t pid : itPids->second)
         {
             // Both these calls are no-ops if the PID is already excluded
             CGroup::addPidToCgroup(pid, cGroupPath);
-            appMap[app].insert(pid);
+            _appIndex.addPid(pid, app);
         }
     }
 }
 
-void ProcTracker::removeApps(const QVector<QString> &keepApps, AppMap &appMap)
+void ProcTracker::removeApps(const QVector<QString> &keepApps, Group group)
 {
-    for(const auto &app : appMap.keys())
+    for(const auto &app : _appIndex.appsInGroup(group))
     {
         if(!keepApps.contains(app))
         {
-            for(pid_t pid : appMap[app])
+            for(pid_t pid : _appIndex.removeApp(app))
             {
-                CGroup::removePidFromCgroup(pid, Path::ParentVpnExclusionsFile);
+                CGroup::releasePid(pid);
             }
-
-            appMap.remove(app);
         }
     }
 }
@@ -312,6 +354,14 @@ void ProcTracker::shutdownConnection()
 {
     _pCnProc.clear();
 
+    if(_socketOverflows || _droppedExecs)
+    {
+        qWarning() << "Process events lost while connected - socket overflows:"
+            << _socketOverflows << "- dropped exec events:" << _droppedExecs;
+    }
+    _socketOverflows = 0;
+    _droppedExecs = 0;
+
     teardownFirewall();
     // Remove cgroup routing rules
     CGroup::teardownNetCls();
@@ -337,51 +387,59 @@ void ProcTracker::updateSplitTunnel(const FirewallParams &params, QString tunnel
 
 void ProcTracker::removeTerminatedApp(pid_t pid)
 {
-    // Remove from exclusions
-    for(AppMap::iterator i = _exclusionsMap.begin(); i != _exclusionsMap.end(); ++i)
-    {
-        auto &set = i.value();
-        set.remove(pid);
-    }
+    _resolvingPids.erase(pid);
+    _appIndex.removePid(pid);
+    CGroup::forgetPid(pid);
+}
 
-    // Remove from vpnOnly
-    for(AppMap::iterator i = _vpnOnlyMap.begin(); i != _vpnOnlyMap.end(); ++i)
+void ProcTracker::addLaunchedApp(pid_t pid)
+{
+    // Nothing to do if no apps are configured
+    if(_appIndex.empty())
+        return;
+
+    // Resolving the PID's executable and adding it to a cgroup happens on the
+    // resolver's worker thread; see onLaunchResolved()
+    _resolvingPids.insert(pid);
+    if(!_launchResolver.queueExec(pid))
     {
-        auto &set = i.value();
-        set.remove(pid);
+        _resolvingPids.erase(pid);
+        countLostEvents(_droppedExecs, "Exec event queue is full");
     }
 }
 
-void ProcTracker::addLaunchedApp(pid_t pid)
+void ProcTracker::onLaunchResolved(pid_t pid, const QString &appName,
+                                   const QString &cGroupPath)
 {
-    // Get the launch path associated with the PID
-    QString appName = ProcFs::pathForPid(pid);
-
-    // May be empty if the process was so short-lived it exited before we had a chance to read its name
-    // In this case we just early-exit and ignore it
-    if(appName.isEmpty())
+    // Ignore the PID if it exited while it was being resolved, or if the apps
+    // were removed.  (It was added to the cgroup, but the cgroup membership
+    // ends with the process.)
+    if(_resolvingPids.erase(pid) == 0)
         return;
 
-    if(_exclusionsMap.contains(appName))
+    // The apps may have changed while the PID was being resolved
+    const Group *pGroup = _appIndex.appGroup(appName);
+    if(!pGroup || (*pGroup == Group::Exclusions && !_previousNetScan.ipv4Valid()))
     {
-        // Add it if we're currently tracking excluded apps.
-        if(_previousNetScan.ipv4Valid())
-        {
-            _exclusionsMap[appName].insert(pid);
-            qInfo() << "Adding" << pid << "to VPN exclusions for app:" << appName;
-
-            // Add the PID to the cgroup so its network traffic goes out the
-            // physical uplink
-            CGroup::addPidToCgroup(pid, Path::VpnExclusionsFile);
-        }
+        qInfo() << "App" << appName << "was removed while resolving" << pid;
+        CGroup::releasePid(pid);
+        return;
     }
-    else if(_vpnOnlyMap.contains(appName))
-    {
-        _vpnOnlyMap[appName].insert(pid);
+    const Path &groupCGroup = groupCGroupFile(*pGroup);
+    if(groupCGroup != cGroupPath)
+        CGroup::addPidToCgroup(pid, groupCGroup);
+
+    _appIndex.addPid(pid, appName);
+    if(*pGroup == Group::Exclusions)
+        qInfo() << "Adding" << pid << "to VPN exclusions for app:" << appName;
+    else
         qInfo() << "Adding" << pid << "to VPN Only for app:" << appName;
+}
 
-        // Add the PID to the cgroup so its network traffic is forced out the
-        // VPN
-        CGroup::addPidToCgroup(pid, Path::VpnOnlyFile);
-    }
+void ProcTracker::countLostEvents(std::uint64_t &counter, const char *reason)
+{
+    ++counter;
+    // Trace at 1, 2, 4, 8, ... so a flood of events doesn't flood the log too
+    if((counter & (counter - 1)) == 0)
+        qWarning() << reason << "- split tunnel events lost" << counter << "times";
 }
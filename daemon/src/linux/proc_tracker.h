@@ -25,7 +25,11 @@
 #include <QSocketNotifier>
 #include <QPointer>
 #include <QDir>
+#include <unordered_set>
 #include "linux_cn_proc.h"
+#include "linux_proc_fs.h"
+#include "linux_proc_index.h"
+#include "linux_proc_resolver.h"
 #include "daemon.h"
 #include "posix/posix_firewall_pf.h"
 #include "exec.h"
@@ -38,10 +42,7 @@ class ProcTracker : public QObject
     CLASS_LOGGING_CATEGORY("ProcTracker")
 
 public:
-    ProcTracker(QObject *pParent)
-        : QObject{pParent}
-    {
-    }
+    ProcTracker(QObject *pParent);
 
     ~ProcTracker()
     {
@@ -56,22 +57,31 @@ public slots:
                            QString tunnelDeviceLocalAddress);
     void aboutToConnectToVpn() {} // Stub, only used by macOS
 private:
-    using AppMap = QHash<QString, QSet<pid_t>>;
+    using Group = ProcAppIndex::Group;
 
     void addPidToCgroup(pid_t pid, const Path &cGroupPath);
     void removePidFromCgroup(pid_t pid, const Path &cGroupPath);
     void addChildPidsToCgroup(pid_t parentPid, const Path &cGroupPath);
     void removeChildPidsFromCgroup(pid_t parentPid, const Path &cGroupPath);
-    // Remove apps that are no longer in this group - removes apps and PIDs from
-    // appMap that do not appear in keepApps
-    void removeApps(const QVector<QString> &keepApps, AppMap &appMap);
-    void addApps(const QVector<QString> &apps, AppMap &appMap, QString cGroupPath);
+    // Remove apps that are no longer in this group - removes apps and PIDs in
+    // group that do not appear in keepApps
+    void removeApps(const QVector<QString> &keepApps, Group group);
+    // Add apps to a group, placing their running processes (found in exePids)
+    // in the cgroup
+    void addApps(const QVector<QString> &apps, Group group,
+                 const ProcFs::ExePidIndex &exePids, const QString &cGroupPath);
+    // Give the current apps to _launchResolver
+    void updateLaunchResolver();
     void removeAllApps();
     void writePidToCGroup(pid_t pid, const QString &cGroupPath);
     QSet<pid_t> pidsForPath(const QString &path);
     QString pathForPid(pid_t pid);
     void addLaunchedApp(pid_t pid);
+    void onLaunchResolved(pid_t pid, const QString &appName, const QString &cGroupPath);
     void removeTerminatedApp(pid_t pid);
+    // Count events lost due to overload, and trace when the total reaches a
+    // power of 2
+    void countLostEvents(std::uint64_t &counter, const char *reason);
     void updateMasquerade(QString interfaceName, QString tunnelDeviceName);
     void updateRoutes(QString gatewayIp, QString interfaceName, QString tunnelDeviceName);
     void updateNetwork(const FirewallParams &params, QString tunnelDeviceName,
@@ -91,8 +101,19 @@ private:
     OriginalNetworkScan _previousNetScan;
     QString _previousRPFilter;
     QString _previousRouteLocalNet;
-    AppMap _exclusionsMap;
-    AppMap _vpnOnlyMap;
+    // Apps in each group and their running PIDs, updated from process
+    // events
+    ProcAppIndex _appIndex;
+    // Launched PIDs that are being resolved by _launchResolver.  Exits
+    // remove PIDs from this set, so a result for a PID that already exited
+    // is ignored.
+    std::unordered_set<pid_t> _resolvingPids;
+    // Resolves launched processes and adds them to cgroups on a worker thread
+    ProcLaunchResolver _launchResolver;
+    // Counts of events lost since the socket overflowed or the resolver queue
+    // was full
+    std::uint64_t _socketOverflows;
+    std::uint64_t _droppedExecs;
     QString _previousTunnelDeviceLocalAddress;
     QString _previousTunnelDeviceName;
 
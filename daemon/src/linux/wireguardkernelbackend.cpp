@@ -105,6 +105,17 @@ auto WireguardKernelBackend::getStatus() -> Async<WgDevPtr>
     return Async<WgDevPtr>::resolve(pDev);
 }
 
+auto WireguardKernelBackend::getTrafficStats() -> Async<TrafficStats>
+{
+    // The interface counts the tunneled traffic; unlike the peer counters,
+    // this does not include WireGuard's overhead, but it's equivalent for
+    // bandwidth measurements.
+    LinkStatsReader::Counters counters{};
+    if(!_linkStats.read(interfaceName, counters))
+        return Async<TrafficStats>::reject(Error{HERE, Error::Code::WireguardDeviceLost});
+    return Async<TrafficStats>::resolve(TrafficStats{counters.rxBytes, counters.txBytes});
+}
+
 Async<void> WireguardKernelBackend::shutdown()
 {
     // There's no asynchronous shutdown to do for the kernel backend; the
@@ -23,6 +23,7 @@
 #define WIREGUARDKERNELBACKEND_H
 
 #include "wireguardbackend.h"
+#include "linux_linkstats.h"
 #include "vpn.h"
 
 // WireguardKernelBackend is a backend Wireguard implementation using the Linux
@@ -47,9 +48,12 @@ public:
                                  const QPair<QHostAddress, int> &peerIpNet)
         -> Async<std::shared_ptr<NetworkAdapter>> override;
     virtual Async<WgDevPtr> getStatus() override;
+    // Reads the interface's link stats instead of dumping the device
+    virtual Async<TrafficStats> getTrafficStats() override;
     virtual Async<void> shutdown() override;
 
 private:
+    LinkStatsReader _linkStats;
     // Whether we have created an interface - just indicates whether we should
     // do cleanup at destruction
     bool _created;
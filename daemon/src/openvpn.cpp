@@ -56,6 +56,13 @@ OpenVPNProcess::OpenVPNProcess(QObject *parent)
         raiseError(Error(HERE, Error::OpenVPNManagementAcceptError));
     });
 
+    connect(&_stdoutBuffer, &LineBuffer::lineComplete, this,
+            [this](const QByteArray &line){emit stdoutLine(QString::fromLatin1(line));});
+    connect(&_stderrBuffer, &LineBuffer::lineComplete, this,
+            [this](const QByteArray &line){emit stderrLine(QString::fromLatin1(line));});
+    connect(&_managementReadBuffer, &LineBuffer::lineComplete, this,
+            [this](const QByteArray &line){emit managementLine(QString::fromLatin1(line));});
+
     connect(this, &OpenVPNProcess::managementLine, this, &OpenVPNProcess::handleManagementLine);
 }
 
@@ -123,28 +130,12 @@ void OpenVPNProcess::kill()
 
 void OpenVPNProcess::stdoutReadyRead()
 {
-    _stdoutBuffer += _process->readAllStandardOutput();
-    auto lines = _stdoutBuffer.split('\n');
-    _stdoutBuffer = lines.last();
-    for (int i = 0; i < lines.size() - 1; i++)
-    {
-        if (lines[i].endsWith('\r'))
-            lines[i].chop(1);
-        emit stdoutLine(QString::fromLatin1(lines[i]));
-    }
+    _stdoutBuffer.append(_process->readAllStandardOutput());
 }
 
 void OpenVPNProcess::stderrReadyRead()
 {
-    _stderrBuffer += _process->readAllStandardError();
-    auto lines = _stderrBuffer.split('\n');
-    _stderrBuffer = lines.last();
-    for (int i = 0; i < lines.size() - 1; i++)
-    {
-        if (lines[i].endsWith('\r'))
-            lines[i].chop(1);
-        emit stderrLine(QString::fromLatin1(lines[i]));
-    }
+    _stderrBuffer.append(_process->readAllStandardError());
 }
 
 void OpenVPNProcess::processError(QProcess::ProcessError error)
@@ -196,26 +187,16 @@ void OpenVPNProcess::managementReadyRead()
 {
     if (_managementSocket->bytesAvailable() > 0)
     {
-        _managementReadBuffer += _managementSocket->readAll();
-        auto lines = _managementReadBuffer.split('\n');
-        _managementReadBuffer = lines.last();
-        for (int i = 0; i < lines.size() - 1; i++)
-        {
-            if (lines[i].endsWith('\r'))
-                lines[i].chop(1);
-            emit managementLine(QString::fromLatin1(lines[i]));
-        }
+        _managementReadBuffer.append(_managementSocket->readAll());
     }
 }
 
 void OpenVPNProcess::managementReadFinished()
 {
     managementReadyRead();
-    if (_managementReadBuffer.size() > 0)
-    {
-        emit managementLine(QString::fromLatin1(_managementReadBuffer));
-        _managementReadBuffer.clear();
-    }
+    QByteArray partialLine = _managementReadBuffer.reset();
+    if (partialLine.size() > 0)
+        emit managementLine(QString::fromLatin1(partialLine));
 }
 
 void OpenVPNProcess::managementBytesWritten(qint64 bytes)
@@ -23,6 +23,7 @@
 #define OPENVPN_H
 #pragma once
 
+#include "linebuffer.h"
 #include <QByteArray>
 #include <QObject>
 #include <QProcess>
@@ -112,8 +113,8 @@ private:
     class QTcpServer* _managementServer;
     class QTcpSocket* _managementSocket;
 
-    QByteArray _stdoutBuffer, _stderrBuffer;
-    QByteArray _managementReadBuffer, _managementWriteBuffer;
+    LineBuffer _stdoutBuffer, _stderrBuffer, _managementReadBuffer;
+    QByteArray _managementWriteBuffer;
 
     QString _tunnelIP, _tunnelIPv6;
     QString _remoteIP, _localIP;
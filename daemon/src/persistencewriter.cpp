@@ -0,0 +1,74 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("persistencewriter.cpp")
+
+#include "persistencewriter.h"
+#include "json.h"
+
+void PersistenceWriter::queueWrite(const QString &path, QJsonObject content)
+{
+    queueWrite(path, [content = std::move(content)](const QString &filePath)
+    {
+        writeJsonFileAtomic(content, filePath);
+    });
+}
+
+void PersistenceWriter::queueWrite(const QString &path, WriteFunc writeFunc)
+{
+    bool alreadyQueued{false};
+    {
+        std::lock_guard<std::mutex> lock{_pendingMutex};
+        auto itPending = _pending.find(path);
+        if(itPending != _pending.end())
+        {
+            itPending->second = std::move(writeFunc);
+            alreadyQueued = true;
+        }
+        else
+            _pending.emplace(path, std::move(writeFunc));
+    }
+
+    // If the file was already queued, the worker will pick up the new content
+    // when it gets to that file.
+    if(!alreadyQueued)
+        _writerThread.queueOnThread([this, path](){writePending(path);});
+}
+
+void PersistenceWriter::flush()
+{
+    // Writes are queued in order, so once this runs, all prior writes are done
+    _writerThread.invokeOnThread([](){});
+}
+
+void PersistenceWriter::writePending(const QString &path)
+{
+    WriteFunc writeFunc;
+    {
+        std::lock_guard<std::mutex> lock{_pendingMutex};
+        auto itPending = _pending.find(path);
+        // Each write is queued once per entry in _pending, and only this
+        // method removes entries.
+        Q_ASSERT(itPending != _pending.end());
+        writeFunc = std::move(itPending->second);
+        _pending.erase(itPending);
+    }
+
+    Q_ASSERT(writeFunc);    // Guaranteed by queueWrite()
+    writeFunc(path);
+}
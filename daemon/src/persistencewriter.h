@@ -0,0 +1,77 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("persistencewriter.h")
+
+#ifndef PERSISTENCEWRITER_H
+#define PERSISTENCEWRITER_H
+
+#include "thread.h"
+#include <QJsonObject>
+#include <QString>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+// PersistenceWriter writes the daemon's persistent JSON files on a worker
+// thread.
+//
+// Daemon passes the current content of a file to queueWrite() when it changes.
+// Converting the content to JSON text and writing it happens on the worker
+// thread, so large files (like the cached regions lists) don't stall the event
+// loop.  Each file is written atomically with writeJsonFileAtomic().
+//
+// If a file is queued again before the worker thread has written it, only the
+// newest content is written.  Files are written in the order they were first
+// queued.
+//
+// Any queued writes are completed when PersistenceWriter is destroyed.
+class PersistenceWriter
+{
+    CLASS_LOGGING_CATEGORY("json.settings");
+
+public:
+    // Queue the content of a file to be written.  path is the complete path to
+    // the file; its directory must already exist.
+    void queueWrite(const QString &path, QJsonObject content);
+
+    // Queue a file to be written by a function on the worker thread - used for
+    // files that aren't JSON, like the region snapshot.  writeFunc is called
+    // with the path, and it should write the file atomically.  Anything it
+    // captures must be safe to use on the worker thread.
+    using WriteFunc = std::function<void(const QString &path)>;
+    void queueWrite(const QString &path, WriteFunc writeFunc);
+
+    // Wait for all writes queued so far to complete.
+    void flush();
+
+private:
+    // Write the pending content for path (on the worker thread)
+    void writePending(const QString &path);
+
+private:
+    std::mutex _pendingMutex;
+    // Writes that have been queued but not done yet, by file path.  The
+    // worker thread takes writes out of this map when it writes the file.
+    std::unordered_map<QString, WriteFunc> _pending;
+    // Destroyed first, which completes any queued writes while _pending is
+    // still valid.
+    RunningWorkerThread _writerThread;
+};
+
+#endif
@@ -151,7 +151,13 @@ PosixDaemon::PosixDaemon()
     _state.netExtensionState(qEnumToString(DaemonState::NetExtensionState::Installed));
 
 #ifdef Q_OS_LINUX
+    IpTablesFirewall::setNftablesEnabled(_settings.linuxFirewallBackend() == QStringLiteral("nftables"));
     IpTablesFirewall::install();
+    connect(&_settings, &DaemonSettings::linuxFirewallBackendChanged, this, [this]()
+        {
+            IpTablesFirewall::setNftablesEnabled(_settings.linuxFirewallBackend() == QStringLiteral("nftables"));
+            queueApplyFirewallRules();
+        });
 
     // Check for the WireGuard kernel module
     connect(&_linuxModSupport, &LinuxModSupport::modulesUpdated, this,
@@ -580,6 +586,10 @@ void PosixDaemon::applyFirewallRules(const FirewallParams& params)
     // Note: rule precedence is handled inside IpTablesFirewall
     IpTablesFirewall::ensureRootAnchorPriority();
 
+    // Apply all anchor changes below in one batch; only anchors that actually
+    // changed are applied.
+    IpTablesFirewall::beginBatch();
+
     IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("000.allowLoopback"), params.allowLoopback);
     IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("100.blockAll"), params.blockAll);
     IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::Both, QStringLiteral("200.allowVPN"), params.allowVPN);
@@ -632,6 +642,8 @@ void PosixDaemon::applyFirewallRules(const FirewallParams& params)
     // Update dynamic rules that depend on info such as the adapter name and/or DNS servers
     _firewall.updateRules(params);
 
+    IpTablesFirewall::commitBatch();
+
     // Update routes for forwarded packets (i.e docker)
     updateForwardedRoutes(params, _state.tunnelDeviceName(),
         params.enableSplitTunnel && !_settings.routedPacketsOnVPN());
@@ -868,12 +880,13 @@ void PosixDaemon::writePlatformDiagnostics(DiagnosticsFile &file)
                               "cat", QStringList{QStringLiteral("/run/resolvconf/interface/%1").arg(fileName)});
     }
 
-    // net_cls cgroup required for split tunnel
-    file.writeCommand("ls -l <net_cls>", "ls", QStringList{"-l", Path::ParentVpnExclusionsFile.parent()});
-    file.writeText("cat piavpnonly: cgroup.procs", Exec::bashWithOutput("cat /sys/fs/cgroup/net_cls/piavpnonly/cgroup.procs"));
-    file.writeText("ps -p piavpnonly", Exec::bashWithOutput("cat /sys/fs/cgroup/net_cls/piavpnonly/cgroup.procs | xargs -n1 ps -p"));
-    file.writeText("cat piavpnexclusions: cgroup.procs", Exec::bashWithOutput("cat /sys/fs/cgroup/net_cls/piavpnexclusions/cgroup.procs"));
-    file.writeText("ps -p piavpnexclusions", Exec::bashWithOutput("cat /sys/fs/cgroup/net_cls/piavpnexclusions/cgroup.procs | xargs -n1 ps -p"));
+    // net_cls (or unified) cgroup required for split tunnel
+    file.writeText("cgroup hierarchy", CGroup::hierarchy() == CGroup::Hierarchy::Unified ? QStringLiteral("unified") : QStringLiteral("net_cls"));
+    file.writeCommand("ls -l <net_cls>", "ls", QStringList{"-l", CGroup::parentFile().parent()});
+    file.writeText("cat piavpnonly: cgroup.procs", Exec::bashWithOutput(QStringLiteral("cat %1").arg(CGroup::vpnOnlyFile())));
+    file.writeText("ps -p piavpnonly", Exec::bashWithOutput(QStringLiteral("cat %1 | xargs -n1 ps -p").arg(CGroup::vpnOnlyFile())));
+    file.writeText("cat piavpnexclusions: cgroup.procs", Exec::bashWithOutput(QStringLiteral("cat %1").arg(CGroup::exclusionsFile())));
+    file.writeText("ps -p piavpnexclusions", Exec::bashWithOutput(QStringLiteral("cat %1 | xargs -n1 ps -p").arg(CGroup::exclusionsFile())));
     file.writeCommand("ip rule list", "ip", QStringList{"rule", "list"});
     file.writeCommand("ip route show table " BRAND_CODE "vpnrt", "ip", QStringList{"route", "show", "table", BRAND_CODE "vpnrt"});
     file.writeCommand("ip route show table " BRAND_CODE "vpnWgrt", "ip", QStringList{"route", "show", "table", BRAND_CODE "vpnWgrt"});
@@ -1038,8 +1051,9 @@ void PosixDaemon::checkFeatureSupport()
         _state.automationSupportErrors({QStringLiteral("libnl_invalid")});
     }
 
-    // This cgroup must be mounted in this location for this feature.
-    QFileInfo cgroupFile(Path::ParentVpnExclusionsFile);
+    // This cgroup must be mounted in this location for this feature.  (The
+    // unified hierarchy is always mounted if it's used.)
+    QFileInfo cgroupFile(CGroup::parentFile());
     if(!cgroupFile.exists())
     {
         // Try to create the net_cls VFS (if we have no other errors)
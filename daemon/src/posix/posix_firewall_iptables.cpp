@@ -28,9 +28,16 @@
 #include "exec.h"
 #include "linux/linux_cgroup.h"
 #include "linux/linux_fwmark.h"
+#include "linux/linux_libnl.h"
+#include "linux/linux_nftables.h"
 #include "linux/linux_routing.h"
 
 #include <QProcess>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <tuple>
 
 QString SplitDNSInfo::existingDNS(const DaemonState &state)
 {
@@ -80,6 +87,149 @@ bool SplitDNSInfo::isValid() const
 namespace
 {
     const QString kAnchorName{BRAND_CODE "vpn"};
+
+    // Identifies an anchor in a table for one IP version (IPv4 or IPv6, not
+    // Both)
+    using AnchorId = std::tuple<IpTablesFirewall::IPVersion, QString, QString>;
+    enum : std::size_t { AnchorIpVersion, AnchorTable, AnchorName };
+
+    // The state of an anchor - either part may be unknown/unspecified
+    struct AnchorContent
+    {
+        Optional<bool> enabled;
+        Optional<QStringList> rules;
+    };
+
+    // State last committed by commitBatch()
+    std::map<AnchorId, AnchorContent> committedAnchors;
+    // Changes recorded in the current batch
+    std::map<AnchorId, AnchorContent> pendingAnchors;
+    bool batchOpen{false};
+
+    // The filter anchors installed by IpTablesFirewall::install(), in order;
+    // used to install the same anchors with nftables
+    std::vector<NftablesFirewall::AnchorDef> filterAnchorDefs;
+    // Whether nftables has been selected for the filter anchors
+    bool nftablesSelected{false};
+    // Whether uninstall() has deleted any nftables tables left behind by a
+    // prior run
+    bool leftoverTablesChecked{false};
+    // The nftables firewall, if it is active.  While it's active, the filter
+    // anchors are applied with nftables, and the iptables filter anchors are
+    // all disabled.
+    std::unique_ptr<NftablesFirewall> pNftables;
+
+    Nftables::Family nftFamily(IpTablesFirewall::IPVersion ip)
+    {
+        Q_ASSERT(ip != IpTablesFirewall::Both);
+        return ip == IpTablesFirewall::IPv6 ? Nftables::Family::IPv6 : Nftables::Family::IPv4;
+    }
+
+    // Whether an anchor is applied with nftables (if nftables is active).
+    // Only filter anchors that were installed are applied with nftables;
+    // changes to any other anchor are still applied with iptables.
+    bool isNftablesAnchor(const AnchorId &id)
+    {
+        if(!pNftables || std::get<AnchorTable>(id) != IpTablesFirewall::kFilterTable)
+            return false;
+        const auto family = nftFamily(std::get<AnchorIpVersion>(id));
+        return std::any_of(filterAnchorDefs.begin(), filterAnchorDefs.end(),
+            [&](const NftablesFirewall::AnchorDef &def)
+            {
+                return def.family == family && def.anchor == std::get<AnchorName>(id);
+            });
+    }
+
+    const QString &ipVersionTrace(IpTablesFirewall::IPVersion ip)
+    {
+        static const QString ipv4{QStringLiteral("(IPv4)")};
+        static const QString ipv6{QStringLiteral("(IPv6)")};
+        return ip == IpTablesFirewall::IPv6 ? ipv6 : ipv4;
+    }
+
+    // Record a change for an anchor in the current batch
+    AnchorContent &pendingAnchor(IpTablesFirewall::IPVersion ip,
+                                 const QString &anchor, const QString &tableName)
+    {
+        Q_ASSERT(batchOpen);
+        Q_ASSERT(ip != IpTablesFirewall::Both);
+        return pendingAnchors[AnchorId{ip, tableName, anchor}];
+    }
+
+    // An anchor is being changed outside of a batch; forget its committed
+    // state so the next batch applies it again
+    void forgetCommittedAnchor(IpTablesFirewall::IPVersion ip,
+                               const QString &anchor, const QString &tableName)
+    {
+        if(ip == IpTablesFirewall::Both)
+        {
+            forgetCommittedAnchor(IpTablesFirewall::IPv4, anchor, tableName);
+            forgetCommittedAnchor(IpTablesFirewall::IPv6, anchor, tableName);
+            return;
+        }
+        committedAnchors.erase(AnchorId{ip, tableName, anchor});
+    }
+
+    // Find the parts of an anchor's pending content that differ from the
+    // state last committed.  Returns false if nothing changed.
+    bool findAnchorChange(const AnchorId &id, const AnchorContent &content,
+                          AnchorContent &change)
+    {
+        auto itCommitted = committedAnchors.find(id);
+        const AnchorContent *pCommitted = itCommitted == committedAnchors.end() ?
+            nullptr : &itCommitted->second;
+
+        if(content.enabled && (!pCommitted || pCommitted->enabled != content.enabled))
+            change.enabled = content.enabled;
+        if(content.rules && (!pCommitted || pCommitted->rules != content.rules))
+            change.rules = content.rules;
+        return change.enabled || change.rules;
+    }
+
+    // Store changes that were committed successfully
+    void storeCommittedChanges(const std::map<AnchorId, AnchorContent> &changes)
+    {
+        for(const auto &change : changes)
+        {
+            auto &committed = committedAnchors[change.first];
+            if(change.second.enabled)
+                committed.enabled = change.second.enabled;
+            if(change.second.rules)
+                committed.rules = change.second.rules;
+        }
+    }
+
+    // Move the committed state of the nftables filter anchors (updated with
+    // any changes that were not committed) to 'pending', so a batch applies
+    // them to the iptables anchors (or vice versa).  The iptables and
+    // nftables anchors aren't in the same state, so the committed state is
+    // discarded.
+    void replayFilterAnchors(std::map<AnchorId, AnchorContent> &pending,
+                             const std::map<AnchorId, AnchorContent> &changes)
+    {
+        for(const auto &def : filterAnchorDefs)
+        {
+            AnchorId id{def.family == Nftables::Family::IPv6 ? IpTablesFirewall::IPv6 : IpTablesFirewall::IPv4,
+                        IpTablesFirewall::kFilterTable, def.anchor};
+            AnchorContent content;
+            auto itCommitted = committedAnchors.find(id);
+            if(itCommitted != committedAnchors.end())
+            {
+                content = std::move(itCommitted->second);
+                committedAnchors.erase(itCommitted);
+            }
+            auto itChange = changes.find(id);
+            if(itChange != changes.end())
+            {
+                if(itChange->second.enabled)
+                    content.enabled = itChange->second.enabled;
+                if(itChange->second.rules)
+                    content.rules = itChange->second.rules;
+            }
+            if(content.enabled || content.rules)
+                pending[id] = std::move(content);
+        }
+    }
 }
 
 QString IpTablesFirewall::kOutputChain = QStringLiteral("OUTPUT");
@@ -108,6 +258,37 @@ static QString getCommand(IpTablesFirewall::IPVersion ip)
     return ip == IpTablesFirewall::IPv6 ? QStringLiteral("ip6tables") : QStringLiteral("iptables");
 }
 
+namespace
+{
+    // The root chains linked into the built-in chains for each table
+    struct RootAnchorLink
+    {
+        const QString &tableName;
+        QString parent;
+    };
+
+    const std::vector<RootAnchorLink> &rootAnchorLinks()
+    {
+        static const std::vector<RootAnchorLink> links
+        {
+            // Filter table
+            {IpTablesFirewall::kFilterTable, QStringLiteral("OUTPUT")},
+            {IpTablesFirewall::kFilterTable, QStringLiteral("FORWARD")},
+            {IpTablesFirewall::kFilterTable, QStringLiteral("INPUT")},
+            // Nat table
+            {IpTablesFirewall::kNatTable, QStringLiteral("OUTPUT")},
+            {IpTablesFirewall::kNatTable, QStringLiteral("PREROUTING")},
+            {IpTablesFirewall::kNatTable, QStringLiteral("POSTROUTING")},
+            // Mangle table
+            {IpTablesFirewall::kMangleTable, QStringLiteral("OUTPUT")},
+            {IpTablesFirewall::kMangleTable, QStringLiteral("PREROUTING")},
+            // Raw table
+            {IpTablesFirewall::kRawTable, QStringLiteral("PREROUTING")},
+        };
+        return links;
+    }
+}
+
 int IpTablesFirewall::createChain(IpTablesFirewall::IPVersion ip, const QString& chain, const QString& tableName)
 {
     if (ip == Both)
@@ -174,24 +355,149 @@ int IpTablesFirewall::unlinkAndDeleteChain(IpTablesFirewall::IPVersion ip, const
     return deleteChain(ip, chain, tableName);
 }
 
-void IpTablesFirewall::ensureRootAnchorPriority(IpTablesFirewall::IPVersion ip)
+auto IpTablesFirewall::checkAnchors(IpTablesFirewall::IPVersion ip) -> AnchorCheck
 {
-    // Filter table
-    linkChain(ip, rootChainFor("OUTPUT"), kOutputChain, true, kFilterTable);
-    linkChain(ip, rootChainFor("FORWARD"), kForwardChain, true, kFilterTable);
-    linkChain(ip, rootChainFor("INPUT"), kInputChain, true, kFilterTable);
+    Q_ASSERT(ip != Both);
+
+    // Use QProcess directly rather than Executor, which would trace the
+    // entire ruleset every time
+    QProcess save;
+    save.start(ip == IPv6 ? QStringLiteral("ip6tables-save") : QStringLiteral("iptables-save"),
+               {}, QProcess::ReadOnly);
+    save.closeWriteChannel();
+    int exitCode = waitForExitCode(save);
+    if(exitCode != 0)
+    {
+        qWarning() << "Unable to check root anchor priority" << ipVersionTrace(ip)
+            << "- save failed with code" << exitCode;
+        return AnchorCheck::Unprioritized;
+    }
+    const QString output = QString::fromUtf8(save.readAllStandardOutput());
+
+    QString currentTable;
+    // Chains declared in each table
+    std::set<std::pair<QString, QString>> chains;
+    // Rule lines seen in each table/chain so far
+    std::map<std::pair<QString, QString>, QStringList> chainRules;
+    const auto &lines = output.splitRef('\n');
+    for(const auto &line : lines)
+    {
+        if(line.startsWith('*'))
+            currentTable = line.mid(1).trimmed().toString();
+        else if(line.startsWith(':'))
+        {
+            auto nameEnd = line.indexOf(' ');
+            if(nameEnd > 1)
+                chains.insert({currentTable, line.mid(1, nameEnd-1).toString()});
+        }
+        else if(line.startsWith(QLatin1String("-A ")))
+        {
+            auto chainEnd = line.indexOf(' ', 3);
+            if(chainEnd < 0)
+                continue;
+            chainRules[{currentTable, line.mid(3, chainEnd-3).toString()}]
+                .push_back(line.mid(chainEnd+1).trimmed().toString());
+        }
+    }
 
-    // Nat table
-    linkChain(ip, rootChainFor("OUTPUT"), kOutputChain, true, kNatTable);
-    linkChain(ip, rootChainFor("PREROUTING"), kPreRoutingChain, true, kNatTable);
-    linkChain(ip, rootChainFor("POSTROUTING"), kPostRoutingChain, true, kNatTable);
+    // Check that the committed anchors are still in the state that was
+    // committed.  Something else could have flushed or deleted our chains
+    // (like a firewalld reload); the batch would otherwise skip those anchors
+    // since their committed state didn't change.  Forget the committed state
+    // of any anchor that was changed, so the next batch reapplies it.
+    bool chainsMissing{false};
+    for(auto itCommitted = committedAnchors.begin(); itCommitted != committedAnchors.end(); )
+    {
+        const AnchorId &id = itCommitted->first;
+        if(std::get<AnchorIpVersion>(id) != ip || isNftablesAnchor(id))
+        {
+            ++itCommitted;
+            continue;
+        }
 
-    // Mangle table
-    linkChain(ip, rootChainFor("OUTPUT"), kOutputChain, true, kMangleTable);
-    linkChain(ip, rootChainFor("PREROUTING"), kPreRoutingChain, true, kMangleTable);
+        const QString &tableName = std::get<AnchorTable>(id);
+        const QString &anchor = std::get<AnchorName>(id);
+        const AnchorContent &committed = itCommitted->second;
+        const QString anchorChain = QStringLiteral("%1.a.%2").arg(kAnchorName, anchor);
+        const QString actualChain = QStringLiteral("%1.%2").arg(kAnchorName, anchor);
+        const QString ruleChain = QStringLiteral("%1.r.%2").arg(kAnchorName, anchor);
 
-    // Raw table
-    linkChain(ip, rootChainFor("PREROUTING"), kPreRoutingChain, true, kRawTable);
+        bool changed{false};
+        if(!chains.count({tableName, anchorChain}) || !chains.count({tableName, actualChain}) ||
+           !chains.count({tableName, ruleChain}))
+        {
+            chainsMissing = true;
+            changed = true;
+        }
+        if(committed.enabled)
+        {
+            const bool enabled = chainRules[{tableName, anchorChain}]
+                .contains(QStringLiteral("-j %1").arg(actualChain));
+            changed = changed || enabled != committed.enabled.get();
+        }
+        // The saved rules are normalized by iptables, so they can't be
+        // compared to the committed rules directly, but each committed rule
+        // is one saved rule.
+        if(committed.rules)
+        {
+            changed = changed ||
+                chainRules[{tableName, actualChain}] != QStringList{QStringLiteral("-j %1").arg(ruleChain)} ||
+                chainRules[{tableName, ruleChain}].size() != committed.rules.get().size();
+        }
+
+        if(changed)
+        {
+            qInfo().noquote() << QStringLiteral("%1%2 was changed externally, reapplying it")
+                .arg(anchor, ipVersionTrace(ip));
+            itCommitted = committedAnchors.erase(itCommitted);
+        }
+        else
+            ++itCommitted;
+    }
+    if(chainsMissing)
+        return AnchorCheck::Missing;
+
+    // For each table, find the rules in each parent chain that jump to our
+    // root chains.  The root chain must be the first rule, and there must be
+    // no other jumps to it.
+    for(const auto &link : rootAnchorLinks())
+    {
+        const QString jump = QStringLiteral("-j %1").arg(rootChainFor(link.parent));
+        const auto &rules = chainRules[{link.tableName, link.parent}];
+        if(rules.isEmpty() || rules.front() != jump || rules.count(jump) != 1)
+            return AnchorCheck::Unprioritized;
+    }
+    return AnchorCheck::Intact;
+}
+
+void IpTablesFirewall::ensureRootAnchorPriority(IpTablesFirewall::IPVersion ip)
+{
+    if (ip == Both)
+    {
+        ensureRootAnchorPriority(IPv4);
+        ensureRootAnchorPriority(IPv6);
+        return;
+    }
+
+    // Checking all the links with one iptables-save is much cheaper than
+    // running linkChain() for each one; this is usually all that's needed.
+    switch(checkAnchors(ip))
+    {
+        case AnchorCheck::Intact:
+            return;
+        case AnchorCheck::Missing:
+            // The anchors can't be restored by a batch if their chains are
+            // gone, since they'd no longer be linked into the root chains.
+            qWarning() << "Firewall chains are missing" << ipVersionTrace(ip)
+                << "- reinstalling firewall";
+            install();
+            return;
+        case AnchorCheck::Unprioritized:
+            qInfo() << "Restoring root anchor priority" << ipVersionTrace(ip);
+            for(const auto &link : rootAnchorLinks())
+                linkChain(ip, rootChainFor(link.parent), link.parent, true, link.tableName);
+            return;
+    }
 }
 
 void IpTablesFirewall::installAnchor(IpTablesFirewall::IPVersion ip, const QString& anchor, const QStringList& rules, const QString& tableName, const QString &rootChain)
@@ -206,6 +512,14 @@ void IpTablesFirewall::installAnchor(IpTablesFirewall::IPVersion ip, const QStri
 
     const QString cmd = getCommand(ip);
 
+    if(tableName == kFilterTable)
+    {
+        // The root chain for OUTPUT is kRootChain; the others are named
+        // after their parent chain
+        QString hook = rootChain == kRootChain ? kOutputChain : rootChain.mid(kAnchorName.size() + 1);
+        filterAnchorDefs.push_back({nftFamily(ip), std::move(hook), anchor, rules});
+    }
+
     // iptables anchors in PIA are constructed from three chains, because we
     // need two "links" that we can replace or delete:
     // - The "anchor"-"actual" link is created or deleted to enable or disable
@@ -287,29 +601,18 @@ QStringList IpTablesFirewall::getDNSRules(const QString &vpnAdapterName, const Q
     return result;
 }
 
-void IpTablesFirewall::install()
+std::vector<NftablesFirewall::AnchorDef> IpTablesFirewall::filterAnchors()
 {
-    // Clean up any existing rules if they exist.
-    uninstall();
-
-    // Create a root filter chain to hold all our other anchors in order.
-    createChain(Both, kRootChain, kFilterTable);
-    createChain(Both, rootChainFor("FORWARD"), kFilterTable);
-    createChain(Both, rootChainFor("INPUT"), kFilterTable);
-
-    // Create root raw chains
-    createChain(Both, rootChainFor("PREROUTING"), kRawTable);
-
-    // Create root NAT chains
-    createChain(Both, kRootChain, kNatTable);
-    createChain(Both, rootChainFor("PREROUTING"), kNatTable);
-    createChain(Both, rootChainFor("POSTROUTING"), kNatTable);
-
-    // Create root Mangle chains
-    createChain(Both, kRootChain, kMangleTable);
-    createChain(Both, rootChainFor("PREROUTING"), kMangleTable);
-
-    // Install our filter rulesets in each corresponding anchor chain.
+    std::vector<NftablesFirewall::AnchorDef> anchors;
+    auto addAnchor = [&](IPVersion ip, const QString &anchor,
+                         const QStringList &rules,
+                         const QString &hook = kOutputChain)
+    {
+        if(ip != IPv6)
+            anchors.push_back({Nftables::Family::IPv4, hook, anchor, rules});
+        if(ip != IPv4)
+            anchors.push_back({Nftables::Family::IPv6, hook, anchor, rules});
+    };
 
     // Don't allow unfettered loopback traffic - in particular do not just
     // permit loopback DNS traffic. This is due to an obscure iptables issue
@@ -321,14 +624,14 @@ void IpTablesFirewall::install()
     // then just allowing all loopback traffic would also allow the incorrectly routed vpnOnly DNS packets.
     // To work around this, we only allow non DNS loopback traffic and have the DNS traffic fall back
     // to the DNS rules found in 320.allowDNS.
-    installAnchor(Both, QStringLiteral("000.allowLoopback"), {
+    addAnchor(Both, QStringLiteral("000.allowLoopback"), {
         // Use -j RETURN so that the port 53 packets are handled by
         // later chains. Allow everything else.
         QStringLiteral("-o lo+ -p udp -m udp --dport 53 -j RETURN"),
         QStringLiteral("-o lo+ -p tcp -m tcp --dport 53 -j RETURN"),
         QStringLiteral("-o lo+ -j ACCEPT")
     });
-    installAnchor(Both, QStringLiteral("400.allowPIA"), {
+    addAnchor(Both, QStringLiteral("400.allowPIA"), {
         QStringLiteral("-m owner --gid-owner %1 -j ACCEPT").arg(kVpnGroupName),
     });
 
@@ -336,35 +639,35 @@ void IpTablesFirewall::install()
     // Though another process could also mark packets with this fwmark to permit
     // them, it would have to have root privileges to do so, which means it
     // could install its own firewall rules anyway.
-    installAnchor(Both, QStringLiteral("390.allowWg"), {
+    addAnchor(Both, QStringLiteral("390.allowWg"), {
         QStringLiteral("-m mark --mark %1 -j ACCEPT").arg(Fwmark::wireguardFwmark),
     });
-    installAnchor(Both, QStringLiteral("350.allowHnsd"), {
+    addAnchor(Both, QStringLiteral("350.allowHnsd"), {
         // Updated at run-time in updateRules()
     });
-    installAnchor(Both, QStringLiteral("350.cgAllowHnsd"), {
+    addAnchor(Both, QStringLiteral("350.cgAllowHnsd"), {
         // Port 13038 is the handshake control port
-        QStringLiteral("-m owner --gid-owner %1 -m cgroup --cgroup %2 -p tcp --match multiport --dports 53,13038 -j ACCEPT").arg(kHnsdGroupName, CGroup::vpnOnlyId),
-        QStringLiteral("-m owner --gid-owner %1 -m cgroup --cgroup %2 -p udp --match multiport --dports 53,13038 -j ACCEPT").arg(kHnsdGroupName, CGroup::vpnOnlyId),
+        QStringLiteral("-m owner --gid-owner %1 -m cgroup %2 -p tcp --match multiport --dports 53,13038 -j ACCEPT").arg(kHnsdGroupName, CGroup::iptablesMatch(CGroup::vpnOnlyId)),
+        QStringLiteral("-m owner --gid-owner %1 -m cgroup %2 -p udp --match multiport --dports 53,13038 -j ACCEPT").arg(kHnsdGroupName, CGroup::iptablesMatch(CGroup::vpnOnlyId)),
         QStringLiteral("-m owner --gid-owner %1 -j REJECT").arg(kHnsdGroupName),
     });
 
     // block vpnOnly packets (these are only blocked when VPN is disconnected)
-    installAnchor(Both, QStringLiteral("340.blockVpnOnly"), {
-        QStringLiteral("-m cgroup --cgroup %1 -j REJECT").arg(CGroup::vpnOnlyId),
+    addAnchor(Both, QStringLiteral("340.blockVpnOnly"), {
+        QStringLiteral("-m cgroup %1 -j REJECT").arg(CGroup::iptablesMatch(CGroup::vpnOnlyId)),
     });
 
-    installAnchor(IPv4, QStringLiteral("320.allowDNS"), {});
-    installAnchor(Both, QStringLiteral("310.blockDNS"), {
+    addAnchor(IPv4, QStringLiteral("320.allowDNS"), {});
+    addAnchor(Both, QStringLiteral("310.blockDNS"), {
         QStringLiteral("-p udp --dport 53 -j REJECT"),
         QStringLiteral("-p tcp --dport 53 -j REJECT"),
     });
 
-    installAnchor(Both, QStringLiteral("305.allowSubnets"), {
+    addAnchor(Both, QStringLiteral("305.allowSubnets"), {
         // Updated at run-time
     });
 
-    installAnchor(IPv4, QStringLiteral("300.allowLAN"), {
+    addAnchor(IPv4, QStringLiteral("300.allowLAN"), {
         QStringLiteral("-d 10.0.0.0/8 -j ACCEPT"),
         QStringLiteral("-d 169.254.0.0/16 -j ACCEPT"),
         QStringLiteral("-d 172.16.0.0/12 -j ACCEPT"),
@@ -372,39 +675,199 @@ void IpTablesFirewall::install()
         QStringLiteral("-d 224.0.0.0/4 -j ACCEPT"),
         QStringLiteral("-d 255.255.255.255/32 -j ACCEPT"),
     });
-    installAnchor(IPv6, QStringLiteral("300.allowLAN"), {
+    addAnchor(IPv6, QStringLiteral("300.allowLAN"), {
         QStringLiteral("-d fc00::/7 -j ACCEPT"),
         QStringLiteral("-d fe80::/10 -j ACCEPT"),
         QStringLiteral("-d ff00::/8 -j ACCEPT"),
     });
-    installAnchor(IPv6, QStringLiteral("299.allowIPv6Prefix"), {
+    addAnchor(IPv6, QStringLiteral("299.allowIPv6Prefix"), {
         // Updated at run-time
     });
-    installAnchor(IPv4, QStringLiteral("290.allowDHCP"), {
+    addAnchor(IPv4, QStringLiteral("290.allowDHCP"), {
         QStringLiteral("-p udp -d 255.255.255.255 --sport 68 --dport 67 -j ACCEPT"),
     });
-    installAnchor(IPv6, QStringLiteral("290.allowDHCP"), {
+    addAnchor(IPv6, QStringLiteral("290.allowDHCP"), {
         QStringLiteral("-p udp -d ff00::/8 --sport 546 --dport 547 -j ACCEPT"),
     });
 
     // This rule exists as the 100.blockAll rule can be toggled off if killswitch=off.
     // However we *always* want to block IPv6 traffic in any situation (until we properly support IPv6)
-    installAnchor(IPv6, QStringLiteral("250.blockIPv6"), {
+    addAnchor(IPv6, QStringLiteral("250.blockIPv6"), {
         QStringLiteral("! -o lo+ -j REJECT"),
     });
 
-    installAnchor(IPv4, QStringLiteral("230.allowBypassApps"), {
-        QStringLiteral("-m cgroup --cgroup %1 -j ACCEPT").arg(CGroup::bypassId, Fwmark::excludePacketTag),
+    addAnchor(IPv4, QStringLiteral("230.allowBypassApps"), {
+        QStringLiteral("-m cgroup %1 -j ACCEPT").arg(CGroup::iptablesMatch(CGroup::bypassId), Fwmark::excludePacketTag),
     });
 
-    installAnchor(Both, QStringLiteral("200.allowVPN"), {
+    addAnchor(Both, QStringLiteral("200.allowVPN"), {
         // To be added at runtime, dependent upon vpn method (i.e openvpn or wireguard)
     });
 
-    installAnchor(Both, QStringLiteral("100.blockAll"), {
+    addAnchor(Both, QStringLiteral("100.blockAll"), {
         QStringLiteral("-j REJECT"),
     });
 
+    // Protect our loopback ips from outside access (since we may have route_local activated)
+    addAnchor(IPv4, QStringLiteral("100.protectLoopback"), {
+        QStringLiteral("! -i lo -o lo -j REJECT")
+    }, kInputChain);
+
+    return anchors;
+}
+
+QStringList IpTablesFirewall::getAllowVpnRules(const QString &adapterName)
+{
+    if(adapterName.isEmpty())
+        return {};
+    return {QStringLiteral("-o %1 -j ACCEPT").arg(adapterName)};
+}
+
+QStringList IpTablesFirewall::getAllowHnsdRules(const QString &adapterName)
+{
+    if(adapterName.isEmpty())
+        return {};
+    return {
+        QStringLiteral("-m owner --gid-owner %1 -o %2 -p tcp --match multiport --dports 53,13038 -j ACCEPT").arg(kHnsdGroupName, adapterName),
+        QStringLiteral("-m owner --gid-owner %1 -o %2 -p udp --match multiport --dports 53,13038 -j ACCEPT").arg(kHnsdGroupName, adapterName),
+        QStringLiteral("-m owner --gid-owner %1 -j REJECT").arg(kHnsdGroupName),
+    };
+}
+
+QStringList IpTablesFirewall::getAllowIPv6PrefixRules(const QString &ipAddress6)
+{
+    if(ipAddress6.isEmpty())
+        return {};
+    // First 64 bits is the IPv6 Network Prefix. This prefix is shared by all IPv6 hosts on the LAN,
+    // so whitelisting it allows those hosts to communicate
+    return {QStringLiteral("-d %1/64 -j ACCEPT").arg(ipAddress6)};
+}
+
+QStringList IpTablesFirewall::getAllowSubnetRules(IPVersion ip, const QSet<QString> &subnets)
+{
+    if(subnets.isEmpty())
+        return {};
+
+    QStringList subnetAcceptRules;
+    for(const auto &subnet : subnets)
+        subnetAcceptRules << QStringLiteral("-d %1 -j ACCEPT").arg(subnet);
+
+    // If there's any IPv6 addresses then we also need to whitelist link-local and broadcast
+    // as these address ranges are needed for IPv6 Neighbor Discovery.
+    if(ip == IPv6)
+    {
+        subnetAcceptRules << QStringLiteral("-d fe80::/10 -j ACCEPT");
+        subnetAcceptRules << QStringLiteral("-d ff00::/8 -j ACCEPT");
+    }
+    return subnetAcceptRules;
+}
+
+QStringList IpTablesFirewall::getAllowDNSRules(const QString &adapterName,
+                                               const QStringList &servers,
+                                               bool enableSplitTunnel,
+                                               bool forceVpnOnlyDns,
+                                               const QString &appDnsServer)
+{
+    // If the adapter name isn't set, getDNSRules() returns an empty list
+    QStringList ruleList = getDNSRules(adapterName, servers);
+
+    if(!ruleList.isEmpty() && enableSplitTunnel)
+    {
+        // DNS leak protection for vpnOnly apps.
+        // In rare situations, when making a DNS request, a vpnOnly app could re-use the port
+        // previously used by a bypass app. When this happens, iptables causes the vpnOnly DNS request
+        // to get routed the same way as the bypass request - causing a DNS leak.
+        // We guard against this below.
+        if(forceVpnOnlyDns)
+        {
+            const auto vpnOnlyServersStr = QStringList{appDnsServer}.join(',');
+            // When the VPN does not have the default route, allow
+            // the vpnOnly DNS servers
+            ruleList << QStringLiteral("-p udp -m cgroup %1 -m udp --dport 53 -d %2 -j ACCEPT").arg(CGroup::iptablesMatch(CGroup::vpnOnlyId), vpnOnlyServersStr);
+            ruleList << QStringLiteral("-p tcp -m cgroup %1 -m tcp --dport 53 -d %2 -j ACCEPT").arg(CGroup::iptablesMatch(CGroup::vpnOnlyId), vpnOnlyServersStr);
+            // And block everything else
+            // Doing this prevents a vpnOnly app re-using a port/route used by a bypass app
+            ruleList << QStringLiteral("-p udp -m cgroup %1 -m udp --dport 53 -j REJECT").arg(CGroup::iptablesMatch(CGroup::vpnOnlyId));
+            ruleList << QStringLiteral("-p tcp -m cgroup %1 -m tcp --dport 53 -j REJECT").arg(CGroup::iptablesMatch(CGroup::vpnOnlyId));
+
+            // Reject bypass apps from using vpnOnly DNS (prevents a bypass app re-using a vpnOnly port/route)
+            // If we didn't block this, it may allow bypass apps to make DNS requests over the VPN - this isn't technically a 'leak'
+            // but is still weird/unexpected behaviour, so we prevent it.
+            ruleList << QStringLiteral("-p udp -m cgroup %1 -m udp --dport 53 -d %2 -j REJECT").arg(CGroup::iptablesMatch(CGroup::bypassId), vpnOnlyServersStr);
+            ruleList << QStringLiteral("-p tcp -m cgroup %1 -m tcp --dport 53 -d %2 -j REJECT").arg(CGroup::iptablesMatch(CGroup::bypassId), vpnOnlyServersStr);
+        }
+        else // VPN has default route
+        {
+            const auto bypassServersStr = QStringList{appDnsServer}.join(",");
+            // Allow configured DNS servers for bypass apps (VPN has the default route)
+
+            // Only apply our bypass leak protection if we have bypass DNS servers
+            // (we will not have bypass DNS servers if ST "Name Servers" is set to "Use VPN DNS Only" rather than "Follow App Rules")
+            if(!bypassServersStr.isEmpty())
+            {
+                ruleList << QStringLiteral("-p udp -m cgroup %1 -m udp --dport 53 -d %2 -j ACCEPT").arg(CGroup::iptablesMatch(CGroup::bypassId), bypassServersStr);
+                ruleList << QStringLiteral("-p tcp -m cgroup %1 -m tcp --dport 53 -d %2 -j ACCEPT").arg(CGroup::iptablesMatch(CGroup::bypassId), bypassServersStr);
+                // And block everything else
+                ruleList << QStringLiteral("-p udp -m cgroup %1 -m udp --dport 53 -j REJECT").arg(CGroup::iptablesMatch(CGroup::bypassId));
+                ruleList << QStringLiteral("-p tcp -m cgroup %1 -m tcp --dport 53 -j REJECT").arg(CGroup::iptablesMatch(CGroup::bypassId));
+
+                // When the VPN does have the default route, vpnOnly apps use the configured VPN DNS.
+                // However, vpnOnly apps could still leak if a DNS request re-uses the route used by
+                // by a prior bypass app. This happens when a vpnOnly app re-uses the source port of a bypass app within the UDP conntrack timeout.
+                // To guard against this we block bypass DNS servers for any packet that is not part of the bypass cgroup.
+                // NOTE: we cannot use the vpnOnly cgroup here as no apps are added to the vpnOnly cgroup when the VPN has
+                // the default route.
+                ruleList << QStringLiteral("-p udp -m cgroup ! %1 -m udp --dport 53 -d %2 -j REJECT").arg(CGroup::iptablesMatch(CGroup::bypassId), bypassServersStr);
+                ruleList << QStringLiteral("-p tcp -m cgroup ! %1 -m tcp --dport 53 -d %2 -j REJECT").arg(CGroup::iptablesMatch(CGroup::bypassId), bypassServersStr);
+            }
+        }
+    }
+
+    // Re-allow localhost DNS now we've plugged the leaks.
+    // localhost DNS is important for systemd which uses a 127.0.0.53 DNS proxy
+    // for all DNS traffic.
+    ruleList << QStringLiteral("-o lo+ -p udp -m udp --dport 53 -j ACCEPT");
+    ruleList << QStringLiteral("-o lo+ -p tcp -m tcp --dport 53 -j ACCEPT");
+    return ruleList;
+}
+
+void IpTablesFirewall::install()
+{
+    // Clean up any existing rules if they exist.
+    uninstall();
+
+    // All anchors are being recreated, the next batch must apply everything
+    committedAnchors.clear();
+
+    // The split tunnel cgroups must exist before the rules that match them
+    // are created
+    CGroup::createUnifiedGroups();
+
+    // Create a root filter chain to hold all our other anchors in order.
+    createChain(Both, kRootChain, kFilterTable);
+    createChain(Both, rootChainFor("FORWARD"), kFilterTable);
+    createChain(Both, rootChainFor("INPUT"), kFilterTable);
+
+    // Create root raw chains
+    createChain(Both, rootChainFor("PREROUTING"), kRawTable);
+
+    // Create root NAT chains
+    createChain(Both, kRootChain, kNatTable);
+    createChain(Both, rootChainFor("PREROUTING"), kNatTable);
+    createChain(Both, rootChainFor("POSTROUTING"), kNatTable);
+
+    // Create root Mangle chains
+    createChain(Both, kRootChain, kMangleTable);
+    createChain(Both, rootChainFor("PREROUTING"), kMangleTable);
+
+    // Install our filter rulesets in each corresponding anchor chain.
+    for(const auto &def : filterAnchors())
+    {
+        installAnchor(def.family == Nftables::Family::IPv6 ? IPv6 : IPv4,
+                      def.anchor, def.rules, kFilterTable,
+                      def.hook == kOutputChain ? kRootChain : rootChainFor(def.hook));
+    }
+
     // NAT rules
     installAnchor(Both, QStringLiteral("80.splitDNS"), {
         // Updated dynamically (see updateRules)
@@ -426,11 +889,6 @@ void IpTablesFirewall::install()
         // This anchor is set at run-time by split-tunnel ProcTracker class
     }, kNatTable, rootChainFor("POSTROUTING"));
 
-    // Protect our loopback ips from outside access (since we may have route_local activated)
-    installAnchor(IPv4, QStringLiteral("100.protectLoopback"), {
-        QStringLiteral("! -i lo -o lo -j REJECT")
-    }, kFilterTable, rootChainFor("INPUT"));
-
     // Mangle rules
     // This rule is for "bypass subnets". The approach we use for
     // allowing subnets to bypass the VPN is to tag packets heading towards those subnets
@@ -446,13 +904,13 @@ void IpTablesFirewall::install()
 
     installAnchor(Both, QStringLiteral("100.tagBypass"), {
         // Split tunnel
-        QStringLiteral("-m cgroup --cgroup %1 -j MARK --set-mark %2").arg(CGroup::bypassId, Fwmark::excludePacketTag),
+        QStringLiteral("-m cgroup %1 -j MARK --set-mark %2").arg(CGroup::iptablesMatch(CGroup::bypassId), Fwmark::excludePacketTag),
     }, kMangleTable);
 
     // Mangle rules
     installAnchor(Both, QStringLiteral("100.tagVpnOnly"), {
         // Inverse split tunnel
-        QStringLiteral("-m cgroup --cgroup %1 -j MARK --set-mark %2").arg(CGroup::vpnOnlyId, Fwmark::vpnOnlyPacketTag)
+        QStringLiteral("-m cgroup %1 -j MARK --set-mark %2").arg(CGroup::iptablesMatch(CGroup::vpnOnlyId), Fwmark::vpnOnlyPacketTag)
     }, kMangleTable);
 
     // Marks all forwarded packets
@@ -513,10 +971,130 @@ void IpTablesFirewall::install()
     // Route forwarded packets
     execute(QStringLiteral("ip rule add from all fwmark %1 lookup %2 prio %3").arg(Fwmark::forwardedPacketTag).arg(Routing::forwardedTable).arg(Routing::Priorities::forwarded));
     execute(QStringLiteral("ip -6 rule add from all fwmark %1 lookup %2 prio %3").arg(Fwmark::forwardedPacketTag).arg(Routing::forwardedTable).arg(Routing::Priorities::forwarded));
+
+    installNftables();
+}
+
+void IpTablesFirewall::installNftables()
+{
+    if(!nftablesSelected)
+        return;
+
+    if(!libnl::load())
+    {
+        qWarning() << "Can't use nftables, libnl is not available - using iptables";
+        return;
+    }
+
+    // Split tunnel rules in the unified hierarchy are matched by cgroup path,
+    // which nftables can't do on older kernels
+    if(CGroup::hierarchy() == CGroup::Hierarchy::Unified &&
+       !Nftables::socketCgroupV2Supported())
+    {
+        qWarning() << "Can't use nftables, kernel doesn't support cgroup v2 socket matches - using iptables";
+        return;
+    }
+
+    auto pNewNftables = std::make_unique<NftablesFirewall>(kAnchorName);
+    try
+    {
+        pNewNftables->install(filterAnchorDefs);
+        pNftables = std::move(pNewNftables);
+    }
+    catch(const std::exception &ex)
+    {
+        qWarning() << "Unable to install nftables firewall, using iptables -" << ex.what();
+        pNewNftables->uninstall();
+    }
+}
+
+void IpTablesFirewall::setNftablesEnabled(bool enabled)
+{
+    if(enabled == nftablesSelected)
+        return;
+    nftablesSelected = enabled;
+
+    // If the firewall isn't installed, this takes effect when it is
+    if(filterAnchorDefs.empty())
+        return;
+
+    qInfo() << "Switching filter anchors to" << (enabled ? "nftables" : "iptables");
+    if(enabled)
+    {
+        installNftables();
+        if(!pNftables)
+            return; // Failed, still using iptables
+
+        // Apply the current anchor state to nftables.  The iptables anchors
+        // remain in place until that succeeds, so nothing is unblocked in the
+        // meantime.
+        beginBatch();
+        replayFilterAnchors(pendingAnchors, {});
+        commitBatch();
+
+        // If that failed, commitBatch() already reverted to iptables
+        if(pNftables)
+            disableIpTablesFilterAnchors();
+    }
+    else if(pNftables)
+    {
+        // Apply the anchors with iptables first, then remove the nftables
+        // tables
+        std::unique_ptr<NftablesFirewall> pOldNftables;
+        pOldNftables.swap(pNftables);
+        beginBatch();
+        replayFilterAnchors(pendingAnchors, {});
+        commitBatch();
+        pOldNftables->uninstall();
+    }
+}
+
+void IpTablesFirewall::disableIpTablesFilterAnchors()
+{
+    for(IPVersion ip : {IPv4, IPv6})
+    {
+        const auto family = nftFamily(ip);
+        QStringList lines;
+        for(const auto &def : filterAnchorDefs)
+        {
+            if(def.family == family)
+                lines << QStringLiteral(":%1.a.%2 - [0:0]").arg(kAnchorName, def.anchor);
+        }
+        if(lines.isEmpty())
+            continue;
+
+        QByteArray restoreInput = "*" + kFilterTable.toUtf8() + '\n';
+        restoreInput += lines.join('\n').toUtf8() + '\n';
+        restoreInput += "COMMIT\n";
+        if(commitRestore(ip, restoreInput))
+            continue;
+
+        qWarning() << "Unable to disable iptables filter anchors" << ipVersionTrace(ip)
+            << "with restore, disabling individually";
+        for(const auto &def : filterAnchorDefs)
+        {
+            if(def.family == family)
+                disableAnchorCmd(ip, def.anchor, kFilterTable);
+        }
+    }
 }
 
 void IpTablesFirewall::uninstall()
 {
+    committedAnchors.clear();
+
+    // Delete the nftables tables if they're active.  Tables could also have
+    // been left behind by a prior run that used the nftables backend and
+    // didn't shut down cleanly; check for those once, on the first uninstall
+    // (install() uninstalls first).  Otherwise, don't load libnl or send a
+    // transaction when nftables was never used.
+    if(pNftables)
+        pNftables->uninstall();
+    else if((nftablesSelected || !leftoverTablesChecked) && libnl::load())
+        NftablesFirewall{kAnchorName}.uninstall();
+    leftoverTablesChecked = true;
+    pNftables.reset();
+    filterAnchorDefs.clear();
 
     execute(QStringLiteral("ip rule del lookup main suppress_prefixlength 1 prio %1").arg(Routing::Priorities::suppressedMain));
     execute(QStringLiteral("ip -6 rule del lookup main suppress_prefixlength 1 prio %1").arg(Routing::Priorities::suppressedMain));
@@ -592,6 +1170,25 @@ void IpTablesFirewall::enableAnchor(IpTablesFirewall::IPVersion ip, const QStrin
         enableAnchor(IPv6, anchor, tableName);
         return;
     }
+    if(batchOpen)
+    {
+        pendingAnchor(ip, anchor, tableName).enabled = true;
+        return;
+    }
+    if(isNftablesAnchor(AnchorId{ip, tableName, anchor}))
+    {
+        // nftables anchors can only be changed by a batch
+        beginBatch();
+        enableAnchor(ip, anchor, tableName);
+        commitBatch();
+        return;
+    }
+    forgetCommittedAnchor(ip, anchor, tableName);
+    enableAnchorCmd(ip, anchor, tableName);
+}
+
+void IpTablesFirewall::enableAnchorCmd(IpTablesFirewall::IPVersion ip, const QString &anchor, const QString& tableName)
+{
     const QString cmd = getCommand(ip);
     const QString ipStr = ip == IPv6 ? QStringLiteral("(IPv6)") : QStringLiteral("(IPv4)");
 
@@ -606,8 +1203,26 @@ void IpTablesFirewall::replaceAnchor(IpTablesFirewall::IPVersion ip, const QStri
         replaceAnchor(IPv6, anchor, newRules, tableName);
         return;
     }
+    if(batchOpen)
+    {
+        pendingAnchor(ip, anchor, tableName).rules = newRules;
+        return;
+    }
+    if(isNftablesAnchor(AnchorId{ip, tableName, anchor}))
+    {
+        // nftables anchors can only be changed by a batch
+        beginBatch();
+        replaceAnchor(ip, anchor, newRules, tableName);
+        commitBatch();
+        return;
+    }
+    forgetCommittedAnchor(ip, anchor, tableName);
+    replaceAnchorCmd(ip, anchor, newRules, tableName);
+}
+
+void IpTablesFirewall::replaceAnchorCmd(IpTablesFirewall::IPVersion ip, const QString &anchor, const QStringList &newRules, const QString& tableName)
+{
     const QString cmd = getCommand(ip);
-    const QString ipStr = ip == IPv6 ? QStringLiteral("(IPv6)") : QStringLiteral("(IPv4)");
 
     // To replace the anchor atomically:
     // 1. Rename the old "rule" chain (see model in installAnchor())
@@ -641,6 +1256,25 @@ void IpTablesFirewall::disableAnchor(IpTablesFirewall::IPVersion ip, const QStri
         disableAnchor(IPv6, anchor, tableName);
         return;
     }
+    if(batchOpen)
+    {
+        pendingAnchor(ip, anchor, tableName).enabled = false;
+        return;
+    }
+    if(isNftablesAnchor(AnchorId{ip, tableName, anchor}))
+    {
+        // nftables anchors can only be changed by a batch
+        beginBatch();
+        disableAnchor(ip, anchor, tableName);
+        commitBatch();
+        return;
+    }
+    forgetCommittedAnchor(ip, anchor, tableName);
+    disableAnchorCmd(ip, anchor, tableName);
+}
+
+void IpTablesFirewall::disableAnchorCmd(IpTablesFirewall::IPVersion ip, const QString &anchor, const QString& tableName)
+{
     const QString cmd = getCommand(ip);
     const QString ipStr = ip == IPv6 ? QStringLiteral("(IPv6)") : QStringLiteral("(IPv4)");
     execute(QStringLiteral("if ! %1 -w -C %5.a.%2 -j %5.%2 -t %4 2> /dev/null ; then echo '%2%3: OFF' ; else echo '%2%3: ON -> OFF' ; %1 -w -F %5.a.%2 -t %4; fi").arg(cmd, anchor, ipStr, tableName, kAnchorName));
@@ -660,6 +1294,170 @@ void IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::IPVersion ip, const QS
         disableAnchor(ip, anchor, tableName);
 }
 
+void IpTablesFirewall::beginBatch()
+{
+    Q_ASSERT(!batchOpen);
+    pendingAnchors.clear();
+    batchOpen = true;
+}
+
+bool IpTablesFirewall::commitRestore(IpTablesFirewall::IPVersion ip, const QByteArray &restoreInput)
+{
+    static Executor iptablesRestoreExecutor{CURRENT_CATEGORY};
+    const QString restoreCmd = ip == IPv6 ? QStringLiteral("ip6tables-restore") : QStringLiteral("iptables-restore");
+    // --noflush - only the chains declared in the input are flushed, all
+    // other rules are kept.  Each table is committed atomically.
+    return iptablesRestoreExecutor.cmdWithInput(restoreCmd, {QStringLiteral("--noflush")},
+                                                restoreInput) == 0;
+}
+
+void IpTablesFirewall::commitBatch()
+{
+    Q_ASSERT(batchOpen);
+    batchOpen = false;
+    std::map<AnchorId, AnchorContent> pending;
+    pending.swap(pendingAnchors);
+
+    // If nftables fails, it's removed once the anchors have been applied with
+    // iptables instead
+    std::unique_ptr<NftablesFirewall> pFailedNftables;
+    if(pNftables)
+    {
+        // Apply the nftables anchors in one transaction for both families
+        std::vector<NftablesFirewall::AnchorChange> nftChanges;
+        std::map<AnchorId, AnchorContent> changes;
+        for(auto itPending = pending.begin(); itPending != pending.end(); )
+        {
+            const AnchorId &id = itPending->first;
+            if(!isNftablesAnchor(id))
+            {
+                ++itPending;
+                continue;
+            }
+
+            AnchorContent change;
+            if(findAnchorChange(id, itPending->second, change))
+            {
+                if(change.enabled)
+                {
+                    qInfo().noquote() << QStringLiteral("%1%2: %3").arg(std::get<AnchorName>(id),
+                        ipVersionTrace(std::get<AnchorIpVersion>(id)),
+                        change.enabled.get() ? QStringLiteral("ON") : QStringLiteral("OFF"));
+                }
+                nftChanges.push_back({nftFamily(std::get<AnchorIpVersion>(id)),
+                                      std::get<AnchorName>(id), change.enabled,
+                                      change.rules});
+                changes.emplace(id, std::move(change));
+            }
+            itPending = pending.erase(itPending);
+        }
+
+        try
+        {
+            pNftables->commit(nftChanges);
+            storeCommittedChanges(changes);
+        }
+        catch(const std::exception &ex)
+        {
+            // Revert to iptables for the filter anchors.  Apply the complete
+            // state of those anchors with iptables below.
+            qWarning() << "Unable to commit firewall batch with nftables, reverting to iptables -"
+                << ex.what();
+            pFailedNftables.swap(pNftables);
+            replayFilterAnchors(pending, changes);
+        }
+    }
+
+    for(IPVersion ip : {IPv4, IPv6})
+    {
+        // The restore input for each table, and the anchor changes it applies
+        std::map<QString, QStringList> tableLines;
+        std::map<AnchorId, AnchorContent> changes;
+
+        for(const auto &pendingEntry : pending)
+        {
+            const AnchorId &id = pendingEntry.first;
+            if(std::get<AnchorIpVersion>(id) != ip)
+                continue;
+            const QString &tableName = std::get<AnchorTable>(id);
+            const QString &anchor = std::get<AnchorName>(id);
+
+            auto itCommitted = committedAnchors.find(id);
+            const AnchorContent *pCommitted = itCommitted == committedAnchors.end() ?
+                nullptr : &itCommitted->second;
+
+            AnchorContent change;
+            if(!findAnchorChange(id, pendingEntry.second, change))
+                continue;   // Nothing changed in this anchor
+
+            QStringList &lines = tableLines[tableName];
+            // Declaring a chain with --noflush flushes it (or creates it if it
+            // doesn't exist), then the new content is appended.  Since the
+            // whole table is committed at once, this replaces the rule chain
+            // atomically, there's no need to pivot to a new chain like
+            // replaceAnchorCmd() does.
+            if(change.enabled)
+            {
+                const bool wasEnabled = pCommitted && pCommitted->enabled && pCommitted->enabled.get();
+                qInfo().noquote() << QStringLiteral("%1%2: %3 -> %4").arg(anchor, ipVersionTrace(ip),
+                    wasEnabled ? QStringLiteral("ON") : QStringLiteral("OFF"),
+                    change.enabled.get() ? QStringLiteral("ON") : QStringLiteral("OFF"));
+                lines << QStringLiteral(":%1.a.%2 - [0:0]").arg(kAnchorName, anchor);
+                if(change.enabled.get())
+                    lines << QStringLiteral("-A %1.a.%2 -j %1.%2").arg(kAnchorName, anchor);
+            }
+            if(change.rules)
+            {
+                lines << QStringLiteral(":%1.r.%2 - [0:0]").arg(kAnchorName, anchor);
+                for(const auto &rule : change.rules.get())
+                    lines << QStringLiteral("-A %1.r.%2 %3").arg(kAnchorName, anchor, rule);
+            }
+            changes.emplace(id, std::move(change));
+        }
+
+        if(changes.empty())
+            continue;
+
+        QByteArray restoreInput;
+        for(const auto &table : tableLines)
+        {
+            restoreInput += '*' + table.first.toUtf8() + '\n';
+            restoreInput += table.second.join('\n').toUtf8() + '\n';
+            restoreInput += "COMMIT\n";
+        }
+
+        if(commitRestore(ip, restoreInput))
+        {
+            storeCommittedChanges(changes);
+            continue;
+        }
+
+        // iptables-restore failed (the xtables lock could be held, or the
+        // restore utility might not be available).  Apply the changes with
+        // individual commands instead.
+        qWarning() << "Unable to commit firewall batch" << ipVersionTrace(ip)
+            << "with restore, applying" << changes.size() << "anchors individually";
+        for(const auto &change : changes)
+        {
+            const QString &tableName = std::get<AnchorTable>(change.first);
+            const QString &anchor = std::get<AnchorName>(change.first);
+            committedAnchors.erase(change.first);
+            if(change.second.rules)
+                replaceAnchorCmd(ip, anchor, change.second.rules.get(), tableName);
+            if(change.second.enabled)
+            {
+                if(change.second.enabled.get())
+                    enableAnchorCmd(ip, anchor, tableName);
+                else
+                    disableAnchorCmd(ip, anchor, tableName);
+            }
+        }
+    }
+
+    if(pFailedNftables)
+        pFailedNftables->uninstall();
+}
+
 // Ensure we can route 127.* so that we can rewrite source ips for DNS
 void IpTablesFirewall::enableRouteLocalNet()
 {
@@ -712,21 +1510,9 @@ void IpTablesFirewall::updateRules(const FirewallParams &params)
     if(adapterName != _adapterName)
     {
         if(adapterName.isEmpty())
-        {
-            // Don't know the adapter name, wipe out the rules
             qInfo() << "Clearing allowVPN and allowHnsd rules, adapter name is not known";
-            replaceAnchor(IpTablesFirewall::Both, QStringLiteral("200.allowVPN"), {});
-            replaceAnchor(IpTablesFirewall::Both, QStringLiteral("350.allowHnsd"), {});
-        }
-        else
-        {
-            replaceAnchor(IpTablesFirewall::Both, QStringLiteral("200.allowVPN"), { QStringLiteral("-o %1 -j ACCEPT").arg(adapterName) });
-            replaceAnchor(IpTablesFirewall::Both, QStringLiteral("350.allowHnsd"), {
-                QStringLiteral("-m owner --gid-owner %1 -o %2 -p tcp --match multiport --dports 53,13038 -j ACCEPT").arg(IpTablesFirewall::kHnsdGroupName, adapterName),
-                QStringLiteral("-m owner --gid-owner %1 -o %2 -p udp --match multiport --dports 53,13038 -j ACCEPT").arg(IpTablesFirewall::kHnsdGroupName, adapterName),
-                QStringLiteral("-m owner --gid-owner %1 -j REJECT").arg(IpTablesFirewall::kHnsdGroupName),
-            });
-        }
+        replaceAnchor(IpTablesFirewall::Both, QStringLiteral("200.allowVPN"), getAllowVpnRules(adapterName));
+        replaceAnchor(IpTablesFirewall::Both, QStringLiteral("350.allowHnsd"), getAllowHnsdRules(adapterName));
     }
 
     if(ipAddress6 != _ipAddress6)
@@ -739,10 +1525,8 @@ void IpTablesFirewall::updateRules(const FirewallParams &params)
         }
         else
         {
-            // First 64 bits is the IPv6 Network Prefix. This prefix is shared by all IPv6 hosts on the LAN,
-            // so whitelisting it allows those hosts to communicate
             replaceAnchor(IPv6, QStringLiteral("299.allowIPv6Prefix"),
-                          {QStringLiteral("-d %2/64 -j ACCEPT").arg(ipAddress6)});
+                          getAllowIPv6PrefixRules(ipAddress6));
             replaceAnchor(IPv6, QStringLiteral("299.blockFwdIPv6Prefix"),
                           {QStringLiteral("-d %2/64 -j REJECT").arg(ipAddress6)});
         }
@@ -823,14 +1607,14 @@ void IpTablesFirewall::updateRules(const FirewallParams &params)
                 .arg(appDnsInfo.dnsServer(), appDnsInfo.cGroupId(),
                      appDnsInfo.sourceIp());
             replaceAnchor(IpTablesFirewall::IPv4, QStringLiteral("90.snatDNS"), {
-                QStringLiteral("-p udp -m cgroup --cgroup %1 -m udp --dport 53 -j SNAT --to-source %2").arg(appDnsInfo.cGroupId()).arg(appDnsInfo.sourceIp()),
-                QStringLiteral("-p tcp -m cgroup --cgroup %1 -m tcp --dport 53 -j SNAT --to-source %2").arg(appDnsInfo.cGroupId()).arg(appDnsInfo.sourceIp()),
+                QStringLiteral("-p udp -m cgroup %1 -m udp --dport 53 -j SNAT --to-source %2").arg(CGroup::iptablesMatch(appDnsInfo.cGroupId())).arg(appDnsInfo.sourceIp()),
+                QStringLiteral("-p tcp -m cgroup %1 -m tcp --dport 53 -j SNAT --to-source %2").arg(CGroup::iptablesMatch(appDnsInfo.cGroupId())).arg(appDnsInfo.sourceIp()),
             },
             kNatTable);
 
             replaceAnchor(IpTablesFirewall::IPv4, QStringLiteral("80.splitDNS"), {
-                QStringLiteral("-p udp -m cgroup --cgroup %1 -m udp --dport 53 -j DNAT --to-destination %2:53").arg(appDnsInfo.cGroupId()).arg(appDnsInfo.dnsServer()),
-                QStringLiteral("-p tcp -m cgroup --cgroup %1 -m tcp --dport 53 -j DNAT --to-destination %2:53").arg(appDnsInfo.cGroupId()).arg(appDnsInfo.dnsServer()),
+                QStringLiteral("-p udp -m cgroup %1 -m udp --dport 53 -j DNAT --to-destination %2:53").arg(CGroup::iptablesMatch(appDnsInfo.cGroupId())).arg(appDnsInfo.dnsServer()),
+                QStringLiteral("-p tcp -m cgroup %1 -m tcp --dport 53 -j DNAT --to-destination %2:53").arg(CGroup::iptablesMatch(appDnsInfo.cGroupId())).arg(appDnsInfo.dnsServer()),
             },
             kNatTable);
         }
@@ -856,68 +1640,11 @@ void IpTablesFirewall::updateRules(const FirewallParams &params)
         effectiveDnsServers = params._connectionSettings->getDnsServers();
     if(effectiveDnsServers != _dnsServers || adapterName != _adapterName)
     {
-        // If the adapter name isn't set, getDNSRules() returns an empty list
-        QStringList ruleList = getDNSRules(adapterName, effectiveDnsServers);
-
-        if(!ruleList.isEmpty() && params.enableSplitTunnel)
-        {
-            // DNS leak protection for vpnOnly apps.
-            // In rare situations, when making a DNS request, a vpnOnly app could re-use the port
-            // previously used by a bypass app. When this happens, iptables causes the vpnOnly DNS request
-            // to get routed the same way as the bypass request - causing a DNS leak.
-            // We guard against this below.
-            if(params._connectionSettings && params._connectionSettings->forceVpnOnlyDns())
-            {
-                const auto vpnOnlyServersStr = QStringList{appDnsInfo.dnsServer()}.join(',');
-                // When the VPN does not have the default route, allow
-                // the vpnOnly DNS servers
-                ruleList << QStringLiteral("-p udp -m cgroup --cgroup %1 -m udp --dport 53 -d %2 -j ACCEPT").arg(CGroup::vpnOnlyId, vpnOnlyServersStr);
-                ruleList << QStringLiteral("-p tcp -m cgroup --cgroup %1 -m tcp --dport 53 -d %2 -j ACCEPT").arg(CGroup::vpnOnlyId, vpnOnlyServersStr);
-                // And block everything else
-                // Doing this prevents a vpnOnly app re-using a port/route used by a bypass app
-                ruleList << QStringLiteral("-p udp -m cgroup --cgroup %1 -m udp --dport 53 -j REJECT").arg(CGroup::vpnOnlyId);
-                ruleList << QStringLiteral("-p tcp -m cgroup --cgroup %1 -m tcp --dport 53 -j REJECT").arg(CGroup::vpnOnlyId);
-
-                // Reject bypass apps from using vpnOnly DNS (prevents a bypass app re-using a vpnOnly port/route)
-                // If we didn't block this, it may allow bypass apps to make DNS requests over the VPN - this isn't technically a 'leak'
-                // but is still weird/unexpected behaviour, so we prevent it.
-                ruleList << QStringLiteral("-p udp -m cgroup --cgroup %1 -m udp --dport 53 -d %2 -j REJECT").arg(CGroup::bypassId, vpnOnlyServersStr);
-                ruleList << QStringLiteral("-p tcp -m cgroup --cgroup %1 -m tcp --dport 53 -d %2 -j REJECT").arg(CGroup::bypassId, vpnOnlyServersStr);
-            }
-            else // VPN has default route
-            {
-                const auto bypassServersStr = QStringList{appDnsInfo.dnsServer()}.join(",");
-                // Allow configured DNS servers for bypass apps (VPN has the default route)
-
-                // Only apply our bypass leak protection if we have bypass DNS servers
-                // (we will not have bypass DNS servers if ST "Name Servers" is set to "Use VPN DNS Only" rather than "Follow App Rules")
-                if(!bypassServersStr.isEmpty())
-                {
-                    ruleList << QStringLiteral("-p udp -m cgroup --cgroup %1 -m udp --dport 53 -d %2 -j ACCEPT").arg(CGroup::bypassId, bypassServersStr);
-                    ruleList << QStringLiteral("-p tcp -m cgroup --cgroup %1 -m tcp --dport 53 -d %2 -j ACCEPT").arg(CGroup::bypassId, bypassServersStr);
-                    // And block everything else
-                    ruleList << QStringLiteral("-p udp -m cgroup --cgroup %1 -m udp --dport 53 -j REJECT").arg(CGroup::bypassId);
-                    ruleList << QStringLiteral("-p tcp -m cgroup --cgroup %1 -m tcp --dport 53 -j REJECT").arg(CGroup::bypassId);
-
-                    // When the VPN does have the default route, vpnOnly apps use the configured VPN DNS.
-                    // However, vpnOnly apps could still leak if a DNS request re-uses the route used by
-                    // by a prior bypass app. This happens when a vpnOnly app re-uses the source port of a bypass app within the UDP conntrack timeout.
-                    // To guard against this we block bypass DNS servers for any packet that is not part of the bypass cgroup.
-                    // NOTE: we cannot use the vpnOnly cgroup here as no apps are added to the vpnOnly cgroup when the VPN has
-                    // the default route.
-                    ruleList << QStringLiteral("-p udp -m cgroup ! --cgroup %1 -m udp --dport 53 -d %2 -j REJECT").arg(CGroup::bypassId, bypassServersStr);
-                    ruleList << QStringLiteral("-p tcp -m cgroup ! --cgroup %1 -m tcp --dport 53 -d %2 -j REJECT").arg(CGroup::bypassId, bypassServersStr);
-                }
-            }
-        }
-
-        // Re-allow localhost DNS now we've plugged the leaks.
-        // localhost DNS is important for systemd which uses a 127.0.0.53 DNS proxy
-        // for all DNS traffic.
-        ruleList << QStringLiteral("-o lo+ -p udp -m udp --dport 53 -j ACCEPT");
-        ruleList << QStringLiteral("-o lo+ -p tcp -m tcp --dport 53 -j ACCEPT");
-
-        replaceAnchor(IpTablesFirewall::IPv4, QStringLiteral("320.allowDNS"), ruleList);
+        const bool forceVpnOnlyDns = params._connectionSettings && params._connectionSettings->forceVpnOnlyDns();
+        replaceAnchor(IpTablesFirewall::IPv4, QStringLiteral("320.allowDNS"),
+                      getAllowDNSRules(adapterName, effectiveDnsServers,
+                                       params.enableSplitTunnel, forceVpnOnlyDns,
+                                       appDnsInfo.dnsServer()));
     }
 
     // Enable localhost routing
@@ -955,21 +1682,9 @@ void IpTablesFirewall::updateBypassSubnets(IpTablesFirewall::IPVersion ipVersion
         }
         else
         {
-            QStringList subnetAcceptRules;
-            for(const auto &subnet : bypassSubnets)
-                subnetAcceptRules << QStringLiteral("-d %1 -j ACCEPT").arg(subnet);
-
-
-            // If there's any IPv6 addresses then we also need to whitelist link-local and broadcast
-            // as these address ranges are needed for IPv6 Neighbor Discovery.
-            if(ipVersion == IPv6)
-            {
-                subnetAcceptRules << QStringLiteral("-d fe80::/10 -j ACCEPT");
-                subnetAcceptRules << QStringLiteral("-d ff00::/8 -j ACCEPT");
-            }
-
             IpTablesFirewall::replaceAnchor(ipVersion,
-                                            QStringLiteral("305.allowSubnets"), subnetAcceptRules);
+                                            QStringLiteral("305.allowSubnets"),
+                                            getAllowSubnetRules(ipVersion, bypassSubnets));
 
             QStringList subnetMarkRules;
             for(const auto &subnet : bypassSubnets)
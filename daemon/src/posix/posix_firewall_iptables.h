@@ -29,6 +29,8 @@
 #include <QStringList>
 #include <QHostAddress>
 #include "daemon.h"
+#include "linux/linux_nftables.h"
+#include <vector>
 
 struct FirewallParams;
 
@@ -102,6 +104,34 @@ private:
     // No rules are created if the VPN adapter name is not known yet.
     static QStringList getDNSRules(const QString &vpnAdapterName, const QStringList& servers);
     static int execute(const QString& command, bool ignoreErrors = false);
+    // Implementations of enableAnchor()/disableAnchor()/replaceAnchor() that
+    // execute commands immediately (used outside of a batch, or if a batch
+    // can't be committed with iptables-restore)
+    static void enableAnchorCmd(IPVersion ip, const QString& anchor, const QString& tableName);
+    static void disableAnchorCmd(IPVersion ip, const QString& anchor, const QString& tableName);
+    static void replaceAnchorCmd(IPVersion ip, const QString &anchor, const QStringList &newRules, const QString& tableName);
+    enum class AnchorCheck
+    {
+        Intact,
+        // The root anchors must be relinked at the top of their parent chains
+        Unprioritized,
+        // Some of our chains have been deleted, the firewall must be
+        // reinstalled
+        Missing,
+    };
+    // Check the anchors using one iptables-save - whether the root anchors are
+    // at the top of their parent chains, and whether the committed anchors
+    // are still in their committed state.  Committed state is forgotten for
+    // any anchor that was changed externally, so the next batch reapplies it.
+    static AnchorCheck checkAnchors(IPVersion ip);
+    // Commit a batch for one IP version with iptables-restore; returns false
+    // if the commit failed
+    static bool commitRestore(IPVersion ip, const QByteArray &restoreInput);
+    // Install the filter anchors with nftables if it has been selected.  If
+    // this fails, iptables is still used.
+    static void installNftables();
+    // Disable all iptables filter anchors (when switching to nftables)
+    static void disableIpTablesFilterAnchors();
     void enableRouteLocalNet();
     void disableRouteLocalNet();
 private:
@@ -119,6 +149,54 @@ public:
     static bool isAnchorEnabled(IPVersion ip, const QString& anchor, const QString& tableName = kFilterTable);
     static void setAnchorEnabled(IPVersion ip, const QString& anchor, bool enabled, const QString& tableName = kFilterTable);
     static void replaceAnchor(IpTablesFirewall::IPVersion ip, const QString &anchor, const QStringList &newRules, const QString& tableName = kFilterTable);
+
+    // Batch anchor updates.  Between beginBatch() and commitBatch(),
+    // enableAnchor(), disableAnchor(), setAnchorEnabled(), and replaceAnchor()
+    // just record the desired state of each anchor.  commitBatch() compares
+    // that to the state last committed and applies all changed anchors
+    // atomically with one iptables-restore per IP version (instead of several
+    // processes per anchor), falling back to individual commands if that
+    // fails.
+    //
+    // The committed state is reset when the firewall is installed or
+    // uninstalled, and anchors changed outside of a batch are always
+    // reapplied by the next batch.  ensureRootAnchorPriority() also forgets
+    // the state of anchors whose chains were changed by something else (or
+    // reinstalls the firewall if chains were deleted), so call it before a
+    // batch.
+    static void beginBatch();
+    static void commitBatch();
+
+    // Select nftables or iptables for the filter anchors.  With nftables, the
+    // filter anchors are installed in nftables tables, and each batch is
+    // applied with one netlink transaction (see NftablesFirewall).  The NAT,
+    // mangle, and raw anchors always use iptables.
+    //
+    // If the firewall is installed, the current anchor state is moved to the
+    // new backend immediately; otherwise this takes effect when it's
+    // installed.  If nftables can't be installed or a batch can't be
+    // committed with nftables, the filter anchors revert to iptables.
+    static void setNftablesEnabled(bool enabled);
+
+    // The filter anchors created by install(), with their initial rules, in
+    // order.  The filter anchor rules are also applied with nftables, so they
+    // (and the rules generated below for updateRules()) may only use options
+    // that Nftables::translateRules() supports.
+    static std::vector<NftablesFirewall::AnchorDef> filterAnchors();
+    // Rules for the filter anchors that are updated at runtime.  If
+    // adapterName is empty, the VPN and hnsd rules are empty.
+    static QStringList getAllowVpnRules(const QString &adapterName);
+    static QStringList getAllowHnsdRules(const QString &adapterName);
+    static QStringList getAllowIPv6PrefixRules(const QString &ipAddress6);
+    static QStringList getAllowSubnetRules(IPVersion ip, const QSet<QString> &subnets);
+    // All rules for 320.allowDNS - getDNSRules() for the DNS servers, leak
+    // protection for split tunnel DNS (using appDnsServer, the DNS server
+    // forced for VPN-only or bypass apps), and localhost DNS.
+    static QStringList getAllowDNSRules(const QString &adapterName,
+                                        const QStringList &servers,
+                                        bool enableSplitTunnel,
+                                        bool forceVpnOnlyDns,
+                                        const QString &appDnsServer);
     void updateRules(const FirewallParams &params);
     void updateBypassSubnets(IpTablesFirewall::IPVersion ipVersion, const QSet<QString> &bypassSubnets, QSet<QString> &oldBypassSubnets);
     QString existingDNS();
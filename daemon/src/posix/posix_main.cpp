@@ -114,7 +114,7 @@ int main(int argc, char** argv)
         QTextStream{stdout} << Version::semanticVersion() << Qt::endl;
         return 0;
     }
-    Logger logSingleton{Path::DaemonLogFile};
+    Logger logSingleton{Path::DaemonLogFile, Logger::WriteMode::Asynchronous};
 
     setUidAndGid();
 
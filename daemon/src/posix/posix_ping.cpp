@@ -25,10 +25,19 @@
 #include <QHostAddress>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
+#include <cstring>
 #include <netinet/ip.h>
 #include <fcntl.h>
 
+namespace
+{
+    // Echoes that haven't been answered after this long are forgotten.  This
+    // is longer than any caller waits for a reply.
+    const std::chrono::seconds pendingEchoTimeout{30};
+}
+
 PosixPing::PosixPing()
     : _identifier{static_cast<quint16>(QRandomGenerator::global()->bounded(std::numeric_limits<quint16>::max()))},
       _nextSequence{0}
@@ -49,6 +58,17 @@ PosixPing::PosixPing()
       qWarning() << "Failed to set IP_HDRINCL flag on ICMP socket";
     }
 
+    // Request kernel receive timestamps, so the round trip time isn't affected
+    // by any delay in processing replies.
+#if defined(SO_TIMESTAMPNS)
+    if(::setsockopt(_icmpSocket.get(), SOL_SOCKET, SO_TIMESTAMPNS, &val, sizeof(val)) < 0)
+#else
+    if(::setsockopt(_icmpSocket.get(), SOL_SOCKET, SO_TIMESTAMP, &val, sizeof(val)) < 0)
+#endif
+    {
+        qWarning() << "Failed to enable receive timestamps on ICMP socket:" << errno;
+    }
+
     // apply NONBLOCK flag
     int oldFlags = ::fcntl(_icmpSocket.get(), F_GETFL);
     ::fcntl(_icmpSocket.get(), F_SETFL, oldFlags | O_NONBLOCK);
@@ -82,9 +102,28 @@ quint16 PosixPing::calcChecksum(const quint8 *data, std::size_t len) const
     return ~static_cast<quint16>(accum);
 }
 
+void PosixPing::addPendingEcho(quint32 address, quint16 sequence)
+{
+    auto now = Clock::now();
+    while(!_echoSendOrder.empty() && now - _echoSendOrder.front().first >= pendingEchoTimeout)
+    {
+        // Erase the echo only if it wasn't answered and hasn't been sent again
+        // since then (the sequence wrapped around)
+        auto itEcho = _pendingEchoes.find(_echoSendOrder.front().second);
+        if(itEcho != _pendingEchoes.end() && itEcho->second == _echoSendOrder.front().first)
+            _pendingEchoes.erase(itEcho);
+        _echoSendOrder.pop_front();
+    }
+    _pendingEchoes[{address, sequence}] = now;
+    _echoSendOrder.push_back({now, {address, sequence}});
+}
+
 bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFragment)
 {
+    quint16 sequence = _nextSequence++;
 #ifdef UNIT_TEST
+    // Record the echo so unit tests can process replies to it
+    addPendingEcho(address, sequence);
     // Fake this in unit tests since we can't send real ICMP pings when not run
     // as root.
     // Unit tests use the IPv4 documentation range to test a lack of response,
@@ -92,7 +131,10 @@ bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFrag
     if((address & 0xFFFFFF00) != 0xC0000200)    // 192.0.2.0/24
     {
         qInfo() << "Mocking ping to" << QHostAddress{address};
-        QTimer::singleShot(30, this, [this, address]{emit receivedReply(address);});
+        QTimer::singleShot(30, this, [this, address]
+        {
+            emit receivedReply(address, std::chrono::milliseconds{30});
+        });
     }
     return true;
 #endif
@@ -128,31 +170,14 @@ bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFrag
     pEcho->code = 0;
     pEcho->checksum = 0;
     pEcho->identifier = htons(_identifier);
-    pEcho->sequence = htons(_nextSequence);
+    pEcho->sequence = htons(sequence);
 
-    ++_nextSequence;
-    // The default payload on Mac/Linux is 56 bytes from 0x00 - 0x37.  The first
-    // few bytes are replaced with a timestamp.
+    // The default payload on Mac/Linux is 56 bytes from 0x00 - 0x37.
     for(int i = 0; i < payloadSize; ++i)
     {
         packet[sizeof(IcmpEcho)+i] = i;
     }
 
-    timeval now{};
-    gettimeofday(&now, nullptr);
-
-    // The timestamp is written with 32-bit fields on Mac / 64-bit fields on Linux
-#ifdef Q_OS_MAC
-    using TimestampField = quint32;
-#else
-    using TimestampField = quint64;
-#endif
-
-    TimestampField *pWritePos = reinterpret_cast<TimestampField*>(&packet[sizeof(IcmpEcho)]);
-    *pWritePos = static_cast<TimestampField>(now.tv_sec);
-    ++pWritePos;
-    *pWritePos = static_cast<TimestampField>(now.tv_usec);
-
     // Compute the checksum.  Add into a 32-bit accumulator, then fold the
     // carries in.
     pEcho->checksum = calcChecksum(packet, packetSize);
@@ -171,6 +196,10 @@ bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFrag
 #endif
     }
 
+    // Record the send time right before sending.  If the send fails, the
+    // entry is just forgotten later.
+    addPendingEcho(address, sequence);
+
     // Write the packet
     sockaddr_in to;
     to.sin_family = AF_INET;
@@ -202,7 +231,48 @@ bool PosixPing::sendEchoRequest(quint32 address, int payloadSize, bool allowFrag
     return true;
 }
 
-void PosixPing::onReadyRead()
+auto PosixPing::receiveTime(const msghdr &message, const timespec &realtimeNow,
+                            Clock::time_point steadyNow) -> Clock::time_point
+{
+    nullable_t<timespec> received;
+    for(const cmsghdr *pCmsg = CMSG_FIRSTHDR(&message); pCmsg && received.isNull();
+        pCmsg = CMSG_NXTHDR(const_cast<msghdr*>(&message), const_cast<cmsghdr*>(pCmsg)))
+    {
+        if(pCmsg->cmsg_level != SOL_SOCKET)
+            continue;
+#if defined(SCM_TIMESTAMPNS)
+        if(pCmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            timespec timestamp{};
+            std::memcpy(&timestamp, CMSG_DATA(pCmsg), sizeof(timestamp));
+            received = timestamp;
+        }
+#endif
+        if(pCmsg->cmsg_type == SCM_TIMESTAMP)
+        {
+            timeval timestampTv{};
+            std::memcpy(&timestampTv, CMSG_DATA(pCmsg), sizeof(timestampTv));
+            timespec timestamp{};
+            timestamp.tv_sec = timestampTv.tv_sec;
+            timestamp.tv_nsec = timestampTv.tv_usec * 1000;
+            received = timestamp;
+        }
+    }
+
+    // No timestamp (the socket option couldn't be enabled), use the current
+    // time
+    if(received.isNull())
+        return steadyNow;
+
+    auto age = std::chrono::seconds{realtimeNow.tv_sec - received->tv_sec} +
+        std::chrono::nanoseconds{realtimeNow.tv_nsec - received->tv_nsec};
+    if(age < Clock::duration::zero())
+        return steadyNow;
+    return steadyNow - std::chrono::duration_cast<Clock::duration>(age);
+}
+
+void PosixPing::processPacket(const quint8 *pPacket, std::size_t size,
+                              Clock::time_point received)
 {
     struct Ipv4
     {
@@ -218,28 +288,18 @@ void PosixPing::onReadyRead()
         quint32 dest;
     };
 
-    alignas(Ipv4) std::array<quint8, 2048> packet;
-    auto read = recv(_icmpSocket.get(), packet.data(), packet.size(), 0);
-    if(read < 0)
+    if(size < sizeof(Ipv4))
     {
-        // Shouldn't happen, socket said it was ready
-        qWarning() << "Failed to read from ICMP socket -" << read << "- err:"
-            << errno;
-        return;
-    }
-
-    if(static_cast<std::size_t>(read) < sizeof(Ipv4))
-    {
-        qWarning() << "Read incomplete packet of" << read << "bytes, expected"
+        qWarning() << "Read incomplete packet of" << size << "bytes, expected"
             << sizeof(Ipv4) << "bytes";
         return;
     }
 
-    const Ipv4 *pIpHdr = reinterpret_cast<const Ipv4*>(packet.data());
+    const Ipv4 *pIpHdr = reinterpret_cast<const Ipv4*>(pPacket);
 
     // Ignore the packet length from the IP header - the kernel has already
     // manipulated it (converted to host byte order and subtracted header
-    // length).  'read' tells us how long the packet is.
+    // length).  'size' tells us how long the packet is.
 
     if((pIpHdr->version_ihl >> 4) != 4)
     {
@@ -248,11 +308,11 @@ void PosixPing::onReadyRead()
     }
 
     std::size_t headerBytes = (pIpHdr->version_ihl & 0x0F) * 4;
-    if(headerBytes < 20 || static_cast<std::size_t>(read) < headerBytes ||
-       read - headerBytes < sizeof(IcmpEcho))
+    if(headerBytes < 20 || size < headerBytes ||
+       size - headerBytes < sizeof(IcmpEcho))
     {
         qWarning() << "Invalid IP header length:" << headerBytes
-            << "bytes (read" << read << "bytes)";
+            << "bytes (read" << size << "bytes)";
         return;
     }
 
@@ -264,14 +324,14 @@ void PosixPing::onReadyRead()
     }
 
     // Check ICMP checksum
-    if(calcChecksum(packet.data() + headerBytes, read - headerBytes))
+    if(calcChecksum(pPacket + headerBytes, size - headerBytes))
     {
         qWarning() << "Received corrupt ICMP packet from"
             << QHostAddress{ntohl(pIpHdr->src)}.toString();
     }
 
     // Find the ICMP header
-    const IcmpEcho *pEchoReply = reinterpret_cast<const IcmpEcho*>(packet.data() + headerBytes);
+    const IcmpEcho *pEchoReply = reinterpret_cast<const IcmpEcho*>(pPacket + headerBytes);
     // If it's not an echo reply, not ours, etc., just ignore it.
     if(pEchoReply->type != 0 || pEchoReply->code != 0 ||
        ntohs(pEchoReply->identifier) != _identifier)
@@ -280,6 +340,100 @@ void PosixPing::onReadyRead()
         return;
     }
 
-    // It's our reply - emit the response.
-    emit receivedReply(ntohl(pIpHdr->src));
+    // It's our reply - find the echo it answers.  If there isn't one, this is
+    // a duplicate or late reply, or it wasn't sent in response to our echo.
+    // (Don't trace, duplicates could happen a lot.)
+    quint32 source = ntohl(pIpHdr->src);
+    auto itEcho = _pendingEchoes.find({source, ntohs(pEchoReply->sequence)});
+    if(itEcho == _pendingEchoes.end())
+        return;
+    auto roundTrip = std::chrono::duration_cast<std::chrono::microseconds>(received - itEcho->second);
+    _pendingEchoes.erase(itEcho);
+
+    // Only possible if the kernel timestamp is wrong, but don't emit a
+    // nonsensical measurement.
+    if(roundTrip < std::chrono::microseconds{0})
+    {
+        qWarning() << "Ignoring reply from" << QHostAddress{source}.toString()
+            << "with negative round trip time" << roundTrip.count() << "us";
+        return;
+    }
+
+    emit receivedReply(source, roundTrip);
+}
+
+void PosixPing::onReadyRead()
+{
+    alignas(quint32) std::array<std::array<quint8, PacketBufferSize>, ReadBatchSize> packets;
+    alignas(cmsghdr) std::array<std::array<quint8, ControlBufferSize>, ReadBatchSize> controls;
+    std::array<iovec, ReadBatchSize> iovecs;
+
+#if defined(Q_OS_LINUX)
+    // Drain all queued replies, reading a batch at a time with recvmmsg().
+    // Replies to a batch of pings tend to arrive close together, so this
+    // usually reads all of them with one call.
+    std::array<mmsghdr, ReadBatchSize> messages;
+    while(true)
+    {
+        for(std::size_t i=0; i<ReadBatchSize; ++i)
+        {
+            iovecs[i].iov_base = packets[i].data();
+            iovecs[i].iov_len = packets[i].size();
+            messages[i] = {};
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_control = controls[i].data();
+            messages[i].msg_hdr.msg_controllen = controls[i].size();
+        }
+
+        int count = ::recvmmsg(_icmpSocket.get(), messages.data(), ReadBatchSize,
+                               MSG_DONTWAIT, nullptr);
+        if(count < 0)
+        {
+            // EWOULDBLOCK just means all replies have been read
+            if(errno != EWOULDBLOCK && errno != EAGAIN)
+                qWarning() << "Failed to read from ICMP socket - err:" << errno;
+            return;
+        }
+
+        timespec realtimeNow{};
+        ::clock_gettime(CLOCK_REALTIME, &realtimeNow);
+        auto steadyNow = Clock::now();
+        for(int i=0; i<count; ++i)
+        {
+            processPacket(packets[i].data(), messages[i].msg_len,
+                          receiveTime(messages[i].msg_hdr, realtimeNow, steadyNow));
+        }
+
+        // If the batch wasn't filled, there's nothing left to read
+        if(count < ReadBatchSize)
+            return;
+    }
+#else
+    // No recvmmsg() on Mac; drain the replies one at a time.
+    while(true)
+    {
+        iovecs[0].iov_base = packets[0].data();
+        iovecs[0].iov_len = packets[0].size();
+        msghdr message{};
+        message.msg_iov = &iovecs[0];
+        message.msg_iovlen = 1;
+        message.msg_control = controls[0].data();
+        message.msg_controllen = controls[0].size();
+
+        auto read = ::recvmsg(_icmpSocket.get(), &message, MSG_DONTWAIT);
+        if(read < 0)
+        {
+            // EWOULDBLOCK just means all replies have been read
+            if(errno != EWOULDBLOCK && errno != EAGAIN)
+                qWarning() << "Failed to read from ICMP socket - err:" << errno;
+            return;
+        }
+
+        timespec realtimeNow{};
+        ::clock_gettime(CLOCK_REALTIME, &realtimeNow);
+        processPacket(packets[0].data(), static_cast<std::size_t>(read),
+                      receiveTime(message, realtimeNow, Clock::now()));
+    }
+#endif
 }
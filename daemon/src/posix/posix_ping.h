@@ -22,6 +22,11 @@
 #include "common.h"
 #include "posix_objects.h"
 #include <QSocketNotifier>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <time.h>
+#include <sys/socket.h>
 
 // Open an ICMP socket and send pings on Mac/Linux.
 // An identifier is chosen randomly when the object is created; responses are
@@ -29,6 +34,12 @@
 //
 // It is possible (but unlikely) that duplicate or spurious responses could be
 // emitted if they happen to have that identifier.
+//
+// The send time of each echo is kept locally on the monotonic clock, keyed by
+// the destination and sequence number, and the socket requests kernel receive
+// timestamps.  The round trip time of each reply is measured per-echo without
+// trusting anything in the reply's payload, and doesn't include any delay in
+// processing the reply on the event loop.
 class PosixPing : public QObject
 {
     Q_OBJECT
@@ -37,7 +48,13 @@ private:
     enum
     {
         // Size of payload included in echoes
-        PayloadSize = 56
+        PayloadSize = 56,
+        // Maximum number of replies read at once with recvmmsg()
+        ReadBatchSize = 16,
+        // Size of the buffer used to read each packet
+        PacketBufferSize = 2048,
+        // Size of the control buffer used to read each packet's timestamp
+        ControlBufferSize = 64,
     };
     struct IcmpEcho
     {
@@ -48,22 +65,49 @@ private:
         quint16 sequence;
     };
 
+public:
+    using Clock = std::chrono::steady_clock;
+
 public:
     PosixPing();
 
 private:
     quint16 calcChecksum(const quint8 *data, std::size_t len) const;
+    // Record the send time of an echo, and forget echoes that are too old to
+    // still be answered.  Only the expired echoes at the front of
+    // _echoSendOrder are visited, so this is constant time on average.
+    void addPendingEcho(quint32 address, quint16 sequence);
 
 public:
     // Send an ICMP echo request.  If a reply is received, it will be signaled
     // with receivedReply().
     bool sendEchoRequest(quint32 address, int payloadSize = 32, bool allowFragment = true);
 
+    // The remaining methods are public for unit tests.
+
+    // Identifier used in our echoes
+    quint16 identifier() const {return _identifier;}
+
+    // Get the time a message was received on the steady clock.  The kernel
+    // receive timestamp is on the realtime clock, so the message's age is
+    // measured on that clock (against realtimeNow) and subtracted from
+    // steadyNow.  Returns steadyNow if the message has no timestamp, or if the
+    // timestamp is in the future (the realtime clock was stepped back).
+    static Clock::time_point receiveTime(const msghdr &message,
+                                         const timespec &realtimeNow,
+                                         Clock::time_point steadyNow);
+    // Process a packet read from the ICMP socket.  If it's the first reply to
+    // one of our pending echoes, receivedReply() is emitted.
+    void processPacket(const quint8 *pPacket, std::size_t size,
+                       Clock::time_point received);
+
 private:
     void onReadyRead();
 
 signals:
-    void receivedReply(quint32 address);
+    // A reply was received.  roundTrip is the time from sending the echo to
+    // receiving the reply.
+    void receivedReply(quint32 address, std::chrono::microseconds roundTrip);
 
 private:
     PosixFd _icmpSocket;
@@ -72,6 +116,13 @@ private:
     nullable_t<QSocketNotifier> _pReadNotifier;
     quint16 _identifier;
     quint16 _nextSequence;
+    // Send times of echoes that haven't been answered yet, by destination
+    // address and sequence number
+    std::map<std::pair<quint32, quint16>, Clock::time_point> _pendingEchoes;
+    // Every echo sent in the last pendingEchoTimeout, in the order sent.  An
+    // echo that was answered remains here until it expires; it's just no
+    // longer in _pendingEchoes.
+    std::deque<std::pair<Clock::time_point, std::pair<quint32, quint16>>> _echoSendOrder;
 };
 
 #endif
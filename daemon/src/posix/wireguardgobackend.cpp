@@ -622,6 +622,24 @@ auto WireguardGoBackend::getStatus() -> Async<WgDevPtr>
         });
 }
 
+#ifdef Q_OS_LINUX
+auto WireguardGoBackend::getTrafficStats() -> Async<TrafficStats>
+{
+    if(_interfaceName.isEmpty())
+    {
+        // Never got the interface name
+        return Async<TrafficStats>::reject({HERE, Error::Code::WireguardCreateDeviceFailed});
+    }
+
+    // Like the kernel backend, the tun device counts the tunneled traffic,
+    // not including WireGuard's overhead
+    LinkStatsReader::Counters counters{};
+    if(!_linkStats.read(_interfaceName, counters))
+        return Async<TrafficStats>::reject({HERE, Error::Code::WireguardDeviceLost});
+    return Async<TrafficStats>::resolve(TrafficStats{counters.rxBytes, counters.txBytes});
+}
+#endif
+
 Async<void> WireguardGoBackend::shutdown()
 {
     // If an async connection attempt was ongoing, abandon it (prevents spurious
@@ -29,6 +29,9 @@
 #include "async.h"
 #include "vpn.h"
 #include <QLocalSocket>
+#ifdef Q_OS_LINUX
+#include "linux/linux_linkstats.h"
+#endif
 
 // ProcessRunner that applies the interface name file environment variable on
 // Mac.
@@ -72,6 +75,12 @@ public:
 
     virtual Async<WgDevPtr> getStatus() override;
 
+#ifdef Q_OS_LINUX
+    // On Linux, reads the tun device's link stats instead of making an IPC
+    // request
+    virtual Async<TrafficStats> getTrafficStats() override;
+#endif
+
     virtual Async<void> shutdown() override;
 private:
     // Handling the various error and finish signals from QProcess is
@@ -99,6 +108,9 @@ private:
     QString _interfaceName;
     // Wireguard socket path; built from that interface name.
     QString _wgSocketPath;
+#ifdef Q_OS_LINUX
+    LinkStatsReader _linkStats;
+#endif
     // PID of the wireguard-go process
     qint64 _wgGoPid;
     // When shutdown() is called, we try to shut down wireguard-go.  If it shuts
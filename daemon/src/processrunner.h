@@ -251,7 +251,9 @@ public:
     virtual void setupProcess(UidGidProcess &process);
 
 signals:
-    // Line printed to standard output.
+    // Line printed to standard output.  This is forwarded directly from
+    // LineBuffer::lineComplete(), so the line is only valid during the signal
+    // (see LineBuffer).
     void stdoutLine(const QByteArray &line);
 
     // The process has been started.  This will eventually be followed by
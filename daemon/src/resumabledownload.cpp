@@ -0,0 +1,454 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("resumabledownload.cpp")
+
+#include "resumabledownload.h"
+#include "apinetwork.h"
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QNetworkRequest>
+#include <QRegularExpression>
+#include <algorithm>
+
+namespace
+{
+    // Number of consecutive retries allowed without receiving any data
+    const unsigned maxRetries{5};
+    // Delay before the first retry; doubled for each consecutive retry up to
+    // the maximum.
+    const std::chrono::seconds initialRetryDelay{1};
+    const std::chrono::seconds maxRetryDelay{30};
+    // Size of the chunks read to hash existing partial data
+    const qint64 hashChunkSize{64 * 1024};
+
+    // Whether a request that failed with an HTTP status should be retried.
+    // Client errors won't succeed if repeated, except for a timeout, an
+    // unsatisfiable range (the download starts over), or rate limiting.
+    bool isRetriableStatus(int status)
+    {
+        if(status < 400 || status >= 500)
+            return true;
+        return status == 408 || status == 416 || status == 429;
+    }
+}
+
+const QString ResumableDownload::partSuffix{QStringLiteral(".part")};
+const QString ResumableDownload::stateSuffix{QStringLiteral(".part.json")};
+
+ResumableDownload::ResumableDownload(QUrl uri, QString targetPath,
+                                     QByteArray expectedSha256)
+    : _uri{std::move(uri)}, _targetPath{std::move(targetPath)},
+      _expectedSha256{expectedSha256.toLower()},
+      _partFile{_targetPath + partSuffix},
+      _hash{QCryptographicHash::Algorithm::Sha256}, _received{0}, _total{-1},
+      _responseChecked{false}, _replyRejected{false}, _writeFailed{false},
+      _canceled{false}, _retries{0}
+{
+    _retryTimer.setSingleShot(true);
+    connect(&_retryTimer, &QTimer::timeout, this, &ResumableDownload::sendRequest);
+}
+
+bool ResumableDownload::canResume() const
+{
+    return !_validator.isEmpty() || !_expectedSha256.isEmpty();
+}
+
+bool ResumableDownload::openPartial()
+{
+    QJsonObject state;
+    QFile stateFile{_targetPath + stateSuffix};
+    if(stateFile.open(QFile::OpenModeFlag::ReadOnly))
+        state = QJsonDocument::fromJson(stateFile.readAll()).object();
+    _validator = state.value(QStringLiteral("validator")).toString().toLatin1();
+
+    // Resume only if the partial data came from the same URI, and only if
+    // it's possible to tell whether the file has changed since then
+    bool sameUri = state.value(QStringLiteral("uri")).toString() == _uri.toString();
+    if(sameUri && _partFile.exists() && !canResume())
+    {
+        qInfo() << "Can't resume download of" << _uri
+            << "without a validator or digest - starting over";
+    }
+    else if(sameUri && _partFile.exists() &&
+            _partFile.open(QFile::OpenModeFlag::ReadWrite))
+    {
+        // Restore the digest state by hashing the data we already have.  This
+        // leaves the file positioned at the end to append new data.
+        while(!_partFile.atEnd())
+        {
+            QByteArray chunk{_partFile.read(hashChunkSize)};
+            if(chunk.isEmpty())
+                break;
+            _hash.addData(chunk);
+        }
+        if(_partFile.error() == QFile::FileError::NoError && _partFile.atEnd())
+        {
+            _received = _partFile.pos();
+            qInfo() << "Resuming download of" << _uri << "from" << _received
+                << "bytes";
+            return true;
+        }
+
+        qWarning() << "Can't read partial download" << _partFile.fileName()
+            << "due to error" << _partFile.error() << "- starting over";
+        _partFile.close();
+    }
+
+    _hash.reset();
+    _received = 0;
+    _validator.clear();
+    if(!_partFile.open(QFile::OpenModeFlag::WriteOnly | QFile::OpenModeFlag::Truncate))
+    {
+        qError() << "Can't open download file" << _partFile.fileName()
+            << "due to error" << _partFile.error();
+        return false;
+    }
+    writeResumeState();
+    return true;
+}
+
+void ResumableDownload::restartPartial()
+{
+    qInfo() << "Discarding" << _received << "bytes of partial download from"
+        << _uri;
+    _partFile.resize(0);
+    _partFile.seek(0);
+    _hash.reset();
+    _received = 0;
+    _total = -1;
+}
+
+void ResumableDownload::removePartial()
+{
+    _partFile.close();
+    _partFile.remove();
+    QFile::remove(_targetPath + stateSuffix);
+}
+
+void ResumableDownload::writeResumeState()
+{
+    QJsonObject state
+    {
+        {QStringLiteral("uri"), _uri.toString()},
+        {QStringLiteral("validator"), QString::fromLatin1(_validator)}
+    };
+    QFile stateFile{_targetPath + stateSuffix};
+    // If this fails, the download still works, it just can't be resumed after
+    // a restart.
+    if(!stateFile.open(QFile::OpenModeFlag::WriteOnly | QFile::OpenModeFlag::Truncate) ||
+       stateFile.write(QJsonDocument{state}.toJson(QJsonDocument::JsonFormat::Compact)) < 0)
+    {
+        qWarning() << "Can't write download state" << stateFile.fileName()
+            << "due to error" << stateFile.error();
+    }
+}
+
+void ResumableDownload::sendRequest()
+{
+    Q_ASSERT(!_pReply);   // Not called while a request is in progress
+    Q_ASSERT(_partFile.isOpen());   // Class invariant while downloading
+
+    _responseChecked = false;
+    _replyRejected = false;
+    _writeFailed = false;
+
+    // Without a validator, the server can't tell us if the file changed, and
+    // without a digest, a mix of two versions wouldn't be detected - start
+    // over.  (This happens when resuming after a network error if the server
+    // didn't send a validator.)
+    if(_received > 0 && !canResume())
+    {
+        qInfo() << "Can't resume download of" << _uri
+            << "without a validator or digest - starting over";
+        restartPartial();
+    }
+
+    QNetworkRequest request{_uri};
+    if(_received > 0)
+    {
+        request.setRawHeader(QByteArrayLiteral("Range"),
+                             QByteArrayLiteral("bytes=") + QByteArray::number(_received) + '-');
+        // If the file has changed, the server sends the whole file instead.
+        if(!_validator.isEmpty())
+            request.setRawHeader(QByteArrayLiteral("If-Range"), _validator);
+    }
+
+    _pReply = ApiNetwork::instance()->getAccessManager().get(request);
+    _pReply->setParent(this);
+    // There is no timeout on the download, but the user can cancel it manually
+    // if it appears to be stuck but does not fail.
+    connect(_pReply, &QIODevice::readyRead, this, &ResumableDownload::onReadyRead);
+    connect(_pReply, &QNetworkReply::finished, this, &ResumableDownload::onFinished);
+}
+
+void ResumableDownload::checkResponse()
+{
+    Q_ASSERT(_pReply);  // Valid when reply signals are connected
+
+    _responseChecked = true;
+    int status = _pReply->attribute(QNetworkRequest::Attribute::HttpStatusCodeAttribute).toInt();
+    if(status == 206)
+    {
+        // Make sure the server resumed where we asked it to.
+        static const QRegularExpression contentRange{QStringLiteral(R"(^bytes (\d+)-\d+/(\d+|\*)$)")};
+        const auto &rangeHeader = _pReply->rawHeader(QByteArrayLiteral("Content-Range"));
+        const auto &match = contentRange.match(QString::fromLatin1(rangeHeader));
+        if(!match.hasMatch() || match.captured(1).toLongLong() != _received)
+        {
+            qWarning() << "Download of" << _uri << "resumed with unexpected range"
+                << rangeHeader << "- expected start" << _received;
+            restartPartial();
+            _replyRejected = true;
+            return;
+        }
+        bool totalValid{false};
+        _total = match.captured(2).toLongLong(&totalValid);
+        if(!totalValid)
+            _total = -1;
+    }
+    else if(status == 200)
+    {
+        // The server sent the whole file (it doesn't support ranges, or the
+        // file changed).
+        if(_received > 0)
+        {
+            qInfo() << "Server did not resume download of" << _uri;
+            restartPartial();
+        }
+        bool lengthValid{false};
+        _total = _pReply->rawHeader(QByteArrayLiteral("Content-Length")).toLongLong(&lengthValid);
+        if(!lengthValid)
+            _total = -1;
+    }
+    else
+    {
+        // Error responses are handled by onFinished()
+        return;
+    }
+
+    // Keep the validator to resume later.  Weak ETags can't be used with
+    // If-Range, use Last-Modified instead in that case.
+    QByteArray validator{_pReply->rawHeader(QByteArrayLiteral("ETag"))};
+    if(validator.isEmpty() || validator.startsWith("W/"))
+        validator = _pReply->rawHeader(QByteArrayLiteral("Last-Modified"));
+    if(validator != _validator)
+    {
+        _validator = validator;
+        writeResumeState();
+    }
+
+    emit progress(_received, _total);
+}
+
+void ResumableDownload::onReadyRead()
+{
+    if(!_pReply)
+        return;
+
+    if(!_responseChecked)
+    {
+        checkResponse();
+        if(_replyRejected)
+        {
+            _pReply->abort();
+            return;
+        }
+    }
+
+    QByteArray data{_pReply->readAll()};
+    // Don't write the body of an error response
+    int status = _pReply->attribute(QNetworkRequest::Attribute::HttpStatusCodeAttribute).toInt();
+    if(data.isEmpty() || (status != 200 && status != 206))
+        return;
+
+    if(_partFile.write(data) != data.size())
+    {
+        // Abort the request; onFinished() will fail the download.
+        qError() << "Failed to write to download file" << _partFile.fileName()
+            << "-" << _partFile.error();
+        _writeFailed = true;
+        _pReply->abort();
+        return;
+    }
+    _hash.addData(data);
+    _received += data.size();
+    // We're making progress, so reset the retry count
+    _retries = 0;
+    emit progress(_received, _total);
+}
+
+void ResumableDownload::onFinished()
+{
+    // Write any data that haven't been read yet.  If this aborts the reply,
+    // onFinished() has already been called again, and _pReply is cleared.
+    onReadyRead();
+    if(!_pReply)
+        return;
+
+    QPointer<QNetworkReply> pReply;
+    _pReply.swap(pReply);
+    pReply->deleteLater();
+
+    auto error = pReply->error();
+    int status = pReply->attribute(QNetworkRequest::Attribute::HttpStatusCodeAttribute).toInt();
+
+    if(_canceled)
+    {
+        qInfo() << "Download of" << _uri << "was canceled";
+        removePartial();
+        finish(Result::Canceled);
+        return;
+    }
+    if(_writeFailed)
+    {
+        removePartial();
+        finish(Result::Failed);
+        return;
+    }
+    if(_replyRejected)
+    {
+        retryOrFail();
+        return;
+    }
+    if(error != QNetworkReply::NetworkError::NoError)
+    {
+        qWarning() << "Download of" << _uri << "failed after" << _received
+            << "bytes with error" << qEnumToString(error) << "- status" << status;
+        // The partial data can't be resumed, start over
+        if(status == 416)
+            restartPartial();
+        if(!isRetriableStatus(status))
+            failWithoutRetry();
+        else
+            retryOrFail();
+        return;
+    }
+    if(status != 200 && status != 206)
+    {
+        qWarning() << "Download of" << _uri << "returned unexpected status"
+            << status;
+        if(!isRetriableStatus(status))
+            failWithoutRetry();
+        else
+            retryOrFail();
+        return;
+    }
+    if(_total >= 0 && _received < _total)
+    {
+        qWarning() << "Download of" << _uri << "ended after" << _received
+            << "of" << _total << "bytes";
+        retryOrFail();
+        return;
+    }
+
+    complete();
+}
+
+void ResumableDownload::retryOrFail()
+{
+    if(_retries >= maxRetries)
+    {
+        qWarning() << "Download of" << _uri << "failed after" << _retries
+            << "retries, keeping" << _received << "bytes to resume later";
+        _partFile.close();
+        finish(Result::Failed);
+        return;
+    }
+
+    std::chrono::milliseconds delay{std::min<std::chrono::milliseconds>(
+        initialRetryDelay * (1 << _retries), maxRetryDelay)};
+    ++_retries;
+    qInfo() << "Retrying download of" << _uri << "from" << _received
+        << "bytes in" << traceMsec(delay) << "(retry" << _retries << ")";
+    _retryTimer.start(msec(delay));
+}
+
+void ResumableDownload::failWithoutRetry()
+{
+    qWarning() << "Download of" << _uri << "can't succeed by retrying, keeping"
+        << _received << "bytes to resume later";
+    _partFile.close();
+    finish(Result::Failed);
+}
+
+void ResumableDownload::complete()
+{
+    _partFile.close();
+    _sha256 = _hash.result().toHex();
+    qInfo() << "Downloaded" << _received << "bytes from" << _uri << "- SHA-256:"
+        << _sha256;
+
+    if(!_expectedSha256.isEmpty() && _sha256 != _expectedSha256)
+    {
+        qError() << "Download of" << _uri << "has SHA-256" << _sha256
+            << "- expected" << _expectedSha256;
+        removePartial();
+        finish(Result::Failed);
+        return;
+    }
+
+    // Replace the target if it exists (failure is ignored, rename() fails in
+    // that case)
+    QFile::remove(_targetPath);
+    if(!_partFile.rename(_targetPath))
+    {
+        qError() << "Can't move download" << _partFile.fileName() << "to"
+            << _targetPath << "due to error" << _partFile.error();
+        removePartial();
+        finish(Result::Failed);
+        return;
+    }
+    QFile::remove(_targetPath + stateSuffix);
+    finish(Result::Succeeded);
+}
+
+void ResumableDownload::finish(Result result)
+{
+    _retryTimer.stop();
+    emit finished(result);
+}
+
+void ResumableDownload::start()
+{
+    if(!openPartial())
+    {
+        QTimer::singleShot(0, this, [this](){finish(Result::Failed);});
+        return;
+    }
+    emit progress(_received, _total);
+    sendRequest();
+}
+
+void ResumableDownload::cancel()
+{
+    // Ignore this if the download isn't in progress
+    if(_canceled || (!_pReply && !_retryTimer.isActive()))
+        return;
+
+    _canceled = true;
+    // If a request is in progress, onFinished() completes the cancellation
+    if(_pReply)
+        _pReply->abort();
+    else
+    {
+        qInfo() << "Download of" << _uri << "was canceled";
+        removePartial();
+        finish(Result::Canceled);
+    }
+}
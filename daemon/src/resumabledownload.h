@@ -0,0 +1,143 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("resumabledownload.h")
+
+#ifndef RESUMABLEDOWNLOAD_H
+#define RESUMABLEDOWNLOAD_H
+
+#include <QObject>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QNetworkReply>
+#include <QPointer>
+#include <QTimer>
+#include <QUrl>
+
+// ResumableDownload downloads a file over HTTP(S), resuming with range
+// requests if the transfer is interrupted.
+//
+// Data are written to "<target>.part" as they arrive, and a SHA-256 digest is
+// computed over the stream at the same time, so the finished file never has
+// to be read back to verify it.  The URI and the server's validator (ETag or
+// Last-Modified) are stored in "<target>.part.json", so a download that was
+// interrupted by a daemon restart can be resumed by a new ResumableDownload for
+// the same URI and target.  (In that case, the partial data are hashed once
+// when the download starts to restore the digest state.)
+//
+// Partial data are only resumed if the server gave a validator or the expected
+// digest is known.  Otherwise, a file that changed between requests could not
+// be detected, so the download starts over instead.
+//
+// Network errors are retried with a backoff delay, resuming from the data
+// received so far.  Client error statuses are not retried (except 408, 416,
+// and 429).  If the download fails, the partial data are kept so a later
+// download can still resume.  Canceling discards the partial data.
+class ResumableDownload : public QObject
+{
+    Q_OBJECT
+    CLASS_LOGGING_CATEGORY("resumabledownload")
+
+public:
+    enum class Result
+    {
+        Succeeded,
+        Failed,
+        Canceled,
+    };
+
+    // Suffixes of the partial data file and the resume state file.
+    static const QString partSuffix, stateSuffix;
+
+public:
+    // If expectedSha256 is not empty, it's the hex SHA-256 digest of the file;
+    // the download fails if the digest doesn't match.
+    ResumableDownload(QUrl uri, QString targetPath, QByteArray expectedSha256);
+
+private:
+    // Whether partial data can be resumed - the server gave a validator to
+    // send with If-Range, or the expected digest would detect a file that
+    // changed while it was being downloaded.
+    bool canResume() const;
+    // Open the partial file, resuming from an earlier download if possible.
+    bool openPartial();
+    // Discard the partial data received so far (but keep the file open to
+    // start over).
+    void restartPartial();
+    // Delete the partial file and resume state.
+    void removePartial();
+    void writeResumeState();
+
+    void sendRequest();
+    // Check the response status and headers for the current reply.  If the
+    // server resumed at the wrong position, the partial data are discarded and
+    // _replyRejected is set; the reply must be aborted and retried.
+    void checkResponse();
+    void onReadyRead();
+    void onFinished();
+    // Retry after a network error, or fail if no retries are left.
+    void retryOrFail();
+    // Fail after an error that won't be resolved by retrying (most 4xx
+    // statuses).
+    void failWithoutRetry();
+    // Verify and move the completed download to the target path.
+    void complete();
+    void finish(Result result);
+
+public:
+    // Start downloading.  finished() is always emitted asynchronously, even if
+    // the download can't start.
+    void start();
+    // Cancel the download.  finished() is emitted with Result::Canceled.
+    void cancel();
+
+    const QString &targetPath() const {return _targetPath;}
+    qint64 bytesReceived() const {return _received;}
+    // Hex SHA-256 digest of the completed file; valid once finished() has been
+    // emitted with Result::Succeeded.
+    const QByteArray &sha256() const {return _sha256;}
+
+signals:
+    // Progress of the download.  bytesTotal is -1 if the size isn't known yet.
+    void progress(qint64 bytesReceived, qint64 bytesTotal);
+    void finished(Result result);
+
+private:
+    QUrl _uri;
+    QString _targetPath;
+    QByteArray _expectedSha256;
+    QFile _partFile;
+    QCryptographicHash _hash;
+    QByteArray _sha256;
+    // Bytes of the file received so far (size of _partFile), and the total
+    // size if known (otherwise -1)
+    qint64 _received, _total;
+    // ETag or Last-Modified from the server, used for If-Range when resuming
+    QByteArray _validator;
+    QPointer<QNetworkReply> _pReply;
+    // Whether the current reply's response has been checked by
+    // checkResponse(), and whether the reply is being aborted because its
+    // response couldn't be used or the file couldn't be written.
+    bool _responseChecked, _replyRejected, _writeFailed;
+    bool _canceled;
+    // Retries since data were last received, and the timer used to delay them.
+    unsigned _retries;
+    QTimer _retryTimer;
+};
+
+#endif
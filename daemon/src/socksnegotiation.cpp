@@ -0,0 +1,319 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line SOURCE_FILE("socksnegotiation.cpp")
+
+#include "socksnegotiation.h"
+#include "brand.h"
+#include <QCryptographicHash>
+#include <QRandomGenerator>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // SOCKS protocol constants
+    enum : quint8
+    {
+        SocksVersion = 5,
+        // The auth negotiation has its own version
+        UsernamePasswordAuthVersion = 1,
+    };
+
+    enum Method : quint8
+    {
+        NoAuth = 0,
+        UsernamePassword = 2,
+        NotAcceptable = 0xFF
+    };
+
+    enum AddressType : quint8
+    {
+        IPv4 = 1,
+        IPv6 = 4,
+    };
+
+    enum Command : quint8
+    {
+        Connect = 1,
+    };
+
+    // SOCKS5 protocol message formats / offsets.
+    // Several of these have fields with the same name; anonymous enums in
+    // namespaces avoid conflicts (we don't need to declare variables of these
+    // types, they're just indexing offsets / sizes).
+    namespace AuthMethodHeaderMsg
+    {
+        enum
+        {
+            Version,
+            NMethods,
+            Length
+        };
+    }
+    // The auth data is of the form:
+    // | version | username-length | <data> | password-length | <data> |
+    // This is broken into 4 parts to handle the variable-length data
+    namespace AuthUsernameHeaderMsg
+    {
+        enum
+        {
+            Version,
+            UsernameLength,
+            Length
+        };
+    }
+    // Then, username data
+    namespace AuthPasswordHeaderMsg
+    {
+        enum
+        {
+            // No "version" here since it's really part of one "auth" message.
+            PasswordLength,
+            Length
+        };
+    }
+
+    namespace ConnectHeaderMsg
+    {
+        enum
+        {
+            Version,
+            Command,
+            Reserved,
+            AddrType,
+            Length
+        };
+    }
+    // The remaining part of the connect message depends on the address type
+    namespace ConnectAddrMsg
+    {
+        enum
+        {
+            // Address and port
+            IPv4Length = 4 + 2,
+            IPv6Length = 16 + 2,
+        };
+    }
+    namespace ConnectResponseMsg
+    {
+        enum
+        {
+            Version,
+            Reply,
+            Reserved,
+            AddrType,
+            // Followed by address and port (length depends on address type)
+            Addr,
+            Port = Addr + 4,
+            Length = Port + 2,
+        };
+    }
+    static_assert(static_cast<std::size_t>(ConnectResponseMsg::Length) == SocksNegotiation::ConnectResponseLength,
+                  "Connect response length must match ConnectResponse");
+
+    // Check two same-sized QByteArrays in constant time for equality
+    bool checkHashEquals(const QByteArray &first, const QByteArray &second)
+    {
+        Q_ASSERT(first.size() == second.size());    // Ensured by caller
+
+        // Use volatile data pointers and a volatile intermediate, this requires
+        // the compiler to emit all memory accesses for these variables, which
+        // ensures that the calculation takes place as written.
+        volatile const char *pFirst = first.data();
+        volatile const char *pSecond = second.data();
+        volatile char accumulatedDifference = 0;
+
+        for(int i=0; i<first.size(); ++i)
+        {
+            accumulatedDifference |= pFirst[i] ^ pSecond[i];
+        }
+
+        return !accumulatedDifference;
+    }
+}
+
+// Brand code is a sane value.  Underscore added since the username is
+// prefix-matched.
+const QByteArray SocksNegotiation::username = QByteArrayLiteral(BRAND_CODE "_");
+
+QByteArray SocksNegotiation::generatePassword()
+{
+    quint64 passwordData = QRandomGenerator::global()->generate64();
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(&passwordData), sizeof(passwordData)).toHex();
+}
+
+QByteArray SocksNegotiation::hashPassword(const QByteArray &password)
+{
+    QCryptographicHash hash{QCryptographicHash::Algorithm::Sha256};
+    hash.addData(password);
+    return hash.result();
+}
+
+auto SocksNegotiation::connectResponse(Reply reply, quint32 address,
+                                       quint16 port) -> ConnectResponse
+{
+    ConnectResponse response{};
+    response[ConnectResponseMsg::Version] = SocksVersion;
+    response[ConnectResponseMsg::Reply] = reply;
+    response[ConnectResponseMsg::AddrType] = AddressType::IPv4;
+    qToBigEndian(address, response.data() + ConnectResponseMsg::Addr);
+    qToBigEndian(port, response.data() + ConnectResponseMsg::Port);
+    return response;
+}
+
+auto SocksNegotiation::expect(Step step, quint16 nextMessageBytes) -> Result
+{
+    _step = step;
+    _nextMessageBytes = nextMessageBytes;
+    Result result{};
+    result.action = Action::Continue;
+    return result;
+}
+
+auto SocksNegotiation::respond(Step step, quint16 nextMessageBytes,
+                               std::initializer_list<unsigned char> response)
+    -> Result
+{
+    Result result = expect(step, nextMessageBytes);
+    result.action = Action::Respond;
+    result.responseSize = response.size();
+    std::copy(response.begin(), response.end(), result.response.begin());
+    return result;
+}
+
+auto SocksNegotiation::reject(const char *pReason,
+                              std::initializer_list<unsigned char> response)
+    -> Result
+{
+    Result result = respond(Step::Done, 0, response);
+    result.action = Action::Reject;
+    result.pReason = pReason;
+    return result;
+}
+
+auto SocksNegotiation::rejectConnect(const char *pReason, Reply reply) -> Result
+{
+    // This sends an empty IPv4 address in the rejection, even for IPv6
+    // requests.  It should probably be an empty IPv6 address in that case, but
+    // this is fine for the limited use of this SOCKS proxy.
+    Result result = expect(Step::Done, 0);
+    result.action = Action::Reject;
+    result.response = connectResponse(reply);
+    result.responseSize = result.response.size();
+    result.pReason = pReason;
+    return result;
+}
+
+auto SocksNegotiation::abort(const char *pReason) -> Result
+{
+    Result result = expect(Step::Done, 0);
+    result.action = Action::Abort;
+    result.pReason = pReason;
+    return result;
+}
+
+auto SocksNegotiation::processMessage(const unsigned char *pMsg,
+                                      std::size_t size,
+                                      const QByteArray &passwordHash) -> Result
+{
+    Q_ASSERT(size == _nextMessageBytes);    // Ensured by caller
+
+    switch(_step)
+    {
+        default:
+        case Step::Done:
+            Q_ASSERT(false);    // Caller shouldn't process messages now
+            return abort("unexpected message after negotiation");
+        case Step::AuthMethodsHeader:
+            if(pMsg[AuthMethodHeaderMsg::Version] != SocksVersion)
+                return abort("unsupported SOCKS version");
+            return expect(Step::AuthMethods, pMsg[AuthMethodHeaderMsg::NMethods]);
+        case Step::AuthMethods:
+            // Look for the "username/password" method
+            if(std::find(pMsg, pMsg + size, Method::UsernamePassword) != pMsg + size)
+            {
+                return respond(Step::AuthUsernameHeader, AuthUsernameHeaderMsg::Length,
+                               {SocksVersion, Method::UsernamePassword});
+            }
+            return reject("no acceptable auth method",
+                          {SocksVersion, Method::NotAcceptable});
+        case Step::AuthUsernameHeader:
+            if(pMsg[AuthUsernameHeaderMsg::Version] != UsernamePasswordAuthVersion)
+                return abort("unsupported U/P auth version");
+            return expect(Step::AuthUsername, pMsg[AuthUsernameHeaderMsg::UsernameLength]);
+        case Step::AuthUsername:
+            // This check and response could reveal the username
+            // (non-constant-time check, and timing indicates that username
+            // failed, not password), but the username is not secret.
+            //
+            // This is a prefix check so we can vary the username to hack around
+            // QNetworkAccessManager's broken connection caching, see
+            // ApiNetwork.
+            if(size < static_cast<std::size_t>(username.size()) ||
+               std::memcmp(pMsg, username.constData(), static_cast<std::size_t>(username.size())) != 0)
+            {
+                // Nonzero status = failure
+                return reject("incorrect username", {UsernamePasswordAuthVersion, 1});
+            }
+            return expect(Step::AuthPasswordHeader, AuthPasswordHeaderMsg::Length);
+        case Step::AuthPasswordHeader:
+            return expect(Step::AuthPassword, pMsg[AuthPasswordHeaderMsg::PasswordLength]);
+        case Step::AuthPassword:
+        {
+            // Check the password by hashing it, then performing a constant-time
+            // comparison on the hash.
+            QByteArray hash = hashPassword(QByteArray::fromRawData(reinterpret_cast<const char*>(pMsg),
+                                                                   static_cast<int>(size)));
+            // The hashes should be the same length, but check for sanity, this
+            // would prevent all auth from working
+            if(hash.size() != passwordHash.size())
+                return reject("password hash size mismatch", {UsernamePasswordAuthVersion, 1});
+            if(!checkHashEquals(hash, passwordHash))
+                return reject("incorrect password", {UsernamePasswordAuthVersion, 1});
+            return respond(Step::ConnectHeader, ConnectHeaderMsg::Length,
+                           {UsernamePasswordAuthVersion, 0});
+        }
+        case Step::ConnectHeader:
+            if(pMsg[ConnectHeaderMsg::Version] != SocksVersion)
+                return abort("unsupported SOCKS version");
+            // The client will probably try to send an address, but if we don't
+            // understand the command or address type, we may not know how long
+            // it is.  Ignore any subsequent data and send a rejection now.
+            if(pMsg[ConnectHeaderMsg::Command] != Command::Connect)
+                return rejectConnect("unsupported command", Reply::CommandNotSupported);
+            if(pMsg[ConnectHeaderMsg::AddrType] == AddressType::IPv6)
+                return expect(Step::ConnectIPv6, ConnectAddrMsg::IPv6Length);
+            if(pMsg[ConnectHeaderMsg::AddrType] != AddressType::IPv4)
+                return rejectConnect("unsupported address type", Reply::AddressTypeNotSupported);
+            return expect(Step::ConnectIPv4, ConnectAddrMsg::IPv4Length);
+        case Step::ConnectIPv4:
+        {
+            Result result = expect(Step::Done, 0);
+            result.action = Action::Connect;
+            result.address = qFromBigEndian<quint32>(pMsg);
+            result.port = qFromBigEndian<quint16>(pMsg + 4);
+            return result;
+        }
+        case Step::ConnectIPv6:
+            // PIA's network doesn't support IPv6, so there's no point in trying
+            // to connect - reject as if the target was unreachable.
+            return rejectConnect("IPv6 is not supported", Reply::NetUnreachable);
+    }
+}
@@ -0,0 +1,167 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#line HEADER_FILE("socksnegotiation.h")
+
+#ifndef SOCKSNEGOTIATION_H
+#define SOCKSNEGOTIATION_H
+
+#include <QByteArray>
+#include <array>
+#include <initializer_list>
+
+// SocksNegotiation parses the client side of the SOCKS5 negotiation for the
+// API proxy - the greeting, username/password auth (RFC 1929), and the
+// CONNECT request.  This is shared by both proxy implementations
+// (SocksConnection and EpollSocksProxy), which just receive the messages and
+// carry out the resulting actions with their own sockets.
+//
+// Each negotiation step receives one fixed-length message; the length of each
+// message is known once the previous message has been processed.  Only IPv4
+// CONNECT requests are supported.
+class SocksNegotiation
+{
+public:
+    // The username doesn't really matter, but it's prefix-matched so the
+    // daemon can vary it - see ApiNetwork.
+    static const QByteArray username;
+
+    // Generate a password for a new proxy instance.  The proxy port is
+    // reachable by any application, but we only intend to use it from the
+    // daemon.
+    static QByteArray generatePassword();
+    // Hash a password for processMessage().  Passwords are checked by
+    // comparing hashes in constant time; the hash mainly ensures that the
+    // data compared are the same length.
+    static QByteArray hashPassword(const QByteArray &password);
+
+    // Reply codes for the CONNECT response
+    enum Reply : quint8
+    {
+        Succeeded,
+        GeneralFailure,
+        NotAllowed,
+        NetUnreachable,
+        HostUnreachable,
+        ConnectionRefused,
+        TtlExpired,
+        CommandNotSupported,
+        AddressTypeNotSupported,
+    };
+
+    enum : std::size_t
+    {
+        // Largest message - a method list, username, or password can each be
+        // up to 255 bytes
+        MaxMessageSize = 255,
+        // Length of the CONNECT response (with an IPv4 address), which is
+        // also the longest response
+        ConnectResponseLength = 10,
+    };
+
+    using ConnectResponse = std::array<unsigned char, ConnectResponseLength>;
+
+    // Build the CONNECT response.  On success, address and port are the local
+    // address of the target connection; failures send an empty address.
+    static ConnectResponse connectResponse(Reply reply, quint32 address = 0,
+                                           quint16 port = 0);
+
+    enum class Step : quint8
+    {
+        // Receive the VER and NMETHODS bytes of the client greeting.  RFC1928
+        // documents this and the methods themselves as one message, but we
+        // treat them separately since this part specifies the length of the
+        // next part.
+        AuthMethodsHeader,
+        // Receive the variable-length method list
+        AuthMethods,
+        // Receive the auth username header (version and name length)
+        AuthUsernameHeader,
+        // Receive the auth username
+        AuthUsername,
+        // Receive the auth password header (password length)
+        AuthPasswordHeader,
+        // Receive the auth password
+        AuthPassword,
+        // Receive the CONNECT request header - everything up to the address
+        // type, which determines the length of the rest of the message.
+        ConnectHeader,
+        // Receive the rest of the CONNECT request, for either IPv4 or IPv6
+        ConnectIPv4,
+        ConnectIPv6,
+        // Negotiation is over - a CONNECT request was received, or the
+        // connection was rejected or aborted
+        Done,
+    };
+
+    enum class Action : quint8
+    {
+        // Receive the next message, nothing to send
+        Continue,
+        // Send the response, then receive the next message
+        Respond,
+        // Send the failure response, then close the connection
+        Reject,
+        // Protocol error - close the connection without a response
+        Abort,
+        // Connect to the requested target, then send connectResponse()
+        Connect,
+    };
+
+    struct Result
+    {
+        Action action;
+        // Response for Respond and Reject
+        std::size_t responseSize;
+        ConnectResponse response;
+        // Target for Connect (host byte order)
+        quint32 address;
+        quint16 port;
+        // Reason for Reject or Abort, for tracing
+        const char *pReason;
+    };
+
+public:
+    SocksNegotiation() : _step{Step::AuthMethodsHeader}, _nextMessageBytes{2} {}
+
+public:
+    Step step() const {return _step;}
+    // Size of the next message to receive.  In the Done step, this is 0.
+    quint16 nextMessageBytes() const {return _nextMessageBytes;}
+
+    // Process a complete message of nextMessageBytes() bytes and advance to
+    // the next step.  passwordHash is the hashPassword() of the proxy's
+    // password.
+    Result processMessage(const unsigned char *pMsg, std::size_t size,
+                          const QByteArray &passwordHash);
+
+private:
+    Result expect(Step step, quint16 nextMessageBytes);
+    Result respond(Step step, quint16 nextMessageBytes,
+                   std::initializer_list<unsigned char> response);
+    Result reject(const char *pReason,
+                  std::initializer_list<unsigned char> response);
+    Result rejectConnect(const char *pReason, Reply reply);
+    Result abort(const char *pReason);
+
+private:
+    Step _step;
+    quint16 _nextMessageBytes;
+};
+
+#endif
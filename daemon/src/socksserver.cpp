@@ -20,192 +20,35 @@
 #line SOURCE_FILE("socksserver.cpp")
 
 #include "socksserver.h"
-#include "brand.h"
-#include <QRandomGenerator>
-#include <QCryptographicHash>
 #include <QNetworkProxy>
 
 // For SO_BINDTODEVICE
 #ifdef Q_OS_LINUX
 #include <sys/socket.h>
+// For F_DUPFD_CLOEXEC
+#include <fcntl.h>
+#include <atomic>
 #endif
 
 namespace
 {
-    // SOCKS protocol constants
-    enum : quint8
+    QByteArray responseData(const SocksNegotiation::ConnectResponse &response,
+                            std::size_t size = SocksNegotiation::ConnectResponseLength)
     {
-        SocksVersion = 5,
-        // The auth negotiation has its own version
-        UsernamePasswordAuthVersion = 1,
-    };
-
-    enum Method : quint8
-    {
-        NoAuth = 0,
-        UsernamePassword = 2,
-        NotAcceptable = 0xFF
-    };
-
-    enum AddressType : quint8
-    {
-        IPv4 = 1,
-        IPv6 = 4,
-    };
-
-    enum Command : quint8
-    {
-        Connect = 1,
-    };
-
-    enum Reply : quint8
-    {
-        Succeeded,
-        GeneralFailure,
-        NotAllowed,
-        NetUnreachable,
-        HostUnreachable,
-        ConnectionRefused,
-        TtlExpired,
-        CommandNotSupported,
-        AddressTypeNotSupported,
-    };
-
-    // SOCKS5 protocol message formats / offsets.
-    // Several of these have fields with the same name; anonymous enums in
-    // namespaces avoid conflicts (we don't need to declare variables of these
-    // types, they're just indexing offsets / sizes).
-    namespace AuthMethodHeaderMsg
-    {
-        enum
-        {
-            Version,
-            NMethods,
-            Length
-        };
-    }
-    namespace AuthMethodResponseMsg
-    {
-        enum
-        {
-            Version,
-            Method,
-            Length
-        };
-    }
-    // The auth data is of the form:
-    // | version | username-length | <data> | password-length | <data> |
-    // This is broken into 4 parts to handle the variable-length data
-    namespace AuthUsernameHeaderMsg
-    {
-        enum
-        {
-            Version,
-            UsernameLength,
-            Length
-        };
+        return {reinterpret_cast<const char*>(response.data()), static_cast<int>(size)};
     }
-    // Then, username data
-    namespace AuthPasswordHeaderMsg
-    {
-        enum
-        {
-            // No "version" here since it's really part of one "auth" message.
-            PasswordLength,
-            Length
-        };
-    }
-    namespace AuthResponseMsg
-    {
-        enum
-        {
-            Version,
-            Status,
-            Length
-        };
-    }
-
-    namespace ConnectHeaderMsg
-    {
-        enum
-        {
-            Version,
-            Command,
-            Reserved,
-            AddrType,
-            Length
-        };
-    }
-    // The remaining part of the connect message (treated as a separate message
-    // by SocksConnection) depends on the address type specified
-    // TODO - May need to support IPv6 too
-    /*namespace AddrLength
-    {
-        enum
-        {
-            IPv4 = 4,
-            IPv6 = 16,
-        };
-    }*/
-    namespace ConnectResponseMsg
-    {
-        enum
-        {
-            Version,
-            Reply,
-            Reserved,
-            AddrType,
-            // Followed by address and port (length depends on address type)
-            Addr,
-            Port = Addr + 4,
-            Length = Port + 2,
-        };
-    }
-
-    // Read an unsigned big-endian integer from a QByteArray offset.  This is
-    // slightly tricky since QByteArray returns 'chars' as its element type,
-    // which may be signed.
-    template<class UInt_t>
-    UInt_t readUnsignedBE(const QByteArray &data, unsigned offset)
-    {
-        Q_ASSERT(static_cast<unsigned>(data.size()) >= static_cast<unsigned>(offset) + sizeof(UInt_t)); // Checked by caller
 
-        UInt_t result = 0;
-        const char *begin = data.constData() + offset;
-        const char *end = begin + sizeof(UInt_t);
-        while(begin != end)
-        {
-            result <<= 8;
-            result |= static_cast<unsigned char>(*begin);
-            ++begin;
-        }
-        return result;
-    }
-
-    // Check two same-sized QByteArrays in constant time for equality
-    bool checkHashEquals(const QByteArray &first, const QByteArray &second)
-    {
-        Q_ASSERT(first.size() == second.size());    // Ensured by caller
-
-        // Use volatile data pointers and a volatile intermediate, this requires
-        // the compiler to emit all memory accesses for these variables, which
-        // ensures that the calculation takes place as written.
-        volatile const char *pFirst = first.data();
-        volatile const char *pSecond = second.data();
-        volatile char accumulatedDifference = 0;
-
-        for(int i=0; i<first.size(); ++i)
-        {
-            accumulatedDifference |= pFirst[i] ^ pSecond[i];
-        }
-
-        return !accumulatedDifference;
-    }
+#ifdef Q_OS_LINUX
+    std::atomic<bool> spliceRelayEnabled{true};
+#endif
 }
 
-// The username doesn't really matter, brand code is a sane value.  Underscore
-// added since the username is prefix-matched.
-const QByteArray SocksConnection::username = QByteArrayLiteral(BRAND_CODE "_");
+#ifdef Q_OS_LINUX
+void SocksConnection::setSpliceRelayEnabled(bool enabled)
+{
+    spliceRelayEnabled = enabled;
+}
+#endif
 
 SocksServer::SocksServer(QHostAddress bindAddress, QString bindInterface)
     : _bindAddress{std::move(bindAddress)},
@@ -219,14 +62,9 @@ SocksServer::SocksServer(QHostAddress bindAddress, QString bindInterface)
         qInfo() << "Started API proxy on port" << _server.serverPort();
         connect(&_server, &QTcpServer::newConnection, this, &SocksServer::onNewConnection);
 
-        // Generate a password.  The SocksServer port is reachable by any
-        // application, but we only intend to use it from the daemon.
-        quint64 passwordData = QRandomGenerator::global()->generate64();
-        _password = QByteArray::fromRawData(reinterpret_cast<const char*>(&passwordData), sizeof(passwordData)).toHex();
-        // Use the hash of the password for validation; see SocksConnection
-        QCryptographicHash hash{QCryptographicHash::Algorithm::Sha256};
-        hash.addData(_password);
-        _passwordHash = hash.result();
+        _password = SocksNegotiation::generatePassword();
+        // Use the hash of the password for validation; see SocksNegotiation
+        _passwordHash = SocksNegotiation::hashPassword(_password);
     }
     else
     {
@@ -261,7 +99,7 @@ SocksConnection::SocksConnection(QTcpSocket &socksSocket,
       _passwordHash{std::move(passwordHash)},
       _bindAddress{std::move(bindAddress)},
       _bindInterface{std::move(bindInterface)},
-      _state{State::ReceiveAuthMethodsHeader}, _nextMessageBytes{2}
+      _state{State::Negotiating}
 {
     // By default QTcpSocket will try to use a system proxy, if configured.
     // This virtually never makes sense for these connections, since we're on
@@ -279,6 +117,17 @@ SocksConnection::SocksConnection(QTcpSocket &socksSocket,
     connect(&_targetSocket, QOverload<QTcpSocket::SocketError>::of(&QTcpSocket::error),
             this, &SocksConnection::onTargetError);
     connect(&_targetSocket, &QTcpSocket::disconnected, this, &SocksConnection::onTargetDisconnected);
+#ifdef Q_OS_LINUX
+    // If the relay couldn't start yet due to buffered data, try again once
+    // the data are written
+    auto retryRelay = [this]()
+    {
+        if(_state == State::Connected)
+            startSpliceRelay();
+    };
+    connect(&_socksSocket, &QTcpSocket::bytesWritten, this, retryRelay);
+    connect(&_targetSocket, &QTcpSocket::bytesWritten, this, retryRelay);
+#endif
 
     _abortTimer.setSingleShot(true);
     _abortTimer.setInterval(msec(std::chrono::seconds(5)));
@@ -295,6 +144,12 @@ SocksConnection::SocksConnection(QTcpSocket &socksSocket,
 
 void SocksConnection::abortConnection()
 {
+#ifdef Q_OS_LINUX
+    // The relay is destroyed along with this object; ignore anything else it
+    // reports
+    if(_pRelay)
+        _pRelay->disconnect(this);
+#endif
     _socksSocket.abort();
     _targetSocket.abort();  // No effect if not connected
     _state = State::Closed;
@@ -316,7 +171,6 @@ void SocksConnection::respond(const QByteArray &response)
 
 void SocksConnection::rejectConnection(const QByteArray &response)
 {
-    _nextMessageBytes = 0;
     _state = State::SocksDisconnecting;
     // Abort if the client doesn't disconnect soon.  (If the timer was already
     // running for the negotiation phase, this restarts it.)
@@ -328,35 +182,6 @@ void SocksConnection::rejectConnection(const QByteArray &response)
         _socksSocket.disconnectFromHost();
 }
 
-bool SocksConnection::checkMessageVersion(const QByteArray &message,
-                                          quint8 version,
-                                          const QString &traceName)
-{
-    Q_ASSERT(message.size() >= 1);  // Checked by caller
-
-    if(message[0] != version)
-    {
-        // Bail; this does not support any other version.
-        qWarning() << "API proxy:" << this << "Received unsupported" << traceName << "version"
-            << int(message[0]);
-        abortConnection();
-        return false;
-    }
-
-    return true;
-}
-
-bool SocksConnection::checkSocksVersion(const QByteArray &message)
-{
-    return checkMessageVersion(message, SocksVersion, QStringLiteral("SOCKS"));
-}
-
-bool SocksConnection::checkUPAuthVersion(const QByteArray &message)
-{
-    return checkMessageVersion(message, UsernamePasswordAuthVersion,
-                               QStringLiteral("U/P auth"));
-}
-
 void SocksConnection::forwardData(QTcpSocket &source, QTcpSocket &dest,
                                   const QString &directionTrace)
 {
@@ -375,6 +200,89 @@ void SocksConnection::forwardData(QTcpSocket &source, QTcpSocket &dest,
     }
 }
 
+#ifdef Q_OS_LINUX
+void SocksConnection::startSpliceRelay()
+{
+    Q_ASSERT(_state == State::Connected);   // Ensured by caller
+
+    if(_pRelay || _spliceRelayFailed || !spliceRelayEnabled)
+        return;
+
+    // Anything the QTcpSockets have already received must be forwarded, and
+    // anything they have buffered must be written, before the relay can take
+    // over the sockets.
+    if(_socksSocket.bytesAvailable() > 0 || _targetSocket.bytesAvailable() > 0)
+        return;
+    _socksSocket.flush();
+    _targetSocket.flush();
+    if(_socksSocket.bytesToWrite() > 0 || _targetSocket.bytesToWrite() > 0)
+        return;
+
+    // Duplicate the descriptors, then close the QTcpSockets - the sockets
+    // remain open through the duplicates.
+    PosixFd socksFd{::fcntl(static_cast<int>(_socksSocket.socketDescriptor()),
+                            F_DUPFD_CLOEXEC, 0)};
+    PosixFd targetFd{::fcntl(static_cast<int>(_targetSocket.socketDescriptor()),
+                             F_DUPFD_CLOEXEC, 0)};
+    if(!socksFd || !targetFd)
+    {
+        qWarning() << "API proxy:" << this
+            << "Unable to duplicate sockets for relay, continuing with QTcpSocket -"
+            << ErrnoTracer{};
+        // Don't try again for this connection
+        _spliceRelayFailed = true;
+        return;
+    }
+
+    _socksSocket.disconnect(this);
+    _targetSocket.disconnect(this);
+    _socksSocket.abort();
+    _targetSocket.abort();
+
+    qInfo() << "API proxy:" << this << "Relaying data with splice()";
+    _pRelay.emplace(std::move(socksFd), std::move(targetFd));
+    connect(_pRelay.ptr(), &SpliceRelay::endpointClosed, this,
+            &SocksConnection::onRelayEndpointClosed);
+    connect(_pRelay.ptr(), &SpliceRelay::finished, this,
+            &SocksConnection::onRelayFinished);
+    connect(_pRelay.ptr(), &SpliceRelay::failed, this, [this]()
+    {
+        qWarning() << "API proxy:" << this << "Aborting connection due to relay error";
+        abortConnection();
+    });
+}
+
+void SocksConnection::onRelayEndpointClosed(SpliceRelay::Endpoint endpoint)
+{
+    Q_ASSERT(_state == State::Connected);   // Relay only reports one close
+
+    // Same as onSocksDisconnected() / onTargetDisconnected() in the Connected
+    // state - the relay sends the remaining data to the other side, then
+    // finishes.  The abort timer limits how long that can take.
+    if(endpoint == SpliceRelay::Endpoint::First)
+    {
+        qInfo() << "API proxy:" << this << "SOCKS connection disconnected in relay";
+        _state = State::TargetDisconnecting;
+    }
+    else
+    {
+        qInfo() << "API proxy:" << this << "Target socket disconnected in relay";
+        _state = State::SocksDisconnecting;
+    }
+    _abortTimer.start();
+}
+
+void SocksConnection::onRelayFinished()
+{
+    qInfo() << "API proxy:" << this << "Relay finished in state" << traceEnum(_state)
+        << "- relayed" << _pRelay->firstToSecondBytes() << "bytes outbound,"
+        << _pRelay->secondToFirstBytes() << "bytes inbound";
+    _state = State::Closed;
+    _abortTimer.stop();
+    _socksSocket.deleteLater();
+}
+#endif
+
 void SocksConnection::onSocksReadyRead()
 {
     while(true)
@@ -407,251 +315,108 @@ void SocksConnection::onSocksReadyRead()
     }
 }
 
-void SocksConnection::processSocksData()
+void SocksConnection::connectTarget(quint32 address, quint16 port)
 {
-    // In Receive* states, wait until we've received the entire message - let
-    // QTcpSocket buffer it.  In other states, _nextMessageBytes is 0, so this
-    // has no effect.
-    QByteArray receivedMsg;
-    if(_nextMessageBytes > 0)
-    {
-        if(_socksSocket.bytesAvailable() < _nextMessageBytes)
+    QHostAddress destHost{address};
+    qInfo() << "API proxy:" << this << "Connecting to" << destHost << "port" << port;
+    _state = State::Connecting;
+    // Negotiation completed, now waiting on the connect - stop the abort
+    // timeout
+    _abortTimer.stop();
+    // Bind to the VPN interface if the target isn't loopback.
+    // Loopback targets generally only occur if an API is overridden,
+    // this is common when using a mock API for testing.
+    if(!destHost.isLoopback())
+    {
+        qInfo() << "API proxy:" << this << "Target socket:"
+            << _targetSocket.socketDescriptor() << "->" << _bindAddress;
+        if(!_targetSocket.bind(_bindAddress))
+        {
+            qWarning() << "API proxy:" << this
+                << "Bind failed on socket:"
+                << _targetSocket.socketDescriptor()
+                << "->" << _bindAddress << ":"
+                << traceEnum(_targetSocket.error());
+        }
+        else
         {
-            qInfo() << "API proxy:" << this << "Wait for complete message of" << _nextMessageBytes
-                << "in state" << traceEnum(_state) << "- have"
-                << _socksSocket.bytesAvailable() << "bytes";
-            return;
+            qInfo() << "API proxy:" << this
+                << "Bind succeeded on socket:"
+                << _targetSocket.socketDescriptor()
+                << "->" << _bindAddress << "=="
+                << _targetSocket.localAddress();
         }
 
-        receivedMsg = _socksSocket.read(_nextMessageBytes);
-        // This should not fail since we checked bytesAvailable()
-        if(receivedMsg.size() != _nextMessageBytes)
+        // Also bind the socket to the interface on Linux, as Linux does not support the "strong host model"
+        // meaning the packets won't be routed through our preferred interface based on source ip alone
+#ifdef Q_OS_LINUX
+        if(setsockopt(_targetSocket.socketDescriptor(), SOL_SOCKET,
+                      SO_BINDTODEVICE, qPrintable(_bindInterface),
+                      _bindInterface.size()))
         {
-            qWarning() << "API proxy:" << this << "Failed to read expected message of"
-                << _nextMessageBytes << "bytes in state" << traceEnum(_state)
-                << "- got" << receivedMsg.size() << "bytes";
-            abortConnection();
-            // Can't process the message, we're now in the 'Closed' state.
-            return;
+            qWarning() << "API proxy:" << this
+                << QStringLiteral("setsockopt error: %1 (code: %2)")
+                    .arg(qt_error_string(errno)).arg(errno);
         }
+#endif
     }
+    _targetSocket.connectToHost(destHost, port);
+}
 
+void SocksConnection::processSocksData()
+{
     switch(_state)
     {
-        case State::ReceiveAuthMethodsHeader:
-            Q_ASSERT(receivedMsg.size() == AuthMethodHeaderMsg::Length);  // Message size for this state
-            if(!checkSocksVersion(receivedMsg))
-                break; // Aborted
-
-            _nextMessageBytes = receivedMsg[AuthMethodHeaderMsg::NMethods];
-            _state = State::ReceiveAuthMethods;
-            break;
-        case State::ReceiveAuthMethods:
+        case State::Negotiating:
         {
-            // Look for the "username/password" method
-            auto isUPAuthMethod = [](quint8 method){return method == Method::UsernamePassword;};
-            QByteArray response{AuthMethodResponseMsg::Length, 0};
-            response[AuthMethodResponseMsg::Version] = SocksVersion;
-            if(std::any_of(receivedMsg.begin(), receivedMsg.end(), isUPAuthMethod))
+            // Wait until we've received the entire message - let QTcpSocket
+            // buffer it.
+            qint64 messageBytes = _negotiation.nextMessageBytes();
+            if(_socksSocket.bytesAvailable() < messageBytes)
             {
-                // Success, accept this method
-                response[AuthMethodResponseMsg::Method] = Method::UsernamePassword;
-                _nextMessageBytes = AuthUsernameHeaderMsg::Length;
-                _state = State::ReceiveAuthUsernameHeader;
-                respond(response);
+                qInfo() << "API proxy:" << this << "Wait for complete message of" << messageBytes
+                    << "in step" << static_cast<int>(_negotiation.step()) << "- have"
+                    << _socksSocket.bytesAvailable() << "bytes";
+                return;
             }
-            else
-            {
-                // Failure, no acceptable method
-                qInfo() << "Rejecting SOCKS connection, no acceptable auth method found in:"
-                    << receivedMsg;
-                response[AuthMethodResponseMsg::Method] = Method::NotAcceptable;
-                rejectConnection(response); // Goes to Rejecting state
-            }
-            break;
-        }
-        case State::ReceiveAuthUsernameHeader:
-            Q_ASSERT(receivedMsg.size() == AuthUsernameHeaderMsg::Length);
-            if(!checkUPAuthVersion(receivedMsg))
-                break;
 
-            _nextMessageBytes = receivedMsg[AuthUsernameHeaderMsg::UsernameLength];
-            _state = State::ReceiveAuthUsername;
-            break;
-        case State::ReceiveAuthUsername:
-            // This check and response could reveal the username
-            // (non-constant-time check, and timing indicates that username
-            // failed, not password), but the username is not secret.
-            //
-            // This is a prefix check so we can vary the username to hack around
-            // QNetworkAccessManager's broken connection caching, see
-            // ApiNetwork.
-            if(!receivedMsg.startsWith(username))
+            QByteArray receivedMsg = _socksSocket.read(messageBytes);
+            // This should not fail since we checked bytesAvailable()
+            if(receivedMsg.size() != messageBytes)
             {
-                qInfo() << "Reject connection due to incorrect username";
-                QByteArray response{AuthResponseMsg::Length, 0};
-                response[AuthResponseMsg::Version] = UsernamePasswordAuthVersion;
-                response[AuthResponseMsg::Status] = 1;  // Nonzero = failure
-                rejectConnection(response);
+                qWarning() << "API proxy:" << this << "Failed to read expected message of"
+                    << messageBytes << "bytes in step" << static_cast<int>(_negotiation.step())
+                    << "- got" << receivedMsg.size() << "bytes";
+                abortConnection();
+                // Can't process the message, we're now in the 'Closed' state.
+                return;
             }
-            else
-            {
-                _nextMessageBytes = AuthPasswordHeaderMsg::Length;
-                _state = State::ReceiveAuthPasswordHeader;
-            }
-            break;
-        case State::ReceiveAuthPasswordHeader:
-            _nextMessageBytes = receivedMsg[AuthPasswordHeaderMsg::PasswordLength];
-            _state = State::ReceiveAuthPassword;
-            break;
-        case State::ReceiveAuthPassword:
-        {
-            // Check the password by hashing it, then performing a constant-time
-            // comparison on the hash.  The hash mainly just ensures that the
-            // resulting data are the same length, to simplify the constant-time
-            // comparison.
-            QCryptographicHash hasher{QCryptographicHash::Algorithm::Sha256};
-            hasher.addData(receivedMsg);
-            auto hash = hasher.result();
-
-            QByteArray response{AuthResponseMsg::Length, 0};
-            response[AuthResponseMsg::Version] = UsernamePasswordAuthVersion;
-            response[AuthResponseMsg::Status] = 1;  // Nonzero = failure
-
-            // The hashes should be the same length, but check for sanity, this
-            // would prevent all auth from working
-            if(hash.size() != _passwordHash.size())
-            {
-                qWarning() << "API proxy:" << this << "Can't compare password hashes of different sizes:"
-                    << hash.size() << "-" << _passwordHash.size();
-                rejectConnection(response);
-            }
-            else if(checkHashEquals(hash, _passwordHash))
-            {
-                _nextMessageBytes = ConnectHeaderMsg::Length;
-                _state = State::ReceiveConnectHeader;
-                response[AuthResponseMsg::Status] = 0;  // Success
-                respond(response);
-            }
-            else
-            {
-                qWarning() << "API proxy:" << this << "Rejecting connection due to incorrect password";
-                rejectConnection(response);
-            }
-            break;
-        }
-        case State::ReceiveConnectHeader:
-        {
-            Q_ASSERT(receivedMsg.size() == ConnectHeaderMsg::Length);  // Message size for this state
-            if(!checkSocksVersion(receivedMsg))
-                break; // Aborted
-
-            QByteArray response{ConnectResponseMsg::Length, 0};
-            response[ConnectResponseMsg::Version] = SocksVersion;
-            response[ConnectResponseMsg::AddrType] = AddressType::IPv4;
-            // The client will probably try to send an address, but if we don't
-            // understand the command or address type, we may not know how long
-            // it is.
-            // Ignore any subsquent data and send a rejection now.
-            if(receivedMsg.at(ConnectHeaderMsg::Command) != Command::Connect)
-            {
-                qInfo() << "API proxy:" << this << "Rejecting SOCKS connection, unexpected command"
-                    << int(receivedMsg.at(ConnectHeaderMsg::Command));
-                response[ConnectResponseMsg::Reply] = Reply::CommandNotSupported;
-                rejectConnection(response);
-            }
-            else if(receivedMsg.at(ConnectHeaderMsg::AddrType) == AddressType::IPv6)
-            {
-                _nextMessageBytes = 18; // IPv6 16 bytes + port 2 bytes
-                _state = State::ReceiveConnectIPv6;
-            }
-            else if(receivedMsg.at(ConnectHeaderMsg::AddrType) != AddressType::IPv4)
-            {
-                qInfo() << "API proxy:" << this << "Rejecting SOCKS connection, unexpected address type"
-                    << int(receivedMsg.at(ConnectHeaderMsg::AddrType));
-                response[ConnectResponseMsg::Reply] = Reply::AddressTypeNotSupported;
-                rejectConnection(response);
-            }
-            else
-            {
-                // Success, wait for address data
-                _nextMessageBytes = 6;  // IPv4 4 bytes + port 2 bytes
-                _state = State::ReceiveConnectIPv4;
-            }
-            break;
-        }
-        case State::ReceiveConnectIPv4:
-        {
-            Q_ASSERT(receivedMsg.size() == 6);  // Message size for this state
-            quint32 destAddr = readUnsignedBE<quint32>(receivedMsg, 0);
-            quint16 port = readUnsignedBE<quint16>(receivedMsg, 4);
-            QHostAddress destHost{destAddr};
-            qInfo() << "API proxy:" << this << "Connecting to" << destHost << "port" << port;
-            _nextMessageBytes = 0;
-            _state = State::Connecting;
-            // Negotiation completed, now waiting on the connect - stop the
-            // abort timeout
-            _abortTimer.stop();
-            // Bind to the VPN interface if the target isn't loopback.
-            // Loopback targets generally only occur if an API is overridden,
-            // this is common when using a mock API for testing.
-            if(!destHost.isLoopback())
+
+            auto result = _negotiation.processMessage(reinterpret_cast<const unsigned char*>(receivedMsg.constData()),
+                                                      static_cast<std::size_t>(receivedMsg.size()),
+                                                      _passwordHash);
+            QByteArray response = responseData(result.response, result.responseSize);
+            switch(result.action)
             {
-                qInfo() << "API proxy:" << this << "Target socket:"
-                    << _targetSocket.socketDescriptor() << "->" << _bindAddress;
-                if(!_targetSocket.bind(_bindAddress))
-                {
-                    qWarning() << "API proxy:" << this
-                        << "Bind failed on socket:"
-                        << _targetSocket.socketDescriptor()
-                        << "->" << _bindAddress << ":"
-                        << traceEnum(_targetSocket.error());
-                }
-                else
-                {
-                    qInfo() << "API proxy:" << this
-                        << "Bind succeeded on socket:"
-                        << _targetSocket.socketDescriptor()
-                        << "->" << _bindAddress << "=="
-                        << _targetSocket.localAddress();
-                }
-
-                // Also bind the socket to the interface on Linux, as Linux does not support the "strong host model"
-                // meaning the packets won't be routed through our preferred interface based on source ip alone
-#ifdef Q_OS_LINUX
-                if(setsockopt(_targetSocket.socketDescriptor(), SOL_SOCKET,
-                              SO_BINDTODEVICE, qPrintable(_bindInterface),
-                              _bindInterface.size()))
-                {
-                    qWarning() << "API proxy:" << this
-                        << QStringLiteral("setsockopt error: %1 (code: %2)")
-                            .arg(qt_error_string(errno)).arg(errno);
-                }
-#endif
+                case SocksNegotiation::Action::Continue:
+                    break;
+                case SocksNegotiation::Action::Respond:
+                    respond(response);
+                    break;
+                case SocksNegotiation::Action::Reject:
+                    qInfo() << "API proxy:" << this << "Rejecting SOCKS connection -"
+                        << result.pReason;
+                    rejectConnection(response);   // Goes to SocksDisconnecting state
+                    break;
+                case SocksNegotiation::Action::Abort:
+                    qWarning() << "API proxy:" << this << "Aborting SOCKS connection -"
+                        << result.pReason;
+                    abortConnection();
+                    break;
+                case SocksNegotiation::Action::Connect:
+                    connectTarget(result.address, result.port);
+                    break;
             }
-            _targetSocket.connectToHost(destHost, port);
-            break;
-        }
-        case State::ReceiveConnectIPv6:
-        {
-            Q_ASSERT(receivedMsg.size() == 18); // Message size for this state
-            QHostAddress destHost{reinterpret_cast<const quint8*>(receivedMsg.data())};
-            quint16 port = readUnsignedBE<quint16>(receivedMsg, 4);
-            qInfo() << "API proxy:" << this << "Rejecting IPv6 connection to"
-                << destHost << "port" << port;
-            _nextMessageBytes = 0;
-            _state = State::Connecting;
-            _abortTimer.stop();
-
-            // PIA's network doesn't support IPv6, so we can't attempt to
-            // connect to the target.  Reject the connection.
-            //
-            // No need to try connecting and let it fail, just act as if the
-            // target socket was unable to connect.
-            // This sends an empty IPv4 address in the rejection response.  It
-            // should probably be an empty IPv6 address, but this is fine for
-            // the limited use of this SOCKS proxy.
-            onTargetError(QAbstractSocket::SocketError::NetworkError);
             break;
         }
         case State::Connecting:
@@ -661,6 +426,10 @@ void SocksConnection::processSocksData()
             break;
         case State::Connected:
             forwardData(_socksSocket, _targetSocket, QStringLiteral("outbound"));
+#ifdef Q_OS_LINUX
+            if(_state == State::Connected)
+                startSpliceRelay();
+#endif
             break;
         default:
         case State::SocksDisconnecting:
@@ -693,15 +462,11 @@ void SocksConnection::onSocksDisconnected()
     switch(_state)
     {
         default:
-        case State::ReceiveAuthMethodsHeader:
-        case State::ReceiveAuthMethods:
-        case State::ReceiveConnectHeader:
-        case State::ReceiveConnectIPv4:
-        case State::ReceiveConnectIPv6:
+        case State::Negotiating:
         case State::Connecting:
         case State::TargetDisconnecting:
         case State::Closed:
-            // Unexpected, abort.  Can occur in Receive* or Connecting if the
+            // Unexpected, abort.  Can occur in Negotiating or Connecting if the
             // SOCKS side disconnects unexpectedly.  Shouldn't occur in
             // TargetDisconnecting/Closed; would indicate that we received
             // more than one disconnect signal.
@@ -728,11 +493,7 @@ void SocksConnection::onTargetConnected()
     switch(_state)
     {
         default:
-        case State::ReceiveAuthMethodsHeader:
-        case State::ReceiveAuthMethods:
-        case State::ReceiveConnectHeader:
-        case State::ReceiveConnectIPv4:
-        case State::ReceiveConnectIPv6:
+        case State::Negotiating:
         case State::Connected:
         case State::SocksDisconnecting:
         case State::TargetDisconnecting:
@@ -746,23 +507,15 @@ void SocksConnection::onTargetConnected()
         {
             _state = State::Connected;
             // Send the success reply to the SOCKS connection
-            QByteArray response{ConnectResponseMsg::Length, 0};
-            response[ConnectResponseMsg::Version] = SocksVersion;
-            response[ConnectResponseMsg::AddrType] = AddressType::IPv4;
-            response[ConnectResponseMsg::Reply] = Reply::Succeeded;
             QHostAddress localHostAddr = _targetSocket.localAddress();
-            quint32 localAddr = localHostAddr.toIPv4Address();
-            response[ConnectResponseMsg::Addr] = static_cast<quint8>(localAddr >> 24);
-            response[ConnectResponseMsg::Addr+1] = static_cast<quint8>(localAddr >> 16);
-            response[ConnectResponseMsg::Addr+2] = static_cast<quint8>(localAddr >> 8);
-            response[ConnectResponseMsg::Addr+3] = static_cast<quint8>(localAddr);
             quint16 localPort = _targetSocket.localPort();
-            response[ConnectResponseMsg::Port] = static_cast<quint8>(localPort >> 8);
-            response[ConnectResponseMsg::Port+1] = static_cast<quint8>(localPort);
+            auto response = SocksNegotiation::connectResponse(SocksNegotiation::Reply::Succeeded,
+                                                              localHostAddr.toIPv4Address(),
+                                                              localPort);
             qInfo() << "API proxy:" << this << "Connected" << localHostAddr << ":" << localPort << "->"
                 << _targetSocket.peerAddress() << ":"
                 << _targetSocket.peerPort();
-            respond(response);
+            respond(responseData(response));
 
             // Forward any data that had already arrived from either end,
             // unless we aborted in respond()
@@ -771,6 +524,11 @@ void SocksConnection::onTargetConnected()
             // Could also have aborted in the first forwardData() call
             if(_state == State::Connected)
                 forwardData(_targetSocket, _socksSocket, QStringLiteral("inbound"));
+#ifdef Q_OS_LINUX
+            // Hand the sockets over to the splice relay if possible
+            if(_state == State::Connected)
+                startSpliceRelay();
+#endif
 
             break;
         }
@@ -790,11 +548,7 @@ void SocksConnection::onTargetError(QAbstractSocket::SocketError socketError)
     switch(_state)
     {
         default:
-        case State::ReceiveAuthMethodsHeader:
-        case State::ReceiveAuthMethods:
-        case State::ReceiveConnectHeader:
-        case State::ReceiveConnectIPv4:
-        case State::ReceiveConnectIPv6:
+        case State::Negotiating:
         case State::Connected:
         case State::SocksDisconnecting:
         case State::TargetDisconnecting:
@@ -808,32 +562,28 @@ void SocksConnection::onTargetError(QAbstractSocket::SocketError socketError)
         {
             _state = State::SocksDisconnecting;
             // Send the failure reply to the SOCKS connection
-            QByteArray response{ConnectResponseMsg::Length, 0};
-            response[ConnectResponseMsg::Version] = SocksVersion;
-            response[ConnectResponseMsg::AddrType] = AddressType::IPv4;
-
-            Reply result;
+            SocksNegotiation::Reply result;
             switch(socketError)
             {
                 default:
-                    result = Reply::GeneralFailure;
+                    result = SocksNegotiation::Reply::GeneralFailure;
                     break;
                 case QAbstractSocket::SocketError::NetworkError:
-                    result = Reply::NetUnreachable;
+                    result = SocksNegotiation::Reply::NetUnreachable;
                     break;
                 case QAbstractSocket::SocketError::HostNotFoundError:
-                    result = Reply::HostUnreachable;
+                    result = SocksNegotiation::Reply::HostUnreachable;
                     break;
                 case QAbstractSocket::SocketError::ConnectionRefusedError:
-                    result = Reply::ConnectionRefused;
+                    result = SocksNegotiation::Reply::ConnectionRefused;
                     break;
             }
-            response[ConnectResponseMsg::Reply] = result;
+            auto response = SocksNegotiation::connectResponse(result);
 
             qInfo() << "API proxy:" << this << "SOCKS connection to" << _targetSocket.peerAddress()
                 << ":" << _targetSocket.peerPort() << "failed with error"
                 << traceEnum(socketError) << "- respond with code" << result;
-            rejectConnection(response);
+            rejectConnection(responseData(response));
 
             break;
         }
@@ -845,11 +595,7 @@ void SocksConnection::onTargetReadyRead()
     switch(_state)
     {
         default:
-        case State::ReceiveAuthMethodsHeader:
-        case State::ReceiveAuthMethods:
-        case State::ReceiveConnectHeader:
-        case State::ReceiveConnectIPv4:
-        case State::ReceiveConnectIPv6:
+        case State::Negotiating:
         case State::Connecting:
             // Not ready to forward data, let the QTcpSocket buffer it
             qInfo() << "API proxy:" << this << "Buffering data from target in state" << traceEnum(_state)
@@ -857,6 +603,10 @@ void SocksConnection::onTargetReadyRead()
             break;
         case State::Connected:
             forwardData(_targetSocket, _socksSocket, QStringLiteral("inbound"));
+#ifdef Q_OS_LINUX
+            if(_state == State::Connected)
+                startSpliceRelay();
+#endif
             break;
         case State::SocksDisconnecting:
         case State::TargetDisconnecting:
@@ -875,15 +625,11 @@ void SocksConnection::onTargetDisconnected()
     switch(_state)
     {
         default:
-        case State::ReceiveAuthMethodsHeader:
-        case State::ReceiveAuthMethods:
-        case State::ReceiveConnectHeader:
-        case State::ReceiveConnectIPv4:
-        case State::ReceiveConnectIPv6:
+        case State::Negotiating:
         case State::Connecting:
         case State::SocksDisconnecting:
         case State::Closed:
-            // Unexpected, abort.  Can occur in Receive* or Connecting if the
+            // Unexpected, abort.  Can occur in Negotiating or Connecting if the
             // SOCKS side disconnects unexpectedly.  Shouldn't occur in
             // TargetDisconnecting/Closed; would indicate that we received
             // more than one disconnect signal.
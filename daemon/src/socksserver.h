@@ -25,6 +25,11 @@
 #include <QTcpServer>
 #include <QTcpSocket>
 #include <QTimer>
+#include "socksnegotiation.h"
+
+#ifdef Q_OS_LINUX
+#include "linux/linux_splicerelay.h"
+#endif
 
 // SocksServer runs a minimal TCP SOCKS5 server that forwards connections
 // through the VPN interface.  This is used to route QNetworkAccessManager-based
@@ -44,7 +49,7 @@ public:
     quint16 port() const {return _server.serverPort();}
     // Get the password to the proxy.  SocksServer generates a password to
     // ensure that only the daemon can connect to it.  The user name is always
-    // SocksConnection::username.
+    // SocksNegotiation::username.
     QByteArray password() const {return _password;}
 
     // Update the bind address - the new address must be a valid IPv4 address.
@@ -67,34 +72,19 @@ class SocksConnection : public QObject
     Q_OBJECT
 
 public:
-    static const QByteArray username;
+#ifdef Q_OS_LINUX
+    // Enable or disable the splice() relay for new connections (enabled by
+    // default).  When disabled, data are relayed through the QTcpSockets.
+    // Used by unit tests to compare the two relays.
+    static void setSpliceRelayEnabled(bool enabled);
+#endif
 
 public:
     // Lifecycle of a SOCKS5 connection
     enum class State
     {
-        // Receive the VER and NMETHODS bytes of the client greeting.
-        // RFC1928 documents this and the methods themselves as one greeting
-        // message, but we treat them separately since this part specifies the
-        // length of the next part.
-        ReceiveAuthMethodsHeader,
-        // Receive the variable-length method list.  The response is sent when
-        // this completes.
-        ReceiveAuthMethods,
-        // Receive the auth username header (version and name length)
-        ReceiveAuthUsernameHeader,
-        // Recieve the auth username
-        ReceiveAuthUsername,
-        // Receive the auth password header (password length)
-        ReceiveAuthPasswordHeader,
-        // Receive the auth password
-        ReceiveAuthPassword,
-        // Receive the TCP connect request header - everything up to the address
-        // type, which determines the length of the rest of the message.
-        ReceiveConnectHeader,
-        // Receive the rest of the connect request, for either IPv4 or IPv6
-        ReceiveConnectIPv4,
-        ReceiveConnectIPv6,
+        // Receive negotiation messages - see SocksNegotiation
+        Negotiating,
         // We're connecting the outgoing socket; response is sent when this
         // completes.
         Connecting,
@@ -142,17 +132,22 @@ private:
     // aborts if the response can't be sent.)
     void rejectConnection(const QByteArray &response);
 
-    // Check the protocol version in a message - aborts if it is invalid
-    // (returns false in that case).
-    bool checkMessageVersion(const QByteArray &message, quint8 version,
-                             const QString &traceName);
-    bool checkSocksVersion(const QByteArray &message);
-    bool checkUPAuthVersion(const QByteArray &message);
+    // Start connecting to the target requested by the SOCKS client (goes to
+    // the Connecting state).
+    void connectTarget(quint32 address, quint16 port);
 
     // Forward all available data in both directions.  If any write fails, this
     // aborts the connection.
     void forwardData(QTcpSocket &source, QTcpSocket &dest,
                      const QString &directionTrace);
+#ifdef Q_OS_LINUX
+    // In the Connected state, hand both sockets over to a SpliceRelay once
+    // the QTcpSockets have no buffered data.  If the QTcpSockets still have
+    // data to write, this is retried when data are written.
+    void startSpliceRelay();
+    void onRelayEndpointClosed(SpliceRelay::Endpoint endpoint);
+    void onRelayFinished();
+#endif
     // Process incoming data on the SOCKS connection (protocol messages or
     // application data).  Used by onSocksReadyRead().
     void processSocksData();
@@ -183,10 +178,18 @@ private:
     // - If either side disconnects, the other side has 5 seconds to recieve any
     //   remaining data and disconnect
     QTimer _abortTimer;
-    // In Receive* states, the number of bytes in the next message.  In other
-    // states, 0.
-    qint64 _nextMessageBytes;
+    // Parses the negotiation messages in the Negotiating state
+    SocksNegotiation _negotiation;
     QTcpSocket _targetSocket;
+#ifdef Q_OS_LINUX
+    // Once connected, data are relayed by SpliceRelay instead of the
+    // QTcpSockets.  The QTcpSockets are closed at that point; the relay has
+    // duplicates of their descriptors.
+    nullable_t<SpliceRelay> _pRelay;
+    // Set if the relay couldn't be started; the QTcpSockets are used for the
+    // rest of the connection.
+    bool _spliceRelayFailed{false};
+#endif
 };
 
 #endif
@@ -31,6 +31,29 @@ void SocksServerThread::start(QHostAddress bindAddress, QString bindInterface)
     // Checked by caller
     Q_ASSERT(bindAddress.protocol() == QAbstractSocket::NetworkLayerProtocol::IPv4Protocol);
 
+#ifdef Q_OS_LINUX
+    if(_pEpollProxy)
+    {
+        qInfo() << "Updating SOCKS server bind address to" << bindAddress;
+        _pEpollProxy->updateBindAddress(bindAddress, bindInterface);
+        return;
+    }
+    if(!_pSocksServer)
+    {
+        _pEpollProxy.reset(new EpollSocksProxy{bindAddress, bindInterface});
+        _port = _pEpollProxy->port();
+        _password = _pEpollProxy->password();
+        if(_port)
+        {
+            qInfo() << "Started SOCKS server on port" << _port
+                << "with bind address" << bindAddress;
+            return;
+        }
+        qWarning() << "Unable to start epoll SOCKS server, falling back to SocksServer";
+        _pEpollProxy.reset();
+    }
+#endif
+
     _thread.invokeOnThread([&]()
     {
         if(_pSocksServer)
@@ -63,6 +86,16 @@ void SocksServerThread::start(QHostAddress bindAddress, QString bindInterface)
 
 void SocksServerThread::stop()
 {
+#ifdef Q_OS_LINUX
+    if(_pEpollProxy)
+    {
+        qInfo() << "Stopping SOCKS server";
+        _pEpollProxy.reset();
+        _port = 0;
+        return;
+    }
+#endif
+
     _thread.invokeOnThread([&]()
     {
         if(_pSocksServer)
@@ -26,8 +26,16 @@
 #include "thread.h"
 #include <QPointer>
 
+#ifdef Q_OS_LINUX
+#include "linux/linux_epollsocks.h"
+#include <memory>
+#endif
+
 // SocksServerThread just runs a SocksServer on a worker thread.  The server can
 // be started and stopped.
+//
+// On Linux, it runs an EpollSocksProxy instead, which has its own thread.  (If
+// that can't start, it falls back to SocksServer.)
 class SocksServerThread : public QObject
 {
     Q_OBJECT
@@ -48,6 +56,9 @@ public:
     const QByteArray &password() const {return _password;}
 
 private:
+#ifdef Q_OS_LINUX
+    std::unique_ptr<EpollSocksProxy> _pEpollProxy;
+#endif
     RunningWorkerThread _thread;
     QPointer<SocksServer> _pSocksServer;
     quint16 _port;
@@ -78,20 +78,22 @@ namespace
     const std::chrono::hours versionRefreshInterval{1};
 }
 
-Update::Update(const QString &uri, const QString &version, const QString &osRequired)
+Update::Update(const QString &uri, const QString &version, const QString &osRequired,
+               const QString &sha256)
 {
     if(!uri.isEmpty() && !version.isEmpty())
     {
         _uri = uri;
         _version = version;
         _osRequired = osRequired;
+        _sha256 = sha256;
     }
 }
 
 bool Update::operator==(const Update &other) const
 {
     return uri() == other.uri() && version() == other.version() &&
-        osRequired() == other.osRequired();
+        osRequired() == other.osRequired() && sha256() == other.sha256();
 }
 
 UpdateChannel::UpdateChannel()
@@ -143,6 +145,8 @@ void UpdateChannel::checkVersionMetadata(const QJsonDocument &regionsDoc)
     const QString &latestVersion = platformObj[QStringLiteral("version")].toString();
     const QString &downloadUrl = platformObj[QStringLiteral("download")].toString();
     const QString &osVersionRequirement = platformObj[QStringLiteral("required")].toString();
+    // Optional - if present, the download is verified against this digest
+    const QString &downloadSha256 = platformObj[QStringLiteral("sha256")].toString();
 
     // If something is missing from the server data, log a warning just for
     // diagnostic purposes.
@@ -155,7 +159,7 @@ void UpdateChannel::checkVersionMetadata(const QJsonDocument &regionsDoc)
 
     // Store the update.  (Update ignores partial data if the server returned
     // only a URI or version somehow.)
-    _update = Update{downloadUrl, latestVersion, osVersionRequirement};
+    _update = Update{downloadUrl, latestVersion, osVersionRequirement, downloadSha256};
 }
 
 void UpdateChannel::run(bool newRunning, const std::shared_ptr<ApiBase> &pUpdateApi)
@@ -474,58 +478,30 @@ Async<DownloadResult> UpdateDownloader::downloadUpdate()
         qWarning() << "Can't download update, no update is available";
         return Async<DownloadResult>::resolve();
     }
-    if(_pDownloadReply)
+    if(_pDownload)
     {
         qWarning() << "Already downloading an update, can't start again";
         return Async<DownloadResult>::resolve(DownloadResult().version(availableUpdate.version()));
     }
 
-    // Class invariant - open when _pDownloadReply is set
-    Q_ASSERT(!_installerFile.isOpen());
-
     QUrl reqUrl{availableUpdate.uri()};
-
-    // Open the installer file in the download location.
     Path downloadPath{Path::DaemonUpdateDir / reqUrl.fileName()};
-    _installerFile.unsetError();
-    _installerFile.setFileName(downloadPath);
-
-    // Attempt to clean any old downloads that exist to limit accumulation of
-    // installers.  Failure does not prevent us from downloading the new file
-    // though.
-    // Note that QDir::removeRecursively() returns true (success) if the
-    // directory doesn't exist ("expected result already reached" per doc).
-    if(!QDir{Path::DaemonUpdateDir}.removeRecursively())
-    {
-        qWarning() << "Unable to clean update directory:"
-            << Path::DaemonUpdateDir;
-    }
 
+    // Clean any old downloads that exist to limit accumulation of installers,
+    // but keep partial data for this file so the download can resume.
+    cleanUpdateDir(reqUrl.fileName());
     Path::DaemonUpdateDir.mkpath();
-    if(!_installerFile.open(QFile::OpenModeFlag::WriteOnly | QFile::OpenModeFlag::Truncate))
-    {
-        // Can't open the file for some reason.  This could legitimately happen,
-        // ensure that it's visible if it does.
-        qError() << "Can't download installer - can't open file"
-            << downloadPath << "due to error" << _installerFile.error();
-        emit downloadFailed(availableUpdate.version(), true);
-        // This call did initiate a download, but it failed.
-        return Async<DownloadResult>::resolve(DownloadResult().version(availableUpdate.version()).failed(true));
-    }
 
-    QNetworkRequest downloadReq{availableUpdate.uri()};
-    _pDownloadReply = ApiNetwork::instance()->getAccessManager().get(downloadReq);
-    _pDownloadReply->setParent(this);
+    _pDownload = new ResumableDownload{reqUrl, downloadPath,
+                                       availableUpdate.sha256().toLatin1()};
+    _pDownload->setParent(this);
     _pDownloadTask = Async<DownloadResult>::create();
     _downloadingVersion = availableUpdate.version();
-    // There is no timeout on this download, but the user can cancel it
-    // manually if it appears to be stuck but does not fail.
-    connect(_pDownloadReply, &QNetworkReply::downloadProgress, this,
+    connect(_pDownload, &ResumableDownload::progress, this,
             &UpdateDownloader::onDownloadProgress);
-    connect(_pDownloadReply, &QIODevice::readyRead, this,
-            &UpdateDownloader::onDownloadReadyRead);
-    connect(_pDownloadReply, &QNetworkReply::finished, this,
+    connect(_pDownload, &ResumableDownload::finished, this,
             &UpdateDownloader::onDownloadFinished);
+    _pDownload->start();
     emit downloadProgress(_downloadingVersion, 0);
 
     return _pDownloadTask;
@@ -535,111 +511,105 @@ void UpdateDownloader::cancelDownload()
 {
     // Client only shows this UI when a download is in progress, don't need to
     // provide feedback for this case.
-    if(!_pDownloadReply)
+    if(!_pDownload)
     {
         qWarning() << "Can't cancel download, no download is taking place";
         return;
     }
 
-    _pDownloadReply->abort();
+    _pDownload->cancel();
 }
 
 void UpdateDownloader::onDownloadProgress(qint64 bytesReceived,
                                           qint64 bytesTotal)
 {
     // Class invariant - valid when this signal is connected
-    Q_ASSERT(_pDownloadReply);
-    // Class invariant - set when _pDownloadReply is set
+    Q_ASSERT(_pDownload);
+    // Class invariant - set when _pDownload is set
     Q_ASSERT(!_downloadingVersion.isEmpty());
 
-    // This signal can be emitted with bytesTotal == 0 if the download fails
-    // before getting the content length from the server (or presumably if the
-    // file isn't found, etc.).
+    // bytesTotal is -1 until the content length is known from the server.
     int progressPct = 0;
     if(bytesTotal > 0 && bytesReceived >= 0)
         progressPct = static_cast<int>(bytesReceived * 100 / bytesTotal);
     emit downloadProgress(_downloadingVersion, progressPct);
 }
 
-void UpdateDownloader::onDownloadReadyRead()
-{
-    // Class invariant - valid when this signal is connected
-    Q_ASSERT(_pDownloadReply);
-    // Class invariant - file open when _pDownloadReply is set
-    Q_ASSERT(_installerFile.isOpen());
-
-    // Write the new data to the file.
-    // QIODevice doesn't provide any way to observe the new data without copying
-    // it, so we make a copy here just to write it and throw the copy away.
-    if(_installerFile.write(_pDownloadReply->readAll()) < 0)
-    {
-        // The write failed, cancel the download by aborting the network
-        // request.  This will cause onDownloadFinished() to be called with an
-        // error, which will close the file and emit downloadFailed().
-        qError() << "Failed to write to installer file"
-            << _installerFile.fileName() << "-" << _installerFile.error();
-        _pDownloadReply->abort();
-    }
-}
-
-void UpdateDownloader::onDownloadFinished()
+void UpdateDownloader::onDownloadFinished(ResumableDownload::Result result)
 {
     // Class invariant - valid when this signal is connected
-    Q_ASSERT(_pDownloadReply);
-    // Class invariant - valid when _pDownloadReply is set
+    Q_ASSERT(_pDownload);
+    // Class invariant - valid when _pDownload is set
     Q_ASSERT(_pDownloadTask);
-    // Class invariant - file open when _pDownloadReply is set
-    Q_ASSERT(_installerFile.isOpen());
-    // Class invariant - set when _pDownloadReply is set
+    // Class invariant - set when _pDownload is set
     Q_ASSERT(!_downloadingVersion.isEmpty());
 
-    // Delete the reply when we're done here
-    _pDownloadReply->deleteLater();
-    _installerFile.close();
+    // Delete the download when we're done here
+    _pDownload->deleteLater();
 
-    // Reset _pDownloadReply, _pDownloadTask, and _downloadingVersion since the
-    // download is finished and we've closed the file.
-    QPointer<QNetworkReply> pFinishedReply;
-    _pDownloadReply.swap(pFinishedReply);
+    // Reset _pDownload, _pDownloadTask, and _downloadingVersion since the
+    // download is finished.
+    QPointer<ResumableDownload> pFinishedDownload;
+    _pDownload.swap(pFinishedDownload);
     Async<DownloadResult> pFinishedTask;
     _pDownloadTask.swap(pFinishedTask);
     QString finishedVersion;
     _downloadingVersion.swap(finishedVersion);
 
-    // Check if the download failed
     DownloadResult taskResult;
     taskResult.version(finishedVersion);
-    auto error = pFinishedReply->error();
-    if(error != QNetworkReply::NetworkError::NoError)
+    if(result == ResumableDownload::Result::Succeeded)
     {
-        qInfo() << "Installer download of" << finishedVersion << "from"
-            << pFinishedReply->url() << "failed with error:"
-            << qEnumToString(error);
-        // Delete the partial file - failure is ignored
-        _installerFile.remove();
-        // 'OperationCanceledError' indicates that the user canceled the
-        // download (we only call abort() due to a user cancellation).
-        bool dueToError = error != QNetworkReply::NetworkError::OperationCanceledError;
-        emit downloadFailed(finishedVersion, dueToError);
-        // The result is an error if we detected an error above, canceled
-        // otherwise.
-        taskResult.failed(dueToError);
-    }
-    else
-    {
-        // Otherwise, we're done, the download succeeded
 #ifdef Q_OS_LINUX
         // Add the executable bit on Linux so the client can execute the
         // downloaded installer.
-        Exec::cmd(QStringLiteral("chmod"), {"a+x", _installerFile.fileName()});
+        Exec::cmd(QStringLiteral("chmod"), {"a+x", pFinishedDownload->targetPath()});
 #endif
-        emit downloadFinished(finishedVersion, _installerFile.fileName());
+        emit downloadFinished(finishedVersion, pFinishedDownload->targetPath());
         taskResult.succeeded(true);
     }
+    else
+    {
+        // ResumableDownload has already traced the details.  A canceled
+        // download was requested by the user, anything else is an error.
+        qInfo() << "Installer download of" << finishedVersion << "did not complete:"
+            << (result == ResumableDownload::Result::Canceled ? "canceled" : "failed");
+        bool dueToError = result != ResumableDownload::Result::Canceled;
+        emit downloadFailed(finishedVersion, dueToError);
+        taskResult.failed(dueToError);
+    }
     // Resolve the existing task
     pFinishedTask->resolve(std::move(taskResult));
 }
 
+void UpdateDownloader::cleanUpdateDir(const QString &fileName)
+{
+    QDir updateDir{Path::DaemonUpdateDir};
+    // Failure to remove anything is traced but does not prevent the download.
+    // (entryInfoList() is empty if the directory doesn't exist.)
+    const auto &entries = updateDir.entryInfoList(QDir::Filter::AllEntries |
+                                                  QDir::Filter::Hidden |
+                                                  QDir::Filter::System |
+                                                  QDir::Filter::NoDotAndDotDot);
+    for(const auto &entry : entries)
+    {
+        if(entry.fileName() == fileName + ResumableDownload::partSuffix ||
+           entry.fileName() == fileName + ResumableDownload::stateSuffix)
+        {
+            continue;
+        }
+
+        bool removed = entry.isDir() ?
+            QDir{entry.filePath()}.removeRecursively() :
+            QFile::remove(entry.filePath());
+        if(!removed)
+        {
+            qWarning() << "Unable to clean update directory entry:"
+                << entry.filePath();
+        }
+    }
+}
+
 bool UpdateDownloader::validateOSRequirements(const QString &requirement) const
 {
 #ifdef Q_OS_MAC
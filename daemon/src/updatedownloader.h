@@ -27,6 +27,7 @@
 #include "json.h"
 #include "apiclient.h"
 #include "jsonrefresher.h"
+#include "resumabledownload.h"
 #include <QObject>
 #include <QJsonDocument>
 #include <QNetworkAccessManager>
@@ -58,7 +59,7 @@ public:
 };
 
 // Object representing an update available from an update channel - a version
-// string and download URI.
+// string and download URI, and optionally the SHA-256 digest of the download.
 //
 // Always has both or neither part set (can never be partially valid), but the
 // version string is not necessarily valid at this point.
@@ -70,7 +71,8 @@ public:
     // Construct Update with the URI and version.  If either is empty, both
     // strings are left empty in the resulting object (there is never a
     // partially-valid Update).
-    Update(const QString &uri, const QString &version, const QString &osRequired);
+    Update(const QString &uri, const QString &version, const QString &osRequired,
+           const QString &sha256 = {});
 
 public:
     // A valid Update has a non-empty URI and version.
@@ -78,12 +80,15 @@ public:
     const QString &uri() const {return _uri;}
     const QString &version() const {return _version;}
     const QString &osRequired() const {return _osRequired;}
+    // Hex SHA-256 digest of the download, empty if the metadata didn't
+    // provide one.
+    const QString &sha256() const {return _sha256;}
 
     bool operator==(const Update &other) const;
     bool operator!=(const Update &other) const {return !(*this == other);}
 
 private:
-    QString _uri, _version, _osRequired;
+    QString _uri, _version, _osRequired, _sha256;
 };
 
 inline QDebug &operator<<(QDebug &dbg, const Update &update)
@@ -247,6 +252,8 @@ public:
 
     // Start downloading the latest update.  Emits downloadProgress() initially
     // with progress 0, then periodically as the download progresses.
+    // Interrupted downloads are resumed, including a download left incomplete
+    // by an earlier failure or daemon restart (see ResumableDownload).
     // When the download completes, downloadFinished() is emitted with the path
     // to the downloaded file.  If the download fails, downloadFailed() is
     // emitted.
@@ -264,8 +271,10 @@ public:
 
 private:
     void onDownloadProgress(qint64 bytesReceived, qint64 bytesTotal);
-    void onDownloadReadyRead();
-    void onDownloadFinished();
+    void onDownloadFinished(ResumableDownload::Result result);
+    // Remove old downloads from the update directory, except for the partial
+    // data of the file named fileName (which can be resumed).
+    void cleanUpdateDir(const QString &fileName);
     bool validateOSRequirements(const QString &requirement) const;
 
 signals:
@@ -299,20 +308,16 @@ private:
     UpdateChannel _gaChannel, _betaChannel;
     // Whether the beta channel is enabled
     bool _enableBeta;
-    // Network reply for the download in progress (prevents us from starting
-    // another download)
-    QPointer<QNetworkReply> _pDownloadReply;
+    // The download in progress (prevents us from starting another download)
+    QPointer<ResumableDownload> _pDownload;
     // Task to resolve/reject for the download in progress.  Set when
-    // _pDownloadReply is set.
+    // _pDownload is set.
     Async<DownloadResult> _pDownloadTask;
     // The version being downloaded.  Normally, this is the same as
     // _availableVersion, but it can be different if a refresh occurs during a
-    // download, and the available version changes.  Set when _pDownloadReply is
+    // download, and the available version changes.  Set when _pDownload is
     // set.
     QString _downloadingVersion;
-    // When a download is in progress, the file we are writing to.  This holds
-    // an open file when _pDownloadReply is set, it is closed otherwise.
-    QFile _installerFile;
 };
 
 #endif
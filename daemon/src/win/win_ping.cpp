@@ -115,6 +115,10 @@ QPointer<WinIcmpEcho> WinIcmpEcho::send(quint32 address,
         ip_opts.Flags = IP_FLAG_DF | IP_OPT_ROUTER_ALERT;
     }
 
+    // Time the echo individually, so echoes sent later in a batch aren't
+    // penalized.  (IcmpSendEcho2() does report a round trip time, but only in
+    // whole milliseconds.)
+    pEcho->_sentTime.start();
     auto result = ::IcmpSendEcho2(icmp, pEcho->_event, nullptr, nullptr,
                                   pingAddr, payload, payloadSize,
                                   allowFragments ? nullptr : &ip_opts,
@@ -254,7 +258,10 @@ void WinIcmpEcho::onEventActivated()
 
     quint32 replyAddr = ntohl(pReplyData->Address);
     if(pReplyData->Status == IP_SUCCESS)
-        emit receivedReply(replyAddr);
+    {
+        emit receivedReply(replyAddr,
+                           std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds{_sentTime.nsecsElapsed()}));
+    }
     else if(shouldTraceIcmpError(pReplyData->Status))
     {
         qWarning() << "Received error from ICMP echo to"
@@ -23,8 +23,10 @@
 #define WIN_PING_H
 
 #include "win/win_util.h"
+#include <QElapsedTimer>
 #include <QPointer>
 #include <QWinEventNotifier>
+#include <chrono>
 #include <vector>
 #include <Windows.h>
 
@@ -62,8 +64,9 @@ private:
     void onEventActivated();
 
 signals:
-    // Emitted when the reply is received.
-    void receivedReply(quint32 address);
+    // Emitted when the reply is received, with the time elapsed since the echo
+    // was sent.
+    void receivedReply(quint32 address, std::chrono::microseconds roundTrip);
     void receivedError(int errCode);
 
 private:
@@ -72,6 +75,8 @@ private:
     // Buffer provided to IcmpSendEcho2() for the reply
     std::vector<quint8> _replyBuffer;
     QWinEventNotifier _notifier;
+    // Started when the echo is sent
+    QElapsedTimer _sentTime;
 };
 
 #endif
@@ -55,7 +55,7 @@ static void serviceMain(int argc, wchar_t** argv)
         QCoreApplication app(c, &v);
 
         Path::initializePostApp();
-        Logger logSingleton{Path::DaemonLogFile};
+        Logger logSingleton{Path::DaemonLogFile, Logger::WriteMode::Asynchronous};
 
         WinService service;
         QObject::connect(&service, &Daemon::started, [&service]
@@ -108,3 +108,18 @@ QString wgKeyToB64(const wg_key &key)
     auto base64Ascii = QByteArray::fromRawData(reinterpret_cast<const char*>(&key[0]), sizeof(key)).toBase64();
     return QString::fromLatin1(base64Ascii);
 }
+
+auto WireguardBackend::getTrafficStats() -> Async<TrafficStats>
+{
+    return getStatus()->then([](const WgDevPtr &pDev)
+    {
+        Q_ASSERT(pDev); // Postcondition of getStatus()
+        TrafficStats stats{0, 0};
+        for(auto pPeer = pDev->first_peer; pPeer; pPeer = pPeer->next_peer)
+        {
+            stats.rxBytes += pPeer->rx_bytes;
+            stats.txBytes += pPeer->tx_bytes;
+        }
+        return stats;
+    });
+}
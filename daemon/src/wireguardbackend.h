@@ -104,6 +104,13 @@ public:
     // allocated).
     using WgDevPtr = std::shared_ptr<wg_device>;
 
+    // Cumulative traffic counters for the interface
+    struct TrafficStats
+    {
+        quint64 rxBytes;
+        quint64 txBytes;
+    };
+
 public:
     // shutdown() will be called before destroying the backend to permit
     // asynchronous shutdown (even if createInterface() was not called or
@@ -152,6 +159,12 @@ public:
     // must be valid.
     virtual Async<WgDevPtr> getStatus() = 0;
 
+    // Get the interface's traffic counters.  This is polled more often than
+    // getStatus(), so backends that can read the counters without a complete
+    // device dump should override this.  The default implementation sums the
+    // peers' counters from getStatus().
+    virtual Async<TrafficStats> getTrafficStats();
+
     // Shut down the device; called before the WireguardBackend is destroyed.
     // If shutdown times out, or the task is rejected, the backend will still be
     // destroyed.
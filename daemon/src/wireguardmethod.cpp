@@ -35,6 +35,7 @@
     #include "linux/wireguardkernelbackend.h"
     #include "linux/linux_fwmark.h"
     #include "linux/linux_routing.h"
+    #include "filewatcher.h"
 #endif
 
 #if defined(Q_OS_WIN)
@@ -61,6 +62,21 @@ namespace
 
     const std::chrono::seconds statsInterval{5};
 
+    // Interval of handshake checks once the interface is up.  These need the
+    // complete device status (all peers and allowed IPs), so they're less
+    // frequent than stat updates, which only need the traffic counters.
+    const std::chrono::seconds handshakeCheckInterval{15};
+
+#ifdef Q_OS_LINUX
+    // When resolv.conf changes, wait this long before checking it so a burst
+    // of writes (NetworkManager, dhclient, etc.) results in one check and one
+    // fix.
+    const std::chrono::milliseconds resolvConfSettleDelay{250};
+    // If resolv.conf can't be watched (such as when the inotify watch limit
+    // has been reached), check it this often instead
+    const std::chrono::seconds resolvConfPollInterval{5};
+#endif
+
     // Creating the interface must complete within this timeout
 #ifndef Q_OS_WINDOWS
     const std::chrono::seconds createInterfaceTimeout{10};
@@ -195,12 +211,22 @@ private:
     // Update stats with the latest information from the adapter
     void updateStats();
 
+    // Check the peer handshake periodically once the interface is up
+    void checkHandshake();
+
     // Ping the endpoint
     void pingEndpoint();
 
     // Verify that pings are hitting endpoiint
     void checkPing(const quint64 &rx, const quint64 &tx);
 
+    // Start or stop watching resolv.conf (Linux only; no-op on other
+    // platforms)
+    void startDNSWatch();
+    void stopDNSWatch();
+    // Poll resolv.conf if the watch couldn't be established, or stop polling
+    // if it has been
+    void updateDNSPoll();
     void checkDNS();
     void fixDNS(const QByteArray &existingContent, const QByteArray &expectedContent);
 
@@ -236,6 +262,15 @@ private:
     QTimer _firstHandshakeTimer;
     // Stats timer - started when WG interface is configured
     QTimer _statsTimer;
+    // Handshake timer - also started when WG interface is configured
+    QTimer _handshakeTimer;
+#ifdef Q_OS_LINUX
+    // Watches resolv.conf (and /etc, to catch replace-by-rename) once the
+    // interface is up.  Changes are coalesced for resolvConfSettleDelay.
+    nullable_t<FileWatcher> _pResolvConfWatcher;
+    // Checks resolv.conf periodically while it can't be watched
+    QTimer _dnsPollTimer;
+#endif
     // Connection configuration
     ConnectionConfig _connectionConfig;
     // The address of the VPN host
@@ -274,6 +309,14 @@ WireguardMethod::WireguardMethod(QObject *pParent, const OriginalNetworkScan &ne
     _statsTimer.setInterval(msec(statsInterval));
     connect(&_statsTimer, &QTimer::timeout, this,
         &WireguardMethod::updateStats);
+    _handshakeTimer.setInterval(msec(handshakeCheckInterval));
+    connect(&_handshakeTimer, &QTimer::timeout, this,
+        &WireguardMethod::checkHandshake);
+#ifdef Q_OS_LINUX
+    _dnsPollTimer.setInterval(msec(resolvConfPollInterval));
+    connect(&_dnsPollTimer, &QTimer::timeout, this,
+        &WireguardMethod::checkDNS);
+#endif
 }
 
 WireguardMethod::~WireguardMethod()
@@ -567,6 +610,8 @@ void WireguardMethod::createInterface(const WireguardKeypair &clientKeypair,
             _firstHandshakeElapsed.start();
             _firstHandshakeTimer.start();
             _statsTimer.start();
+            _handshakeTimer.start();
+            startDNSWatch();
         });
 }
 
@@ -901,9 +946,16 @@ void WireguardMethod::updateStats()
     if(state() >= State::Exiting)
         return;
 
-    getWireguardDevice()
+    if(!_pBackend)
+    {
+        qWarning() << "Can't get WireGuard stats - backend not created or was destroyed";
+        raiseError({HERE, Error::Code::WireguardDeviceLost});
+        return;
+    }
+
+    _pBackend->getTrafficStats()
         .timeout(statFetchTimeout)
-        ->notify(this, [this](const Error &err, const WireguardBackend::WgDevPtr &pDev)
+        ->notify(this, [this](const Error &err, const WireguardBackend::TrafficStats &stats)
             {
                 // If we started exiting by the time the result arrived, there's
                 // nothing to do
@@ -920,26 +972,41 @@ void WireguardMethod::updateStats()
                     return;
                 }
 
-                // Add up bytecounts
-                quint64 rx{0}, tx{0};
-                for(auto pPeer = pDev->first_peer; pPeer; pPeer = pPeer->next_peer)
-                {
-                    rx += pPeer->rx_bytes;
-                    tx += pPeer->tx_bytes;
-                }
-
                 // Trace bytecounts - this is pretty useful for diagnostics.
                 // The OpenVPN method gets this trace from the management
                 // interface, this is similar.
-                qInfo().nospace() << "BYTECOUNT: " << rx << ", " << tx;
-                emitBytecounts(rx, tx);
+                qInfo().nospace() << "BYTECOUNT: " << stats.rxBytes << ", " << stats.txBytes;
+                emitBytecounts(stats.rxBytes, stats.txBytes);
 
-                checkPeerHandshake(*pDev);
+                // Check the connection is still up
+                checkPing(stats.rxBytes, stats.txBytes);
+            });
+}
 
-                checkDNS();
+void WireguardMethod::checkHandshake()
+{
+    // If we're already exiting, there's nothing to do.
+    if(state() >= State::Exiting)
+        return;
 
-                // Check the connection is still up
-                checkPing(rx, tx);
+    getWireguardDevice()
+        .timeout(statFetchTimeout)
+        ->notify(this, [this](const Error &err, const WireguardBackend::WgDevPtr &pDev)
+            {
+                if(state() >= State::Exiting)
+                {
+                    qWarning() << "Ignoring device status, already advanced to state"
+                        << traceEnum(state());
+                    return;
+                }
+                if(err)
+                {
+                    qWarning() << "Failed to fetch device status:" << err;
+                    raiseError(err);
+                    return;
+                }
+
+                checkPeerHandshake(*pDev);
             });
 }
 
@@ -963,6 +1030,55 @@ void WireguardMethod::fixDNS(const QByteArray &existingContent, const QByteArray
     resolvConfBackup.write(existingContent);
 }
 
+void WireguardMethod::startDNSWatch()
+{
+#ifdef Q_OS_LINUX
+    // Only resolv.conf written directly by us needs to be guarded; see
+    // checkDNS().  The DNS servers are known by the time the interface is up.
+    if(_dnsServers.isEmpty())
+        return;
+
+    _pResolvConfWatcher.emplace(Path{QStringLiteral("/etc/resolv.conf")}, true,
+                                resolvConfSettleDelay);
+    connect(_pResolvConfWatcher.ptr(), &FileWatcher::changed, this,
+        &WireguardMethod::checkDNS);
+    // The watch is re-established after each change, which could also fail
+    connect(_pResolvConfWatcher.ptr(), &FileWatcher::changed, this,
+        &WireguardMethod::updateDNSPoll);
+    updateDNSPoll();
+    // Check once now in case it was changed before the watch was established
+    checkDNS();
+#endif
+}
+
+void WireguardMethod::stopDNSWatch()
+{
+#ifdef Q_OS_LINUX
+    _dnsPollTimer.stop();
+    _pResolvConfWatcher.clear();
+#endif
+}
+
+void WireguardMethod::updateDNSPoll()
+{
+#ifdef Q_OS_LINUX
+    if(_pResolvConfWatcher && !_pResolvConfWatcher->watching())
+    {
+        if(!_dnsPollTimer.isActive())
+        {
+            qWarning() << "Unable to watch resolv.conf, checking it every"
+                << traceMsec(msec(resolvConfPollInterval)) << "instead";
+            _dnsPollTimer.start();
+        }
+    }
+    else if(_dnsPollTimer.isActive())
+    {
+        qInfo() << "Watching resolv.conf, stop polling it";
+        _dnsPollTimer.stop();
+    }
+#endif
+}
+
 void WireguardMethod::checkDNS()
 {
 #ifdef Q_OS_LINUX
@@ -1129,7 +1245,9 @@ void WireguardMethod::shutdown()
         return;
 
     _statsTimer.stop();
+    _handshakeTimer.stop();
     _firstHandshakeTimer.stop();
+    stopDNSWatch();
 
     advanceState(State::Exiting);
 
@@ -16,6 +16,8 @@ module PiaUnitTest
         'latencytracker',
         'linebuffer',
         'localsockets',
+        'logging',
+        'mpscring',
         'nearestlocations',
         'networkmonitor',
         'networktaskwithretry',
@@ -24,10 +26,18 @@ module PiaUnitTest
         'originalnetworkscan',
         'openssl',
         'path',
+        'persistencewriter',
         'portforwarder',
         'raii',
+        'redactor',
+        'regiondatabase',
+        'regionlistmodel',
+        'regionsnapshot',
+        'resumabledownload',
         'semversion',
         'settings',
+        'socksnegotiation',
+        'socksserver',
         'subnetbypass',
         'tasks',
         'transportselector',
@@ -38,10 +48,19 @@ module PiaUnitTest
         if Build.windows?
             t << 'wfp_filters'
         elsif Build.linux?
+            t << 'cnproc'
+            t << 'epollsocks'
+            t << 'filewatcher'
+            t << 'iptablesfirewall'
+            t << 'linkstats'
+            t << 'nftables'
+            t << 'posixping'
+            t << 'procindex'
             t << 'splitdnsinfo'
         elsif Build.macos?
            t << 'constrainedhash'
            t << 'flow_tracker'
+           t << 'posixping'
         end
     end
 
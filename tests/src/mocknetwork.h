@@ -59,6 +59,25 @@ public:
         QTimer::singleShot(0, this, &MockNetworkReply::finished);
     }
 
+    // Set the HTTP status code and response headers seen by the code under
+    // test.  Set these before emitting finished().
+    void setStatusCode(int status)
+    {
+        setAttribute(QNetworkRequest::Attribute::HttpStatusCodeAttribute, status);
+    }
+    void setReplyHeader(const QByteArray &name, const QByteArray &value)
+    {
+        setRawHeader(name, value);
+    }
+
+    // End the reply with an error, as if the connection was lost after
+    // delivering the body so far.  The body can still be read.
+    void finishError(QNetworkReply::NetworkError code)
+    {
+        setError(code, QStringLiteral("Unit test error: %1").arg(qEnumToString(code)));
+        emit finished();
+    }
+
 protected:
     virtual qint64 readData(char *data, qint64 maxlen) override
     {
@@ -0,0 +1,91 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line SOURCE_FILE("regionfixtures.cpp")
+
+#include "regionfixtures.h"
+
+namespace RegionFixtures
+{
+    QJsonObject buildRegionsList(int countries, int regionsPerCountry)
+    {
+        QJsonObject groups
+        {
+            {QStringLiteral("ovpntcp"), QJsonArray{QJsonObject{{QStringLiteral("name"), QStringLiteral("openvpn_tcp")}, {QStringLiteral("ports"), QJsonArray{80, 443, 853, 8443}}}}},
+            {QStringLiteral("ovpnudp"), QJsonArray{QJsonObject{{QStringLiteral("name"), QStringLiteral("openvpn_udp")}, {QStringLiteral("ports"), QJsonArray{8080, 853, 123, 53}}}}},
+            {QStringLiteral("wg"), QJsonArray{QJsonObject{{QStringLiteral("name"), QStringLiteral("wireguard")}, {QStringLiteral("ports"), QJsonArray{1337}}}}},
+            {QStringLiteral("meta"), QJsonArray{QJsonObject{{QStringLiteral("name"), QStringLiteral("meta")}, {QStringLiteral("ports"), QJsonArray{443, 8080}}}}}
+        };
+
+        QJsonArray regions;
+        for(int c=0; c<countries; ++c)
+        {
+            QString country{QChar{'A' + (c / 26) % 26}};
+            country += QChar{'A' + c % 26};
+            for(int r=0; r<regionsPerCountry; ++r)
+            {
+                QString id = QStringLiteral("region_%1_%2").arg(c).arg(r);
+                QJsonObject servers;
+                for(const auto &group : {QStringLiteral("ovpntcp"), QStringLiteral("ovpnudp"), QStringLiteral("wg"), QStringLiteral("meta")})
+                {
+                    QJsonArray groupServers;
+                    for(int s=0; s<3; ++s)
+                    {
+                        groupServers.push_back(QJsonObject{
+                            {QStringLiteral("ip"), QStringLiteral("10.%1.%2.%3").arg(c).arg(r).arg(s)},
+                            {QStringLiteral("cn"), QStringLiteral("%1-%2").arg(id).arg(s)},
+                            {QStringLiteral("van"), (s % 2) == 0}
+                        });
+                    }
+                    servers.insert(group, groupServers);
+                }
+                regions.push_back(QJsonObject{
+                    {QStringLiteral("id"), id},
+                    {QStringLiteral("name"), QStringLiteral("Region %1 é %2").arg(c).arg(r)},
+                    {QStringLiteral("country"), country},
+                    {QStringLiteral("auto_region"), (r % 3) != 0},
+                    {QStringLiteral("dns"), id},
+                    {QStringLiteral("port_forward"), (r % 2) == 0},
+                    {QStringLiteral("geo"), (r % 4) == 0},
+                    {QStringLiteral("offline"), (r % 5) == 0},
+                    {QStringLiteral("servers"), servers}
+                });
+            }
+        }
+
+        return QJsonObject{{QStringLiteral("groups"), groups},
+                           {QStringLiteral("regions"), regions}};
+    }
+
+    QJsonArray buildShadowsocksList(int countries)
+    {
+        QJsonArray shadowsocks;
+        for(int c=0; c<countries; ++c)
+        {
+            shadowsocks.push_back(QJsonObject{
+                {QStringLiteral("region"), QStringLiteral("region_%1_0").arg(c)},
+                {QStringLiteral("host"), QStringLiteral("10.%1.0.100").arg(c)},
+                {QStringLiteral("port"), 443},
+                {QStringLiteral("key"), QStringLiteral("shadowsocks")},
+                {QStringLiteral("cipher"), QStringLiteral("aes-128-gcm")}
+            });
+        }
+        return shadowsocks;
+    }
+}
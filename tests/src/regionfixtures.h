@@ -0,0 +1,47 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#line HEADER_FILE("regionfixtures.h")
+
+#ifndef REGIONFIXTURES_H
+#define REGIONFIXTURES_H
+
+#include <QJsonArray>
+#include <QJsonObject>
+
+// Synthetic regions lists for tests and benchmarks that need a large number of
+// regions.
+namespace RegionFixtures
+{
+    // Build a modern regions list with 'countries' countries of
+    // 'regionsPerCountry' regions each.  Each region has three servers in
+    // each service group.  The regions cover all the fields stored in the
+    // region database and snapshot - all services, NCP flags, and
+    // auto/port-forward/geo/offline regions.
+    //
+    // Region IDs are "region_<country>_<region>", so they can be referred to
+    // by other lists.
+    QJsonObject buildRegionsList(int countries, int regionsPerCountry);
+
+    // Build a Shadowsocks regions list with a Shadowsocks server for the first
+    // region in each country from buildRegionsList().
+    QJsonArray buildShadowsocksList(int countries);
+}
+
+#endif
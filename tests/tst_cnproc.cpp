@@ -0,0 +1,167 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include <QtTest>
+
+#include "linux/linux_cn_proc.h"
+#include "linux/linux_proc_fs.h"
+#include "linux/linux_proc_resolver.h"
+#include <unordered_set>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    // Number of processes launched by the stress test
+    const int StressProcesses = 2000;
+}
+
+class tst_cnproc : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Create an empty file standing in for a cgroup's process file
+    QString createCGroupFile(const QTemporaryDir &dir)
+    {
+        QString path = dir.filePath(QStringLiteral("cgroup.procs"));
+        QFile file{path};
+        if(!file.open(QFile::WriteOnly))
+            return {};
+        return path;
+    }
+
+    QByteArray readFile(const QString &path)
+    {
+        QFile file{path};
+        if(!file.open(QFile::ReadOnly))
+            return {};
+        return file.readAll();
+    }
+
+private slots:
+    // Resolve this process - it's a configured app, so it's written to the
+    // cgroup file
+    void resolveLaunchedApp()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        QString cGroupFile = createCGroupFile(dir);
+        QVERIFY(!cGroupFile.isEmpty());
+        QString ownPath = ProcFs::pathForPid(::getpid());
+        QVERIFY(!ownPath.isEmpty());
+
+        ProcLaunchResolver resolver;
+        resolver.setApps({{ownPath, cGroupFile}});
+        QSignalSpy resolvedSpy{&resolver, &ProcLaunchResolver::resolved};
+
+        QVERIFY(resolver.queueExec(::getpid()));
+        resolver.flush();
+
+        QCOMPARE(resolvedSpy.count(), 1);
+        const auto args = resolvedSpy.takeFirst();
+        QCOMPARE(args[0].value<pid_t>(), ::getpid());
+        QCOMPARE(args[1].toString(), ownPath);
+        QCOMPARE(args[2].toString(), cGroupFile);
+        QCOMPARE(readFile(cGroupFile), QByteArray::number(::getpid()));
+    }
+
+    // Processes that aren't configured apps aren't resolved
+    void ignoreOtherApps()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        QString cGroupFile = createCGroupFile(dir);
+        QVERIFY(!cGroupFile.isEmpty());
+
+        ProcLaunchResolver resolver;
+        resolver.setApps({{QStringLiteral("/nonexistent/app"), cGroupFile}});
+        QSignalSpy resolvedSpy{&resolver, &ProcLaunchResolver::resolved};
+
+        QVERIFY(resolver.queueExec(::getpid()));
+        resolver.flush();
+        QCOMPARE(resolvedSpy.count(), 0);
+
+        // Nothing is matched after clear()
+        resolver.setApps({{ProcFs::pathForPid(::getpid()), cGroupFile}});
+        resolver.clear();
+        QVERIFY(resolver.queueExec(::getpid()));
+        resolver.flush();
+        QCOMPARE(resolvedSpy.count(), 0);
+        QCOMPARE(readFile(cGroupFile), QByteArray{});
+    }
+
+    // Events are dropped and counted when the queue is full
+    void dropWhenFull()
+    {
+        ProcLaunchResolver resolver{0};
+        resolver.setApps({{QStringLiteral("/nonexistent/app"), QStringLiteral("/nonexistent/cgroup")}});
+
+        QVERIFY(!resolver.queueExec(::getpid()));
+        QVERIFY(!resolver.queueExec(::getpid()));
+        QCOMPARE(resolver.droppedCount(), std::uint64_t{2});
+    }
+
+    // Launch processes in a tight loop, and check that every exec is
+    // delivered unless the socket overflowed.  Subscribing to cn_proc events
+    // requires CAP_NET_ADMIN, so this is skipped when run unprivileged.
+    void stressExecEvents()
+    {
+        CnProc cnProc;
+        QSignalSpy connectedSpy{&cnProc, &CnProc::connected};
+        if(!connectedSpy.wait(2000))
+            QSKIP("cn_proc events are not available (requires CAP_NET_ADMIN)");
+
+        std::unordered_set<pid_t> launched, execs;
+        connect(&cnProc, &CnProc::exec, this, [&](pid_t pid){execs.insert(pid);});
+
+        QElapsedTimer launchTime;
+        launchTime.start();
+        for(int i = 0; i < StressProcesses; ++i)
+        {
+            pid_t child = ::fork();
+            QVERIFY(child >= 0);
+            if(child == 0)
+            {
+                ::execl("/bin/true", "true", nullptr);
+                ::_exit(127);
+            }
+            launched.insert(child);
+            ::waitpid(child, nullptr, 0);
+        }
+        qInfo() << "Launched" << StressProcesses << "processes in"
+            << launchTime.elapsed() << "ms";
+
+        // Read events until all the execs are seen or the socket overflowed
+        auto allSeen = [&]()
+        {
+            for(pid_t pid : launched)
+            {
+                if(execs.count(pid) == 0)
+                    return false;
+            }
+            return true;
+        };
+        QTRY_VERIFY_WITH_TIMEOUT(allSeen() || cnProc.overflowCount() > 0, 10000);
+        qInfo() << "Received" << execs.size() << "exec events, overflows:"
+            << cnProc.overflowCount();
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_cnproc)
+#include TEST_MOC
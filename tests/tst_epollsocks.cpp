@@ -0,0 +1,398 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include <QtTest>
+
+#include "linux/linux_epollsocks.h"
+#include "socksnegotiation.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    sockaddr_in loopbackAddr(quint16 port)
+    {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        return addr;
+    }
+
+    // Echo server used as the proxy target.  Runs its own poll() loop on a
+    // thread, since the load test drives its client sockets synchronously.
+    class EchoServer
+    {
+    public:
+        EchoServer()
+            : _port{0}, _stop{false}
+        {
+            _listen = PosixFd{::socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0)};
+            sockaddr_in addr = loopbackAddr(0);
+            socklen_t addrLen = sizeof(addr);
+            if(!_listen ||
+               ::bind(_listen.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) ||
+               ::listen(_listen.get(), SOMAXCONN) ||
+               ::getsockname(_listen.get(), reinterpret_cast<sockaddr*>(&addr), &addrLen))
+            {
+                return;
+            }
+            _port = ntohs(addr.sin_port);
+            _thread = std::thread{[this](){run();}};
+        }
+        ~EchoServer()
+        {
+            _stop = true;
+            if(_thread.joinable())
+                _thread.join();
+        }
+
+        quint16 port() const {return _port;}
+
+    private:
+        void run()
+        {
+            std::vector<pollfd> fds{{_listen.get(), POLLIN, 0}};
+            std::vector<char> buffer(64 * 1024);
+            while(!_stop)
+            {
+                ::poll(fds.data(), fds.size(), 20);
+                for(std::size_t i=0; i<fds.size(); ++i)
+                {
+                    if(!(fds[i].revents & (POLLIN|POLLHUP|POLLERR)))
+                        continue;
+                    if(i == 0)
+                    {
+                        int client = ::accept4(_listen.get(), nullptr, nullptr, SOCK_CLOEXEC);
+                        if(client >= 0)
+                            fds.push_back({client, POLLIN, 0});
+                        continue;
+                    }
+                    auto received = ::recv(fds[i].fd, buffer.data(), buffer.size(), 0);
+                    if(received <= 0)
+                    {
+                        ::close(fds[i].fd);
+                        fds[i].fd = -1;
+                        continue;
+                    }
+                    // Blocking send is fine, the proxy keeps reading
+                    ::send(fds[i].fd, buffer.data(), static_cast<std::size_t>(received), MSG_NOSIGNAL);
+                }
+                fds.erase(std::remove_if(fds.begin() + 1, fds.end(),
+                                         [](const pollfd &fd){return fd.fd < 0;}),
+                          fds.end());
+            }
+            for(std::size_t i=1; i<fds.size(); ++i)
+                ::close(fds[i].fd);
+        }
+
+    private:
+        PosixFd _listen;
+        quint16 _port;
+        std::atomic<bool> _stop;
+        std::thread _thread;
+    };
+
+    // Build the complete client side of a SOCKS negotiation - greeting, auth,
+    // and CONNECT to a loopback port.  The proxy handles these pipelined.
+    QByteArray buildRequest(const QByteArray &password, quint16 targetPort)
+    {
+        QByteArray request;
+        request.append("\x05\x01\x02", 3);
+        request.append('\x01');
+        request.append(static_cast<char>(SocksNegotiation::username.size()));
+        request.append(SocksNegotiation::username);
+        request.append(static_cast<char>(password.size()));
+        request.append(password);
+        request.append("\x05\x01\x00\x01\x7f\x00\x00\x01", 8);
+        request.append(static_cast<char>(targetPort >> 8));
+        request.append(static_cast<char>(targetPort));
+        return request;
+    }
+
+    // Method response (2), auth response (2), connect response (10)
+    enum : int {ResponseLength = 14};
+
+    bool checkResponse(const QByteArray &response)
+    {
+        return response.size() >= ResponseLength && response[1] == 2 &&
+            response[3] == 0 && response[5] == 0;
+    }
+
+    // Connect a blocking socket to the proxy
+    PosixFd connectToProxy(quint16 port)
+    {
+        PosixFd socket{::socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0)};
+        sockaddr_in addr = loopbackAddr(port);
+        if(!socket || ::connect(socket.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)))
+            return {};
+        timeval timeout{5, 0};
+        ::setsockopt(socket.get(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        return socket;
+    }
+
+    QByteArray receiveExactly(int socket, int size)
+    {
+        QByteArray data{size, 0};
+        auto received = ::recv(socket, data.data(), static_cast<std::size_t>(size), MSG_WAITALL);
+        data.resize(std::max<int>(0, static_cast<int>(received)));
+        return data;
+    }
+
+    bool sendAll(int socket, const QByteArray &data)
+    {
+        return ::send(socket, data.constData(), static_cast<std::size_t>(data.size()),
+                      MSG_NOSIGNAL) == data.size();
+    }
+}
+
+class tst_epollsocks : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase()
+    {
+        // The load test needs 8 descriptors per session (client, proxy
+        // accepted, proxy target, two relay pipes, echo server) - raise the
+        // soft limit.
+        rlimit limit{};
+        ::getrlimit(RLIMIT_NOFILE, &limit);
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    // Relay data through the proxy, including enough to exercise backpressure
+    void relay()
+    {
+        EchoServer echo;
+        QVERIFY(echo.port());
+        EpollSocksProxy proxy{QHostAddress{QHostAddress::LocalHost}, QStringLiteral("lo")};
+        QVERIFY(proxy.port());
+
+        PosixFd client = connectToProxy(proxy.port());
+        QVERIFY(client);
+        QVERIFY(sendAll(client.get(), buildRequest(proxy.password(), echo.port())));
+        QVERIFY(checkResponse(receiveExactly(client.get(), ResponseLength)));
+
+        QByteArray payload;
+        for(int i = 0; payload.size() < 4 * 1024 * 1024; ++i)
+            payload += QByteArray::number(i);
+        std::thread writer{[&](){sendAll(client.get(), payload);}};
+        QByteArray echoed = receiveExactly(client.get(), payload.size());
+        writer.join();
+        QCOMPARE(echoed.size(), payload.size());
+        QVERIFY(echoed == payload);
+    }
+
+    // When the client half-closes, the target still gets to send the rest of
+    // its data before the connection closes
+    void clientHalfClose()
+    {
+        EchoServer echo;
+        QVERIFY(echo.port());
+        EpollSocksProxy proxy{QHostAddress{QHostAddress::LocalHost}, QStringLiteral("lo")};
+        QVERIFY(proxy.port());
+
+        PosixFd client = connectToProxy(proxy.port());
+        QVERIFY(client);
+        QVERIFY(sendAll(client.get(), buildRequest(proxy.password(), echo.port())));
+        QVERIFY(checkResponse(receiveExactly(client.get(), ResponseLength)));
+
+        QByteArray payload{1024 * 1024, 'h'};
+        std::thread writer{[&]()
+        {
+            sendAll(client.get(), payload);
+            ::shutdown(client.get(), SHUT_WR);
+        }};
+        QByteArray echoed = receiveExactly(client.get(), payload.size());
+        writer.join();
+        QVERIFY(echoed == payload);
+        // The echo server closes once it sees the EOF, which closes the client
+        QCOMPARE(receiveExactly(client.get(), 1), QByteArray{});
+    }
+
+    // Measure relay throughput - the client sends 16 MiB that's echoed back
+    // through the proxy.
+    void benchmarkRelay()
+    {
+        EchoServer echo;
+        QVERIFY(echo.port());
+        EpollSocksProxy proxy{QHostAddress{QHostAddress::LocalHost}, QStringLiteral("lo")};
+        QVERIFY(proxy.port());
+
+        PosixFd client = connectToProxy(proxy.port());
+        QVERIFY(client);
+        QVERIFY(sendAll(client.get(), buildRequest(proxy.password(), echo.port())));
+        QVERIFY(checkResponse(receiveExactly(client.get(), ResponseLength)));
+
+        const QByteArray chunk{1024 * 1024, 'x'};
+        enum : int {ChunkCount = 16};
+        QBENCHMARK
+        {
+            std::thread writer{[&]()
+            {
+                for(int i = 0; i < ChunkCount; ++i)
+                    sendAll(client.get(), chunk);
+            }};
+            int received = 0;
+            for(int i = 0; i < ChunkCount; ++i)
+                received += receiveExactly(client.get(), chunk.size()).size();
+            writer.join();
+            QCOMPARE(received, ChunkCount * chunk.size());
+        }
+    }
+
+    // A wrong password is rejected with a failure response and the connection
+    // is closed
+    void rejectPassword()
+    {
+        EpollSocksProxy proxy{QHostAddress{QHostAddress::LocalHost}, QStringLiteral("lo")};
+        QVERIFY(proxy.port());
+
+        PosixFd client = connectToProxy(proxy.port());
+        QVERIFY(client);
+        QVERIFY(sendAll(client.get(), buildRequest(QByteArrayLiteral("incorrect"), 1)));
+        QCOMPARE(receiveExactly(client.get(), 4), QByteArrayLiteral("\x05\x02\x01\x01"));
+        QCOMPARE(receiveExactly(client.get(), 1), QByteArray{});
+    }
+
+    // Idle connections are closed by the timer wheel
+    void negotiationTimeout()
+    {
+        const std::chrono::milliseconds timeout{300};
+        EpollSocksProxy proxy{QHostAddress{QHostAddress::LocalHost}, QStringLiteral("lo"), timeout};
+        QVERIFY(proxy.port());
+
+        std::vector<PosixFd> clients;
+        for(int i = 0; i < 20; ++i)
+        {
+            clients.push_back(connectToProxy(proxy.port()));
+            QVERIFY(clients.back());
+        }
+
+        auto start = Clock::now();
+        for(const auto &client : clients)
+            QCOMPARE(receiveExactly(client.get(), 1), QByteArray{});
+        auto elapsed = Clock::now() - start;
+        QVERIFY(elapsed >= timeout - std::chrono::milliseconds{50});
+        QVERIFY(elapsed < std::chrono::seconds{3});
+    }
+
+    // Load generator - open many concurrent SOCKS sessions through the proxy
+    // to a local echo server, and report the setup latency (from starting the
+    // TCP connection to receiving the CONNECT response).
+    void loadConcurrentSessions()
+    {
+        EchoServer echo;
+        QVERIFY(echo.port());
+        EpollSocksProxy proxy{QHostAddress{QHostAddress::LocalHost}, QStringLiteral("lo")};
+        QVERIFY(proxy.port());
+
+        rlimit limit{};
+        ::getrlimit(RLIMIT_NOFILE, &limit);
+        int sessionCount = static_cast<int>(std::min<rlim_t>(2000, (limit.rlim_cur - 64) / 8));
+        qInfo() << "Opening" << sessionCount << "concurrent sessions";
+
+        const QByteArray request = buildRequest(proxy.password(), echo.port()) + QByteArrayLiteral("ping");
+        const sockaddr_in proxyAddr = loopbackAddr(proxy.port());
+
+        struct Session
+        {
+            PosixFd socket;
+            Clock::time_point start;
+            bool sent;
+            QByteArray received;
+            double setupMs;
+        };
+        std::vector<Session> sessions(static_cast<std::size_t>(sessionCount));
+        std::vector<pollfd> fds;
+        fds.reserve(sessions.size());
+        for(auto &session : sessions)
+        {
+            session.socket = PosixFd{::socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)};
+            QVERIFY(session.socket);
+            session.start = Clock::now();
+            session.sent = false;
+            session.setupMs = -1;
+            int result = ::connect(session.socket.get(), reinterpret_cast<const sockaddr*>(&proxyAddr), sizeof(proxyAddr));
+            QVERIFY(result == 0 || errno == EINPROGRESS);
+            fds.push_back({session.socket.get(), POLLOUT, 0});
+        }
+
+        int completed = 0;
+        auto deadline = Clock::now() + std::chrono::seconds{30};
+        while(completed < sessionCount && Clock::now() < deadline)
+        {
+            ::poll(fds.data(), fds.size(), 100);
+            for(std::size_t i=0; i<fds.size(); ++i)
+            {
+                Session &session = sessions[i];
+                if(!fds[i].revents)
+                    continue;
+                if(!session.sent && (fds[i].revents & POLLOUT))
+                {
+                    QVERIFY(sendAll(session.socket.get(), request));
+                    session.sent = true;
+                    fds[i].events = POLLIN;
+                    continue;
+                }
+                char data[64];
+                auto received = ::recv(session.socket.get(), data, sizeof(data), 0);
+                QVERIFY2(received > 0, qPrintable(QStringLiteral("session %1 closed").arg(i)));
+                session.received.append(data, static_cast<int>(received));
+                if(session.setupMs < 0 && session.received.size() >= ResponseLength)
+                {
+                    session.setupMs = std::chrono::duration<double, std::milli>(Clock::now() - session.start).count();
+                }
+                // Wait for the echoed "ping" too, to verify the relay
+                if(session.received.size() >= ResponseLength + 4)
+                {
+                    QVERIFY(checkResponse(session.received));
+                    QCOMPARE(session.received.mid(ResponseLength), QByteArrayLiteral("ping"));
+                    fds[i].events = 0;
+                    ++completed;
+                }
+            }
+        }
+        QCOMPARE(completed, sessionCount);
+
+        std::vector<double> setupTimes;
+        setupTimes.reserve(sessions.size());
+        for(const auto &session : sessions)
+            setupTimes.push_back(session.setupMs);
+        std::sort(setupTimes.begin(), setupTimes.end());
+        auto percentile = [&](std::size_t pct){return setupTimes[(setupTimes.size() - 1) * pct / 100];};
+        qInfo() << "Setup latency for" << sessionCount << "sessions: p50"
+            << percentile(50) << "ms, p99" << percentile(99) << "ms, max"
+            << setupTimes.back() << "ms";
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_epollsocks)
+#include TEST_MOC
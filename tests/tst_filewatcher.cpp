@@ -0,0 +1,154 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+#include <QTemporaryDir>
+#include "filewatcher.h"
+#include <cstdio>
+
+namespace
+{
+    bool writeFile(const QString &path, const QByteArray &content)
+    {
+        QFile file{path};
+        return file.open(QFile::WriteOnly | QFile::Truncate) &&
+            file.write(content) == content.size();
+    }
+}
+
+class tst_filewatcher : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Modifying a watched file is detected
+    void modify()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString target = dir.filePath(QStringLiteral("resolv.conf"));
+        QVERIFY(writeFile(target, "nameserver 10.0.0.1\n"));
+
+        FileWatcher watcher{Path{target}};
+        QVERIFY(watcher.watching());
+        QSignalSpy changedSpy{&watcher, &FileWatcher::changed};
+
+        QVERIFY(writeFile(target, "nameserver 10.0.0.2\n"));
+        QVERIFY(changedSpy.wait());
+    }
+
+    // A missing file is watched through its parent, and creating it is
+    // detected
+    void create()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString target = dir.filePath(QStringLiteral("resolv.conf"));
+
+        FileWatcher watcher{Path{target}, true};
+        QVERIFY(watcher.watching());
+        QSignalSpy changedSpy{&watcher, &FileWatcher::changed};
+
+        QVERIFY(writeFile(target, "nameserver 10.0.0.1\n"));
+        QVERIFY(changedSpy.wait());
+        QVERIFY(watcher.watching());
+    }
+
+    // Replacing the file by renaming another file over it (like
+    // NetworkManager does) is detected when the parent is watched, and the
+    // new file is watched afterward
+    void replaceByRename()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString target = dir.filePath(QStringLiteral("resolv.conf"));
+        const QString temp = dir.filePath(QStringLiteral("resolv.conf.tmp"));
+        QVERIFY(writeFile(target, "nameserver 10.0.0.1\n"));
+
+        FileWatcher watcher{Path{target}, true};
+        QVERIFY(watcher.watching());
+        QSignalSpy changedSpy{&watcher, &FileWatcher::changed};
+
+        QVERIFY(writeFile(temp, "nameserver 192.168.1.1\n"));
+        // Writing the temporary file may be signaled too, since the parent is
+        // watched - wait for that to settle before replacing the target
+        QTest::qWait(100);
+        changedSpy.clear();
+
+        // QFile::rename() won't replace an existing file; rename() does so
+        // atomically
+        QCOMPARE(std::rename(QFile::encodeName(temp).constData(),
+                             QFile::encodeName(target).constData()), 0);
+        QVERIFY(changedSpy.wait());
+        QVERIFY(watcher.watching());
+
+        // The replacement file is watched now
+        QTest::qWait(100);
+        changedSpy.clear();
+        QVERIFY(writeFile(target, "nameserver 10.0.0.3\n"));
+        QVERIFY(changedSpy.wait());
+    }
+
+    // With a settle delay, a burst of changes is signaled once, after the
+    // delay
+    void settleDelay()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString target = dir.filePath(QStringLiteral("resolv.conf"));
+        QVERIFY(writeFile(target, "nameserver 10.0.0.1\n"));
+
+        FileWatcher watcher{Path{target}, true, std::chrono::milliseconds{300}};
+        QSignalSpy changedSpy{&watcher, &FileWatcher::changed};
+
+        for(int i=0; i<5; ++i)
+            QVERIFY(writeFile(target, QByteArrayLiteral("nameserver 10.0.0.") + QByteArray::number(i) + '\n'));
+
+        // Not signaled until the delay elapses
+        QTest::qWait(100);
+        QCOMPARE(changedSpy.size(), 0);
+        QTRY_COMPARE(changedSpy.size(), 1);
+        // No more signals for the same burst
+        QTest::qWait(500);
+        QCOMPARE(changedSpy.size(), 1);
+    }
+
+    // A steady stream of changes doesn't postpone the signal indefinitely
+    void settleDelayStream()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString target = dir.filePath(QStringLiteral("resolv.conf"));
+        QVERIFY(writeFile(target, "nameserver 10.0.0.1\n"));
+
+        FileWatcher watcher{Path{target}, false, std::chrono::milliseconds{300}};
+        QSignalSpy changedSpy{&watcher, &FileWatcher::changed};
+
+        // Change the file every 100 ms for 1.5 s
+        for(int i=0; i<15; ++i)
+        {
+            QVERIFY(writeFile(target, QByteArrayLiteral("nameserver 10.0.1.") + QByteArray::number(i) + '\n'));
+            QTest::qWait(100);
+        }
+        QVERIFY(changedSpy.size() >= 2);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_filewatcher)
+#include TEST_MOC
@@ -0,0 +1,121 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+
+#include "daemon/src/posix/posix_firewall_iptables.h"
+#include "brand.h"
+#include <unistd.h>
+
+namespace
+{
+    const QString testAnchor{QStringLiteral("305.allowSubnets")};
+    const QString anchorChain{QStringLiteral(BRAND_CODE "vpn.a.305.allowSubnets")};
+    const QString ruleChain{QStringLiteral(BRAND_CODE "vpn.r.305.allowSubnets")};
+    const QStringList testRules{QStringLiteral("-d 192.0.2.0/24 -j ACCEPT"),
+                                QStringLiteral("-d 198.51.100.0/24 -j ACCEPT")};
+
+    // Run iptables with the given arguments; returns the output, or a null
+    // QString if it fails
+    QString iptables(const QStringList &args)
+    {
+        QProcess process;
+        process.start(QStringLiteral("iptables"), QStringList{QStringLiteral("-w")} + args);
+        if(!process.waitForFinished() || process.exitStatus() != QProcess::NormalExit ||
+           process.exitCode() != 0)
+        {
+            return {};
+        }
+        return QString::fromUtf8(process.readAllStandardOutput());
+    }
+
+    int countRules(const QString &chain)
+    {
+        return iptables({QStringLiteral("-S"), chain}).count(QStringLiteral("-A ") + chain);
+    }
+
+    void applyTestAnchor()
+    {
+        IpTablesFirewall::ensureRootAnchorPriority();
+        IpTablesFirewall::beginBatch();
+        IpTablesFirewall::replaceAnchor(IpTablesFirewall::IPv4, testAnchor, testRules);
+        IpTablesFirewall::setAnchorEnabled(IpTablesFirewall::IPv4, testAnchor, true);
+        IpTablesFirewall::commitBatch();
+    }
+}
+
+// These tests install the daemon's firewall anchors, so they require root.
+// All anchors are disabled except for the test anchor, which only allows
+// traffic to the documentation subnets.
+class tst_iptablesfirewall : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase()
+    {
+        if(::geteuid() != 0 || iptables({QStringLiteral("-S"), QStringLiteral("OUTPUT")}).isNull())
+            QSKIP("iptables is not available (requires root)");
+        IpTablesFirewall::install();
+    }
+
+    void cleanupTestCase()
+    {
+        if(::geteuid() == 0)
+            IpTablesFirewall::uninstall();
+    }
+
+    // A batch must reapply an anchor that was flushed by something else, even
+    // though its committed state didn't change
+    void reapplyFlushedAnchor()
+    {
+        applyTestAnchor();
+        QCOMPARE(countRules(anchorChain), 1);
+        QCOMPARE(countRules(ruleChain), testRules.size());
+
+        // Flush the chains like a firewall reload would
+        QVERIFY(!iptables({QStringLiteral("-F"), anchorChain}).isNull());
+        QVERIFY(!iptables({QStringLiteral("-F"), ruleChain}).isNull());
+        QCOMPARE(countRules(anchorChain), 0);
+
+        applyTestAnchor();
+        QCOMPARE(countRules(anchorChain), 1);
+        QCOMPARE(countRules(ruleChain), testRules.size());
+    }
+
+    // If the chains were deleted, the firewall is reinstalled and the next
+    // batch applies the anchor again
+    void reinstallDeletedAnchor()
+    {
+        applyTestAnchor();
+
+        QVERIFY(!iptables({QStringLiteral("-F"), anchorChain}).isNull());
+        QVERIFY(!iptables({QStringLiteral("-D"), QStringLiteral(BRAND_CODE "vpn.anchors"),
+                           QStringLiteral("-j"), anchorChain}).isNull());
+        QVERIFY(!iptables({QStringLiteral("-X"), anchorChain}).isNull());
+
+        applyTestAnchor();
+        QVERIFY(IpTablesFirewall::isInstalled());
+        QCOMPARE(countRules(anchorChain), 1);
+        QCOMPARE(countRules(ruleChain), testRules.size());
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_iptablesfirewall)
+#include TEST_MOC
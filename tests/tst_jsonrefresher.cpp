@@ -36,6 +36,8 @@ Note that ApiBase (used by JsonRefresher) is covered in the ApiClient tests.
 namespace TestData {
 
 const QByteArray &successJson = R"({"unit_test":true})";
+const QByteArray &changedJson = R"({"unit_test":false})";
+const QByteArray &successEtag = R"("v1")";
 
 std::shared_ptr<ApiBase> pUnitTestDummyApi =
     std::make_shared<FixedApiBase>(
@@ -48,10 +50,10 @@ std::shared_ptr<ApiBase> pUnitTestDummyApi =
 class TestRefresher : public JsonRefresher
 {
 public:
-    TestRefresher()
+    TestRefresher(std::chrono::milliseconds refreshInterval = std::chrono::seconds(5))
         : JsonRefresher{QStringLiteral("Unit test"),
                         QStringLiteral("/unit_test"), std::chrono::seconds(1),
-                        std::chrono::seconds(5)}
+                        refreshInterval}
     {}
 };
 
@@ -112,6 +114,130 @@ private slots:
         QVERIFY(fetchSpy.empty());
         QVERIFY(!fetchSpy.wait(1000));
     }
+
+    // Once content is accepted, refreshes are conditional, and neither a 304
+    // nor an identical payload is emitted again.
+    void testUnchangedContent()
+    {
+        TestRefresher refresher{std::chrono::seconds(1)};
+        QSignalSpy fetchSpy{&refresher, &JsonRefresher::contentLoaded};
+        QSignalSpy consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal};
+        connect(&refresher, &JsonRefresher::contentLoaded, &refresher,
+                [&refresher](){refresher.loadSucceeded();});
+        QByteArray ifNoneMatch;
+        connect(&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal,
+                &refresher, [&ifNoneMatch](const QNetworkRequest &req)
+                {
+                    ifNoneMatch = req.rawHeader(QByteArrayLiteral("If-None-Match"));
+                });
+
+        // The first request is unconditional
+        auto pReply = MockNetworkManager::enqueueReply(TestData::successJson);
+        pReply->setReplyHeader(QByteArrayLiteral("ETag"), TestData::successEtag);
+        refresher.start(TestData::pUnitTestDummyApi);
+        QVERIFY(consumeSpy.wait(100));
+        QVERIFY(ifNoneMatch.isEmpty());
+        pReply->finished();
+        QTRY_COMPARE(fetchSpy.size(), 1);
+
+        // The next refresh sends the ETag; a 304 isn't emitted
+        auto pNotModifiedReply = MockNetworkManager::enqueueReply(QByteArray{});
+        pNotModifiedReply->setStatusCode(304);
+        QVERIFY(consumeSpy.wait(2000));
+        QCOMPARE(ifNoneMatch, TestData::successEtag);
+        pNotModifiedReply->finished();
+
+        // The 304 keeps the ETag.  If the server ignores it and sends the same
+        // content again, it still isn't emitted.
+        auto pSameReply = MockNetworkManager::enqueueReply(TestData::successJson);
+        QVERIFY(consumeSpy.wait(2000));
+        QCOMPARE(ifNoneMatch, TestData::successEtag);
+        pSameReply->finished();
+
+        // That reply had no ETag, so the next request is unconditional.
+        // Changed content is emitted.
+        auto pChangedReply = MockNetworkManager::enqueueReply(TestData::changedJson);
+        QVERIFY(consumeSpy.wait(2000));
+        QVERIFY(ifNoneMatch.isEmpty());
+        QCOMPARE(fetchSpy.size(), 1);
+        pChangedReply->finished();
+        QTRY_COMPARE(fetchSpy.size(), 2);
+        QCOMPARE(fetchSpy[1][0].value<QJsonDocument>(),
+                 QJsonDocument::fromJson(TestData::changedJson));
+
+        refresher.stop();
+    }
+
+    // If the consumer discards the content while the refresher keeps running,
+    // invalidate() causes the same content to be emitted again.
+    void testInvalidate()
+    {
+        TestRefresher refresher{std::chrono::seconds(1)};
+        QSignalSpy fetchSpy{&refresher, &JsonRefresher::contentLoaded};
+        QSignalSpy consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal};
+        connect(&refresher, &JsonRefresher::contentLoaded, &refresher,
+                [&refresher](){refresher.loadSucceeded();});
+        QByteArray ifNoneMatch;
+        connect(&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal,
+                &refresher, [&ifNoneMatch](const QNetworkRequest &req)
+                {
+                    ifNoneMatch = req.rawHeader(QByteArrayLiteral("If-None-Match"));
+                });
+
+        auto pReply = MockNetworkManager::enqueueReply(TestData::successJson);
+        pReply->setReplyHeader(QByteArrayLiteral("ETag"), TestData::successEtag);
+        refresher.start(TestData::pUnitTestDummyApi);
+        QVERIFY(consumeSpy.wait(100));
+        pReply->finished();
+        QTRY_COMPARE(fetchSpy.size(), 1);
+
+        // Starting again with the same API has no effect (like the daemon does
+        // when it's deactivated), but the consumer discarded the content.
+        refresher.start(TestData::pUnitTestDummyApi);
+        refresher.invalidate();
+
+        // The next request is unconditional, and the same content is emitted
+        auto pSameReply = MockNetworkManager::enqueueReply(TestData::successJson);
+        pSameReply->setReplyHeader(QByteArrayLiteral("ETag"), TestData::successEtag);
+        QVERIFY(consumeSpy.wait(2000));
+        QVERIFY(ifNoneMatch.isEmpty());
+        pSameReply->finished();
+        QTRY_COMPARE(fetchSpy.size(), 2);
+        QCOMPARE(fetchSpy[1][0].value<QJsonDocument>(),
+                 QJsonDocument::fromJson(TestData::successJson));
+
+        refresher.stop();
+    }
+
+    // If the content isn't accepted, the next request is unconditional and
+    // the same content is emitted again.
+    void testRejectedContent()
+    {
+        TestRefresher refresher{std::chrono::seconds(1)};
+        QSignalSpy fetchSpy{&refresher, &JsonRefresher::contentLoaded};
+        QSignalSpy consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal};
+        QByteArray ifNoneMatch;
+        connect(&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal,
+                &refresher, [&ifNoneMatch](const QNetworkRequest &req)
+                {
+                    ifNoneMatch = req.rawHeader(QByteArrayLiteral("If-None-Match"));
+                });
+
+        auto pReply = MockNetworkManager::enqueueReply(TestData::successJson);
+        pReply->setReplyHeader(QByteArrayLiteral("ETag"), TestData::successEtag);
+        refresher.start(TestData::pUnitTestDummyApi);
+        QVERIFY(consumeSpy.wait(100));
+        pReply->finished();
+        QTRY_COMPARE(fetchSpy.size(), 1);
+
+        auto pSameReply = MockNetworkManager::enqueueReply(TestData::successJson);
+        QVERIFY(consumeSpy.wait(2000));
+        QVERIFY(ifNoneMatch.isEmpty());
+        pSameReply->finished();
+        QTRY_COMPARE(fetchSpy.size(), 2);
+
+        refresher.stop();
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_jsonrefresher)
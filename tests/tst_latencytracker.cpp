@@ -107,7 +107,7 @@ public:
     MeasurementSplitter(LatencyBatch &batch);
 
 signals:
-    void newMeasurement(const QString &locationId, std::chrono::milliseconds latency);
+    void newMeasurement(const QString &locationId, std::chrono::microseconds latency);
 
 private slots:
     void onNewMeasurements(const LatencyTracker::Latencies &measurements);
@@ -284,6 +284,43 @@ private slots:
         QCOMPARE(measurementSpy.size(), MockPingServerCount);
     }
 
+    // Verify that a batch larger than one burst of echoes is measured
+    // completely, and that each measurement is timed from its own echo (the
+    // mocked echoes always take 30 ms, even when sent in a later burst)
+    void pacedBatch()
+    {
+        enum { LocationCount = 100 };
+        std::vector<QSharedPointer<Location>> pingLocations;
+        for(int i=0; i<LocationCount; ++i)
+        {
+            QSharedPointer<Location> pLocation{new Location{}};
+            pLocation->id(QStringLiteral("mock-paced-%1").arg(i));
+            pLocation->name(QStringLiteral("mock-paced-%1").arg(i));
+            pLocation->country(QStringLiteral("US"));
+            pLocation->portForward(false);
+            Server mockServer;
+            mockServer.ip(QStringLiteral("127.0.1.%1").arg(i+1));
+            mockServer.commonName("n/a");
+            mockServer.wireguardPorts({1337});
+            pLocation->servers({std::move(mockServer)});
+            pingLocations.push_back(std::move(pLocation));
+        }
+
+        auto pBatch{new LatencyBatch{pingLocations, this}};
+        MeasurementSplitter splitter{*pBatch};
+        QSignalSpy measurementSpy{&splitter, &MeasurementSplitter::newMeasurement};
+        QSignalSpy destroySpy{pBatch, &QObject::destroyed};
+
+        QVERIFY(destroySpy.wait());
+
+        QCOMPARE(measurementSpy.size(), LocationCount);
+        for(const auto &measurement : measurementSpy)
+        {
+            QCOMPARE(measurement[1].value<std::chrono::microseconds>(),
+                     std::chrono::microseconds{std::chrono::milliseconds{30}});
+        }
+    }
+
     // Verify that a LatencyBatch destroys itself correctly when none of the
     // addresses given are valid.  (It should be destroyed immediately, not after
     // the measurement timeout.)
@@ -348,6 +385,151 @@ private slots:
         QCOMPARE(measurementSpy.size(), 0);
     }
 
+    // Verify that LatencyStore averages the most recent HistoryCount
+    // measurements for each location
+    void storeAverages()
+    {
+        using us = std::chrono::microseconds;
+        LatencyStore store;
+        auto first = store.add();
+        auto second = store.add();
+
+        QCOMPARE(store.latency(first), us{0});
+        QCOMPARE(store.updateLatency(first, us{10}), us{10});
+        QCOMPARE(store.updateLatency(first, us{20}), us{15});
+        // Other locations aren't affected
+        QCOMPARE(store.updateLatency(second, us{100}), us{100});
+        QCOMPARE(store.updateLatency(first, us{30}), us{20});
+        QCOMPARE(store.updateLatency(first, us{40}), us{25});
+        QCOMPARE(store.updateLatency(first, us{50}), us{30});
+        // The buffer is full now; the oldest measurements are discarded
+        QCOMPARE(store.updateLatency(first, us{60}), us{40});
+        QCOMPARE(store.updateLatency(first, us{70}), us{50});
+        QCOMPARE(store.latency(first), us{50});
+        QCOMPARE(store.latency(second), us{100});
+
+        // Measurements carry over to another store
+        LatencyStore copied;
+        auto empty = copied.add();
+        auto carried = copied.add(store, first);
+        QCOMPARE(copied.updateLatency(carried, us{80}), us{60});
+
+        std::vector<us> latencies;
+        copied.computeLatencies(latencies);
+        QCOMPARE(latencies.size(), std::size_t{2});
+        QCOMPARE(latencies[empty], us{0});
+        QCOMPARE(latencies[carried], us{60});
+    }
+
+    // Verify the deviation of a location's recent measurements
+    void storeDeviation()
+    {
+        using us = std::chrono::microseconds;
+        LatencyStore store;
+        auto index = store.add();
+
+        store.updateLatency(index, us{100});
+        QCOMPARE(store.deviation(index), us{0});
+        store.updateLatency(index, us{100});
+        QCOMPARE(store.deviation(index), us{0});
+        store.updateLatency(index, us{400});
+        // Mean 200, variance (10000*2 + 40000)/3 = 20000
+        QCOMPARE(store.deviation(index), us{141});
+    }
+
+    // Verify that locations back off exponentially while stable, and return
+    // to the base interval when their measurements vary
+    void schedulerBackoff()
+    {
+        using Scheduler = LatencyProbeScheduler;
+        Scheduler scheduler;
+        Scheduler::Clock::time_point now{};
+        auto index = scheduler.add(now);
+        std::vector<std::size_t> due;
+
+        std::chrono::seconds expectedInterval{Scheduler::BaseInterval};
+        for(int i=0; i<8; ++i)
+        {
+            scheduler.takeDue(now, due);
+            QCOMPARE(due, std::vector<std::size_t>{index});
+            QCOMPARE(scheduler.nextProbe(index), now + expectedInterval);
+            scheduler.measured(index, true, now);
+            // Not due again until the interval elapses
+            scheduler.takeDue(now + expectedInterval - Scheduler::CoalesceWindow - std::chrono::seconds{1}, due);
+            QVERIFY(due.empty());
+
+            now += expectedInterval;
+            expectedInterval = std::min(expectedInterval * 2, std::chrono::seconds{Scheduler::MaxInterval});
+        }
+
+        // An unstable measurement reschedules the location at the base interval
+        scheduler.takeDue(now, due);
+        scheduler.measured(index, false, now);
+        QCOMPARE(scheduler.nextProbe(index), now + Scheduler::BaseInterval);
+    }
+
+    // Verify that candidates are probed at the candidate interval, and are
+    // probed first when more locations are due than the probe budget
+    void schedulerCandidates()
+    {
+        using Scheduler = LatencyProbeScheduler;
+        Scheduler scheduler;
+        Scheduler::Clock::time_point now{};
+        for(std::size_t i=0; i<Scheduler::ProbeBudget + 10; ++i)
+            scheduler.add(now);
+        std::size_t candidate = Scheduler::ProbeBudget + 5;
+        scheduler.setCandidate(candidate, true, now);
+
+        std::vector<std::size_t> due;
+        scheduler.takeDue(now, due);
+        QCOMPARE(due.size(), std::size_t{Scheduler::ProbeBudget});
+        QVERIFY(std::find(due.begin(), due.end(), candidate) != due.end());
+        QCOMPARE(scheduler.nextProbe(candidate), now + Scheduler::CandidateInterval);
+
+        // The remaining locations are still due
+        scheduler.takeDue(now, due);
+        QCOMPARE(due.size(), std::size_t{10});
+        QCOMPARE(scheduler.nextDue(), now + Scheduler::CandidateInterval);
+
+        // Candidates don't back off
+        now += Scheduler::CandidateInterval;
+        scheduler.takeDue(now, due);
+        QCOMPARE(due, std::vector<std::size_t>{candidate});
+        QCOMPARE(scheduler.nextProbe(candidate), now + Scheduler::CandidateInterval);
+
+        // A location that has backed off is probed sooner when it becomes a
+        // candidate
+        now += Scheduler::CandidateInterval;
+        scheduler.takeDue(now, due);
+        QCOMPARE(scheduler.nextProbe(0), now + 2 * Scheduler::BaseInterval);
+        scheduler.setCandidate(0, true, now);
+        QCOMPARE(scheduler.nextProbe(0), now + Scheduler::CandidateInterval);
+    }
+
+    // Measure adding one round of measurements for 10k locations and then
+    // computing the latencies of all locations
+    void benchmarkLatencyStore()
+    {
+        enum : std::size_t {LocationCount = 10000};
+        LatencyStore store;
+        store.reserve(LocationCount);
+        for(std::size_t i=0; i<LocationCount; ++i)
+            store.add();
+
+        std::vector<std::chrono::microseconds> latencies;
+        std::chrono::microseconds sample{1};
+        QBENCHMARK
+        {
+            for(std::size_t i=0; i<LocationCount; ++i)
+            {
+                store.updateLatency(i, sample);
+                sample = std::chrono::microseconds{(sample.count() * 7 + 3) % 500000};
+            }
+            store.computeLatencies(latencies);
+        }
+        QCOMPARE(latencies.size(), std::size_t{LocationCount});
+    }
+
     //Verify that equivalent IP addresses are found correctly
     void equivalentIpAddresses()
     {
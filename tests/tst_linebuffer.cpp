@@ -28,6 +28,45 @@ namespace samples
     const QByteArray noNewlines{"goodbye"};
 }
 
+// LineBuffer's lines are only valid during the signal, so collect copies of
+// them instead of using QSignalSpy
+class LineCollector
+{
+public:
+    LineCollector(LineBuffer &buffer)
+    {
+        QObject::connect(&buffer, &LineBuffer::lineComplete, &buffer,
+            [this](const QByteArray &line)
+            {
+                lines.push_back(QByteArray{line.constData(), line.size()});
+            });
+    }
+
+public:
+    QList<QByteArray> lines;
+};
+
+// Generate ~1 MiB of output in 80-character lines
+QByteArray generateLines()
+{
+    QByteArray line(79, 'x');
+    line += '\n';
+    QByteArray data;
+    data.reserve(1024*1024);
+    while(data.size() < 1024*1024)
+        data += line;
+    return data;
+}
+
+// Split data into chunks of a given size
+QList<QByteArray> splitChunks(const QByteArray &data, int chunkSize)
+{
+    QList<QByteArray> chunks;
+    for(int pos = 0; pos < data.size(); pos += chunkSize)
+        chunks.push_back(data.mid(pos, chunkSize));
+    return chunks;
+}
+
 class tst_linebuffer : public QObject
 {
     Q_OBJECT
@@ -38,90 +77,142 @@ private slots:
     void testAppendOneNewline()
     {
         LineBuffer buf;
-        QSignalSpy spy{&buf, &LineBuffer::lineComplete};
+        LineCollector collector{buf};
         buf.append(samples::oneNewline);
 
-        QCOMPARE(spy.count(), 1);
-
-        QList<QVariant> arguments = spy.takeFirst();
-        auto line = arguments.at(0).toByteArray();
-
-        QCOMPARE(arguments.at(0).type(), QVariant::ByteArray);
-        QCOMPARE(line, QByteArray{"hello"}); // trailing newline is removed
+        QCOMPARE(collector.lines.count(), 1);
+        QCOMPARE(collector.lines[0], QByteArray{"hello"}); // trailing newline is removed
     }
 
     // signals are emitted for each newline in buffer
     void testAppendMultipleNewlines()
     {
         LineBuffer buf;
-        QSignalSpy spy{&buf, &LineBuffer::lineComplete};
+        LineCollector collector{buf};
         buf.append(samples::multipleNewlines);
 
         // There are two lines, so the signal was emitted twice
-        QCOMPARE(spy.count(), 2);
-
-        // First line
-        QList<QVariant> arguments1 = spy.takeFirst();
-        auto line1 = arguments1.at(0).toByteArray();
-        QCOMPARE(line1, QByteArray{"hello"});
-
-        // Second line
-        QList<QVariant> arguments2 = spy.takeFirst();
-        auto line2 = arguments2.at(0).toByteArray();
-        QCOMPARE(line2, QByteArray{"world"});
+        QCOMPARE(collector.lines.count(), 2);
+        QCOMPARE(collector.lines[0], QByteArray{"hello"});
+        QCOMPARE(collector.lines[1], QByteArray{"world"});
     }
 
     // buffered text has no newline, so no signal is emitted
     void testAppendNoNewline()
     {
         LineBuffer buf;
-        QSignalSpy spy{&buf, &LineBuffer::lineComplete};
+        LineCollector collector{buf};
         buf.append(samples::noNewlines);
 
         // No lines
-        QCOMPARE(spy.count(), 0);
+        QCOMPARE(collector.lines.count(), 0);
     }
 
     void testAppendNoNewlineFollowedByNewline()
     {
         LineBuffer buf;
-        QSignalSpy spy{&buf, &LineBuffer::lineComplete};
+        LineCollector collector{buf};
         buf.append(samples::noNewlines);
-        QCOMPARE(spy.count(), 0);
+        QCOMPARE(collector.lines.count(), 0);
 
         // Adding a subsequent newline causes buffered text to be emitted
         buf.append(QByteArray{"\n"});
-        QCOMPARE(spy.count(), 1);
-
-        QList<QVariant> arguments = spy.takeFirst();
-        auto line = arguments.at(0).toByteArray();
-
-        QCOMPARE(arguments.at(0).type(), QVariant::ByteArray);
-        QCOMPARE(line, QByteArray{"goodbye"});
+        QCOMPARE(collector.lines.count(), 1);
+        QCOMPARE(collector.lines[0], QByteArray{"goodbye"});
     }
 
     void testReset()
     {
         LineBuffer buf;
-        QSignalSpy spy{&buf, &LineBuffer::lineComplete};
+        LineCollector collector{buf};
         buf.append(samples::noNewlines);
 
         // Clear out existing text in buffer
-        buf.reset();
+        QCOMPARE(buf.reset(), samples::noNewlines);
 
         // Append new text, this time with a newline
         buf.append(QByteArray{"sunshine\n"});
-        QCOMPARE(spy.count(), 1);
+        QCOMPARE(collector.lines.count(), 1);
+
+        // No trace of text previous to reset() exists in bufffer
+        QCOMPARE(collector.lines[0], QByteArray{"sunshine"});
+    }
 
-        QList<QVariant> arguments = spy.takeFirst();
-        auto line = arguments.at(0).toByteArray();
+    // CRLF line breaks are handled, including when split between chunks, and
+    // empty lines are emitted
+    void testCrlfAndEmptyLines()
+    {
+        LineBuffer buf;
+        LineCollector collector{buf};
+        buf.append(QByteArray{"first\r\n\r\nsec"});
+        buf.append(QByteArray{"ond\r"});
+        buf.append(QByteArray{"\n\nthird"});
 
-        QCOMPARE(arguments.at(0).type(), QVariant::ByteArray);
+        QCOMPARE(collector.lines, (QList<QByteArray>{"first", "", "second", ""}));
+        QCOMPARE(buf.reset(), QByteArray{"third"});
+    }
 
-        // No trace of text previous to reset() exists in bufffer
-        QCOMPARE(line, QByteArray{"sunshine"});
+    // A line split across many chunks is reassembled
+    void testFragmentedLine()
+    {
+        LineBuffer buf;
+        LineCollector collector{buf};
+        QByteArray line(10000, 'a');
+        for(const auto &chunk : splitChunks(line + "\nnext", 7))
+            buf.append(chunk);
+
+        QCOMPARE(collector.lines.count(), 1);
+        QCOMPARE(collector.lines[0], line);
+        QCOMPARE(buf.reset(), QByteArray{"next"});
     }
 
+    // Benchmarks - large input in one chunk, and the same input in small
+    // fragments
+    void benchmarkLargeInput()
+    {
+        const auto data = generateLines();
+        LineBuffer buf;
+        int lines = 0;
+        QObject::connect(&buf, &LineBuffer::lineComplete, &buf,
+                         [&](const QByteArray &){++lines;});
+        QBENCHMARK
+        {
+            buf.append(data);
+        }
+        QVERIFY(lines > 0);
+    }
+
+    void benchmarkFragmentedInput()
+    {
+        const auto chunks = splitChunks(generateLines(), 7);
+        LineBuffer buf;
+        int lines = 0;
+        QObject::connect(&buf, &LineBuffer::lineComplete, &buf,
+                         [&](const QByteArray &){++lines;});
+        QBENCHMARK
+        {
+            for(const auto &chunk : chunks)
+                buf.append(chunk);
+        }
+        QVERIFY(lines > 0);
+    }
+
+    // One very long line delivered in small chunks - this was quadratic when
+    // the buffer was rescanned and reallocated for each chunk
+    void benchmarkLongLine()
+    {
+        const auto chunks = splitChunks(QByteArray(4*1024*1024, 'x') + "\n", 4096);
+        LineBuffer buf;
+        int lines = 0;
+        QObject::connect(&buf, &LineBuffer::lineComplete, &buf,
+                         [&](const QByteArray &){++lines;});
+        QBENCHMARK
+        {
+            for(const auto &chunk : chunks)
+                buf.append(chunk);
+        }
+        QVERIFY(lines > 0);
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_linebuffer)
@@ -0,0 +1,72 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include <QtTest>
+
+#include "linux/linux_linkstats.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+class tst_linkstats : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Loopback traffic is counted on "lo" - its counters increase after
+    // sending a datagram to ourselves
+    void loopbackCounters()
+    {
+        LinkStatsReader reader;
+        LinkStatsReader::Counters before{};
+        QVERIFY(reader.read(QStringLiteral("lo"), before));
+
+        PosixFd sock{::socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0)};
+        QVERIFY(sock);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t addrLen = sizeof(addr);
+        QCOMPARE(::bind(sock.get(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0);
+        QCOMPARE(::getsockname(sock.get(), reinterpret_cast<sockaddr*>(&addr), &addrLen), 0);
+
+        const QByteArray payload(1000, 'x');
+        QCOMPARE(::sendto(sock.get(), payload.constData(), static_cast<std::size_t>(payload.size()), 0,
+                          reinterpret_cast<sockaddr*>(&addr), sizeof(addr)),
+                 static_cast<ssize_t>(payload.size()));
+
+        LinkStatsReader::Counters after{};
+        QVERIFY(reader.read(QStringLiteral("lo"), after));
+        QVERIFY(after.rxBytes >= before.rxBytes + static_cast<std::uint64_t>(payload.size()));
+        QVERIFY(after.txBytes >= before.txBytes + static_cast<std::uint64_t>(payload.size()));
+    }
+
+    // The reader can be reused, and fails for interfaces that don't exist
+    void missingInterface()
+    {
+        LinkStatsReader reader;
+        LinkStatsReader::Counters counters{};
+        QVERIFY(!reader.read(QStringLiteral("nonexistent0"), counters));
+        QVERIFY(!reader.read(QStringLiteral("name-too-long-for-ifnamsiz"), counters));
+        QVERIFY(reader.read(QStringLiteral("lo"), counters));
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_linkstats)
+#include TEST_MOC
@@ -164,6 +164,89 @@ private slots:
         QCOMPARE(receivedMessages, sentMessages);
     }
 
+    // Send bursts of messages without returning to the event loop, mixing small
+    // messages with ones larger than the coalescing threshold, and have the
+    // server reply to each with two messages.  Everything must arrive intact
+    // and in order, and acknowledgements must still keep up.
+    void coalescedBursts()
+    {
+        QVector<QByteArray> sentMessages, receivedMessages;
+
+        QVERIFY2(setupServerClientConnection([](const QByteArray& msg, IPCConnection* connection) {
+            connection->sendMessage(QByteArrayLiteral("notify-") + msg.left(8));
+            connection->sendMessage(msg);
+        }, [&](const QByteArray& msg) {
+            receivedMessages.append(msg);
+        }), "failed to setup client-server connection");
+
+        _connection->setLagThreshold(500);
+        _serverClientConnection->setLagThreshold(500);
+        QSignalSpy spyClientLagging{_connection, &ClientIPCConnection::remoteLagging};
+
+        QVector<QByteArray> expectedMessages;
+        for (int burst = 0; burst < 4; ++burst)
+        {
+            for (int i = 0; i < 50; ++i)
+            {
+                // Every 10th message is larger than the coalescing threshold
+                int size = (i % 10 == 9) ? 200 * 1024 : 16 + i;
+                QByteArray msg{size, static_cast<char>('a' + (burst * 50 + i) % 26)};
+                msg.replace(0, 8, QByteArray::number(burst * 50 + i).rightJustified(8, '0'));
+                _connection->sendMessage(msg);
+                sentMessages.append(msg);
+                expectedMessages.append(QByteArrayLiteral("notify-") + msg.left(8));
+                expectedMessages.append(msg);
+            }
+            QTest::qWait(0);
+        }
+
+        QVERIFY2(QTest::qWaitFor([&]() { return receivedMessages.count() == expectedMessages.count() || _connection->isError(); },
+                                 60000),
+                 "timed out waiting for responses");
+        QVERIFY(!_connection->isError());
+        QCOMPARE(receivedMessages, expectedMessages);
+        QVERIFY(spyClientLagging.isEmpty());
+    }
+
+    // Messages queued to be written at the end of the event loop iteration are
+    // still sent if the connection is destroyed first
+    void flushOnDestroy()
+    {
+        QVector<QByteArray> receivedMessages;
+        QVERIFY2(setupServerClientConnection([&](const QByteArray& msg, IPCConnection*) {
+            receivedMessages.append(msg);
+        }, {}), "failed to setup client-server connection");
+
+        // ThreadedLocalIPCConnection queues messages to its own thread; this
+        // only applies to the socket connection itself
+        if(!qobject_cast<LocalSocketIPCConnection*>(_connection.data()))
+            QSKIP("Only applies to LocalSocketIPCConnection");
+
+        const QVector<QByteArray> sentMessages{QByteArrayLiteral("queued-1"),
+                                               QByteArrayLiteral("queued-2")};
+        for(const auto &msg : sentMessages)
+            _connection->sendMessage(msg);
+        delete _connection.data();
+
+        QVERIFY2(QTest::qWaitFor([&]() { return receivedMessages.count() == sentMessages.count(); }),
+                 "timed out waiting for messages");
+        QCOMPARE(receivedMessages, sentMessages);
+    }
+
+    // Verify the serialized frame format, which must not change as it's shared
+    // with other versions of the client and daemon.
+    void frameFormat()
+    {
+        QByteArray frame;
+        {
+            QDataStream stream(&frame, QIODevice::WriteOnly);
+            LocalSocketIPCConnection::writeFrame(0x1234u, QByteArrayLiteral("{}"), stream);
+            LocalSocketIPCConnection::writeFrame(0xFFF1u, QByteArray{0, Qt::Initialization::Uninitialized}, stream);
+        }
+        QCOMPARE(frame, QByteArray::fromHex("ffacce56" "4003" "2001" "02000000" "7b7d"
+                                            "ffacce56" "100f" "f00f" "00000000"));
+    }
+
     // Send a mix of valid and invalid messages and verify that all the valid
     // messages are properly received.
     void garbageRecovery()
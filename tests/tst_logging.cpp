@@ -0,0 +1,169 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+#include <QTemporaryDir>
+#include <thread>
+#include <vector>
+
+#include "path.h"
+
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const int producerThreads = 4;
+    const int linesPerThread = 2000;
+
+    // Read the test lines ("asynclog <producer> <line>") from a log file as
+    // (producer, line) pairs in file order.  The fatal test line is returned
+    // as producer -1.
+    std::vector<std::pair<int, int>> readTestLines(const QString &path)
+    {
+        std::vector<std::pair<int, int>> lines;
+        QFile file{path};
+        if(!file.open(QFile::ReadOnly | QFile::Text))
+            return lines;
+        QRegularExpression lineRegex{QStringLiteral(R"(asynclog (\d+) (\d+)$)")};
+        while(!file.atEnd())
+        {
+            QString line = QString::fromUtf8(file.readLine()).trimmed();
+            if(line.endsWith(QStringLiteral("asynclog fatal")))
+            {
+                lines.push_back({-1, 0});
+                continue;
+            }
+            auto match = lineRegex.match(line);
+            if(match.hasMatch())
+                lines.push_back({match.captured(1).toInt(), match.captured(2).toInt()});
+        }
+        return lines;
+    }
+}
+
+class tst_logging : public QObject
+{
+    Q_OBJECT
+
+private:
+    QtMessageHandler _testHandler{nullptr};
+
+private slots:
+    void initTestCase()
+    {
+        // Install Logger's handler for this test, restore QTest's afterward
+        _testHandler = qInstallMessageHandler(nullptr);
+        Logger::initialize(false);
+    }
+
+    void cleanupTestCase()
+    {
+        qInstallMessageHandler(_testHandler);
+    }
+
+    // In asynchronous mode, every line traced is written, and the lines from
+    // each thread are written in the order they were traced.
+    void asyncPreservesOrder()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        Path::DebugFile = Path{dir.path()} / "debug.txt";
+        const QString logPath = dir.filePath(QStringLiteral("daemon.log"));
+
+        {
+            Logger logger{logPath, Logger::WriteMode::Asynchronous};
+            logger.configure(true, false, {});
+
+            std::vector<std::thread> producers;
+            for(int p=0; p<producerThreads; ++p)
+            {
+                producers.emplace_back([p]
+                {
+                    for(int i=0; i<linesPerThread; ++i)
+                        qInfo().noquote() << "asynclog" << p << i;
+                });
+            }
+            for(auto &producer : producers)
+                producer.join();
+            // Destroying the Logger writes everything still queued
+        }
+
+        std::vector<int> nextLine(producerThreads, 0);
+        for(const auto &line : readTestLines(logPath))
+        {
+            QVERIFY(line.first >= 0 && line.first < producerThreads);
+            QCOMPARE(line.second, nextLine[line.first]);
+            ++nextLine[line.first];
+        }
+        for(int p=0; p<producerThreads; ++p)
+            QCOMPARE(nextLine[p], linesPerThread);
+    }
+
+    // A fatal message writes everything queued before it's written, since the
+    // process aborts right after.
+    void fatalDrainsQueue()
+    {
+#ifdef Q_OS_UNIX
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString logPath = dir.filePath(QStringLiteral("daemon.log"));
+
+        pid_t child = ::fork();
+        QVERIFY(child >= 0);
+        if(child == 0)
+        {
+            // Don't dump core for the expected abort
+            rlimit noCore{0, 0};
+            ::setrlimit(RLIMIT_CORE, &noCore);
+
+            Path::DebugFile = Path{dir.path()} / "debug.txt";
+            Logger logger{logPath, Logger::WriteMode::Asynchronous};
+            logger.configure(true, false, {});
+            for(int i=0; i<linesPerThread; ++i)
+                qInfo().noquote() << "asynclog" << 0 << i;
+            qFatal("asynclog fatal");
+            ::_exit(1);   // Not reached
+        }
+
+        int status{};
+        QCOMPARE(::waitpid(child, &status, 0), child);
+        QVERIFY(WIFSIGNALED(status));
+        QCOMPARE(WTERMSIG(status), SIGABRT);
+
+        const auto lines = readTestLines(logPath);
+        QCOMPARE(static_cast<int>(lines.size()), linesPerThread + 1);
+        for(int i=0; i<linesPerThread; ++i)
+        {
+            QCOMPARE(lines[i].first, 0);
+            QCOMPARE(lines[i].second, i);
+        }
+        QCOMPARE(lines.back().first, -1);
+#else
+        QSKIP("Fatal message test requires fork()");
+#endif
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_logging)
+#include TEST_MOC
@@ -0,0 +1,122 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+#include <thread>
+#include <vector>
+
+#include "mpscring.h"
+
+class tst_mpscring : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testCapacity()
+    {
+        QCOMPARE(MpscRing<int>{1}.capacity(), std::size_t{2});
+        QCOMPARE(MpscRing<int>{8}.capacity(), std::size_t{8});
+        QCOMPARE(MpscRing<int>{100}.capacity(), std::size_t{128});
+    }
+
+    void testFullAndEmpty()
+    {
+        MpscRing<QString> ring{4};
+        QString value;
+        QVERIFY(ring.empty());
+        QVERIFY(!ring.tryPop(value));
+
+        for(int i=0; i<4; ++i)
+        {
+            value = QString::number(i);
+            QVERIFY(ring.tryPush(value));
+        }
+        QVERIFY(!ring.empty());
+
+        // The value is left intact if the push fails
+        value = QStringLiteral("overflow");
+        QVERIFY(!ring.tryPush(value));
+        QCOMPARE(value, QStringLiteral("overflow"));
+
+        // Values come out in order, and freed slots can be reused
+        QVERIFY(ring.tryPop(value));
+        QCOMPARE(value, QStringLiteral("0"));
+        value = QStringLiteral("4");
+        QVERIFY(ring.tryPush(value));
+        for(int i=1; i<5; ++i)
+        {
+            QVERIFY(ring.tryPop(value));
+            QCOMPARE(value, QString::number(i));
+        }
+        QVERIFY(ring.empty());
+        QVERIFY(!ring.tryPop(value));
+    }
+
+    // Several producers push concurrently while one consumer pops.  Every
+    // value must arrive exactly once, in order for each producer.
+    void testConcurrentProducers()
+    {
+        const int producerCount = 4;
+        const int valuesPerProducer = 20000;
+        MpscRing<int> ring{64};
+
+        std::vector<std::thread> producers;
+        for(int p=0; p<producerCount; ++p)
+        {
+            producers.emplace_back([&ring, p]
+            {
+                for(int i=0; i<valuesPerProducer; ++i)
+                {
+                    int value = p * valuesPerProducer + i;
+                    while(!ring.tryPush(value))
+                        std::this_thread::yield();
+                }
+            });
+        }
+
+        std::vector<int> nextExpected(producerCount, 0);
+        int received = 0;
+        bool ordered = true;
+        while(received < producerCount * valuesPerProducer)
+        {
+            int value;
+            if(!ring.tryPop(value))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            int producer = value / valuesPerProducer;
+            if(value % valuesPerProducer != nextExpected[producer])
+                ordered = false;
+            ++nextExpected[producer];
+            ++received;
+        }
+
+        for(auto &producer : producers)
+            producer.join();
+
+        QVERIFY(ordered);
+        QVERIFY(ring.empty());
+        for(int p=0; p<producerCount; ++p)
+            QCOMPARE(nextExpected[p], valuesPerProducer);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_mpscring)
+#include TEST_MOC
@@ -19,6 +19,7 @@
 #include "common.h"
 #include "settings/locations.h"
 #include "common/src/locations.h"
+#include "src/regionfixtures.h"
 #include <QtTest>
 
 namespace samples
@@ -341,6 +342,31 @@ const auto locationsGeo = QJsonDocument::fromJson(R"(
     const QJsonArray emptyShadowsocks{};
 }
 
+// Generate a latency for every region, varied by 'seed'
+LatencyMap buildSyntheticLatencies(const LocationsById &locations, int seed)
+{
+    LatencyMap latencies;
+    int i = 0;
+    for(const auto &locationEntry : locations)
+    {
+        latencies[locationEntry.first] = ((i * 37 + seed * 101) % 500) + 10;
+        ++i;
+    }
+    return latencies;
+}
+
+// Get the location IDs from grouped locations in order
+std::vector<QString> groupedIds(const std::vector<CountryLocations> &grouped)
+{
+    std::vector<QString> ids;
+    for(const auto &country : grouped)
+    {
+        for(const auto &pLocation : country.locations())
+            ids.push_back(pLocation->id());
+    }
+    return ids;
+}
+
 class tst_nearestlocations : public QObject
 {
     Q_OBJECT
@@ -506,6 +532,83 @@ private slots:
         testLocations.erase("npf_nauto_ng");
         QCOMPARE(getBestId(), "npf_nauto_g");
     }
+
+    // Applying latencies to built locations must produce the same result as
+    // rebuilding the locations with those latencies.
+    void testLatencyUpdateMatchesRebuild()
+    {
+        const auto regions = RegionFixtures::buildRegionsList(20, 5);
+        LocationsById locations{buildModernLocations({}, regions, {}, {}, {})};
+        std::vector<CountryLocations> grouped;
+        std::vector<QSharedPointer<Location>> dips;
+        buildGroupedLocations(locations, grouped, dips);
+
+        const auto originalLocations = locations;
+        const auto latencies = buildSyntheticLatencies(locations, 1);
+
+        auto changedIds = updateLocationLatencies(locations, latencies);
+        QCOMPARE(changedIds.size(), locations.size());
+        updateGroupedLocations(locations, changedIds, grouped, dips);
+
+        LocationsById rebuilt{buildModernLocations(latencies, regions, {}, {}, {})};
+        std::vector<CountryLocations> rebuiltGrouped;
+        std::vector<QSharedPointer<Location>> rebuiltDips;
+        buildGroupedLocations(rebuilt, rebuiltGrouped, rebuiltDips);
+
+        QVERIFY(groupedIds(grouped) == groupedIds(rebuiltGrouped));
+        for(const auto &locationEntry : rebuilt)
+            QVERIFY(compareLocationsValue(locations.at(locationEntry.first), locationEntry.second));
+
+        // The original objects are not modified
+        for(const auto &locationEntry : originalLocations)
+            QVERIFY(!locationEntry.second->latency());
+
+        // Applying the same latencies again changes nothing
+        QVERIFY(updateLocationLatencies(locations, latencies).empty());
+
+        // A single changed latency only replaces that location
+        LatencyMap oneChange{latencies};
+        const auto &changedId = locations.begin()->first;
+        oneChange[changedId] = 1;
+        auto pUnchanged = std::next(locations.begin())->second;
+        changedIds = updateLocationLatencies(locations, oneChange);
+        QCOMPARE(changedIds.size(), std::size_t{1});
+        QCOMPARE(*changedIds.begin(), changedId);
+        QVERIFY(std::next(locations.begin())->second == pUnchanged);
+        updateGroupedLocations(locations, changedIds, grouped, dips);
+        QCOMPARE(grouped.front().locations().front()->id(), changedId);
+    }
+
+    void benchmarkLatencyFullRebuild()
+    {
+        const auto regions = RegionFixtures::buildRegionsList(100, 10);
+        LocationsById locations{buildModernLocations({}, regions, {}, {}, {})};
+        int seed = 0;
+        QBENCHMARK
+        {
+            auto latencies = buildSyntheticLatencies(locations, ++seed);
+            LocationsById rebuilt{buildModernLocations(latencies, regions, {}, {}, {})};
+            std::vector<CountryLocations> grouped;
+            std::vector<QSharedPointer<Location>> dips;
+            buildGroupedLocations(rebuilt, grouped, dips);
+        }
+    }
+
+    void benchmarkLatencyIncrementalUpdate()
+    {
+        const auto regions = RegionFixtures::buildRegionsList(100, 10);
+        LocationsById locations{buildModernLocations({}, regions, {}, {}, {})};
+        std::vector<CountryLocations> grouped;
+        std::vector<QSharedPointer<Location>> dips;
+        buildGroupedLocations(locations, grouped, dips);
+        int seed = 0;
+        QBENCHMARK
+        {
+            auto latencies = buildSyntheticLatencies(locations, ++seed);
+            auto changedIds = updateLocationLatencies(locations, latencies);
+            updateGroupedLocations(locations, changedIds, grouped, dips);
+        }
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_nearestlocations)
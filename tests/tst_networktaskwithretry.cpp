@@ -188,6 +188,95 @@ private slots:
     {
         testFailRedirect(noPortBase, QStringLiteral("https:redir_resource"));
     }
+
+    // A slow attempt is hedged with the next base, the first successful result
+    // is used, and the slow attempt is aborted.
+    void testHedgedRequest()
+    {
+        FixedApiBase hedgeBase{std::initializer_list<QString>{
+            QStringLiteral("https://one.example.com/"),
+            QStringLiteral("https://two.example.com/")}};
+
+        QSignalSpy consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal};
+        QObject consumeContext;
+        QStringList requestHosts;
+        connect(&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal,
+                &consumeContext, [&requestHosts](const QNetworkRequest &req)
+                {
+                    requestHosts.push_back(req.url().host());
+                });
+
+        auto pSlowReply = MockNetworkManager::enqueueReply();
+        QSignalSpy slowFinishedSpy{pSlowReply.data(), &QNetworkReply::finished};
+        auto pFastReply = MockNetworkManager::enqueueReply(successJson);
+        CallbackSpy resultSpy;
+        Async<NetworkTaskWithRetry>::create(
+            QNetworkAccessManager::Operation::GetOperation, hedgeBase,
+            testResource, ApiRetries::hedged(2), QJsonDocument{},
+            QByteArray{})->notify(&resultSpy, resultSpy.callback());
+        QVERIFY(consumeSpy.wait(100));
+
+        // There's no latency history, so the second base is tried after the
+        // default hedge delay.
+        QVERIFY(!consumeSpy.wait(500));
+        QVERIFY(consumeSpy.wait(2000));
+        QCOMPARE(requestHosts, (QStringList{QStringLiteral("one.example.com"),
+                                            QStringLiteral("two.example.com")}));
+
+        emit pFastReply->finished();
+        QVERIFY(checkSuccessResponse(resultSpy));
+        // The slow attempt was aborted
+        QCOMPARE(slowFinishedSpy.count(), 1);
+    }
+
+    // ApiBaseData starts requests with the base that has been fastest
+    // recently, and forgets a base's history when it fails.
+    void testFastestBase()
+    {
+        ApiBaseData baseData{std::initializer_list<QString>{
+            QStringLiteral("https://one.example.com/"),
+            QStringLiteral("https://two.example.com/"),
+            QStringLiteral("https://three.example.com/")}};
+
+        baseData.attemptSucceeded(0, std::chrono::milliseconds{400});
+        QCOMPARE(baseData.getNextStartIndex(), 0u);
+        baseData.attemptSucceeded(2, std::chrono::milliseconds{100});
+        QCOMPARE(baseData.getNextStartIndex(), 2u);
+        // A slower success doesn't displace the fastest base
+        baseData.attemptSucceeded(1, std::chrono::milliseconds{300});
+        QCOMPARE(baseData.getNextStartIndex(), 2u);
+        // Once the fastest base fails, the next-fastest base is preferred
+        baseData.attemptFailed(2);
+        QCOMPARE(baseData.getNextStartIndex(), 1u);
+        baseData.attemptSucceeded(1, std::chrono::milliseconds{300});
+        QCOMPARE(baseData.getNextStartIndex(), 1u);
+
+        // The hedge delay is the 90th percentile of the base's latencies, or a
+        // default for a base with no history
+        baseData.attemptSucceeded(0, std::chrono::milliseconds{350});
+        QVERIFY(baseData.getHedgeDelay(0) == std::chrono::milliseconds{400});
+        QVERIFY(baseData.getHedgeDelay(2) == std::chrono::milliseconds{1500});
+    }
+
+    // With no latency history, a failure moves on to the next base, and
+    // failures of other bases don't change the start base.
+    void testFailedBaseWithoutHistory()
+    {
+        ApiBaseData baseData{std::initializer_list<QString>{
+            QStringLiteral("https://one.example.com/"),
+            QStringLiteral("https://two.example.com/"),
+            QStringLiteral("https://three.example.com/")}};
+
+        QCOMPARE(baseData.getNextStartIndex(), 0u);
+        baseData.attemptFailed(0);
+        QCOMPARE(baseData.getNextStartIndex(), 1u);
+        baseData.attemptFailed(2);
+        QCOMPARE(baseData.getNextStartIndex(), 1u);
+        baseData.attemptFailed(1);
+        QCOMPARE(baseData.getNextStartIndex(), 2u);
+        baseData.attemptFailed(2);
+        QCOMPARE(baseData.getNextStartIndex(), 0u);
+    }
 };
 
 QTEST_GUILESS_MAIN(tst_networktaskwithretry)
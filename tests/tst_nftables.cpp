@@ -0,0 +1,316 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+
+#include "linux/linux_nftables.h"
+#include "daemon/src/posix/posix_firewall_iptables.h"
+#include <linux/netfilter_ipv4.h>
+#include <linux/netfilter_ipv6.h>
+#include <net/if.h>
+#include <grp.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <linux/magic.h>
+
+namespace
+{
+    Nftables::AddressRange range(const char *pStartHex, const char *pEndHex)
+    {
+        return {QByteArray::fromHex(pStartHex), QByteArray::fromHex(pEndHex)};
+    }
+
+    // The firewall anchor rules match the daemon's groups and cgroups, which
+    // only exist where the daemon is installed.  Substitute a group and cgroup
+    // that exist so the rules can be translated here.
+    QStringList withLocalGroups(QStringList rules)
+    {
+        const group *pRootGroup = ::getgrgid(0);
+        const QString rootGroup = pRootGroup ? QString::fromLocal8Bit(pRootGroup->gr_name) : QString{};
+        const QStringList cgroups = QDir{QStringLiteral("/sys/fs/cgroup")}.entryList(QDir::Dirs|QDir::NoDotAndDotDot);
+
+        const QRegularExpression groupOption{QStringLiteral("--gid-owner (\\S+)")};
+        const QRegularExpression pathOption{QStringLiteral("--path (\\S+)")};
+        for(auto &rule : rules)
+        {
+            auto groupMatch = groupOption.match(rule);
+            if(groupMatch.hasMatch() && !::getgrnam(groupMatch.captured(1).toLocal8Bit().constData()))
+                rule.replace(groupMatch.capturedStart(1), groupMatch.capturedLength(1), rootGroup);
+            auto pathMatch = pathOption.match(rule);
+            if(pathMatch.hasMatch() && !cgroups.isEmpty() &&
+               !QDir{QStringLiteral("/sys/fs/cgroup")}.exists(pathMatch.captured(1)))
+            {
+                rule.replace(pathMatch.capturedStart(1), pathMatch.capturedLength(1), cgroups[0]);
+            }
+        }
+        return rules;
+    }
+
+    bool translates(Nftables::Family family, const QStringList &rules)
+    {
+        try
+        {
+            Nftables::translateRules(family, withLocalGroups(rules));
+            return true;
+        }
+        catch(const Error &)
+        {
+            return false;   // translateRules() traced the rule
+        }
+    }
+}
+
+class tst_nftables : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testSubnetRange()
+    {
+        using Nftables::Family;
+        using Nftables::subnetRange;
+
+        QCOMPARE(subnetRange(Family::IPv4, "10.0.0.0/8"), range("0a000000", "0b000000"));
+        // Host bits are ignored
+        QCOMPARE(subnetRange(Family::IPv4, "192.168.1.77/24"), range("c0a80100", "c0a80200"));
+        // A single address
+        QCOMPARE(subnetRange(Family::IPv4, "1.1.1.1"), range("01010101", "01010102"));
+        // Ranges at the end of the address space have no end
+        QCOMPARE(subnetRange(Family::IPv4, "255.255.255.255/32"), range("ffffffff", ""));
+        QCOMPARE(subnetRange(Family::IPv4, "0.0.0.0/0"), range("00000000", ""));
+        QCOMPARE(subnetRange(Family::IPv6, "fe80::/10"),
+                 range("fe800000000000000000000000000000", "fec00000000000000000000000000000"));
+        QCOMPARE(subnetRange(Family::IPv6, "ff00::/8"),
+                 range("ff000000000000000000000000000000", ""));
+
+        // Wrong family or invalid prefix
+        QVERIFY_EXCEPTION_THROWN(subnetRange(Family::IPv4, "fc00::/7"), Error);
+        QVERIFY_EXCEPTION_THROWN(subnetRange(Family::IPv6, "10.0.0.0/8"), Error);
+        QVERIFY_EXCEPTION_THROWN(subnetRange(Family::IPv4, "10.0.0.0/33"), Error);
+    }
+
+    void testMergeRanges()
+    {
+        using Nftables::AddressRange;
+        using Nftables::mergeRanges;
+
+        // Sorted, disjoint ranges are kept
+        std::vector<AddressRange> disjoint{range("0a000000", "0b000000"),
+                                           range("01010101", "01010102")};
+        QCOMPARE(mergeRanges(disjoint),
+                 (std::vector<AddressRange>{range("01010101", "01010102"),
+                                            range("0a000000", "0b000000")}));
+
+        // Adjacent, overlapping, and contained ranges are combined
+        QCOMPARE(mergeRanges({range("0a000000", "0a000100"), range("0a000100", "0a000200")}),
+                 (std::vector<AddressRange>{range("0a000000", "0a000200")}));
+        QCOMPARE(mergeRanges({range("0a000000", "0a000180"), range("0a000100", "0a000200")}),
+                 (std::vector<AddressRange>{range("0a000000", "0a000200")}));
+        QCOMPARE(mergeRanges({range("0a000000", "0b000000"), range("0a000100", "0a000200")}),
+                 (std::vector<AddressRange>{range("0a000000", "0b000000")}));
+
+        // Ranges extending to the end of the address space absorb later ranges
+        QCOMPARE(mergeRanges({range("e0000000", ""), range("ffffffff", ""),
+                              range("f0000000", "f0000001")}),
+                 (std::vector<AddressRange>{range("e0000000", "")}));
+        QCOMPARE(mergeRanges({range("e0000000", "ffffffff"), range("ffffffff", "")}),
+                 (std::vector<AddressRange>{range("e0000000", "")}));
+    }
+
+    // Rules that differ only by destination are combined into one set
+    void testDestinationSets()
+    {
+        auto rules = Nftables::translateRules(Nftables::Family::IPv4, {
+            QStringLiteral("-d 10.0.0.0/8 -j ACCEPT"),
+            QStringLiteral("-d 169.254.0.0/16 -j ACCEPT"),
+            QStringLiteral("-d 172.16.0.0/12 -j ACCEPT"),
+            QStringLiteral("-d 192.168.0.0/16 -j ACCEPT"),
+            QStringLiteral("-d 224.0.0.0/4 -j ACCEPT"),
+            QStringLiteral("-d 255.255.255.255/32 -j ACCEPT"),
+        });
+        QCOMPARE(rules.size(), std::size_t{1});
+        QVERIFY(rules[0].matchDestSet);
+        QVERIFY(rules[0].matches.empty());
+        QCOMPARE(rules[0].verdict, Nftables::Verdict::Accept);
+        QCOMPARE(rules[0].key, QStringLiteral("-d @set -j ACCEPT"));
+        QCOMPARE(rules[0].destRanges.size(), std::size_t{6});
+        QCOMPARE(rules[0].destRanges.back(), range("ffffffff", ""));
+    }
+
+    // DNS rules alternate between UDP and TCP for each server; each protocol
+    // gets one rule with a set
+    void testInterleavedRules()
+    {
+        auto rules = Nftables::translateRules(Nftables::Family::IPv4, {
+            QStringLiteral("-o tun0 -d 10.0.0.242 -p udp --dport 53 -j ACCEPT"),
+            QStringLiteral("-o tun0 -d 10.0.0.242 -p tcp --dport 53 -j ACCEPT"),
+            QStringLiteral("-o tun0 -d 10.0.0.243 -p udp --dport 53 -j ACCEPT"),
+            QStringLiteral("-o tun0 -d 10.0.0.243 -p tcp --dport 53 -j ACCEPT"),
+            QStringLiteral(" -d 127.0.0.53 -p udp --dport 53 -j ACCEPT"),
+            QStringLiteral("-o lo+ -p udp -m udp --dport 53 -j ACCEPT"),
+        });
+        QCOMPARE(rules.size(), std::size_t{4});
+        QCOMPARE(rules[0].key, QStringLiteral("-o tun0 -d @set -p udp --dport 53 -j ACCEPT"));
+        QCOMPARE(rules[0].destRanges,
+                 (std::vector<Nftables::AddressRange>{range("0a0000f2", "0a0000f4")}));
+        QCOMPARE(rules[1].key, QStringLiteral("-o tun0 -d @set -p tcp --dport 53 -j ACCEPT"));
+        QCOMPARE(rules[1].destRanges.size(), std::size_t{1});
+        // No interface, so not combined with the tunnel rules
+        QCOMPARE(rules[2].key, QStringLiteral("-d @set -p udp --dport 53 -j ACCEPT"));
+        QVERIFY(!rules[3].matchDestSet);
+
+        // Interface names are padded, unless they're wildcards
+        QCOMPARE(rules[0].matches[0].value.size(), IFNAMSIZ);
+        QCOMPARE(rules[3].matches[0].value, QByteArray{"lo"});
+    }
+
+    // Rules aren't combined across a change in verdict
+    void testVerdictOrder()
+    {
+        auto rules = Nftables::translateRules(Nftables::Family::IPv6, {
+            QStringLiteral("-d fc00::/7 -j ACCEPT"),
+            QStringLiteral("-d fe80::/10 -j REJECT"),
+            QStringLiteral("-d ff00::/8 -j ACCEPT"),
+        });
+        QCOMPARE(rules.size(), std::size_t{3});
+        QCOMPARE(rules[0].verdict, Nftables::Verdict::Accept);
+        QCOMPARE(rules[1].verdict, Nftables::Verdict::Reject);
+        QCOMPARE(rules[2].verdict, Nftables::Verdict::Accept);
+        QCOMPARE(rules[2].destRanges.size(), std::size_t{1});
+    }
+
+    void testMultiport()
+    {
+        auto rules = Nftables::translateRules(Nftables::Family::IPv4, {
+            QStringLiteral("-m cgroup --cgroup 0x567 -p tcp --match multiport --dports 53,13038 -j ACCEPT"),
+        });
+        QCOMPARE(rules.size(), std::size_t{2});
+        // cgroup, protocol, and port
+        QCOMPARE(rules[0].matches.size(), std::size_t{3});
+        QCOMPARE(rules[0].matches[2].value, QByteArray::fromHex("0035"));
+        QCOMPARE(rules[1].matches[2].value, QByteArray::fromHex("32ee"));
+        QVERIFY(rules[0].key != rules[1].key);
+    }
+
+    void testNegation()
+    {
+        auto rules = Nftables::translateRules(Nftables::Family::IPv6, {
+            QStringLiteral("! -o lo+ -j REJECT"),
+            QStringLiteral("-p udp -m cgroup ! --cgroup 0x567 -m udp --dport 53 -d ::1 -j REJECT"),
+        });
+        QCOMPARE(rules.size(), std::size_t{2});
+        QVERIFY(rules[0].matches[0].negate);
+        QVERIFY(!rules[1].matches[0].negate);
+        QVERIFY(rules[1].matches[1].negate);
+        QVERIFY(rules[1].matchDestSet);
+    }
+
+    // Cgroup v2 paths are matched by the cgroup's ID, which requires an
+    // existing cgroup - use any group found in the hierarchy
+    void testCgroupPath()
+    {
+        struct statfs rootFs{};
+        if(::statfs("/sys/fs/cgroup", &rootFs) != 0 || rootFs.f_type != CGROUP2_SUPER_MAGIC)
+            QSKIP("Unified cgroup hierarchy is not mounted");
+        const QStringList groups = QDir{QStringLiteral("/sys/fs/cgroup")}.entryList(QDir::Dirs|QDir::NoDotAndDotDot);
+        if(groups.isEmpty())
+            QSKIP("No cgroups in unified hierarchy");
+
+        struct stat groupStat{};
+        QCOMPARE(::stat(QFile::encodeName(QStringLiteral("/sys/fs/cgroup/") + groups[0]).constData(), &groupStat), 0);
+        const std::uint64_t groupId = groupStat.st_ino;
+
+        auto rules = Nftables::translateRules(Nftables::Family::IPv4, {
+            QStringLiteral("-m cgroup --path %1 -j ACCEPT").arg(groups[0]),
+            QStringLiteral("-p udp -m cgroup ! --path /%1/ -m udp --dport 53 -j REJECT").arg(groups[0]),
+        });
+        QCOMPARE(rules.size(), std::size_t{2});
+        const auto &match = rules[0].matches[0];
+        QCOMPARE(match.source, Nftables::Match::Source::SocketCgroupV2);
+        QCOMPARE(match.key, std::uint32_t{1});
+        QCOMPARE(match.value, QByteArray(reinterpret_cast<const char*>(&groupId), sizeof(groupId)));
+        QVERIFY(!match.negate);
+        QCOMPARE(rules[1].matches[1].source, Nftables::Match::Source::SocketCgroupV2);
+        QVERIFY(rules[1].matches[1].negate);
+    }
+
+    void testUnsupportedRules()
+    {
+        using Nftables::Family;
+        using Nftables::translateRules;
+
+        QVERIFY_EXCEPTION_THROWN(translateRules(Family::IPv4, {QStringLiteral("-j MARK --set-mark 1")}), Error);
+        QVERIFY_EXCEPTION_THROWN(translateRules(Family::IPv4, {QStringLiteral("-p icmp -j ACCEPT")}), Error);
+        QVERIFY_EXCEPTION_THROWN(translateRules(Family::IPv4, {QStringLiteral("--dport 53 -j ACCEPT")}), Error);
+        QVERIFY_EXCEPTION_THROWN(translateRules(Family::IPv4, {QStringLiteral("-d 10.0.0.0/8")}), Error);
+        QVERIFY_EXCEPTION_THROWN(translateRules(Family::IPv4, {QStringLiteral("-o eth0 !")}), Error);
+        QVERIFY_EXCEPTION_THROWN(translateRules(Family::IPv4, {QStringLiteral("-m cgroup --path nonexistent.cgroup -j ACCEPT")}), Error);
+    }
+
+    // Every rule that IpTablesFirewall puts in a filter anchor is also applied
+    // with nftables, so each one must translate
+    void testFirewallAnchors()
+    {
+        using Nftables::Family;
+
+        const auto anchors = IpTablesFirewall::filterAnchors();
+        QVERIFY(!anchors.empty());
+        for(const auto &def : anchors)
+            QVERIFY2(translates(def.family, def.rules), qPrintable(def.anchor));
+
+        // Rules applied at runtime by updateRules()
+        for(auto family : {Family::IPv4, Family::IPv6})
+        {
+            QVERIFY(translates(family, IpTablesFirewall::getAllowVpnRules(QStringLiteral("tun0"))));
+            QVERIFY(translates(family, IpTablesFirewall::getAllowHnsdRules(QStringLiteral("tun0"))));
+        }
+        QVERIFY(translates(Family::IPv6, IpTablesFirewall::getAllowIPv6PrefixRules(QStringLiteral("2001:db8::123"))));
+        QVERIFY(translates(Family::IPv4, IpTablesFirewall::getAllowSubnetRules(IpTablesFirewall::IPv4,
+            {QStringLiteral("192.0.2.0/24"), QStringLiteral("198.51.100.7")})));
+        QVERIFY(translates(Family::IPv6, IpTablesFirewall::getAllowSubnetRules(IpTablesFirewall::IPv6,
+            {QStringLiteral("2001:db8::/32")})));
+
+        const QStringList dnsServers{QStringLiteral("10.0.0.243"), QStringLiteral("127.0.0.53")};
+        for(bool enableSplitTunnel : {false, true})
+        {
+            for(bool forceVpnOnlyDns : {false, true})
+            {
+                const auto rules = IpTablesFirewall::getAllowDNSRules(QStringLiteral("tun0"),
+                    dnsServers, enableSplitTunnel, forceVpnOnlyDns, QStringLiteral("192.0.2.53"));
+                QVERIFY(translates(Family::IPv4, rules));
+            }
+        }
+        QVERIFY(translates(Family::IPv4, IpTablesFirewall::getAllowDNSRules({}, dnsServers, true, false, {})));
+    }
+
+    // The base chains run after NAT and before the iptables filter tables, so
+    // the anchors see the same packets as the iptables anchors and their drops
+    // take effect first.  (Accepts still don't skip the host's filter rules -
+    // see NftablesFirewall.)
+    void testBaseChainPriority()
+    {
+        QVERIFY(Nftables::BaseChainPriority < NF_IP_PRI_FILTER);
+        QVERIFY(Nftables::BaseChainPriority < NF_IP6_PRI_FILTER);
+        QVERIFY(Nftables::BaseChainPriority > NF_IP_PRI_NAT_DST);
+        QVERIFY(Nftables::BaseChainPriority > NF_IP6_PRI_NAT_DST);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_nftables)
+#include TEST_MOC
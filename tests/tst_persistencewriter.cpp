@@ -0,0 +1,140 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QTemporaryDir>
+#include "daemon/src/persistencewriter.h"
+#include "json.h"
+
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // Build a JSON object of roughly the size of a cached regions list; each
+    // version has distinct content so a mix of two versions can be detected.
+    QJsonObject buildContent(int version)
+    {
+        QJsonArray regions;
+        for(int i=0; i<5000; ++i)
+        {
+            regions.append(QJsonObject{
+                {QStringLiteral("id"), QStringLiteral("region-%1").arg(i)},
+                {QStringLiteral("version"), version},
+                {QStringLiteral("servers"), QJsonArray{QStringLiteral("10.0.%1.%2").arg(i / 256).arg(i % 256)}}
+            });
+        }
+        return QJsonObject{{QStringLiteral("version"), version},
+                           {QStringLiteral("regions"), regions}};
+    }
+
+    QJsonObject readContent(const QString &path)
+    {
+        QFile file{path};
+        if(!file.open(QFile::ReadOnly))
+            return {};
+        return QJsonDocument::fromJson(file.readAll()).object();
+    }
+}
+
+class tst_persistencewriter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Queued writes are written, and only the newest content of each file is
+    // written.
+    void coalescesWrites()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString dataPath = dir.filePath(QStringLiteral("data.json"));
+        const QString cachePath = dir.filePath(QStringLiteral("regionscache.json"));
+
+        PersistenceWriter writer;
+        for(int i=0; i<100; ++i)
+            writer.queueWrite(dataPath, QJsonObject{{QStringLiteral("value"), i}});
+        writer.queueWrite(cachePath, buildContent(1));
+        writer.flush();
+
+        QCOMPARE(readContent(dataPath), (QJsonObject{{QStringLiteral("value"), 99}}));
+        QCOMPARE(readContent(cachePath), buildContent(1));
+    }
+
+    // Writes still queued when PersistenceWriter is destroyed are completed.
+    void completesOnDestruction()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString path = dir.filePath(QStringLiteral("settings.json"));
+
+        {
+            PersistenceWriter writer;
+            writer.queueWrite(path, buildContent(2));
+        }
+
+        QCOMPARE(readContent(path), buildContent(2));
+    }
+
+    // Kill a process while it's writing a file and verify that the file always
+    // has either the old or the new content, never a partial or mixed write.
+    void crashConsistency()
+    {
+#ifdef Q_OS_UNIX
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString path = dir.filePath(QStringLiteral("data.json"));
+
+        const QJsonObject contents[]{buildContent(1), buildContent(2)};
+        QVERIFY(writeJsonFileAtomic(contents[0], path));
+
+        for(int attempt=0; attempt<20; ++attempt)
+        {
+            pid_t child = ::fork();
+            QVERIFY(child >= 0);
+            if(child == 0)
+            {
+                // Rewrite the file continuously until killed
+                for(int i=1; ; ++i)
+                    writeJsonFileAtomic(contents[i % 2], path);
+            }
+
+            // Kill the writer at varying points during a write
+            ::usleep(static_cast<useconds_t>(2000 + attempt * 1500));
+            ::kill(child, SIGKILL);
+            int status{};
+            QCOMPARE(::waitpid(child, &status, 0), child);
+            QVERIFY(WIFSIGNALED(status));
+
+            const auto content = readContent(path);
+            QVERIFY(content == contents[0] || content == contents[1]);
+        }
+#else
+        QSKIP("Crash consistency test requires fork()");
+#endif
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_persistencewriter)
+#include TEST_MOC
@@ -0,0 +1,278 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+
+#include "posix/posix_ping.h"
+#include <QtEndian>
+#include <array>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+namespace
+{
+    using Clock = PosixPing::Clock;
+
+    // Addresses in the documentation range - PosixPing doesn't mock replies
+    // for these in unit tests, so only the replies given to processPacket()
+    // are observed.
+    const quint32 serverAddress{0xC0000201};   // 192.0.2.1
+    const quint32 otherAddress{0xC0000202};    // 192.0.2.2
+
+    const std::chrono::milliseconds replyDelay{20};
+
+    // Compute an ICMP checksum the same way as PosixPing
+    quint16 checksum(const quint8 *data, std::size_t len)
+    {
+        quint32 accum{0};
+        for(std::size_t i=0; i+1 < len; i += 2)
+        {
+            quint16 word;
+            std::memcpy(&word, data + i, sizeof(word));
+            accum += word;
+        }
+        if(len % 2)
+            accum += data[len-1];
+        accum = (accum & 0xFFFF) + (accum >> 16);
+        accum = (accum & 0xFFFF) + (accum >> 16);
+        return ~static_cast<quint16>(accum);
+    }
+
+    // Build an IPv4 packet containing an ICMP echo reply, as read from the raw
+    // socket.
+    QByteArray buildReply(quint32 source, quint16 identifier, quint16 sequence,
+                          const QByteArray &payload = QByteArray(56, '\x5A'))
+    {
+        QByteArray packet(20 + 8, '\0');
+        packet += payload;
+        auto pPacket = reinterpret_cast<quint8*>(packet.data());
+        pPacket[0] = 0x45;  // IPv4, 20-byte header
+        pPacket[8] = 64;    // TTL
+        pPacket[9] = 1;     // ICMP
+        qToBigEndian(source, pPacket + 12);
+        quint8 *pIcmp = pPacket + 20;
+        pIcmp[0] = 0;   // Echo reply
+        pIcmp[1] = 0;
+        qToBigEndian(identifier, pIcmp + 4);
+        qToBigEndian(sequence, pIcmp + 6);
+        quint16 sum = checksum(pIcmp, static_cast<std::size_t>(packet.size() - 20));
+        std::memcpy(pIcmp + 2, &sum, sizeof(sum));
+        return packet;
+    }
+
+    // A message with a kernel receive timestamp control message
+    class TimestampedMessage
+    {
+    public:
+        TimestampedMessage(const timespec &timestamp)
+        {
+            message.msg_control = _control.data();
+            message.msg_controllen = _control.size();
+            cmsghdr *pCmsg = CMSG_FIRSTHDR(&message);
+            pCmsg->cmsg_level = SOL_SOCKET;
+#if defined(SCM_TIMESTAMPNS)
+            pCmsg->cmsg_type = SCM_TIMESTAMPNS;
+            pCmsg->cmsg_len = CMSG_LEN(sizeof(timestamp));
+            std::memcpy(CMSG_DATA(pCmsg), &timestamp, sizeof(timestamp));
+#else
+            timeval timestampTv{};
+            timestampTv.tv_sec = timestamp.tv_sec;
+            timestampTv.tv_usec = static_cast<decltype(timestampTv.tv_usec)>(timestamp.tv_nsec / 1000);
+            pCmsg->cmsg_type = SCM_TIMESTAMP;
+            pCmsg->cmsg_len = CMSG_LEN(sizeof(timestampTv));
+            std::memcpy(CMSG_DATA(pCmsg), &timestampTv, sizeof(timestampTv));
+#endif
+        }
+        TimestampedMessage(const TimestampedMessage &) = delete;
+        TimestampedMessage &operator=(const TimestampedMessage &) = delete;
+
+    public:
+        msghdr message{};
+
+    private:
+        alignas(cmsghdr) std::array<quint8, CMSG_SPACE(sizeof(timespec))> _control{};
+    };
+
+    // Collects the replies emitted by a PosixPing
+    class ReplyRecorder
+    {
+    public:
+        ReplyRecorder(PosixPing &ping)
+        {
+            QObject::connect(&ping, &PosixPing::receivedReply, &_context,
+                [this](quint32 address, std::chrono::microseconds roundTrip)
+                {
+                    replies.push_back({address, roundTrip});
+                });
+        }
+
+    public:
+        std::vector<std::pair<quint32, std::chrono::microseconds>> replies;
+
+    private:
+        QObject _context;
+    };
+}
+
+class tst_posixping : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Send an echo and return the time range it could have been sent in
+    std::pair<Clock::time_point, Clock::time_point> sendEcho(PosixPing &ping, quint32 address)
+    {
+        auto before = Clock::now();
+        ping.sendEchoRequest(address);
+        return {before, Clock::now()};
+    }
+
+    void processReply(PosixPing &ping, const QByteArray &packet, Clock::time_point received)
+    {
+        ping.processPacket(reinterpret_cast<const quint8*>(packet.constData()),
+                           static_cast<std::size_t>(packet.size()), received);
+    }
+
+    // Verify that a round trip time was measured from the local send time
+    void verifyRoundTrip(std::chrono::microseconds roundTrip,
+                         const std::pair<Clock::time_point, Clock::time_point> &sent)
+    {
+        QVERIFY(roundTrip >= replyDelay);
+        QVERIFY(roundTrip <= replyDelay + (sent.second - sent.first));
+    }
+
+private slots:
+    // The kernel timestamp is converted to the steady clock by its age
+    void testReceiveTime()
+    {
+        const timespec realtimeNow{1000, 2000000};
+        const Clock::time_point steadyNow{std::chrono::hours{1}};
+
+        // No timestamp - the current time is used
+        msghdr noTimestamp{};
+        QCOMPARE(PosixPing::receiveTime(noTimestamp, realtimeNow, steadyNow), steadyNow);
+
+        // Received 5 ms ago
+        TimestampedMessage earlier{timespec{999, 997000000}};
+        QCOMPARE(PosixPing::receiveTime(earlier.message, realtimeNow, steadyNow),
+                 steadyNow - std::chrono::milliseconds{5});
+
+        // A timestamp in the future means the realtime clock was stepped back;
+        // the current time is used
+        TimestampedMessage future{timespec{1060, 0}};
+        QCOMPARE(PosixPing::receiveTime(future.message, realtimeNow, steadyNow), steadyNow);
+    }
+
+    // Replies are matched to echoes by address and sequence number, and each
+    // echo is only measured once
+    void testMatchReplies()
+    {
+        PosixPing ping;
+        ReplyRecorder recorder{ping};
+        auto sent = sendEcho(ping, serverAddress);
+        auto received = sent.second + replyDelay;
+
+        // Not our identifier, not the address pinged, not the sequence sent
+        processReply(ping, buildReply(serverAddress, ping.identifier() ^ 1, 0), received);
+        processReply(ping, buildReply(otherAddress, ping.identifier(), 0), received);
+        processReply(ping, buildReply(serverAddress, ping.identifier(), 1), received);
+        QVERIFY(recorder.replies.empty());
+
+        processReply(ping, buildReply(serverAddress, ping.identifier(), 0), received);
+        QCOMPARE(recorder.replies.size(), std::size_t{1});
+        QCOMPARE(recorder.replies[0].first, serverAddress);
+        verifyRoundTrip(recorder.replies[0].second, sent);
+
+        // A duplicate reply isn't measured again
+        processReply(ping, buildReply(serverAddress, ping.identifier(), 0), received + replyDelay);
+        QCOMPARE(recorder.replies.size(), std::size_t{1});
+    }
+
+    // The payload of the reply isn't used to measure the round trip time; a
+    // forged send timestamp has no effect
+    void testPayloadIgnored()
+    {
+        PosixPing ping;
+        ReplyRecorder recorder{ping};
+        auto sent = sendEcho(ping, serverAddress);
+
+        // A timestamp an hour in the past, in the format ping(8) uses
+        timeval forged{};
+        ::gettimeofday(&forged, nullptr);
+        forged.tv_sec -= 3600;
+        QByteArray payload{reinterpret_cast<const char*>(&forged), sizeof(forged)};
+        payload.append(QByteArray(40, '\0'));
+
+        processReply(ping, buildReply(serverAddress, ping.identifier(), 0, payload),
+                     sent.second + replyDelay);
+        QCOMPARE(recorder.replies.size(), std::size_t{1});
+        verifyRoundTrip(recorder.replies[0].second, sent);
+    }
+
+    // Replies with small or empty payloads are still measured
+    void testShortPayload()
+    {
+        PosixPing ping;
+        ReplyRecorder recorder{ping};
+        auto sentEmpty = sendEcho(ping, serverAddress);
+        auto sentShort = sendEcho(ping, serverAddress);
+        auto received = sentShort.second + replyDelay;
+
+        processReply(ping, buildReply(serverAddress, ping.identifier(), 0, {}), received);
+        processReply(ping, buildReply(serverAddress, ping.identifier(), 1, QByteArray(4, '\0')), received);
+        QCOMPARE(recorder.replies.size(), std::size_t{2});
+        // The first echo could have been sent any time before the second
+        verifyRoundTrip(recorder.replies[0].second, {sentEmpty.first, sentShort.second});
+        verifyRoundTrip(recorder.replies[1].second, sentShort);
+    }
+
+    // A reply that appears to be received before the echo was sent is ignored
+    void testNegativeRoundTrip()
+    {
+        PosixPing ping;
+        ReplyRecorder recorder{ping};
+        auto sent = sendEcho(ping, serverAddress);
+
+        processReply(ping, buildReply(serverAddress, ping.identifier(), 0),
+                     sent.first - std::chrono::seconds{1});
+        QVERIFY(recorder.replies.empty());
+    }
+
+    // Truncated packets are ignored
+    void testTruncatedPacket()
+    {
+        PosixPing ping;
+        ReplyRecorder recorder{ping};
+        auto sent = sendEcho(ping, serverAddress);
+        const QByteArray reply = buildReply(serverAddress, ping.identifier(), 0);
+
+        // Partial IP header, partial ICMP header
+        processReply(ping, reply.left(12), sent.second + replyDelay);
+        processReply(ping, reply.left(24), sent.second + replyDelay);
+        QVERIFY(recorder.replies.empty());
+
+        // The echo is still pending, the complete reply is measured
+        processReply(ping, reply, sent.second + replyDelay);
+        QCOMPARE(recorder.replies.size(), std::size_t{1});
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_posixping)
+#include TEST_MOC
@@ -0,0 +1,255 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include <QtTest>
+
+#include "linux/linux_proc_fs.h"
+#include "linux/linux_proc_index.h"
+#include <algorithm>
+
+namespace
+{
+    using Group = ProcAppIndex::Group;
+
+    // Build a fake /proc tree - a directory per PID containing an 'exe'
+    // symlink.  The links don't have to resolve, only the link text is read.
+    class FakeProc
+    {
+    public:
+        bool isValid() const {return _dir.isValid();}
+        QString path() const {return _dir.path();}
+
+        bool addProcess(pid_t pid, const QString &exePath)
+        {
+            QString pidDir = _dir.filePath(QString::number(pid));
+            return QDir{}.mkdir(pidDir) &&
+                QFile::link(exePath, pidDir + QStringLiteral("/exe"));
+        }
+
+        bool addEntry(const QString &name)
+        {
+            return QDir{}.mkdir(_dir.filePath(name));
+        }
+
+    private:
+        QTemporaryDir _dir;
+    };
+
+    QString appPath(int app)
+    {
+        return QStringLiteral("/opt/app%1/bin/app").arg(app);
+    }
+
+    std::vector<pid_t> sorted(std::vector<pid_t> pids)
+    {
+        std::sort(pids.begin(), pids.end());
+        return pids;
+    }
+
+    // The per-app scan used before the index - each app scans all of /proc
+    std::vector<pid_t> scanPidsForPath(const QString &procDir, const QString &path)
+    {
+        QDir dir{procDir};
+        dir.setFilter(QDir::Dirs);
+        dir.setNameFilters({"[1-9]*"});
+
+        std::vector<pid_t> pids;
+        for(const auto &entry : dir.entryList())
+        {
+            if(QFile::symLinkTarget(dir.filePath(entry + QStringLiteral("/exe"))) == path)
+                pids.push_back(entry.toInt());
+        }
+        return pids;
+    }
+
+    const int BenchmarkProcesses = 10000;
+    const int BenchmarkApps = 100;
+}
+
+class tst_procindex : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void indexPidsByPath()
+    {
+        FakeProc proc;
+        QVERIFY(proc.isValid());
+        QVERIFY(proc.addProcess(1, QStringLiteral("/sbin/init")));
+        QVERIFY(proc.addProcess(100, QStringLiteral("/usr/bin/firefox")));
+        QVERIFY(proc.addProcess(101, QStringLiteral("/usr/bin/firefox")));
+        QVERIFY(proc.addProcess(250, QStringLiteral("/usr/bin/curl")));
+        // Non-PID entries are ignored
+        QVERIFY(proc.addEntry(QStringLiteral("self")));
+        QVERIFY(proc.addEntry(QStringLiteral("sys")));
+        QVERIFY(proc.addEntry(QStringLiteral("12ab")));
+        // A process whose exe can't be read (kernel threads, exited
+        // processes) is ignored
+        QVERIFY(proc.addEntry(QStringLiteral("300")));
+
+        auto index = ProcFs::indexPidsByPath(proc.path());
+        QCOMPARE(index.size(), std::size_t{3});
+        QCOMPARE(sorted(index[QStringLiteral("/usr/bin/firefox")]), (std::vector<pid_t>{100, 101}));
+        QCOMPARE(index[QStringLiteral("/usr/bin/curl")], (std::vector<pid_t>{250}));
+        QCOMPARE(index[QStringLiteral("/sbin/init")], (std::vector<pid_t>{1}));
+    }
+
+    void indexMissingProcDir()
+    {
+        QVERIFY(ProcFs::indexPidsByPath(QStringLiteral("/nonexistent/proc")).empty());
+    }
+
+    void addRemoveApps()
+    {
+        ProcAppIndex index;
+        index.addApp(QStringLiteral("/usr/bin/firefox"), Group::Exclusions);
+        index.addApp(QStringLiteral("/usr/bin/curl"), Group::VpnOnly);
+        // Adding an existing app has no effect, even for another group
+        index.addApp(QStringLiteral("/usr/bin/curl"), Group::Exclusions);
+
+        QVERIFY(index.appGroup(QStringLiteral("/usr/bin/firefox")));
+        QCOMPARE(*index.appGroup(QStringLiteral("/usr/bin/firefox")), Group::Exclusions);
+        QCOMPARE(*index.appGroup(QStringLiteral("/usr/bin/curl")), Group::VpnOnly);
+        QVERIFY(!index.appGroup(QStringLiteral("/usr/bin/wget")));
+        QCOMPARE(index.appsInGroup(Group::VpnOnly), (std::vector<QString>{QStringLiteral("/usr/bin/curl")}));
+
+        QVERIFY(index.addPid(100, QStringLiteral("/usr/bin/firefox")));
+        QVERIFY(index.addPid(101, QStringLiteral("/usr/bin/firefox")));
+        QVERIFY(index.addPid(200, QStringLiteral("/usr/bin/curl")));
+        QVERIFY(!index.addPid(300, QStringLiteral("/usr/bin/wget")));
+        QCOMPARE(index.pidCount(), std::size_t{3});
+
+        QCOMPARE(sorted(index.removeApp(QStringLiteral("/usr/bin/firefox"))), (std::vector<pid_t>{100, 101}));
+        QVERIFY(!index.appGroup(QStringLiteral("/usr/bin/firefox")));
+        QCOMPARE(index.appForPid(100), QString{});
+        QCOMPARE(index.pidCount(), std::size_t{1});
+        QVERIFY(index.removeApp(QStringLiteral("/usr/bin/firefox")).empty());
+
+        index.clear();
+        QCOMPARE(index.pidCount(), std::size_t{0});
+        QVERIFY(index.appsInGroup(Group::VpnOnly).empty());
+    }
+
+    void processEvents()
+    {
+        ProcAppIndex index;
+        index.addApp(QStringLiteral("/usr/bin/bash"), Group::Exclusions);
+        index.addApp(QStringLiteral("/usr/bin/curl"), Group::Exclusions);
+
+        QVERIFY(index.addPid(100, QStringLiteral("/usr/bin/bash")));
+        QCOMPARE(index.appForPid(100), QStringLiteral("/usr/bin/bash"));
+
+        // The process exec()s another tracked app - it moves to that app
+        QVERIFY(index.addPid(100, QStringLiteral("/usr/bin/curl")));
+        QCOMPARE(index.appForPid(100), QStringLiteral("/usr/bin/curl"));
+        QCOMPARE(index.pidCount(), std::size_t{1});
+        QVERIFY(index.removeApp(QStringLiteral("/usr/bin/bash")).empty());
+
+        // Exit removes it; exits of untracked PIDs are ignored
+        index.removePid(100);
+        index.removePid(12345);
+        QCOMPARE(index.appForPid(100), QString{});
+        QCOMPARE(index.pidCount(), std::size_t{0});
+        QVERIFY(index.removeApp(QStringLiteral("/usr/bin/curl")).empty());
+    }
+
+    // Compare finding the PIDs of 100 apps among 10k processes by scanning
+    // /proc for each app with indexing /proc once.
+    void benchmarkAddApps_data()
+    {
+        QTest::addColumn<bool>("useIndex");
+        QTest::newRow("perApp") << false;
+        QTest::newRow("index") << true;
+    }
+    void benchmarkAddApps()
+    {
+        QFETCH(bool, useIndex);
+
+        // Half the processes belong to configured apps, the rest to other
+        // executables
+        FakeProc proc;
+        QVERIFY(proc.isValid());
+        for(int i = 0; i < BenchmarkProcesses; ++i)
+        {
+            pid_t pid = 1000 + i;
+            QString exe = (i % 2) ? appPath((i / 2) % BenchmarkApps) :
+                QStringLiteral("/usr/bin/other%1").arg(i);
+            QVERIFY(proc.addProcess(pid, exe));
+        }
+
+        std::size_t pidCount{0};
+        if(useIndex)
+        {
+            QBENCHMARK
+            {
+                ProcAppIndex index;
+                auto exePids = ProcFs::indexPidsByPath(proc.path());
+                for(int app = 0; app < BenchmarkApps; ++app)
+                {
+                    index.addApp(appPath(app), Group::Exclusions);
+                    for(pid_t pid : exePids[appPath(app)])
+                        index.addPid(pid, appPath(app));
+                }
+                pidCount = index.pidCount();
+            }
+        }
+        else
+        {
+            QBENCHMARK
+            {
+                ProcAppIndex index;
+                for(int app = 0; app < BenchmarkApps; ++app)
+                {
+                    index.addApp(appPath(app), Group::Exclusions);
+                    for(pid_t pid : scanPidsForPath(proc.path(), appPath(app)))
+                        index.addPid(pid, appPath(app));
+                }
+                pidCount = index.pidCount();
+            }
+        }
+        QCOMPARE(pidCount, std::size_t{BenchmarkProcesses / 2});
+    }
+
+    // Process exec/exit events with 100 apps and 10k tracked processes -
+    // each event is O(1).
+    void benchmarkProcessEvents()
+    {
+        std::vector<QString> apps;
+        ProcAppIndex index;
+        for(int app = 0; app < BenchmarkApps; ++app)
+        {
+            apps.push_back(appPath(app));
+            index.addApp(apps.back(), Group::VpnOnly);
+        }
+        for(int i = 0; i < BenchmarkProcesses; ++i)
+            index.addPid(1000 + i, apps[i % BenchmarkApps]);
+
+        QBENCHMARK
+        {
+            for(int i = 0; i < BenchmarkProcesses; ++i)
+            {
+                index.removePid(1000 + i);
+                index.addPid(1000 + i, apps[i % BenchmarkApps]);
+            }
+        }
+        QCOMPARE(index.pidCount(), std::size_t{BenchmarkProcesses});
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_procindex)
+#include TEST_MOC
@@ -0,0 +1,180 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+
+#include "redactor.h"
+
+namespace
+{
+    // Synthetic redactions like those the daemon registers - dedicated IPs,
+    // DIP tokens, and CNs
+    std::unordered_map<QString, QString> buildRedactions(int dipCount)
+    {
+        std::unordered_map<QString, QString> redactions;
+        for(int i=0; i<dipCount; ++i)
+        {
+            redactions[QStringLiteral("172.%1.%2.%3").arg(i / 250 + 16).arg(i % 250).arg(i % 7 + 10)] =
+                QStringLiteral("<<DIP IP %1>>").arg(i);
+            redactions[QStringLiteral("DIP%1").arg(i * 7919, 29, 16, QChar{'0'})] =
+                QStringLiteral("<<DIP token %1>>").arg(i);
+            redactions[QStringLiteral("dip%1.pvdata.host").arg(i)] =
+                QStringLiteral("<<DIP CN %1>>").arg(i);
+        }
+        return redactions;
+    }
+
+    // Log text resembling daemon log output; a few lines contain redacted
+    // values
+    QString buildLogText(int lineCount)
+    {
+        QString text;
+        for(int i=0; i<lineCount; ++i)
+        {
+            text += QStringLiteral("[2022-03-01 12:34:56.789][a3f1][daemon.connection][src/daemon/connection.cpp:%1][info] ")
+                .arg(i % 900 + 100);
+            if(i % 50 == 0)
+                text += QStringLiteral("Connecting to dedicated IP 172.16.%1.%2 (dip%1.pvdata.host)\n").arg(i % 250).arg(i % 7 + 10);
+            else
+                text += QStringLiteral("Measured latency 34ms to 10.%1.%2.1 for region us_california, retry %3\n")
+                    .arg(i % 200).arg(i % 13).arg(i % 5);
+        }
+        return text;
+    }
+
+    // The previous redaction implementation, for comparison
+    QString redactSequentially(const std::unordered_map<QString, QString> &redactions,
+                               QString text)
+    {
+        for(const auto &redaction : redactions)
+            text.replace(redaction.first, redaction.second);
+        return text;
+    }
+}
+
+class tst_redactor : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRedact()
+    {
+        Redactor redactor{{
+            {QStringLiteral("1.2.3.4"), QStringLiteral("<<IP>>")},
+            {QStringLiteral("secret"), QStringLiteral("<<token>>")},
+        }};
+        QCOMPARE(redactor.redact(QStringLiteral("connect to 1.2.3.4 with secret, then 1.2.3.4")),
+                 QStringLiteral("connect to <<IP>> with <<token>>, then <<IP>>"));
+        QCOMPARE(redactor.redact(QStringLiteral("nothing here")), QStringLiteral("nothing here"));
+        QCOMPARE(redactor.redact(QStringLiteral("secretsecret")), QStringLiteral("<<token>><<token>>"));
+        QCOMPARE(redactor.redact(QString{}), QString{});
+
+        // 8-bit text is redacted too
+        QCOMPARE(redactor.redact(QByteArrayLiteral("ip=1.2.3.4\n")), QByteArrayLiteral("ip=<<IP>>\n"));
+    }
+
+    void testOverlapping()
+    {
+        Redactor redactor{{
+            {QStringLiteral("10.0.0.1"), QStringLiteral("<<short>>")},
+            {QStringLiteral("10.0.0.12"), QStringLiteral("<<long>>")},
+            {QStringLiteral("0.12.5"), QStringLiteral("<<later>>")},
+            {QStringLiteral("abc"), QStringLiteral("<<abc>>")},
+            {QStringLiteral("bcd"), QStringLiteral("<<bcd>>")},
+        }};
+        // The longest match at a position is used
+        QCOMPARE(redactor.redact(QStringLiteral("10.0.0.12 10.0.0.1")),
+                 QStringLiteral("<<long>> <<short>>"));
+        // The leftmost match wins over an overlapping later one, even if the
+        // later one is longer
+        QCOMPARE(redactor.redact(QStringLiteral("10.0.0.12.5")), QStringLiteral("<<long>>.5"));
+        QCOMPARE(redactor.redact(QStringLiteral("abcd")), QStringLiteral("<<abc>>d"));
+        QCOMPARE(redactor.redact(QStringLiteral("xbcd")), QStringLiteral("x<<bcd>>"));
+    }
+
+    void testReplacementNotRescanned()
+    {
+        Redactor redactor{{
+            {QStringLiteral("user"), QStringLiteral("<<name>>")},
+            {QStringLiteral("name"), QStringLiteral("<<x>>")},
+            {QString{}, QStringLiteral("<<empty>>")},
+        }};
+        QCOMPARE(redactor.redact(QStringLiteral("user name")), QStringLiteral("<<name>> <<x>>"));
+    }
+
+    void testMatchesSequentialReplace()
+    {
+        // With redactions that don't overlap, the result is the same as
+        // replacing each redaction in turn
+        const auto redactions = buildRedactions(200);
+        const QString text = buildLogText(500);
+        Redactor redactor{redactions};
+        QString redacted = redactor.redact(text);
+        QCOMPARE(redacted, redactSequentially(redactions, text));
+        QVERIFY(redacted != text);
+    }
+
+    void benchmarkSequentialReplace()
+    {
+        const auto redactions = buildRedactions(200);
+        const QString text = buildLogText(2000);
+        QBENCHMARK
+        {
+            redactSequentially(redactions, text);
+        }
+    }
+
+    void benchmarkRedactor()
+    {
+        const auto redactions = buildRedactions(200);
+        const QString text = buildLogText(2000);
+        Redactor redactor{redactions};
+        QBENCHMARK
+        {
+            redactor.redact(text);
+        }
+    }
+
+    // The daemon redacts each trace separately, so most texts are one line
+    void benchmarkSequentialReplacePerLine()
+    {
+        const auto redactions = buildRedactions(200);
+        const auto lines = buildLogText(2000).split('\n');
+        QBENCHMARK
+        {
+            for(const auto &line : lines)
+                redactSequentially(redactions, line);
+        }
+    }
+
+    void benchmarkRedactorPerLine()
+    {
+        const auto redactions = buildRedactions(200);
+        const auto lines = buildLogText(2000).split('\n');
+        Redactor redactor{redactions};
+        QBENCHMARK
+        {
+            for(const auto &line : lines)
+                redactor.redact(line);
+        }
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_redactor)
+#include TEST_MOC
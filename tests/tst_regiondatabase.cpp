@@ -0,0 +1,244 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+#include <QJsonArray>
+#include "locations.h"
+#include "regiondatabase.h"
+#include "src/regionfixtures.h"
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace
+{
+    using RegionFixtures::buildRegionsList;
+    using RegionFixtures::buildShadowsocksList;
+
+    // Get the number of bytes currently allocated from the heap, or -1 if it
+    // can't be measured on this platform.
+    qint64 heapAllocated()
+    {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+        return static_cast<qint64>(mallinfo2().uordblks);
+#elif defined(__GLIBC__)
+        return static_cast<qint64>(static_cast<unsigned>(mallinfo().uordblks));
+#else
+        return -1;
+#endif
+    }
+
+    // About 5000 servers - 420 regions with 12 servers each, plus Shadowsocks
+    // servers for 42 of them
+    enum
+    {
+        SyntheticCountries = 42,
+        SyntheticRegionsPerCountry = 10,
+    };
+}
+
+class tst_regiondatabase : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Materializing the database reproduces the regions it was built from
+    void buildAndMaterialize()
+    {
+        const auto regions = buildModernRegions(buildRegionsList(4, 5),
+                                                buildShadowsocksList(4));
+        const auto database = RegionDatabase::build(regions);
+
+        QCOMPARE(database.locations().size(), regions.locations.size());
+        QCOMPARE(database.groups().size(), regions.groupTemplates.size());
+
+        const auto materialized = database.materialize();
+        QCOMPARE(materialized.locations.size(), regions.locations.size());
+        for(const auto &locationEntry : regions.locations)
+            QVERIFY(*materialized.locations.at(locationEntry.first) == *locationEntry.second);
+        for(const auto &groupEntry : regions.groupTemplates)
+            QVERIFY(materialized.groupTemplates.at(groupEntry.first) == groupEntry.second);
+    }
+
+    // Strings and port lists are only stored once
+    void interning()
+    {
+        const auto database = RegionDatabase::build(buildModernRegions(buildRegionsList(4, 5),
+                                                                       buildShadowsocksList(4)));
+
+        std::unordered_set<QString> distinctStrings;
+        for(quint32 i=0; i<database.stringCount(); ++i)
+            distinctStrings.insert(database.string(i));
+        QCOMPARE(distinctStrings.size(), database.stringCount());
+
+        // Each distinct port list is stored once - the four service groups and
+        // Shadowsocks (the empty list doesn't occupy any space)
+        QCOMPARE(database.ports().size(), std::size_t{4 + 4 + 1 + 2 + 1});
+    }
+
+    // Tables with out-of-range indices or offsets are rejected
+    void invalidTables()
+    {
+        // One string, "a"
+        const std::vector<quint32> offsets{0, 1};
+        const std::vector<quint16> data{'a'};
+
+        RegionDatabase::ServerRecord server{};
+        server.ip = 1;  // Only one string
+        QVERIFY_EXCEPTION_THROWN(RegionDatabase::fromTables(offsets, data, {}, {server}, {}, {}),
+                                 Error);
+
+        RegionDatabase::LocationRecord location{};
+        location.firstServer = 0;
+        location.serverCount = 2;   // Only one server
+        QVERIFY_EXCEPTION_THROWN(RegionDatabase::fromTables(offsets, data, {}, {RegionDatabase::ServerRecord{}}, {location}, {}),
+                                 Error);
+
+        RegionDatabase::ServerRecord badPorts{};
+        badPorts.portLists[0] = {2, 2};   // Only three ports
+        QVERIFY_EXCEPTION_THROWN(RegionDatabase::fromTables(offsets, data, {1, 2, 3}, {badPorts}, {}, {}),
+                                 Error);
+
+        // String offsets past the end of the data, or out of order
+        QVERIFY_EXCEPTION_THROWN(RegionDatabase::fromTables({0, 2}, data, {}, {}, {}, {}),
+                                 Error);
+        QVERIFY_EXCEPTION_THROWN(RegionDatabase::fromTables({0, 1, 0, 1}, data, {}, {}, {}, {}),
+                                 Error);
+    }
+
+    // Latencies are applied while materializing, so buildModernLocations()
+    // doesn't need to copy the locations again
+    void materializeLatencies()
+    {
+        const auto regions = buildModernRegions(buildRegionsList(4, 5),
+                                                buildShadowsocksList(4));
+        const auto database = RegionDatabase::build(regions);
+
+        LatencyMap latencies;
+        for(const auto &locationEntry : regions.locations)
+            latencies[locationEntry.first] = 50;
+
+        const auto materialized = database.materialize(latencies);
+        for(const auto &locationEntry : materialized.locations)
+            QCOMPARE(locationEntry.second->latency(), Optional<double>{50});
+
+        const auto locations = buildModernLocations(latencies, materialized, {}, {});
+        for(const auto &locationEntry : locations)
+            QVERIFY(locationEntry.second == materialized.locations.at(locationEntry.first));
+
+        // Strings are decoded once and shared by the materialized objects
+        QVERIFY(materialized.locations.at(QStringLiteral("region_0_0"))->country().constData() ==
+                materialized.locations.at(QStringLiteral("region_0_1"))->country().constData());
+    }
+
+    // Measure the heap memory the daemon holds for the regions - the cached
+    // regions plus the locations built from them with latencies (as held by
+    // DaemonState) - for a synthetic list of about 5000 servers.
+    //
+    // - "objects" keeps the cached regions as Location/Server objects
+    //   (ModernRegions); applying latencies copies each location.
+    // - "database" keeps the cached regions in a RegionDatabase and
+    //   materializes the locations with their latencies.
+    //
+    // The regions lists' JSON (held by DaemonData either way) is not counted.
+    void benchmarkMemory_data()
+    {
+        QTest::addColumn<bool>("database");
+        QTest::newRow("objects") << false;
+        QTest::newRow("database") << true;
+    }
+    void benchmarkMemory()
+    {
+        QFETCH(bool, database);
+
+        if(heapAllocated() < 0)
+            QSKIP("Heap usage can't be measured on this platform");
+
+        const auto regionsList = buildRegionsList(SyntheticCountries, SyntheticRegionsPerCountry);
+        const auto shadowsocksList = buildShadowsocksList(SyntheticCountries);
+        LatencyMap latencies;
+        for(int c=0; c<SyntheticCountries; ++c)
+        {
+            for(int r=0; r<SyntheticRegionsPerCountry; ++r)
+                latencies[QStringLiteral("region_%1_%2").arg(c).arg(r)] = c * 10 + r;
+        }
+
+        qint64 allocated{0};
+        LocationsById locations;
+        if(database)
+        {
+            // Build the database from temporary regions, so only the database
+            // and the locations remain allocated
+            qint64 before = heapAllocated();
+            auto pDatabase = std::make_unique<RegionDatabase>(RegionDatabase::build(buildModernRegions(regionsList, shadowsocksList)));
+            locations = buildModernLocations(latencies, pDatabase->materialize(latencies), {}, {});
+            allocated = heapAllocated() - before;
+            qInfo() << "Database estimates its own usage at" << pDatabase->memoryUsage() << "bytes";
+        }
+        else
+        {
+            qint64 before = heapAllocated();
+            auto pRegions = std::make_unique<ModernRegions>(buildModernRegions(regionsList, shadowsocksList));
+            locations = buildModernLocations(latencies, *pRegions, {}, {});
+            allocated = heapAllocated() - before;
+        }
+        QCOMPARE(locations.size(), std::size_t{SyntheticCountries * SyntheticRegionsPerCountry});
+
+        qInfo() << "Heap allocated:" << allocated << "bytes";
+        QTest::setBenchmarkResult(allocated, QTest::BytesAllocated);
+    }
+
+    // Compare the time to produce Location/Server objects from the database
+    // with building them from the regions list JSON.
+    void benchmarkRebuild_data()
+    {
+        QTest::addColumn<bool>("database");
+        QTest::newRow("json") << false;
+        QTest::newRow("database") << true;
+    }
+    void benchmarkRebuild()
+    {
+        QFETCH(bool, database);
+
+        const auto regionsList = buildRegionsList(SyntheticCountries, SyntheticRegionsPerCountry);
+        const auto shadowsocksList = buildShadowsocksList(SyntheticCountries);
+        const auto regionDatabase = RegionDatabase::build(buildModernRegions(regionsList, shadowsocksList));
+
+        std::size_t regionCount{0};
+        if(database)
+        {
+            QBENCHMARK
+            {
+                regionCount = regionDatabase.materialize().locations.size();
+            }
+        }
+        else
+        {
+            QBENCHMARK
+            {
+                regionCount = buildModernRegions(regionsList, shadowsocksList).locations.size();
+            }
+        }
+        QCOMPARE(regionCount, std::size_t{SyntheticCountries * SyntheticRegionsPerCountry});
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_regiondatabase)
+#include TEST_MOC
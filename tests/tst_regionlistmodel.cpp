@@ -0,0 +1,304 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include <QtTest>
+#include <QAbstractItemModelTester>
+
+#include "regionlistmodel.h"
+
+namespace
+{
+    QSharedPointer<Location> makeLocation(const QString &id, const QString &name,
+                                          const QString &country, double latency)
+    {
+        auto pLocation = QSharedPointer<Location>::create();
+        pLocation->id(id);
+        pLocation->name(name);
+        pLocation->country(country);
+        pLocation->latency(latency);
+        return pLocation;
+    }
+
+    CountryLocations makeCountry(std::vector<QSharedPointer<Location>> locations)
+    {
+        CountryLocations country;
+        country.locations(std::move(locations));
+        return country;
+    }
+
+    // Sample groups in latency order:
+    // - DE (single, Germany)
+    // - US (group: US East, US West)
+    // - JP (single, Japan)
+    std::vector<CountryLocations> sampleGroups(double deLatency = 20.0)
+    {
+        return {
+            makeCountry({makeLocation(QStringLiteral("de"), QStringLiteral("Germany"), QStringLiteral("DE"), deLatency)}),
+            makeCountry({makeLocation(QStringLiteral("us_east"), QStringLiteral("US East"), QStringLiteral("US"), 40.0),
+                         makeLocation(QStringLiteral("us_west"), QStringLiteral("US West"), QStringLiteral("US"), 80.0)}),
+            makeCountry({makeLocation(QStringLiteral("jp"), QStringLiteral("Japan"), QStringLiteral("JP"), 150.0)})
+        };
+    }
+
+    QStringList rowCountries(const QAbstractItemModel &model)
+    {
+        QStringList countries;
+        for(int i = 0; i < model.rowCount(); ++i)
+            countries.push_back(model.data(model.index(i, 0), RegionListModel::RegionCountryRole).toString());
+        return countries;
+    }
+
+    QString regionId(const QAbstractItemModel &model, int row)
+    {
+        return model.data(model.index(row, 0), RegionListModel::RegionRole)
+            .toJsonObject().value(QStringLiteral("id")).toString();
+    }
+
+    QStringList childIds(const QAbstractItemModel &model, int row)
+    {
+        QStringList ids;
+        const auto &children = model.data(model.index(row, 0), RegionListModel::RegionChildrenRole).toList();
+        for(const auto &child : children)
+        {
+            ids.push_back(child.toMap().value(QStringLiteral("subregion"))
+                .toJsonObject().value(QStringLiteral("id")).toString());
+        }
+        return ids;
+    }
+}
+
+class tst_regionlistmodel : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Countries become rows in the daemon's order; groups have children
+    void buildRows()
+    {
+        DaemonState state;
+        state.groupedLocations(sampleGroups());
+        RegionListModel model;
+        QAbstractItemModelTester tester{&model, QAbstractItemModelTester::FailureReportingMode::QtTest};
+        model.setDaemonState(&state);
+
+        QCOMPARE(rowCountries(model), (QStringList{"de", "us", "jp"}));
+        QCOMPARE(regionId(model, 0), QStringLiteral("de"));
+        QVERIFY(childIds(model, 0).isEmpty());
+        QCOMPARE(regionId(model, 1), QString{});
+        QCOMPARE(childIds(model, 1), (QStringList{"us_east", "us_west"}));
+    }
+
+    // A latency update that doesn't change the order only updates the rows
+    // that changed
+    void latencyUpdate()
+    {
+        DaemonState state;
+        state.groupedLocations(sampleGroups());
+        RegionListModel model;
+        QAbstractItemModelTester tester{&model, QAbstractItemModelTester::FailureReportingMode::QtTest};
+        model.setDaemonState(&state);
+
+        QSignalSpy changedSpy{&model, &QAbstractItemModel::dataChanged};
+        QSignalSpy movedSpy{&model, &QAbstractItemModel::rowsMoved};
+        QSignalSpy insertedSpy{&model, &QAbstractItemModel::rowsInserted};
+        QSignalSpy removedSpy{&model, &QAbstractItemModel::rowsRemoved};
+        QSignalSpy resetSpy{&model, &QAbstractItemModel::modelReset};
+
+        state.groupedLocations(sampleGroups(25.0));
+
+        QCOMPARE(changedSpy.size(), 1);
+        QCOMPARE(changedSpy[0][0].toModelIndex().row(), 0);
+        QCOMPARE(changedSpy[0][1].toModelIndex().row(), 0);
+        QCOMPARE(movedSpy.size(), 0);
+        QCOMPARE(insertedSpy.size(), 0);
+        QCOMPARE(removedSpy.size(), 0);
+        QCOMPARE(resetSpy.size(), 0);
+
+        // Identical content in new objects doesn't change anything
+        changedSpy.clear();
+        state.groupedLocations(sampleGroups(25.0));
+        QCOMPARE(changedSpy.size(), 0);
+    }
+
+    // Reordering moves rows rather than removing and inserting them
+    void reorder()
+    {
+        DaemonState state;
+        state.groupedLocations(sampleGroups());
+        RegionListModel model;
+        QAbstractItemModelTester tester{&model, QAbstractItemModelTester::FailureReportingMode::QtTest};
+        model.setDaemonState(&state);
+
+        QSignalSpy movedSpy{&model, &QAbstractItemModel::rowsMoved};
+        QSignalSpy insertedSpy{&model, &QAbstractItemModel::rowsInserted};
+        QSignalSpy removedSpy{&model, &QAbstractItemModel::rowsRemoved};
+
+        // Germany is now the slowest
+        auto groups = sampleGroups(200.0);
+        std::rotate(groups.begin(), groups.begin() + 1, groups.end());
+        state.groupedLocations(groups);
+
+        QCOMPARE(rowCountries(model), (QStringList{"us", "jp", "de"}));
+        QVERIFY(movedSpy.size() > 0);
+        QCOMPARE(insertedSpy.size(), 0);
+        QCOMPARE(removedSpy.size(), 0);
+    }
+
+    // Countries can be added and removed
+    void addRemove()
+    {
+        DaemonState state;
+        state.groupedLocations(sampleGroups());
+        RegionListModel model;
+        QAbstractItemModelTester tester{&model, QAbstractItemModelTester::FailureReportingMode::QtTest};
+        model.setDaemonState(&state);
+
+        auto groups = sampleGroups();
+        groups.erase(groups.begin() + 1);
+        groups.push_back(makeCountry({makeLocation(QStringLiteral("ca"), QStringLiteral("Canada"), QStringLiteral("CA"), 10.0)}));
+        std::rotate(groups.rbegin(), groups.rbegin() + 1, groups.rend());
+        state.groupedLocations(groups);
+
+        QCOMPARE(rowCountries(model), (QStringList{"ca", "de", "jp"}));
+    }
+
+    // The search term filters regions and groups
+    void search()
+    {
+        DaemonState state;
+        state.groupedLocations(sampleGroups());
+        RegionListModel model;
+        model.setDaemonState(&state);
+        RegionFilterModel filter;
+        QAbstractItemModelTester tester{&filter, QAbstractItemModelTester::FailureReportingMode::QtTest};
+        filter.setRegions(&model);
+
+        QCOMPARE(rowCountries(filter), (QStringList{"de", "us", "jp"}));
+
+        // Matching one region in a group displays it as a single region
+        filter.setSearchTerm(QStringLiteral("west"));
+        QCOMPARE(rowCountries(filter), (QStringList{"us"}));
+        QCOMPARE(regionId(filter, 0), QStringLiteral("us_west"));
+        QVERIFY(childIds(filter, 0).isEmpty());
+
+        // Matching more than one region keeps the group
+        filter.setSearchTerm(QStringLiteral("us "));
+        QCOMPARE(rowCountries(filter), (QStringList{"us"}));
+        QCOMPARE(childIds(filter, 0), (QStringList{"us_east", "us_west"}));
+
+        // Single regions match their region name, not the country
+        filter.setSearchTerm(QStringLiteral("JAP"));
+        QCOMPARE(rowCountries(filter), (QStringList{"jp"}));
+        filter.setSearchTerm(QStringLiteral("jp"));
+        QCOMPARE(filter.rowCount(), 0);
+
+        filter.setSearchTerm({});
+        QCOMPARE(filter.rowCount(), 3);
+    }
+
+    // Sorting by name sorts countries and the regions within them
+    void sortByName()
+    {
+        DaemonState state;
+        auto groups = sampleGroups();
+        // Put US West first in the group to check that regions are sorted
+        auto usLocations = groups[1].locations();
+        std::reverse(usLocations.begin(), usLocations.end());
+        groups[1].locations(usLocations);
+        state.groupedLocations(groups);
+
+        RegionListModel model;
+        model.setDaemonState(&state);
+        RegionFilterModel filter;
+        QAbstractItemModelTester tester{&filter, QAbstractItemModelTester::FailureReportingMode::QtTest};
+        filter.setRegions(&model);
+        filter.setLocale(QStringLiteral("en-US"));
+
+        filter.setSortKey(QStringLiteral("name"));
+        QCOMPARE(rowCountries(filter), (QStringList{"de", "jp", "us"}));
+        QCOMPARE(childIds(filter, 2), (QStringList{"us_east", "us_west"}));
+
+        // Latency order is the source order
+        filter.setSortKey(QStringLiteral("latency"));
+        QCOMPARE(rowCountries(filter), (QStringList{"de", "us", "jp"}));
+        QCOMPARE(childIds(filter, 1), (QStringList{"us_west", "us_east"}));
+    }
+
+    // The filter keeps up with source rows being updated, moved, inserted,
+    // and removed
+    void filterFollowsSource()
+    {
+        DaemonState state;
+        state.groupedLocations(sampleGroups());
+        RegionListModel model;
+        model.setDaemonState(&state);
+        RegionFilterModel filter;
+        QAbstractItemModelTester tester{&filter, QAbstractItemModelTester::FailureReportingMode::QtTest};
+        filter.setRegions(&model);
+        filter.setLocale(QStringLiteral("en-US"));
+        filter.setSortKey(QStringLiteral("name"));
+        filter.setSearchTerm(QStringLiteral("an"));  // Germany, Japan
+        QCOMPARE(rowCountries(filter), (QStringList{"de", "jp"}));
+
+        // Move Germany to the end and rename US West so it matches
+        auto groups = sampleGroups(200.0);
+        groups[1].locations()[1]->name(QStringLiteral("Anchorage"));
+        std::rotate(groups.begin(), groups.begin() + 1, groups.end());
+        state.groupedLocations(groups);
+        QCOMPARE(rowCountries(filter), (QStringList{"us", "de", "jp"}));
+        QCOMPARE(regionId(filter, 0), QStringLiteral("us_west"));
+
+        // Remove the US and add Canada
+        groups.erase(groups.begin());
+        groups.push_back(makeCountry({makeLocation(QStringLiteral("ca"), QStringLiteral("Canada"), QStringLiteral("CA"), 10.0)}));
+        state.groupedLocations(groups);
+        QCOMPARE(rowCountries(filter), (QStringList{"ca", "de", "jp"}));
+
+        // Back to latency order - the source order
+        filter.setSortKey(QStringLiteral("latency"));
+        QCOMPARE(rowCountries(filter), (QStringList{"jp", "de", "ca"}));
+    }
+
+    // The service filter removes regions lacking the service
+    void serviceFilter()
+    {
+        auto groups = sampleGroups();
+        Server ssServer;
+        ssServer.shadowsocksPorts({443});
+        ssServer.shadowsocksKey(QStringLiteral("key"));
+        ssServer.shadowsocksCipher(QStringLiteral("aes-128-gcm"));
+        groups[1].locations()[1]->servers({ssServer});
+        DaemonState state;
+        state.groupedLocations(groups);
+
+        RegionListModel model;
+        QAbstractItemModelTester tester{&model, QAbstractItemModelTester::FailureReportingMode::QtTest};
+        model.setDaemonState(&state);
+        model.setServiceFilter(QStringLiteral("shadowsocks"));
+
+        // US is left with one region, so it's a single region
+        QCOMPARE(rowCountries(model), (QStringList{"us"}));
+        QCOMPARE(regionId(model, 0), QStringLiteral("us_west"));
+
+        model.setServiceFilter({});
+        QCOMPARE(model.rowCount(), 3);
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_regionlistmodel)
+#include TEST_MOC
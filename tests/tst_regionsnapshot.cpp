@@ -0,0 +1,201 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "common.h"
+#include <QtTest>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QTemporaryDir>
+#include "locations.h"
+#include "regionsnapshot.h"
+#include "src/regionfixtures.h"
+
+namespace
+{
+    using RegionFixtures::buildRegionsList;
+    using RegionFixtures::buildShadowsocksList;
+
+    void compareRegions(const ModernRegions &actual, const ModernRegions &expected)
+    {
+        QCOMPARE(actual.locations.size(), expected.locations.size());
+        for(const auto &locationEntry : expected.locations)
+        {
+            auto itActual = actual.locations.find(locationEntry.first);
+            QVERIFY(itActual != actual.locations.end());
+            QVERIFY(*itActual->second == *locationEntry.second);
+        }
+        QCOMPARE(actual.groupTemplates.size(), expected.groupTemplates.size());
+        for(const auto &groupEntry : expected.groupTemplates)
+        {
+            auto itActual = actual.groupTemplates.find(groupEntry.first);
+            QVERIFY(itActual != actual.groupTemplates.end());
+            QVERIFY(itActual->second == groupEntry.second);
+        }
+    }
+
+    bool writeFile(const QString &path, const QByteArray &content)
+    {
+        QFile file{path};
+        return file.open(QFile::WriteOnly) && file.write(content) == content.size();
+    }
+}
+
+class tst_regionsnapshot : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Regions materialized from a snapshot are identical to the regions built
+    // from the JSON.
+    void roundTrip()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString path = dir.filePath(QStringLiteral("regions.snapshot"));
+
+        const auto built = buildModernRegions(buildRegionsList(5, 6),
+                                              buildShadowsocksList(5));
+        QVERIFY(!built.locations.empty());
+        const auto database = RegionDatabase::build(built);
+        QVERIFY(RegionSnapshot::write(path, database, QStringLiteral("source-1")));
+
+        RegionSnapshot snapshot;
+        QVERIFY(snapshot.open(path));
+        QCOMPARE(snapshot.sourceId(), QStringLiteral("source-1"));
+        const auto loaded = snapshot.database();
+        // The source ID is not part of the database
+        QVERIFY(loaded.stringOffsets() == database.stringOffsets());
+        QVERIFY(loaded.stringData() == database.stringData());
+        compareRegions(loaded.materialize(), built);
+
+        // Locations built from the snapshot are the same as those built from
+        // the JSON
+        LatencyMap latencies{{QStringLiteral("region_1_1"), 50}};
+        auto fromJson = buildModernLocations(latencies, buildRegionsList(5, 6),
+                                             buildShadowsocksList(5), {}, {});
+        auto fromSnapshot = buildModernLocations(latencies, loaded.materialize(),
+                                                 {}, {});
+        QCOMPARE(fromSnapshot.size(), fromJson.size());
+        for(const auto &locationEntry : fromJson)
+            QVERIFY(*fromSnapshot.at(locationEntry.first) == *locationEntry.second);
+    }
+
+    // Empty regions can be stored too
+    void emptyRegions()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString path = dir.filePath(QStringLiteral("regions.snapshot"));
+
+        QVERIFY(RegionSnapshot::write(path, {}, {}));
+        RegionSnapshot snapshot;
+        QVERIFY(snapshot.open(path));
+        QCOMPARE(snapshot.sourceId(), QString{});
+        QVERIFY(snapshot.database().empty());
+    }
+
+    // Missing, truncated, and damaged snapshots are rejected
+    void invalidSnapshots()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString path = dir.filePath(QStringLiteral("regions.snapshot"));
+
+        RegionSnapshot snapshot;
+        QVERIFY(!snapshot.open(path));
+
+        const QByteArray valid = RegionSnapshot::serialize(RegionDatabase::build(buildModernRegions(buildRegionsList(2, 2), {})),
+                                                           QStringLiteral("source"));
+
+        QVERIFY(writeFile(path, valid.left(40)));
+        QVERIFY(!snapshot.open(path));
+
+        QVERIFY(writeFile(path, valid.left(valid.size() - 1)));
+        QVERIFY(!snapshot.open(path));
+
+        // Damage a byte in the payload - detected by the checksum
+        QByteArray damaged{valid};
+        damaged[damaged.size() / 2] = static_cast<char>(damaged[damaged.size() / 2] ^ 0x5A);
+        QVERIFY(writeFile(path, damaged));
+        QVERIFY(!snapshot.open(path));
+
+        // Unknown format version
+        QByteArray newVersion{valid};
+        newVersion[8] = static_cast<char>(newVersion[8] + 1);
+        QVERIFY(writeFile(path, newVersion));
+        QVERIFY(!snapshot.open(path));
+
+        QVERIFY(writeFile(path, valid));
+        QVERIFY(snapshot.open(path));
+        QCOMPARE(snapshot.sourceId(), QStringLiteral("source"));
+    }
+
+    // Compare daemon startup paths for the cached regions list - parsing the
+    // JSON and building the regions, or loading the snapshot.
+    void benchmarkStartup_data()
+    {
+        QTest::addColumn<bool>("snapshot");
+        QTest::newRow("json") << false;
+        QTest::newRow("snapshot") << true;
+    }
+    void benchmarkStartup()
+    {
+        QFETCH(bool, snapshot);
+
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString jsonPath = dir.filePath(QStringLiteral("regionscache.json"));
+        const QString snapshotPath = dir.filePath(QStringLiteral("regions.snapshot"));
+
+        const auto regionsList = buildRegionsList(100, 10);
+        const auto shadowsocksList = buildShadowsocksList(100);
+        QJsonObject regionsCache{{QStringLiteral("cachedModernRegionsList"), regionsList},
+                                 {QStringLiteral("cachedModernShadowsocksList"), shadowsocksList}};
+        QVERIFY(writeFile(jsonPath, QJsonDocument{regionsCache}.toJson(QJsonDocument::Compact)));
+        QVERIFY(RegionSnapshot::write(snapshotPath,
+                                      RegionDatabase::build(buildModernRegions(regionsList, shadowsocksList)),
+                                      QStringLiteral("source")));
+
+        std::size_t regionCount{0};
+        if(snapshot)
+        {
+            QBENCHMARK
+            {
+                RegionSnapshot regionSnapshot;
+                QVERIFY(regionSnapshot.open(snapshotPath));
+                regionCount = regionSnapshot.database().materialize().locations.size();
+            }
+        }
+        else
+        {
+            QBENCHMARK
+            {
+                QFile file{jsonPath};
+                QVERIFY(file.open(QFile::ReadOnly));
+                const auto cache = QJsonDocument::fromJson(file.readAll()).object();
+                regionCount = buildModernRegions(cache.value(QStringLiteral("cachedModernRegionsList")).toObject(),
+                                                 cache.value(QStringLiteral("cachedModernShadowsocksList")).toArray())
+                    .locations.size();
+            }
+        }
+        QCOMPARE(regionCount, std::size_t{1000});
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_regionsnapshot)
+#include TEST_MOC
@@ -0,0 +1,373 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "daemon/src/resumabledownload.h"
+#include "testshim.h"
+#include "src/mocknetwork.h"
+#include <QtTest>
+
+/*
+
+=== ResumableDownload tests ===
+
+These tests cover resuming interrupted downloads with range requests, both
+within one ResumableDownload and with a new ResumableDownload (as after a
+daemon restart), and verification of the SHA-256 digest.
+
+*/
+
+namespace TestData
+{
+    const QUrl downloadUri{QStringLiteral("https://unit-test.privateinternetaccess.com/installer.run")};
+    const QByteArray etag{QByteArrayLiteral(R"("v1")")};
+
+    QByteArray makeBody()
+    {
+        QByteArray body;
+        for(int i=0; i<10000; ++i)
+            body += QByteArray::number(i) + '\n';
+        return body;
+    }
+    const QByteArray body{makeBody()};
+    const QByteArray bodySha256{QCryptographicHash::hash(body, QCryptographicHash::Algorithm::Sha256).toHex()};
+    // Amount of the body delivered before the connection is lost
+    const int half{body.size() / 2};
+}
+
+// Fixture providing a download into a temporary directory, and capturing the
+// requests sent and the result of the download.
+class DownloadFixture
+{
+public:
+    DownloadFixture()
+        : _consumeSpy{&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal}
+    {
+        QObject::connect(&MockNetworkManager::_replyConsumed, &ReplyConsumedSignal::signal,
+                         &_context, [this](const QNetworkRequest &req){_lastRequest = req;});
+    }
+
+public:
+    QString targetPath() const {return _tempDir.filePath(QStringLiteral("installer.run"));}
+    QString partPath() const {return targetPath() + ResumableDownload::partSuffix;}
+    QString statePath() const {return targetPath() + ResumableDownload::stateSuffix;}
+
+    std::unique_ptr<ResumableDownload> createDownload(const QByteArray &expectedSha256)
+    {
+        auto pDownload = std::make_unique<ResumableDownload>(TestData::downloadUri,
+                                                             targetPath(),
+                                                             expectedSha256);
+        _result.clear();
+        QObject::connect(pDownload.get(), &ResumableDownload::finished, &_context,
+                         [this](ResumableDownload::Result result){_result = result;});
+        return pDownload;
+    }
+
+    QByteArray readTarget() const
+    {
+        QFile target{targetPath()};
+        if(!target.open(QFile::OpenModeFlag::ReadOnly))
+            return {};
+        return target.readAll();
+    }
+
+public:
+    QTemporaryDir _tempDir;
+    // Context object for the connections above; disconnects them when the
+    // fixture is destroyed
+    QObject _context;
+    QSignalSpy _consumeSpy;
+    QNetworkRequest _lastRequest;
+    nullable_t<ResumableDownload::Result> _result;
+};
+
+// Queue a reply delivering the first half of the body with a 200 status.  The
+// test ends it with finishError() to simulate a lost connection.  If
+// withValidator is false, the server doesn't send an ETag.
+QPointer<MockNetworkReply> enqueueFirstHalf(bool withValidator = true)
+{
+    auto pReply = MockNetworkManager::enqueueReply(TestData::body.left(TestData::half));
+    pReply->setStatusCode(200);
+    pReply->setReplyHeader(QByteArrayLiteral("Content-Length"),
+                           QByteArray::number(TestData::body.size()));
+    if(withValidator)
+        pReply->setReplyHeader(QByteArrayLiteral("ETag"), TestData::etag);
+    return pReply;
+}
+
+// Queue a reply delivering the whole body with a 200 status.
+QPointer<MockNetworkReply> enqueueWhole()
+{
+    auto pReply = MockNetworkManager::enqueueReply(TestData::body);
+    pReply->setStatusCode(200);
+    return pReply;
+}
+
+// Queue a reply delivering the rest of the body with a 206 status.
+QPointer<MockNetworkReply> enqueueSecondHalf()
+{
+    auto pReply = MockNetworkManager::enqueueReply(TestData::body.mid(TestData::half));
+    pReply->setStatusCode(206);
+    pReply->setReplyHeader(QByteArrayLiteral("Content-Range"),
+                           QByteArrayLiteral("bytes ") + QByteArray::number(TestData::half) +
+                           '-' + QByteArray::number(TestData::body.size()-1) + '/' +
+                           QByteArray::number(TestData::body.size()));
+    pReply->setReplyHeader(QByteArrayLiteral("ETag"), TestData::etag);
+    return pReply;
+}
+
+class tst_resumabledownload : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init()
+    {
+        TestShim::installMock<QNetworkAccessManager, MockNetworkManager>();
+    }
+
+    void cleanup()
+    {
+        MockNetworkManager::clearQueuedReplies();
+    }
+
+    // Lose the connection partway through the download; it should resume from
+    // where it left off.
+    void testResumeAfterDrop()
+    {
+        DownloadFixture fixture;
+        QVERIFY(fixture._tempDir.isValid());
+        auto pDownload = fixture.createDownload(TestData::bodySha256);
+
+        auto pFirstReply = enqueueFirstHalf();
+        pDownload->start();
+        QCOMPARE(fixture._consumeSpy.size(), 1);
+        QVERIFY(!fixture._lastRequest.hasRawHeader(QByteArrayLiteral("Range")));
+        pFirstReply->finishError(QNetworkReply::NetworkError::RemoteHostClosedError);
+
+        // The data received so far are kept, and the download is retried.
+        QCOMPARE(pDownload->bytesReceived(), static_cast<qint64>(TestData::half));
+        QVERIFY(QFile::exists(fixture.partPath()));
+        QVERIFY(fixture._result.isNull());
+
+        auto pSecondReply = enqueueSecondHalf();
+        QVERIFY(fixture._consumeSpy.wait(3000));
+        QCOMPARE(fixture._lastRequest.rawHeader(QByteArrayLiteral("Range")),
+                 QByteArrayLiteral("bytes=") + QByteArray::number(TestData::half) + '-');
+        QCOMPARE(fixture._lastRequest.rawHeader(QByteArrayLiteral("If-Range")),
+                 TestData::etag);
+        emit pSecondReply->finished();
+
+        QVERIFY(!fixture._result.isNull());
+        QCOMPARE(fixture._result.get(), ResumableDownload::Result::Succeeded);
+        QCOMPARE(pDownload->sha256(), TestData::bodySha256);
+        QCOMPARE(fixture.readTarget(), TestData::body);
+        QVERIFY(!QFile::exists(fixture.partPath()));
+        QVERIFY(!QFile::exists(fixture.statePath()));
+    }
+
+    // Destroy the download after losing the connection, as if the daemon was
+    // restarted.  A new download for the same file resumes the partial data.
+    void testResumeAfterRestart()
+    {
+        DownloadFixture fixture;
+        QVERIFY(fixture._tempDir.isValid());
+        auto pDownload = fixture.createDownload(TestData::bodySha256);
+
+        auto pFirstReply = enqueueFirstHalf();
+        pDownload->start();
+        pFirstReply->finishError(QNetworkReply::NetworkError::RemoteHostClosedError);
+        pDownload.reset();
+        QVERIFY(QFile::exists(fixture.partPath()));
+        QVERIFY(QFile::exists(fixture.statePath()));
+
+        pDownload = fixture.createDownload(TestData::bodySha256);
+        auto pSecondReply = enqueueSecondHalf();
+        pDownload->start();
+        QCOMPARE(fixture._consumeSpy.size(), 2);
+        QCOMPARE(fixture._lastRequest.rawHeader(QByteArrayLiteral("Range")),
+                 QByteArrayLiteral("bytes=") + QByteArray::number(TestData::half) + '-');
+        QCOMPARE(fixture._lastRequest.rawHeader(QByteArrayLiteral("If-Range")),
+                 TestData::etag);
+        emit pSecondReply->finished();
+
+        // The digest covers the data from before the restart too
+        QVERIFY(!fixture._result.isNull());
+        QCOMPARE(fixture._result.get(), ResumableDownload::Result::Succeeded);
+        QCOMPARE(pDownload->sha256(), TestData::bodySha256);
+        QCOMPARE(fixture.readTarget(), TestData::body);
+    }
+
+    // If the server sends the whole file in response to a range request (the
+    // file changed, or ranges aren't supported), the partial data are
+    // discarded.
+    void testRangeIgnored()
+    {
+        DownloadFixture fixture;
+        QVERIFY(fixture._tempDir.isValid());
+        auto pDownload = fixture.createDownload(TestData::bodySha256);
+
+        auto pFirstReply = enqueueFirstHalf();
+        pDownload->start();
+        pFirstReply->finishError(QNetworkReply::NetworkError::RemoteHostClosedError);
+
+        auto pWholeReply = MockNetworkManager::enqueueReply(TestData::body);
+        pWholeReply->setStatusCode(200);
+        QVERIFY(fixture._consumeSpy.wait(3000));
+        QVERIFY(fixture._lastRequest.hasRawHeader(QByteArrayLiteral("Range")));
+        emit pWholeReply->finished();
+
+        QVERIFY(!fixture._result.isNull());
+        QCOMPARE(fixture._result.get(), ResumableDownload::Result::Succeeded);
+        QCOMPARE(fixture.readTarget(), TestData::body);
+    }
+
+    // Without a validator or digest, a change in the file between requests
+    // couldn't be detected, so the download starts over instead of resuming.
+    void testNoValidatorRetry()
+    {
+        DownloadFixture fixture;
+        QVERIFY(fixture._tempDir.isValid());
+        auto pDownload = fixture.createDownload({});
+
+        auto pFirstReply = enqueueFirstHalf(false);
+        pDownload->start();
+        pFirstReply->finishError(QNetworkReply::NetworkError::RemoteHostClosedError);
+
+        auto pWholeReply = enqueueWhole();
+        QVERIFY(fixture._consumeSpy.wait(3000));
+        QVERIFY(!fixture._lastRequest.hasRawHeader(QByteArrayLiteral("Range")));
+        emit pWholeReply->finished();
+
+        QVERIFY(!fixture._result.isNull());
+        QCOMPARE(fixture._result.get(), ResumableDownload::Result::Succeeded);
+        QCOMPARE(fixture.readTarget(), TestData::body);
+    }
+
+    // Same as above, but after a restart
+    void testNoValidatorRestart()
+    {
+        DownloadFixture fixture;
+        QVERIFY(fixture._tempDir.isValid());
+        auto pDownload = fixture.createDownload({});
+
+        auto pFirstReply = enqueueFirstHalf(false);
+        pDownload->start();
+        pFirstReply->finishError(QNetworkReply::NetworkError::RemoteHostClosedError);
+        pDownload.reset();
+
+        pDownload = fixture.createDownload({});
+        auto pWholeReply = enqueueWhole();
+        pDownload->start();
+        QCOMPARE(fixture._consumeSpy.size(), 2);
+        QVERIFY(!fixture._lastRequest.hasRawHeader(QByteArrayLiteral("Range")));
+        emit pWholeReply->finished();
+
+        QVERIFY(!fixture._result.isNull());
+        QCOMPARE(fixture._result.get(), ResumableDownload::Result::Succeeded);
+        QCOMPARE(fixture.readTarget(), TestData::body);
+    }
+
+    // With an expected digest, the download resumes even without a validator
+    // (a mix of two versions would fail verification).
+    void testDigestOnlyResume()
+    {
+        DownloadFixture fixture;
+        QVERIFY(fixture._tempDir.isValid());
+        auto pDownload = fixture.createDownload(TestData::bodySha256);
+
+        auto pFirstReply = enqueueFirstHalf(false);
+        pDownload->start();
+        pFirstReply->finishError(QNetworkReply::NetworkError::RemoteHostClosedError);
+        pDownload.reset();
+
+        pDownload = fixture.createDownload(TestData::bodySha256);
+        auto pSecondReply = enqueueSecondHalf();
+        pDownload->start();
+        QCOMPARE(fixture._lastRequest.rawHeader(QByteArrayLiteral("Range")),
+                 QByteArrayLiteral("bytes=") + QByteArray::number(TestData::half) + '-');
+        QVERIFY(!fixture._lastRequest.hasRawHeader(QByteArrayLiteral("If-Range")));
+        emit pSecondReply->finished();
+
+        QVERIFY(!fixture._result.isNull());
+        QCOMPARE(fixture._result.get(), ResumableDownload::Result::Succeeded);
+        QCOMPARE(fixture.readTarget(), TestData::body);
+    }
+
+    // Client errors fail immediately instead of being retried
+    void testClientErrorNotRetried()
+    {
+        DownloadFixture fixture;
+        QVERIFY(fixture._tempDir.isValid());
+        auto pDownload = fixture.createDownload(TestData::bodySha256);
+
+        auto pReply = MockNetworkManager::enqueueReply({});
+        pReply->setStatusCode(404);
+        pDownload->start();
+        pReply->finishError(QNetworkReply::NetworkError::ContentNotFoundError);
+
+        QVERIFY(!fixture._result.isNull());
+        QCOMPARE(fixture._result.get(), ResumableDownload::Result::Failed);
+        QCOMPARE(fixture._consumeSpy.size(), 1);
+    }
+
+    // Rate limiting is retried
+    void testRateLimitRetried()
+    {
+        DownloadFixture fixture;
+        QVERIFY(fixture._tempDir.isValid());
+        auto pDownload = fixture.createDownload(TestData::bodySha256);
+
+        auto pReply = MockNetworkManager::enqueueReply({});
+        pReply->setStatusCode(429);
+        pDownload->start();
+        pReply->finishError(QNetworkReply::NetworkError::UnknownContentError);
+        QVERIFY(fixture._result.isNull());
+
+        auto pWholeReply = enqueueWhole();
+        QVERIFY(fixture._consumeSpy.wait(3000));
+        emit pWholeReply->finished();
+
+        QVERIFY(!fixture._result.isNull());
+        QCOMPARE(fixture._result.get(), ResumableDownload::Result::Succeeded);
+    }
+
+    // A download that doesn't match the expected digest fails, and nothing is
+    // left behind.
+    void testChecksumMismatch()
+    {
+        DownloadFixture fixture;
+        QVERIFY(fixture._tempDir.isValid());
+        QByteArray wrongSha256{QCryptographicHash::hash(QByteArrayLiteral("wrong"),
+                                                        QCryptographicHash::Algorithm::Sha256).toHex()};
+        auto pDownload = fixture.createDownload(wrongSha256);
+
+        auto pReply = MockNetworkManager::enqueueReply(TestData::body);
+        pReply->setStatusCode(200);
+        pDownload->start();
+        emit pReply->finished();
+
+        QVERIFY(!fixture._result.isNull());
+        QCOMPARE(fixture._result.get(), ResumableDownload::Result::Failed);
+        QVERIFY(!QFile::exists(fixture.targetPath()));
+        QVERIFY(!QFile::exists(fixture.partPath()));
+        QVERIFY(!QFile::exists(fixture.statePath()));
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_resumabledownload)
+#include TEST_MOC
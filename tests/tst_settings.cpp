@@ -19,6 +19,7 @@
 #include "common.h"
 #include "settings/locations.h"
 #include "common/src/locations.h"
+#include "common/src/statepatch.h"
 #include <QtTest>
 
 namespace sample_docs {
@@ -470,6 +471,79 @@ private slots:
         QVERIFY(pAlUpd);
         QCOMPARE(pAlUpd->latency().get(), alLatency);
     }
+
+    // Location patches sent to clients should reproduce the daemon's
+    // locations, and should only contain the locations that changed.
+    void locationsPatch()
+    {
+        LocationsById base{buildModernLocations({}, sample_docs::twoLocations, {}, {}, {})};
+        QCOMPARE(base.size(), std::size_t{2});
+
+        // A full rebuild with new latencies creates new objects, but only the
+        // location with a new latency is in the patch
+        LatencyMap latencies;
+        latencies["al"] = 50.0;
+        LocationsById current{buildModernLocations(latencies, sample_docs::twoLocations, {}, {}, {})};
+        auto patch = StatePatch::buildLocationsPatch(base, current);
+        QCOMPARE(patch["set"].toObject().keys(), QStringList{"al"});
+        QVERIFY(patch["remove"].toArray().isEmpty());
+
+        LocationsById patched{base};
+        QVERIFY(StatePatch::applyLocationsPatch(patched, patch));
+        QCOMPARE(patched.size(), current.size());
+        for(const auto &locationEntry : current)
+            QVERIFY(compareLocationsValue(patched.at(locationEntry.first), locationEntry.second));
+        // The unchanged location keeps its existing object
+        QVERIFY(patched.at("ad") == base.at("ad"));
+
+        // Removed locations are removed
+        current.erase("ad");
+        patch = StatePatch::buildLocationsPatch(base, current);
+        QCOMPARE(patch["remove"].toArray(), QJsonArray{"ad"});
+        QVERIFY(StatePatch::applyLocationsPatch(patched, patch));
+        QCOMPARE(patched.size(), std::size_t{1});
+
+        // The patch can also be applied to a newer value
+        QVERIFY(StatePatch::applyLocationsPatch(patched, patch));
+        QVERIFY(compareLocationsValue(patched.at("al"), current.at("al")));
+    }
+
+    void groupedLocationsPatch()
+    {
+        LatencyMap latencies;
+        latencies["al"] = 50.0;
+        latencies["ad"] = 20.0;
+        LocationsById locations{buildModernLocations(latencies, sample_docs::twoLocations, {}, {}, {})};
+
+        DaemonState daemonState;
+        daemonState.availableLocations(locations);
+        std::vector<CountryLocations> grouped;
+        std::vector<QSharedPointer<Location>> dips;
+        buildGroupedLocations(locations, grouped, dips);
+        daemonState.groupedLocations(grouped);
+
+        QJsonObject statePatch
+        {
+            {"availableLocations", StatePatch::buildLocationsPatch({}, locations)},
+            {"groupedLocations", StatePatch::buildGroupedLayout(grouped)}
+        };
+
+        DaemonState clientState;
+        int groupedChanges = 0;
+        connect(&clientState, &DaemonState::groupedLocationsChanged, this,
+                [&](){++groupedChanges;});
+        QVERIFY(clientState.assign({}, [&](){
+            QVERIFY(StatePatch::applyStatePatch(clientState, statePatch));
+            // Change signals are deferred until the whole change is applied
+            QCOMPARE(groupedChanges, 0);
+        }));
+        QCOMPARE(groupedChanges, 1);
+        QVERIFY(clientState.availableLocations().size() == daemonState.availableLocations().size());
+        QCOMPARE(clientState.get("groupedLocations"), daemonState.get("groupedLocations"));
+        // Grouped locations refer to the client's available locations
+        const auto &pFirst = clientState.groupedLocations().front().locations().front();
+        QVERIFY(pFirst == clientState.availableLocations().at(pFirst->id()));
+    }
 };
 #undef COMMA
 QTEST_GUILESS_MAIN(tst_settings)
@@ -0,0 +1,196 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include <QtTest>
+
+#include "socksnegotiation.h"
+
+namespace
+{
+    using Action = SocksNegotiation::Action;
+    using Step = SocksNegotiation::Step;
+
+    const QByteArray password{QByteArrayLiteral("0123456789abcdef")};
+
+    // Process the next message from the front of data, which must have
+    // enough bytes
+    SocksNegotiation::Result processNext(SocksNegotiation &negotiation,
+                                         QByteArray &data)
+    {
+        int size = negotiation.nextMessageBytes();
+        QByteArray message = data.left(size);
+        data.remove(0, size);
+        return negotiation.processMessage(reinterpret_cast<const unsigned char*>(message.constData()),
+                                          static_cast<std::size_t>(message.size()),
+                                          SocksNegotiation::hashPassword(password));
+    }
+
+    QByteArray responseOf(const SocksNegotiation::Result &result)
+    {
+        return {reinterpret_cast<const char*>(result.response.data()),
+                static_cast<int>(result.responseSize)};
+    }
+
+    // Process messages until something other than Continue occurs
+    SocksNegotiation::Result processUntilAction(SocksNegotiation &negotiation,
+                                                QByteArray &data)
+    {
+        SocksNegotiation::Result result;
+        do
+            result = processNext(negotiation, data);
+        while(result.action == Action::Continue && negotiation.step() != Step::Done);
+        return result;
+    }
+
+    QByteArray greeting() {return QByteArrayLiteral("\x05\x02\x00\x02");}
+
+    QByteArray auth(const QByteArray &username, const QByteArray &password)
+    {
+        QByteArray data{"\x01", 1};
+        data.append(static_cast<char>(username.size()));
+        data.append(username);
+        data.append(static_cast<char>(password.size()));
+        data.append(password);
+        return data;
+    }
+}
+
+class tst_socksnegotiation : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Complete negotiation of an IPv4 CONNECT
+    void connectIPv4()
+    {
+        SocksNegotiation negotiation;
+        QByteArray data = greeting() +
+            auth(SocksNegotiation::username + "suffix", password) +
+            QByteArrayLiteral("\x05\x01\x00\x01\x0a\x00\x00\x01\x01\xbb");
+
+        auto result = processUntilAction(negotiation, data);
+        QCOMPARE(result.action, Action::Respond);
+        QCOMPARE(responseOf(result), QByteArrayLiteral("\x05\x02"));
+
+        result = processUntilAction(negotiation, data);
+        QCOMPARE(result.action, Action::Respond);
+        QCOMPARE(responseOf(result), QByteArrayLiteral("\x01\x00"));
+
+        result = processUntilAction(negotiation, data);
+        QCOMPARE(result.action, Action::Connect);
+        QCOMPARE(result.address, quint32{0x0A000001});
+        QCOMPARE(result.port, quint16{443});
+        QCOMPARE(negotiation.step(), Step::Done);
+        QVERIFY(data.isEmpty());
+    }
+
+    void rejectAuthMethods()
+    {
+        SocksNegotiation negotiation;
+        QByteArray data{QByteArrayLiteral("\x05\x01\x00")};
+        auto result = processUntilAction(negotiation, data);
+        QCOMPARE(result.action, Action::Reject);
+        QCOMPARE(responseOf(result), QByteArrayLiteral("\x05\xff"));
+    }
+
+    void rejectCredentials_data()
+    {
+        QTest::addColumn<QByteArray>("username");
+        QTest::addColumn<QByteArray>("password");
+        QTest::newRow("username") << QByteArrayLiteral("nobody") << password;
+        QTest::newRow("short username") << SocksNegotiation::username.left(1) << password;
+        QTest::newRow("password") << SocksNegotiation::username << QByteArrayLiteral("0123456789abcdeF");
+        QTest::newRow("empty password") << SocksNegotiation::username << QByteArray{};
+    }
+    void rejectCredentials()
+    {
+        QFETCH(QByteArray, username);
+        QFETCH(QByteArray, password);
+
+        SocksNegotiation negotiation;
+        QByteArray data = greeting() + auth(username, password);
+        QCOMPARE(processUntilAction(negotiation, data).action, Action::Respond);
+        auto result = processUntilAction(negotiation, data);
+        QCOMPARE(result.action, Action::Reject);
+        QCOMPARE(responseOf(result), QByteArrayLiteral("\x01\x01"));
+        QCOMPARE(negotiation.step(), Step::Done);
+    }
+
+    // Requests that are rejected with a CONNECT failure response
+    void rejectConnect_data()
+    {
+        QTest::addColumn<QByteArray>("request");
+        QTest::addColumn<int>("reply");
+        QTest::newRow("bind") << QByteArrayLiteral("\x05\x02\x00\x01")
+            << int{SocksNegotiation::Reply::CommandNotSupported};
+        QTest::newRow("domain") << QByteArrayLiteral("\x05\x01\x00\x03")
+            << int{SocksNegotiation::Reply::AddressTypeNotSupported};
+        QTest::newRow("ipv6") << QByteArrayLiteral("\x05\x01\x00\x04") + QByteArray{18, 0}
+            << int{SocksNegotiation::Reply::NetUnreachable};
+    }
+    void rejectConnect()
+    {
+        QFETCH(QByteArray, request);
+        QFETCH(int, reply);
+
+        SocksNegotiation negotiation;
+        QByteArray data = greeting() + auth(SocksNegotiation::username, password) + request;
+        QCOMPARE(processUntilAction(negotiation, data).action, Action::Respond);
+        QCOMPARE(processUntilAction(negotiation, data).action, Action::Respond);
+        auto result = processUntilAction(negotiation, data);
+        QCOMPARE(result.action, Action::Reject);
+        auto expected = SocksNegotiation::connectResponse(static_cast<SocksNegotiation::Reply>(reply));
+        QCOMPARE(result.responseSize, expected.size());
+        QVERIFY(result.response == expected);
+    }
+
+    // Unsupported protocol versions abort without a response
+    void abortVersion_data()
+    {
+        QTest::addColumn<QByteArray>("data");
+        QTest::newRow("greeting") << QByteArrayLiteral("\x04\x01");
+        QTest::newRow("auth") << greeting() + QByteArrayLiteral("\x02\x01");
+        QTest::newRow("connect") << greeting() + auth(SocksNegotiation::username, password) +
+            QByteArrayLiteral("\x04\x01\x00\x01");
+    }
+    void abortVersion()
+    {
+        QFETCH(QByteArray, data);
+
+        SocksNegotiation negotiation;
+        SocksNegotiation::Result result;
+        do
+            result = processUntilAction(negotiation, data);
+        while(result.action == Action::Respond);
+        QCOMPARE(result.action, Action::Abort);
+        QCOMPARE(result.responseSize, std::size_t{0});
+        QCOMPARE(negotiation.nextMessageBytes(), quint16{0});
+    }
+
+    void connectResponse()
+    {
+        auto response = SocksNegotiation::connectResponse(SocksNegotiation::Reply::Succeeded,
+                                                          0x7F000001, 0x1234);
+        QByteArray data{reinterpret_cast<const char*>(response.data()),
+                        static_cast<int>(response.size())};
+        QCOMPARE(data, QByteArrayLiteral("\x05\x00\x00\x01\x7f\x00\x00\x01\x12\x34"));
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_socksnegotiation)
+#include TEST_MOC
@@ -0,0 +1,210 @@
+// Copyright (c) 2022 Private Internet Access, Inc.
+//
+// This file is part of the Private Internet Access Desktop Client.
+//
+// The Private Internet Access Desktop Client is free software: you can
+// redistribute it and/or modify it under the terms of the GNU General Public
+// License as published by the Free Software Foundation, either version 3 of
+// the License, or (at your option) any later version.
+//
+// The Private Internet Access Desktop Client is distributed in the hope that
+// it will be useful, but WITHOUT ANY WARRANTY; without even the implied
+// warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with the Private Internet Access Desktop Client.  If not, see
+// <https://www.gnu.org/licenses/>.
+#include "common.h"
+#include <QtTest>
+#include <QNetworkProxy>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+#include "socksserver.h"
+#include <memory>
+
+namespace
+{
+    // Target server for the proxy.  Echoes everything it receives, optionally
+    // sending a greeting and closing the connection first.
+    class EchoServer : public QObject
+    {
+    public:
+        EchoServer(QByteArray greeting = {}, bool closeAfterGreeting = false)
+        {
+            _server.listen(QHostAddress::LocalHost);
+            connect(&_server, &QTcpServer::newConnection, this,
+                [this, greeting, closeAfterGreeting]()
+                {
+                    while(auto pSocket = _server.nextPendingConnection())
+                    {
+                        connect(pSocket, &QTcpSocket::readyRead, pSocket,
+                                [pSocket](){pSocket->write(pSocket->readAll());});
+                        connect(pSocket, &QTcpSocket::disconnected, pSocket,
+                                &QObject::deleteLater);
+                        if(!greeting.isEmpty())
+                            pSocket->write(greeting);
+                        if(closeAfterGreeting)
+                            pSocket->disconnectFromHost();
+                    }
+                });
+        }
+
+        quint16 port() const {return _server.serverPort();}
+
+    private:
+        QTcpServer _server;
+    };
+
+    // Connect a client socket to a target through the proxy
+    std::unique_ptr<QTcpSocket> connectThroughProxy(const SocksServer &proxy,
+                                                    quint16 targetPort)
+    {
+        auto pSocket = std::make_unique<QTcpSocket>();
+        pSocket->setProxy({QNetworkProxy::ProxyType::Socks5Proxy,
+                           QStringLiteral("127.0.0.1"), proxy.port(),
+                           QString::fromLatin1(SocksNegotiation::username),
+                           QString::fromLatin1(proxy.password())});
+        pSocket->connectToHost(QHostAddress{QHostAddress::LocalHost}, targetPort);
+        // The proxy runs on this thread, so wait with the event loop running
+        if(!QTest::qWaitFor([&](){return pSocket->state() == QAbstractSocket::ConnectedState ||
+                                         pSocket->state() == QAbstractSocket::UnconnectedState;}) ||
+           pSocket->state() != QAbstractSocket::ConnectedState)
+        {
+            return {};
+        }
+        return pSocket;
+    }
+
+    // Read from a socket until the expected number of bytes arrive
+    QByteArray readExpected(QTcpSocket &socket, int expectedSize, int timeoutMs = 5000)
+    {
+        QByteArray received;
+        QTest::qWaitFor([&]()
+            {
+                received += socket.readAll();
+                return received.size() >= expectedSize;
+            }, timeoutMs);
+        return received;
+    }
+}
+
+class tst_socksserver : public QObject
+{
+    Q_OBJECT
+
+private:
+    // Rows for relay mode - the QTcpSocket relay everywhere, and the splice
+    // relay on Linux
+    void addRelayRows()
+    {
+        QTest::addColumn<bool>("splice");
+        QTest::newRow("qtsocket") << false;
+#ifdef Q_OS_LINUX
+        QTest::newRow("splice") << true;
+#endif
+    }
+
+    void applyRelayMode(bool splice)
+    {
+#ifdef Q_OS_LINUX
+        SocksConnection::setSpliceRelayEnabled(splice);
+#else
+        Q_UNUSED(splice);
+#endif
+    }
+
+private slots:
+    void cleanup()
+    {
+        applyRelayMode(true);
+    }
+
+    // Relay data in both directions, including data large enough to fill
+    // socket buffers
+    void relayEcho_data() {addRelayRows();}
+    void relayEcho()
+    {
+        QFETCH(bool, splice);
+        applyRelayMode(splice);
+
+        EchoServer echo;
+        SocksServer proxy{QHostAddress{QHostAddress::LocalHost}, QStringLiteral("lo")};
+        QVERIFY(proxy.port());
+
+        auto pClient = connectThroughProxy(proxy, echo.port());
+        QVERIFY(pClient);
+
+        QByteArray small{QByteArrayLiteral("hello through the proxy")};
+        pClient->write(small);
+        QCOMPARE(readExpected(*pClient, small.size()), small);
+
+        QByteArray large;
+        large.reserve(4 * 1024 * 1024);
+        for(int i = 0; large.size() < 4 * 1024 * 1024; ++i)
+            large += QByteArray::number(i);
+        pClient->write(large);
+        QCOMPARE(readExpected(*pClient, large.size(), 30000), large);
+    }
+
+    // When the target sends data and disconnects, the client must receive
+    // all of it before being disconnected
+    void targetClosesFirst_data() {addRelayRows();}
+    void targetClosesFirst()
+    {
+        QFETCH(bool, splice);
+        applyRelayMode(splice);
+
+        QByteArray greeting{256 * 1024, 'g'};
+        EchoServer echo{greeting, true};
+        SocksServer proxy{QHostAddress{QHostAddress::LocalHost}, QStringLiteral("lo")};
+        QVERIFY(proxy.port());
+
+        auto pClient = connectThroughProxy(proxy, echo.port());
+        QVERIFY(pClient);
+
+        QByteArray received;
+        QVERIFY(QTest::qWaitFor([&]()
+            {
+                received += pClient->readAll();
+                return pClient->state() == QAbstractSocket::UnconnectedState;
+            }));
+        received += pClient->readAll();
+        QCOMPARE(received, greeting);
+    }
+
+    // Measure relay throughput - the client sends 16 MiB that's echoed back
+    // through the proxy.
+    void benchmarkRelay_data() {addRelayRows();}
+    void benchmarkRelay()
+    {
+        QFETCH(bool, splice);
+        applyRelayMode(splice);
+
+        EchoServer echo;
+        SocksServer proxy{QHostAddress{QHostAddress::LocalHost}, QStringLiteral("lo")};
+        QVERIFY(proxy.port());
+
+        auto pClient = connectThroughProxy(proxy, echo.port());
+        QVERIFY(pClient);
+
+        const QByteArray chunk{1024 * 1024, 'x'};
+        enum : qint64 {ChunkCount = 16};
+        qint64 received{0};
+        connect(pClient.get(), &QTcpSocket::readyRead, this,
+                [&](){received += pClient->readAll().size();});
+
+        QBENCHMARK
+        {
+            received = 0;
+            for(int i = 0; i < ChunkCount; ++i)
+                pClient->write(chunk);
+            QVERIFY(QTest::qWaitFor([&](){return received >= ChunkCount * chunk.size();}, 30000));
+        }
+        QCOMPARE(received, ChunkCount * chunk.size());
+    }
+};
+
+QTEST_GUILESS_MAIN(tst_socksserver)
+#include TEST_MOC